@@ -0,0 +1,238 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Microbenchmarks for the hot lib/ primitives, so scheduler
+ *              and parser changes can be quantified before deployment.
+ *              Each result is emitted as one JSON object per line for
+ *              tracking across versions.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "scheduler.h"
+#include "timer.h"
+#include "utils.h"
+#include "parser.h"
+#include "vector.h"
+#include "memory.h"
+#include "logger.h"
+
+/* Referenced by liblib.a but owned by the daemon proper */
+char *log_file_name;
+
+static struct timespec bench_begin;
+
+static void
+tic(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &bench_begin);
+}
+
+static double
+toc(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double)(now.tv_sec - bench_begin.tv_sec) +
+	       (double)(now.tv_nsec - bench_begin.tv_nsec) / 1e9;
+}
+
+static void
+emit(const char *name, size_t iterations, double secs)
+{
+	printf("{\"bench\": \"%s\", \"iterations\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f}\n",
+	       name, iterations, secs, secs > 0 ? (double)iterations / secs : 0);
+}
+
+static int
+bench_noop_thread(__attribute__((unused)) thread_t *thread)
+{
+	return 0;
+}
+
+/* thread_add_timer()/thread_fetch() throughput with num pending timers.
+ * The add pass registers timers an hour out, so the insert cost is
+ * measured against a fully populated queue; the fetch pass expires
+ * num immediate timers through the real dispatch path. */
+static void
+bench_scheduler(size_t num)
+{
+	thread_master_t *m;
+	thread_t fetch;
+	char name[64];
+	size_t i;
+	double secs;
+
+	m = thread_make_master();
+
+	tic();
+	for (i = 0; i < num; i++)
+		thread_add_timer(m, bench_noop_thread, NULL, TIMER_HZ * 3600 + i);
+	secs = toc();
+	snprintf(name, sizeof(name), "thread_add_timer_%zu", num);
+	emit(name, num, secs);
+
+	tic();
+	for (i = 0; i < num; i++)
+		thread_add_timer(m, bench_noop_thread, NULL, 0);
+	for (i = 0; i < num; i++) {
+		if (!thread_fetch(m, &fetch))
+			break;
+		thread_call(&fetch);
+	}
+	secs = toc();
+	snprintf(name, sizeof(name), "thread_fetch_%zu", num);
+	emit(name, num, secs);
+
+	thread_destroy_master(m);
+}
+
+/* in_csum() throughput over an MTU sized buffer */
+static void
+bench_in_csum(void)
+{
+	uint16_t buf[750];
+	volatile uint32_t sink = 0;
+	size_t i;
+	const size_t num = 1000000;
+	double secs;
+
+	for (i = 0; i < sizeof(buf) / sizeof(buf[0]); i++)
+		buf[i] = (uint16_t)(i * 2654435761U);
+
+	tic();
+	for (i = 0; i < num; i++)
+		sink += in_csum(buf, sizeof(buf), (uint32_t)i, NULL);
+	secs = toc();
+	(void)sink;
+
+	emit("in_csum_1500", num, secs);
+}
+
+/* alloc_strvec() throughput over roughly 10MB of synthetic keyword
+ * lines, the shape read_conf_file() feeds it */
+static void
+bench_alloc_strvec(void)
+{
+	static const char *lines[] = {
+		"virtual_ipaddress 192.168.200.16/24 dev eth0 label eth0:1",
+		"    delay_loop 6",
+		"    lb_algo rr ! inline comment",
+		"real_server 192.168.200.2 1358 {",
+		"notify_master \"/usr/local/bin/transition.sh master eth0\"",
+	};
+	vector_t *strvec;
+	size_t bytes = 0, num = 0, i;
+	double secs;
+
+	tic();
+	while (bytes < 10 * 1024 * 1024) {
+		i = num % (sizeof(lines) / sizeof(lines[0]));
+		strvec = alloc_strvec((char *)lines[i]);
+		if (strvec)
+			free_strvec(strvec);
+		bytes += strlen(lines[i]);
+		num++;
+	}
+	secs = toc();
+
+	emit("alloc_strvec_10MB", num, secs);
+}
+
+/* Simulated advert tick: for each mock instance rebuild the VRRP
+ * header checksum and send the advert on a UDP socket, approximating
+ * the per-instance cost of a send pass without the netlink and
+ * interface plumbing */
+#define BENCH_ADVERT_INSTANCES	1000
+#define BENCH_ADVERT_TICKS	100
+
+static void
+bench_advert_ticks(void)
+{
+	static uint8_t pkts[BENCH_ADVERT_INSTANCES][40];
+	struct sockaddr_in dst;
+	uint16_t csum;
+	size_t tick, i;
+	const size_t num = BENCH_ADVERT_INSTANCES * BENCH_ADVERT_TICKS;
+	double secs;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		fprintf(stderr, "bench: cannot create advert socket\n");
+		return;
+	}
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	dst.sin_port = htons(9);	/* discard */
+
+	for (i = 0; i < BENCH_ADVERT_INSTANCES; i++) {
+		memset(pkts[i], 0, sizeof(pkts[i]));
+		pkts[i][0] = 0x21;		/* version 2, type advert */
+		pkts[i][1] = (uint8_t)i;	/* vrid */
+		pkts[i][2] = 100;		/* priority */
+		pkts[i][3] = 1;			/* naddr */
+	}
+
+	tic();
+	for (tick = 0; tick < BENCH_ADVERT_TICKS; tick++) {
+		for (i = 0; i < BENCH_ADVERT_INSTANCES; i++) {
+			pkts[i][6] = pkts[i][7] = 0;
+			csum = in_csum((uint16_t *)pkts[i], sizeof(pkts[i]), 0, NULL);
+			pkts[i][6] = (uint8_t)(csum & 0xff);
+			pkts[i][7] = (uint8_t)(csum >> 8);
+
+			/* Errors (e.g. ICMP port unreachable feedback)
+			 * are of no interest here */
+			sendto(fd, pkts[i], sizeof(pkts[i]), 0,
+			       (struct sockaddr *)&dst, sizeof(dst));
+		}
+	}
+	secs = toc();
+
+	close(fd);
+
+	emit("advert_tick_1000_instances", num, secs);
+}
+
+int
+main(__attribute__((unused)) int argc, __attribute__((unused)) char **argv)
+{
+	bench_scheduler(1000);
+	bench_scheduler(10000);
+	bench_scheduler(100000);
+	bench_in_csum();
+	bench_alloc_strvec();
+	bench_advert_ticks();
+
+	return 0;
+}
@@ -0,0 +1,539 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        End-to-end failover latency timer. Watches a segment
+ *              through a packet socket with kernel receive timestamps,
+ *              optionally triggers a failover, and reports a per-phase
+ *              breakdown of the transition: last advert from the old
+ *              master, first advert from the new master, first GARP
+ *              for the VIP, ARP resolution of the VIP, first TCP SYN
+ *              answered from the VIP and kernel route convergence -
+ *              so we know which transition stage (garp, netlink, ipvs)
+ *              to optimize next instead of eyeballing ping loss.
+ *
+ *              ipset convergence is not probed - sets are host-local,
+ *              check them on the box itself.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <linux/if_packet.h>
+#include <linux/rtnetlink.h>
+
+#define IPPROTO_VRRP		112
+#define VRRP_PKT_ADVERT		1
+#define VRRP_PRIO_STOP		0
+
+struct arp_pkt {
+	struct arphdr hdr;
+	unsigned char sha[ETH_ALEN];
+	unsigned char spa[4];
+	unsigned char tha[ETH_ALEN];
+	unsigned char tpa[4];
+} __attribute__((packed));
+
+/* Transition timeline. Unset events have tv_sec == 0. */
+static struct timespec t_trigger;
+static struct timespec t_old_last;	/* last advert from the old master */
+static struct timespec t_old_stop;	/* priority-0 resign advert, if sent */
+static struct timespec t_new_first;	/* first advert from the new master */
+static struct timespec t_garp;		/* first gratuitous ARP for the VIP */
+static struct timespec t_arp;		/* VIP answered our ARP probe */
+static struct timespec t_syn;		/* VIP answered our TCP SYN */
+static struct timespec t_route;		/* kernel route to VIP changed nexthop */
+
+static in_addr_t vip;
+static in_addr_t old_master;		/* 0 = learn from the first advert */
+static in_addr_t new_master;
+static int vrid = -1;			/* -1 = any */
+static int probe_port = 80;
+static int probe_interval_ms = 2;
+static int timeout_s = 30;
+static const char *ifname;
+static const char *trigger_cmd;
+
+static int ifindex;
+static unsigned char if_hwaddr[ETH_ALEN];
+static in_addr_t if_addr;
+static uint32_t route_initial_oif;
+static bool route_initial_known;
+
+static void
+ts_now(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static double
+ts_delta_ms(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1e3 +
+	       (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+static void
+report_phase(const char *name, const struct timespec *ts)
+{
+	const struct timespec *base = t_trigger.tv_sec ? &t_trigger : &t_old_last;
+
+	if (!ts->tv_sec) {
+		printf("  %-28s -\n", name);
+		return;
+	}
+
+	printf("  %-28s %10.3f ms\n", name, ts_delta_ms(base, ts));
+}
+
+/* Open an AF_PACKET socket with kernel receive timestamping. We see
+ * every frame on the segment, so the one socket covers VRRP adverts,
+ * GARPs, replies to our ARP probes and the SYN-ACKs answering our
+ * TCP probes. */
+static int
+open_capture(void)
+{
+	struct sockaddr_ll sll;
+	int fd;
+	int one = 1;
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd < 0) {
+		perror("socket(AF_PACKET)");
+		exit(1);
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("bind(AF_PACKET)");
+		exit(1);
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+		perror("setsockopt(SO_TIMESTAMPNS)");
+		exit(1);
+	}
+
+	return fd;
+}
+
+static void
+get_if_details(int fd)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		fprintf(stderr, "unknown interface %s\n", ifname);
+		exit(1);
+	}
+	ifindex = ifr.ifr_ifindex;
+
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		perror("SIOCGIFHWADDR");
+		exit(1);
+	}
+	memcpy(if_hwaddr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	if (ioctl(fd, SIOCGIFADDR, &ifr) == 0)
+		if_addr = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+}
+
+static void
+send_arp_probe(int fd)
+{
+	struct sockaddr_ll sll;
+	struct arp_pkt arp;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_ifindex = ifindex;
+	sll.sll_halen = ETH_ALEN;
+	memset(sll.sll_addr, 0xff, ETH_ALEN);
+
+	memset(&arp, 0, sizeof(arp));
+	arp.hdr.ar_hrd = htons(ARPHRD_ETHER);
+	arp.hdr.ar_pro = htons(ETH_P_IP);
+	arp.hdr.ar_hln = ETH_ALEN;
+	arp.hdr.ar_pln = 4;
+	arp.hdr.ar_op = htons(ARPOP_REQUEST);
+	memcpy(arp.sha, if_hwaddr, ETH_ALEN);
+	memcpy(arp.spa, &if_addr, 4);
+	memcpy(arp.tpa, &vip, 4);
+
+	sendto(fd, &arp, sizeof(arp), 0, (struct sockaddr *)&sll, sizeof(sll));
+}
+
+/* Fire a non-blocking connect at the VIP. The handshake runs in the
+ * kernel; we timestamp the SYN-ACK when it shows up on the capture
+ * socket, so the probe socket itself is fire-and-forget. */
+static void
+send_tcp_probe(void)
+{
+	struct sockaddr_in sin;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = vip;
+	sin.sin_port = htons(probe_port);
+	connect(fd, (struct sockaddr *)&sin, sizeof(sin));
+	close(fd);
+}
+
+/* Ask the kernel for its route to the VIP. Used to spot nexthop/oif
+ * convergence on routed (non-broadcast-domain) observers. */
+static bool
+route_get_oif(uint32_t *oif)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtmsg rtm;
+		char attrbuf[64];
+	} req;
+	char buf[1024];
+	struct nlmsghdr *nlh;
+	struct rtattr *rta;
+	struct rtmsg *rtm;
+	int len, alen;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0)
+		return false;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)) + RTA_LENGTH(4);
+	req.nlh.nlmsg_type = RTM_GETROUTE;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.rtm.rtm_family = AF_INET;
+	req.rtm.rtm_dst_len = 32;
+	rta = (struct rtattr *)(((char *)&req) + NLMSG_LENGTH(sizeof(struct rtmsg)));
+	rta->rta_type = RTA_DST;
+	rta->rta_len = RTA_LENGTH(4);
+	memcpy(RTA_DATA(rta), &vip, 4);
+
+	if (send(fd, &req, req.nlh.nlmsg_len, 0) < 0 ||
+	    (len = recv(fd, buf, sizeof(buf), 0)) <= 0) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	nlh = (struct nlmsghdr *)buf;
+	if (!NLMSG_OK(nlh, (unsigned)len) || nlh->nlmsg_type != RTM_NEWROUTE)
+		return false;
+
+	rtm = NLMSG_DATA(nlh);
+	alen = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*rtm));
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen))
+		if (rta->rta_type == RTA_OIF) {
+			memcpy(oif, RTA_DATA(rta), 4);
+			return true;
+		}
+
+	return false;
+}
+
+static void
+check_route(void)
+{
+	uint32_t oif;
+
+	if (t_route.tv_sec)
+		return;
+
+	if (!route_get_oif(&oif))
+		return;
+
+	if (!route_initial_known) {
+		route_initial_oif = oif;
+		route_initial_known = true;
+		return;
+	}
+
+	if (oif != route_initial_oif)
+		ts_now(&t_route);
+}
+
+static bool
+all_done(void)
+{
+	return t_new_first.tv_sec && t_garp.tv_sec &&
+	       t_arp.tv_sec && t_syn.tv_sec;
+}
+
+static void
+handle_frame(const unsigned char *frame, int len, const struct timespec *ts)
+{
+	const struct ether_header *eth = (const struct ether_header *)frame;
+	const struct iphdr *iph;
+	const struct tcphdr *th;
+	const struct arp_pkt *arp;
+	const unsigned char *vrrp;
+	in_addr_t saddr, spa;
+
+	if (len < (int)sizeof(*eth))
+		return;
+
+	if (eth->ether_type == htons(ETH_P_ARP)) {
+		if (len < (int)(sizeof(*eth) + sizeof(*arp)))
+			return;
+		arp = (const struct arp_pkt *)(frame + sizeof(*eth));
+		memcpy(&spa, arp->spa, 4);
+		if (spa != vip)
+			return;
+
+		/* Gratuitous ARP: sender == target protocol address */
+		if (!memcmp(arp->spa, arp->tpa, 4)) {
+			if (!t_garp.tv_sec && (t_new_first.tv_sec || t_trigger.tv_sec))
+				t_garp = *ts;
+			return;
+		}
+
+		if (arp->hdr.ar_op == htons(ARPOP_REPLY) &&
+		    !memcmp(arp->tha, if_hwaddr, ETH_ALEN) &&
+		    !t_arp.tv_sec && t_new_first.tv_sec)
+			t_arp = *ts;
+		return;
+	}
+
+	if (eth->ether_type != htons(ETH_P_IP))
+		return;
+	if (len < (int)(sizeof(*eth) + sizeof(*iph)))
+		return;
+
+	iph = (const struct iphdr *)(frame + sizeof(*eth));
+	saddr = iph->saddr;
+
+	if (iph->protocol == IPPROTO_VRRP) {
+		vrrp = frame + sizeof(*eth) + iph->ihl * 4;
+		if (frame + len < vrrp + 4)
+			return;
+		if ((vrrp[0] & 0x0f) != VRRP_PKT_ADVERT)
+			return;
+		if (vrid >= 0 && vrrp[1] != vrid)
+			return;
+
+		if (!old_master && !t_trigger.tv_sec) {
+			old_master = saddr;
+			fprintf(stderr, "learned old master %s\n",
+				inet_ntoa(*(struct in_addr *)&old_master));
+		}
+
+		if (saddr == old_master) {
+			if (vrrp[2] == VRRP_PRIO_STOP && !t_old_stop.tv_sec)
+				t_old_stop = *ts;
+			else
+				t_old_last = *ts;
+			return;
+		}
+
+		if (!t_new_first.tv_sec && (t_old_last.tv_sec || t_old_stop.tv_sec)) {
+			t_new_first = *ts;
+			new_master = saddr;
+			fprintf(stderr, "new master %s\n",
+				inet_ntoa(*(struct in_addr *)&new_master));
+		}
+		return;
+	}
+
+	if (iph->protocol == IPPROTO_TCP && saddr == vip) {
+		if (len < (int)(sizeof(*eth) + iph->ihl * 4 + sizeof(*th)))
+			return;
+		th = (const struct tcphdr *)(frame + sizeof(*eth) + iph->ihl * 4);
+		if (th->source != htons(probe_port))
+			return;
+		/* Accept SYN-ACK or RST - either proves the address is live */
+		if ((th->syn && th->ack) || th->rst)
+			if (!t_syn.tv_sec && t_new_first.tv_sec)
+				t_syn = *ts;
+	}
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -i ifname -a vip [options]\n"
+		" -i ifname     interface to capture and probe on\n"
+		" -a vip        virtual IP address to track\n"
+		" -m addr       old master source address (default: learned)\n"
+		" -V vrid       only track this virtual router id\n"
+		" -P port       TCP port to probe on the vip (default 80)\n"
+		" -I ms         probe interval (default 2)\n"
+		" -x command    shell command triggering the failover; its start\n"
+		"               is the timing origin (default: passive, origin is\n"
+		"               the last advert from the old master)\n"
+		" -t seconds    give up after this long (default 30)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char frame[2048];
+	char cbuf[256];
+	struct timespec start, now, ts, *tsp;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	struct pollfd pfd;
+	double next_probe = 0, elapsed;
+	int cap_fd;
+	int opt;
+	int n;
+
+	while ((opt = getopt(argc, argv, "i:a:m:V:P:I:x:t:")) != -1) {
+		switch (opt) {
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'a':
+			vip = inet_addr(optarg);
+			break;
+		case 'm':
+			old_master = inet_addr(optarg);
+			break;
+		case 'V':
+			vrid = atoi(optarg);
+			break;
+		case 'P':
+			probe_port = atoi(optarg);
+			break;
+		case 'I':
+			probe_interval_ms = atoi(optarg);
+			break;
+		case 'x':
+			trigger_cmd = optarg;
+			break;
+		case 't':
+			timeout_s = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!ifname || !vip)
+		usage(argv[0]);
+
+	/* ifindex and addresses first - the capture socket binds to them */
+	n = socket(AF_INET, SOCK_DGRAM, 0);
+	get_if_details(n);
+	close(n);
+
+	cap_fd = open_capture();
+
+	check_route();			/* snapshot the pre-failover route */
+
+	if (trigger_cmd) {
+		ts_now(&t_trigger);
+		if (system(trigger_cmd) == -1)
+			perror("system");
+	}
+
+	ts_now(&start);
+	pfd.fd = cap_fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		ts_now(&now);
+		elapsed = ts_delta_ms(&start, &now);
+		if (elapsed >= timeout_s * 1e3 || all_done())
+			break;
+
+		if (elapsed >= next_probe &&
+		    (t_trigger.tv_sec || t_old_last.tv_sec || t_old_stop.tv_sec)) {
+			send_arp_probe(cap_fd);
+			send_tcp_probe();
+			check_route();
+			next_probe = elapsed + probe_interval_ms;
+		}
+
+		if (poll(&pfd, 1, probe_interval_ms) <= 0)
+			continue;
+
+		iov.iov_base = frame;
+		iov.iov_len = sizeof(frame);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		n = recvmsg(cap_fd, &msg, MSG_DONTWAIT);
+		if (n <= 0)
+			continue;
+
+		tsp = NULL;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SO_TIMESTAMPNS)
+				tsp = (struct timespec *)CMSG_DATA(cmsg);
+		if (!tsp) {
+			ts_now(&ts);
+			tsp = &ts;
+		}
+
+		handle_frame(frame, n, tsp);
+	}
+
+	if (!t_old_last.tv_sec && !t_trigger.tv_sec) {
+		fprintf(stderr, "no adverts seen - nothing to report\n");
+		return 1;
+	}
+
+	printf("failover timeline (origin: %s):\n",
+	       t_trigger.tv_sec ? "trigger command" : "last advert from old master");
+	report_phase("trigger", &t_trigger);
+	report_phase("last advert old master", &t_old_last);
+	report_phase("prio-0 resign advert", &t_old_stop);
+	report_phase("first advert new master", &t_new_first);
+	report_phase("first gratuitous ARP", &t_garp);
+	report_phase("VIP ARP resolved", &t_arp);
+	report_phase("VIP TCP SYN answered", &t_syn);
+	report_phase("route nexthop converged", &t_route);
+
+	return all_done() ? 0 : 2;
+}
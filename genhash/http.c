@@ -31,6 +31,7 @@
 #include "utils.h"
 #include "html.h"
 #include "timer.h"
+#include "crc32c.h"
 
 /* genhash includes */
 #include "include/http.h"
@@ -59,6 +60,32 @@
  *   finalize    /     epilog
  */
 
+/* CRC32C wrappers fitting the hash function vtable. The "digest" is
+ * the 4 CRC bytes most significant first, so the printed hex equals
+ * the numeric fingerprint value. */
+static void
+crc32c_hash_init(hash_context_t *ctx)
+{
+	ctx->crc = CRC32C_INIT;
+}
+
+static void
+crc32c_hash_update(hash_context_t *ctx, const void *buf, unsigned long len)
+{
+	ctx->crc = crc32c_update(ctx->crc, buf, len);
+}
+
+static void
+crc32c_hash_final(unsigned char *digest, hash_context_t *ctx)
+{
+	uint32_t crc = CRC32C_FINAL(ctx->crc);
+
+	digest[0] = (unsigned char)(crc >> 24);
+	digest[1] = (unsigned char)(crc >> 16);
+	digest[2] = (unsigned char)(crc >> 8);
+	digest[3] = (unsigned char)crc;
+}
+
 const hash_t hashes[hash_guard] = {
 	[hash_md5] = {
 		(hash_init_f) MD5_Init,
@@ -76,16 +103,28 @@ const hash_t hashes[hash_guard] = {
 		SHA_DIGEST_LENGTH,
 		"SHA1",
 		"SHA1SUM",
-	}
+	},
 #endif
+	[hash_crc32c] = {
+		crc32c_hash_init,
+		crc32c_hash_update,
+		crc32c_hash_final,
+		sizeof(uint32_t),
+		"CRC32C",
+		"CRC32C",
+	}
 };
 
 #define HASH_LENGTH(sock)	((sock)->hash->length)
 #define HASH_LABEL(sock)	((sock)->hash->label)
 #define HASH_INIT(sock)		((sock)->hash->init(&(sock)->context))
+/* Hashing is bounded by the content length and by any --bytes limit */
+#define HASH_LIMIT(sock) \
+	(req->hash_bytes != -1 && ((sock)->content_len == -1 || req->hash_bytes < (sock)->content_len) ? \
+	 req->hash_bytes : (sock)->content_len)
 #define HASH_UPDATE(sock, buf, len) \
-	if ((sock)->content_len == -1 || (sock)->rx_bytes < (sock)->content_len) \
-		((sock)->hash->update(&(sock)->context, (buf), (sock)->content_len == -1 || (sock)->content_len - (sock)->rx_bytes >= len ? len : (sock)->content_len - (sock)->rx_bytes))
+	if (HASH_LIMIT(sock) == -1 || (sock)->rx_bytes < HASH_LIMIT(sock)) \
+		((sock)->hash->update(&(sock)->context, (buf), HASH_LIMIT(sock) == -1 || HASH_LIMIT(sock) - (sock)->rx_bytes >= len ? len : HASH_LIMIT(sock) - (sock)->rx_bytes))
 #define HASH_FINAL(sock, digest) \
 	((sock)->hash->final((digest), &(sock)->context))
 
@@ -106,6 +145,14 @@ free_all(thread_t * thread)
 	 * => free the reserved thread
 	 */
 	req->response_time = timer_tol(timer_now());
+
+	/* In batch mode the pool slot moves on to the next URL */
+	if (req->url_file) {
+		sock_obj->buffer = NULL;
+		sock_next(sock_obj);
+		return;
+	}
+
 	thread_add_terminate_event(thread->master);
 }
 
@@ -113,7 +160,14 @@ free_all(thread_t * thread)
 int
 epilog(thread_t * thread)
 {
-	DBG("Timeout on URL : [%s]\n", req->url);
+	SOCK *sock_obj = THREAD_ARG(thread);
+
+	if (req->url_file) {
+		fprintf(stderr, "%s FAILED\n", sock_obj->url);
+		sock_obj->keep_alive = 0;
+	} else {
+		DBG("Timeout on URL : [%s]\n", req->url);
+	}
 	free_all(thread);
 	return 0;
 }
@@ -130,6 +184,17 @@ finalize(thread_t * thread)
 
 	/* Compute final hash digest */
 	HASH_FINAL(sock_obj, digest);
+
+	/* Batch mode emits one url -> hash line per fetch */
+	if (req->url_file) {
+		printf("%s ", sock_obj->url);
+		for (i = 0; i < digest_length; i++)
+			printf("%02x", digest[i]);
+		printf("\n");
+		free_all(thread);
+		return 0;
+	}
+
 	if (req->verbose) {
 		printf("\n");
 		printf(HTML_HASH);
@@ -140,7 +205,9 @@ finalize(thread_t * thread)
 	printf("%s = ", HASH_LABEL(sock_obj));
 	for (i = 0; i < digest_length; i++)
 		printf("%02x", digest[i]);
-	if (sock_obj->content_len != -1 && sock_obj->content_len != sock_obj->rx_bytes)
+	if (req->hash_bytes != -1)
+		printf ("\n(hash limited to the first %zd bytes of the body)", req->hash_bytes);
+	else if (sock_obj->content_len != -1 && sock_obj->content_len != sock_obj->rx_bytes)
 		printf ("\nWARNING - Content-Length (%ld) does not match received bytes (%ld).", sock_obj->content_len, sock_obj->rx_bytes);
 	printf("\n\n");
 
@@ -275,11 +342,28 @@ http_read_thread(thread_t * thread)
 		}
 
 		/* All the HTTP stream has been parsed */
+		sock_obj->keep_alive = 0;
 		finalize(thread);
 	} else {
 		/* Handle the response stream */
 		http_process_stream(sock_obj, (int)r);
 
+		/* With a --bytes limit we can stop once those bytes are hashed */
+		if (req->hash_bytes != -1 && sock_obj->extracted &&
+		    sock_obj->rx_bytes >= req->hash_bytes) {
+			sock_obj->keep_alive = 0;
+			return finalize(thread);
+		}
+
+		/* With keep-alive the server will not close the connection;
+		 * the response ends when Content-Length bytes are hashed */
+		if (req->url_file && sock_obj->extracted &&
+		    sock_obj->content_len != -1 &&
+		    sock_obj->rx_bytes >= sock_obj->content_len) {
+			sock_obj->keep_alive = 1;
+			return finalize(thread);
+		}
+
 		/*
 		 * Register next http stream reader.
 		 * Register itself to not perturbe global I/O multiplexer.
@@ -333,6 +417,7 @@ http_request_thread(thread_t * thread)
 	char *str_request;
 	char *request_host;
 	char *request_host_port;
+	char *url = sock_obj->url ? sock_obj->url : req->url;
 	int ret = 0;
 
 	/* Handle read timeout */
@@ -361,12 +446,13 @@ http_request_thread(thread_t * thread)
 
 	snprintf(str_request, GET_BUFFER_LENGTH,
 		 (req->dst && req->dst->ai_family == AF_INET6 && !req->vhost) ? REQUEST_TEMPLATE_IPV6 : REQUEST_TEMPLATE,
-		  req->url, request_host, request_host_port);
+		  url, request_host, request_host_port,
+		  req->url_file ? REQUEST_KEEPALIVE : "");
 
 	FREE(request_host_port);
 
 	/* Send the GET request to remote Web server */
-	DBG("Sending GET request [%s] on fd:%d\n", req->url, sock_obj->fd);
+	DBG("Sending GET request [%s] on fd:%d\n", url, sock_obj->fd);
 	if (req->ssl)
 		ret = ssl_send_request(sock_obj->ssl, str_request, (int)strlen(str_request));
 	else
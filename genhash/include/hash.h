@@ -25,6 +25,7 @@
 #define _HASH_H
 
 /* system includes */
+#include <stdint.h>
 #include <openssl/md5.h>
 #ifdef _WITH_SHA1_
 #include <openssl/sha.h>
@@ -37,6 +38,7 @@ enum feat_hashes {
 #ifdef _WITH_SHA1_
 	hash_sha1,
 #endif
+	hash_crc32c,
 	hash_guard,
 	hash_default = hash_md5,
 };
@@ -46,6 +48,7 @@ typedef union {
 #ifdef _WITH_SHA1_
 	SHA_CTX			sha;
 #endif
+	uint32_t		crc;
 	/* this is due to poor C standard/draft wording (wrapped):
 	   https://groups.google.com/forum/#!msg/comp.lang.c/
 	   1kQMGXhgn4I/0VBEYG_ji44J */
@@ -38,14 +38,17 @@
 #define PROTO_HTTP	0x01
 #define PROTO_SSL	0x02
 
-/* GET processing command */
+/* GET processing command. The last %s carries the Connection header
+ * in batch mode, where the connection is reused for the next URL */
 #define REQUEST_TEMPLATE "GET %s HTTP/1.0\r\n" \
 			 "User-Agent: KeepAlive GenHash Client\r\n" \
-			 "Host: %s%s\r\n\r\n"
+			 "Host: %s%s\r\n%s\r\n"
 
 #define REQUEST_TEMPLATE_IPV6 "GET %s HTTP/1.0\r\n" \
 			 "User-Agent: KeepAlive GenHash Client\r\n" \
-			 "Host: [%s]%s\r\n\r\n"
+			 "Host: [%s]%s\r\n%s\r\n"
+
+#define REQUEST_KEEPALIVE "Connection: keep-alive\r\n"
 
 /* Output delimiters */
 #define DELIM_BEGIN		"-----------------------["
@@ -67,12 +67,15 @@ typedef struct {
 	char		ipaddress[INET6_ADDRSTRLEN];
 	uint16_t	addr_port;
 	char		*url;
+	char		*url_file;	/* batch mode - file of URLs to fetch */
+	unsigned	concurrency;	/* batch mode - max parallel fetches */
 	char		*vhost;
 	int		verbose;
 	int		ssl;
 	SSL_CTX		*ctx;
 	SSL_METHOD	*meth;
 	enum		feat_hashes hash;
+	ssize_t		hash_bytes;	/* hash only the first N body bytes, -1 = whole body */
 	unsigned long	ref_time;
 	unsigned long	response_time;
 #ifdef _WITH_SO_MARK_
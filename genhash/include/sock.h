@@ -38,6 +38,8 @@ typedef struct {
 	hash_context_t	context;
 	int		status;
 	int		lock;
+	char		*url;		/* batch mode - URL being fetched */
+	int		keep_alive;	/* connection usable for the next URL */
 	char		*buffer;
 	char		*extracted;
 	int		size;
@@ -52,5 +54,7 @@ extern SOCK *sock;
 /* Prototypes */
 extern void free_sock(SOCK *);
 extern void init_sock(void);
+extern int load_url_file(const char *);
+extern void sock_next(SOCK *);
 
 #endif
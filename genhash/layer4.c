@@ -153,7 +153,17 @@ tcp_connection_state(int fd, enum connect_result status, thread_t * thread,
 	switch (status) {
 	case connect_error:
 		close(fd);
-		thread_add_terminate_event(thread->master);
+		if (req->url_file) {
+			/* Batch mode - fail this URL, move the slot on */
+			SOCK *sock_obj = THREAD_ARG(thread);
+
+			fprintf(stderr, "%s FAILED\n", sock_obj->url);
+			exit_code = 1;
+			sock_obj->fd = -1;
+			sock_obj->keep_alive = 0;
+			sock_next(sock_obj);
+		} else
+			thread_add_terminate_event(thread->master);
 		break;
 
 	case connect_success:
@@ -181,16 +191,19 @@ tcp_check_thread(thread_t * thread)
 	sock_obj->status = tcp_socket_state(thread, tcp_check_thread);
 	switch (sock_obj->status) {
 	case connect_error:
-		DBG("Error connecting server [%s]:%d.\n",
-		    req->ipaddress, ntohs(req->addr_port));
-		thread_add_terminate_event(thread->master);
-		return -1;
-		break;
-
 	case connect_timeout:
-		DBG("Timeout connecting server [%s]:%d.\n",
+		DBG("%s connecting server [%s]:%d.\n",
+		    sock_obj->status == connect_error ? "Error" : "Timeout",
 		    req->ipaddress, ntohs(req->addr_port));
-		thread_add_terminate_event(thread->master);
+		if (req->url_file) {
+			/* Batch mode - fail this URL, move the slot on */
+			fprintf(stderr, "%s FAILED\n", sock_obj->url);
+			exit_code = 1;
+			sock_obj->fd = -1;
+			sock_obj->keep_alive = 0;
+			sock_next(sock_obj);
+		} else
+			thread_add_terminate_event(thread->master);
 		return -1;
 		break;
 
@@ -213,6 +226,13 @@ tcp_check_thread(thread_t * thread)
 					ssl_printerr(SSL_get_error
 						     (sock_obj->ssl, ret));
 				sock_obj->status = connect_error;
+				if (req->url_file) {
+					/* Batch mode - fail this URL, move the slot on */
+					fprintf(stderr, "%s FAILED\n", sock_obj->url);
+					exit_code = 1;
+					sock_obj->keep_alive = 0;
+					sock_next(sock_obj);
+				}
 				return -1;
 			}
 		}
@@ -241,7 +261,7 @@ tcp_connect_thread(thread_t * thread)
 	fcntl(sock_obj->fd, F_SETFD, fcntl(sock_obj->fd, F_GETFD) | FD_CLOEXEC);
 #endif
 
-	sock->status = tcp_connect(sock_obj->fd, req);
+	sock_obj->status = tcp_connect(sock_obj->fd, req);
 
 	/* handle tcp connection status & register check worker thread */
 	tcp_connection_state(sock_obj->fd, sock_obj->status, thread, tcp_check_thread,
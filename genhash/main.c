@@ -73,6 +73,7 @@ usage(const char *prog)
 	fprintf(stderr,
 		"Usage:\n"
 		"  %1$s -s server-address -p port -u url\n"
+		"  %1$s -s server-address -p port -f url-file [-c concurrency]\n"
 		"  %1$s -S -s server-address -p port -u url\n"
 		"  %1$s -h\n" "  %1$s -r\n\n", prog);
 	fprintf(stderr,
@@ -82,12 +83,15 @@ usage(const char *prog)
 		"  %1$s --server          -s       Use the specified remote server address.\n"
 		"  %1$s --port            -p       Use the specified remote server port.\n"
 		"  %1$s --url             -u       Use the specified remote server url.\n"
+		"  %1$s --url-file        -f       Fetch all urls listed in the specified file.\n"
+		"  %1$s --concurrency     -c       Number of concurrent fetches in batch mode (default 5).\n"
 		"  %1$s --use-virtualhost -V       Use the specified virtualhost in GET query.\n"
 		"  %1$s --hash            -H       Use the specified hash algorithm.\n"
 		"  %1$s --verbose         -v       Use verbose mode output.\n"
 		"  %1$s --help            -h       Display this short inlined help screen.\n"
 		"  %1$s --release         -r       Display the release number.\n"
-		"  %1$s --fwmark          -m       Use the specified FW mark.\n",
+		"  %1$s --fwmark          -m       Use the specified FW mark.\n"
+		"  %1$s --bytes           -n       Hash only the first N bytes of the body.\n",
 		prog);
 	fprintf(stderr, "\nSupported hash algorithms:\n");
 	for (i = hash_first; i < hash_guard; i++)
@@ -120,12 +124,15 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 		{"use-virtualhost", required_argument, 0, 'V'},
 		{"port",            required_argument, 0, 'p'},
 		{"url",             required_argument, 0, 'u'},
+		{"url-file",        required_argument, 0, 'f'},
+		{"concurrency",     required_argument, 0, 'c'},
 		{"fwmark",          required_argument, 0, 'm'},
+		{"bytes",           required_argument, 0, 'n'},
 		{0, 0, 0, 0}
 	};
 
 	/* Parse the command line arguments */
-	while ((c = getopt_long (argc, argv, "rhvSs:H:V:p:u:m:", long_options, NULL)) != EOF) {
+	while ((c = getopt_long (argc, argv, "rhvSs:H:V:p:u:f:c:m:n:", long_options, NULL)) != EOF) {
 		switch (c) {
 		case 'r':
 			fprintf(stderr, VERSION_STRING);
@@ -178,6 +185,16 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 		case 'u':
 			req_obj->url = optarg;
 			break;
+		case 'f':
+			req_obj->url_file = optarg;
+			break;
+		case 'c':
+			req_obj->concurrency = (unsigned)strtoul(optarg, NULL, 10);
+			if (!req_obj->concurrency) {
+				fprintf(stderr, "concurrency should be a positive number, not %s\n", optarg);
+				return CMD_LINE_ERROR;
+			}
+			break;
 		case 'm':
 #ifdef _WITH_SO_MARK_
 			req_obj->mark = (unsigned)strtoul(optarg, NULL, 10);
@@ -186,6 +203,13 @@ parse_cmdline(int argc, char **argv, REQ * req_obj)
 			return CMD_LINE_ERROR;
 #endif
 			break;
+		case 'n':
+			req_obj->hash_bytes = (ssize_t)strtol(optarg, NULL, 10);
+			if (req_obj->hash_bytes <= 0) {
+				fprintf(stderr, "number of bytes to hash should be a positive number, not %s\n", optarg);
+				return CMD_LINE_ERROR;
+			}
+			break;
 		default:
 			usage(argv[0]);
 			return CMD_LINE_ERROR;
@@ -208,7 +232,7 @@ int
 main(int argc, char **argv)
 {
 	thread_t thread;
-	char *url_default = malloc(2);
+	char *url_default = (char *) MALLOC(2);
 	url_default[0] = '/';
 	url_default[1] = '\0';
 
@@ -217,6 +241,8 @@ main(int argc, char **argv)
 
 	/* Preset (potentially) non-zero defaults */
 	req->hash = hash_default;
+	req->hash_bytes = -1;
+	req->concurrency = 5;
 
 	/* Command line parser */
 	if (!parse_cmdline(argc, argv, req)) {
@@ -226,7 +252,7 @@ main(int argc, char **argv)
 	}
 
 	/* Check minimum configuration need */
-	if (!req->dst && !req->addr_port && !req->url) {
+	if (!req->dst && !req->addr_port && !req->url && !req->url_file) {
 		FREE(url_default);
 		freeaddrinfo(req->dst);
 		FREE(req);
@@ -237,6 +263,14 @@ main(int argc, char **argv)
 		req->url = url_default;
 	}
 
+	/* Load the batch mode URL queue */
+	if (req->url_file && !load_url_file(req->url_file)) {
+		FREE(url_default);
+		freeaddrinfo(req->dst);
+		FREE(req);
+		exit(1);
+	}
+
 	/* Init the reference timer */
 	req->ref_time = timer_tol(timer_now());
 	DBG("Reference timer = %lu\n", req->ref_time);
@@ -265,14 +299,15 @@ main(int argc, char **argv)
 		thread_call(&thread);
 
 	/* Finalize output informations */
-	if (req->verbose)
+	if (req->verbose && !req->url_file)
 		printf("Global response time for [%s] =%lu\n",
 			    req->url, req->response_time - req->ref_time);
 
 	/* exit cleanly */
 	FREE(url_default);
 	SSL_CTX_free(req->ctx);
-	free_sock(sock);
+	if (sock)	/* batch mode pool slots free themselves */
+		free_sock(sock);
 	freeaddrinfo(req->dst);
 	FREE(req);
 	exit(exit_code);
@@ -39,6 +39,12 @@
 /* global var */
 SOCK *sock = NULL;
 
+/* Batch mode URL queue */
+static char **batch_urls;
+static size_t batch_nurls;
+static size_t batch_next;
+static unsigned batch_active;
+
 /* Close the descriptor */
 static void
 close_sock(SOCK * sock_obj)
@@ -60,10 +66,101 @@ free_sock(SOCK * sock_obj)
 	FREE(sock_obj);
 }
 
-/* Init socket handler */
+/* Load the batch mode URL queue. Empty lines and '#' comments are
+ * skipped */
+int
+load_url_file(const char *path)
+{
+	FILE *f;
+	char line[GET_BUFFER_LENGTH];
+	size_t alloc = 0, len;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Cannot open url file %s: %s\n",
+			path, strerror(errno));
+		return 0;
+	}
+
+	while (fgets(line, sizeof (line), f)) {
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (!len || line[0] == '#')
+			continue;
+
+		if (batch_nurls == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			batch_urls = REALLOC(batch_urls, alloc * sizeof (char *));
+		}
+
+		batch_urls[batch_nurls] = (char *) MALLOC(len + 1);
+		strcpy(batch_urls[batch_nurls], line);
+		batch_nurls++;
+	}
+
+	fclose(f);
+
+	if (!batch_nurls)
+		fprintf(stderr, "No urls found in %s\n", path);
+
+	return batch_nurls != 0;
+}
+
+/* Move a pool slot on to the next queued URL, reusing the connection
+ * when the previous response left it usable */
+void
+sock_next(SOCK * sock_obj)
+{
+	if (batch_next == batch_nurls) {
+		/* Queue drained - retire this pool slot */
+		free_sock(sock_obj);
+		if (--batch_active == 0)
+			thread_add_terminate_event(master);
+		return;
+	}
+
+	sock_obj->url = batch_urls[batch_next++];
+
+	/* Reset the per-fetch state */
+	sock_obj->extracted = NULL;
+	sock_obj->size = 0;
+	sock_obj->total_size = 0;
+	sock_obj->content_len = 0;
+	sock_obj->rx_bytes = 0;
+	sock_obj->status = 0;
+
+	if (sock_obj->keep_alive) {
+		thread_add_event(master, http_request_thread, sock_obj, 0);
+		return;
+	}
+
+	if (sock_obj->ssl) {
+		SSL_free(sock_obj->ssl);
+		sock_obj->ssl = NULL;
+	}
+	if (sock_obj->fd >= 0)
+		close(sock_obj->fd);
+	thread_add_event(master, tcp_connect_thread, sock_obj, 0);
+}
+
+/* Init socket handler. In batch mode one pool slot is started per
+ * concurrent fetch; each slot walks the URL queue via sock_next() */
 void
 init_sock(void)
 {
+	SOCK *sock_obj;
+	unsigned i;
+
+	if (req->url_file) {
+		for (i = 0; i < req->concurrency && batch_next < batch_nurls; i++) {
+			sock_obj = (SOCK *) MALLOC(sizeof (SOCK));
+			sock_obj->url = batch_urls[batch_next++];
+			batch_active++;
+			thread_add_event(master, tcp_connect_thread, sock_obj, 0);
+		}
+		return;
+	}
+
 	sock = (SOCK *) MALLOC(sizeof (SOCK));
 	memset(sock, 0, sizeof (SOCK));
 	thread_add_event(master, tcp_connect_thread, sock, 0);
@@ -195,13 +195,31 @@ ssl_read_thread(thread_t * thread)
 	if (error) {
 		/* All the SSL streal has been parsed */
 		/* Handle response stream */
-		if (error != SSL_ERROR_NONE)
+		if (error != SSL_ERROR_NONE) {
+			sock_obj->keep_alive = 0;
 			return finalize(thread);
+		}
 	} else if (r > 0 && error == 0) {
 
 		/* Handle the response stream */
 		http_process_stream(sock_obj, r);
 
+		/* With a --bytes limit we can stop once those bytes are hashed */
+		if (req->hash_bytes != -1 && sock_obj->extracted &&
+		    sock_obj->rx_bytes >= req->hash_bytes) {
+			sock_obj->keep_alive = 0;
+			return finalize(thread);
+		}
+
+		/* With keep-alive the server will not close the connection;
+		 * the response ends when Content-Length bytes are hashed */
+		if (req->url_file && sock_obj->extracted &&
+		    sock_obj->content_len != -1 &&
+		    sock_obj->rx_bytes >= sock_obj->content_len) {
+			sock_obj->keep_alive = 1;
+			return finalize(thread);
+		}
+
 		/*
 		 * Register next ssl stream reader.
 		 * Register itself to not perturbe global I/O multiplexer.
@@ -27,6 +27,7 @@
 #include <stdint.h>
 
 #include "check_api.h"
+#include "check_daemon.h"
 #include "main.h"
 #include "parser.h"
 #include "memory.h"
@@ -34,6 +35,7 @@
 #include "logger.h"
 #include "bitops.h"
 #include "global_data.h"
+#include "statspage.h"
 #include "keepalived_netlink.h"
 #include "check_misc.h"
 #include "check_smtp.h"
@@ -41,15 +43,28 @@
 #include "check_http.h"
 #include "check_ssl.h"
 #include "check_dns.h"
+#include "check_udp.h"
+#include "check_sendexpect.h"
+#include "check_ping.h"
+#include "ipwrapper.h"
 
 /* Global vars */
 list checkers_queue;
 
+/* Shared-memory statistics page - checker verdict counters live on
+ * the page once published, so monitoring agents can scrape them by
+ * mmap'ing the file with no cost to the checker hot path */
+#define CHECK_STATS_PAGE_FILE	"/tmp/keepalived.checkers.shm"
+static stats_page_t *checker_stats_page;
+
 /* free checker data */
 static void
 free_checker(void *data)
 {
 	checker_t *checker= data;
+	free_list(&checker->probe_followers);
+	if (!stats_page_contains(checker_stats_page, checker->stats))
+		FREE_PTR(checker->stats);
 	(*checker->free_func) (checker);
 }
 
@@ -58,8 +73,21 @@ static void
 dump_checker(void *data)
 {
 	checker_t *checker = data;
+	const checker_hist_entry_t *ent;
+	unsigned count = checker->hist_head;
+	unsigned i;
+
 	log_message(LOG_INFO, " %s", FMT_CHK(checker));
 	(*checker->dump_func) (checker);
+
+	/* Verdict flight recorder, oldest entry first */
+	if (count > CHECKER_HIST_ENTRIES)
+		count = CHECKER_HIST_ENTRIES;
+	for (i = checker->hist_head - count; i != checker->hist_head; i++) {
+		ent = &checker->hist[i % CHECKER_HIST_ENTRIES];
+		log_message(LOG_INFO, "   Verdict %s at %u after %us held, %u retries",
+			    ent->up ? "UP" : "DOWN", ent->ts, ent->dwell, ent->retries);
+	}
 }
 
 void
@@ -72,11 +100,17 @@ dump_connection_opts(void *data)
 		log_message(LOG_INFO, "     Bind to = %s", inet_sockaddrtopair(&conn->bindto));
 	if (conn->bind_if[0])
 		log_message(LOG_INFO, "     Bind i/f = %s", conn->bind_if);
+	if (conn->netns[0])
+		log_message(LOG_INFO, "     Netns = %s", conn->netns);
 #ifdef _WITH_SO_MARK_
 	if (conn->fwmark != 0)
 		log_message(LOG_INFO, "     Mark = %u", conn->fwmark);
 #endif
+	if (conn->fast_open)
+		log_message(LOG_INFO, "     TCP fast open = ON");
 	log_message(LOG_INFO, "     Timeout = %d", conn->connection_to/TIMER_HZ);
+	if (conn->adaptive_min)
+		log_message(LOG_INFO, "     Adaptive timeout floor = %f", conn->adaptive_min / TIMER_HZ_FLOAT);
 }
 
 void
@@ -97,6 +131,10 @@ dump_checker_opts(void *data)
 		log_message(LOG_INFO, "   Retry delay = %lu" , checker->delay_before_retry / TIMER_HZ);
 	}
 	log_message(LOG_INFO, "   Warmup = %lu", checker->warmup / TIMER_HZ);
+	if (checker->backoff_after)
+		log_message(LOG_INFO, "   Backoff after = %u, max delay = %lu"
+				    , checker->backoff_after
+				    , checker->backoff_max / TIMER_HZ);
 }
 
 /* Queue a checker into the checkers_queue */
@@ -134,8 +172,12 @@ queue_checker(void (*free_func) (void *), void (*dump_func) (void *)
 	checker->delay_before_retry = ULONG_MAX;
 	checker->retry_it = 0;
 	checker->is_up = true;
+	checker->stats = (checker_stats_t *) MALLOC(sizeof (checker_stats_t));
 	checker->default_delay_before_retry = 1 * TIMER_HZ;
 	checker->default_retry = 1 ;
+	checker->backoff_after = 0;
+	checker->backoff_max = ULONG_MAX;
+	checker->fail_cycles = 0;
 
 	/* queue the checker */
 	list_add(checkers_queue, checker);
@@ -164,6 +206,14 @@ check_conn_opts(conn_opts_t *co)
 		return false;
 	}
 
+	/* Remember the configured timeout - connection_to is lowered at
+	 * runtime when the timeout adapts, and this is its ceiling */
+	co->configured_to = co->connection_to;
+	if (co->adaptive_min > co->connection_to) {
+		log_message(LOG_INFO, "Checker adaptive_timeout exceeds connect_timeout - ignoring");
+		co->adaptive_min = 0;
+	}
+
 	return true;
 }
 
@@ -181,7 +231,15 @@ compare_conn_opts(conn_opts_t *a, conn_opts_t *b)
 		return false;
 	if (strcmp(a->bind_if, b->bind_if))
 		return false;
-	if (a->connection_to != b->connection_to)
+	if (strcmp(a->netns, b->netns))
+		return false;
+	/* Compare the configured timeouts - connection_to of a running
+	 * checker may have been lowered by the adaptive estimator */
+	if (a->configured_to != b->configured_to)
+		return false;
+	if (a->adaptive_min != b->adaptive_min)
+		return false;
+	if (a->fast_open != b->fast_open)
 		return false;
 #ifdef _WITH_SO_MARK_
 	if (a->fwmark != b->fwmark)
@@ -264,6 +322,19 @@ co_srcif_handler(vector_t *strvec)
 	strcpy(co->bind_if, strvec_slot(strvec, 1));
 }
 
+/* "connect_netns" keyword */
+static void
+co_netns_handler(vector_t *strvec)
+{
+	conn_opts_t *co = CHECKER_GET_CO();
+
+	if (strlen(strvec_slot(strvec, 1)) > sizeof(co->netns) - 1) {
+		log_message(LOG_INFO, "Namespace name %s is too long - ignoring", FMT_STR_VSLOT(strvec, 1));
+		return;
+	}
+	strcpy(co->netns, strvec_slot(strvec, 1));
+}
+
 /* "connect_timeout" keyword */
 static void
 co_timeout_handler(vector_t *strvec)
@@ -276,6 +347,18 @@ co_timeout_handler(vector_t *strvec)
 		co->connection_to = TIMER_HZ;
 }
 
+/* "adaptive_timeout" keyword */
+static void
+co_adaptive_timeout_handler(vector_t *strvec)
+{
+	conn_opts_t *co = CHECKER_GET_CO();
+	co->adaptive_min = (unsigned int)read_timer(strvec);
+
+	/* do not allow 0 floor */
+	if (! co->adaptive_min)
+		co->adaptive_min = TIMER_HZ / 10;
+}
+
 #ifdef _WITH_SO_MARK_
 /* "fwmark" keyword */
 static void
@@ -300,6 +383,22 @@ delay_before_retry_handler(vector_t *strvec)
 	checker->delay_before_retry = CHECKER_VALUE_UINT(strvec) * TIMER_HZ;
 }
 
+/* "backoff_after" keyword */
+static void
+backoff_after_handler(vector_t *strvec)
+{
+	checker_t *checker = CHECKER_GET_CURRENT();
+	checker->backoff_after = CHECKER_VALUE_UINT(strvec);
+}
+
+/* "backoff_max" keyword */
+static void
+backoff_max_handler(vector_t *strvec)
+{
+	checker_t *checker = CHECKER_GET_CURRENT();
+	checker->backoff_max = read_timer(strvec);
+}
+
 /* "warmup" keyword */
 static void
 warmup_handler(vector_t *strvec)
@@ -339,18 +438,111 @@ install_checker_common_keywords(bool connection_keywords)
 		install_keyword("bindto", &co_srcip_handler);
 		install_keyword("bind_port", &co_srcport_handler);
 		install_keyword("bind_if", &co_srcif_handler);
+		install_keyword("connect_netns", &co_netns_handler);
 		install_keyword("connect_timeout", &co_timeout_handler);
+		install_keyword("adaptive_timeout", &co_adaptive_timeout_handler);
 #ifdef _WITH_SO_MARK_
 		install_keyword("fwmark", &co_fwmark_handler);
 #endif
 	}
 	install_keyword("retry", &retry_handler);
 	install_keyword("delay_before_retry", &delay_before_retry_handler);
+	install_keyword("backoff_after", &backoff_after_handler);
+	install_keyword("backoff_max", &backoff_max_handler);
 	install_keyword("warmup", &warmup_handler);
 	install_keyword("delay_loop", &delay_handler);
 	install_keyword("alpha", &alpha_handler);
 }
 
+/* A connect_timeout sized for the worst backend makes every probe of a
+ * dead target occupy a checker slot for that long.  With adaptive_timeout
+ * configured, each successful probe feeds its response time into a
+ * smoothed average and deviation (the estimator TCP uses for its RTO,
+ * gains 1/8 and 1/4), and the next probe times out after avg + 4*dev,
+ * clamped between adaptive_timeout and connect_timeout.  A failed cycle
+ * restores the configured timeout so a slow-but-recovering server gets
+ * full patience again.  The kernel-offloaded timeouts (TCP_SYNCNT,
+ * TCP_USER_TIMEOUT) follow automatically since they are derived from
+ * connection_to at each connect. */
+static void
+checker_update_timeout(checker_t *checker, bool success)
+{
+	conn_opts_t *co = checker->co;
+	unsigned long rtt, to;
+	long err;
+
+	if (!co || !co->adaptive_min)
+		return;
+
+	if (!success) {
+		co->connection_to = co->configured_to;
+		return;
+	}
+
+	/* The probe was never timed (e.g. a suspended cycle) */
+	if (!co->probe_start)
+		return;
+
+	rtt = timer_long(time_now) - co->probe_start;
+	co->probe_start = 0;
+	if (rtt > co->configured_to)
+		rtt = co->configured_to;
+
+	if (!co->rtt_avg) {
+		co->rtt_avg = rtt;
+		co->rtt_var = rtt / 2;
+	} else {
+		err = (long)rtt - (long)co->rtt_avg;
+		co->rtt_avg = (unsigned long)((long)co->rtt_avg + err / 8);
+		if (err < 0)
+			err = -err;
+		co->rtt_var = (unsigned long)((long)co->rtt_var + (err - (long)co->rtt_var) / 4);
+	}
+
+	to = co->rtt_avg + 4 * co->rtt_var;
+	if (to < co->adaptive_min)
+		to = co->adaptive_min;
+	if (to > co->configured_to)
+		to = co->configured_to;
+	co->connection_to = (unsigned int)to;
+}
+
+/* Probing a real server that has been dead for hours at the full
+ * delay_loop rate gains nothing, but during a large outage the connect
+ * timeouts of the dead targets starve the live ones of checker cycles.
+ * Once a checker has concluded backoff_after consecutive cycles down,
+ * every further failure doubles the probe interval, capped at
+ * backoff_max.  The first success, a reload, or re-activating a
+ * suspended checker snaps the interval back to delay_loop.
+ *
+ * Checkers call this when a check cycle concludes, i.e. on success or
+ * once the retries are exhausted, not while stepping through retries. */
+unsigned long
+checker_adjust_delay(checker_t *checker, bool success)
+{
+	unsigned long delay = checker->delay_loop;
+	unsigned doublings;
+
+	checker_update_timeout(checker, success);
+
+	if (success) {
+		checker->fail_cycles = 0;
+		return delay;
+	}
+
+	if (checker->fail_cycles != UINT_MAX)
+		checker->fail_cycles++;
+
+	if (!checker->backoff_after || checker->fail_cycles < checker->backoff_after)
+		return delay;
+
+	doublings = checker->fail_cycles - checker->backoff_after + 1;
+	while (doublings-- && delay && delay < checker->backoff_max / 2)
+		delay <<= 1;
+
+	return delay < checker->backoff_max ? delay : checker->backoff_max;
+}
+
 /* dump the checkers_queue */
 void
 dump_checkers_queue(void)
@@ -386,6 +578,9 @@ free_vs_checkers(virtual_server_t *vs)
 		if (checker->vs != vs)
 			continue;
 
+		/* The checker may still have threads in flight which
+		 * would otherwise fire against freed memory */
+		thread_cancel_arg(master, checker);
 		free_list_element(checkers_queue, e);
 	}
 }
@@ -400,6 +595,179 @@ free_checkers_queue(void)
 	free_list(&checkers_queue);
 }
 
+/* Hash a checker to a stable start phase. Hashing the addresses rather
+ * than drawing from rand() keeps each checker at the same phase across
+ * reloads, and spreads checkers of the same RS apart. */
+static uint64_t
+checker_phase(checker_t *checker)
+{
+	const unsigned char *p;
+	size_t i;
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	p = (const unsigned char *) &checker->rs->addr;
+	for (i = 0; i < sizeof(checker->rs->addr); i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	if (checker->co) {
+		p = (const unsigned char *) &checker->co->dst;
+		for (i = 0; i < sizeof(checker->co->dst); i++) {
+			h ^= p[i];
+			h *= 0x100000001b3ULL;
+		}
+	}
+
+	return h;
+}
+
+/* Warm restart checkpoint. The up/down state of every checker is
+ * written periodically (and at shutdown) so a restarted daemon can
+ * restore it for unchanged services instead of either re-probing the
+ * world from down (alpha mode) or blindly trusting everything up. The
+ * regular probes, which start within the warmup window, then verify
+ * the restored state. */
+#define CHECKER_STATE_MAX_AGE	(10 * 60)	/* seconds a saved entry stays usable */
+
+/* Identity of a checker in the state file. It must be stable across
+ * restarts of an unchanged configuration, so it is built from the
+ * virtual server, the real server and the checker's own connection
+ * endpoint; an ordinal separates otherwise identical checkers on the
+ * same service. */
+static void
+checker_state_key(checker_t *checker, char *buf, size_t len)
+{
+	int n;
+
+	n = snprintf(buf, len, "%s %s", FMT_VS(checker->vs), FMT_RS(checker->rs, checker->vs));
+	if (checker->co && n > 0 && (size_t)n < len)
+		snprintf(buf + n, len - n, " %s", inet_sockaddrtopair(&checker->co->dst));
+}
+
+static uint64_t
+checker_state_id(const char *key, unsigned ord)
+{
+	uint64_t h = 5381;
+
+	while (*key)
+		h = h * 33 + (unsigned char)*key++;
+
+	return h ^ ((uint64_t)ord << 56);
+}
+
+void
+checker_state_save(void)
+{
+	FILE *fp;
+	element e;
+	checker_t *checker;
+	char key[512], prev[512];
+	char *tmp_path;
+	unsigned ord = 0;
+
+	if (!global_data->checker_state_file)
+		return;
+
+	tmp_path = MALLOC(strlen(global_data->checker_state_file) + 5);
+	sprintf(tmp_path, "%s.tmp", global_data->checker_state_file);
+
+	fp = fopen(tmp_path, "w");
+	if (!fp) {
+		log_message(LOG_INFO, "Unable to write checker state file %s - %s"
+				    , tmp_path, strerror(errno));
+		FREE(tmp_path);
+		return;
+	}
+
+	prev[0] = '\0';
+	for (e = LIST_ISEMPTY(checkers_queue) ? NULL : LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		checker = ELEMENT_DATA(e);
+		checker_state_key(checker, key, sizeof(key));
+		ord = strcmp(key, prev) ? 0 : ord + 1;
+		strcpy(prev, key);
+		fprintf(fp, "%d %lu %u %s\n", checker->is_up ? 1 : 0,
+			(unsigned long)time(NULL), ord, key);
+	}
+
+	if (fclose(fp) || rename(tmp_path, global_data->checker_state_file) == -1)
+		log_message(LOG_INFO, "Unable to update checker state file %s - %s"
+				    , global_data->checker_state_file, strerror(errno));
+
+	FREE(tmp_path);
+}
+
+/* Restore saved checker state for entries whose identity still matches
+ * the loaded configuration. Must run before init_services() so restored
+ * up state puts the real servers straight back into the IPVS pool. */
+void
+checker_state_restore(void)
+{
+	FILE *fp;
+	hashtab_t saved;
+	element e;
+	checker_t *checker;
+	char line[600], key[512], prev[512];
+	unsigned ord;
+	unsigned long when;
+	int up, n;
+	char *p;
+	void *val;
+	time_t now = time(NULL);
+	unsigned restored = 0;
+
+	if (!global_data->checker_state_file)
+		return;
+
+	fp = fopen(global_data->checker_state_file, "r");
+	if (!fp)
+		return;
+
+	htab_init(&saved, LIST_ISEMPTY(checkers_queue) ? 0 : LIST_SIZE(checkers_queue));
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%d %lu %u %n", &up, &when, &ord, &n) != 3)
+			continue;
+		p = line + n;
+		p[strcspn(p, "\n")] = '\0';
+
+		/* Bound the staleness we are prepared to trust */
+		if (now < (time_t)when || now - (time_t)when > CHECKER_STATE_MAX_AGE)
+			continue;
+
+		/* Value encodes the up flag; NULL would mean empty slot */
+		htab_insert(&saved, checker_state_id(p, ord), (void *)(uintptr_t)(up + 1));
+	}
+	fclose(fp);
+
+	prev[0] = '\0';
+	ord = 0;
+	for (e = LIST_ISEMPTY(checkers_queue) ? NULL : LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		checker = ELEMENT_DATA(e);
+		checker_state_key(checker, key, sizeof(key));
+		ord = strcmp(key, prev) ? 0 : ord + 1;
+		strcpy(prev, key);
+
+		val = htab_del(&saved, checker_state_id(key, ord));
+		if (!val)
+			continue;
+
+		up = (int)(uintptr_t)val - 1;
+		if (checker->is_up == (bool)up)
+			continue;
+
+		set_checker_state(checker, up);
+		if (!up) {
+			/* Mirror the alpha mode initialisation */
+			UNSET_ALIVE(checker->rs);
+		}
+		restored++;
+	}
+	htab_destroy(&saved);
+
+	if (restored)
+		log_message(LOG_INFO, "Restored the state of %u checkers from %s"
+				    , restored, global_data->checker_state_file);
+}
+
 /* register checkers to the global I/O scheduler */
 void
 register_checkers_thread(void)
@@ -407,24 +775,54 @@ register_checkers_thread(void)
 	checker_t *checker;
 	element e;
 	unsigned long warmup;
+	unsigned *slot_count = NULL;
+	unsigned long nslots = 0, slot;
+
+	/* With a start limiter, count how many checkers begin in each one
+	 * second slot and overflow the excess into the following slots */
+	if (global_data->max_concurrent_checks && !LIST_ISEMPTY(checkers_queue)) {
+		nslots = 1;
+		for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+			checker = ELEMENT_DATA(e);
+			if (checker->warmup / TIMER_HZ + 1 > nslots)
+				nslots = checker->warmup / TIMER_HZ + 1;
+		}
+		slot_count = (unsigned *) MALLOC(nslots * sizeof(unsigned));
+	}
 
 	for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
 		checker = ELEMENT_DATA(e);
+		if (!checker_in_shard(checker))
+			continue;
+		/* A shared probe is run by its leader; the result is fanned
+		 * out through update_svr_checker_state() */
+		if (checker->probe_leader)
+			continue;
 		log_message(LOG_INFO, "%sctivating healthchecker for service %s for VS %s"
 				    , checker->enabled ? "A" : "Dea", FMT_RS(checker->rs, checker->vs), FMT_VS(checker->vs));
 		if (checker->launch)
 		{
-			/* wait for a random timeout to begin checker thread.
-			   It helps avoiding multiple simultaneous checks to
-			   the same RS.
+			/* spread the start times over the warmup window
+			   (which defaults to the checker interval), so the
+			   checkers don't all fire in the same tick forever.
 			*/
 			warmup = checker->warmup;
 			if (warmup)
-				warmup = warmup * (unsigned)rand() / RAND_MAX;
+				warmup = checker_phase(checker) % warmup;
+			if (slot_count) {
+				slot = warmup / TIMER_HZ;
+				while (slot_count[slot] >= global_data->max_concurrent_checks &&
+				       slot + 1 < nslots)
+					slot++;
+				slot_count[slot]++;
+				warmup = slot * TIMER_HZ + warmup % TIMER_HZ;
+			}
 			thread_add_timer(master, checker->launch, checker,
 					 BOOTSTRAP_DELAY + warmup);
 		}
 	}
+
+	FREE_PTR(slot_count);
 }
 
 /* Sync checkers activity with netlink kernel reflection */
@@ -567,6 +965,8 @@ update_checker_activity(sa_family_t family, void *address, bool enable)
 							!checker->enabled ? "Activat" : "Suspend",
 							FMT_RS(checker->rs, checker->vs), FMT_VS(checker->vs));
 				checker->enabled = enable;
+				if (enable)
+					checker->fail_cycles = 0;
 			}
 		}
 	}
@@ -582,4 +982,153 @@ install_checkers_keyword(void)
 	install_http_check_keyword();
 	install_ssl_check_keyword();
 	install_dns_check_keyword();
+	install_udp_check_keyword();
+	install_sendexpect_check_keyword();
+	install_ping_check_keyword();
+}
+
+/* Move the per-checker verdict counters onto the shared stats page so
+ * they are exported to monitoring agents. Across a reload a checker
+ * finds its existing record by name and keeps its counter history. */
+void
+publish_checker_stats_page(void)
+{
+	char name[STATS_REC_NAME_LEN];
+	element e;
+	checker_t *checker;
+	checker_stats_t *rec;
+	bool existing;
+	int len;
+
+	if (LIST_ISEMPTY(checkers_queue))
+		return;
+
+	if (!checker_stats_page)
+		checker_stats_page = stats_page_create(CHECK_STATS_PAGE_FILE, sizeof(checker_stats_t),
+						       LIST_SIZE(checkers_queue) * 2 + 64);
+	if (!checker_stats_page)
+		return;
+
+	checker_stats_page->hdr->generation++;
+
+	for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		checker = ELEMENT_DATA(e);
+
+		if (stats_page_contains(checker_stats_page, checker->stats))
+			continue;
+
+		/* The formatting macros share static buffers, so build
+		 * the name in two steps */
+		len = snprintf(name, sizeof(name), "#%u %s", checker->id, FMT_VS(checker->vs));
+		if (len > 0 && (size_t)len < sizeof(name))
+			snprintf(name + len, sizeof(name) - len, " -> %s", FMT_CHK(checker));
+
+		rec = stats_page_record(checker_stats_page, name, &existing);
+		if (!rec) {
+			log_message(LOG_INFO, "Checker stats page full - %s keeps private counters", name);
+			continue;
+		}
+
+		if (!existing)
+			*rec = *checker->stats;
+		FREE(checker->stats);
+		checker->stats = rec;
+	}
+}
+
+void
+close_checker_stats_page(void)
+{
+	stats_page_close(&checker_stats_page, true);
+}
+
+/* TIME_WAIT pressure gauge. Probe sockets are closed abortively
+ * (SO_LINGER(0) in socket_bind_connect()) so the common case leaves no
+ * TIME_WAIT behind, but peers closing first or misc scripts still can,
+ * and at high check rates that eats into the ephemeral port range and
+ * shows up as slow bind/connect. Sample the system TIME_WAIT count
+ * against the configured local port span, export both on the stats
+ * page, and warn when the span starts filling up. */
+#define TW_SAMPLE_INTERVAL	(10 * TIMER_HZ)
+
+/* Must fit within the checker_stats_t payload of the stats page */
+typedef struct _tw_gauge {
+	uint64_t	time_wait;	/* gauge: current TIME_WAIT sockets */
+	uint64_t	port_span;	/* gauge: size of the ephemeral port range */
+	uint32_t	samples;
+} tw_gauge_t;
+
+static tw_gauge_t *tw_gauge;
+static uint64_t tw_port_span;
+static bool tw_warned;
+
+static uint64_t
+count_time_wait(void)
+{
+	char line[128];
+	uint64_t tw = 0;
+	char *p;
+	FILE *f;
+
+	if (!(f = fopen("/proc/net/sockstat", "r")))
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "TCP:", 4))
+			continue;
+		if ((p = strstr(line, " tw ")))
+			tw = strtoul(p + 4, NULL, 10);
+		break;
+	}
+	fclose(f);
+
+	return tw;
+}
+
+static int
+checker_tw_gauge_thread(__attribute__((unused)) thread_t * thread)
+{
+	uint64_t tw = count_time_wait();
+
+	if (tw_gauge) {
+		tw_gauge->time_wait = tw;
+		tw_gauge->port_span = tw_port_span;
+		tw_gauge->samples++;
+	}
+
+	/* Warn once per excursion over half the port range */
+	if (tw_port_span && tw > tw_port_span / 2) {
+		if (!tw_warned)
+			log_message(LOG_INFO, "%" PRIu64 " TIME_WAIT sockets against a local port range of %" PRIu64
+					    " - probe connects may slow down", tw, tw_port_span);
+		tw_warned = true;
+	} else
+		tw_warned = false;
+
+	thread_add_timer(master, checker_tw_gauge_thread, NULL, TW_SAMPLE_INTERVAL);
+	return 0;
+}
+
+void
+checker_tw_gauge_init(void)
+{
+	unsigned low, high;
+	bool existing;
+	FILE *f;
+
+	if (LIST_ISEMPTY(checkers_queue))
+		return;
+
+	/* Know the ports we actually have to play with */
+	tw_port_span = 0;
+	if ((f = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r"))) {
+		if (fscanf(f, "%u %u", &low, &high) == 2 && high > low)
+			tw_port_span = high - low + 1;
+		fclose(f);
+	}
+
+	if (checker_stats_page && !tw_gauge)
+		tw_gauge = stats_page_record(checker_stats_page, "# tcp time-wait pressure", &existing);
+
+	thread_add_timer(master, checker_tw_gauge_thread, NULL, TW_SAMPLE_INTERVAL);
 }
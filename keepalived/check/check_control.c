@@ -0,0 +1,534 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Runtime control socket for the healthchecker process.
+ *              Lets an operator adjust a real server weight or turn
+ *              checkers on and off for one real server without editing
+ *              the configuration and reloading. Also serves the UDP
+ *              weight listener, through which backends push their own
+ *              weights instead of being polled by misc_check scripts.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+/* system include */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* local include */
+#include "check_control.h"
+#include "check_data.h"
+#include "check_api.h"
+#include "ipwrapper.h"
+#include "global_data.h"
+#include "scheduler.h"
+#include "parser.h"
+#include "logger.h"
+#include "utils.h"
+#include "memory.h"
+#include "list.h"
+#include "hashtab.h"
+#include "timer.h"
+
+static int control_sock = -1;
+
+/* UDP weight listener. Pending updates are coalesced per real server
+ * (last datagram wins) and applied in one batch per flush interval, so
+ * a chatty backend cannot flap its IPVS weight faster than the batch
+ * period. */
+#define WEIGHT_FLUSH_DELAY	TIMER_HZ
+#define WEIGHT_MAX		65535
+
+typedef struct _queued_weight {
+	virtual_server_t	*vs;
+	real_server_t		*rs;
+	int			weight;
+} queued_weight_t;
+
+static int weight_sock = -1;
+static list weight_queue;			/* queued_weight_t - owns the entries */
+static hashtab_t weight_htab;			/* rs pointer -> queued entry, for coalescing */
+
+static virtual_server_t *
+control_find_vs(char *ip, const char *port)
+{
+	struct sockaddr_storage addr;
+	element e;
+	virtual_server_t *vs;
+
+	if (inet_stosockaddr(ip, port, &addr))
+		return NULL;
+
+	if (LIST_ISEMPTY(check_data->vs))
+		return NULL;
+
+	for (e = LIST_HEAD(check_data->vs); e; ELEMENT_NEXT(e)) {
+		vs = ELEMENT_DATA(e);
+		if (vs->vsgname || vs->vfwmark)
+			continue;
+		if (!inet_sockaddrcmp(&vs->addr, &addr) &&
+		    inet_sockaddrport(&vs->addr) == inet_sockaddrport(&addr))
+			return vs;
+	}
+
+	return NULL;
+}
+
+static real_server_t *
+control_find_rs(virtual_server_t *vs, char *ip, const char *port)
+{
+	struct sockaddr_storage addr;
+	element e;
+	real_server_t *rs;
+
+	if (inet_stosockaddr(ip, port, &addr))
+		return NULL;
+
+	if (LIST_ISEMPTY(vs->rs))
+		return NULL;
+
+	for (e = LIST_HEAD(vs->rs); e; ELEMENT_NEXT(e)) {
+		rs = ELEMENT_DATA(e);
+		if (!inet_sockaddrcmp(&rs->addr, &addr) &&
+		    inet_sockaddrport(&rs->addr) == inet_sockaddrport(&addr))
+			return rs;
+	}
+
+	return NULL;
+}
+
+static void
+control_status(FILE *file)
+{
+	element e, e1;
+	virtual_server_t *vs;
+	real_server_t *rs;
+
+	if (LIST_ISEMPTY(check_data->vs))
+		return;
+
+	for (e = LIST_HEAD(check_data->vs); e; ELEMENT_NEXT(e)) {
+		vs = ELEMENT_DATA(e);
+		fprintf(file, "VS %s %s\n", FMT_VS(vs), vs->alive ? "alive" : "down");
+		if (LIST_ISEMPTY(vs->rs))
+			continue;
+		for (e1 = LIST_HEAD(vs->rs); e1; ELEMENT_NEXT(e1)) {
+			rs = ELEMENT_DATA(e1);
+			fprintf(file, "  RS %s %s weight %d\n", FMT_RS(rs, vs),
+				rs->alive ? "alive" : "down", rs->weight);
+		}
+	}
+}
+
+/* Turn every checker watching (vs, rs) on or off. Disabling leaves the
+ * real server in its current state but stops the probes against it. */
+static void
+control_set_checkers(FILE *file, virtual_server_t *vs, real_server_t *rs, bool enable)
+{
+	element e;
+	checker_t *checker;
+	unsigned changed = 0;
+
+	if (!LIST_ISEMPTY(checkers_queue)) {
+		for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+			checker = ELEMENT_DATA(e);
+			if (checker->vs != vs || checker->rs != rs)
+				continue;
+			checker->enabled = enable;
+			changed++;
+		}
+	}
+
+	if (!changed) {
+		fprintf(file, "ERR no checkers for %s\n", FMT_RS(rs, vs));
+		return;
+	}
+
+	log_message(LOG_INFO, "%s %u checker(s) for service %s via control socket",
+		    enable ? "Enabled" : "Disabled", changed, FMT_RS(rs, vs));
+	fprintf(file, "OK %u checker(s) %s\n", changed, enable ? "enabled" : "disabled");
+}
+
+/* Pull the next probe of every enabled checker on the target forward to
+ * now. The probes run on the normal paths, so their results still flow
+ * through update_svr_checker_state() - this only collapses the wait for
+ * the polling schedule, typically after a deploy has just brought a
+ * backend back. With vs == NULL every checker is rescheduled. */
+static void
+control_recheck(FILE *file, virtual_server_t *vs, real_server_t *rs)
+{
+	element e;
+	checker_t *checker;
+	unsigned rescheduled = 0;
+
+	if (!LIST_ISEMPTY(checkers_queue)) {
+		for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+			checker = ELEMENT_DATA(e);
+			if (vs && (checker->vs != vs || (rs && checker->rs != rs)))
+				continue;
+			if (!checker->enabled)
+				continue;
+
+			/* A checker mid-probe has no pending timer and is
+			 * as immediate as it gets already */
+			if (thread_timer_expire_arg(master, checker))
+				rescheduled++;
+		}
+	}
+
+	if (!rescheduled) {
+		fprintf(file, "ERR no pending checkers%s\n", vs ? " for target" : "");
+		return;
+	}
+
+	log_message(LOG_INFO, "Forced immediate recheck of %u checker(s) via control socket",
+		    rescheduled);
+	fprintf(file, "OK %u checker(s) rescheduled\n", rescheduled);
+}
+
+static void
+control_command(FILE *file, char *buf)
+{
+	vector_t *strvec;
+	char *cmd;
+	virtual_server_t *vs;
+	real_server_t *rs;
+	int weight;
+
+	strvec = alloc_strvec(buf);
+	if (!strvec) {
+		fprintf(file, "ERR empty command\n");
+		return;
+	}
+
+	cmd = vector_slot(strvec, 0);
+
+	if (!strcmp(cmd, "status")) {
+		control_status(file);
+		free_strvec(strvec);
+		return;
+	}
+
+	if (!strcmp(cmd, "memprof")) {
+		mem_prof_print(file);
+		free_strvec(strvec);
+		return;
+	}
+
+	if (!strcmp(cmd, "loopstats")) {
+		thread_dump_callback_acct(file);
+		free_strvec(strvec);
+		return;
+	}
+
+	if (!strcmp(cmd, "loglevel")) {
+		if (vector_size(strvec) < 2)
+			log_subsys_dump(file);
+		else if (vector_size(strvec) < 3 ||
+			 !log_subsys_set_level(vector_slot(strvec, 1), vector_slot(strvec, 2)))
+			fprintf(file, "ERR usage: loglevel [vrrp|check|netlink|scheduler|all emerg..debug]\n");
+		else {
+			log_message(LOG_INFO, "Logging level for %s set to %s via control socket",
+				    (char *)vector_slot(strvec, 1), (char *)vector_slot(strvec, 2));
+			fprintf(file, "OK\n");
+		}
+		free_strvec(strvec);
+		return;
+	}
+
+	if (!strcmp(cmd, "recheck")) {
+		rs = NULL;
+		if (vector_size(strvec) >= 2 && !strcmp(vector_slot(strvec, 1), "all"))
+			control_recheck(file, NULL, NULL);
+		else if (vector_size(strvec) != 3 && vector_size(strvec) != 5)
+			fprintf(file, "ERR usage: recheck all|vip vport [rip rport]\n");
+		else if (!(vs = control_find_vs(vector_slot(strvec, 1), vector_slot(strvec, 2))))
+			fprintf(file, "ERR unknown virtual server %s %s\n",
+				(char *)vector_slot(strvec, 1), (char *)vector_slot(strvec, 2));
+		else if (vector_size(strvec) == 5 &&
+			 !(rs = control_find_rs(vs, vector_slot(strvec, 3), vector_slot(strvec, 4))))
+			fprintf(file, "ERR unknown real server %s %s\n",
+				(char *)vector_slot(strvec, 3), (char *)vector_slot(strvec, 4));
+		else
+			control_recheck(file, vs, rs);
+		free_strvec(strvec);
+		return;
+	}
+
+	if (strcmp(cmd, "weight") && strcmp(cmd, "enable") && strcmp(cmd, "disable")) {
+		fprintf(file, "ERR unknown command %s\n", cmd);
+		free_strvec(strvec);
+		return;
+	}
+
+	if (vector_size(strvec) < (!strcmp(cmd, "weight") ? 6 : 5)) {
+		fprintf(file, "ERR usage: %s vip vport rip rport%s\n", cmd,
+			!strcmp(cmd, "weight") ? " weight" : "");
+		free_strvec(strvec);
+		return;
+	}
+
+	if (!(vs = control_find_vs(vector_slot(strvec, 1), vector_slot(strvec, 2))))
+		fprintf(file, "ERR unknown virtual server %s %s\n",
+			(char *)vector_slot(strvec, 1), (char *)vector_slot(strvec, 2));
+	else if (!(rs = control_find_rs(vs, vector_slot(strvec, 3), vector_slot(strvec, 4))))
+		fprintf(file, "ERR unknown real server %s %s\n",
+			(char *)vector_slot(strvec, 3), (char *)vector_slot(strvec, 4));
+	else if (!strcmp(cmd, "weight")) {
+		weight = atoi(vector_slot(strvec, 5));
+		if (weight < 0)
+			fprintf(file, "ERR invalid weight %s\n", (char *)vector_slot(strvec, 5));
+		else {
+			log_message(LOG_INFO, "Setting weight of service %s to %d via control socket",
+				    FMT_RS(rs, vs), weight);
+			update_svr_wgt(weight, vs, rs, true);
+			fprintf(file, "OK\n");
+		}
+	} else
+		control_set_checkers(file, vs, rs, !strcmp(cmd, "enable"));
+
+	free_strvec(strvec);
+}
+
+static void
+free_queued_weight(void *data)
+{
+	FREE(data);
+}
+
+/* Apply the batched weight updates. update_svr_wgt() skips servers
+ * whose weight is unchanged, so re-sent identical weights are free. */
+static int
+weight_queue_flush(__attribute__((unused)) thread_t *thread)
+{
+	element e;
+	queued_weight_t *qw;
+
+	for (e = LIST_HEAD(weight_queue); e; ELEMENT_NEXT(e)) {
+		qw = ELEMENT_DATA(e);
+		if (qw->rs->weight != qw->weight)
+			update_svr_wgt(qw->weight, qw->vs, qw->rs, true);
+	}
+
+	free_list(&weight_queue);
+	htab_destroy(&weight_htab);
+
+	return 0;
+}
+
+static void
+weight_queue_add(virtual_server_t *vs, real_server_t *rs, int weight)
+{
+	queued_weight_t *qw;
+
+	/* A later datagram for the same real server supersedes the
+	 * queued weight */
+	if ((qw = htab_find(&weight_htab, (uint64_t)(uintptr_t)rs))) {
+		qw->weight = weight;
+		return;
+	}
+
+	if (LIST_ISEMPTY(weight_queue)) {
+		if (!weight_queue)
+			weight_queue = alloc_list(free_queued_weight, NULL);
+		thread_add_timer(master, weight_queue_flush, NULL, WEIGHT_FLUSH_DELAY);
+	}
+
+	qw = (queued_weight_t *) MALLOC(sizeof(queued_weight_t));
+	qw->vs = vs;
+	qw->rs = rs;
+	qw->weight = weight;
+	list_add(weight_queue, qw);
+	htab_insert(&weight_htab, (uint64_t)(uintptr_t)rs, qw);
+}
+
+/* Datagram format, one update per datagram:
+ *	vip vport rip rport weight
+ * Malformed or unknown updates are silently dropped - the listener
+ * faces a telemetry feed, not an operator. */
+static int
+check_weight_recv_thread(thread_t *thread)
+{
+	char buf[128];
+	vector_t *strvec;
+	virtual_server_t *vs;
+	real_server_t *rs;
+	ssize_t len;
+	int weight;
+
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return 0;
+
+	/* Drain everything that has accumulated since the last wakeup */
+	while ((len = recv(weight_sock, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = '\0';
+
+		if (!(strvec = alloc_strvec(buf)))
+			continue;
+
+		if (vector_size(strvec) >= 5 &&
+		    (vs = control_find_vs(vector_slot(strvec, 0), vector_slot(strvec, 1))) &&
+		    (rs = control_find_rs(vs, vector_slot(strvec, 2), vector_slot(strvec, 3)))) {
+			weight = atoi(vector_slot(strvec, 4));
+			if (weight >= 0 && weight <= WEIGHT_MAX)
+				weight_queue_add(vs, rs, weight);
+		}
+
+		free_strvec(strvec);
+	}
+
+	thread_add_read(master, check_weight_recv_thread, NULL, weight_sock, TIMER_NEVER);
+
+	return 0;
+}
+
+void
+check_weight_socket_init(void)
+{
+	socklen_t len;
+
+	if (global_data->lvs_weight_socket.ss_family == AF_UNSPEC || weight_sock != -1)
+		return;
+
+	if ((weight_sock = socket(global_data->lvs_weight_socket.ss_family,
+				  SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		log_message(LOG_INFO, "Unable to create weight socket (%s)", strerror(errno));
+		return;
+	}
+
+	len = global_data->lvs_weight_socket.ss_family == AF_INET6 ?
+		sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	if (bind(weight_sock, (struct sockaddr *)&global_data->lvs_weight_socket, len) == -1) {
+		log_message(LOG_INFO, "Unable to bind weight socket (%s)", strerror(errno));
+		close(weight_sock);
+		weight_sock = -1;
+		return;
+	}
+
+	thread_add_read(master, check_weight_recv_thread, NULL, weight_sock, TIMER_NEVER);
+}
+
+void
+check_weight_socket_close(void)
+{
+	if (weight_sock != -1) {
+		close(weight_sock);
+		weight_sock = -1;
+	}
+
+	/* Queued updates reference servers about to be freed */
+	free_list(&weight_queue);
+	htab_destroy(&weight_htab);
+}
+
+static int
+check_control_accept_thread(thread_t *thread)
+{
+	struct timeval timeo = { .tv_sec = 1, .tv_usec = 0 };
+	char buf[256];
+	ssize_t len;
+	FILE *file;
+	int fd;
+
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return 0;
+
+	fd = accept(control_sock, NULL, NULL);
+
+	/* Wait for the next connection */
+	thread_add_read(master, check_control_accept_thread, NULL, control_sock, TIMER_NEVER);
+
+	if (fd < 0)
+		return 0;
+
+	/* Don't let a silent or stalled client block the healthchecker */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeo, sizeof(timeo));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeo, sizeof(timeo));
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len <= 0) {
+		close(fd);
+		return 0;
+	}
+	buf[len] = '\0';
+
+	if (!(file = fdopen(fd, "w"))) {
+		close(fd);
+		return 0;
+	}
+
+	control_command(file, buf);
+	fclose(file);
+
+	return 0;
+}
+
+void
+check_control_socket_init(void)
+{
+	struct sockaddr_un addr;
+
+	if (!global_data->lvs_control_socket || control_sock != -1)
+		return;
+
+	if (strlen(global_data->lvs_control_socket) >= sizeof(addr.sun_path)) {
+		log_message(LOG_INFO, "Control socket path %s too long - ignoring", global_data->lvs_control_socket);
+		return;
+	}
+
+	if ((control_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		log_message(LOG_INFO, "Unable to create control socket (%s)", strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, global_data->lvs_control_socket);
+
+	/* Remove any socket left over from a previous invocation */
+	unlink(addr.sun_path);
+
+	if (bind(control_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(control_sock, 2) == -1) {
+		log_message(LOG_INFO, "Unable to bind control socket %s (%s)", addr.sun_path, strerror(errno));
+		close(control_sock);
+		control_sock = -1;
+		return;
+	}
+
+	thread_add_read(master, check_control_accept_thread, NULL, control_sock, TIMER_NEVER);
+}
+
+void
+check_control_socket_close(void)
+{
+	if (control_sock == -1)
+		return;
+
+	close(control_sock);
+	control_sock = -1;
+
+	if (global_data->lvs_control_socket)
+		unlink(global_data->lvs_control_socket);
+}
@@ -23,15 +23,24 @@
 #include "config.h"
 
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #include "check_daemon.h"
+#include "smtp.h"
 #include "check_parser.h"
 #include "ipwrapper.h"
 #include "ipvswrapper.h"
 #include "check_data.h"
 #include "check_ssl.h"
 #include "check_api.h"
+#include "check_dns.h"
+#include "check_ping.h"
+#include "check_tcp.h"
+#include "check_control.h"
 #include "global_data.h"
 #include "pidfile.h"
 #include "daemon.h"
@@ -46,14 +55,93 @@
 #include "bitops.h"
 #include "keepalived_netlink.h"
 #ifdef _WITH_SNMP_CHECKER_
+  #include "snmp.h"
   #include "check_snmp.h"
 #endif
 
 /* Global variables */
 bool using_ha_suspend;
+int checker_shard_fd = -1;		/* worker side socket to the coordinator */
 
 /* local variables */
 static char *check_syslog_ident;
+static unsigned checker_shard_id;	/* shard of this worker process */
+
+/* Checker sharding. With checker_shards N set, the checkers are split
+ * across N worker processes by a hash of their RS address, so check
+ * capacity scales with the available cores. The workers report checker
+ * state transitions over a socketpair to this (coordinator) process,
+ * which owns the IPVS and notification state. */
+typedef struct _checker_shard_msg {
+	uint32_t	id;		/* checker->id */
+	uint8_t		alive;
+	uint8_t		is_weight;	/* dynamic weight report, not a state transition */
+	int32_t		weight;
+} checker_shard_msg_t;
+
+#ifndef _DEBUG_
+static unsigned num_checker_shards;	/* as at the last start of the workers */
+static pid_t *checker_shard_pids;
+static int *checker_shard_fds;		/* coordinator side of each worker socketpair */
+static checker_t **checkers_by_id;	/* coordinator lookup for worker reports */
+static unsigned num_checkers_by_id;
+
+static void start_checker_shard_workers(void);
+static bool start_checker_shard_worker(unsigned);
+static void stop_checker_shard_workers(void);
+
+static uint64_t
+checker_shard_hash(real_server_t *rs)
+{
+	const unsigned char *p;
+	size_t i;
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	p = (const unsigned char *) &rs->addr;
+	for (i = 0; i < sizeof(rs->addr); i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+#endif
+
+/* Which checkers this process runs. Each shard worker owns the checkers
+ * whose RS address hashes to its shard, so all the checkers of an RS stay
+ * in one process; any other process runs whatever is registered. */
+bool
+checker_in_shard(checker_t *checker)
+{
+#ifndef _DEBUG_
+	if (checker_shard_fd != -1)
+		return checker_shard_hash(checker->rs) % num_checker_shards == checker_shard_id;
+#endif
+	return true;
+}
+
+/* Worker side - report a checker state transition to the coordinator */
+void
+checker_shard_report(checker_t *checker, bool alive)
+{
+	checker_shard_msg_t msg = { .id = checker->id, .alive = alive };
+
+	if (send(checker_shard_fd, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg))
+		log_message(LOG_INFO, "Checker shard %u: failed to report state of %s (%s)"
+				    , checker_shard_id, FMT_CHK(checker), strerror(errno));
+}
+
+/* Worker side - report a dynamic weight to the coordinator, which solely
+ * owns the IPVS state and applies it through the debounced weight path */
+void
+checker_shard_report_weight(checker_t *checker, int weight)
+{
+	checker_shard_msg_t msg = { .id = checker->id, .is_weight = 1, .weight = (int32_t)weight };
+
+	if (send(checker_shard_fd, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg))
+		log_message(LOG_INFO, "Checker shard %u: failed to report weight of %s (%s)"
+				    , checker_shard_id, FMT_CHK(checker), strerror(errno));
+}
 
 static int
 lvs_notify_fifo_script_exit(__attribute__((unused)) thread_t *thread)
@@ -68,6 +156,14 @@ lvs_notify_fifo_script_exit(__attribute__((unused)) thread_t *thread)
 static void
 stop_check(int status)
 {
+#ifndef _DEBUG_
+	stop_checker_shard_workers();
+#endif
+
+	/* Checkpoint the checker states for a warm restart */
+	if (global_data)
+		checker_state_save();
+
 	if (using_ha_suspend)
 		kernel_netlink_close();
 
@@ -79,8 +175,17 @@ stop_check(int status)
 
 	/* Destroy master thread */
 	signal_handler_destroy();
+#ifdef _MEM_CHECK_
 	thread_destroy_master(master);
 	free_checkers_queue();
+	dns_cache_clear();
+#endif
+	close_checker_stats_page();
+	ping_close_sockets();
+	syn_close_sockets();
+	check_control_socket_close();
+	check_weight_socket_close();
+	wgt_debounce_clear();
 	free_ssl();
 	if (!__test_bit(DONT_RELEASE_IPVS_BIT, &debug))
 		clear_services();
@@ -93,12 +198,17 @@ stop_check(int status)
 	/* Stop daemon */
 	pidfile_rm(checkers_pidfile);
 
-	/* Clean data */
+#ifdef _MEM_CHECK_
+	/* Freeing every object one by one takes seconds on a large
+	 * configuration and delays the restart; it only matters when
+	 * the allocator is auditing. Otherwise the OS reclaims it all
+	 * at exit. */
 	if (global_data)
 		free_global_data(global_data);
 	if (check_data)
 		free_check_data(check_data);
 	free_parent_mallocs_exit();
+#endif
 
 	/*
 	 * Reached when terminate signal catched.
@@ -123,7 +233,49 @@ stop_check(int status)
 	exit(status);
 }
 
+/* Parse and cross-check the checker configuration without touching the
+ * kernel. Runs the full parser, link_vsg_to_vs() and
+ * validate_check_config(), but never talks to IPVS or opens a socket,
+ * so a bad candidate config can be rejected before it ever reaches a
+ * live daemon. */
+bool
+check_validate_config(void)
+{
+	bool ret;
+
+	init_checkers_queue();
+
+	global_data = alloc_global_data();
+	check_data = alloc_check_data();
+	if (!check_data)
+		return false;
+
+	init_data(conf_file, check_init_keywords);
+	init_global_data(global_data);
+
+	link_vsg_to_vs();
+	ret = validate_check_config();
+
+	free_checkers_queue();
+	free_check_data(check_data);
+	free_global_data(global_data);
+
+	return ret;
+}
+
 /* Daemon init sequence */
+/* Periodic warm restart checkpoint of the checker states */
+#define CHECKER_STATE_SAVE_INTERVAL	(30 * TIMER_HZ)
+
+static int
+checker_state_save_thread(__attribute__((unused)) thread_t * thread)
+{
+	checker_state_save();
+	thread_add_timer(master, checker_state_save_thread, NULL,
+			 CHECKER_STATE_SAVE_INTERVAL);
+	return 0;
+}
+
 static void
 start_check(list old_checkers_queue)
 {
@@ -139,6 +291,12 @@ start_check(list old_checkers_queue)
 
 	init_global_data(global_data);
 
+	/* In takeover mode the IPVS topology is left in the kernel on exit
+	 * and adopted via the reconciliation dump on the next start, so
+	 * established connections survive a daemon restart. */
+	if (global_data->takeover)
+		__set_bit(DONT_RELEASE_IPVS_BIT, &debug);
+
 	/* fill 'vsg' members of the virtual_server_t structure.
 	 * We must do that after parsing config, because
 	 * vs and vsg declarations may appear in any order,
@@ -167,9 +325,15 @@ start_check(list old_checkers_queue)
         if (global_data->lvs_notify_fifo.name)
                 notify_fifo_open(&global_data->notify_fifo, &global_data->lvs_notify_fifo, lvs_notify_fifo_script_exit, "lvs_");
 
-	/* Get current active addresses, and start update process */
-	if (using_ha_suspend || __test_bit(LOG_ADDRESS_CHANGES, &debug))
-		kernel_netlink_init();
+	/* Get current active addresses, and start update process. Prefer
+	 * the address events the vrrp process republishes over running
+	 * our own netlink reflection */
+	if (using_ha_suspend || __test_bit(LOG_ADDRESS_CHANGES, &debug)) {
+#if !defined _DEBUG_ && defined _WITH_VRRP_
+		if (!netlink_shared_consumer_init())
+#endif
+			kernel_netlink_init();
+	}
 
 	/* Remove any entries left over from previous invocation */
 	if (!reload && global_data->lvs_flush)
@@ -191,9 +355,30 @@ start_check(list old_checkers_queue)
 	if (global_data->checker_no_swap)
 		set_process_dont_swap(4096);	/* guess a stack size to reserve */
 
+	if (global_data->checker_cpu_mask)
+		set_process_cpu_affinity(global_data->checker_cpu_mask, "checker");
+
+	if (global_data->checker_realtime_policy)
+		set_process_realtime_priority(global_data->checker_realtime_policy, global_data->checker_realtime_priority, "checker");
+
 	/* Processing differential configuration parsing */
 	if (reload)
 		clear_diff_services(old_checkers_queue);
+	else {
+		/* Warm restart - reinstate saved checker state before the
+		 * IPVS topology is programmed, so previously up servers go
+		 * straight back into the pool. A reload migrates the state
+		 * from the old checkers instead. */
+		checker_state_restore();
+	}
+
+	/* On a cold start hold quorum-up transitions while the synced
+	 * connection table catches up */
+	if (!reload)
+		quorum_gate_arm();
+
+	/* Export the per-checker verdict counters for monitoring agents */
+	publish_checker_stats_page();
 
 	/* Initialize IPVS topology */
 	if (!init_services())
@@ -205,7 +390,32 @@ start_check(list old_checkers_queue)
 		dump_check_data(check_data);
 	}
 
+	/* Keep the warm restart checkpoint current */
+	if (global_data->checker_state_file)
+		thread_add_timer(master, checker_state_save_thread, NULL,
+				 CHECKER_STATE_SAVE_INTERVAL);
+
+	/* Open the runtime control and weight sockets if configured */
+	check_control_socket_init();
+	check_weight_socket_init();
+
+	/* Watch TIME_WAIT pressure on the probe source ports */
+	checker_tw_gauge_init();
+
 	/* Register checkers thread */
+#ifndef _DEBUG_
+	if (global_data->checker_shards > 1 && !LIST_ISEMPTY(checkers_queue)) {
+		if (using_ha_suspend)
+			log_message(LOG_INFO, "checker_shards is not supported with ha_suspend - running a single checker process");
+		else {
+			start_checker_shard_workers();
+			return;
+		}
+	}
+#endif
+	/* Resolve a deferred smtp_server name without blocking */
+	smtp_start_resolver();
+
 	register_checkers_thread();
 }
 
@@ -216,11 +426,22 @@ reload_check_thread(__attribute__((unused)) thread_t * thread)
 {
 	list old_checkers_queue;
 
+	/* If no configuration file changed, a reload would rebuild an
+	 * identical configuration - don't bother */
+	if (!conf_files_changed()) {
+		log_message(LOG_INFO, "Configuration file(s) unchanged on SIGHUP - not reloading");
+		return 0;
+	}
+
 	/* set the reloading flag */
 	SET_RELOAD;
 
 	log_message(LOG_INFO, "Got SIGHUP, reloading checker configuration");
 
+	/* Stop the shard workers - they are forked afresh from the new
+	 * configuration once it has been loaded */
+	stop_checker_shard_workers();
+
 	/* Terminate all script process */
 	script_killall(master, SIGTERM);
 
@@ -233,6 +454,23 @@ reload_check_thread(__attribute__((unused)) thread_t * thread)
 	thread_cleanup_master(master);
 	free_global_data(global_data);
 
+	/* The threads tracking running notify scripts went with the master
+	 * thread - drop the pending script queue and reset the count */
+	notify_flush_pending();
+
+	/* The DNS resolver cache references the old checkers */
+	dns_cache_clear();
+
+	/* The shared ping sockets' read threads went with the master thread */
+	ping_close_sockets();
+	syn_close_sockets();
+
+	/* The control and weight socket addresses may change across the
+	 * reload, and queued weight updates reference the old servers */
+	check_control_socket_close();
+	check_weight_socket_close();
+	wgt_debounce_clear();
+
 	/* Save previous checker data */
 	old_checkers_queue = checkers_queue;
 	checkers_queue = NULL;
@@ -250,6 +488,12 @@ reload_check_thread(__attribute__((unused)) thread_t * thread)
 	/* free backup data */
 	free_check_data(old_check_data);
 	free_list(&old_checkers_queue);
+
+#ifdef _WITH_SNMP_CHECKER_
+	/* The SNMP table snapshots reference the old configuration */
+	snmp_cache_reset();
+#endif
+
 	UNSET_RELOAD;
 
 	return 0;
@@ -306,6 +550,225 @@ check_respawn_thread(thread_t * thread)
 	}
 	return 0;
 }
+
+/* Shard worker signal handling - reloads are driven by the coordinator,
+ * which restarts the workers from the new configuration */
+static void
+checker_shard_signal_init(void)
+{
+	signal_handler_child_clear();
+	signal_ignore(SIGHUP);
+	signal_set(SIGINT, sigend_check, NULL);
+	signal_set(SIGTERM, sigend_check, NULL);
+	signal_ignore(SIGPIPE);
+}
+
+/* Shard worker main - run the slice of the checkers owned by this shard
+ * and report state transitions over the socketpair. The worker inherits
+ * the parsed configuration from the coordinator, but never touches the
+ * IPVS or notification state. */
+static void
+start_checker_shard(unsigned shard, int fd)
+{
+	checker_shard_id = shard;
+	checker_shard_fd = fd;
+
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+	signal_handler_destroy();
+	thread_destroy_master(master);	/* This destroys the coordinator's threads */
+	master = thread_make_master();
+	checker_shard_signal_init();
+
+	register_checkers_thread();
+
+	launch_scheduler();
+
+	/* Terminate all script process */
+	script_killall(master, SIGTERM);
+
+	thread_destroy_master(master);
+
+	log_message(LOG_INFO, "Stopped checker shard %u", shard);
+
+	exit(EXIT_SUCCESS);
+}
+
+/* Coordinator side - apply the state transitions reported by a worker */
+static int
+checker_shard_report_thread(thread_t * thread)
+{
+	checker_shard_msg_t msg;
+	unsigned shard = (unsigned)(uintptr_t)THREAD_ARG(thread);
+	int fd = THREAD_FD(thread);
+	ssize_t len;
+
+	while ((len = recv(fd, &msg, sizeof(msg), MSG_DONTWAIT)) == (ssize_t)sizeof(msg)) {
+		if (msg.id >= num_checkers_by_id) {
+			log_message(LOG_INFO, "Ignoring checker state report with invalid id %u", msg.id);
+			continue;
+		}
+		if (msg.is_weight)
+			update_svr_wgt_lazy(msg.weight, checkers_by_id[msg.id]->vs,
+					    checkers_by_id[msg.id]->rs);
+		else
+			update_svr_checker_state(msg.alive, checkers_by_id[msg.id]);
+	}
+
+	if (len == 0) {
+		/* The worker has gone; the respawn thread restarts it with
+		 * a fresh socketpair. It may already have stored the new fd,
+		 * so only drop the tracking entry if it is still ours. */
+		if (checker_shard_fds && checker_shard_fds[shard] == fd)
+			checker_shard_fds[shard] = -1;
+		close(fd);
+		return 0;
+	}
+
+	thread_add_read(master, checker_shard_report_thread, THREAD_ARG(thread), fd, TIMER_NEVER);
+	return 0;
+}
+
+/* Shard worker respawning thread */
+static int
+checker_shard_respawn_thread(thread_t * thread)
+{
+	unsigned shard = (unsigned)(uintptr_t)THREAD_ARG(thread);
+	pid_t pid;
+
+	/* Fetch thread args */
+	pid = THREAD_CHILD_PID(thread);
+
+	/* Restart respawning thread */
+	if (thread->type == THREAD_CHILD_TIMEOUT) {
+		thread_add_child(master, checker_shard_respawn_thread,
+				 THREAD_ARG(thread), pid, RESPAWN_TIMER);
+		return 0;
+	}
+
+	/* We catch a SIGCHLD, handle it */
+	if (checker_shard_pids && !__test_bit(DONT_RESPAWN_BIT, &debug)) {
+		log_message(LOG_ALERT, "Checker shard %u process(%d) died: Respawning", shard, pid);
+		start_checker_shard_worker(shard);
+	} else {
+		log_message(LOG_ALERT, "Checker shard %u process(%d) died: Exiting", shard, pid);
+		if (checker_shard_pids)
+			checker_shard_pids[shard] = 0;
+		raise(SIGTERM);
+	}
+	return 0;
+}
+
+/* Fork one shard worker */
+static bool
+start_checker_shard_worker(unsigned shard)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1) {
+		log_message(LOG_INFO, "Checker shard %u: socketpair error(%s)"
+				    , shard, strerror(errno));
+		return false;
+	}
+
+	if (log_file_name)
+		flush_log_file();
+
+	pid = fork();
+
+	if (pid < 0) {
+		log_message(LOG_INFO, "Checker shard %u: fork error(%s)"
+				    , shard, strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	} else if (pid) {
+		close(fds[1]);
+		checker_shard_pids[shard] = pid;
+		checker_shard_fds[shard] = fds[0];
+		log_message(LOG_INFO, "Starting checker shard %u process, pid=%d"
+				    , shard, pid);
+
+		thread_add_read(master, checker_shard_report_thread, (void *)(uintptr_t)shard,
+				fds[0], TIMER_NEVER);
+
+		/* Start respawning thread */
+		thread_add_child(master, checker_shard_respawn_thread,
+				 (void *)(uintptr_t)shard, pid, RESPAWN_TIMER);
+		return true;
+	}
+
+	close(fds[0]);
+	start_checker_shard(shard, fds[1]);
+
+	/* unreachable */
+	exit(EXIT_SUCCESS);
+}
+
+/* Fork the shard workers and index the checkers for their reports. The
+ * queue is rebuilt from the configuration on each (re)load, so the ids
+ * the workers inherit stay in step with the coordinator's. */
+static void
+start_checker_shard_workers(void)
+{
+	checker_t *checker;
+	element e;
+	unsigned shard;
+	unsigned num = 0;
+
+	num_checkers_by_id = LIST_SIZE(checkers_queue);
+	checkers_by_id = (checker_t **) MALLOC(num_checkers_by_id * sizeof(checker_t *));
+	for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		checker = ELEMENT_DATA(e);
+		checker->id = num;
+		checkers_by_id[num++] = checker;
+	}
+
+	num_checker_shards = global_data->checker_shards;
+	checker_shard_pids = (pid_t *) MALLOC(num_checker_shards * sizeof(pid_t));
+	checker_shard_fds = (int *) MALLOC(num_checker_shards * sizeof(int));
+	for (shard = 0; shard < num_checker_shards; shard++)
+		checker_shard_fds[shard] = -1;
+	for (shard = 0; shard < num_checker_shards; shard++)
+		start_checker_shard_worker(shard);
+}
+
+/* Stop the shard workers. The respawn threads are destroyed with the
+ * master (daemon stop) or by thread_cleanup_master (reload), so reap
+ * the workers here rather than racing a respawn against them. */
+static void
+stop_checker_shard_workers(void)
+{
+	unsigned shard;
+
+	if (!checker_shard_pids)
+		return;
+
+	for (shard = 0; shard < num_checker_shards; shard++) {
+		if (checker_shard_pids[shard] > 0)
+			kill(checker_shard_pids[shard], SIGTERM);
+	}
+	for (shard = 0; shard < num_checker_shards; shard++) {
+		if (checker_shard_pids[shard] > 0)
+			waitpid(checker_shard_pids[shard], NULL, 0);
+	}
+
+	/* The report read-threads are destroyed without being dispatched
+	 * on a reload, so their EOF path never closes our socketpair ends */
+	for (shard = 0; shard < num_checker_shards; shard++) {
+		if (checker_shard_fds[shard] != -1)
+			close(checker_shard_fds[shard]);
+	}
+
+	FREE_PTR(checker_shard_pids);
+	checker_shard_pids = NULL;
+	FREE_PTR(checker_shard_fds);
+	checker_shard_fds = NULL;
+	FREE_PTR(checkers_by_id);
+	checkers_by_id = NULL;
+	num_checkers_by_id = 0;
+}
 #endif
 
 /* Register CHECK thread */
@@ -338,12 +801,14 @@ start_check_child(void)
 	}
 	prctl(PR_SET_PDEATHSIG, SIGTERM);
 
-	/* Clear any child finder functions set in parent */
+	/* Clear any child finder name function set in parent */
 	set_child_finder_name(NULL);
-	set_child_finder(NULL, NULL, NULL, NULL, NULL, 0);	/* Currently these won't be set */
 
 	prog_type = PROG_TYPE_CHECKER;
 
+	/* Account this process's allocations to the check subsystem */
+	mem_ctx_set(MEM_CTX_CHECK);
+
 	if ((instance_name
 #if HAVE_DECL_CLONE_NEWNET
 			   || network_namespace
@@ -355,9 +820,14 @@ start_check_child(void)
 		syslog_ident = PROG_CHECK;
 
 	/* Opening local CHECK syslog channel */
-	if (!__test_bit(NO_SYSLOG_BIT, &debug))
+	if (!__test_bit(NO_SYSLOG_BIT, &debug)) {
 		openlog(syslog_ident, LOG_PID | ((__test_bit(LOG_CONSOLE_BIT, &debug)) ? LOG_CONS : 0)
 				    , (log_facility==LOG_DAEMON) ? LOG_LOCAL2 : log_facility);
+		if (__test_bit(LOG_ASYNC_BIT, &debug))
+			enable_async_log(syslog_ident, (log_facility==LOG_DAEMON) ? LOG_LOCAL2 : log_facility);
+		if (__test_bit(LOG_JOURNAL_BIT, &debug))
+			enable_journal_log(syslog_ident, (log_facility==LOG_DAEMON) ? LOG_LOCAL2 : log_facility);
+	}
 
 	if (log_file_name)
 		open_log_file(log_file_name, "check", network_namespace, instance_name);
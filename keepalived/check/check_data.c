@@ -108,7 +108,10 @@ dump_vsg(void *data)
 static void
 free_vsg_entry(void *data)
 {
-	FREE(data);
+	virtual_server_group_entry_t *vsg_entry = data;
+
+	FREE_PTR(vsg_entry->exp_addr);
+	FREE(vsg_entry);
 }
 static void
 dump_vsg_entry(void *data)
@@ -157,6 +160,7 @@ alloc_vsg_entry(vector_t *strvec)
 	virtual_server_group_entry_t *new;
 	virtual_server_group_entry_t *old;
 	uint32_t start;
+	uint32_t i;
 	element e;
 
 	new = (virtual_server_group_entry_t *) MALLOC(sizeof(virtual_server_group_entry_t));
@@ -213,6 +217,19 @@ alloc_vsg_entry(vector_t *strvec)
 			new->range -= start;
 		}
 
+		/* Expand the range once into a flat array of concrete
+		 * addresses, so set operations iterate the array instead
+		 * of recomputing addresses on every quorum change */
+		new->exp_count = new->range + 1;
+		new->exp_addr = (union nf_inet_addr *) MALLOC(new->exp_count * sizeof(*new->exp_addr));
+		for (i = 0; i < new->exp_count; i++) {
+			if (new->addr.ss_family == AF_INET6) {
+				inet_sockaddrip6(&new->addr, &new->exp_addr[i].in6);
+				new->exp_addr[i].in6.s6_addr16[7] = htons((uint16_t)(start + i));
+			} else
+				new->exp_addr[i].ip = htonl(ntohl(((struct sockaddr_in *)&new->addr)->sin_addr.s_addr) + i);
+		}
+
 		list_add(vsg->addr_range, new);
 	}
 }
@@ -416,6 +433,8 @@ free_rs(void *data)
 	free_notify_script(&rs->notify_up);
 	free_notify_script(&rs->notify_down);
 	FREE_PTR(rs->virtualhost);
+	if (rs->ssl_session)
+		SSL_SESSION_free(rs->ssl_session);
 	FREE(rs);
 }
 
@@ -538,6 +557,8 @@ dump_check_data(check_data_t *data)
 		dump_list(data->vs);
 	}
 	dump_checkers_queue();
+
+	mem_ctx_log();
 }
 
 char *
@@ -597,12 +618,32 @@ check_check_script_security(void)
 	}
 }
 
+/* Two checkers may share one probe if they are of the same type with
+ * the same parameters (the type compare covers the connection options,
+ * and so the probed address and port) and run at the same cadence */
+static bool
+checker_probe_identical(checker_t *a, checker_t *b)
+{
+	if (a->launch != b->launch ||
+	    !a->compare || a->compare != b->compare)
+		return false;
+
+	if (a->enabled != b->enabled ||
+	    a->alpha != b->alpha ||
+	    a->delay_loop != b->delay_loop ||
+	    a->retry != b->retry ||
+	    a->delay_before_retry != b->delay_before_retry)
+		return false;
+
+	return a->compare(a, b);
+}
+
 bool validate_check_config(void)
 {
 	element e, e1;
 	virtual_server_t *vs;
 	real_server_t *rs;
-	checker_t *checker;
+	checker_t *checker, *leader;
 	element next;
 
 	using_ha_suspend = false;
@@ -746,12 +787,40 @@ bool validate_check_config(void)
 						checker->delay_loop;
 			}
 
+			/* Default backoff cap of 32 probe intervals */
+			if (checker->backoff_after && checker->backoff_max == ULONG_MAX)
+				checker->backoff_max = checker->delay_loop * 32;
+
 			/* In Alpha mode also mark the checker as failed. */
 			if (checker->alpha) {
 				set_checker_state(checker, false);
 				UNSET_ALIVE(checker->rs);
 			}
 		}
+
+		/* The same real server often appears in many virtual servers
+		 * with an identical checker. Probing each (vs,rs) pair
+		 * separately multiplies identical probes, so elect the first
+		 * checker of each identical group as leader and subscribe the
+		 * others to its result. */
+		for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+			checker = ELEMENT_DATA(e);
+			for (e1 = LIST_HEAD(checkers_queue); e1 != e; ELEMENT_NEXT(e1)) {
+				leader = ELEMENT_DATA(e1);
+				if (leader->probe_leader ||
+				    !checker_probe_identical(leader, checker))
+					continue;
+
+				checker->probe_leader = leader;
+				if (!LIST_EXISTS(leader->probe_followers))
+					leader->probe_followers = alloc_list(NULL, NULL);
+				list_add(leader->probe_followers, checker);
+				log_message(LOG_INFO, "VS %s: subscribing to shared probe of service %s"
+						    , FMT_VS(checker->vs)
+						    , FMT_RS(checker->rs, checker->vs));
+				break;
+			}
+		}
 	}
 
 // ??? This should probably be done in check_daemon after clear_diff_services()
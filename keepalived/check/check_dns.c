@@ -29,6 +29,7 @@
 
 #include "check_dns.h"
 #include "check_api.h"
+#include "global_data.h"
 #include "memory.h"
 #include "ipwrapper.h"
 #include "logger.h"
@@ -36,6 +37,8 @@
 #include "utils.h"
 #include "parser.h"
 #include "timer.h"
+#include "hashtab.h"
+#include "list.h"
 #if !HAVE_DECL_SOCK_CLOEXEC
 #include "old_socket.h"
 #include "string.h"
@@ -103,6 +106,224 @@ dns_log_message(thread_t * thread, int level, const char *fmt, ...)
 	log_message(level, "DNS_CHECK (%s) %s", FMT_DNS_RS(checker), buf);
 }
 
+/* Shared resolver cache.
+ *
+ * Many virtual servers often check the same name against the same
+ * server. Identical (server, name, type) queries within the record's
+ * TTL are answered from cache, and checkers asking while an identical
+ * query is in flight piggyback on its answer, so N identical checks
+ * cost one packet instead of N. */
+#define DNS_CACHE_TTL_MAX	300	/* cap on answer TTL, seconds */
+#define DNS_CACHE_NEG_TTL	5	/* how long to cache a failure, seconds */
+
+typedef struct _dns_cache_entry {
+	uint64_t key;
+	const char *name;	/* key collision verification */
+	uint16_t type;
+	struct sockaddr_storage dst;
+	bool pending;		/* owner query in flight */
+	bool up;		/* cached result */
+	timeval_t expires;	/* validity of the cached result */
+	list waiters;		/* checkers awaiting the in-flight query */
+} dns_cache_entry_t;
+
+static hashtab_t dns_cache;
+static list dns_cache_entries;
+
+static uint64_t
+dns_cache_key(checker_t *checker)
+{
+	dns_check_t *dns_check = CHECKER_ARG(checker);
+	const uint8_t *p = (const uint8_t *)&checker->co->dst;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const char *s;
+	size_t i;
+
+	for (s = dns_check->name; *s; s++)
+		h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+	h = (h ^ (dns_check->type & 0xff)) * 0x100000001b3ULL;
+	h = (h ^ (dns_check->type >> 8)) * 0x100000001b3ULL;
+	for (i = 0; i < sizeof(checker->co->dst); i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+
+	return h;
+}
+
+static dns_cache_entry_t *
+dns_cache_lookup(checker_t *checker)
+{
+	dns_check_t *dns_check = CHECKER_ARG(checker);
+	dns_cache_entry_t *entry;
+
+	if (!dns_cache.size)
+		return NULL;
+
+	entry = htab_find(&dns_cache, dns_cache_key(checker));
+	if (!entry)
+		return NULL;
+
+	/* Guard against a 64 bit key collision */
+	if (entry->type != dns_check->type ||
+	    strcmp(entry->name, dns_check->name) ||
+	    memcmp(&entry->dst, &checker->co->dst, sizeof(entry->dst)))
+		return NULL;
+
+	return entry;
+}
+
+static void
+dns_free_cache_entry(void *data)
+{
+	dns_cache_entry_t *entry = data;
+
+	if (LIST_EXISTS(entry->waiters))
+		free_list(&entry->waiters);
+	FREE(entry);
+}
+
+void
+dns_cache_clear(void)
+{
+	if (LIST_EXISTS(dns_cache_entries))
+		free_list(&dns_cache_entries);
+	if (dns_cache.size)
+		htab_destroy(&dns_cache);
+}
+
+/* Mark that this checker now owns an in-flight query for its key */
+static void
+dns_cache_mark_pending(checker_t *checker)
+{
+	dns_check_t *dns_check = CHECKER_ARG(checker);
+	dns_cache_entry_t *entry;
+
+	if ((entry = dns_cache_lookup(checker))) {
+		entry->pending = true;
+		return;
+	}
+
+	if (!dns_cache.size)
+		htab_init(&dns_cache, 64);
+	if (!LIST_EXISTS(dns_cache_entries))
+		dns_cache_entries = alloc_list(dns_free_cache_entry, NULL);
+
+	entry = (dns_cache_entry_t *) MALLOC(sizeof (dns_cache_entry_t));
+	entry->key = dns_cache_key(checker);
+	entry->name = dns_check->name;
+	entry->type = dns_check->type;
+	entry->dst = checker->co->dst;
+	entry->pending = true;
+
+	if (!htab_insert(&dns_cache, entry->key, entry)) {
+		/* key collision - run this checker uncached */
+		FREE(entry);
+		return;
+	}
+	list_add(dns_cache_entries, entry);
+}
+
+/* Apply a result obtained by another checker's query (or from cache).
+ * The owner has already been through its retry cycle, so the result is
+ * taken as is. */
+static void
+dns_cache_apply(thread_master_t *master, checker_t *checker, bool up)
+{
+	if (up) {
+		if (!checker->is_up) {
+			log_message(LOG_INFO, "DNS_CHECK (%s) cached result: up", FMT_DNS_RS(checker));
+			smtp_alert(checker, NULL, NULL, "UP",
+				   "=> DNS_CHECK: succeed on service <=");
+			update_svr_checker_state(UP, checker);
+		}
+	} else {
+		if (checker->is_up) {
+			log_message(LOG_INFO, "DNS_CHECK (%s) cached result: down", FMT_DNS_RS(checker));
+			update_svr_checker_state(DOWN, checker);
+			smtp_alert(checker, NULL, NULL, "DOWN",
+				   "=> DNS_CHECK: failed on service <=");
+		}
+	}
+
+	checker->retry_it = 0;
+	thread_add_timer_slack(master, dns_connect_thread, checker,
+			 checker_adjust_delay(checker, up),
+				 global_data->checker_timer_slack);
+}
+
+/* Record a completed query and hand the result to any waiters */
+static void
+dns_cache_store(thread_t *thread, bool up)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	dns_check_t *dns_check = CHECKER_ARG(checker);
+	dns_cache_entry_t *entry;
+	checker_t *waiter;
+	element e;
+	uint32_t ttl;
+
+	if (!(entry = dns_cache_lookup(checker)))
+		return;
+
+	ttl = up ? dns_check->rttl : DNS_CACHE_NEG_TTL;
+	if (ttl > DNS_CACHE_TTL_MAX)
+		ttl = DNS_CACHE_TTL_MAX;
+
+	entry->pending = false;
+	entry->up = up;
+	entry->expires = timer_add_long(time_now, ttl * TIMER_HZ);
+
+	if (LIST_ISEMPTY(entry->waiters))
+		return;
+
+	for (e = LIST_HEAD(entry->waiters); e; ELEMENT_NEXT(e)) {
+		waiter = ELEMENT_DATA(e);
+		dns_cache_apply(thread->master, waiter, up);
+	}
+	free_list(&entry->waiters);
+}
+
+/* Extract the TTL of the first answer RR, for the result cache */
+static uint32_t
+dns_answer_ttl(const uint8_t *buf, size_t len)
+{
+	const dns_header_t *header = (const dns_header_t *) buf;
+	const uint8_t *p = buf + sizeof (*header);
+	const uint8_t *end = buf + len;
+	uint16_t qdcount = ntohs(header->qdcount);
+	uint32_t ttl;
+
+	if (!ntohs(header->ancount))
+		return 0;
+
+	/* Skip the question section */
+	while (qdcount--) {
+		while (p < end && *p) {
+			if ((*p & 0xc0) == 0xc0) {
+				p++;
+				break;
+			}
+			p += *p + 1;
+		}
+		p += 1 + 4;	/* label end + qtype + qclass */
+	}
+
+	/* Skip the answer name */
+	while (p < end && *p) {
+		if ((*p & 0xc0) == 0xc0) {
+			p++;
+			break;
+		}
+		p += *p + 1;
+	}
+	p += 1 + 4;	/* label end + type + class */
+
+	if (p + 4 > end)
+		return 0;
+
+	memcpy(&ttl, p, sizeof (ttl));
+	return ntohl(ttl);
+}
+
 static int
 dns_final(thread_t * thread, int error, const char *fmt, ...)
 {
@@ -126,16 +347,19 @@ dns_final(thread_t * thread, int error, const char *fmt, ...)
 			}
 			if (checker->retry_it < checker->retry) {
 				checker->retry_it++;
-				thread_add_timer(thread->master,
+				thread_add_timer_slack(thread->master,
 						 dns_connect_thread, checker,
-						 checker->delay_before_retry);
+						 checker->delay_before_retry,
+				 global_data->checker_timer_slack);
 				return 0;
 			}
 			update_svr_checker_state(DOWN, checker);
 			smtp_alert(checker, NULL, NULL, "DOWN",
 				   "=> DNS_CHECK: failed on service <=");
 		}
+		dns_cache_store(thread, false);
 	} else {
+		dns_cache_store(thread, true);
 		if (!checker->is_up) {
 			smtp_alert(checker, NULL, NULL, "UP",
 				   "=> DNS_CHECK: succeed on service <=");
@@ -144,8 +368,9 @@ dns_final(thread_t * thread, int error, const char *fmt, ...)
 	}
 
 	checker->retry_it = 0;
-	thread_add_timer(thread->master, dns_connect_thread, checker,
-			 checker->delay_loop);
+	thread_add_timer_slack(thread->master, dns_connect_thread, checker,
+			 checker_adjust_delay(checker, !error),
+				 global_data->checker_timer_slack);
 
 	return 0;
 }
@@ -213,6 +438,7 @@ dns_recv_thread(thread_t * thread)
 	}
 
 	/* success */
+	dns_check->rttl = dns_answer_ttl((uint8_t *)rbuf, (size_t)ret);
 	dns_final(thread, 0, NULL);
 
 	return 0;
@@ -329,8 +555,6 @@ dns_check_thread(thread_t * thread)
 		break;
 	case connect_success:
 		dns_make_query(thread);
-		fcntl(thread->u.fd, F_SETFL,
-		      fcntl(thread->u.fd, F_GETFL, 0) | O_NONBLOCK);
 		timeout = timer_long(thread->sands) - timer_long(time_now);
 		thread_add_write(thread->master, dns_send_thread, checker,
 				 thread->u.fd, timeout);
@@ -344,21 +568,39 @@ static int
 dns_connect_thread(thread_t * thread)
 {
 	int fd, status;
+	dns_cache_entry_t *entry;
 
 	checker_t *checker = THREAD_ARG(thread);
 	conn_opts_t *co = checker->co;
 
 	if (!checker->enabled) {
-		thread_add_timer(thread->master, dns_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, dns_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
 		return 0;
 	}
 
-	if ((fd = socket(co->dst.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP)) == -1) {
+	/* Shared resolver: piggyback on an identical query already in
+	 * flight, or use a fresh cached result */
+	if ((entry = dns_cache_lookup(checker))) {
+		if (entry->pending) {
+			if (!LIST_EXISTS(entry->waiters))
+				entry->waiters = alloc_list(NULL, NULL);
+			list_add(entry->waiters, checker);
+			return 0;
+		}
+		if (timer_cmp(time_now, entry->expires) < 0) {
+			dns_cache_apply(thread->master, checker, entry->up);
+			return 0;
+		}
+	}
+
+	if ((fd = socket_netns(co->netns, co->dst.ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP)) == -1) {
 		dns_log_message(thread, LOG_INFO,
 				"failed to create socket. Rescheduling.");
-		thread_add_timer(thread->master, dns_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, dns_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
 		return 0;
 	}
 #if !HAVE_DECL_SOCK_CLOEXEC
@@ -371,14 +613,20 @@ dns_connect_thread(thread_t * thread)
 	status = socket_bind_connect(fd, co);
 
 	/* handle connection status & register check worker thread */
-	if (socket_connection_state(fd, status, thread, dns_check_thread, co->connection_to)) {
+	if (socket_connection_state(fd, status, thread, dns_check_thread, co)) {
 		close(fd);
 		dns_log_message(thread, LOG_INFO,
 				"UDP socket bind failed. Rescheduling.");
-		thread_add_timer(thread->master, dns_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, dns_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
+		return 0;
 	}
 
+	/* This checker's query will answer for any identical checkers
+	 * asking before it completes */
+	dns_cache_mark_pending(checker);
+
 	return 0;
 }
 
@@ -25,8 +25,10 @@
 
 #include <openssl/err.h>
 #include "check_http.h"
+#include "crc32c.h"
 #include "check_ssl.h"
 #include "check_api.h"
+#include "global_data.h"
 #include "logger.h"
 #include "memory.h"
 #include "parser.h"
@@ -39,6 +41,7 @@
 
 #define	REGISTER_CHECKER_NEW	1
 #define	REGISTER_CHECKER_RETRY	2
+#define	REGISTER_CHECKER_FAILED	3
 
 static int http_connect_thread(thread_t *);
 
@@ -50,6 +53,8 @@ free_url(void *data)
 	FREE_PTR(url->path);
 	FREE_PTR(url->digest);
 	FREE_PTR(url->virtualhost);
+	FREE_PTR(url->request);
+	FREE_PTR(url->content_encoding);
 	FREE(url);
 }
 
@@ -60,6 +65,10 @@ dump_url(void *data)
 	log_message(LOG_INFO, "   Checked url = %s", url->path);
 	if (url->digest)
 		log_message(LOG_INFO, "     digest = %s", url->digest);
+	if (url->fingerprint_set)
+		log_message(LOG_INFO, "     fingerprint = %8.8x", url->fingerprint);
+	if (url->digest_bytes)
+		log_message(LOG_INFO, "     digest bytes = %zu", url->digest_bytes);
 	if (url->status_code)
 		log_message(LOG_INFO, "     HTTP Status Code = %d", url->status_code);
 	if (url->virtualhost)
@@ -75,6 +84,7 @@ free_http_request(request_t *req)
 		SSL_free(req->ssl);
 	if (req->buffer)
 		FREE(req->buffer);
+	FREE_PTR(req->content_encoding);
 	FREE(req);
 }
 
@@ -86,7 +96,12 @@ free_http_get_check(void *data)
 
 	free_list(&http_get_chk->url);
 	free_http_request(req);
+	if (http_get_chk->ka_ssl)
+		SSL_free(http_get_chk->ka_ssl);
+	if (http_get_chk->ka_fd != -1)
+		close(http_get_chk->ka_fd);
 	FREE_PTR(http_get_chk->virtualhost);
+	FREE_PTR(http_get_chk->accept_encoding);
 	FREE_PTR(http_get_chk);
 	FREE_PTR(CHECKER_CO(data));
 	FREE(data);
@@ -103,6 +118,13 @@ dump_http_get_check(void *data)
 	dump_checker_opts(checker);
 	if (http_get_chk->virtualhost)
 		log_message(LOG_INFO, "   Virtualhost = %s", http_get_chk->virtualhost);
+	if (http_get_chk->accept_encoding)
+		log_message(LOG_INFO, "   Accept-Encoding = %s", http_get_chk->accept_encoding);
+	if (http_get_chk->keepalive)
+		log_message(LOG_INFO, "   Keep-alive = on");
+	if (http_get_chk->deep_interval)
+		log_message(LOG_INFO, "   Deep check interval = %lu",
+				http_get_chk->deep_interval / TIMER_HZ);
 	dump_list(http_get_chk->url);
 }
 static http_checker_t *
@@ -115,6 +137,7 @@ alloc_http_get(char *proto)
 	    (!strcmp(proto, "HTTP_GET")) ? PROTO_HTTP : PROTO_SSL;
 	http_get_chk->url = alloc_list(free_url, dump_url);
 	http_get_chk->virtualhost = NULL;
+	http_get_chk->ka_fd = -1;
 
 	if (http_get_chk->proto == PROTO_SSL)
 		check_data->ssl_required = true;
@@ -138,6 +161,14 @@ http_get_check_compare(void *a, void *b)
 		return false;
 	if (old->virtualhost && strcmp(old->virtualhost, new->virtualhost))
 		return false;
+	if (old->keepalive != new->keepalive)
+		return false;
+	if (!old->accept_encoding != !new->accept_encoding)
+		return false;
+	if (old->accept_encoding && strcmp(old->accept_encoding, new->accept_encoding))
+		return false;
+	if (old->deep_interval != new->deep_interval)
+		return false;
 	for (n = 0; n < LIST_SIZE(new->url); n++) {
 		u1 = (url_t *)list_element(old->url, n);
 		u2 = (url_t *)list_element(new->url, n);
@@ -147,6 +178,12 @@ http_get_check_compare(void *a, void *b)
 			return false;
 		if (u1->digest && strcmp(u1->digest, u2->digest))
 			return false;
+		if (u1->fingerprint_set != u2->fingerprint_set)
+			return false;
+		if (u1->fingerprint_set && u1->fingerprint != u2->fingerprint)
+			return false;
+		if (u1->digest_bytes != u2->digest_bytes)
+			return false;
 		if (u1->status_code != u2->status_code)
 			return false;
 		if (!u1->virtualhost != !u2->virtualhost)
@@ -188,6 +225,38 @@ virtualhost_handler(vector_t *strvec)
 	http_get_chk->virtualhost = CHECKER_VALUE_STRING(strvec);
 }
 
+static void
+accept_encoding_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+
+	http_get_chk->accept_encoding = CHECKER_VALUE_STRING(strvec);
+}
+
+static void
+keepalive_handler(__attribute__((unused)) vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+
+	http_get_chk->keepalive = true;
+}
+
+static void
+deep_interval_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+
+	http_get_chk->deep_interval = CHECKER_VALUE_UINT(strvec) * TIMER_HZ;
+}
+
+static void
+fastopen_handler(__attribute__((unused)) vector_t *strvec)
+{
+	conn_opts_t *co = CHECKER_GET_CO();
+
+	co->fast_open = true;
+}
+
 static void
 http_get_check(void)
 {
@@ -230,9 +299,42 @@ digest_handler(vector_t *strvec)
 	http_checker_t *http_get_chk = CHECKER_GET();
 	url_t *url = LIST_TAIL_DATA(http_get_chk->url);
 
+	if (url->fingerprint_set) {
+		log_message(LOG_INFO, "fingerprint overrides digest for url %s", url->path ? url->path : "");
+		return;
+	}
+
 	url->digest = CHECKER_VALUE_STRING(strvec);
 }
 
+static void
+fingerprint_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+	url_t *url = LIST_TAIL_DATA(http_get_chk->url);
+	char *str = CHECKER_VALUE_STRING(strvec);
+
+	url->fingerprint = (uint32_t)strtoul(str, NULL, 16);
+	url->fingerprint_set = true;
+	FREE(str);
+
+	/* The round streams a single hash - the cheap one wins */
+	if (url->digest) {
+		log_message(LOG_INFO, "fingerprint overrides digest for url %s", url->path ? url->path : "");
+		FREE_PTR(url->digest);
+		url->digest = NULL;
+	}
+}
+
+static void
+digest_bytes_handler(vector_t *strvec)
+{
+	http_checker_t *http_get_chk = CHECKER_GET();
+	url_t *url = LIST_TAIL_DATA(http_get_chk->url);
+
+	url->digest_bytes = (size_t)CHECKER_VALUE_INT(strvec);
+}
+
 static void
 status_code_handler(vector_t *strvec)
 {
@@ -270,10 +372,16 @@ install_http_ssl_check_keyword(const char *keyword)
 	install_checker_common_keywords(true);
 	install_keyword("nb_get_retry", &http_get_retry_handler);	/* Deprecated */
 	install_keyword("virtualhost", &virtualhost_handler);
+	install_keyword("accept_encoding", &accept_encoding_handler);
+	install_keyword("keepalive", &keepalive_handler);
+	install_keyword("deep_interval", &deep_interval_handler);
+	install_keyword("fastopen", &fastopen_handler);
 	install_keyword("url", &url_handler);
 	install_sublevel();
 	install_keyword("path", &path_handler);
 	install_keyword("digest", &digest_handler);
+	install_keyword("fingerprint", &fingerprint_handler);
+	install_keyword("digest_bytes", &digest_bytes_handler);
 	install_keyword("status_code", &status_code_handler);
 	install_keyword("virtualhost", &url_virtualhost_handler);
 	install_sublevel_end_handler(url_check);
@@ -335,6 +443,7 @@ epilog(thread_t * thread, int method, unsigned t, unsigned c)
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
 	request_t *req = http_get_check->req;
 	unsigned long delay = 0;
+	bool cycle_success = false;
 
 	http_get_check->url_it += t ? t : -http_get_check->url_it;
 	checker->retry_it += c ? c : -checker->retry_it;
@@ -351,6 +460,7 @@ epilog(thread_t * thread, int method, unsigned t, unsigned c)
 				   "=> CHECK succeed on service <=");
 			update_svr_checker_state(UP, checker);
 		}
+		cycle_success = true;
 
 		/* Reset it counters */
 		http_get_check->url_it = 0;
@@ -384,11 +494,16 @@ epilog(thread_t * thread, int method, unsigned t, unsigned c)
 	/* register next timer thread */
 	switch (method) {
 	case REGISTER_CHECKER_NEW:
-		delay = checker->delay_loop;
+		delay = cycle_success ? checker_adjust_delay(checker, true) :
+					checker->delay_loop;
+		break;
+	case REGISTER_CHECKER_FAILED:
+		/* Server already known dead failed again - a concluded cycle */
+		delay = checker_adjust_delay(checker, false);
 		break;
 	case REGISTER_CHECKER_RETRY:
 		if (http_get_check->url_it == 0 && checker->retry_it == 0)
-			delay = checker->delay_loop;
+			delay = checker_adjust_delay(checker, false);
 		else
 			delay = checker->delay_before_retry;
 		break;
@@ -396,13 +511,24 @@ epilog(thread_t * thread, int method, unsigned t, unsigned c)
 
 	/* If req == NULL, fd is not created */
 	if (req) {
-		free_http_request(req);
+		if (http_get_check->ka_keep && http_get_check->ka_fd == -1) {
+			/* Park the connection (and its TLS session) for the next GET */
+			http_get_check->ka_fd = thread->u.fd;
+			http_get_check->ka_ssl = req->ssl;
+			http_get_check->ka_bio = req->bio;
+			req->ssl = NULL;
+			free_http_request(req);
+		} else {
+			free_http_request(req);
+			close(thread->u.fd);
+		}
 		http_get_check->req = NULL;
-		close(thread->u.fd);
+		http_get_check->ka_keep = false;
 	}
 
 	/* Register next checker thread */
-	thread_add_timer(thread->master, http_connect_thread, checker, delay);
+	thread_add_timer_slack(thread->master, http_connect_thread, checker, delay,
+				 global_data->checker_timer_slack);
 	return 0;
 }
 
@@ -410,6 +536,22 @@ int
 timeout_epilog(thread_t * thread, const char *debug_msg)
 {
 	checker_t *checker = THREAD_ARG(thread);
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	request_t *req = http_get_check->req;
+
+	/* The server may have closed a kept-alive connection between two
+	 * rounds; fall back to a fresh connection without counting a failure */
+	if (http_get_check->ka_reused) {
+		http_get_check->ka_reused = false;
+		http_get_check->ka_keep = false;
+		if (req) {
+			free_http_request(req);
+			http_get_check->req = NULL;
+			close(thread->u.fd);
+		}
+		thread_add_timer(thread->master, http_connect_thread, checker, 0);
+		return 0;
+	}
 
 	/* check if server is currently alive */
 	if (checker->is_up) {
@@ -420,7 +562,7 @@ timeout_epilog(thread_t * thread, const char *debug_msg)
 	}
 
 	/* do not retry if server is already known as dead */
-	return epilog(thread, REGISTER_CHECKER_NEW, 0, 0);
+	return epilog(thread, REGISTER_CHECKER_FAILED, 0, 0);
 }
 
 /* return the url pointer of the current url iterator  */
@@ -441,6 +583,7 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 	url_t *url;
 	int r, di = 0;
 	char *digest_tmp;
+	bool skip_digest = false;
 	url_t *fetched_url = fetch_next_url(http_get_check);
 	enum {
 		NONE,
@@ -453,6 +596,9 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 	if (empty_buffer)
 		return timeout_epilog(thread, "Read, no data received from ");
 
+	/* The server answered, so the reused connection was good */
+	http_get_check->ka_reused = false;
+
 	/* Next check the HTTP status code */
 	if (fetched_url->status_code) {
 		if (req->status_code != fetched_url->status_code)
@@ -463,9 +609,30 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 	else if (req->status_code >= 200 && req->status_code <= 299)
 		last_success = ON_SUCCESS;
 
-	/* Report a length mismatch the first time we get the specific difference */
+	/* A light round stops at the status line - no length or digest
+	 * validation. A cheap probe alone never brings a server back up:
+	 * escalate to a full round first. */
+	if (http_get_check->light_round) {
+		if (!checker->is_up) {
+			http_get_check->force_deep = true;
+			free_http_request(req);
+			http_get_check->req = NULL;
+			http_get_check->ka_keep = false;
+			close(thread->u.fd);
+			thread_add_timer(thread->master, http_connect_thread,
+					 checker, 0);
+			return 1;
+		}
+		return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
+	}
+
+	/* Report a length mismatch the first time we get the specific difference.
+	 * A digest limited to the first N bytes concludes before end of body,
+	 * so a mismatch is then expected. */
 	url = list_element(http_get_check->url, http_get_check->url_it);
-	if (req->content_len != UINT_MAX && req->content_len != req->rx_bytes) {
+	if (req->digest_limit != UINT_MAX && req->rx_bytes >= req->digest_limit)
+		url->len_mismatch = 0;
+	else if (req->content_len != UINT_MAX && req->content_len != req->rx_bytes) {
 		if (url->len_mismatch != (ssize_t)req->content_len - (ssize_t)req->rx_bytes) {
 			log_message(LOG_INFO, "http_check for RS %s VS %s url %s%s: content_length (%lu) does not match received bytes (%lu)",
 				    FMT_RS(checker->rs, checker->vs), FMT_VS(checker->vs), url->virtualhost ? url->virtualhost : "",
@@ -476,8 +643,35 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 	else
 		url->len_mismatch = 0;
 
+	/* The digest/fingerprint is computed over the body bytes as sent,
+	 * so a change of Content-Encoding changes it without the content
+	 * having changed. Record the encoding the hash is validated
+	 * against; when it changes, skip the comparison for this round
+	 * instead of reporting a false mismatch. */
+	if (fetched_url->digest || fetched_url->fingerprint_set) {
+		if (!fetched_url->encoding_seen) {
+			fetched_url->encoding_seen = true;
+			fetched_url->content_encoding = req->content_encoding;
+			req->content_encoding = NULL;
+		} else if (!fetched_url->content_encoding != !req->content_encoding ||
+			   (fetched_url->content_encoding && req->content_encoding &&
+			    strcmp(fetched_url->content_encoding, req->content_encoding))) {
+			log_message(LOG_INFO, "http_check for RS %s VS %s url %s: Content-Encoding changed from %s to %s - skipping digest comparison",
+				    FMT_RS(checker->rs, checker->vs), FMT_VS(checker->vs), fetched_url->path,
+				    fetched_url->content_encoding ? fetched_url->content_encoding : "identity",
+				    req->content_encoding ? req->content_encoding : "identity");
+			FREE_PTR(fetched_url->content_encoding);
+			fetched_url->content_encoding = req->content_encoding;
+			req->content_encoding = NULL;
+			skip_digest = true;
+		}
+	}
+
 	/* Continue with MD5SUM */
-	if (fetched_url->digest) {
+	if (skip_digest) {
+		/* treated neither as a digest success nor a failure */
+	}
+	else if (fetched_url->digest) {
 		/* Compute MD5SUM */
 		digest_tmp = (char *) MALLOC(MD5_BUFFER_LENGTH + 1);
 		for (di = 0; di < 16; di++)
@@ -490,6 +684,11 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 			return timeout_epilog(thread, "MD5 digest error to");
 		last_success = ON_DIGEST;
 	}
+	else if (fetched_url->fingerprint_set) {
+		if (CRC32C_FINAL(req->crc) != fetched_url->fingerprint)
+			return timeout_epilog(thread, "CRC32C fingerprint error to");
+		last_success = ON_DIGEST;
+	}
 
 	if (!checker->is_up) {
 		switch (last_success) {
@@ -509,7 +708,8 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 				return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
 			case ON_DIGEST:
 				log_message(LOG_INFO,
-					"MD5 digest success to %s url(%u)."
+					"%s success to %s url(%u)."
+					, fetched_url->fingerprint_set ? "CRC32C fingerprint" : "MD5 digest"
 					, FMT_HTTP_RS(checker)
 					, http_get_check->url_it + 1);
 				return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
@@ -519,28 +719,61 @@ http_handle_response(thread_t * thread, unsigned char digest[16]
 	return epilog(thread, REGISTER_CHECKER_NEW, 0, 0) + 1;
 }
 
-/* Handle response stream performing MD5 updates */
+/* Body bytes still to be fed to the digest - bounded by the content
+ * length and by any configured first-N-bytes digest limit */
+static size_t
+http_digest_remaining(request_t *req)
+{
+	size_t limit = req->content_len;
+
+	if (req->digest_limit < limit)
+		limit = req->digest_limit;
+
+	if (limit == UINT_MAX)
+		return UINT_MAX;
+
+	return limit > req->rx_bytes ? limit - req->rx_bytes : 0;
+}
+
+/* Feed body bytes to whichever hash the round is running */
+static void
+http_hash_update(request_t *req, const void *buf, size_t len)
+{
+	if (req->use_crc)
+		req->crc = crc32c_update(req->crc, buf, len);
+	else
+		MD5_Update(&req->context, buf, len);
+}
+
+/* Handle response stream performing digest/fingerprint updates */
 void
-http_process_response(request_t *req, size_t r, bool do_md5)
+http_process_response(request_t *req, size_t r, bool do_hash)
 {
+	size_t remaining;
+
 	req->len += r;
 	if (!req->extracted) {
-		if ((req->extracted = extract_html(req->buffer, req->len))) {
+		if ((req->extracted = extract_html_incr(req->buffer, req->len, &req->hdr_scanned))) {
 			req->status_code = extract_status_code(req->buffer, req->len);
 			req->content_len = extract_content_length(req->buffer, req->len);
+			if (do_hash)
+				req->content_encoding = extract_content_encoding(req->buffer, (size_t)(req->extracted - req->buffer));
 			r = req->len - (size_t)(req->extracted - req->buffer);
-			if (r && do_md5) {
-				if (req->content_len == UINT_MAX || req->content_len > req->rx_bytes)
-					MD5_Update(&req->context, req->extracted,
-						   req->content_len == UINT_MAX || req->content_len >= req->rx_bytes + r ? r : req->content_len - req->rx_bytes);
+			if (r && do_hash) {
+				remaining = http_digest_remaining(req);
+				if (remaining)
+					http_hash_update(req, req->extracted,
+							 remaining >= r ? r : remaining);
 			}
 			req->rx_bytes = r;
 			req->len = 0;
 		}
 	} else if (req->len) {
-		if (req->content_len == UINT_MAX || req->content_len > req->rx_bytes) {
-			MD5_Update(&req->context, req->buffer,
-				   req->content_len == UINT_MAX || req->content_len >= req->rx_bytes + req->len ? req->len : req->content_len - req->rx_bytes);
+		if (do_hash) {
+			remaining = http_digest_remaining(req);
+			if (remaining)
+				http_hash_update(req, req->buffer,
+						 remaining >= req->len ? req->len : remaining);
 		}
 		req->rx_bytes += req->len;
 		req->len = 0;
@@ -558,23 +791,15 @@ http_read_thread(thread_t * thread)
 	unsigned timeout = checker->co->connection_to;
 	unsigned char digest[16];
 	ssize_t r = 0;
-	int val;
 
 	/* Handle read timeout */
 	if (thread->type == THREAD_READ_TIMEOUT)
 		return timeout_epilog(thread, "Timeout HTTP read");
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
-
-	/* read the HTTP stream */
+	/* read the HTTP stream - the socket is non-blocking */
 	r = read(thread->u.fd, req->buffer + req->len,
 		 MAX_BUFFER_LENGTH - req->len);
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
-
 	/* Test if data are ready */
 	if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
 		log_message(LOG_INFO, "Read error with server %s: %s"
@@ -602,7 +827,36 @@ http_read_thread(thread_t * thread)
 	} else {
 
 		/* Handle response stream */
-		http_process_response(req, (size_t)r, (url->digest != NULL));
+		http_process_response(req, (size_t)r,
+				      ((url->digest || url->fingerprint_set) && !http_get_check->light_round));
+
+		/* A light round needs nothing beyond the headers */
+		if (http_get_check->light_round && req->extracted) {
+			http_handle_response(thread, digest, false);
+			return 0;
+		}
+
+		/* With keep-alive the end of the response is known from
+		 * Content-Length, without waiting for the server to close */
+		if (http_get_check->keepalive && req->extracted &&
+		    req->content_len != UINT_MAX && req->rx_bytes >= req->content_len) {
+			if (url->digest)
+				MD5_Final(digest, &req->context);
+			http_get_check->ka_keep = true;
+			http_handle_response(thread, digest, false);
+			return 0;
+		}
+
+		/* A digest limited to the first N bytes concludes once they
+		 * are hashed. The connection cannot be reused since the rest
+		 * of the body is unread. */
+		if ((url->digest || url->fingerprint_set) && req->extracted &&
+		    req->digest_limit != UINT_MAX && req->rx_bytes >= req->digest_limit) {
+			if (url->digest)
+				MD5_Final(digest, &req->context);
+			http_handle_response(thread, digest, false);
+			return 0;
+		}
 
 		/*
 		 * Register next http stream reader.
@@ -636,8 +890,13 @@ http_response_thread(thread_t * thread)
 	req->buffer = (char *) MALLOC(MAX_BUFFER_LENGTH);
 	req->extracted = NULL;
 	req->len = 0;
+	req->hdr_scanned = 0;
 	req->error = 0;
-	if (url->digest)
+	req->digest_limit = url->digest_bytes ? url->digest_bytes : UINT_MAX;
+	req->use_crc = url->fingerprint_set;
+	if (url->fingerprint_set)
+		req->crc = CRC32C_INIT;
+	else if (url->digest)
 		MD5_Init(&req->context);
 
 	/* Register asynchronous http/ssl read thread */
@@ -650,34 +909,22 @@ http_response_thread(thread_t * thread)
 	return 0;
 }
 
-/* remote Web server is connected, send it the get url query.  */
-static int
-http_request_thread(thread_t * thread)
+/* Format the GET request for a url. Neither the url, the virtualhost
+ * fallback chain nor the connection destination change once the
+ * configuration is loaded, so the bytes are built once on first use
+ * and sent as they are for every subsequent check, instead of being
+ * assembled into a fresh buffer per GET. */
+static void
+http_build_request(checker_t *checker, url_t *url)
 {
-	checker_t *checker = THREAD_ARG(thread);
 	http_checker_t *http_get_check = CHECKER_ARG(checker);
-	request_t *req = http_get_check->req;
 	struct sockaddr_storage *addr = &checker->co->dst;
-	unsigned timeout = checker->co->connection_to;
 	char *vhost;
 	char *request_host;
 	char request_host_port[7];	/* ":" [0-9][0-9][0-9][0-9][0-9] "\0" */
-	char *str_request;
-	url_t *fetched_url;
-	int ret = 0;
-	int val;
-
-	/* Handle write timeout */
-	if (thread->type == THREAD_WRITE_TIMEOUT)
-		return timeout_epilog(thread, "Timeout WEB write");
 
-	/* Allocate & clean the GET string */
-	str_request = (char *) MALLOC(GET_BUFFER_LENGTH);
-
-	fetched_url = fetch_next_url(http_get_check);
-
-	if (fetched_url->virtualhost)
-		vhost = fetched_url->virtualhost;
+	if (url->virtualhost)
+		vhost = url->virtualhost;
 	else if (http_get_check->virtualhost)
 		vhost = http_get_check->virtualhost;
 	else if (checker->rs->virtualhost)
@@ -698,31 +945,72 @@ http_request_thread(thread_t * thread)
 			 ntohs(inet_sockaddrport(addr)));
 	}
 
+	url->request = (char *) MALLOC(GET_BUFFER_LENGTH);
+
 	if(addr->ss_family == AF_INET6 && !vhost){
 		/* if literal ipv6 address, use ipv6 template, see RFC 2732 */
-		snprintf(str_request, GET_BUFFER_LENGTH, REQUEST_TEMPLATE_IPV6,
-			fetched_url->path, request_host, request_host_port);
+		snprintf(url->request, GET_BUFFER_LENGTH,
+			http_get_check->keepalive ? REQUEST_TEMPLATE_IPV6_KA : REQUEST_TEMPLATE_IPV6,
+			url->path, request_host, request_host_port);
 	} else {
-		snprintf(str_request, GET_BUFFER_LENGTH, REQUEST_TEMPLATE,
-			fetched_url->path, request_host, request_host_port);
+		snprintf(url->request, GET_BUFFER_LENGTH,
+			http_get_check->keepalive ? REQUEST_TEMPLATE_KA : REQUEST_TEMPLATE,
+			url->path, request_host, request_host_port);
 	}
 
-	DBG("Processing url(%u) of %s.", http_get_check->url_it + 1 , FMT_HTTP_RS(checker));
+	url->request_len = strlen(url->request);
+
+	/* Splice an Accept-Encoding header in before the blank line
+	 * terminating the request. The digest is then computed over the
+	 * compressed bytes as sent - they are only compared for change,
+	 * so no decompression is needed. */
+	if (http_get_check->accept_encoding && url->request_len >= 2) {
+		snprintf(url->request + url->request_len - 2,
+			 GET_BUFFER_LENGTH - (url->request_len - 2),
+			 "Accept-Encoding: %s\r\n\r\n",
+			 http_get_check->accept_encoding);
+		url->request_len = strlen(url->request);
+	}
+}
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
+/* remote Web server is connected, send it the get url query.  */
+static int
+http_request_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	http_checker_t *http_get_check = CHECKER_ARG(checker);
+	request_t *req = http_get_check->req;
+	unsigned timeout = checker->co->connection_to;
+	url_t *fetched_url;
+	int ret = 0;
 
-	/* Send the GET request to remote Web server */
-	if (http_get_check->proto == PROTO_SSL)
-		ret = ssl_send_request(req->ssl, str_request, (int)strlen(str_request));
-	else
-		ret = (send(thread->u.fd, str_request, strlen(str_request), 0) != -1);
+	/* Handle write timeout */
+	if (thread->type == THREAD_WRITE_TIMEOUT)
+		return timeout_epilog(thread, "Timeout WEB write");
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
+	fetched_url = fetch_next_url(http_get_check);
+	if (!fetched_url->request)
+		http_build_request(checker, fetched_url);
 
-	FREE(str_request);
+	DBG("Processing url(%u) of %s.", http_get_check->url_it + 1 , FMT_HTTP_RS(checker));
+
+	/* Send the GET request to remote Web server. The socket was
+	 * created non-blocking, so the send returns straight away. */
+	if (http_get_check->proto == PROTO_SSL)
+		ret = ssl_send_request(req->ssl, fetched_url->request, (int)fetched_url->request_len);
+	else {
+		ret = (send(thread->u.fd, fetched_url->request, fetched_url->request_len, 0) != -1);
+
+		/* With a deferred fast open connect and no cookie cached for
+		 * the destination, the first send starts a regular handshake.
+		 * Retry the request once the socket becomes writable. */
+		if (!ret && checker->co->fast_open &&
+		    (errno == EINPROGRESS || errno == EAGAIN)) {
+			thread_add_write(thread->master, http_request_thread,
+					 checker, thread->u.fd, timeout);
+			return 0;
+		}
+	}
 
 	if (!ret)
 		return timeout_epilog(thread, "Cannot send get request to");
@@ -839,8 +1127,9 @@ http_connect_thread(thread_t * thread)
 	 * if checker is disabled
 	 */
 	if (!checker->enabled) {
-		thread_add_timer(thread->master, http_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, http_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
 		return 0;
 	}
 
@@ -849,11 +1138,40 @@ http_connect_thread(thread_t * thread)
 	if (!fetched_url)
 		return epilog(thread, REGISTER_CHECKER_NEW, 1, 0) + 1;
 
+	/* At the start of a round decide whether this is a cheap
+	 * status-line-only pass or a full digest/body validation */
+	if (http_get_check->url_it == 0 && http_get_check->deep_interval) {
+		if (http_get_check->force_deep ||
+		    timer_long(timer_sub(timer_now(), http_get_check->last_deep)) >=
+							http_get_check->deep_interval) {
+			http_get_check->light_round = false;
+			http_get_check->force_deep = false;
+			http_get_check->last_deep = timer_now();
+		} else
+			http_get_check->light_round = true;
+	}
+
+	/* Reuse the kept-alive connection from the previous round */
+	if (http_get_check->ka_fd != -1) {
+		fd = http_get_check->ka_fd;
+		http_get_check->ka_fd = -1;
+		http_get_check->ka_reused = true;
+		http_get_check->req = (request_t *) MALLOC(sizeof (request_t));
+		http_get_check->req->ssl = http_get_check->ka_ssl;
+		http_get_check->req->bio = http_get_check->ka_bio;
+		http_get_check->ka_ssl = NULL;
+		http_get_check->ka_bio = NULL;
+		thread_add_write(thread->master, http_request_thread, checker,
+				 fd, co->connection_to);
+		return 0;
+	}
+
 	/* Create the socket */
-	if ((fd = socket(co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
+	if ((fd = socket_netns(co->netns, co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_TCP)) == -1) {
 		log_message(LOG_INFO, "WEB connection fail to create socket. Rescheduling.");
-		thread_add_timer(thread->master, http_connect_thread, checker,
-				checker->delay_loop);
+		thread_add_timer_slack(thread->master, http_connect_thread, checker,
+				checker->delay_loop,
+				 global_data->checker_timer_slack);
 
 		return 0;
 	}
@@ -866,12 +1184,12 @@ http_connect_thread(thread_t * thread)
 	status = tcp_bind_connect(fd, co);
 
 	/* handle tcp connection status & register check worker thread */
-	if(tcp_connection_state(fd, status, thread, http_check_thread,
-			co->connection_to)) {
+	if(tcp_connection_state(fd, status, thread, http_check_thread, co)) {
 		close(fd);
 		log_message(LOG_INFO, "WEB socket bind failed. Rescheduling");
-		thread_add_timer(thread->master, http_connect_thread, checker,
-				checker->delay_loop);
+		thread_add_timer_slack(thread->master, http_connect_thread, checker,
+				checker->delay_loop,
+				 global_data->checker_timer_slack);
 	}
 
 	return 0;
@@ -39,6 +39,7 @@
 #include "signals.h"
 #include "global_data.h"
 #include "global_parser.h"
+#include "check_daemon.h"
 
 static int misc_check_thread(thread_t *);
 static int misc_check_child_thread(thread_t *);
@@ -249,34 +250,6 @@ check_misc_script_security(void)
 	return script_flags;
 }
 
-void
-check_misc_set_child_finder(void)
-{
-	element e;
-	checker_t *checker;
-	misc_checker_t *misc_script;
-	size_t num_misc_checkers = 0;
-
-	if (LIST_ISEMPTY(checkers_queue))
-		return;
-
-	for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
-		checker = ELEMENT_DATA(e);
-
-		if (checker->launch != misc_check_thread)
-			continue;
-
-		misc_script = CHECKER_ARG(checker);
-		if (!misc_script->insecure)
-			num_misc_checkers++;
-	}
-
-	if (!num_misc_checkers)
-		return;
-
-	set_child_finder(DEFAULT_CHILD_FINDER, NULL, NULL, NULL, NULL, num_misc_checkers);
-}
-
 static int
 misc_check_thread(thread_t * thread)
 {
@@ -297,8 +270,9 @@ misc_check_thread(thread_t * thread)
 	 */
 	if (!checker->enabled) {
 		/* Register next timer checker */
-		thread_add_timer(thread->master, misc_check_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, misc_check_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
 		return 0;
 	}
 
@@ -326,6 +300,7 @@ misc_check_child_thread(thread_t * thread)
 	unsigned timeout = 0;
 	char *script_exit_type = NULL;
 	bool script_success;
+	bool cycle_success = false;
 	char *reason = NULL;
 	int reason_code;
 
@@ -370,6 +345,15 @@ misc_check_child_thread(thread_t * thread)
 	if (WIFEXITED(wait_status)) {
 		int status = WEXITSTATUS(wait_status);
 
+		/* The shell exits 126/127 when it cannot run the script.
+		 * That is a configuration problem, not an RS failure, so
+		 * treat it as the forked launcher always has. */
+		if (status >= 126) {
+			log_message(LOG_INFO, "Misc check to [%s] for [%s] couldn't be executed (status %d)",
+				    inet_sockaddrtos(&checker->rs->addr), misck_checker->path, status);
+			status = 0;
+		}
+
 		if (status == 0 ||
 		    (misck_checker->dynamic && status >= 2 && status <= 255)) {
 			/*
@@ -377,9 +361,15 @@ misc_check_child_thread(thread_t * thread)
 			 * the exit status returned.  Effective range is 0..253.
 			 * Catch legacy case of status being 0 but misc_dynamic being set.
 			 */
-			if (misck_checker->dynamic && status != 0)
-				update_svr_wgt(status - 2, checker->vs,
-					       checker->rs, true);
+			if (misck_checker->dynamic && status != 0) {
+				/* A shard worker must not touch the IPVS
+				 * state - hand the weight to the coordinator */
+				if (checker_shard_fd != -1)
+					checker_shard_report_weight(checker, status - 2);
+				else
+					update_svr_wgt_lazy(status - 2, checker->vs,
+							    checker->rs);
+			}
 
 			/* everything is good */
 			if (!checker->is_up || !misck_checker->initial_state_reported) {
@@ -388,6 +378,7 @@ misc_check_child_thread(thread_t * thread)
 				misck_checker->initial_state_reported = true;
 			}
 
+			cycle_success = true;
 			checker->retry_it = 0;
 		} else if (checker->is_up) {
 			if (checker->retry_it < checker->retry)
@@ -457,13 +448,14 @@ misc_check_child_thread(thread_t * thread)
 	}
 
 	/* Register next timer checker */
-	next_time = timer_add_long(misck_checker->last_ran, checker->retry_it ? checker->delay_before_retry : checker->delay_loop);
+	next_time = timer_add_long(misck_checker->last_ran, checker->retry_it ? checker->delay_before_retry : checker_adjust_delay(checker, cycle_success));
 	next_time = timer_sub_now(next_time);
 	if (next_time.tv_sec < 0 ||
 	    (next_time.tv_sec == 0 && next_time.tv_usec == 0))
 		next_time.tv_sec = 0, next_time.tv_usec = 1;
 
-	thread_add_timer(thread->master, misc_check_thread, checker, timer_tol(next_time));
+	thread_add_timer_slack(thread->master, misc_check_thread, checker, timer_tol(next_time),
+				 global_data->checker_timer_slack);
 
 	misck_checker->state = SCRIPT_STATE_IDLE;
 
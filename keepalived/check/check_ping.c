@@ -0,0 +1,455 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        ICMP ping checker
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+/* The ping checker probes real servers with ICMP(v6) echo requests
+ * without a socket per checker, let alone a process per probe. One raw
+ * socket per address family is shared by every PING_CHECK. Checkers
+ * falling due in the same scheduler wakeup queue their echo requests,
+ * which a low priority zero-delay timer flushes with a single
+ * sendmmsg() once all of them have run. Replies come back on the shared
+ * socket and are demultiplexed to the owning checker by icmp id and
+ * sequence; a timer per in-flight probe turns silence into a failure. */
+
+#include "config.h"
+
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+
+#include "check_ping.h"
+#include "check_api.h"
+#include "global_data.h"
+#include "memory.h"
+#include "ipwrapper.h"
+#include "logger.h"
+#include "smtp.h"
+#include "utils.h"
+#include "parser.h"
+#include "timer.h"
+#if !HAVE_DECL_SOCK_CLOEXEC
+#include "old_socket.h"
+#include "string.h"
+#endif
+
+#define PING_TX_BATCH	64
+#define PING_RX_BUFFER	256
+
+static int ping_connect_thread(thread_t *);
+static int ping_receive_thread(thread_t *);
+
+/* One raw socket per address family, shared by all ping checkers.
+ * [0] is IPv4, [1] is IPv6. */
+static int ping_fd[2] = { -1, -1 };
+static thread_t *ping_reader[2];
+
+/* icmp id allocator - one id per checker */
+static uint16_t ping_icmp_id;
+
+/* Echo request TX queue, flushed with one sendmmsg() per sweep */
+static struct mmsghdr ping_tx_msg[PING_TX_BATCH];
+static struct iovec ping_tx_iov[PING_TX_BATCH];
+static struct sockaddr_storage ping_tx_dst[PING_TX_BATCH];
+static int ping_tx_fd[PING_TX_BATCH];
+static unsigned ping_tx_count;
+static thread_t *ping_flush_thread;
+
+/* Configuration stream handling */
+static void
+free_ping_check(void *data)
+{
+	FREE(CHECKER_CO(data));
+	FREE(CHECKER_DATA(data));
+	FREE(data);
+}
+
+static void
+dump_ping_check(void *data)
+{
+	checker_t *checker = data;
+
+	log_message(LOG_INFO, "   Keepalive method = PING_CHECK");
+	dump_checker_opts(checker);
+}
+
+static bool
+ping_check_compare(void *a, void *b)
+{
+	return compare_conn_opts(CHECKER_CO(a), CHECKER_CO(b));
+}
+
+static void
+ping_check_handler(__attribute__((unused)) vector_t *strvec)
+{
+	ping_check_t *ping_check = (ping_check_t *) MALLOC(sizeof (ping_check_t));
+
+	ping_check->probe_id = ++ping_icmp_id;
+
+	/* queue new checker */
+	queue_checker(free_ping_check, dump_ping_check, ping_connect_thread,
+		      ping_check_compare, ping_check, CHECKER_NEW_CO());
+}
+
+static void
+ping_check_end_handler(void)
+{
+	if (!check_conn_opts(CHECKER_GET_CO())) {
+		dequeue_new_checker();
+	}
+}
+
+void
+install_ping_check_keyword(void)
+{
+	install_keyword("PING_CHECK", &ping_check_handler);
+	install_sublevel();
+	install_checker_common_keywords(true);
+	install_sublevel_end_handler(ping_check_end_handler);
+	install_sublevel_end();
+}
+
+static void
+ping_epilog(thread_master_t *master, checker_t *checker, bool is_success)
+{
+	unsigned long delay;
+
+	if (is_success || checker->retry_it >= checker->retry) {
+		delay = checker_adjust_delay(checker, is_success);
+		checker->retry_it = 0;
+
+		if (is_success && !checker->is_up) {
+			log_message(LOG_INFO, "PING check to %s success."
+					, FMT_PING_RS(checker));
+			smtp_alert(checker, NULL, NULL,
+				   "UP",
+				   "=> PING CHECK succeed on service <=");
+			update_svr_checker_state(UP, checker);
+		} else if (!is_success
+			   && checker->is_up) {
+			if (checker->retry)
+				log_message(LOG_INFO
+				    , "Check on service %s failed after %d retry."
+				    , FMT_PING_RS(checker)
+				    , checker->retry);
+			smtp_alert(checker, NULL, NULL,
+				   "DOWN",
+				   "=> PING CHECK failed on service <=");
+			update_svr_checker_state(DOWN, checker);
+		}
+	} else {
+		delay = checker->delay_before_retry;
+		++checker->retry_it;
+	}
+
+	/* Register next timer checker */
+	thread_add_timer_slack(master, ping_connect_thread, checker, delay,
+				 global_data->checker_timer_slack);
+}
+
+/* Send every queued echo request, one sendmmsg() per socket run.
+ * A send error is not failed back to the individual checkers - their
+ * reply timeout covers it. */
+static void
+ping_flush(void)
+{
+	unsigned i, j;
+	int ret;
+
+	for (i = 0; i < ping_tx_count; i = j) {
+		for (j = i + 1; j < ping_tx_count && ping_tx_fd[j] == ping_tx_fd[i]; j++);
+		ret = sendmmsg(ping_tx_fd[i], &ping_tx_msg[i], j - i, 0);
+		if (ret < (int)(j - i))
+			log_message(LOG_INFO, "PING_CHECK: error sending echo request batch (%d of %u sent)"
+					, ret < 0 ? 0 : ret, j - i);
+	}
+	ping_tx_count = 0;
+}
+
+static int
+ping_flush_tx_thread(__attribute__((unused)) thread_t * thread)
+{
+	ping_flush_thread = NULL;
+	ping_flush();
+	return 0;
+}
+
+/* A zero-delay timer at low priority only becomes ready after the poll
+ * following the current dispatch round, so it runs once every checker
+ * due in this wakeup has queued its request */
+static void
+ping_flush_schedule(thread_master_t *master)
+{
+	if (ping_flush_thread)
+		return;
+
+	ping_flush_thread = thread_add_timer(master, ping_flush_tx_thread, NULL, 0);
+	thread_set_priority(ping_flush_thread, THREAD_PRIO_LO);
+}
+
+static int
+ping_open_socket(thread_master_t *master, int family)
+{
+	int idx = (family == AF_INET6);
+	struct icmp6_filter filter;
+	int fd;
+
+	fd = socket(family, SOCK_RAW | SOCK_CLOEXEC, idx ? IPPROTO_ICMPV6 : IPPROTO_ICMP);
+	if (fd == -1) {
+		log_message(LOG_INFO, "PING_CHECK: unable to create ICMP%s socket (%s)"
+				, idx ? "v6" : "", strerror(errno));
+		return -1;
+	}
+
+#if !HAVE_DECL_SOCK_CLOEXEC
+	if (set_sock_flags(fd, F_SETFD, FD_CLOEXEC))
+		log_message(LOG_INFO, "Unable to set CLOEXEC on ping_check socket - %s (%d)", strerror(errno), errno);
+#endif
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+	if (idx) {
+		/* Only echo replies are of interest */
+		ICMP6_FILTER_SETBLOCKALL(&filter);
+		ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+		if (setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof (filter)) < 0)
+			log_message(LOG_INFO, "PING_CHECK: cannot set ICMPv6 filter (%s)", strerror(errno));
+	}
+
+	ping_fd[idx] = fd;
+	ping_reader[idx] = thread_add_read(master, ping_receive_thread, NULL, fd, TIMER_NEVER);
+
+	return 0;
+}
+
+void
+ping_close_sockets(void)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (ping_fd[i] != -1) {
+			close(ping_fd[i]);
+			ping_fd[i] = -1;
+		}
+		/* The read threads went with the master thread */
+		ping_reader[i] = NULL;
+	}
+	ping_flush_thread = NULL;
+	ping_tx_count = 0;
+}
+
+/* Find the checker owning an in-flight probe by its icmp id/sequence */
+static checker_t *
+ping_find_checker(uint16_t id, uint16_t seq)
+{
+	checker_t *checker;
+	ping_check_t *ping_check;
+	element e;
+
+	if (LIST_ISEMPTY(checkers_queue))
+		return NULL;
+
+	for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		checker = ELEMENT_DATA(e);
+		if (checker->launch != ping_connect_thread)
+			continue;
+		ping_check = CHECKER_ARG(checker);
+		if (ping_check->awaiting &&
+		    ping_check->probe_id == id && ping_check->seq == seq)
+			return checker;
+	}
+
+	return NULL;
+}
+
+static int
+ping_receive_thread(thread_t * thread)
+{
+	char rbuf[PING_RX_BUFFER];
+	struct icmphdr *icmph;
+	struct icmp6_hdr *icmp6h;
+	struct iphdr *iph;
+	checker_t *checker;
+	ping_check_t *ping_check;
+	uint16_t id, seq;
+	ssize_t len;
+	int fd = thread->u.fd;
+	int idx = (fd == ping_fd[1]);
+
+	while ((len = recv(fd, rbuf, sizeof (rbuf), 0)) >= 0) {
+		if (!idx) {
+			/* A raw IPv4 socket delivers the IP header too */
+			iph = (struct iphdr *) rbuf;
+			if (len < (ssize_t)((iph->ihl << 2) + sizeof (*icmph)))
+				continue;
+			icmph = (struct icmphdr *) (rbuf + (iph->ihl << 2));
+			if (icmph->type != ICMP_ECHOREPLY)
+				continue;
+			id = ntohs(icmph->un.echo.id);
+			seq = ntohs(icmph->un.echo.sequence);
+		} else {
+			if (len < (ssize_t) sizeof (*icmp6h))
+				continue;
+			icmp6h = (struct icmp6_hdr *) rbuf;
+			if (icmp6h->icmp6_type != ICMP6_ECHO_REPLY)
+				continue;
+			id = ntohs(icmp6h->icmp6_id);
+			seq = ntohs(icmp6h->icmp6_seq);
+		}
+
+		/* Other processes' replies also land on a raw socket */
+		if (!(checker = ping_find_checker(id, seq)))
+			continue;
+
+		ping_check = CHECKER_ARG(checker);
+		ping_check->awaiting = false;
+		thread_cancel(ping_check->timeout_thread);
+		ping_check->timeout_thread = NULL;
+		ping_epilog(thread->master, checker, true);
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		log_message(LOG_INFO, "PING_CHECK: error reading ICMP%s socket (%s)"
+				, idx ? "v6" : "", strerror(errno));
+
+	ping_reader[idx] = thread_add_read(thread->master, ping_receive_thread, NULL,
+					   fd, TIMER_NEVER);
+
+	return 0;
+}
+
+static int
+ping_timeout_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	ping_check_t *ping_check = CHECKER_ARG(checker);
+
+	ping_check->timeout_thread = NULL;
+	ping_check->awaiting = false;
+
+	if (checker->is_up)
+		log_message(LOG_INFO, "PING check to %s timeout."
+				, FMT_PING_RS(checker));
+	ping_epilog(thread->master, checker, false);
+
+	return 0;
+}
+
+static void
+ping_build_request(checker_t *checker)
+{
+	ping_check_t *ping_check = CHECKER_ARG(checker);
+	struct icmphdr *icmph;
+	struct icmp6_hdr *icmp6h;
+
+	ping_check->seq++;
+
+	memset(ping_check->sbuf, 0, sizeof (ping_check->sbuf));
+	memset(ping_check->sbuf + PING_HDR_LEN, 'K', PING_DATA_LEN);
+
+	if (checker->co->dst.ss_family == AF_INET) {
+		icmph = (struct icmphdr *) ping_check->sbuf;
+		icmph->type = ICMP_ECHO;
+		icmph->un.echo.id = htons(ping_check->probe_id);
+		icmph->un.echo.sequence = htons(ping_check->seq);
+		icmph->checksum = in_csum((uint16_t *) ping_check->sbuf,
+					  sizeof (ping_check->sbuf), 0, NULL);
+	} else {
+		icmp6h = (struct icmp6_hdr *) ping_check->sbuf;
+		icmp6h->icmp6_type = ICMP6_ECHO_REQUEST;
+		icmp6h->icmp6_id = htons(ping_check->probe_id);
+		icmp6h->icmp6_seq = htons(ping_check->seq);
+		/* The kernel computes the ICMPv6 checksum on raw sockets */
+	}
+}
+
+static void
+ping_queue_request(checker_t *checker)
+{
+	ping_check_t *ping_check = CHECKER_ARG(checker);
+	struct mmsghdr *msg;
+
+	if (ping_tx_count == PING_TX_BATCH)
+		ping_flush();
+
+	msg = &ping_tx_msg[ping_tx_count];
+	memset(msg, 0, sizeof (*msg));
+
+	ping_tx_iov[ping_tx_count].iov_base = ping_check->sbuf;
+	ping_tx_iov[ping_tx_count].iov_len = sizeof (ping_check->sbuf);
+	ping_tx_dst[ping_tx_count] = checker->co->dst;
+
+	msg->msg_hdr.msg_iov = &ping_tx_iov[ping_tx_count];
+	msg->msg_hdr.msg_iovlen = 1;
+	msg->msg_hdr.msg_name = &ping_tx_dst[ping_tx_count];
+
+	/* Raw sockets want no port in the destination */
+	if (checker->co->dst.ss_family == AF_INET6) {
+		((struct sockaddr_in6 *) &ping_tx_dst[ping_tx_count])->sin6_port = 0;
+		msg->msg_hdr.msg_namelen = sizeof (struct sockaddr_in6);
+		ping_tx_fd[ping_tx_count] = ping_fd[1];
+	} else {
+		((struct sockaddr_in *) &ping_tx_dst[ping_tx_count])->sin_port = 0;
+		msg->msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+		ping_tx_fd[ping_tx_count] = ping_fd[0];
+	}
+
+	ping_tx_count++;
+}
+
+static int
+ping_connect_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	ping_check_t *ping_check = CHECKER_ARG(checker);
+	conn_opts_t *co = checker->co;
+	int idx = (co->dst.ss_family == AF_INET6);
+
+	/*
+	 * Register a new checker thread & return
+	 * if checker is disabled
+	 */
+	if (!checker->enabled) {
+		thread_add_timer_slack(thread->master, ping_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
+		return 0;
+	}
+
+	if (ping_fd[idx] == -1 &&
+	    ping_open_socket(thread->master, co->dst.ss_family) < 0) {
+		thread_add_timer_slack(thread->master, ping_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
+		return 0;
+	}
+
+	ping_build_request(checker);
+	ping_queue_request(checker);
+
+	ping_check->awaiting = true;
+	ping_check->timeout_thread = thread_add_timer(thread->master,
+						      ping_timeout_thread, checker,
+						      co->connection_to);
+
+	ping_flush_schedule(thread->master);
+
+	return 0;
+}
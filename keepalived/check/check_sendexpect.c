@@ -0,0 +1,603 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Send/expect protocol checker
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+/* The send/expect checker scripts a simple protocol conversation -
+ * Redis PING, a memcached version, reading a MySQL greeting - as a
+ * sequence of steps, each writing a configured payload and matching
+ * the reply against a prefix or an extended regex. It runs entirely
+ * on the layer4 non-blocking connect machinery inside the event loop,
+ * replacing the MISC_CHECK scripts typically used for such probes and
+ * their fork+exec+interpreter startup on every probe. Payloads and
+ * prefixes take \r \n \t \\ and \xNN escapes, so binary protocols
+ * need no helper either. The whole conversation shares the checker's
+ * connect timeout. */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+
+#include "check_sendexpect.h"
+#include "check_api.h"
+#include "memory.h"
+#include "ipwrapper.h"
+#include "layer4.h"
+#include "logger.h"
+#include "smtp.h"
+#include "utils.h"
+#include "parser.h"
+#include "global_data.h"
+#if !HAVE_DECL_SOCK_CLOEXEC
+#include "old_socket.h"
+#include "string.h"
+#endif
+
+static int sendexpect_connect_thread(thread_t *);
+
+/* Copy a config string processing \r \n \t \\ and \xNN escapes, so
+ * payloads for line based and binary protocols can be written inline */
+static char *
+sendexpect_unescape(const char *str, size_t *len)
+{
+	char *buf = MALLOC(strlen(str) + 1);
+	char *p = buf;
+	int hi, lo;
+
+	while (*str) {
+		if (*str != '\\' || !str[1]) {
+			*p++ = *str++;
+			continue;
+		}
+
+		str++;
+		switch (*str) {
+		case 'r':
+			*p++ = '\r';
+			str++;
+			break;
+		case 'n':
+			*p++ = '\n';
+			str++;
+			break;
+		case 't':
+			*p++ = '\t';
+			str++;
+			break;
+		case '\\':
+			*p++ = '\\';
+			str++;
+			break;
+		case 'x':
+			hi = isxdigit((int)str[1]) ? str[1] : 0;
+			lo = hi && isxdigit((int)str[2]) ? str[2] : 0;
+			if (!lo) {
+				log_message(LOG_INFO, "Invalid \\x escape in send/expect string");
+				FREE(buf);
+				return NULL;
+			}
+			hi = isdigit(hi) ? hi - '0' : tolower(hi) - 'a' + 10;
+			lo = isdigit(lo) ? lo - '0' : tolower(lo) - 'a' + 10;
+			*p++ = (char)((hi << 4) | lo);
+			str += 3;
+			break;
+		default:
+			/* Unknown escape - keep it verbatim */
+			*p++ = '\\';
+			*p++ = *str++;
+		}
+	}
+
+	*p = '\0';
+	*len = (size_t)(p - buf);
+	return buf;
+}
+
+/* Configuration stream handling */
+static void
+free_sendexpect_step(void *data)
+{
+	se_step_t *step = data;
+
+	FREE_PTR(step->send);
+	if (step->expect_regex)
+		regfree(&step->re);
+	FREE_PTR(step->expect);
+	FREE(step);
+}
+
+static void
+dump_sendexpect_step(void *data)
+{
+	se_step_t *step = data;
+
+	log_message(LOG_INFO, "     Step: send %zu bytes, expect %s%s",
+		    step->send_len,
+		    step->expect ? (step->expect_regex ? "regex " : "prefix ") : "nothing",
+		    step->expect ? step->expect : "");
+}
+
+static void
+free_sendexpect_check(void *data)
+{
+	sendexpect_check_t *se_check = CHECKER_DATA(data);
+
+	free_list(&se_check->steps);
+	FREE(se_check);
+	FREE(CHECKER_CO(data));
+	FREE(data);
+}
+
+static void
+dump_sendexpect_check(void *data)
+{
+	checker_t *checker = data;
+	sendexpect_check_t *se_check = checker->data;
+
+	log_message(LOG_INFO, "   Keepalive method = SENDEXPECT_CHECK");
+	dump_checker_opts(checker);
+	log_message(LOG_INFO, "   Steps = %d", LIST_SIZE(se_check->steps));
+	dump_list(se_check->steps);
+}
+
+static bool
+sendexpect_step_compare(const se_step_t *old, const se_step_t *new)
+{
+	if (old->send_len != new->send_len ||
+	    (old->send_len && memcmp(old->send, new->send, old->send_len)))
+		return false;
+	if (!old->expect != !new->expect)
+		return false;
+	if (old->expect &&
+	    (old->expect_regex != new->expect_regex ||
+	     strcmp(old->expect, new->expect)))
+		return false;
+
+	return true;
+}
+
+static bool
+sendexpect_check_compare(void *a, void *b)
+{
+	sendexpect_check_t *old = CHECKER_DATA(a);
+	sendexpect_check_t *new = CHECKER_DATA(b);
+	element e_old, e_new;
+
+	if (!compare_conn_opts(CHECKER_CO(a), CHECKER_CO(b)))
+		return false;
+	if (LIST_SIZE(old->steps) != LIST_SIZE(new->steps))
+		return false;
+
+	for (e_old = LIST_HEAD(old->steps), e_new = LIST_HEAD(new->steps);
+	     e_old; ELEMENT_NEXT(e_old), ELEMENT_NEXT(e_new)) {
+		if (!sendexpect_step_compare(ELEMENT_DATA(e_old), ELEMENT_DATA(e_new)))
+			return false;
+	}
+
+	return true;
+}
+
+static void
+sendexpect_check_handler(__attribute__((unused)) vector_t *strvec)
+{
+	sendexpect_check_t *se_check = (sendexpect_check_t *) MALLOC(sizeof (sendexpect_check_t));
+
+	se_check->steps = alloc_list(free_sendexpect_step, dump_sendexpect_step);
+
+	/* queue new checker */
+	queue_checker(free_sendexpect_check, dump_sendexpect_check, sendexpect_connect_thread,
+		      sendexpect_check_compare, se_check, CHECKER_NEW_CO());
+}
+
+static void
+sendexpect_step_handler(__attribute__((unused)) vector_t *strvec)
+{
+	sendexpect_check_t *se_check = CHECKER_GET();
+	se_step_t *step = (se_step_t *) MALLOC(sizeof (se_step_t));
+
+	list_add(se_check->steps, step);
+}
+
+static se_step_t *
+sendexpect_current_step(void)
+{
+	sendexpect_check_t *se_check = CHECKER_GET();
+
+	return LIST_TAIL_DATA(se_check->steps);
+}
+
+static void
+sendexpect_send_handler(vector_t *strvec)
+{
+	se_step_t *step = sendexpect_current_step();
+	char *str = CHECKER_VALUE_STRING(strvec);
+
+	FREE_PTR(step->send);
+	step->send = sendexpect_unescape(str, &step->send_len);
+	FREE(str);
+}
+
+static void
+sendexpect_expect_handler(vector_t *strvec)
+{
+	se_step_t *step = sendexpect_current_step();
+	char *str = CHECKER_VALUE_STRING(strvec);
+
+	if (step->expect_regex) {
+		regfree(&step->re);
+		step->expect_regex = false;
+	}
+	FREE_PTR(step->expect);
+	step->expect = sendexpect_unescape(str, &step->expect_len);
+	FREE(str);
+}
+
+static void
+sendexpect_expect_regex_handler(vector_t *strvec)
+{
+	se_step_t *step = sendexpect_current_step();
+
+	if (step->expect_regex) {
+		regfree(&step->re);
+		step->expect_regex = false;
+	}
+	FREE_PTR(step->expect);
+	step->expect = set_value(strvec);
+	step->expect_len = strlen(step->expect);
+
+	if (regcomp(&step->re, step->expect, REG_EXTENDED | REG_NOSUB)) {
+		log_message(LOG_INFO, "Invalid expect_regex \"%s\"", step->expect);
+		FREE_PTR(step->expect);
+		return;
+	}
+	step->expect_regex = true;
+}
+
+static void
+sendexpect_step_end_handler(void)
+{
+	sendexpect_check_t *se_check = CHECKER_GET();
+	se_step_t *step = sendexpect_current_step();
+
+	if (!step->send && !step->expect) {
+		log_message(LOG_INFO, "SENDEXPECT_CHECK step has neither send nor expect - ignoring step");
+		list_del(se_check->steps, step);
+		free_sendexpect_step(step);
+	}
+}
+
+static void
+sendexpect_check_end_handler(void)
+{
+	sendexpect_check_t *se_check = CHECKER_GET();
+
+	if (!check_conn_opts(CHECKER_GET_CO()) || LIST_ISEMPTY(se_check->steps)) {
+		if (LIST_ISEMPTY(se_check->steps))
+			log_message(LOG_INFO, "SENDEXPECT_CHECK has no steps - ignoring checker");
+		dequeue_new_checker();
+	}
+}
+
+void
+install_sendexpect_check_keyword(void)
+{
+	install_keyword("SENDEXPECT_CHECK", &sendexpect_check_handler);
+	install_sublevel();
+	install_checker_common_keywords(true);
+	install_keyword("step", &sendexpect_step_handler);
+	install_sublevel();
+	install_keyword("send", &sendexpect_send_handler);
+	install_keyword("expect", &sendexpect_expect_handler);
+	install_keyword("expect_regex", &sendexpect_expect_regex_handler);
+	install_sublevel_end_handler(sendexpect_step_end_handler);
+	install_sublevel_end();
+	install_sublevel_end_handler(sendexpect_check_end_handler);
+	install_sublevel_end();
+}
+
+static void
+sendexpect_epilog(thread_t * thread, bool is_success)
+{
+	checker_t *checker;
+	unsigned long delay;
+
+	checker = THREAD_ARG(thread);
+
+	if (is_success || checker->retry_it >= checker->retry) {
+		delay = checker_adjust_delay(checker, is_success);
+		checker->retry_it = 0;
+
+		if (is_success && !checker->is_up) {
+			log_message(LOG_INFO, "Send/expect check to %s success."
+					, FMT_SENDEXPECT_RS(checker));
+			smtp_alert(checker, NULL, NULL,
+				   "UP",
+				   "=> SENDEXPECT CHECK succeed on service <=");
+			update_svr_checker_state(UP, checker);
+		} else if (!is_success
+			   && checker->is_up) {
+			if (checker->retry)
+				log_message(LOG_INFO
+				    , "Check on service %s failed after %d retry."
+				    , FMT_SENDEXPECT_RS(checker)
+				    , checker->retry);
+			smtp_alert(checker, NULL, NULL,
+				   "DOWN",
+				   "=> SENDEXPECT CHECK failed on service <=");
+			update_svr_checker_state(DOWN, checker);
+		}
+	} else {
+		delay = checker->delay_before_retry;
+		++checker->retry_it;
+	}
+
+	/* Register next timer checker */
+	thread_add_timer_slack(thread->master, sendexpect_connect_thread, checker, delay,
+			       global_data->checker_timer_slack);
+}
+
+static int sendexpect_send_thread(thread_t *);
+static int sendexpect_recv_thread(thread_t *);
+
+/* Launch the current step, or declare success when none are left.
+ * The remaining probe timeout carries over from thread->sands. */
+static void
+sendexpect_step_start(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	sendexpect_check_t *se_check = CHECKER_ARG(checker);
+	se_step_t *step;
+	unsigned long timeout;
+
+	if (!se_check->step) {
+		close(thread->u.fd);
+		sendexpect_epilog(thread, true);
+		return;
+	}
+
+	se_check->sent = 0;
+	se_check->recv_len = 0;
+	step = ELEMENT_DATA(se_check->step);
+	timeout = timer_long(thread->sands) - timer_long(time_now);
+
+	if (step->send_len)
+		thread_add_write(thread->master, sendexpect_send_thread, checker,
+				 thread->u.fd, timeout);
+	else
+		thread_add_read(thread->master, sendexpect_recv_thread, checker,
+				thread->u.fd, timeout);
+}
+
+static int
+sendexpect_send_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	sendexpect_check_t *se_check = CHECKER_ARG(checker);
+	se_step_t *step = ELEMENT_DATA(se_check->step);
+	unsigned long timeout;
+	ssize_t ret;
+
+	if (thread->type == THREAD_WRITE_TIMEOUT) {
+		if (checker->is_up)
+			log_message(LOG_INFO, "Send/expect check to %s write timeout."
+					, FMT_SENDEXPECT_RS(checker));
+		close(thread->u.fd);
+		sendexpect_epilog(thread, false);
+		return 0;
+	}
+
+	timeout = timer_long(thread->sands) - timer_long(time_now);
+
+	ret = send(thread->u.fd, step->send + se_check->sent,
+		   step->send_len - se_check->sent, 0);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			thread_add_write(thread->master, sendexpect_send_thread,
+					 checker, thread->u.fd, timeout);
+			return 0;
+		}
+		if (checker->is_up)
+			log_message(LOG_INFO, "Send/expect check to %s send failed (%s)."
+					, FMT_SENDEXPECT_RS(checker), strerror(errno));
+		close(thread->u.fd);
+		sendexpect_epilog(thread, false);
+		return 0;
+	}
+
+	se_check->sent += (size_t)ret;
+	if (se_check->sent < step->send_len) {
+		thread_add_write(thread->master, sendexpect_send_thread,
+				 checker, thread->u.fd, timeout);
+		return 0;
+	}
+
+	if (step->expect) {
+		thread_add_read(thread->master, sendexpect_recv_thread,
+				checker, thread->u.fd, timeout);
+		return 0;
+	}
+
+	/* Fire-and-forget step - move straight to the next one */
+	ELEMENT_NEXT(se_check->step);
+	sendexpect_step_start(thread);
+	return 0;
+}
+
+/* Match the collected reply against the step's expectation.
+ * Returns 1 on match, 0 if more data could still satisfy it,
+ * -1 when it can no longer match. */
+static int
+sendexpect_match(sendexpect_check_t *se_check, se_step_t *step)
+{
+	if (step->expect_regex) {
+		se_check->rbuf[se_check->recv_len] = '\0';
+		if (regexec(&step->re, se_check->rbuf, 0, NULL, 0) == 0)
+			return 1;
+		return se_check->recv_len >= SENDEXPECT_BUFFER_SIZE ? -1 : 0;
+	}
+
+	if (memcmp(se_check->rbuf, step->expect,
+		   se_check->recv_len < step->expect_len ? se_check->recv_len : step->expect_len))
+		return -1;
+
+	return se_check->recv_len >= step->expect_len ? 1 : 0;
+}
+
+static int
+sendexpect_recv_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	sendexpect_check_t *se_check = CHECKER_ARG(checker);
+	se_step_t *step = ELEMENT_DATA(se_check->step);
+	unsigned long timeout;
+	ssize_t ret;
+	int match;
+
+	if (thread->type == THREAD_READ_TIMEOUT) {
+		if (checker->is_up)
+			log_message(LOG_INFO, "Send/expect check to %s read timeout."
+					, FMT_SENDEXPECT_RS(checker));
+		close(thread->u.fd);
+		sendexpect_epilog(thread, false);
+		return 0;
+	}
+
+	timeout = timer_long(thread->sands) - timer_long(time_now);
+
+	ret = recv(thread->u.fd, se_check->rbuf + se_check->recv_len,
+		   SENDEXPECT_BUFFER_SIZE - se_check->recv_len, 0);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			thread_add_read(thread->master, sendexpect_recv_thread,
+					checker, thread->u.fd, timeout);
+			return 0;
+		}
+		if (checker->is_up)
+			log_message(LOG_INFO, "Send/expect check to %s read failed (%s)."
+					, FMT_SENDEXPECT_RS(checker), strerror(errno));
+		close(thread->u.fd);
+		sendexpect_epilog(thread, false);
+		return 0;
+	}
+
+	se_check->recv_len += (size_t)ret;
+	match = sendexpect_match(se_check, step);
+
+	if (match > 0) {
+		log_debug(LOG_SUBSYS_CHECK, "Send/expect check to %s step matched after %zu bytes",
+			  FMT_SENDEXPECT_RS(checker), se_check->recv_len);
+		ELEMENT_NEXT(se_check->step);
+		sendexpect_step_start(thread);
+		return 0;
+	}
+
+	/* ret == 0 is the peer closing - nothing more can arrive */
+	if (match < 0 || ret == 0 ||
+	    se_check->recv_len >= SENDEXPECT_BUFFER_SIZE) {
+		if (checker->is_up)
+			log_message(LOG_INFO, "Send/expect check to %s unexpected reply."
+					, FMT_SENDEXPECT_RS(checker));
+		close(thread->u.fd);
+		sendexpect_epilog(thread, false);
+		return 0;
+	}
+
+	thread_add_read(thread->master, sendexpect_recv_thread, checker,
+			thread->u.fd, timeout);
+	return 0;
+}
+
+static int
+sendexpect_check_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	sendexpect_check_t *se_check = CHECKER_ARG(checker);
+	int status;
+
+	status = tcp_socket_state(thread, sendexpect_check_thread);
+
+	/* If status = connect_in_progress, next thread is already registered.
+	 * If it is connect_success, the fd is still open.
+	 * Otherwise we have a real connection error or connection timeout.
+	 */
+	switch (status) {
+	case connect_in_progress:
+		break;
+	case connect_success:
+		se_check->step = LIST_HEAD(se_check->steps);
+		sendexpect_step_start(thread);
+		break;
+	default:
+		if (checker->is_up)
+			log_message(LOG_INFO, "Send/expect connection to %s failed."
+					, FMT_SENDEXPECT_RS(checker));
+		sendexpect_epilog(thread, false);
+	}
+
+	return 0;
+}
+
+static int
+sendexpect_connect_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	conn_opts_t *co = checker->co;
+	int fd;
+	int status;
+
+	/*
+	 * Register a new checker thread & return
+	 * if checker is disabled
+	 */
+	if (!checker->enabled) {
+		thread_add_timer_slack(thread->master, sendexpect_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
+		return 0;
+	}
+
+	if ((fd = socket_netns(co->netns, co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_TCP)) == -1) {
+		log_message(LOG_INFO, "Send/expect check fail to create socket. Rescheduling.");
+		thread_add_timer_slack(thread->master, sendexpect_connect_thread, checker,
+				checker->delay_loop,
+				 global_data->checker_timer_slack);
+
+		return 0;
+	}
+
+#if !HAVE_DECL_SOCK_CLOEXEC
+	if (set_sock_flags(fd, F_SETFD, FD_CLOEXEC))
+		log_message(LOG_INFO, "Unable to set CLOEXEC on send/expect socket - %s (%d)", strerror(errno), errno);
+#endif
+
+	status = tcp_bind_connect(fd, co);
+
+	/* handle tcp connection status & register check worker thread */
+	if (tcp_connection_state(fd, status, thread, sendexpect_check_thread, co)) {
+		close(fd);
+		log_message(LOG_INFO, "Send/expect socket bind failed. Rescheduling.");
+		thread_add_timer_slack(thread->master, sendexpect_connect_thread, checker,
+				checker->delay_loop,
+				 global_data->checker_timer_slack);
+	}
+
+	return 0;
+}
@@ -27,6 +27,7 @@
 
 #include "check_smtp.h"
 #include "check_api.h"
+#include "global_data.h"
 #include "logger.h"
 #include "memory.h"
 #include "ipwrapper.h"
@@ -42,6 +43,7 @@ static conn_opts_t* default_co;	/* Default conn_opts for SMTP_CHECK */
 static conn_opts_t *sav_co;	/* Saved conn_opts while host{} block processed */
 
 static int smtp_connect_thread(thread_t *);
+static int smtp_probe_connect_thread(thread_t *);
 static int smtp_final(thread_t *thread, int error, const char *format, ...)
 	 __attribute__ ((format (printf, 3, 4)));
 
@@ -56,6 +58,13 @@ smtp_free_host(void *data)
 	FREE(data);
 }
 
+/* Free callback for the in-flight probe list */
+static void
+smtp_free_probe(void *data)
+{
+	FREE(data);
+}
+
 /* Used as a callback from the checker api, queue_checker(),
  * to free up a checker entry and all its associated data.
  */
@@ -64,6 +73,7 @@ free_smtp_check(void *data)
 {
 	smtp_checker_t *smtp_checker = CHECKER_DATA(data);
 	free_list(&smtp_checker->host);
+	free_list(&smtp_checker->probe);
 	FREE(smtp_checker->helo_name);
 	FREE(smtp_checker);
 	FREE(data);
@@ -142,6 +152,7 @@ smtp_check_handler(__attribute__((unused)) vector_t *strvec)
 	 * of those hosts will be set to the default's values.
 	 */
 	smtp_checker->host = alloc_list(smtp_free_host, dump_connection_opts);
+	smtp_checker->probe = alloc_list(smtp_free_probe, NULL);
 }
 
 static void
@@ -266,6 +277,40 @@ install_smtp_check_keyword(void)
 	install_sublevel_end();
 }
 
+/*
+ * A probe has reached its verdict. Drop it, and once the last probe
+ * of the round has reported, conclude the round and reschedule the
+ * main thread using the configured delay loop.
+ */
+static void
+smtp_probe_report(thread_t *thread, smtp_probe_t *probe)
+{
+	checker_t *checker = probe->checker;
+	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
+	bool failed = smtp_checker->round_failed;
+
+	list_del(smtp_checker->probe, probe);
+	FREE(probe);
+
+	if (--smtp_checker->probes_left)
+		return;
+
+	/* All the hosts have been tested. Bring the service up if every
+	 * probe was successful (and it's not already up). */
+	if (!failed && !checker->is_up) {
+		log_message(LOG_INFO, "Remote SMTP server %s succeed on service."
+				    , FMT_CHK(checker));
+
+		smtp_alert(checker, NULL, NULL, "UP",
+			   "=> CHECK succeed on service <=");
+		update_svr_checker_state(UP, checker);
+	}
+
+	thread_add_timer_slack(thread->master, smtp_connect_thread, checker,
+			 checker_adjust_delay(checker, !failed),
+				 global_data->checker_timer_slack);
+}
+
 /*
  * Final handler. Determines if we need a retry or not.
  * Also has to make a decision if we need to bring the resulting
@@ -274,17 +319,21 @@ install_smtp_check_keyword(void)
 static int
 smtp_final(thread_t *thread, int error, const char *format, ...)
 {
-	checker_t *checker = THREAD_ARG(thread);
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	checker_t *checker = probe->checker;
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
 	char error_buff[512];
 	char smtp_buff[542];
 	va_list varg_list;
 
 	/* Error or no error we should always have to close the socket */
-	close(thread->u.fd);
+	if (probe->fd != -1) {
+		close(probe->fd);
+		probe->fd = -1;
+	}
 
-	/* If we're here, an attempt HAS been made already for the current host */
-	checker->retry_it++;
+	/* If we're here, an attempt HAS been made already for this host */
+	probe->retry_it++;
 
 	if (error) {
 		/* Always syslog the error when the real server is up */
@@ -304,56 +353,50 @@ smtp_final(thread_t *thread, int error, const char *format, ...)
 
 		/*
 		 * If we still have retries left, try this host again by
-		 * scheduling the main thread to check it again after the
+		 * scheduling its probe to connect again after the
 		 * configured backoff delay. Otherwise down the RS.
 		 */
-		if (checker->retry_it < checker->retry) {
-			thread_add_timer(thread->master, smtp_connect_thread, checker,
-					 checker->delay_before_retry);
+		if (probe->retry_it < checker->retry) {
+			thread_add_timer_slack(thread->master, smtp_probe_connect_thread, probe,
+					 checker->delay_before_retry,
+				 global_data->checker_timer_slack);
 			return 0;
 		}
 
 		/*
-		 * No more retries, pull the real server from the virtual server.
-		 * Only smtp_alert if it wasn't previously down. It should
-		 * be noted that smtp_alert makes a copy of the string arguments, so
-		 * we don't have to keep them statically allocated.
+		 * No more retries for this host, pull the real server from
+		 * the virtual server. One definitive host failure decides the
+		 * round, so act right away instead of waiting for the slower
+		 * probes still in flight. Only smtp_alert if it wasn't
+		 * previously down. It should be noted that smtp_alert makes a
+		 * copy of the string arguments, so we don't have to keep them
+		 * statically allocated.
 		 */
-		if (checker->is_up) {
-			if (format != NULL) {
-				snprintf(error_buff, sizeof(error_buff), "=> CHECK failed on service : %s <=", format);
-				va_start(varg_list, format);
-				vsnprintf(smtp_buff, sizeof(smtp_buff), error_buff, varg_list);
-				va_end(varg_list);
-			} else {
-				strncpy(smtp_buff, "=> CHECK failed on service <=", sizeof(smtp_buff));
+		if (!smtp_checker->round_failed) {
+			smtp_checker->round_failed = true;
+
+			if (checker->is_up) {
+				if (format != NULL) {
+					snprintf(error_buff, sizeof(error_buff), "=> CHECK failed on service : %s <=", format);
+					va_start(varg_list, format);
+					vsnprintf(smtp_buff, sizeof(smtp_buff), error_buff, varg_list);
+					va_end(varg_list);
+				} else {
+					strncpy(smtp_buff, "=> CHECK failed on service <=", sizeof(smtp_buff));
+				}
+
+				smtp_buff[sizeof(smtp_buff) - 1] = '\0';
+				smtp_alert(checker, NULL, NULL, "DOWN", smtp_buff);
+				update_svr_checker_state(DOWN, checker);
 			}
-
-			smtp_buff[sizeof(smtp_buff) - 1] = '\0';
-			smtp_alert(checker, NULL, NULL, "DOWN", smtp_buff);
-			update_svr_checker_state(DOWN, checker);
 		}
-
-		/* Reset everything back to the first host in the list */
-		checker->retry_it = 0;
-		smtp_checker->host_ctr = 0;
-
-		/* Reschedule the main thread using the configured delay loop */;
-		thread_add_timer(thread->master, smtp_connect_thread, checker, checker->delay_loop);
-
-		return 0;
 	}
 
 	/*
-	 * Ok this host was successful, increment to the next host in the list
-	 * and reset the retry_it counter. We'll then reschedule the main thread again.
-	 * If host_ptr exceeds the end of the list, http_main_thread will
-	 * take note and bring up the real server as well as inject the delay_loop.
+	 * Report the verdict for this host - the round concludes and the
+	 * main thread is rescheduled once the last probe comes in.
 	 */
-	checker->retry_it = 0;
-	smtp_checker->host_ctr++;
-
-	thread_add_timer(thread->master, smtp_connect_thread, checker, 1);
+	smtp_probe_report(thread, probe);
 	return 0;
 }
 
@@ -363,10 +406,9 @@ smtp_final(thread_t *thread, int error, const char *format, ...)
 static void
 smtp_clear_buff(thread_t *thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	memset(smtp_checker->buff, 0, SMTP_BUFF_MAX);
-	smtp_checker->buff_ctr = 0;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	memset(probe->buff, 0, SMTP_BUFF_MAX);
+	probe->buff_ctr = 0;
 }
 
 /*
@@ -378,10 +420,8 @@ smtp_clear_buff(thread_t *thread)
 static int
 smtp_get_line_cb(thread_t *thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
-	int f;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	conn_opts_t *smtp_host = probe->host;
 	unsigned x;
 	ssize_t r;
 
@@ -393,42 +433,34 @@ smtp_get_line_cb(thread_t *thread)
 	}
 
 	/* wrap the buffer, if full, by clearing it */
-	if (smtp_checker->buff_ctr > SMTP_BUFF_MAX) {
+	if (probe->buff_ctr > SMTP_BUFF_MAX) {
 		log_message(LOG_INFO, "SMTP_CHECK Buffer overflow reading from server %s. "
 				      "Increase SMTP_BUFF_MAX in smtp_check.h"
 				    , FMT_SMTP_RS(smtp_host));
 		smtp_clear_buff(thread);
 	}
 
-	/* Set descriptor non blocking */
-	f = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, f | O_NONBLOCK);
-
-	/* read the data */
-	r = read(thread->u.fd, smtp_checker->buff + smtp_checker->buff_ctr,
-		 SMTP_BUFF_MAX - smtp_checker->buff_ctr);
+	/* read the data - the socket is non-blocking */
+	r = read(thread->u.fd, probe->buff + probe->buff_ctr,
+		 SMTP_BUFF_MAX - probe->buff_ctr);
 
 	if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
-		thread_add_read(thread->master, smtp_get_line_cb, checker,
+		thread_add_read(thread->master, smtp_get_line_cb, probe,
 				thread->u.fd, smtp_host->connection_to);
-		fcntl(thread->u.fd, F_SETFL, f);
 		return 0;
 	} else if (r > 0)
-		smtp_checker->buff_ctr += (size_t)r;
-
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, f);
+		probe->buff_ctr += (size_t)r;
 
 	/* check if we have a newline, if so, callback */
 	for (x = 0; x < SMTP_BUFF_MAX; x++) {
-		if (smtp_checker->buff[x] == '\n') {
-			smtp_checker->buff[SMTP_BUFF_MAX - 1] = '\0';
+		if (probe->buff[x] == '\n') {
+			probe->buff[SMTP_BUFF_MAX - 1] = '\0';
 
 			DBG("SMTP_CHECK %s < %s"
 			    , FMT_SMTP_RS(smtp_host)
-			    , smtp_checker->buff);
+			    , probe->buff);
 
-			(smtp_checker->buff_cb)(thread);
+			(probe->buff_cb)(thread);
 
 			return 0;
 		}
@@ -449,7 +481,7 @@ smtp_get_line_cb(thread_t *thread)
 	 * to pull a newline. Schedule ourselves for
 	 * another round.
 	 */
-	thread_add_read(thread->master, smtp_get_line_cb, checker,
+	thread_add_read(thread->master, smtp_get_line_cb, probe,
 			thread->u.fd, smtp_host->connection_to);
 	return 0;
 }
@@ -466,18 +498,17 @@ smtp_get_line_cb(thread_t *thread)
 static void
 smtp_get_line(thread_t *thread, int (*callback) (thread_t *))
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	conn_opts_t *smtp_host = probe->host;
 
 	/* clear the buffer */
 	smtp_clear_buff(thread);
 
 	/* set the callback */
-	smtp_checker->buff_cb = callback;
+	probe->buff_cb = callback;
 
 	/* schedule the I/O with our helper function  */
-	thread_add_read(thread->master, smtp_get_line_cb, checker,
+	thread_add_read(thread->master, smtp_get_line_cb, probe,
 		thread->u.fd, smtp_host->connection_to);
 	return;
 }
@@ -491,10 +522,8 @@ smtp_get_line(thread_t *thread, int (*callback) (thread_t *))
 static int
 smtp_put_line_cb(thread_t *thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
-	int f;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	conn_opts_t *smtp_host = probe->host;
 	ssize_t w;
 
 
@@ -505,26 +534,18 @@ smtp_put_line_cb(thread_t *thread)
 		return 0;
 	}
 
-	/* Set descriptor non blocking */
-	f = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, f | O_NONBLOCK);
-
-	/* write the data */
-	w = write(thread->u.fd, smtp_checker->buff, smtp_checker->buff_ctr);
+	/* write the data - the socket is non-blocking */
+	w = write(thread->u.fd, probe->buff, probe->buff_ctr);
 
 	if (w == -1 && (errno == EAGAIN || errno == EINTR)) {
-		thread_add_write(thread->master, smtp_put_line_cb, checker,
+		thread_add_write(thread->master, smtp_put_line_cb, probe,
 				 thread->u.fd, smtp_host->connection_to);
-		fcntl(thread->u.fd, F_SETFL, f);
 		return 0;
 	}
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, f);
-
 	DBG("SMTP_CHECK %s > %s"
 	    , FMT_SMTP_RS(smtp_host)
-	    , smtp_checker->buff);
+	    , probe->buff);
 
 	/*
 	 * If the connection was closed or there was
@@ -537,7 +558,7 @@ smtp_put_line_cb(thread_t *thread)
 	}
 
 	/* Execute the callback */
-	(smtp_checker->buff_cb)(thread);
+	(probe->buff_cb)(thread);
 	return 0;
 }
 
@@ -548,18 +569,17 @@ smtp_put_line_cb(thread_t *thread)
 static void
 smtp_put_line(thread_t *thread, int (*callback) (thread_t *))
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	conn_opts_t *smtp_host = probe->host;
 
-	smtp_checker->buff[SMTP_BUFF_MAX - 1] = '\0';
-	smtp_checker->buff_ctr = strlen(smtp_checker->buff);
+	probe->buff[SMTP_BUFF_MAX - 1] = '\0';
+	probe->buff_ctr = strlen(probe->buff);
 
 	/* set the callback */
-	smtp_checker->buff_cb = callback;
+	probe->buff_cb = callback;
 
 	/* schedule the I/O with our helper function  */
-	thread_add_write(thread->master, smtp_put_line_cb, checker,
+	thread_add_write(thread->master, smtp_put_line_cb, probe,
 			 thread->u.fd, smtp_host->connection_to);
 	return;
 }
@@ -572,9 +592,8 @@ smtp_put_line(thread_t *thread, int (*callback) (thread_t *))
 static int
 smtp_get_status(thread_t *thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	char *buff = smtp_checker->buff;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	char *buff = probe->buff;
 
 	/* First make sure they're all digits */
 	if (isdigit(buff[0]) && isdigit(buff[1]) &&
@@ -591,17 +610,17 @@ smtp_get_status(thread_t *thread)
  * We have a connected socket and are ready to begin
  * the conversation. This function schedules itself to
  * be called via callbacks and tracking state in
- * smtp_checker->state. Upon first calling, smtp_checker->state
+ * probe->state. Upon first calling, probe->state
  * should be set to SMTP_START.
  */
 static int
 smtp_engine_thread(thread_t *thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	smtp_checker_t *smtp_checker = CHECKER_ARG(probe->checker);
+	conn_opts_t *smtp_host = probe->host;
 
-	switch (smtp_checker->state) {
+	switch (probe->state) {
 
 		/* First step, schedule to receive the greeting banner */
 		case SMTP_START:
@@ -610,7 +629,7 @@ smtp_engine_thread(thread_t *thread)
 			 * have data to analyze. Otherwise, smtp_get_line
 			 * will defer directly to smtp_final.
 			 */
-			smtp_checker->state = SMTP_HAVE_BANNER;
+			probe->state = SMTP_HAVE_BANNER;
 			smtp_get_line(thread, smtp_engine_thread);
 			return 0;
 			break;
@@ -629,8 +648,8 @@ smtp_engine_thread(thread_t *thread)
 			 * Schedule to send the HELO, smtp_put_line will
 			 * defer directly to smtp_final on error.
 			 */
-			smtp_checker->state = SMTP_SENT_HELO;
-			snprintf(smtp_checker->buff, SMTP_BUFF_MAX, "HELO %s\r\n",
+			probe->state = SMTP_SENT_HELO;
+			snprintf(probe->buff, SMTP_BUFF_MAX, "HELO %s\r\n",
 				 smtp_checker->helo_name);
 			smtp_put_line(thread, smtp_engine_thread);
 			return 0;
@@ -638,7 +657,7 @@ smtp_engine_thread(thread_t *thread)
 
 		/* Third step, schedule to read the HELO response */
 		case SMTP_SENT_HELO:
-			smtp_checker->state = SMTP_RECV_HELO;
+			probe->state = SMTP_RECV_HELO;
 			smtp_get_line(thread, smtp_engine_thread);
 			return 0;
 			break;
@@ -653,15 +672,15 @@ smtp_engine_thread(thread_t *thread)
 				return 0;
 			}
 
-			smtp_checker->state = SMTP_SENT_QUIT;
-			snprintf(smtp_checker->buff, SMTP_BUFF_MAX, "QUIT\r\n");
+			probe->state = SMTP_SENT_QUIT;
+			snprintf(probe->buff, SMTP_BUFF_MAX, "QUIT\r\n");
 			smtp_put_line(thread, smtp_engine_thread);
 			return 0;
 			break;
 
 		/* Fifth step, schedule to receive QUIT confirmation */
 		case SMTP_SENT_QUIT:
-			smtp_checker->state = SMTP_RECV_QUIT;
+			probe->state = SMTP_RECV_QUIT;
 			smtp_get_line(thread, smtp_engine_thread);
 			return 0;
 			break;
@@ -685,20 +704,23 @@ smtp_engine_thread(thread_t *thread)
 static int
 smtp_check_thread(thread_t *thread)
 {
-	checker_t *checker = THREAD_ARG(thread);
-	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host = smtp_checker->host_ptr;
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	conn_opts_t *smtp_host = probe->host;
 	int status;
 
 	status = tcp_socket_state(thread, smtp_check_thread);
 	switch (status) {
 		case connect_error:
+			/* tcp_socket_state() has already closed the socket */
+			probe->fd = -1;
 			smtp_final(thread, 1, "Error connecting to server %s"
 					     , FMT_SMTP_RS(smtp_host));
 			return 0;
 			break;
 
 		case connect_timeout:
+			/* tcp_socket_state() has already closed the socket */
+			probe->fd = -1;
 			smtp_final(thread, 1, "Connection timeout to server %s"
 					     , FMT_SMTP_RS(smtp_host));
 			return 0;
@@ -709,7 +731,7 @@ smtp_check_thread(thread_t *thread)
 			    , FMT_SMTP_RS(smtp_host));
 
 			/* Enter the engine at SMTP_START */
-			smtp_checker->state = SMTP_START;
+			probe->state = SMTP_START;
 			smtp_engine_thread(thread);
 			return 0;
 			break;
@@ -736,9 +758,8 @@ smtp_connect_thread(thread_t *thread)
 {
 	checker_t *checker = THREAD_ARG(thread);
 	smtp_checker_t *smtp_checker = CHECKER_ARG(checker);
-	conn_opts_t *smtp_host;
-	enum connect_result status;
-	int sd;
+	smtp_probe_t *probe;
+	element e;
 
 	/* Let's review our data structures.
 	 *
@@ -759,10 +780,11 @@ smtp_connect_thread(thread_t *thread)
 	 * So this whole thing looks like this:
 	 * thread->arg(checker)->data(smtp_checker)->host(smtp_host)
 	 *
-	 * To make life simple, we'll break the structures out so
-	 * that "checker" always points to the current checker structure,
-	 * "smtp_checker" points to the current smtp_checker structure,
-	 * and "smtp_host" points to the current smtp_host structure.
+	 * Each host is probed by an smtp_probe structure of its own,
+	 * carrying the connection, buffer and engine state, so all the
+	 * hosts can be checked concurrently. The probe threads get the
+	 * smtp_probe as their argument, and reach the checker through
+	 * probe->checker.
 	 */
 
 	/*
@@ -771,43 +793,55 @@ smtp_connect_thread(thread_t *thread)
 	 * we don't fall of the face of the earth.
 	 */
 	if (!checker->enabled) {
-		thread_add_timer(thread->master, smtp_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, smtp_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
 		return 0;
 	}
 
 	/*
-	 * Set the internal host pointer to the host that we'll be
-	 * working on. If it's NULL, we've successfully tested all hosts.
-	 * We'll bring the service up (if it's not already), reset the host list,
-	 * and insert the delay loop. When we get scheduled again the host list
-	 * will be reset and we will continue on checking them one by one.
+	 * Launch a probe for every host in the list at once. The hosts are
+	 * independent sockets, so the round completes when the slowest
+	 * single host answers instead of after the sum of all the
+	 * round-trips. smtp_final() aggregates the per host verdicts and
+	 * smtp_probe_report() reschedules us once the last probe reports.
 	 */
-	if ((smtp_checker->host_ptr = list_element(smtp_checker->host, smtp_checker->host_ctr)) == NULL) {
-		if (!checker->is_up) {
-			log_message(LOG_INFO, "Remote SMTP server %s succeed on service."
-					    , FMT_CHK(checker));
-
-			smtp_alert(checker, NULL, NULL, "UP",
-				   "=> CHECK succeed on service <=");
-			update_svr_checker_state(UP, checker);
-		}
-
-		checker->retry_it = 0;
-		smtp_checker->host_ctr = 0;
-		smtp_checker->host_ptr = list_element(smtp_checker->host, 0);
-
-		thread_add_timer(thread->master, smtp_connect_thread, checker, checker->delay_loop);
-		return 0;
+	smtp_checker->probes_left = (unsigned)LIST_SIZE(smtp_checker->host);
+	smtp_checker->round_failed = false;
+
+	for (e = LIST_HEAD(smtp_checker->host); e; ELEMENT_NEXT(e)) {
+		probe = (smtp_probe_t *)MALLOC(sizeof(smtp_probe_t));
+		probe->checker = checker;
+		probe->host = ELEMENT_DATA(e);
+		probe->fd = -1;
+		list_add(smtp_checker->probe, probe);
+
+		thread_add_timer(thread->master, smtp_probe_connect_thread,
+				 probe, 0);
 	}
 
-	smtp_host = smtp_checker->host_ptr;
+	return 0;
+}
+
+/*
+ * Open the connection towards a single host. Every host of the checker
+ * has a probe of its own, so they all connect in parallel.
+ */
+static int
+smtp_probe_connect_thread(thread_t *thread)
+{
+	smtp_probe_t *probe = THREAD_ARG(thread);
+	checker_t *checker = probe->checker;
+	conn_opts_t *smtp_host = probe->host;
+	enum connect_result status;
+	int sd;
 
 	/* Create the socket, failling here should be an oddity */
-	if ((sd = socket(smtp_host->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
+	if ((sd = socket_netns(smtp_host->netns, smtp_host->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_TCP)) == -1) {
 		log_message(LOG_INFO, "SMTP_CHECK connection failed to create socket. Rescheduling.");
-		thread_add_timer(thread->master, smtp_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, smtp_probe_connect_thread, probe,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
 		return 0;
 	}
 #if !HAVE_DECL_SOCK_CLOEXEC
@@ -818,12 +852,15 @@ smtp_connect_thread(thread_t *thread)
 	status = tcp_bind_connect(sd, smtp_host);
 
 	/* handle tcp connection status & register callback the next setp in the process */
-	if(tcp_connection_state(sd, status, thread, smtp_check_thread, smtp_host->connection_to)) {
+	if(tcp_connection_state(sd, status, thread, smtp_check_thread, smtp_host)) {
 		close(sd);
 		log_message(LOG_INFO, "SMTP_CHECK socket bind failed. Rescheduling.");
-		thread_add_timer(thread->master, smtp_connect_thread, checker,
-			checker->delay_loop);
+		thread_add_timer_slack(thread->master, smtp_probe_connect_thread, probe,
+			checker->delay_loop,
+				 global_data->checker_timer_slack);
+		return 0;
 	}
 
+	probe->fd = sd;
 	return 0;
 }
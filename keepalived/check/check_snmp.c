@@ -1629,8 +1629,7 @@ check_snmp_rs_trap(real_server_t *rs, virtual_server_t *vs)
 				  (u_char *)global_data->router_id,
 				  strlen(global_data->router_id));
 
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, rs ? (const void *)rs : (const void *)vs, SNMP_TRAP_RS);
 }
 
 void
@@ -60,6 +60,26 @@ password_cb(char *buf, int num, __attribute__((unused)) int rwflag, void *userda
 	return (int)plen;
 }
 
+/* Session cache callback. Called by the library whenever a negotiated
+ * session (or a TLSv1.3 ticket, which only arrives after the handshake)
+ * becomes available; cache it against the real server so the next check
+ * can resume with an abbreviated handshake */
+static int
+ssl_new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	real_server_t *rs = SSL_get_app_data(ssl);
+
+	if (!rs)
+		return 0;
+
+	if (rs->ssl_session)
+		SSL_SESSION_free(rs->ssl_session);
+	rs->ssl_session = sess;
+
+	/* We keep the reference */
+	return 1;
+}
+
 /* Inititalize global SSL context */
 static int
 build_ssl_ctx(void)
@@ -84,6 +104,12 @@ build_ssl_ctx(void)
 	ssl->meth = (SSL_METHOD *) SSLv23_method();
 	ssl->ctx = SSL_CTX_new(ssl->meth);
 
+	/* Cache client sessions per real server, so repeat checks can do
+	 * abbreviated handshakes. The library internal cache is not used */
+	SSL_CTX_set_session_cache_mode(ssl->ctx,
+				       SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+	SSL_CTX_sess_set_new_cb(ssl->ctx, ssl_new_session_cb);
+
 	/* return for autogen context */
 	if (!check_data->ssl) {
 		check_data->ssl = ssl;
@@ -207,6 +233,11 @@ ssl_connect(thread_t * thread, int new_req)
 		SSL_set0_rbio(req->ssl, req->bio);
 		SSL_set0_wbio(req->ssl, req->bio);
 #endif
+
+		/* Resume the cached session of this real server, if any */
+		SSL_set_app_data(req->ssl, checker->rs);
+		if (checker->rs->ssl_session)
+			SSL_set_session(req->ssl, checker->rs->ssl_session);
 	}
 
 	/* Set descriptor non blocking */
@@ -252,22 +283,14 @@ ssl_read_thread(thread_t * thread)
 	unsigned timeout = checker->co->connection_to;
 	unsigned char digest[16];
 	int r = 0;
-	int val;
 
 	/* Handle read timeout */
 	if (thread->type == THREAD_READ_TIMEOUT && !req->extracted)
 		return timeout_epilog(thread, "Timeout SSL read");
 
-	/* Set descriptor non blocking */
-	val = fcntl(thread->u.fd, F_GETFL, 0);
-	fcntl(thread->u.fd, F_SETFL, val | O_NONBLOCK);
-
-	/* read the SSL stream */
+	/* read the SSL stream - the socket is non-blocking */
 	r = SSL_read(req->ssl, req->buffer + req->len, (int)(MAX_BUFFER_LENGTH - req->len));
 
-	/* restore descriptor flags */
-	fcntl(thread->u.fd, F_SETFL, val);
-
 	req->error = SSL_get_error(req->ssl, r);
 
 	if (req->error == SSL_ERROR_WANT_READ) {
@@ -276,7 +299,36 @@ ssl_read_thread(thread_t * thread)
 				thread->u.fd, timeout);
 	} else if (r > 0 && req->error == 0) {
 		/* Handle response stream */
-		http_process_response(req, (size_t)r, (url->digest != NULL));
+		http_process_response(req, (size_t)r,
+				      ((url->digest || url->fingerprint_set) && !http_get_check->light_round));
+
+		/* A light round needs nothing beyond the headers */
+		if (http_get_check->light_round && req->extracted) {
+			http_handle_response(thread, digest, false);
+			return 0;
+		}
+
+		/* With keep-alive the end of the response is known from
+		 * Content-Length, without waiting for the server to close */
+		if (http_get_check->keepalive && req->extracted &&
+		    req->content_len != UINT_MAX && req->rx_bytes >= req->content_len) {
+			if (url->digest)
+				MD5_Final(digest, &req->context);
+			http_get_check->ka_keep = true;
+			http_handle_response(thread, digest, false);
+			return 0;
+		}
+
+		/* A digest limited to the first N bytes concludes once they
+		 * are hashed. The connection cannot be reused since the rest
+		 * of the body is unread. */
+		if ((url->digest || url->fingerprint_set) && req->extracted &&
+		    req->digest_limit != UINT_MAX && req->rx_bytes >= req->digest_limit) {
+			if (url->digest)
+				MD5_Final(digest, &req->context);
+			http_handle_response(thread, digest, false);
+			return 0;
+		}
 
 		/*
 		 * Register next ssl stream reader.
@@ -22,8 +22,19 @@
 
 #include "config.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
 #include "check_tcp.h"
 #include "check_api.h"
+#include "global_data.h"
 #include "memory.h"
 #include "ipwrapper.h"
 #include "layer4.h"
@@ -37,6 +48,13 @@
 #endif
 
 static int tcp_connect_thread(thread_t *);
+static void tcp_epilog(checker_t *, bool);
+
+/* Shared raw sockets for the half-open SYN probe mode, one per
+ * address family. [0] is IPv4, [1] is IPv6. */
+static int syn_fd[2] = { -1, -1 };
+static thread_t *syn_reader[2];
+static uint16_t syn_port_next;
 
 /* Configuration stream handling */
 static void
@@ -51,23 +69,39 @@ static void
 dump_tcp_check(void *data)
 {
 	checker_t *checker = data;
+	tcp_check_t *tcp_check = CHECKER_ARG(checker);
 
 	log_message(LOG_INFO, "   Keepalive method = TCP_CHECK");
+	if (tcp_check->syn_probe)
+		log_message(LOG_INFO, "   SYN probe = on");
 	dump_checker_opts(checker);
 }
 
 static bool
 tcp_check_compare(void *a, void *b)
 {
+	if (((tcp_check_t *)CHECKER_DATA(a))->syn_probe !=
+	    ((tcp_check_t *)CHECKER_DATA(b))->syn_probe)
+		return false;
 	return compare_conn_opts(CHECKER_CO(a), CHECKER_CO(b));
 }
 
 static void
 tcp_check_handler(__attribute__((unused)) vector_t *strvec)
 {
+	tcp_check_t *tcp_check = (tcp_check_t *) MALLOC(sizeof (tcp_check_t));
+
 	/* queue new checker */
 	queue_checker(free_tcp_check, dump_tcp_check, tcp_connect_thread,
-		      tcp_check_compare, NULL, CHECKER_NEW_CO());
+		      tcp_check_compare, tcp_check, CHECKER_NEW_CO());
+}
+
+static void
+tcp_syn_probe_handler(__attribute__((unused)) vector_t *strvec)
+{
+	tcp_check_t *tcp_check = CHECKER_GET();
+
+	tcp_check->syn_probe = true;
 }
 
 static void
@@ -84,20 +118,18 @@ install_tcp_check_keyword(void)
 	install_keyword("TCP_CHECK", &tcp_check_handler);
 	install_sublevel();
 	install_checker_common_keywords(true);
+	install_keyword("syn_probe", &tcp_syn_probe_handler);
 	install_sublevel_end_handler(tcp_check_end_handler);
 	install_sublevel_end();
 }
 
 static void
-tcp_epilog(thread_t * thread, bool is_success)
+tcp_epilog(checker_t *checker, bool is_success)
 {
-	checker_t *checker;
 	unsigned long delay;
 
-	checker = THREAD_ARG(thread);
-
 	if (is_success || checker->retry_it >= checker->retry) {
-		delay = checker->delay_loop;
+		delay = checker_adjust_delay(checker, is_success);
 		checker->retry_it = 0;
 
 		if (is_success && !checker->is_up) {
@@ -125,7 +157,237 @@ tcp_epilog(thread_t * thread, bool is_success)
 	}
 
 	/* Register next timer checker */
-	thread_add_timer(thread->master, tcp_connect_thread, checker, delay);
+	thread_add_timer_slack(master, tcp_connect_thread, checker, delay,
+				 global_data->checker_timer_slack);
+}
+
+/*
+ * Half-open SYN probe engine. The SYN is crafted on a shared raw
+ * socket and the answer read back off the same socket: a SYN-ACK means
+ * the service is accepting, an RST means it is not, silence is a
+ * timeout. The handshake is never completed - the kernel, seeing a
+ * SYN-ACK for a port it has no socket on, answers it with an RST for
+ * us - so the backend never takes an accept() and neither side is
+ * left holding a TIME_WAIT.
+ */
+
+static int syn_receive_thread(thread_t *);
+
+/* Source address the kernel will route towards the destination,
+ * needed for the IPv4 pseudo-header checksum */
+static bool
+syn_probe_saddr(conn_opts_t *co, struct in_addr *saddr)
+{
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	int fd;
+
+	if (co->bindto.ss_family == AF_INET) {
+		*saddr = ((struct sockaddr_in *) &co->bindto)->sin_addr;
+		return true;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return false;
+	if (connect(fd, (struct sockaddr *) &co->dst, sizeof(struct sockaddr_in)) < 0 ||
+	    getsockname(fd, (struct sockaddr *) &sin, &slen) < 0) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+	*saddr = sin.sin_addr;
+	return true;
+}
+
+static bool
+syn_probe_open(int slot)
+{
+	int family = slot ? AF_INET6 : AF_INET;
+	int offset = (int) offsetof(struct tcphdr, check);
+	int fd;
+
+	if (syn_fd[slot] != -1)
+		return true;
+
+	fd = socket(family, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_TCP);
+	if (fd == -1) {
+		log_message(LOG_INFO, "SYN probe socket error %d (%m)", errno);
+		return false;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+
+	/* The kernel checksums outgoing IPv6 raw packets for us */
+	if (family == AF_INET6)
+		setsockopt(fd, IPPROTO_IPV6, IPV6_CHECKSUM, &offset, sizeof(offset));
+
+	syn_fd[slot] = fd;
+	syn_reader[slot] = thread_add_read(master, syn_receive_thread,
+					   (void *) (long) slot, fd, TIMER_NEVER);
+	return true;
+}
+
+/* The probe went unanswered */
+static int
+syn_timeout_thread(thread_t *thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	tcp_check_t *tcp_check = CHECKER_ARG(checker);
+
+	tcp_check->timeout_thread = NULL;
+	tcp_check->awaiting = false;
+
+	if (checker->is_up)
+		log_message(LOG_INFO, "TCP SYN probe to %s timeout."
+				, FMT_TCP_RS(checker));
+	tcp_epilog(checker, false);
+	return 0;
+}
+
+/* Find the probe a reply belongs to. dest/source/ack_seq are in
+ * network order as they came off the wire. */
+static checker_t *
+syn_find_checker(uint16_t dest, uint16_t source, uint32_t ack_seq)
+{
+	element e;
+	checker_t *checker;
+	tcp_check_t *tcp_check;
+
+	for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		checker = ELEMENT_DATA(e);
+		if (checker->launch != tcp_connect_thread)
+			continue;
+		tcp_check = CHECKER_ARG(checker);
+		if (!tcp_check->awaiting ||
+		    htons(tcp_check->probe_port) != dest ||
+		    htonl(tcp_check->probe_seq + 1) != ack_seq ||
+		    inet_sockaddrport(&checker->co->dst) != source)
+			continue;
+		return checker;
+	}
+	return NULL;
+}
+
+/* Shared receive path - drain the socket and demultiplex */
+static int
+syn_receive_thread(thread_t *thread)
+{
+	long slot = (long) THREAD_ARG(thread);
+	char rbuf[128];
+	struct iphdr *iph;
+	struct tcphdr *th;
+	checker_t *checker;
+	tcp_check_t *tcp_check;
+	ssize_t len;
+
+	while ((len = recv(thread->u.fd, rbuf, sizeof(rbuf), 0)) > 0) {
+		if (slot == 0) {
+			iph = (struct iphdr *) rbuf;
+			if (len < (ssize_t) ((iph->ihl << 2) + sizeof(*th)))
+				continue;
+			th = (struct tcphdr *) (rbuf + (iph->ihl << 2));
+		} else {
+			if (len < (ssize_t) sizeof(*th))
+				continue;
+			th = (struct tcphdr *) rbuf;
+		}
+
+		if (!(th->syn && th->ack) && !th->rst)
+			continue;
+
+		checker = syn_find_checker(th->dest, th->source, th->ack_seq);
+		if (!checker)
+			continue;
+
+		tcp_check = CHECKER_ARG(checker);
+		tcp_check->awaiting = false;
+		if (tcp_check->timeout_thread) {
+			thread_cancel(tcp_check->timeout_thread);
+			tcp_check->timeout_thread = NULL;
+		}
+
+		if (th->rst && checker->is_up)
+			log_message(LOG_INFO, "TCP SYN probe to %s refused."
+					, FMT_TCP_RS(checker));
+		tcp_epilog(checker, th->syn && th->ack);
+	}
+
+	syn_reader[slot] = thread_add_read(master, syn_receive_thread,
+					   (void *) slot, thread->u.fd,
+					   TIMER_NEVER);
+	return 0;
+}
+
+/* Craft and send one SYN; returns false on a local failure */
+static bool
+syn_probe_send(checker_t *checker)
+{
+	conn_opts_t *co = checker->co;
+	tcp_check_t *tcp_check = CHECKER_ARG(checker);
+	int slot = (co->dst.ss_family == AF_INET6);
+	struct tcphdr th;
+	struct {
+		uint32_t	src;
+		uint32_t	dst;
+		uint8_t		zero;
+		uint8_t		proto;
+		uint16_t	len;
+	} ph;	/* naturally packed - 12 bytes, no padding */
+	struct in_addr saddr;
+	uint32_t acc;
+
+	if (!syn_probe_open(slot))
+		return false;
+
+	/* A moving source port plus a random sequence keys the reply
+	 * back to this probe */
+	tcp_check->probe_port = (uint16_t) (61000 + (syn_port_next++ & 0x0fff));
+	tcp_check->probe_seq = (uint32_t) rand();
+
+	memset(&th, 0, sizeof(th));
+	th.source = htons(tcp_check->probe_port);
+	th.dest = inet_sockaddrport(&co->dst);
+	th.seq = htonl(tcp_check->probe_seq);
+	th.doff = sizeof(th) >> 2;
+	th.syn = 1;
+	th.window = htons(65535);
+
+	if (slot == 0) {
+		if (!syn_probe_saddr(co, &saddr))
+			return false;
+		ph.src = saddr.s_addr;
+		ph.dst = ((struct sockaddr_in *) &co->dst)->sin_addr.s_addr;
+		ph.zero = 0;
+		ph.proto = IPPROTO_TCP;
+		ph.len = htons(sizeof(th));
+		in_csum((uint16_t *) &ph, sizeof(ph), 0, &acc);
+		th.check = in_csum((uint16_t *) &th, sizeof(th), acc, NULL);
+	}
+
+	if (sendto(syn_fd[slot], &th, sizeof(th), 0,
+		   (struct sockaddr *) &co->dst, sizeof(co->dst)) < 0)
+		return false;
+
+	tcp_check->awaiting = true;
+	tcp_check->timeout_thread = thread_add_timer(master, syn_timeout_thread,
+						     checker, co->connection_to);
+	return true;
+}
+
+/* Close the shared probe sockets. Their read threads went with the
+ * master thread. */
+void
+syn_close_sockets(void)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (syn_fd[i] != -1) {
+			close(syn_fd[i]);
+			syn_fd[i] = -1;
+		}
+		syn_reader[i] = NULL;
+	}
 }
 
 static int
@@ -145,20 +407,21 @@ tcp_check_thread(thread_t * thread)
 	case connect_in_progress:
 		break;
 	case connect_success:
+		log_debug(LOG_SUBSYS_CHECK, "TCP connection to %s succeeded", FMT_TCP_RS(checker));
 		close(thread->u.fd);
-		tcp_epilog(thread, true);
+		tcp_epilog(checker, true);
 		break;
 	case connect_timeout:
 		if (checker->is_up)
 			log_message(LOG_INFO, "TCP connection to %s timeout."
 					, FMT_TCP_RS(checker));
-		tcp_epilog(thread, false);
+		tcp_epilog(checker, false);
 		break;
 	default:
 		if (checker->is_up)
 			log_message(LOG_INFO, "TCP connection to %s failed."
 					, FMT_TCP_RS(checker));
-		tcp_epilog(thread, false);
+		tcp_epilog(checker, false);
 	}
 
 	return 0;
@@ -177,15 +440,28 @@ tcp_connect_thread(thread_t * thread)
 	 * if checker is disabled
 	 */
 	if (!checker->enabled) {
-		thread_add_timer(thread->master, tcp_connect_thread, checker,
-				 checker->delay_loop);
+		thread_add_timer_slack(thread->master, tcp_connect_thread, checker,
+				 checker->delay_loop,
+				 global_data->checker_timer_slack);
+		return 0;
+	}
+
+	if (((tcp_check_t *)CHECKER_ARG(checker))->syn_probe) {
+		if (!syn_probe_send(checker)) {
+			log_message(LOG_INFO, "TCP SYN probe to %s setup failed. Rescheduling."
+					, FMT_TCP_RS(checker));
+			thread_add_timer_slack(thread->master, tcp_connect_thread, checker,
+					 checker->delay_loop,
+				 global_data->checker_timer_slack);
+		}
 		return 0;
 	}
 
-	if ((fd = socket(co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
+	if ((fd = socket_netns(co->netns, co->dst.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_TCP)) == -1) {
 		log_message(LOG_INFO, "TCP connect fail to create socket. Rescheduling.");
-		thread_add_timer(thread->master, tcp_connect_thread, checker,
-				checker->delay_loop);
+		thread_add_timer_slack(thread->master, tcp_connect_thread, checker,
+				checker->delay_loop,
+				 global_data->checker_timer_slack);
 
 		return 0;
 	}
@@ -198,12 +474,12 @@ tcp_connect_thread(thread_t * thread)
 	status = tcp_bind_connect(fd, co);
 
 	/* handle tcp connection status & register check worker thread */
-	if(tcp_connection_state(fd, status, thread, tcp_check_thread,
-			co->connection_to)) {
+	if(tcp_connection_state(fd, status, thread, tcp_check_thread, co)) {
 		close(fd);
 		log_message(LOG_INFO, "TCP socket bind failed. Rescheduling.");
-		thread_add_timer(thread->master, tcp_connect_thread, checker,
-				checker->delay_loop);
+		thread_add_timer_slack(thread->master, tcp_connect_thread, checker,
+				checker->delay_loop,
+				 global_data->checker_timer_slack);
 	}
 
 	return 0;
@@ -0,0 +1,351 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        UDP checker
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+/* The UDP checker probes a datagram service without forking a helper
+ * process per probe. A configurable payload is sent on a connected,
+ * non-blocking socket; any reply datagram means the service is up, an
+ * ICMP (port/host/net) unreachable surfaced as a socket error means it
+ * is down. Since many datagram services never answer probes they do
+ * not understand, a read timeout counts as success unless require_reply
+ * is configured. */
+
+#include "config.h"
+
+#include "check_udp.h"
+#include "check_api.h"
+#include "memory.h"
+#include "ipwrapper.h"
+#include "layer4.h"
+#include "logger.h"
+#include "smtp.h"
+#include "utils.h"
+#include "parser.h"
+#if !HAVE_DECL_SOCK_CLOEXEC
+#include "old_socket.h"
+#include "string.h"
+#endif
+
+static int udp_connect_thread(thread_t *);
+
+/* Configuration stream handling */
+static void
+free_udp_check(void *data)
+{
+	FREE(CHECKER_CO(data));
+	FREE(CHECKER_DATA(data));
+	FREE(data);
+}
+
+static void
+dump_udp_check(void *data)
+{
+	checker_t *checker = data;
+	udp_check_t *udp_check = checker->data;
+
+	log_message(LOG_INFO, "   Keepalive method = UDP_CHECK");
+	dump_checker_opts(checker);
+	log_message(LOG_INFO, "   Payload len = %zu", udp_check->payload_len);
+	log_message(LOG_INFO, "   Require reply = %s", udp_check->require_reply ? "yes" : "no");
+}
+
+static bool
+udp_check_compare(void *a, void *b)
+{
+	udp_check_t *old = CHECKER_DATA(a);
+	udp_check_t *new = CHECKER_DATA(b);
+
+	if (!compare_conn_opts(CHECKER_CO(a), CHECKER_CO(b)))
+		return false;
+	if (old->require_reply != new->require_reply)
+		return false;
+	if (old->payload_len != new->payload_len)
+		return false;
+	if (old->payload_len && memcmp(old->payload, new->payload, old->payload_len))
+		return false;
+
+	return true;
+}
+
+static void
+udp_check_handler(__attribute__((unused)) vector_t *strvec)
+{
+	udp_check_t *udp_check = (udp_check_t *) MALLOC(sizeof (udp_check_t));
+
+	/* queue new checker */
+	queue_checker(free_udp_check, dump_udp_check, udp_connect_thread,
+		      udp_check_compare, udp_check, CHECKER_NEW_CO());
+}
+
+static void
+udp_payload_handler(vector_t *strvec)
+{
+	udp_check_t *udp_check = CHECKER_GET();
+
+	udp_check->payload = CHECKER_VALUE_STRING(strvec);
+	udp_check->payload_len = strlen(udp_check->payload);
+}
+
+static void
+udp_require_reply_handler(__attribute__((unused)) vector_t *strvec)
+{
+	udp_check_t *udp_check = CHECKER_GET();
+
+	udp_check->require_reply = true;
+}
+
+static void
+udp_check_end_handler(void)
+{
+	if (!check_conn_opts(CHECKER_GET_CO())) {
+		dequeue_new_checker();
+	}
+}
+
+void
+install_udp_check_keyword(void)
+{
+	install_keyword("UDP_CHECK", &udp_check_handler);
+	install_sublevel();
+	install_checker_common_keywords(true);
+	install_keyword("payload", &udp_payload_handler);
+	install_keyword("require_reply", &udp_require_reply_handler);
+	install_sublevel_end_handler(udp_check_end_handler);
+	install_sublevel_end();
+}
+
+static void
+udp_epilog(thread_t * thread, bool is_success)
+{
+	checker_t *checker;
+	unsigned long delay;
+
+	checker = THREAD_ARG(thread);
+
+	if (is_success || checker->retry_it >= checker->retry) {
+		delay = checker_adjust_delay(checker, is_success);
+		checker->retry_it = 0;
+
+		if (is_success && !checker->is_up) {
+			log_message(LOG_INFO, "UDP check to %s success."
+					, FMT_UDP_RS(checker));
+			smtp_alert(checker, NULL, NULL,
+				   "UP",
+				   "=> UDP CHECK succeed on service <=");
+			update_svr_checker_state(UP, checker);
+		} else if (!is_success
+			   && checker->is_up) {
+			if (checker->retry)
+				log_message(LOG_INFO
+				    , "Check on service %s failed after %d retry."
+				    , FMT_UDP_RS(checker)
+				    , checker->retry);
+			smtp_alert(checker, NULL, NULL,
+				   "DOWN",
+				   "=> UDP CHECK failed on service <=");
+			update_svr_checker_state(DOWN, checker);
+		}
+	} else {
+		delay = checker->delay_before_retry;
+		++checker->retry_it;
+	}
+
+	/* Register next timer checker */
+	thread_add_timer(thread->master, udp_connect_thread, checker, delay);
+}
+
+static int
+udp_recv_thread(thread_t * thread)
+{
+	unsigned long timeout;
+	ssize_t ret;
+	char rbuf[UDP_BUFFER_SIZE];
+
+	checker_t *checker = THREAD_ARG(thread);
+	udp_check_t *udp_check = CHECKER_ARG(checker);
+
+	if (thread->type == THREAD_READ_TIMEOUT) {
+		/* No reply, but also no ICMP error. Unless the service is
+		 * expected to answer, silence means the port is open (or
+		 * the probe was filtered, which we cannot tell apart). */
+		close(thread->u.fd);
+		if (udp_check->require_reply && checker->is_up)
+			log_message(LOG_INFO, "UDP check to %s timeout."
+					, FMT_UDP_RS(checker));
+		udp_epilog(thread, !udp_check->require_reply);
+		return 0;
+	}
+
+	timeout = timer_long(thread->sands) - timer_long(time_now);
+
+	ret = recv(thread->u.fd, rbuf, sizeof (rbuf), 0);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			thread_add_read(thread->master, udp_recv_thread,
+					checker, thread->u.fd, timeout);
+			return 0;
+		}
+
+		/* An ICMP unreachable generated by the probe is reported
+		 * as an error on the connected socket */
+		if (checker->is_up)
+			log_message(LOG_INFO, "UDP check to %s failed (%s)."
+					, FMT_UDP_RS(checker), strerror(errno));
+		close(thread->u.fd);
+		udp_epilog(thread, false);
+		return 0;
+	}
+
+	/* Any reply datagram will do */
+	close(thread->u.fd);
+	udp_epilog(thread, true);
+
+	return 0;
+}
+
+static int
+udp_send_thread(thread_t * thread)
+{
+	unsigned long timeout;
+	ssize_t ret;
+
+	checker_t *checker = THREAD_ARG(thread);
+	udp_check_t *udp_check = CHECKER_ARG(checker);
+
+	if (thread->type == THREAD_WRITE_TIMEOUT) {
+		if (checker->is_up)
+			log_message(LOG_INFO, "UDP check to %s write timeout."
+					, FMT_UDP_RS(checker));
+		close(thread->u.fd);
+		udp_epilog(thread, false);
+		return 0;
+	}
+
+	timeout = timer_long(thread->sands) - timer_long(time_now);
+
+	/* An empty payload is still a valid probe - a closed port
+	 * answers it with an ICMP port unreachable */
+	ret = send(thread->u.fd, udp_check->payload, udp_check->payload_len, 0);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			thread_add_write(thread->master, udp_send_thread,
+					 checker, thread->u.fd, timeout);
+			return 0;
+		}
+		if (checker->is_up)
+			log_message(LOG_INFO, "UDP check to %s send failed (%s)."
+					, FMT_UDP_RS(checker), strerror(errno));
+		close(thread->u.fd);
+		udp_epilog(thread, false);
+		return 0;
+	}
+
+	if (ret != (ssize_t) udp_check->payload_len) {
+		if (checker->is_up)
+			log_message(LOG_INFO, "UDP check to %s short send."
+					, FMT_UDP_RS(checker));
+		close(thread->u.fd);
+		udp_epilog(thread, false);
+		return 0;
+	}
+
+	thread_add_read(thread->master, udp_recv_thread, checker, thread->u.fd,
+			timeout);
+
+	return 0;
+}
+
+static int
+udp_check_thread(thread_t * thread)
+{
+	int status;
+	unsigned long timeout;
+
+	checker_t *checker = THREAD_ARG(thread);
+
+	status = socket_state(thread, udp_check_thread);
+
+	/* If status = connect_in_progress, next thread is already registered.
+	 * If it is connect_success, the fd is still open.
+	 * Otherwise we have a real connection error or connection timeout.
+	 */
+	switch (status) {
+	case connect_in_progress:
+		break;
+	case connect_success:
+		timeout = timer_long(thread->sands) - timer_long(time_now);
+		thread_add_write(thread->master, udp_send_thread, checker,
+				 thread->u.fd, timeout);
+		break;
+	default:
+		/* socket_state() has already closed the fd */
+		if (checker->is_up)
+			log_message(LOG_INFO, "UDP connection to %s failed."
+					, FMT_UDP_RS(checker));
+		udp_epilog(thread, false);
+	}
+
+	return 0;
+}
+
+static int
+udp_connect_thread(thread_t * thread)
+{
+	checker_t *checker = THREAD_ARG(thread);
+	conn_opts_t *co = checker->co;
+	int fd;
+	int status;
+
+	/*
+	 * Register a new checker thread & return
+	 * if checker is disabled
+	 */
+	if (!checker->enabled) {
+		thread_add_timer(thread->master, udp_connect_thread, checker,
+				 checker->delay_loop);
+		return 0;
+	}
+
+	if ((fd = socket_netns(co->netns, co->dst.ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP)) == -1) {
+		log_message(LOG_INFO, "UDP check fail to create socket. Rescheduling.");
+		thread_add_timer(thread->master, udp_connect_thread, checker,
+				checker->delay_loop);
+
+		return 0;
+	}
+
+#if !HAVE_DECL_SOCK_CLOEXEC
+	if (set_sock_flags(fd, F_SETFD, FD_CLOEXEC))
+		log_message(LOG_INFO, "Unable to set CLOEXEC on udp_check socket - %s (%d)", strerror(errno), errno);
+#endif
+
+	status = socket_bind_connect(fd, co);
+
+	/* handle connection status & register check worker thread */
+	if (socket_connection_state(fd, status, thread, udp_check_thread, co)) {
+		close(fd);
+		log_message(LOG_INFO, "UDP socket bind failed. Rescheduling.");
+		thread_add_timer(thread->master, udp_connect_thread, checker,
+				checker->delay_loop);
+	}
+
+	return 0;
+}
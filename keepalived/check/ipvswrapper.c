@@ -30,6 +30,7 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 
 #ifndef O_CLOEXEC	/* Since Linux 2.6.23 and glibc 2.7 */
 #define O_CLOEXEC 0	/* It doesn't really matter if O_CLOEXEC isn't set here */
@@ -40,9 +41,18 @@
 #include "utils.h"
 #include "memory.h"
 #include "logger.h"
+#include "global_data.h"
+#include "hashtab.h"
+#include "signals.h"
 
 static bool no_ipvs = false;
 
+#ifdef _WITH_SNMP_CHECKER_
+/* Bumped on every modifying IPVS command, so the stats snapshot knows
+ * the kernel state it mirrors has changed */
+static unsigned ipvs_generation;
+#endif
+
 /*
  * Utility functions coming from Wensong code
  */
@@ -104,6 +114,9 @@ modprobe_ipvs(void)
 		flush_log_file();
 
 	if (!(child = fork())) {
+		/* Restore the standard dispositions and signal mask -
+		 * the signals we handle are blocked for the signalfd */
+		signal_handler_script();
 		execv(argv[0], argv);
 		exit(1);
 	}
@@ -240,10 +253,21 @@ ipvs_talk(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, ipvs_daemon_t *dae
 			result = 0;
 		log_message(LOG_INFO, "IPVS (cmd %d, errno %d): %s", cmd, errno, ipvs_strerror(errno));
 	}
+
+#ifdef _WITH_SNMP_CHECKER_
+	ipvs_generation++;
+#endif
+
 	return result;
 }
 
 #ifdef _WITH_VRRP_
+/* Sync daemon bookkeeping, published on the VRRP stats page once the
+ * page exists. Kept local until then so early daemon commands are not
+ * lost. */
+static ipvs_syncd_stats_t ipvs_syncd_stats_local;
+static ipvs_syncd_stats_t *ipvs_syncd_stats = &ipvs_syncd_stats_local;
+
 /* Note: This function is called in the context of the vrrp child process, not the checker process */
 void
 ipvs_syncd_cmd(int cmd, const struct lvs_syncd_config *config, int state, bool ignore_interface, bool ignore_error)
@@ -252,6 +276,18 @@ ipvs_syncd_cmd(int cmd, const struct lvs_syncd_config *config, int state, bool i
 
 	memset(&daemonrule, 0, sizeof(ipvs_daemon_t));
 
+	if (cmd == IPVS_STARTDAEMON) {
+		ipvs_syncd_stats->state = (uint32_t)state;
+		ipvs_syncd_stats->syncid = config ? (uint32_t)config->syncid : 0;
+		ipvs_syncd_stats->starts++;
+		ipvs_syncd_stats->last_change = (uint64_t)time(NULL);
+	} else if (cmd == IPVS_STOPDAEMON) {
+		if (ipvs_syncd_stats->state == (uint32_t)state)
+			ipvs_syncd_stats->state = 0;
+		ipvs_syncd_stats->stops++;
+		ipvs_syncd_stats->last_change = (uint64_t)time(NULL);
+	}
+
 	/* prepare user rule */
 	daemonrule.state = state;
 	if (config) {
@@ -289,28 +325,20 @@ ipvs_flush_cmd(void)
 	ipvs_talk(IP_VS_SO_SET_FLUSH, NULL, NULL, NULL, false);
 }
 
-/* IPVS group range rule */
+/* IPVS group entry rule. The entry's addresses were expanded once at
+ * config load, so this just walks the flat array - a single address
+ * unless the entry is a range. */
 static int
 ipvs_group_range_cmd(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, virtual_server_group_entry_t *vsg_entry)
 {
 	uint32_t i;
 
-	/* Set address and port */
-	if (vsg_entry->addr.ss_family == AF_INET6)
-		inet_sockaddrip6(&vsg_entry->addr, &srule->nf_addr.in6);
-	else
-		srule->nf_addr.ip = inet_sockaddrip4(&vsg_entry->addr);
+	for (i = 0; i < vsg_entry->exp_count; i++) {
+		srule->nf_addr = vsg_entry->exp_addr[i];
 
-	/* Process the whole range */
-	for (i = 0; i <= vsg_entry->range; i++) {
 		/* Talk to the IPVS channel */
 		if (ipvs_talk(cmd, srule, drule, NULL, false))
 			return -1;
-
-		if (srule->af == AF_INET)
-			srule->nf_addr.ip += htonl(1);
-		else
-			srule->nf_addr.in6.s6_addr16[7] = htons(ntohs(srule->nf_addr.in6.s6_addr16[7]) + 1);
 	}
 
 	return 0;
@@ -419,19 +447,9 @@ ipvs_group_cmd(int cmd, ipvs_service_t *srule, ipvs_dest_t *drule, virtual_serve
 		if (ipvs_change_needed(cmd, vsg_entry, vs, rs)) {
 			srule->user.port = inet_sockaddrport(&vsg_entry->addr);
 
-			if (vsg_entry->range) {
-				if (ipvs_group_range_cmd(cmd, srule, drule, vsg_entry))
-					return -1;
-			} else {
-				if (vsg_entry->addr.ss_family == AF_INET6)
-					inet_sockaddrip6(&vsg_entry->addr, &srule->nf_addr.in6);
-				else
-					srule->nf_addr.ip = inet_sockaddrip4(&vsg_entry->addr);
-
-				/* Talk to the IPVS channel */
-				if (ipvs_talk(cmd, srule, drule, NULL, false))
-					return -1;
-			}
+			if (ipvs_group_range_cmd(cmd, srule, drule, vsg_entry))
+				return -1;
+
 			ipvs_set_vsge_alive_state(cmd, vsg_entry, vs);
 		}
 	}
@@ -505,6 +523,33 @@ ipvs_set_drule(int cmd, ipvs_dest_t *drule, real_server_t * rs)
 	drule->user.l_threshold = rs->l_threshold;
 }
 
+/* Group multiple ipvs_cmd() calls into one kernel exchange. Errors of
+ * batched commands are reported by ipvs_batch_end(). A no-op with the
+ * setsockopt interface, which has no batching support. */
+void
+ipvs_batch_begin(void)
+{
+#if defined LIBIPVS_USE_NL && defined _HAVE_LIBNL3_
+	if (no_ipvs)
+		return;
+
+	ipvs_nl_batch_begin();
+#endif
+}
+
+int
+ipvs_batch_end(void)
+{
+#if defined LIBIPVS_USE_NL && defined _HAVE_LIBNL3_
+	if (no_ipvs)
+		return 0;
+
+	return ipvs_nl_batch_end();
+#else
+	return 0;
+#endif
+}
+
 /* Set/Remove a RS from a VS */
 int
 ipvs_cmd(int cmd, virtual_server_t *vs, real_server_t *rs)
@@ -577,21 +622,11 @@ ipvs_group_sync_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge)
 			drule.user.weight = rs->inhibit && !rs->alive ? 0 : rs->weight;
 
 			/* Set vs rule */
-			if (vsge->range)
-				ipvs_group_range_cmd(IP_VS_SO_SET_ADDDEST, &srule, &drule, vsge);
-			else {
-				if (vsge->vfwmark)
-					srule.user.fwmark = vsge->vfwmark;
-				else {
-					if (vsge->addr.ss_family == AF_INET6)
-						inet_sockaddrip6(&vsge->addr, &srule.nf_addr.in6);
-					else
-						srule.nf_addr.ip = inet_sockaddrip4(&vsge->addr);
-				}
-
-				/* Talk to the IPVS channel */
+			if (vsge->vfwmark) {
+				srule.user.fwmark = vsge->vfwmark;
 				ipvs_talk(IP_VS_SO_SET_ADDDEST, &srule, &drule, NULL, false);
-			}
+			} else
+				ipvs_group_range_cmd(IP_VS_SO_SET_ADDDEST, &srule, &drule, vsge);
 		}
 	}
 }
@@ -619,33 +654,23 @@ ipvs_group_remove_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge
 			ipvs_set_drule(IP_VS_SO_SET_DELDEST, &drule, rs);
 
 			/* Set vs rule */
-			if (vsge->range)
-				ipvs_group_range_cmd(IP_VS_SO_SET_DELDEST, &srule, &drule, vsge);
-			else {
-				if (vsge->vfwmark)
-					srule.user.fwmark = vsge->vfwmark;
-				else {
-					if (vsge->addr.ss_family == AF_INET6)
-						inet_sockaddrip6(&vsge->addr, &srule.nf_addr.in6);
-					else
-						srule.nf_addr.ip = inet_sockaddrip4(&vsge->addr);
-				}
-
-				/* Talk to the IPVS channel */
+			if (vsge->vfwmark) {
+				srule.user.fwmark = vsge->vfwmark;
 				ipvs_talk(IP_VS_SO_SET_DELDEST, &srule, &drule, NULL, false);
-			}
+			} else
+				ipvs_group_range_cmd(IP_VS_SO_SET_DELDEST, &srule, &drule, vsge);
 		}
 	}
 
 	/* Remove VS entry */
-	if (vsge->range)
-		ipvs_group_range_cmd(IP_VS_SO_SET_DEL, &srule, NULL, vsge);
-	else
+	if (vsge->vfwmark) {
+		srule.user.fwmark = vsge->vfwmark;
 		ipvs_talk(IP_VS_SO_SET_DEL, &srule, NULL, NULL, false);
+	} else
+		ipvs_group_range_cmd(IP_VS_SO_SET_DEL, &srule, NULL, vsge);
 	unset_vsge_alive(vsge,vs);
 }
 
-#ifdef _WITH_SNMP_CHECKER_
 static inline bool
 vsd_equal(real_server_t *rs, struct ip_vs_dest_entry_app *entry)
 {
@@ -667,6 +692,251 @@ vsd_equal(real_server_t *rs, struct ip_vs_dest_entry_app *entry)
 	return true;
 }
 
+/* Bulk IPVS state dumps. ipvs_state_dump_load() fetches every service
+ * with one IPVS_CMD_GET_SERVICE netlink dump (plus one GET_DEST dump
+ * per service) and indexes the result by service identity, so callers
+ * can interrogate the kernel state from memory. The 64 bit index keys
+ * are verified with a full compare, so a key collision only causes a
+ * fallback to scanning the dump, never a wrong match. Used by the SNMP
+ * stats snapshot and by the startup reconciliation below. */
+typedef struct ipvs_state_dump {
+	struct ip_vs_get_services_app *services;
+	struct ip_vs_get_dests_app **dests;
+	hashtab_t index;
+	bool collision;
+	bool loaded;
+} ipvs_state_dump_t;
+
+static uint64_t
+ipvs_snap_key(uint16_t af, uint16_t protocol, uint32_t fwmark, const union nf_inet_addr *nfaddr, uint16_t port)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const unsigned char *p;
+	size_t len;
+
+	if (fwmark)
+		h ^= fwmark;
+	else {
+		p = (af == AF_INET6) ? (const unsigned char *)&nfaddr->in6 : (const unsigned char *)&nfaddr->ip;
+		len = (af == AF_INET6) ? sizeof(nfaddr->in6) : sizeof(nfaddr->ip);
+		while (len--) {
+			h ^= *p++;
+			h *= 0x100000001b3ULL;
+		}
+		h ^= (uint64_t)protocol << 16 | port;
+	}
+	h ^= (uint64_t)af << 48;
+	h *= 0x100000001b3ULL;
+
+	return h;
+}
+
+static bool
+ipvs_snap_entry_eq(ipvs_service_entry_t *svc, uint16_t af, uint16_t protocol, uint32_t fwmark, union nf_inet_addr *nfaddr, uint16_t port)
+{
+	if (svc->af != af)
+		return false;
+
+	if (fwmark || svc->user.fwmark)
+		return svc->user.fwmark == fwmark;
+
+	return svc->user.protocol == protocol &&
+	       svc->user.port == port &&
+	       inaddr_equal(af, &svc->nf_addr,
+			    af == AF_INET6 ? (void *)&nfaddr->in6 : (void *)&nfaddr->ip);
+}
+
+static void
+ipvs_state_dump_free(ipvs_state_dump_t *d)
+{
+	unsigned i;
+
+	if (!d->loaded)
+		return;
+
+	for (i = 0; i < d->services->user.num_services; i++) {
+		if (d->dests[i])
+			FREE(d->dests[i]);
+	}
+	FREE(d->dests);
+	d->dests = NULL;
+	FREE(d->services);
+	d->services = NULL;
+	htab_destroy(&d->index);
+	d->collision = false;
+	d->loaded = false;
+}
+
+static bool
+ipvs_state_dump_load(ipvs_state_dump_t *d)
+{
+	ipvs_service_entry_t *svc;
+	unsigned num, i;
+
+	/* The bulk dump is unavailable on the old compat socket interface */
+	if (!(d->services = ipvs_get_services()))
+		return false;
+
+	num = d->services->user.num_services;
+	if (!(d->dests = MALLOC((num ? num : 1) * sizeof(*d->dests)))) {
+		FREE(d->services);
+		d->services = NULL;
+		return false;
+	}
+
+	htab_init(&d->index, num);
+	for (i = 0; i < num; i++) {
+		svc = &d->services->user.entrytable[i];
+		d->dests[i] = ipvs_get_dests(svc);
+		if (!htab_insert(&d->index,
+				 ipvs_snap_key(svc->af, svc->user.protocol, svc->user.fwmark, &svc->nf_addr, svc->user.port),
+				 (void *)(uintptr_t)(i + 1)))
+			d->collision = true;
+	}
+
+	d->loaded = true;
+	return true;
+}
+
+static ipvs_service_entry_t *
+ipvs_state_dump_lookup(ipvs_state_dump_t *d, uint16_t af, uint16_t protocol, uint32_t fwmark, union nf_inet_addr *nfaddr, uint16_t port, struct ip_vs_get_dests_app **dests)
+{
+	ipvs_service_entry_t *svc;
+	unsigned i;
+	uintptr_t idx;
+
+	idx = (uintptr_t)htab_find(&d->index, ipvs_snap_key(af, protocol, fwmark, nfaddr, port));
+	if (idx) {
+		svc = &d->services->user.entrytable[idx - 1];
+		if (ipvs_snap_entry_eq(svc, af, protocol, fwmark, nfaddr, port)) {
+			if (dests)
+				*dests = d->dests[idx - 1];
+			return svc;
+		}
+	}
+
+	/* A key collision dropped an entry from the index */
+	if (d->collision) {
+		for (i = 0; i < d->services->user.num_services; i++) {
+			svc = &d->services->user.entrytable[i];
+			if (ipvs_snap_entry_eq(svc, af, protocol, fwmark, nfaddr, port)) {
+				if (dests)
+					*dests = d->dests[i];
+				return svc;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Startup reconciliation. The initial rule load used to add every
+ * configured service and destination blindly, costing one EEXIST
+ * destined round trip per rule the kernel already had (e.g. after an
+ * unclean restart). The kernel state is dumped once before the load
+ * and freed afterwards; while loaded, these existence checks let the
+ * callers skip commands the kernel does not need. Virtual server
+ * groups expand to several kernel services and are still added
+ * blindly. */
+static ipvs_state_dump_t kernel_state;
+
+void
+ipvs_kernel_state_load(void)
+{
+	ipvs_state_dump_load(&kernel_state);
+}
+
+void
+ipvs_kernel_state_free(void)
+{
+	ipvs_state_dump_free(&kernel_state);
+}
+
+static ipvs_service_entry_t *
+ipvs_kernel_vs_lookup(virtual_server_t *vs, struct ip_vs_get_dests_app **dests)
+{
+	union nf_inet_addr nfaddr;
+	uint16_t port = 0;
+
+	memset(&nfaddr, 0, sizeof(nfaddr));
+	if (!vs->vfwmark) {
+		if (vs->af == AF_INET6)
+			inet_sockaddrip6(&vs->addr, &nfaddr.in6);
+		else
+			nfaddr.ip = inet_sockaddrip4(&vs->addr);
+		port = inet_sockaddrport(&vs->addr);
+	}
+
+	return ipvs_state_dump_lookup(&kernel_state, vs->af, vs->service_type, vs->vfwmark, &nfaddr, port, dests);
+}
+
+bool
+ipvs_kernel_vs_exists(virtual_server_t *vs)
+{
+	if (!kernel_state.loaded || vs->vsgname)
+		return false;
+
+	return !!ipvs_kernel_vs_lookup(vs, NULL);
+}
+
+bool
+ipvs_kernel_rs_exists(virtual_server_t *vs, real_server_t *rs)
+{
+	struct ip_vs_get_dests_app *dests = NULL;
+	ipvs_dest_entry_t *entry;
+	unsigned i;
+
+	if (!kernel_state.loaded || vs->vsgname)
+		return false;
+
+	if (!ipvs_kernel_vs_lookup(vs, &dests) || !dests)
+		return false;
+
+	/* Index through a pointer - subscripting the zero length
+	 * entrytable[] member directly trips -Wzero-length-bounds */
+	entry = dests->user.entrytable;
+	for (i = 0; i < dests->user.num_dests; i++) {
+		if (vsd_equal(rs, &entry[i]))
+			return true;
+	}
+
+	return false;
+}
+
+#ifdef _WITH_SNMP_CHECKER_
+/* IPVS stats snapshot. The SNMP virtualServerTable handlers used to
+ * query the kernel once per service inspected, so one snmpwalk over a
+ * large configuration could cost thousands of netlink round trips.
+ * The stats readers are served from a state dump instead, refreshed
+ * once it is older than the refresh interval, or earlier when the
+ * generation counter shows IPVS has been modified since it was
+ * taken. */
+static ipvs_state_dump_t snap;
+static time_t snap_time;
+static unsigned snap_generation;
+
+static unsigned
+ipvs_stats_refresh_interval(void)
+{
+	return global_data->lvs_stats_refresh_interval ? global_data->lvs_stats_refresh_interval : STATS_REFRESH;
+}
+
+static void
+ipvs_snapshot_refresh(void)
+{
+	time_t time_now = time(NULL);
+
+	if (snap.loaded && snap_generation == ipvs_generation &&
+	    time_now - snap_time < (time_t)ipvs_stats_refresh_interval())
+		return;
+
+	ipvs_state_dump_free(&snap);
+	snap_generation = ipvs_generation;
+	snap_time = time_now;
+
+	ipvs_state_dump_load(&snap);
+}
+
 static void
 ipvs_update_vs_stats(virtual_server_t *vs, uint32_t fwmark, union nf_inet_addr *nfaddr, uint16_t port)
 {
@@ -675,8 +945,12 @@ ipvs_update_vs_stats(virtual_server_t *vs, uint32_t fwmark, union nf_inet_addr *
 	real_server_t *rs;
 	unsigned int i;
 	ipvs_service_entry_t *serv;
+	bool cached = snap.loaded;
 
-	if (!(serv = ipvs_get_service(fwmark, vs->af, vs->service_type, nfaddr, port)))
+	if (cached) {
+		if (!(serv = ipvs_state_dump_lookup(&snap, vs->af, vs->service_type, fwmark, nfaddr, port, &dests)))
+			return;
+	} else if (!(serv = ipvs_get_service(fwmark, vs->af, vs->service_type, nfaddr, port)))
 		return;
 
 	/* Update virtual server stats */
@@ -692,8 +966,10 @@ ipvs_update_vs_stats(virtual_server_t *vs, uint32_t fwmark, union nf_inet_addr *
 	vs->stats.outbps	+= serv->stats.outbps;
 
 	/* Get real servers */
-	dests = ipvs_get_dests(serv);
-	FREE(serv);
+	if (!cached) {
+		dests = ipvs_get_dests(serv);
+		FREE(serv);
+	}
 	if (!dests)
 		return;
 
@@ -728,7 +1004,8 @@ ipvs_update_vs_stats(virtual_server_t *vs, uint32_t fwmark, union nf_inet_addr *
 			rs->stats.outbps	+= dests->user.entrytable[i].stats.outbps;
 		}
 	}
-	FREE(dests);
+	if (!cached)
+		FREE(dests);
 }
 
 /* Update statistics for a given virtual server. This includes
@@ -746,10 +1023,12 @@ ipvs_update_stats(virtual_server_t *vs)
 	real_server_t *rs;
 	time_t time_now = time(NULL);
 
-	if (time_now - vs->lastupdated < STATS_REFRESH)
+	if (time_now - vs->lastupdated < (time_t)ipvs_stats_refresh_interval())
 		return;
 	vs->lastupdated = time_now;
 
+	ipvs_snapshot_refresh();
+
 	/* Reset stats */
 	memset(&vs->stats, 0, sizeof(vs->stats));
 	if (vs->s_svr) {
@@ -771,21 +1050,9 @@ ipvs_update_stats(virtual_server_t *vs)
 		}
 		for (ge = LIST_HEAD(vs->vsg->addr_range); ge; ELEMENT_NEXT(ge)) {
 			vsg_entry = ELEMENT_DATA(ge);
-			addr_ip = (vsg_entry->addr.ss_family == AF_INET6) ?
-				    ntohs(((struct sockaddr_in6 *)&vsg_entry->addr)->sin6_addr.s6_addr16[7]) :
-				    ntohl(((struct sockaddr_in *)&vsg_entry->addr)->sin_addr.s_addr);
-			if (vsg_entry->addr.ss_family == AF_INET6)
-				inet_sockaddrip6(&vsg_entry->addr, &nfaddr.in6);
-
 			port = inet_sockaddrport(&vsg_entry->addr);
-			for (i = 0; i <= vsg_entry->range; i++, addr_ip++) {
-				if (vsg_entry->addr.ss_family == AF_INET6)
-					nfaddr.in6.s6_addr16[7] = htons(addr_ip);
-				else
-					nfaddr.ip = htonl(addr_ip);
-
-				ipvs_update_vs_stats(vs, 0, &nfaddr, port);
-			}
+			for (i = 0; i < vsg_entry->exp_count; i++)
+				ipvs_update_vs_stats(vs, 0, &vsg_entry->exp_addr[i], port);
 		}
 	} else if (vs->vfwmark) {
 		memset(&nfaddr, 0, sizeof(nfaddr));
@@ -819,4 +1086,80 @@ ipvs_syncd_backup(const struct lvs_syncd_config *config)
 	ipvs_syncd_cmd(IPVS_STOPDAEMON, config, IPVS_MASTER, false, false);
 	ipvs_syncd_cmd(IPVS_STARTDAEMON, config, IPVS_BACKUP, false, false);
 }
+
+/* Move the sync daemon bookkeeping onto the given stats page, so a
+ * monitoring agent reading the page sees which daemon runs alongside
+ * the per-instance VRRP counters. Safe to call again after a reload. */
+void
+ipvs_syncd_publish_stats(stats_page_t *page)
+{
+	ipvs_syncd_stats_t *rec;
+	bool existing;
+
+	if (stats_page_contains(page, ipvs_syncd_stats))
+		return;
+
+	rec = stats_page_record(page, "# ipvs sync", &existing);
+	if (!rec)
+		return;
+
+	if (!existing)
+		*rec = *ipvs_syncd_stats;
+	ipvs_syncd_stats = rec;
+}
+
+/* Pre-failover sync tightening. While the master sync daemon is
+ * running, net.ipv4.vs.sync_refresh_period rate-limits how often a
+ * long-lived connection's state is re-announced; when mastership looks
+ * about to move (effective priority degraded below the configured one)
+ * drop it to 0 so every connection update goes out immediately and the
+ * backup's table is current at takeover. The previous value is
+ * restored once the instance is stable again or mastership is gone. */
+#define IPVS_SYNC_REFRESH_PERIOD_PATH	"/proc/sys/net/ipv4/vs/sync_refresh_period"
+
+static int ipvs_sync_refresh_saved = -1;	/* -1 = not tightened */
+
+void
+ipvs_syncd_tighten(void)
+{
+	FILE *fp;
+	int val;
+
+	if (ipvs_sync_refresh_saved >= 0)
+		return;
+
+	if (!(fp = fopen(IPVS_SYNC_REFRESH_PERIOD_PATH, "r+")))
+		return;
+
+	if (fscanf(fp, "%d", &val) != 1 || !val) {
+		/* Already syncing every update */
+		fclose(fp);
+		return;
+	}
+
+	rewind(fp);
+	if (fprintf(fp, "0\n") > 0) {
+		ipvs_sync_refresh_saved = val;
+		ipvs_syncd_stats->tightenings++;
+		log_message(LOG_INFO, "IPVS: tightened sync_refresh_period %d -> 0 for pending failover", val);
+	}
+	fclose(fp);
+}
+
+void
+ipvs_syncd_relax(void)
+{
+	FILE *fp;
+
+	if (ipvs_sync_refresh_saved < 0)
+		return;
+
+	if (!(fp = fopen(IPVS_SYNC_REFRESH_PERIOD_PATH, "w")))
+		return;
+
+	if (fprintf(fp, "%d\n", ipvs_sync_refresh_saved) > 0)
+		log_message(LOG_INFO, "IPVS: restored sync_refresh_period %d", ipvs_sync_refresh_saved);
+	ipvs_sync_refresh_saved = -1;
+	fclose(fp);
+}
 #endif
@@ -25,8 +25,10 @@
 #include "ipwrapper.h"
 #include "ipvswrapper.h"
 #include "check_api.h"
+#include "check_daemon.h"
 #include "logger.h"
 #include "memory.h"
+#include "hashtab.h"
 #include "utils.h"
 #include "notify.h"
 #include "main.h"
@@ -34,6 +36,7 @@
   #include "check_snmp.h"
 #endif
 #include "global_data.h"
+#include "trace.h"
 
 /* Returns the sum of all alive RS weight in a virtual server. */
 static long
@@ -51,6 +54,48 @@ weigh_live_realservers(virtual_server_t * vs)
 	return count;
 }
 
+/* Quorum evaluation uses an incrementally maintained sum of the alive
+ * RS weights instead of rescanning the whole RS pool on every server
+ * transition. The accumulator is adjusted wherever an RS alive flag or
+ * weight changes, and every LIVE_WEIGHT_AUDIT_INTERVAL evaluations it
+ * is checked against a full re-sum as a consistency audit. */
+#define LIVE_WEIGHT_AUDIT_INTERVAL	64
+
+static long
+vs_live_weight(virtual_server_t *vs)
+{
+	long weight_sum;
+
+	if (++vs->live_weight_checks < LIVE_WEIGHT_AUDIT_INTERVAL)
+		return vs->live_weight;
+
+	vs->live_weight_checks = 0;
+	weight_sum = weigh_live_realservers(vs);
+	if (weight_sum != vs->live_weight) {
+		log_message(LOG_INFO, "Live weight %ld of VS %s does not match sum %ld of alive RS weights - resyncing"
+				    , vs->live_weight
+				    , FMT_VS(vs)
+				    , weight_sum);
+		vs->live_weight = weight_sum;
+	}
+
+	return vs->live_weight;
+}
+
+/* All RS alive state changes must go through here so the live weight
+ * accumulator stays consistent. The sorry server is never counted. */
+static void
+rs_set_alive(virtual_server_t *vs, real_server_t *rs, bool alive)
+{
+	if (rs->alive == alive)
+		return;
+
+	rs->alive = alive;
+	vs->live_weight += alive ? rs->weight : -rs->weight;
+	rs->generation++;
+	vs->generation++;
+}
+
 static void
 notify_fifo_vs(virtual_server_t* vs, bool is_up)
 {
@@ -71,12 +116,8 @@ notify_fifo_vs(virtual_server_t* vs, bool is_up)
 
 	snprintf(line, size, "VS %s %s\n", vs_str, state);
 
-	if (global_data->notify_fifo.fd != -1) {
-		if (write(global_data->notify_fifo.fd, line, size - 1) == -1) {}
-	}
-	if (global_data->lvs_notify_fifo.fd != -1) {
-		if (write(global_data->lvs_notify_fifo.fd, line, size - 1) == -1) {}
-	}
+	notify_fifo_write(&global_data->notify_fifo, line, size - 1);
+	notify_fifo_write(&global_data->lvs_notify_fifo, line, size - 1);
 
 	FREE(line);
 }
@@ -107,12 +148,8 @@ notify_fifo_rs(virtual_server_t* vs, real_server_t* rs, bool is_up)
 	snprintf(line, size, "RS %s %s %s\n", rs_str, vs_str, state);
 	FREE(rs_str);
 
-	if (global_data->notify_fifo.fd != -1) {
-		if (write(global_data->notify_fifo.fd, line, size - 1) == - 1) {}
-	}
-	if (global_data->lvs_notify_fifo.fd != -1) {
-		if (write(global_data->lvs_notify_fifo.fd, line, size - 1) == -1) {}
-	}
+	notify_fifo_write(&global_data->notify_fifo, line, size - 1);
+	notify_fifo_write(&global_data->lvs_notify_fifo, line, size - 1);
 
 	FREE(line);
 }
@@ -136,7 +173,7 @@ clear_service_rs(virtual_server_t * vs, list l)
 					, FMT_RS(rs, vs)
 					, FMT_VS(vs));
 		ipvs_cmd(LVS_CMD_DEL_DEST, vs, rs);
-		UNSET_ALIVE(rs);
+		rs_set_alive(vs, rs, false);
 		if (!vs->omega)
 			continue;
 
@@ -148,7 +185,7 @@ clear_service_rs(virtual_server_t * vs, list l)
 					    , rs->notify_down->name
 					    , FMT_RS(rs, vs)
 					    , FMT_VS(vs));
-			notify_exec(rs->notify_down);
+			notify_exec(rs->notify_down, rs);
 		}
 		notify_fifo_rs(vs, rs, false);
 #ifdef _WITH_SNMP_CHECKER_
@@ -159,7 +196,7 @@ clear_service_rs(virtual_server_t * vs, list l)
 		 * we don't push in a sorry server then, hence the regression
 		 * is intended.
 		 */
-		weight_sum = weigh_live_realservers(vs);
+		weight_sum = vs_live_weight(vs);
 		if (vs->quorum_state_up &&
 		    (!weight_sum || weight_sum < down_threshold)) {
 			vs->quorum_state_up = false;
@@ -167,7 +204,7 @@ clear_service_rs(virtual_server_t * vs, list l)
 				log_message(LOG_INFO, "Executing [%s] for VS %s"
 						    , vs->notify_quorum_down->name
 						    , FMT_VS(vs));
-				notify_exec(vs->notify_quorum_down);
+				notify_exec(vs->notify_quorum_down, vs);
 			}
 			notify_fifo_vs(vs, false);
 #ifdef _WITH_SNMP_CHECKER_
@@ -239,9 +276,14 @@ init_service_rs(virtual_server_t * vs)
 		 */
 		if ((!rs->num_failed_checkers && !ISALIVE(rs)) ||
 		    (rs->inhibit && !rs->set)) {
-			ipvs_cmd(LVS_CMD_ADD_DEST, vs, rs);
+			/* If the dest survived in the kernel (e.g. the daemon was
+			 * restarted), adopt it rather than re-adding it. */
+			if (ipvs_kernel_rs_exists(vs, rs))
+				rs->set = true;
+			else
+				ipvs_cmd(LVS_CMD_ADD_DEST, vs, rs);
 			if (!rs->num_failed_checkers)
-				SET_ALIVE(rs);
+				rs_set_alive(vs, rs, true);
 		}
 	}
 
@@ -290,6 +332,7 @@ perform_quorum_state(virtual_server_t *vs, bool add)
 	log_message(LOG_INFO, "%s the pool for VS %s"
 			    , add?"Adding alive servers to":"Removing alive servers from"
 			    , FMT_VS(vs));
+	ipvs_batch_begin();
 	for (e = LIST_HEAD(vs->rs); e; ELEMENT_NEXT(e)) {
 		rs = ELEMENT_DATA(e);
 		if (!ISALIVE(rs)) /* We only handle alive servers */
@@ -300,6 +343,10 @@ perform_quorum_state(virtual_server_t *vs, bool add)
 		ipvs_cmd(add?LVS_CMD_ADD_DEST:LVS_CMD_DEL_DEST, vs, rs);
 		rs->alive = true;
 	}
+	if (ipvs_batch_end() < 0)
+		log_message(LOG_INFO, "IPVS error %s the pool for VS %s"
+				    , add?"adding alive servers to":"removing alive servers from"
+				    , FMT_VS(vs));
 }
 
 void
@@ -314,22 +361,71 @@ set_quorum_states(void)
 	for (e = LIST_HEAD(check_data->vs); e; ELEMENT_NEXT(e)) {
 		vs = ELEMENT_DATA(e);
 
-		vs->quorum_state_up = (weigh_live_realservers(vs) >= vs->quorum + vs->hysteresis);
+		/* This is the anchor point for the incremental live weight -
+		 * re-sum here so transitions only need to adjust the delta. */
+		vs->live_weight = weigh_live_realservers(vs);
+		vs->live_weight_checks = 0;
+		vs->quorum_state_up = (vs->live_weight >= vs->quorum + vs->hysteresis);
 	}
 }
 
+/* Sync catch-up gate. After a cold start the IPVS connection table is
+ * still being filled by the sync daemon; bringing a virtual server's
+ * quorum up before that completes turns the in-flight connections the
+ * table doesn't cover yet into resets. The kernel exposes no sync
+ * progress, so the gate is the configured catch-up window: quorum-up
+ * transitions inside it are parked and re-evaluated when it closes. */
+static timeval_t quorum_gate_until;
+
+static void update_quorum_state(virtual_server_t *, bool);
+
+void
+quorum_gate_arm(void)
+{
+	if (!global_data->lvs_sync_catchup_delay)
+		return;
+
+	quorum_gate_until = timer_add_long(timer_now(), global_data->lvs_sync_catchup_delay);
+	log_message(LOG_INFO, "Holding quorum-up for %lu sec while the connection sync catches up",
+		    global_data->lvs_sync_catchup_delay / TIMER_HZ);
+}
+
+static int
+quorum_gate_thread(thread_t *thread)
+{
+	virtual_server_t *vs = THREAD_ARG(thread);
+
+	vs->quorum_gate_pending = false;
+	update_quorum_state(vs, false);
+
+	return 0;
+}
+
 /* set quorum state depending on current weight of real servers */
 static void
 update_quorum_state(virtual_server_t * vs, bool init)
 {
-	long weight_sum = weigh_live_realservers(vs);
+	long weight_sum = vs_live_weight(vs);
 	long up_threshold = vs->quorum + vs->hysteresis;
 	long down_threshold = vs->quorum - vs->hysteresis;
 
 	/* If we have just gained quorum, it's time to consider notify_up. */
 	if (!vs->quorum_state_up &&
 	    weight_sum >= up_threshold) {
+		if (!timer_isnull(quorum_gate_until) &&
+		    timer_cmp(timer_now(), quorum_gate_until) < 0) {
+			if (!vs->quorum_gate_pending) {
+				vs->quorum_gate_pending = true;
+				log_message(LOG_INFO, "Deferring quorum-up for VS %s until sync catch-up completes",
+					    FMT_VS(vs));
+				thread_add_timer(master, quorum_gate_thread, vs,
+						 timer_long(timer_sub(quorum_gate_until, timer_now())));
+			}
+			return;
+		}
+
 		vs->quorum_state_up = true;
+		vs->generation++;
 		log_message(LOG_INFO, "Gained quorum %u+%u=%ld <= %ld for VS %s"
 				    , vs->quorum
 				    , vs->hysteresis
@@ -347,12 +443,13 @@ update_quorum_state(virtual_server_t * vs, bool init)
 
 			ipvs_cmd(LVS_CMD_DEL_DEST, vs, vs->s_svr);
 			vs->s_svr->alive = false;
+			vs->s_svr->generation++;
 		}
 		if (vs->notify_quorum_up) {
 			log_message(LOG_INFO, "Executing [%s] for VS %s"
 					    , vs->notify_quorum_up->name
 					    , FMT_VS(vs));
-			notify_exec(vs->notify_quorum_up);
+			notify_exec(vs->notify_quorum_up, vs);
 		}
 		notify_fifo_vs(vs, true);
 #ifdef _WITH_SNMP_CHECKER_
@@ -370,6 +467,7 @@ update_quorum_state(virtual_server_t * vs, bool init)
 		 * We are starting up and need to add the sorry server
 		 */
 		vs->quorum_state_up = false;
+		vs->generation++;
 		log_message(LOG_INFO, "%s %u-%u=%ld > %ld for VS %s"
 				    , init ? "Starting with quorum down" : "Lost quorum"
 				    , vs->quorum
@@ -387,6 +485,7 @@ update_quorum_state(virtual_server_t * vs, bool init)
 			/* the sorry server is now up in the pool, we flag it alive */
 			ipvs_cmd(LVS_CMD_ADD_DEST, vs, vs->s_svr);
 			vs->s_svr->alive = true;
+			vs->s_svr->generation++;
 
 			/* Remove remaining alive real servers */
 			perform_quorum_state(vs, false);
@@ -396,7 +495,7 @@ update_quorum_state(virtual_server_t * vs, bool init)
 			log_message(LOG_INFO, "Executing [%s] for VS %s"
 					    , vs->notify_quorum_down->name
 					    , FMT_VS(vs));
-			notify_exec(vs->notify_quorum_down);
+			notify_exec(vs->notify_quorum_down, vs);
 		}
 		notify_fifo_vs(vs, false);
 #ifdef _WITH_SNMP_CHECKER_
@@ -421,6 +520,10 @@ perform_svr_state(bool alive, virtual_server_t * vs, real_server_t * rs)
 	if (ISALIVE(rs) == alive)
 		return true;
 
+	/* Attach the servers to the log records of this transition */
+	log_set_context("VIRTUAL_SERVER", FMT_VS(vs));
+	log_set_context("REAL_SERVER", FMT_RS(rs, vs));
+
 	log_message(LOG_INFO, "%sing service %s to VS %s"
 			    , alive ? (rs->inhibit) ? "Enabl" : "Add" :
 				      (rs->inhibit) ? "Disabl" : "Remov"
@@ -429,17 +532,20 @@ perform_svr_state(bool alive, virtual_server_t * vs, real_server_t * rs)
 
 	/* Change only if we have quorum or no sorry server */
 	if (vs->quorum_state_up || !vs->s_svr || !ISALIVE(vs->s_svr)) {
-		if (ipvs_cmd(alive ? LVS_CMD_ADD_DEST : LVS_CMD_DEL_DEST, vs, rs))
+		if (ipvs_cmd(alive ? LVS_CMD_ADD_DEST : LVS_CMD_DEL_DEST, vs, rs)) {
+			log_set_context("VIRTUAL_SERVER", NULL);
+			log_set_context("REAL_SERVER", NULL);
 			return false;
+		}
 	}
-	rs->alive = alive;
+	rs_set_alive(vs, rs, alive);
 	notify_script = alive ? rs->notify_up : rs->notify_down;
 	if (notify_script) {
 		log_message(LOG_INFO, "Executing [%s] for service %s in VS %s"
 				    , notify_script->name
 				    , FMT_RS(rs, vs)
 				    , FMT_VS(vs));
-		notify_exec(notify_script);
+		notify_exec(notify_script, rs);
 	}
 	notify_fifo_rs(vs, rs, alive);
 #ifdef _WITH_SNMP_CHECKER_
@@ -450,6 +556,9 @@ perform_svr_state(bool alive, virtual_server_t * vs, real_server_t * rs)
 	 * but is now up, this is where the rs is added. */
 	update_quorum_state(vs, false);
 
+	log_set_context("VIRTUAL_SERVER", NULL);
+	log_set_context("REAL_SERVER", NULL);
+
 	return true;
 }
 
@@ -459,7 +568,8 @@ init_service_vs(virtual_server_t * vs)
 {
 	/* Init the VS root */
 	if (!ISALIVE(vs) || vs->vsgname) {
-		ipvs_cmd(LVS_CMD_ADD, vs, NULL);
+		if (!ipvs_kernel_vs_exists(vs))
+			ipvs_cmd(LVS_CMD_ADD, vs, NULL);
 		SET_ALIVE(vs);
 	}
 
@@ -487,11 +597,19 @@ init_services(void)
 	list l = check_data->vs;
 	virtual_server_t *vs;
 
+	/* Dump the current kernel state once so we only issue the
+	 * commands needed to converge on the configuration. */
+	ipvs_kernel_state_load();
+
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vs = ELEMENT_DATA(e);
-		if (!init_service_vs(vs))
+		if (!init_service_vs(vs)) {
+			ipvs_kernel_state_free();
 			return false;
+		}
 	}
+
+	ipvs_kernel_state_free();
 	return true;
 }
 
@@ -507,7 +625,11 @@ update_svr_wgt(int weight, virtual_server_t * vs, real_server_t * rs
 				    , ISALIVE(rs) ? "active" : "inactive"
 				    , FMT_RS(rs, vs)
 				    , FMT_VS(vs));
+		if (ISALIVE(rs))
+			vs->live_weight += weight - rs->weight;
 		rs->weight = weight;
+		rs->generation++;
+		vs->generation++;
 		/*
 		 * Have weight change take effect now only if rs is in
 		 * the pool and alive and the quorum is met (or if
@@ -522,13 +644,105 @@ update_svr_wgt(int weight, virtual_server_t * vs, real_server_t * rs
 	}
 }
 
+/* Dynamic weights fed back by checkers track noisy load metrics, and an
+ * oscillating backend can otherwise drive a kernel update per check.
+ * With weight_debounce configured, per-RS samples accumulate for the
+ * window (last sample wins) and are applied in one batch at flush,
+ * dropping net movements below the threshold as noise. Weight changes
+ * from the control socket and SNMP stay immediate. */
+typedef struct _pending_weight {
+	virtual_server_t	*vs;
+	real_server_t		*rs;
+	int			weight;
+} pending_weight_t;
+
+static list wgt_debounce_queue;			/* pending_weight_t - owns the entries */
+static hashtab_t wgt_debounce_htab;		/* rs pointer -> queued entry, for coalescing */
+
+static void
+free_pending_weight(void *data)
+{
+	FREE(data);
+}
+
+static int
+wgt_debounce_flush(__attribute__((unused)) thread_t *thread)
+{
+	element e;
+	pending_weight_t *pw;
+
+	for (e = LIST_HEAD(wgt_debounce_queue); e; ELEMENT_NEXT(e)) {
+		pw = ELEMENT_DATA(e);
+		if (abs(pw->weight - pw->rs->weight) >= global_data->weight_debounce_threshold)
+			update_svr_wgt(pw->weight, pw->vs, pw->rs, true);
+	}
+
+	free_list(&wgt_debounce_queue);
+	htab_destroy(&wgt_debounce_htab);
+
+	return 0;
+}
+
+void
+update_svr_wgt_lazy(int weight, virtual_server_t *vs, real_server_t *rs)
+{
+	pending_weight_t *pw;
+
+	if (!global_data->weight_debounce_window) {
+		update_svr_wgt(weight, vs, rs, true);
+		return;
+	}
+
+	/* A later sample for the same real server supersedes the
+	 * queued weight */
+	if ((pw = htab_find(&wgt_debounce_htab, (uint64_t)(uintptr_t)rs))) {
+		pw->weight = weight;
+		return;
+	}
+
+	if (LIST_ISEMPTY(wgt_debounce_queue)) {
+		if (!wgt_debounce_queue)
+			wgt_debounce_queue = alloc_list(free_pending_weight, NULL);
+		thread_add_timer(master, wgt_debounce_flush, NULL,
+				 global_data->weight_debounce_window);
+	}
+
+	pw = (pending_weight_t *) MALLOC(sizeof(pending_weight_t));
+	pw->vs = vs;
+	pw->rs = rs;
+	pw->weight = weight;
+	list_add(wgt_debounce_queue, pw);
+	htab_insert(&wgt_debounce_htab, (uint64_t)(uintptr_t)rs, pw);
+}
+
+void
+wgt_debounce_clear(void)
+{
+	/* Queued updates reference servers about to be freed */
+	free_list(&wgt_debounce_queue);
+	htab_destroy(&wgt_debounce_htab);
+}
+
 void
 set_checker_state(checker_t *checker, bool up)
 {
+	checker_hist_entry_t *ent;
+
 	if (checker->is_up == up)
 		return;
 
+	/* Flight-recorder slot for the flip */
+	ent = &checker->hist[checker->hist_head % CHECKER_HIST_ENTRIES];
+	ent->ts = (uint32_t)time_now.tv_sec;
+	ent->dwell = checker->hist_head ?
+		     ent->ts - checker->hist[(checker->hist_head - 1) % CHECKER_HIST_ENTRIES].ts : 0;
+	ent->up = up;
+	ent->retries = checker->retry_it > 255 ? 255 : (uint8_t)checker->retry_it;
+	checker->hist_head++;
+
 	checker->is_up = up;
+	if (checker->stats)
+		checker->stats->transitions++;
 
 	if (!up)
 		checker->rs->num_failed_checkers++;
@@ -540,9 +754,35 @@ set_checker_state(checker_t *checker, bool up)
 void
 update_svr_checker_state(bool alive, checker_t *checker)
 {
+	element e;
+
+	/* Fan a shared probe result out to the subscribed checkers */
+	if (!LIST_ISEMPTY(checker->probe_followers)) {
+		for (e = LIST_HEAD(checker->probe_followers); e; ELEMENT_NEXT(e))
+			update_svr_checker_state(alive, ELEMENT_DATA(e));
+	}
+
+	TRACE_PROBE3(checker_verdict, checker, checker->rs, alive);
+
+	if (checker->stats) {
+		if (alive)
+			checker->stats->up_verdicts++;
+		else
+			checker->stats->down_verdicts++;
+	}
+
 	if (checker->is_up == alive)
 		return;
 
+	/* A shard worker just tracks its local checker state and reports the
+	 * transition; the coordinator owns the IPVS and notification state
+	 * and applies the update against its copy of the checker. */
+	if (checker_shard_fd != -1) {
+		set_checker_state(checker, alive);
+		checker_shard_report(checker, alive);
+		return;
+	}
+
 	if (alive) {
 		/* call the UP handler unless any more failed checks found */
 		if (checker->rs->num_failed_checkers <= 1) {
@@ -619,6 +859,93 @@ clear_diff_vsg(virtual_server_t * old_vs, virtual_server_t * new_vs)
 	clear_diff_vsge(old->vfwmark, new->vfwmark, old_vs);
 }
 
+/* Reload-diff hash indexes. With tens of thousands of (vs,rs) pairs
+ * the nested linear scans made the reload diff phase quadratic; these
+ * indexes are built once per reload. The 64 bit keys are verified with
+ * the full compare macros, so a key collision only causes a fallback
+ * to the old linear scan, never a wrong match. */
+static uint64_t
+addr_hash_key(struct sockaddr_storage *addr)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const unsigned char *p;
+	size_t len;
+
+	if (addr->ss_family == AF_INET6) {
+		p = (const unsigned char *) &((struct sockaddr_in6 *) addr)->sin6_addr;
+		len = sizeof(struct in6_addr);
+	} else {
+		p = (const unsigned char *) &((struct sockaddr_in *) addr)->sin_addr;
+		len = sizeof(struct in_addr);
+	}
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	h ^= (uint64_t)addr->ss_family << 16 | inet_sockaddrport(addr);
+	h *= 0x100000001b3ULL;
+
+	return h;
+}
+
+static uint64_t
+vs_hash_key(virtual_server_t *vs)
+{
+	uint64_t h = addr_hash_key(&vs->addr);
+	const char *p;
+
+	h ^= (uint64_t)vs->vfwmark << 8 | vs->af;
+	h *= 0x100000001b3ULL;
+	for (p = vs->vsgname; p && *p; p++) {
+		h ^= (unsigned char)*p;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+/* Bucket the checkers by their real server, so the checker migration
+ * does not rescan the whole checkers queue for every real server */
+static void
+build_checker_index(hashtab_t *index, list checkers)
+{
+	element e;
+	checker_t *c;
+	list l;
+
+	htab_init(index, LIST_ISEMPTY(checkers) ? 0 : LIST_SIZE(checkers));
+
+	if (LIST_ISEMPTY(checkers))
+		return;
+
+	for (e = LIST_HEAD(checkers); e; ELEMENT_NEXT(e)) {
+		c = ELEMENT_DATA(e);
+		l = htab_find(index, (uint64_t)(uintptr_t)c->rs);
+		if (!l) {
+			l = alloc_list(NULL, NULL);
+			htab_insert(index, (uint64_t)(uintptr_t)c->rs, l);
+		}
+		list_add(l, c);
+	}
+}
+
+static void
+free_checker_index(hashtab_t *index)
+{
+	list l;
+	unsigned i;
+
+	/* nothing is ever deleted, so every non NULL slot is a live list */
+	for (i = 0; i < index->size; i++) {
+		if (index->vals[i]) {
+			l = index->vals[i];
+			free_list(&l);
+		}
+	}
+	htab_destroy(index);
+}
+
 /* Check if a vs exist in new data and returns pointer to it */
 static virtual_server_t*
 vs_exist(virtual_server_t * old_vs)
@@ -659,24 +986,20 @@ rs_exist(real_server_t * old_rs, list l)
 }
 
 static void
-migrate_checkers(real_server_t *old_rs, real_server_t *new_rs, list old_checkers_queue)
+migrate_checkers(virtual_server_t *new_vs, real_server_t *old_rs, real_server_t *new_rs,
+		 hashtab_t *old_checker_index, hashtab_t *new_checker_index)
 {
-	list l;
+	list l, new_l;
 	element e, e1;
 	checker_t *old_c, *new_c;
 
-	l = alloc_list(NULL, NULL);
-	for (e = LIST_HEAD(old_checkers_queue); e; ELEMENT_NEXT(e)) {
-		old_c = ELEMENT_DATA(e);
-		if (old_c->rs == old_rs) {
-			list_add(l, old_c);
-		}
-	}
+	l = htab_find(old_checker_index, (uint64_t)(uintptr_t)old_rs);
 
 	if (!LIST_ISEMPTY(l)) {
-		for (e = LIST_HEAD(checkers_queue); e; ELEMENT_NEXT(e)) {
+		new_l = htab_find(new_checker_index, (uint64_t)(uintptr_t)new_rs);
+		for (e = LIST_ISEMPTY(new_l) ? NULL : LIST_HEAD(new_l); e; ELEMENT_NEXT(e)) {
 			new_c = ELEMENT_DATA(e);
-			if (new_c->rs != new_rs || !new_c->compare)
+			if (!new_c->compare)
 				continue;
 			for (e1 = LIST_HEAD(l); e1; ELEMENT_NEXT(e1)) {
 				old_c = ELEMENT_DATA(e1);
@@ -690,29 +1013,42 @@ migrate_checkers(real_server_t *old_rs, real_server_t *new_rs, list old_checkers
 		}
 
 		if (!new_rs->num_failed_checkers)
-			SET_ALIVE(new_rs);
+			rs_set_alive(new_vs, new_rs, true);
 	}
-
-	free_list(&l);
 }
 
 /* Clear the diff rs of the old vs */
 static void
-clear_diff_rs(virtual_server_t *old_vs, virtual_server_t *new_vs, list old_checkers_queue)
+clear_diff_rs(virtual_server_t *old_vs, virtual_server_t *new_vs,
+	      hashtab_t *old_checker_index, hashtab_t *new_checker_index)
 {
 	element e;
 	list l = old_vs->rs;
 	real_server_t *rs, *new_rs;
+	hashtab_t new_rs_index;
+	bool rs_key_collision = false;
 
 	/* If old vs didn't own rs then nothing return */
 	if (LIST_ISEMPTY(l))
 		return;
 
+	/* Index the new rs pool by address */
+	htab_init(&new_rs_index, LIST_ISEMPTY(new_vs->rs) ? 0 : LIST_SIZE(new_vs->rs));
+	for (e = LIST_ISEMPTY(new_vs->rs) ? NULL : LIST_HEAD(new_vs->rs); e; ELEMENT_NEXT(e)) {
+		rs = ELEMENT_DATA(e);
+		if (!htab_insert(&new_rs_index, addr_hash_key(&rs->addr), rs))
+			rs_key_collision = true;
+	}
+
 	/* remove RS from old vs which are not found in new vs */
 	list rs_to_remove = alloc_list (NULL, NULL);
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		rs = ELEMENT_DATA(e);
-		new_rs = rs_exist(rs, new_vs->rs);
+		new_rs = htab_find(&new_rs_index, addr_hash_key(&rs->addr));
+		if (new_rs && !RS_ISEQ(new_rs, rs))
+			new_rs = NULL;
+		if (!new_rs && rs_key_collision)
+			new_rs = rs_exist(rs, new_vs->rs);
 		if (!new_rs) {
 			log_message(LOG_INFO, "service %s no longer exist"
 					    , FMT_RS(rs, old_vs));
@@ -720,7 +1056,7 @@ clear_diff_rs(virtual_server_t *old_vs, virtual_server_t *new_vs, list old_check
 			/* Reset inhibit flag to delete inhibit entries */
 			if (rs->inhibit) {
 				if (!ISALIVE(rs) && rs->set)
-					SET_ALIVE(rs);
+					rs_set_alive(old_vs, rs, true);
 				rs->inhibit = false;
 			}
 			list_add (rs_to_remove, rs);
@@ -731,8 +1067,10 @@ clear_diff_rs(virtual_server_t *old_vs, virtual_server_t *new_vs, list old_check
 			 * already set IPVS rule.
 			 */
 			if (new_rs->alive)
-				new_rs->alive = rs->alive;
+				rs_set_alive(new_vs, new_rs, rs->alive);
 			new_rs->set = rs->set;
+			if (ISALIVE(new_rs))
+				new_vs->live_weight += rs->weight - new_rs->weight;
 			new_rs->weight = rs->weight;
 			new_rs->pweight = rs->iweight;
 			new_rs->reloaded = true;
@@ -746,11 +1084,12 @@ clear_diff_rs(virtual_server_t *old_vs, virtual_server_t *new_vs, list old_check
 			 * For alpha mode checkers, if it was up, we don't need another
 			 * success to say it is now up.
 			 */
-			migrate_checkers(rs, new_rs, old_checkers_queue);
+			migrate_checkers(new_vs, rs, new_rs, old_checker_index, new_checker_index);
 		}
 	}
 	clear_service_rs(old_vs, rs_to_remove);
 	free_list(&rs_to_remove);
+	htab_destroy(&new_rs_index);
 }
 
 /* clear sorry server, but only if changed */
@@ -794,11 +1133,26 @@ clear_diff_services(list old_checkers_queue)
 	element e;
 	list l = old_check_data->vs;
 	virtual_server_t *vs, *new_vs;
+	hashtab_t new_vs_index;
+	hashtab_t old_checker_index;
+	hashtab_t new_checker_index;
+	bool vs_key_collision = false;
 
 	/* If old config didn't own vs then nothing return */
 	if (LIST_ISEMPTY(l))
 		return;
 
+	/* Index the new configuration once, so the diff below costs one
+	 * lookup per entry instead of one scan */
+	htab_init(&new_vs_index, LIST_ISEMPTY(check_data->vs) ? 0 : LIST_SIZE(check_data->vs));
+	for (e = LIST_ISEMPTY(check_data->vs) ? NULL : LIST_HEAD(check_data->vs); e; ELEMENT_NEXT(e)) {
+		vs = ELEMENT_DATA(e);
+		if (!htab_insert(&new_vs_index, vs_hash_key(vs), vs))
+			vs_key_collision = true;
+	}
+	build_checker_index(&old_checker_index, old_checkers_queue);
+	build_checker_index(&new_checker_index, checkers_queue);
+
 	/* Remove diff entries from previous IPVS rules */
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vs = ELEMENT_DATA(e);
@@ -807,7 +1161,11 @@ clear_diff_services(list old_checkers_queue)
 		 * Try to find this vs into the new conf data
 		 * reloaded.
 		 */
-		new_vs = vs_exist(vs);
+		new_vs = htab_find(&new_vs_index, vs_hash_key(vs));
+		if (new_vs && !VS_ISEQ(vs, new_vs))
+			new_vs = NULL;
+		if (!new_vs && vs_key_collision)
+			new_vs = vs_exist(vs);
 		if (!new_vs) {
 			if (vs->vsgname)
 				log_message(LOG_INFO, "Removing Virtual Server Group [%s]", vs->vsgname);
@@ -829,10 +1187,14 @@ clear_diff_services(list old_checkers_queue)
 			/* omega = false must not prevent the notifiers from being called,
 			   because the VS still exists in new configuration */
 			vs->omega = true;
-			clear_diff_rs(vs, new_vs, old_checkers_queue);
+			clear_diff_rs(vs, new_vs, &old_checker_index, &new_checker_index);
 			clear_diff_s_srv(vs, new_vs->s_svr);
 		}
 	}
+
+	htab_destroy(&new_vs_index);
+	free_checker_index(&old_checker_index);
+	free_checker_index(&new_checker_index);
 }
 
 void
@@ -70,7 +70,6 @@ static int family;
 static bool try_nl = true;
 
 /* Policy definitions */
-#ifdef _WITH_SNMP_CHECKER_
 static struct nla_policy ipvs_cmd_policy[IPVS_CMD_ATTR_MAX + 1] = {
 	[IPVS_CMD_ATTR_SERVICE]		= { .type = NLA_NESTED },
 	[IPVS_CMD_ATTR_DEST]		= { .type = NLA_NESTED },
@@ -151,7 +150,6 @@ static struct nla_policy ipvs_stats_policy[IPVS_STATS_ATTR_MAX + 1] = {
 	[IPVS_STATS_ATTR_INBPS]		= { .type = NLA_U32 },
 	[IPVS_STATS_ATTR_OUTBPS]	= { .type = NLA_U32 },
 };
-#endif	/* _WITH_SNMP_CHECKER */
 
 static struct nla_policy ipvs_info_policy[IPVS_INFO_ATTR_MAX + 1] = {
 	[IPVS_INFO_ATTR_VERSION]        = { .type = NLA_U32 },
@@ -235,10 +233,144 @@ static int ipvs_nl_noop_cb(__attribute__((unused)) struct nl_msg *msg, __attribu
 	return NL_OK;
 }
 
+#ifdef _HAVE_LIBNL3_
+/* Batching of genetlink commands. Between ipvs_nl_batch_begin() and
+ * ipvs_nl_batch_end(), commands that expect only an ACK are queued and
+ * flushed as one netlink datagram with a single send, instead of
+ * opening a socket and doing a synchronous exchange per command. */
+#define IPVS_NL_BATCH_MAX	64
+
+static bool nl_batching;
+static struct nl_msg *nl_batch_msg[IPVS_NL_BATCH_MAX];
+static unsigned nl_batch_count;
+static uint32_t nl_batch_seq = 1;
+static int nl_batch_err;
+
+static int ipvs_nl_batch_flush(void)
+{
+	char buf[32768];
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct nl_sock *bsock;
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *errmsg;
+	uint32_t seq_base;
+	unsigned i, acks;
+	size_t len = 0;
+	ssize_t rlen;
+	uint8_t cmd;
+	int err = 0;
+	int fd;
+
+	if (!nl_batch_count)
+		return 0;
+
+	bsock = nl_socket_alloc();
+	if (bsock && genl_connect(bsock) < 0) {
+		nl_socket_free(bsock);
+		bsock = NULL;
+	}
+	if (!bsock) {
+		for (i = 0; i < nl_batch_count; i++)
+			nlmsg_free(nl_batch_msg[i]);
+		nl_batch_count = 0;
+		return -1;
+	}
+
+	seq_base = nl_batch_seq;
+	nl_batch_seq += nl_batch_count;
+	for (i = 0; i < nl_batch_count; i++) {
+		nlh = nlmsg_hdr(nl_batch_msg[i]);
+		nlh->nlmsg_seq = seq_base + i;
+		nlh->nlmsg_pid = nl_socket_get_local_port(bsock);
+		nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+		memcpy(buf + len, nlh, nlh->nlmsg_len);
+		len += NLMSG_ALIGN(nlh->nlmsg_len);
+	}
+
+	fd = nl_socket_get_fd(bsock);
+	if (sendto(fd, buf, len, 0, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		log_message(LOG_INFO, "IPVS batch send failed - errno %d", errno);
+		err = -1;
+	}
+
+	/* One ACK (or error) comes back per queued command */
+	for (acks = 0; !err && acks < nl_batch_count; ) {
+		rlen = recv(fd, buf, sizeof(buf), 0);
+		if (rlen <= 0) {
+			err = -1;
+			break;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)rlen); nlh = NLMSG_NEXT(nlh, rlen)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+			acks++;
+			errmsg = (struct nlmsgerr *)NLMSG_DATA(nlh);
+			if (!errmsg->error)
+				continue;
+
+			/* Apply the same tolerances as the synchronous path */
+			cmd = nlh->nlmsg_seq - seq_base < nl_batch_count ?
+			      ((struct genlmsghdr *)NLMSG_DATA(&errmsg->msg))->cmd : 0;
+			if (-errmsg->error == EEXIST &&
+			    (cmd == IPVS_CMD_NEW_DEST || cmd == IPVS_CMD_NEW_SERVICE))
+				continue;
+			if (-errmsg->error == ENOENT &&
+			    (cmd == IPVS_CMD_DEL_DEST || cmd == IPVS_CMD_DEL_SERVICE))
+				continue;
+
+			log_message(LOG_INFO, "IPVS batched command %u error %d", cmd, -errmsg->error);
+			nl_batch_err = -1;
+		}
+	}
+
+	for (i = 0; i < nl_batch_count; i++)
+		nlmsg_free(nl_batch_msg[i]);
+	nl_batch_count = 0;
+	nl_socket_free(bsock);
+
+	return err;
+}
+
+void ipvs_nl_batch_begin(void)
+{
+	if (!try_nl)
+		return;
+
+	nl_batching = true;
+	nl_batch_err = 0;
+}
+
+int ipvs_nl_batch_end(void)
+{
+	int err;
+
+	if (!nl_batching)
+		return 0;
+
+	err = ipvs_nl_batch_flush();
+	nl_batching = false;
+
+	return nl_batch_err ? nl_batch_err : err;
+}
+#endif
+
 static int ipvs_nl_send_message(struct nl_msg *msg, nl_recvmsg_msg_cb_t func, void *arg)
 {
 	int err = EINVAL;
 
+#ifdef _HAVE_LIBNL3_
+	/* Commands that only want an ACK are held back while batching */
+	if (nl_batching && msg && func == ipvs_nl_noop_cb) {
+		if (nl_batch_count == IPVS_NL_BATCH_MAX &&
+		    ipvs_nl_batch_flush() < 0) {
+			nlmsg_free(msg);
+			return -1;
+		}
+		nl_batch_msg[nl_batch_count++] = msg;
+		return 0;
+	}
+#endif
+
 	sock = nl_socket_alloc();
 	if (!sock) {
 		if (msg)
@@ -743,7 +875,6 @@ nla_put_failure:
 			  (char *)&dmk, sizeof(dmk));
 }
 
-#ifdef _WITH_SNMP_CHECKER_
 #ifdef LIBIPVS_USE_NL
 #ifdef _WITH_LVS_64BIT_STATS_
 static int ipvs_parse_stats64(ip_vs_stats_t *stats, struct nlattr *nla)
@@ -977,6 +1108,8 @@ struct ip_vs_get_dests_app *ipvs_get_dests(ipvs_service_entry_t *svc)
 {
 	struct ip_vs_get_dests_app *d;
 	struct ip_vs_get_dests *dk;
+	struct ip_vs_dest_entry *dke;
+	ipvs_dest_entry_t *de;
 	socklen_t len;
 	unsigned i;
 
@@ -1059,11 +1192,14 @@ ipvs_nl_dest_failure:
 	memcpy(d, dk, sizeof(struct ip_vs_get_dests));
 	d->af = AF_INET;
 	d->nf_addr.ip = d->user.addr;
+	/* Walk both zero length entrytable[] members through pointers
+	 * so the copy does not trip -Wzero-length-bounds */
+	de = d->user.entrytable;
+	dke = dk->entrytable;
 	for (i = 0; i < dk->num_dests; i++) {
-		memcpy(&d->user.entrytable[i], &dk->entrytable[i],
-		       sizeof(struct ip_vs_dest_entry));
-		d->user.entrytable[i].af = AF_INET;
-		d->user.entrytable[i].nf_addr.ip = d->user.entrytable[i].user.addr;
+		memcpy(&de[i], &dke[i], sizeof(struct ip_vs_dest_entry));
+		de[i].af = AF_INET;
+		de[i].nf_addr.ip = de[i].user.addr;
 	}
 	FREE(dk);
 	return d;
@@ -1149,7 +1285,40 @@ out_err:
 	FREE(svc);
 	return NULL;
 }
-#endif	/* _WITH_SNMP_CHECKER_ */
+
+/* Dump every IPVS service in one netlink request. Only available on
+ * the netlink interface; callers fall back to per service queries when
+ * this returns NULL. */
+struct ip_vs_get_services_app *
+ipvs_get_services(void)
+{
+#ifdef LIBIPVS_USE_NL
+	struct ip_vs_get_services_app *get;
+	struct nl_msg *msg;
+
+	ipvs_func = ipvs_get_service;
+
+	if (!try_nl)
+		return NULL;
+
+	if (!(get = MALLOC(sizeof(*get) + sizeof(ipvs_service_entry_t))))
+		return NULL;
+
+	get->user.num_services = 0;
+
+	msg = ipvs_nl_message(IPVS_CMD_GET_SERVICE, NLM_F_DUMP);
+	if (!msg)
+		goto ipvs_get_services_err;
+	if (ipvs_nl_send_message(msg, ipvs_services_parse_cb, &get))
+		goto ipvs_get_services_err;
+
+	return get;
+
+ipvs_get_services_err:
+	FREE(get);
+#endif
+	return NULL;
+}
 
 void ipvs_close(void)
 {
@@ -1185,10 +1354,8 @@ const char *ipvs_strerror(int err)
 		{ ipvs_del_dest, ENOENT, "No such destination" },
 		{ ipvs_start_daemon, EEXIST, "Daemon has already run" },
 		{ ipvs_stop_daemon, ESRCH, "No daemon is running" },
-#ifdef _WITH_SNMP_CHECKER_
 		{ ipvs_get_dests, ESRCH, "No such service" },
 		{ ipvs_get_service, ESRCH, "No such service" },
-#endif
 		{ 0, EPERM, "Permission denied (you must be root)" },
 		{ 0, EINVAL, "Invalid operation.  Possibly wrong module version, address not unicast, ..." },
 		{ 0, ENOPROTOOPT, "Protocol not available" },
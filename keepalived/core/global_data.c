@@ -26,11 +26,13 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <netdb.h>
+#include <sched.h>
 #include "global_data.h"
 #include "memory.h"
 #include "list.h"
 #include "logger.h"
 #include "utils.h"
+#include "notify.h"
 #ifdef _WITH_VRRP_
 #include "vrrp.h"
 #endif
@@ -98,6 +100,7 @@ set_vrrp_defaults(data_t * data)
 	data->vrrp_higher_prio_send_advert = false;
 	data->vrrp_version = VRRP_VERSION_2;
 	strcpy(data->vrrp_iptables_inchain, "INPUT");
+	strcpy(data->vrrp_nftables_table, "keepalived");
 #ifdef _HAVE_LIBIPSET_
 	data->using_ipsets = true;
 	strcpy(data->vrrp_ipset_address, "keepalived");
@@ -107,6 +110,7 @@ set_vrrp_defaults(data_t * data)
 	data->vrrp_check_unicast_src = false;
 	data->vrrp_skip_check_adv_addr = false;
 	data->vrrp_strict = false;
+	data->vrrp_rx_shards = 1;
 }
 #endif
 
@@ -198,7 +202,7 @@ init_global_data(data_t * data)
 	bool using_unknown_name = false;
 
 	if (!data->router_id ||
-	    (data->smtp_server.ss_family &&
+	    ((data->smtp_server.ss_family || data->smtp_server_name) &&
 	     (!data->smtp_helo_name ||
 	      !data->email_from))) {
 		local_name = get_local_name();
@@ -215,7 +219,7 @@ init_global_data(data_t * data)
 	if (!data->router_id)
 		set_default_router_id(data, local_name);
 
-	if (data->smtp_server.ss_family) {
+	if (data->smtp_server.ss_family || data->smtp_server_name) {
 		if (!data->smtp_connection_to)
 			set_default_smtp_connection_timeout(data);
 
@@ -289,6 +293,11 @@ free_global_data(data_t * data)
 	FREE_PTR(data->router_id);
 	FREE_PTR(data->email_from);
 	FREE_PTR(data->smtp_helo_name);
+	FREE_PTR(data->smtp_server_name);
+#ifdef _WITH_LVS_
+	FREE_PTR(data->checker_state_file);
+#endif
+	FREE_PTR(data->smtp_server_port);
 #ifdef _WITH_SNMP_
 	FREE_PTR(data->snmp_socket);
 #endif
@@ -296,6 +305,11 @@ free_global_data(data_t * data)
 	FREE_PTR(data->lvs_syncd.ifname);
 	FREE_PTR(data->lvs_syncd.vrrp_name);
 #endif
+	FREE_PTR(data->vrrp_dump_socket);
+	FREE_PTR(data->vrrp_control_socket);
+	FREE_PTR(data->vrrp_handoff_socket);
+	FREE_PTR(data->vrrp_state_file);
+	FREE_PTR(data->lvs_control_socket);
 	FREE_PTR(data->notify_fifo.name);
 	free_notify_script(&data->notify_fifo.script);
 #ifdef _WITH_VRRP_
@@ -323,6 +337,12 @@ dump_global_data(data_t * data)
 
 	if (data->router_id)
 		log_message(LOG_INFO, " Router ID = %s", data->router_id);
+	if (data->takeover)
+		log_message(LOG_INFO, " Takeover = true");
+	if (data->smtp_server_name)
+		log_message(LOG_INFO, " Smtp server name = %s:%s%s", data->smtp_server_name,
+			    data->smtp_server_port,
+			    data->smtp_server.ss_family ? "" : " (unresolved)");
 	if (data->smtp_server.ss_family) {
 		log_message(LOG_INFO, " Smtp server = %s", inet_sockaddrtos(&data->smtp_server));
 		log_message(LOG_INFO, " Smtp server port = %u", ntohs(inet_sockaddrport(&data->smtp_server)));
@@ -367,6 +387,10 @@ dump_global_data(data_t * data)
 	}
 #endif
 	log_message(LOG_INFO, " LVS flush = %s", data->lvs_flush ? "true" : "false");
+#ifdef _WITH_SNMP_CHECKER_
+	if (data->lvs_stats_refresh_interval)
+		log_message(LOG_INFO, " LVS stats refresh interval = %u", data->lvs_stats_refresh_interval);
+#endif
 #endif
 	if (data->notify_fifo.name) {
 		log_message(LOG_INFO, " Global notify fifo = %s", data->notify_fifo.name);
@@ -411,6 +435,8 @@ dump_global_data(data_t * data)
 	log_message(LOG_INFO, " Gratuitous ARP refresh timer = %lu",
 		       data->vrrp_garp_refresh.tv_sec);
 	log_message(LOG_INFO, " Gratuitous ARP refresh repeat = %d", data->vrrp_garp_refresh_rep);
+	if (data->vrrp_garp_refresh_rate)
+		log_message(LOG_INFO, " Gratuitous ARP refresh rate = %u frames/sec", data->vrrp_garp_refresh_rate);
 	log_message(LOG_INFO, " Gratuitous ARP lower priority delay = %d", data->vrrp_garp_lower_prio_delay / TIMER_HZ);
 	log_message(LOG_INFO, " Gratuitous ARP lower priority repeat = %d", data->vrrp_garp_lower_prio_rep);
 	log_message(LOG_INFO, " Send advert after receive lower priority advert = %s", data->vrrp_lower_prio_no_advert ? "false" : "true");
@@ -422,6 +448,20 @@ dump_global_data(data_t * data)
 		log_message(LOG_INFO," Iptables input chain = %s", data->vrrp_iptables_inchain);
 	if (data->vrrp_iptables_outchain[0])
 		log_message(LOG_INFO," Iptables output chain = %s", data->vrrp_iptables_outchain);
+	if (data->vrrp_nftables)
+		log_message(LOG_INFO, " Using nftables, table = %s", data->vrrp_nftables_table);
+	if (data->vrrp_dump_socket)
+		log_message(LOG_INFO, " VRRP dump socket = %s", data->vrrp_dump_socket);
+	if (data->vrrp_control_socket)
+		log_message(LOG_INFO, " VRRP control socket = %s", data->vrrp_control_socket);
+	if (data->vrrp_handoff_socket)
+		log_message(LOG_INFO, " VRRP handoff socket = %s", data->vrrp_handoff_socket);
+	if (data->vrrp_state_file)
+		log_message(LOG_INFO, " VRRP state file = %s", data->vrrp_state_file);
+	if (data->lvs_control_socket)
+		log_message(LOG_INFO, " LVS control socket = %s", data->lvs_control_socket);
+	if (data->lvs_weight_socket.ss_family != AF_UNSPEC)
+		log_message(LOG_INFO, " LVS weight socket = %s", inet_sockaddrtopair(&data->lvs_weight_socket));
 #ifdef _HAVE_LIBIPSET_
 	log_message(LOG_INFO, " Using ipsets = %s", data->using_ipsets ? "true" : "false");
 	if (data->vrrp_ipset_address[0])
@@ -437,10 +477,26 @@ dump_global_data(data_t * data)
 	log_message(LOG_INFO, " VRRP strict mode = %s", data->vrrp_strict ? "true" : "false");
 	log_message(LOG_INFO, " VRRP process priority = %d", data->vrrp_process_priority);
 	log_message(LOG_INFO, " VRRP don't swap = %s", data->vrrp_no_swap ? "true" : "false");
+	if (data->vrrp_cpu_mask)
+		log_message(LOG_INFO, " VRRP cpu affinity = 0x%lx", data->vrrp_cpu_mask);
+	if (data->vrrp_realtime_policy)
+		log_message(LOG_INFO, " VRRP realtime priority = %u (%s)", data->vrrp_realtime_priority, data->vrrp_realtime_policy == SCHED_FIFO ? "fifo" : "rr");
+	log_message(LOG_INFO, " VRRP rx ring = %s", data->vrrp_rx_ring ? "true" : "false");
+	log_message(LOG_INFO, " VRRP rx shards = %u", data->vrrp_rx_shards);
 #endif
 #ifdef _WITH_LVS_
 	log_message(LOG_INFO, " Checker process priority = %d", data->checker_process_priority);
 	log_message(LOG_INFO, " Checker don't swap = %s", data->checker_no_swap ? "true" : "false");
+	if (data->checker_cpu_mask)
+		log_message(LOG_INFO, " Checker cpu affinity = 0x%lx", data->checker_cpu_mask);
+	if (data->checker_realtime_policy)
+		log_message(LOG_INFO, " Checker realtime priority = %u (%s)", data->checker_realtime_priority, data->checker_realtime_policy == SCHED_FIFO ? "fifo" : "rr");
+	if (data->checker_shards > 1)
+		log_message(LOG_INFO, " Checker shards = %u", data->checker_shards);
+	if (data->checker_state_file)
+		log_message(LOG_INFO, " Checker state file = %s", data->checker_state_file);
+	if (data->checker_timer_slack)
+		log_message(LOG_INFO, " Checker timer slack = %lu usecs", data->checker_timer_slack);
 #endif
 #ifdef _WITH_SNMP_VRRP_
 	log_message(LOG_INFO, " SNMP keepalived %s", data->enable_snmp_keepalived ? "enabled" : "disabled");
@@ -457,6 +513,8 @@ dump_global_data(data_t * data)
 #ifdef _WITH_SNMP_
 	log_message(LOG_INFO, " SNMP traps %s", data->enable_traps ? "enabled" : "disabled");
 	log_message(LOG_INFO, " SNMP socket = %s", data->snmp_socket ? data->snmp_socket : "default (unix:/var/agentx/master)");
+	if (data->snmp_trap_rate_limit)
+		log_message(LOG_INFO, " SNMP trap rate limit = %u/s", data->snmp_trap_rate_limit);
 #endif
 #if HAVE_DECL_CLONE_NEWNET
 	log_message(LOG_INFO, " Network namespace = %s", network_namespace ? network_namespace : "(default)");
@@ -467,4 +525,6 @@ dump_global_data(data_t * data)
 #endif
 	log_message(LOG_INFO, " Script security %s", data->script_security ? "enabled" : "disabled");
 	log_message(LOG_INFO, " Default script uid:gid %d:%d", default_script_uid, default_script_gid);
+	if (get_max_concurrent_scripts())
+		log_message(LOG_INFO, " Max concurrent scripts = %u", get_max_concurrent_scripts());
 }
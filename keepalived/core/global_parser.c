@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <grp.h>
+#include <sched.h>
 
 #ifdef _WITH_SNMP_
 #include "snmp.h"
@@ -45,6 +46,7 @@
 #include "smtp.h"
 #include "utils.h"
 #include "logger.h"
+#include "notify.h"
 
 #if HAVE_DECL_CLONE_NEWNET
 #include "namespaces.h"
@@ -66,6 +68,11 @@ routerid_handler(vector_t *strvec)
 	global_data->router_id = set_value(strvec);
 }
 static void
+takeover_handler(__attribute__((unused)) vector_t *strvec)
+{
+	global_data->takeover = true;
+}
+static void
 emailfrom_handler(vector_t *strvec)
 {
 	FREE_PTR(global_data->email_from);
@@ -91,8 +98,18 @@ smtpserver_handler(vector_t *strvec)
 	if (!strpbrk(strvec_slot(strvec, 1), "-/"))
 		ret = inet_stosockaddr(strvec_slot(strvec, 1), port_str, &global_data->smtp_server);
 
-	if (ret < 0)
-		domain_stosockaddr(strvec_slot(strvec, 1), port_str, &global_data->smtp_server);
+	if (ret < 0) {
+		/* It's a domain name. Resolving it here would block the whole
+		 * daemon for the resolver timeout if the DNS server is slow
+		 * or unreachable, so defer the lookup to the scheduler - see
+		 * smtp_start_resolver(). */
+		FREE_PTR(global_data->smtp_server_name);
+		FREE_PTR(global_data->smtp_server_port);
+		global_data->smtp_server_name = MALLOC(strlen(strvec_slot(strvec, 1)) + 1);
+		strcpy(global_data->smtp_server_name, strvec_slot(strvec, 1));
+		global_data->smtp_server_port = MALLOC(strlen(port_str) + 1);
+		strcpy(global_data->smtp_server_port, port_str);
+	}
 }
 static void
 smtphelo_handler(vector_t *strvec)
@@ -121,7 +138,7 @@ email_handler(vector_t *strvec)
 		alloc_email(str);
 	}
 
-	free_strvec(email_vec);
+	free_value_block(email_vec);
 }
 #ifdef _WITH_VRRP_
 static void
@@ -316,6 +333,18 @@ lvs_flush_handler(__attribute__((unused)) vector_t *strvec)
 {
 	global_data->lvs_flush = true;
 }
+static void
+lvs_sync_catchup_delay_handler(vector_t *strvec)
+{
+	global_data->lvs_sync_catchup_delay = read_timer(strvec);
+}
+#ifdef _WITH_SNMP_CHECKER_
+static void
+lvs_stats_refresh_handler(vector_t *strvec)
+{
+	global_data->lvs_stats_refresh_interval = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10);
+}
+#endif
 #endif
 #ifdef _WITH_VRRP_
 static void
@@ -367,6 +396,11 @@ vrrp_garp_refresh_rep_handler(vector_t *strvec)
 		global_data->vrrp_garp_refresh_rep = 1;
 }
 static void
+vrrp_garp_refresh_rate_handler(vector_t *strvec)
+{
+	global_data->vrrp_garp_refresh_rate = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10);
+}
+static void
 vrrp_garp_lower_prio_delay_handler(vector_t *strvec)
 {
 	global_data->vrrp_garp_lower_prio_delay = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10) * TIMER_HZ;
@@ -440,6 +474,76 @@ vrrp_iptables_handler(vector_t *strvec)
 		strcpy(global_data->vrrp_iptables_outchain, strvec_slot(strvec,2));
 	}
 }
+static void
+vrrp_dump_socket_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "vrrp_dump_socket requires a socket path");
+		return;
+	}
+	global_data->vrrp_dump_socket = set_value(strvec);
+}
+static void
+vrrp_control_socket_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "vrrp_control_socket requires a socket path");
+		return;
+	}
+	global_data->vrrp_control_socket = set_value(strvec);
+}
+static void
+vrrp_handoff_socket_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "vrrp_handoff_socket requires a socket path");
+		return;
+	}
+	global_data->vrrp_handoff_socket = set_value(strvec);
+}
+static void
+vrrp_state_file_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No vrrp_state_file specified");
+		return;
+	}
+	FREE_PTR(global_data->vrrp_state_file);
+	global_data->vrrp_state_file = set_value(strvec);
+}
+static void
+lvs_control_socket_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "lvs_control_socket requires a socket path");
+		return;
+	}
+	global_data->lvs_control_socket = set_value(strvec);
+}
+static void
+lvs_weight_socket_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 3) {
+		log_message(LOG_INFO, "lvs_weight_udp_socket requires an address and port");
+		return;
+	}
+	if (inet_stosockaddr(strvec_slot(strvec, 1), strvec_slot(strvec, 2), &global_data->lvs_weight_socket)) {
+		log_message(LOG_INFO, "Invalid lvs_weight_udp_socket address %s", FMT_STR_VSLOT(strvec, 1));
+		global_data->lvs_weight_socket.ss_family = AF_UNSPEC;
+	}
+}
+static void
+vrrp_nftables_handler(vector_t *strvec)
+{
+	global_data->vrrp_nftables = true;
+	if (vector_size(strvec) >= 2) {
+		if (strlen(strvec_slot(strvec,1)) >= sizeof(global_data->vrrp_nftables_table)-1) {
+			log_message(LOG_INFO, "VRRP Error : nftables table name too long - ignored");
+			return;
+		}
+		strcpy(global_data->vrrp_nftables_table, strvec_slot(strvec,1));
+	}
+}
 #ifdef _HAVE_LIBIPSET_
 static void
 vrrp_ipsets_handler(vector_t *strvec)
@@ -538,6 +642,82 @@ vrrp_no_swap_handler(__attribute__((unused)) vector_t *strvec)
 {
 	global_data->vrrp_no_swap = true;
 }
+static void
+cpu_affinity_common(vector_t *strvec, unsigned long *mask, const char *name)
+{
+	unsigned long cpus;
+	char *endptr;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No %s mask specified", name);
+		return;
+	}
+
+	cpus = strtoul(strvec_slot(strvec, 1), &endptr, 16);
+	if (*endptr || !cpus) {
+		log_message(LOG_INFO, "Invalid %s mask %s - must be a non-zero hex mask of cpus", name, FMT_STR_VSLOT(strvec, 1));
+		return;
+	}
+
+	*mask = cpus;
+}
+static void
+rt_priority_common(vector_t *strvec, int *policy, unsigned *priority, const char *name)
+{
+	int prio;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No %s specified", name);
+		return;
+	}
+
+	prio = atoi(strvec_slot(strvec, 1));
+	if (prio < 1 || prio > 99) {
+		log_message(LOG_INFO, "Invalid %s %s - must be between 1 and 99", name, FMT_STR_VSLOT(strvec, 1));
+		return;
+	}
+
+	/* SCHED_RR unless fifo is explicitly requested */
+	*policy = SCHED_RR;
+	if (vector_size(strvec) >= 3) {
+		if (!strcmp(strvec_slot(strvec, 2), "fifo"))
+			*policy = SCHED_FIFO;
+		else if (strcmp(strvec_slot(strvec, 2), "rr")) {
+			log_message(LOG_INFO, "Unknown %s policy %s - must be rr or fifo", name, FMT_STR_VSLOT(strvec, 2));
+			*policy = 0;
+			return;
+		}
+	}
+
+	*priority = (unsigned)prio;
+}
+static void
+vrrp_cpu_affinity_handler(vector_t *strvec)
+{
+	cpu_affinity_common(strvec, &global_data->vrrp_cpu_mask, "vrrp_cpu_affinity");
+}
+static void
+vrrp_rt_priority_handler(vector_t *strvec)
+{
+	rt_priority_common(strvec, &global_data->vrrp_realtime_policy, &global_data->vrrp_realtime_priority, "vrrp_rt_priority");
+}
+static void
+vrrp_rx_ring_handler(__attribute__((unused)) vector_t *strvec)
+{
+	global_data->vrrp_rx_ring = true;
+}
+static void
+vrrp_rx_shards_handler(vector_t *strvec)
+{
+	unsigned shards = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10);
+
+	if (shards < 1 || shards > 255) {
+		log_message(LOG_INFO, "Invalid vrrp_rx_shards %s - must be between 1 and 255", FMT_STR_VSLOT(strvec, 1));
+		return;
+	}
+
+	global_data->vrrp_rx_shards = shards;
+}
 #endif
 static void
 notify_fifo(vector_t *strvec, const char *type, notify_fifo_t *fifo)
@@ -635,6 +815,103 @@ checker_no_swap_handler(__attribute__((unused)) vector_t *strvec)
 {
 	global_data->checker_no_swap = true;
 }
+static void
+checker_cpu_affinity_handler(vector_t *strvec)
+{
+	cpu_affinity_common(strvec, &global_data->checker_cpu_mask, "checker_cpu_affinity");
+}
+static void
+checker_rt_priority_handler(vector_t *strvec)
+{
+	rt_priority_common(strvec, &global_data->checker_realtime_policy, &global_data->checker_realtime_priority, "checker_rt_priority");
+}
+static void
+max_concurrent_checks_handler(vector_t *strvec)
+{
+	int max;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No max_concurrent_checks specified");
+		return;
+	}
+
+	max = atoi(strvec_slot(strvec, 1));
+	if (max < 1) {
+		log_message(LOG_INFO, "Invalid max_concurrent_checks specified");
+		return;
+	}
+
+	global_data->max_concurrent_checks = (unsigned)max;
+}
+static void
+checker_shards_handler(vector_t *strvec)
+{
+	int shards;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No checker_shards specified");
+		return;
+	}
+
+	shards = atoi(strvec_slot(strvec, 1));
+	if (shards < 1 || shards > 64) {
+		log_message(LOG_INFO, "Invalid checker_shards specified");
+		return;
+	}
+
+	global_data->checker_shards = (unsigned)shards;
+}
+static void
+checker_state_file_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No checker_state_file specified");
+		return;
+	}
+
+	FREE_PTR(global_data->checker_state_file);
+	global_data->checker_state_file = MALLOC(strlen(strvec_slot(strvec, 1)) + 1);
+	strcpy(global_data->checker_state_file, strvec_slot(strvec, 1));
+}
+static void
+checker_timer_slack_handler(vector_t *strvec)
+{
+	double slack;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No checker_timer_slack specified");
+		return;
+	}
+
+	slack = atof(strvec_slot(strvec, 1));
+	if (slack < 0 || slack > 10) {
+		log_message(LOG_INFO, "Invalid checker_timer_slack specified");
+		return;
+	}
+
+	global_data->checker_timer_slack = (unsigned long)(slack * TIMER_HZ);
+}
+static void
+weight_debounce_handler(vector_t *strvec)
+{
+	double window;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No weight_debounce window specified");
+		return;
+	}
+
+	window = atof(strvec_slot(strvec, 1));
+	if (window < 0 || window > 300) {
+		log_message(LOG_INFO, "Invalid weight_debounce window specified");
+		return;
+	}
+
+	global_data->weight_debounce_window = (unsigned long)(window * TIMER_HZ);
+
+	if (vector_size(strvec) >= 3)
+		global_data->weight_debounce_threshold = atoi(strvec_slot(strvec, 2));
+}
 #endif
 #ifdef _WITH_SNMP_
 static void
@@ -668,6 +945,15 @@ trap_handler(__attribute__((unused)) vector_t *strvec)
 {
 	global_data->enable_traps = true;
 }
+static void
+snmp_trap_rate_limit_handler(vector_t *strvec)
+{
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "snmp_trap_rate_limit requires a rate");
+		return;
+	}
+	global_data->snmp_trap_rate_limit = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10);
+}
 #ifdef _WITH_SNMP_VRRP_
 static void
 snmp_keepalived_handler(__attribute__((unused)) vector_t *strvec)
@@ -798,6 +1084,25 @@ script_security_handler(__attribute__((unused)) vector_t *strvec)
 	global_data->script_security = true;
 }
 
+static void
+max_concurrent_scripts_handler(vector_t *strvec)
+{
+	int limit;
+
+	if (vector_size(strvec) < 2) {
+		log_message(LOG_INFO, "No max_concurrent_scripts value specified");
+		return;
+	}
+
+	limit = atoi(strvec_slot(strvec, 1));
+	if (limit < 0) {
+		log_message(LOG_INFO, "Invalid max_concurrent_scripts value %s", FMT_STR_VSLOT(strvec, 1));
+		return;
+	}
+
+	set_max_concurrent_scripts((unsigned)limit);
+}
+
 void
 init_global_keywords(bool global_active)
 {
@@ -811,6 +1116,7 @@ init_global_keywords(bool global_active)
 	install_keyword_root("instance", &instance_handler, !global_active);
 	install_keyword_root("global_defs", NULL, global_active);
 	install_keyword("router_id", &routerid_handler);
+	install_keyword("takeover", &takeover_handler);
 	install_keyword("notification_email_from", &emailfrom_handler);
 	install_keyword("smtp_server", &smtpserver_handler);
 	install_keyword("smtp_helo_name", &smtphelo_handler);
@@ -822,6 +1128,10 @@ init_global_keywords(bool global_active)
 #ifdef _WITH_LVS_
 	install_keyword("lvs_timeouts", &lvs_timeouts);
 	install_keyword("lvs_flush", &lvs_flush_handler);
+	install_keyword("lvs_sync_catchup_delay", &lvs_sync_catchup_delay_handler);
+#ifdef _WITH_SNMP_CHECKER_
+	install_keyword("lvs_stats_refresh_interval", &lvs_stats_refresh_handler);
+#endif
 #ifdef _WITH_VRRP_
 	install_keyword("lvs_sync_daemon", &lvs_syncd_handler);
 #endif
@@ -833,6 +1143,7 @@ init_global_keywords(bool global_active)
 	install_keyword("vrrp_garp_master_repeat", &vrrp_garp_rep_handler);
 	install_keyword("vrrp_garp_master_refresh", &vrrp_garp_refresh_handler);
 	install_keyword("vrrp_garp_master_refresh_repeat", &vrrp_garp_refresh_rep_handler);
+	install_keyword("vrrp_garp_refresh_rate", &vrrp_garp_refresh_rate_handler);
 	install_keyword("vrrp_garp_lower_prio_delay", &vrrp_garp_lower_prio_delay_handler);
 	install_keyword("vrrp_garp_lower_prio_repeat", &vrrp_garp_lower_prio_rep_handler);
 	install_keyword("vrrp_garp_interval", &vrrp_garp_interval_handler);
@@ -841,6 +1152,13 @@ init_global_keywords(bool global_active)
 	install_keyword("vrrp_higher_prio_send_advert", &vrrp_higher_prio_send_advert_handler);
 	install_keyword("vrrp_version", &vrrp_version_handler);
 	install_keyword("vrrp_iptables", &vrrp_iptables_handler);
+	install_keyword("vrrp_nftables", &vrrp_nftables_handler);
+	install_keyword("vrrp_dump_socket", &vrrp_dump_socket_handler);
+	install_keyword("vrrp_control_socket", &vrrp_control_socket_handler);
+	install_keyword("vrrp_handoff_socket", &vrrp_handoff_socket_handler);
+	install_keyword("vrrp_state_file", &vrrp_state_file_handler);
+	install_keyword("lvs_control_socket", &lvs_control_socket_handler);
+	install_keyword("lvs_weight_udp_socket", &lvs_weight_socket_handler);
 #ifdef _HAVE_LIBIPSET_
 	install_keyword("vrrp_ipsets", &vrrp_ipsets_handler);
 #endif
@@ -849,6 +1167,10 @@ init_global_keywords(bool global_active)
 	install_keyword("vrrp_strict", &vrrp_strict_handler);
 	install_keyword("vrrp_priority", &vrrp_prio_handler);
 	install_keyword("vrrp_no_swap", &vrrp_no_swap_handler);
+	install_keyword("vrrp_cpu_affinity", &vrrp_cpu_affinity_handler);
+	install_keyword("vrrp_rt_priority", &vrrp_rt_priority_handler);
+	install_keyword("vrrp_rx_ring", &vrrp_rx_ring_handler);
+	install_keyword("vrrp_rx_shards", &vrrp_rx_shards_handler);
 #endif
 	install_keyword("notify_fifo", &global_notify_fifo);
 	install_keyword("notify_fifo_script", &global_notify_fifo_script);
@@ -863,10 +1185,18 @@ init_global_keywords(bool global_active)
 #ifdef _WITH_LVS_
 	install_keyword("checker_priority", &checker_prio_handler);
 	install_keyword("checker_no_swap", &checker_no_swap_handler);
+	install_keyword("checker_cpu_affinity", &checker_cpu_affinity_handler);
+	install_keyword("checker_rt_priority", &checker_rt_priority_handler);
+	install_keyword("max_concurrent_checks", &max_concurrent_checks_handler);
+	install_keyword("checker_shards", &checker_shards_handler);
+	install_keyword("checker_state_file", &checker_state_file_handler);
+	install_keyword("checker_timer_slack", &checker_timer_slack_handler);
+	install_keyword("weight_debounce", &weight_debounce_handler);
 #endif
 #ifdef _WITH_SNMP_
 	install_keyword("snmp_socket", &snmp_socket_handler);
 	install_keyword("enable_traps", &trap_handler);
+	install_keyword("snmp_trap_rate_limit", &snmp_trap_rate_limit_handler);
 #ifdef _WITH_SNMP_VRRP_
 	install_keyword("enable_snmp_keepalived", &snmp_keepalived_handler);
 #endif
@@ -889,4 +1219,5 @@ init_global_keywords(bool global_active)
 #endif
 	install_keyword("script_user", &script_user_handler);
 	install_keyword("enable_script_security", &script_security_handler);
+	install_keyword("max_concurrent_scripts", &max_concurrent_scripts_handler);
 }
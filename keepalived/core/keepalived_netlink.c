@@ -37,6 +37,10 @@
 #include <sys/uio.h>
 #include <stdarg.h>
 #include <stdint.h>
+#if !defined _DEBUG_ && defined _WITH_VRRP_ && defined _WITH_LVS_
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#endif
 
 /* local include */
 #ifdef _LIBNL_DYNAMIC_
@@ -57,6 +61,7 @@
 #if !HAVE_DECL_SOCK_NONBLOCK
 #include "old_socket.h"
 #endif
+#include "trace.h"
 
 /* Default values */
 #define IF_DEFAULT_BUFSIZE	(65*1024)
@@ -70,6 +75,7 @@ int netlink_error_ignore;	/* If we get this error, ignore it */
 /* Static vars */
 static nl_handle_t nl_kernel;	/* Kernel reflection channel */
 static int nlmsg_buf_size;	/* Size of netlink message buffer */
+static unsigned netlink_overruns;	/* Receive overruns (ENOBUFS) on our netlink sockets */
 
 void
 netlink_set_recv_buf_size(void)
@@ -521,6 +527,88 @@ parse_rtattr_nested(struct rtattr **tb, int max, struct rtattr *rta)
 }
 #endif
 
+#if !defined _DEBUG_ && defined _WITH_VRRP_ && defined _WITH_LVS_
+/* Shared address-event channel between the vrrp and checker processes.
+ *
+ * When both children run, each used to open its own netlink broadcast
+ * channel and parse the same kernel events. The checker only consumes
+ * address add/del events (to drive ha_suspend and address-change
+ * logging), so the vrrp process, which runs full interface reflection
+ * anyway, republishes each address event into a ring in an anonymous
+ * shared mapping set up by the parent before forking, and pokes an
+ * eventfd doorbell. The checker drains the ring instead of running its
+ * own reflection, halving the netlink processing and guaranteeing both
+ * processes see the same event stream.
+ *
+ * Single producer (vrrp), single consumer (checker). The producer
+ * fills a slot and then publishes the head with a release store; the
+ * consumer keeps its cursor private and detects being lapped (or a
+ * slot overwritten mid-copy) by the head moving more than a ring's
+ * worth ahead of it, in which case it re-reads the address state from
+ * the kernel with a one-off dump. */
+#define NL_SHARED_RING_SIZE	4096	/* must be a power of 2 */
+
+typedef struct _nl_shared_event {
+	uint8_t		family;		/* AF_INET or AF_INET6 */
+	uint8_t		up;		/* RTM_NEWADDR rather than RTM_DELADDR */
+	uint8_t		pad[2];
+	uint32_t	ifindex;
+	unsigned char	addr[16];
+} nl_shared_event_t;
+
+typedef struct _nl_shared {
+	uint32_t	head;		/* next slot to fill - vrrp process only */
+	nl_shared_event_t ring[NL_SHARED_RING_SIZE];
+} nl_shared_t;
+
+static nl_shared_t *nl_shared;
+static int nl_shared_efd = -1;
+static uint32_t nl_shared_tail;		/* consumer cursor - checker process private */
+
+/* Set up the shared ring and its doorbell. Runs in the parent, before
+ * the children are forked, so both inherit the mapping and the eventfd */
+bool
+netlink_shared_create(void)
+{
+	nl_shared = (nl_shared_t *) mmap(NULL, sizeof(nl_shared_t), PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (nl_shared == MAP_FAILED) {
+		log_message(LOG_INFO, "Unable to map shared netlink event ring (%s) - children will run separate reflection", strerror(errno));
+		nl_shared = NULL;
+		return false;
+	}
+
+	nl_shared_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (nl_shared_efd == -1) {
+		log_message(LOG_INFO, "Unable to create shared netlink event doorbell (%s) - children will run separate reflection", strerror(errno));
+		munmap(nl_shared, sizeof(nl_shared_t));
+		nl_shared = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/* Publish one address event for the checker. Runs in the vrrp process */
+static void
+netlink_shared_publish(uint32_t ifindex, uint8_t family, const void *addr, bool up)
+{
+	uint32_t head = __atomic_load_n(&nl_shared->head, __ATOMIC_RELAXED);
+	nl_shared_event_t *ev = &nl_shared->ring[head & (NL_SHARED_RING_SIZE - 1)];
+	uint64_t one = 1;
+
+	ev->family = family;
+	ev->up = up;
+	ev->ifindex = ifindex;
+	memcpy(ev->addr, addr, family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+
+	__atomic_store_n(&nl_shared->head, head + 1, __ATOMIC_RELEASE);
+
+	if (write(nl_shared_efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		log_message(LOG_INFO, "Write to shared netlink event doorbell failed (%s)", strerror(errno));
+}
+#endif
+
 /*
  * Netlink interface address lookup filter
  * We need to handle multiple primary address and
@@ -566,6 +654,15 @@ netlink_if_address_filter(__attribute__((unused)) struct sockaddr_nl *snl, struc
 	if (addr == NULL)
 		return -1;
 
+#if !defined _DEBUG_ && defined _WITH_VRRP_ && defined _WITH_LVS_
+	/* Republish the event for the checker process before any early
+	 * return below - the checker cares about addresses on interfaces
+	 * regardless of our own interest in them */
+	if (nl_shared && prog_type == PROG_TYPE_VRRP)
+		netlink_shared_publish(ifa->ifa_index, (uint8_t)ifa->ifa_family, addr,
+				       h->nlmsg_type == RTM_NEWADDR);
+#endif
+
 #ifdef _WITH_VRRP_
 #ifndef _DEBUG_
 	if (prog_type == PROG_TYPE_VRRP)
@@ -601,7 +698,88 @@ netlink_if_address_filter(__attribute__((unused)) struct sockaddr_nl *snl, struc
 	return 0;
 }
 
-/* Our netlink parser */
+/* Forward references for the overrun re-sync path below */
+static int netlink_parse_info(int (*) (struct sockaddr_nl *, struct nlmsghdr *), nl_handle_t *, struct nlmsghdr *, bool);
+#ifdef _WITH_VRRP_
+static int netlink_request(nl_handle_t *, unsigned char, uint16_t, char *);
+static int netlink_addr_request(nl_handle_t *, unsigned char, ifindex_t);
+static int netlink_if_link_filter(struct sockaddr_nl *, struct nlmsghdr *);
+
+/* Interfaces whose events were dropped or failed to apply are marked
+ * stale, so the re-sync only has to visit those rather than everything
+ * we track. An overrun loses events of unknown scope, so it taints the
+ * whole set. */
+static void
+netlink_mark_all_stale(void)
+{
+	interface_t *ifp;
+	element e;
+	list l = get_if_list();
+
+	if (LIST_ISEMPTY(l))
+		return;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		ifp = ELEMENT_DATA(e);
+		ifp->nl_stale = true;
+	}
+}
+
+/* Refresh the stale interfaces with a targeted RTM_GETLINK and a
+ * filtered RTM_GETADDR dump each, rather than re-dumping the whole link
+ * and address tables - on boxes with many more interfaces than
+ * keepalived uses that is a fraction of the dump cost. */
+static void
+netlink_resync_interfaces(void)
+{
+	nl_handle_t nlh;
+	interface_t *ifp;
+	element e;
+	list l = get_if_list();
+	static bool resyncing;
+#ifdef NETLINK_GET_STRICT_CHK
+	int one = 1;
+#endif
+
+	/* Don't recurse if the re-sync itself overruns */
+	if (resyncing || LIST_ISEMPTY(l))
+		return;
+
+	if (netlink_socket(&nlh, 0, 0) < 0)
+		return;
+
+#ifdef NETLINK_GET_STRICT_CHK
+	/* Ask the kernel (4.20+) to honour the ifa_index filter on the
+	 * address dumps. Older kernels reject the option and return full
+	 * dumps, which the filter callback copes with anyway. */
+	setsockopt(nlh.fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+#endif
+
+	resyncing = true;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		ifp = ELEMENT_DATA(e);
+		if (!ifp->nl_stale)
+			continue;
+		if (netlink_request(&nlh, AF_PACKET, RTM_GETLINK, ifp->ifname) < 0)
+			break;
+		netlink_parse_info(netlink_if_link_filter, &nlh, NULL, false);
+		if (netlink_addr_request(&nlh, AF_UNSPEC, ifp->ifindex) < 0)
+			break;
+		netlink_parse_info(netlink_if_address_filter, &nlh, NULL, false);
+		ifp->nl_stale = false;
+	}
+
+	resyncing = false;
+	netlink_close(&nlh);
+}
+#endif
+
+/* Our netlink parser. Datagrams are drained a batch at a time so an
+ * interface storm is parsed in one pass instead of one recvmsg() per
+ * kernel message. */
+#define NL_RX_BATCH	8
+
 static int
 netlink_parse_info(int (*filter) (struct sockaddr_nl *, struct nlmsghdr *),
 		   nl_handle_t *nl, struct nlmsghdr *n, bool read_all)
@@ -609,144 +787,162 @@ netlink_parse_info(int (*filter) (struct sockaddr_nl *, struct nlmsghdr *),
 	ssize_t status;
 	int ret = 0;
 	int error;
+	int pkts, i;
 
 	while (true) {
-		char buf[nlmsg_buf_size];
-		struct iovec iov = {
-			.iov_base = buf,
-			.iov_len = sizeof buf
-		};
-		struct sockaddr_nl snl;
-		struct msghdr msg = {
-			.msg_name = &snl,
-			.msg_namelen = sizeof(snl),
-			.msg_iov = &iov,
-			.msg_iovlen = 1,
-			.msg_control = NULL,
-			.msg_controllen = 0,
-			.msg_flags = 0
-		};
+		char buf[NL_RX_BATCH][nlmsg_buf_size];
+		struct sockaddr_nl snl[NL_RX_BATCH];
+		struct iovec iov[NL_RX_BATCH];
+		struct mmsghdr msgs[NL_RX_BATCH];
 		struct nlmsghdr *h;
 
-		status = recvmsg(nl->fd, &msg, 0);
+		for (i = 0; i < NL_RX_BATCH; i++) {
+			iov[i].iov_base = buf[i];
+			iov[i].iov_len = nlmsg_buf_size;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_name = &snl[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(snl[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
 
-		if (status < 0) {
+		/* MSG_WAITFORONE makes the blocking command channel return
+		 * as soon as the first reply arrives, while a backed up
+		 * reflection channel fills the whole batch. */
+		pkts = recvmmsg(nl->fd, msgs, NL_RX_BATCH, MSG_WAITFORONE, NULL);
+
+		if (pkts < 0) {
 			if (errno == EINTR)
 				continue;
 			if (errno == EWOULDBLOCK || errno == EAGAIN)
 				break;
 			if (errno == ENOBUFS) {
-				/* It appears the if we add a large number of interfaces, then
-				 * within a few seconds of starting up the kernel can decide to
-				 * notify us again of all the new interfaces (or it may have something
-				 * to do with becoming master). In any event, if we add a
-				 * kernel_netlink_poll() at every stage of the process, we suddenly
-				 * go from having nothing to receive on nl_kernel to ENOBUFS. Since it
-				 * relates to the interfaces, and we have already got the information
-				 * about the interfaces, it appears that we aren't losing any useful info. */
-				log_message(LOG_INFO, "Netlink: Received message overrun - (%m)");
+				/* The kernel dropped messages between our reads. This
+				 * can happen benignly shortly after startup when the
+				 * kernel re-notifies all the interfaces we already know
+				 * about, but during a genuine interface storm it means
+				 * lost link state, so refresh what we track. */
+				log_message(LOG_INFO, "Netlink: Received message overrun #%u - (%m)",
+				       ++netlink_overruns);
+#ifdef _WITH_VRRP_
+				if (nl == &nl_kernel
+#ifndef _DEBUG_
+				    && prog_type == PROG_TYPE_VRRP
+#endif
+							   ) {
+					netlink_mark_all_stale();
+					netlink_resync_interfaces();
+				}
+#endif
 			}
 			else
-				log_message(LOG_INFO, "Netlink: recvmsg error - %d (%m)", errno);
+				log_message(LOG_INFO, "Netlink: recvmmsg error - %d (%m)", errno);
 			continue;
 		}
 
-		if (status == 0) {
-			log_message(LOG_INFO, "Netlink: EOF");
-			return -1;
-		}
+		for (i = 0; i < pkts; i++) {
+			status = msgs[i].msg_len;
 
-		if (msg.msg_namelen != sizeof snl) {
-			log_message(LOG_INFO,
-			       "Netlink: Sender address length error: length %d",
-			       msg.msg_namelen);
-			return -1;
-		}
+			if (status == 0) {
+				log_message(LOG_INFO, "Netlink: EOF");
+				return -1;
+			}
 
-		for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, (size_t)status);
-		     h = NLMSG_NEXT(h, status)) {
-			/* Finish of reading. */
-			if (h->nlmsg_type == NLMSG_DONE)
-				return ret;
-
-			/* Error handling. */
-			if (h->nlmsg_type == NLMSG_ERROR) {
-				struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(h);
-
-				/*
-				 * If error == 0 then this is a netlink ACK.
-				 * return if not related to multipart message.
-				 */
-				if (err->error == 0) {
-					if (!(h->nlmsg_flags & NLM_F_MULTI) && !read_all)
+			if (msgs[i].msg_hdr.msg_namelen != sizeof (struct sockaddr_nl)) {
+				log_message(LOG_INFO,
+				       "Netlink: Sender address length error: length %d",
+				       msgs[i].msg_hdr.msg_namelen);
+				return -1;
+			}
+
+			for (h = (struct nlmsghdr *) buf[i]; NLMSG_OK(h, (size_t)status);
+			     h = NLMSG_NEXT(h, status)) {
+				log_debug(LOG_SUBSYS_NETLINK, "Netlink: recv type %u, flags 0x%x, seq %u, pid %u, len %u",
+					  h->nlmsg_type, h->nlmsg_flags, h->nlmsg_seq, h->nlmsg_pid, h->nlmsg_len);
+
+				/* Finish of reading. */
+				if (h->nlmsg_type == NLMSG_DONE)
+					return ret;
+
+				/* Error handling. */
+				if (h->nlmsg_type == NLMSG_ERROR) {
+					struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(h);
+
+					/*
+					 * If error == 0 then this is a netlink ACK.
+					 * return if not related to multipart message.
+					 */
+					if (err->error == 0) {
+						if (!(h->nlmsg_flags & NLM_F_MULTI) && !read_all)
+							return 0;
+						continue;
+					}
+
+					if (h->nlmsg_len < NLMSG_LENGTH(sizeof (struct nlmsgerr))) {
+						log_message(LOG_INFO,
+						       "Netlink: error: message truncated");
+						return -1;
+					}
+
+					if (n && (err->error == -EEXIST) &&
+					    ((n->nlmsg_type == RTM_NEWROUTE) ||
+					     (n->nlmsg_type == RTM_NEWADDR)))
 						return 0;
-					continue;
-				}
 
-				if (h->nlmsg_len < NLMSG_LENGTH(sizeof (struct nlmsgerr))) {
-					log_message(LOG_INFO,
-					       "Netlink: error: message truncated");
+					/* If have more than one IPv4 address in the same CIDR
+					 * and the "primary" address is removed, unless promote_secondaries
+					 * is configured on the interface, all the "secondary" addresses
+					 * in the same CIDR are deleted */
+					if (n && err->error == -EADDRNOTAVAIL &&
+					    n->nlmsg_type == RTM_DELADDR) {
+						netlink_if_address_filter(NULL, n);
+						if (!(h->nlmsg_flags & NLM_F_MULTI))
+							return 0;
+						continue;
+					}
+	#ifdef _WITH_VRRP_
+					if (netlink_error_ignore != -err->error)
+	#endif
+						log_message(LOG_INFO,
+						       "Netlink: error: %s, type=(%u), seq=%u, pid=%d",
+						       strerror(-err->error),
+						       err->msg.nlmsg_type,
+						       err->msg.nlmsg_seq, err->msg.nlmsg_pid);
+
 					return -1;
 				}
 
-				if (n && (err->error == -EEXIST) &&
-				    ((n->nlmsg_type == RTM_NEWROUTE) ||
-				     (n->nlmsg_type == RTM_NEWADDR)))
-					return 0;
-
-				/* If have more than one IPv4 address in the same CIDR
-				 * and the "primary" address is removed, unless promote_secondaries
-				 * is configured on the interface, all the "secondary" addresses
-				 * in the same CIDR are deleted */
-				if (n && err->error == -EADDRNOTAVAIL &&
-				    n->nlmsg_type == RTM_DELADDR) {
-					netlink_if_address_filter(NULL, n);
-					if (!(h->nlmsg_flags & NLM_F_MULTI))
-						return 0;
+	#ifdef _WITH_VRRP_
+				/* Skip unsolicited messages from cmd channel */
+				if (
+	#ifndef _DEBUG_
+				    prog_type == PROG_TYPE_VRRP &&
+	#endif
+				    nl != &nl_cmd && h->nlmsg_pid == nl_cmd.nl_pid)
 					continue;
+	#endif
+
+				error = (*filter) (&snl[i], h);
+				if (error < 0) {
+					log_message(LOG_INFO, "Netlink: filter function error");
+					ret = error;
 				}
-#ifdef _WITH_VRRP_
-				if (netlink_error_ignore != -err->error)
-#endif
-					log_message(LOG_INFO,
-					       "Netlink: error: %s, type=(%u), seq=%u, pid=%d",
-					       strerror(-err->error),
-					       err->msg.nlmsg_type,
-					       err->msg.nlmsg_seq, err->msg.nlmsg_pid);
 
-				return -1;
+				if (!(h->nlmsg_flags & NLM_F_MULTI) && !read_all)
+					return ret;
 			}
 
-#ifdef _WITH_VRRP_
-			/* Skip unsolicited messages from cmd channel */
-			if (
-#ifndef _DEBUG_
-			    prog_type == PROG_TYPE_VRRP &&
-#endif
-			    nl != &nl_cmd && h->nlmsg_pid == nl_cmd.nl_pid)
+			/* After error care. */
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				log_message(LOG_INFO, "Netlink: error: message truncated");
 				continue;
-#endif
-
-			error = (*filter) (&snl, h);
-			if (error < 0) {
-				log_message(LOG_INFO, "Netlink: filter function error");
-				ret = error;
 			}
-
-			if (!(h->nlmsg_flags & NLM_F_MULTI) && !read_all)
-				return ret;
-		}
-
-		/* After error care. */
-		if (msg.msg_flags & MSG_TRUNC) {
-			log_message(LOG_INFO, "Netlink: error: message truncated");
-			continue;
-		}
-		if (status) {
-			log_message(LOG_INFO, "Netlink: error: data remnant size %zd",
-			       status);
-			return -1;
-		}
+			if (status) {
+				log_message(LOG_INFO, "Netlink: error: data remnant size %zd",
+				       status);
+				return -1;
+			}
+			}
 	}
 
 	return ret;
@@ -812,6 +1008,241 @@ netlink_talk(nl_handle_t *nl, struct nlmsghdr *n)
 		netlink_set_nonblock(nl, &flags);
 	return status;
 }
+
+/*
+ * Command channel batching. Requests are copied into a shared buffer
+ * and pushed with a single sendmsg(), then the kernel ACKs are drained
+ * in one pass. Adding or removing a large number of addresses/routes
+ * this way costs a handful of syscalls rather than a synchronous
+ * round-trip per entry.
+ */
+#define NL_BATCH_BUF_SIZE	8192
+#define NL_BATCH_MAX_MSG	64
+
+static char nl_batch_buf[NL_BATCH_BUF_SIZE];
+static size_t nl_batch_len;
+static unsigned nl_batch_count;
+static uint32_t nl_batch_seq[NL_BATCH_MAX_MSG];
+static void *nl_batch_cookie[NL_BATCH_MAX_MSG];
+static void (*nl_batch_cbs[NL_BATCH_MAX_MSG])(void *, int);
+static void (*nl_batch_cb)(void *, int);
+static bool nl_batch_held;
+
+/* Register the per-request completion handler for the next batch.
+ * The handler is invoked once per queued request with the cookie it
+ * was queued with and 0 or the (positive) netlink errno. The handler
+ * is captured per request, so a held batch may span list operations
+ * with different handlers. */
+void
+netlink_batch_begin(void (*cb)(void *, int))
+{
+	nl_batch_cb = cb;
+}
+
+/* Hold the batch open across list operations: netlink_batch_end()
+ * becomes a no-op until netlink_batch_release(), letting the requests
+ * of several instances transitioning on the same tick go out as one
+ * consolidated flush. */
+void
+netlink_batch_hold(void)
+{
+	nl_batch_held = true;
+}
+
+/* Drain the ACK for every request of the current batch */
+static ssize_t
+netlink_batch_recv_acks(nl_handle_t *nl)
+{
+	unsigned acked = 0;
+	unsigned i;
+	ssize_t ret = 0;
+	int error;
+
+	while (acked < nl_batch_count) {
+		char buf[nlmsg_buf_size];
+		struct iovec iov = {
+			.iov_base = buf,
+			.iov_len = sizeof buf
+		};
+		struct sockaddr_nl snl;
+		struct msghdr msg = {
+			.msg_name = &snl,
+			.msg_namelen = sizeof(snl),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = NULL,
+			.msg_controllen = 0,
+			.msg_flags = 0
+		};
+		struct nlmsghdr *h;
+		ssize_t status;
+
+		status = recvmsg(nl->fd, &msg, 0);
+
+		if (status < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				break;
+			log_message(LOG_INFO, "Netlink: recvmsg error - %d (%m)", errno);
+			return -1;
+		}
+
+		if (status == 0) {
+			log_message(LOG_INFO, "Netlink: EOF");
+			return -1;
+		}
+
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, (size_t)status);
+		     h = NLMSG_NEXT(h, status)) {
+			if (h->nlmsg_type != NLMSG_ERROR)
+				continue;
+
+			struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(h);
+
+			/* Match the ACK to its queued request */
+			for (i = 0; i < nl_batch_count; i++)
+				if (nl_batch_seq[i] == h->nlmsg_seq)
+					break;
+			if (i == nl_batch_count)
+				continue;
+			acked++;
+
+			error = -err->error;
+			if (error) {
+				/* Tolerate the same errors netlink_parse_info() does */
+				if (error == EEXIST &&
+				    (err->msg.nlmsg_type == RTM_NEWROUTE ||
+				     err->msg.nlmsg_type == RTM_NEWADDR))
+					error = 0;
+				else if (error == EADDRNOTAVAIL &&
+					 err->msg.nlmsg_type == RTM_DELADDR) {
+					netlink_if_address_filter(NULL, &err->msg);
+					error = 0;
+				}
+				else {
+					if (netlink_error_ignore != error)
+						log_message(LOG_INFO,
+						       "Netlink: error: %s, type=(%u), seq=%u, pid=%d",
+						       strerror(error),
+						       err->msg.nlmsg_type,
+						       err->msg.nlmsg_seq, err->msg.nlmsg_pid);
+					ret = -1;
+				}
+			}
+
+			if (nl_batch_cbs[i])
+				(*nl_batch_cbs[i])(nl_batch_cookie[i], error);
+		}
+	}
+
+	return ret;
+}
+
+/* Send every queued request with a single sendmsg() and process the ACKs */
+static ssize_t
+netlink_batch_flush(nl_handle_t *nl)
+{
+	ssize_t status;
+	int ret, flags;
+	struct sockaddr_nl snl;
+	struct iovec iov = {
+		.iov_base = nl_batch_buf,
+		.iov_len = nl_batch_len
+	};
+	struct msghdr msg = {
+		.msg_name = &snl,
+		.msg_namelen = sizeof(snl),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = NULL,
+		.msg_controllen = 0,
+		.msg_flags = 0
+	};
+	unsigned i;
+
+	if (!nl_batch_count)
+		return 0;
+
+	TRACE_PROBE2(netlink_batch_flush, nl_batch_count, nl_batch_len);
+
+	memset(&snl, 0, sizeof snl);
+	snl.nl_family = AF_NETLINK;
+
+	status = sendmsg(nl->fd, &msg, 0);
+	if (status < 0) {
+		log_message(LOG_INFO, "Netlink: sendmsg() error: %s",
+		       strerror(errno));
+		for (i = 0; i < nl_batch_count; i++)
+			if (nl_batch_cbs[i])
+				(*nl_batch_cbs[i])(nl_batch_cookie[i], errno);
+		nl_batch_len = 0;
+		nl_batch_count = 0;
+		return -1;
+	}
+
+	/* Set blocking flag */
+	ret = netlink_set_block(nl, &flags);
+	if (ret < 0)
+		log_message(LOG_INFO, "Netlink: Warning, couldn't set "
+		       "blocking flag to netlink socket...");
+
+	status = netlink_batch_recv_acks(nl);
+
+	/* Restore previous flags */
+	if (ret == 0)
+		netlink_set_nonblock(nl, &flags);
+
+	nl_batch_len = 0;
+	nl_batch_count = 0;
+
+	return status;
+}
+
+/* Close the current batch. Held batches stay open - the flush happens
+ * on release. */
+ssize_t
+netlink_batch_end(nl_handle_t *nl)
+{
+	if (nl_batch_held)
+		return 0;
+
+	return netlink_batch_flush(nl);
+}
+
+/* Drop the hold and push everything the held batch accumulated */
+ssize_t
+netlink_batch_release(nl_handle_t *nl)
+{
+	nl_batch_held = false;
+
+	return netlink_batch_flush(nl);
+}
+
+/* Queue a request on the current batch, flushing first if it is full */
+ssize_t
+netlink_talk_queue(nl_handle_t *nl, struct nlmsghdr *n, void *cookie)
+{
+	ssize_t ret = 0;
+
+	if (nl_batch_count == NL_BATCH_MAX_MSG ||
+	    nl_batch_len + NLMSG_ALIGN(n->nlmsg_len) > sizeof(nl_batch_buf))
+		ret = netlink_batch_flush(nl);
+
+	n->nlmsg_seq = ++nl->seq;
+
+	/* Request Netlink acknowledgement */
+	n->nlmsg_flags |= NLM_F_ACK;
+
+	memcpy(nl_batch_buf + nl_batch_len, n, n->nlmsg_len);
+	nl_batch_len += NLMSG_ALIGN(n->nlmsg_len);
+	nl_batch_seq[nl_batch_count] = n->nlmsg_seq;
+	nl_batch_cookie[nl_batch_count] = cookie;
+	nl_batch_cbs[nl_batch_count] = nl_batch_cb;
+	nl_batch_count++;
+
+	return ret;
+}
 #endif
 
 /* Fetch a specific type information from netlink kernel */
@@ -865,6 +1296,42 @@ netlink_request(nl_handle_t *nl,
 }
 
 #ifdef _WITH_VRRP_
+/* Fetch the addresses of a single interface. The ifa_index filter is
+ * only honoured by kernels with strict checking enabled on the socket;
+ * others return a full dump, which is merely slower. */
+static int
+netlink_addr_request(nl_handle_t *nl, unsigned char family, ifindex_t ifindex)
+{
+	ssize_t status;
+	struct sockaddr_nl snl;
+	struct {
+		struct nlmsghdr nlh;
+		struct ifaddrmsg ifa;
+	} req;
+
+	/* Cleanup the room */
+	memset(&snl, 0, sizeof (snl));
+	snl.nl_family = AF_NETLINK;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof req.ifa);
+	req.nlh.nlmsg_type = RTM_GETADDR;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_pid = 0;
+	req.nlh.nlmsg_seq = ++nl->seq;
+	req.ifa.ifa_family = family;
+	req.ifa.ifa_index = ifindex;
+
+	status = sendto(nl->fd, (void *) &req, sizeof (req)
+			, 0, (struct sockaddr *) &snl, sizeof (snl));
+	if (status < 0) {
+		log_message(LOG_INFO, "Netlink: sendto() failed: %s",
+		       strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 static int
 netlink_if_link_populate(interface_t *ifp, struct rtattr *tb[], struct ifinfomsg *ifi)
 {
@@ -927,6 +1394,7 @@ netlink_if_link_populate(interface_t *ifp, struct rtattr *tb[], struct ifinfomsg
 			    *(uint32_t*)RTA_DATA(linkattr[IFLA_MACVLAN_MODE]) == MACVLAN_MODE_PRIVATE) {
 				ifp->base_ifindex = *(uint32_t *)RTA_DATA(tb[IFLA_LINK]);
 				ifp->vmac = true;
+				if_vmac_add(ifp);
 			}
 		}
 	}
@@ -977,16 +1445,21 @@ netlink_if_link_filter(__attribute__((unused)) struct sockaddr_nl *snl, struct n
 	name = (char *) RTA_DATA(tb[IFLA_IFNAME]);
 
 	/* Skip it if already exist */
-	ifp = if_get_by_ifname(name);
+	ifp = if_get_by_ifindex((ifindex_t)ifi->ifi_index);
+	if (!ifp)
+		ifp = if_get_by_ifname(name);
 	if (ifp) {
 #ifdef _HAVE_VRRP_VMAC_
-		if (!ifp->vmac)
+		if (!ifp->vmac && ifp->flags != ifi->ifi_flags)
+#else
+		if (ifp->flags != ifi->ifi_flags)
 #endif
 		{
 #ifdef _HAVE_VRRP_VMAC_
 			if_vmac_reflect_flags((ifindex_t)ifi->ifi_index, ifi->ifi_flags);
 #endif
 			ifp->flags = ifi->ifi_flags;
+			vrrp_track_interface_update(ifp);
 		}
 		return 0;
 	}
@@ -1025,6 +1498,49 @@ end_int:
 	netlink_close(&nlh);
 	return status;
 }
+
+/* Combined interface and address lookup bootstrap function.
+ * Both dumps are requested up front on separate sockets, so the kernel
+ * starts preparing the address dump while the link reply is being
+ * processed, and a single AF_UNSPEC request replaces the sequential
+ * per-family address dumps. The link reply is processed first since
+ * the addresses attach to the interfaces it creates. */
+int
+netlink_interface_address_lookup(void)
+{
+	nl_handle_t nl_link;
+	nl_handle_t nl_addr;
+	int status = 0;
+
+	if (netlink_socket(&nl_link, 0, 0) < 0)
+		return -1;
+
+	if (netlink_socket(&nl_addr, 0, 0) < 0) {
+		netlink_close(&nl_link);
+		return -1;
+	}
+
+	/* Queue both dump requests before processing either reply */
+	if (netlink_request(&nl_link, AF_PACKET, RTM_GETLINK, NULL) < 0 ||
+	    netlink_request(&nl_addr, AF_UNSPEC, RTM_GETADDR, NULL) < 0) {
+		status = -1;
+		goto end_lookup;
+	}
+
+	/* Interface lookup */
+	if (netlink_parse_info(netlink_if_link_filter, &nl_link, NULL, false) < 0) {
+		status = -1;
+		goto end_lookup;
+	}
+
+	/* Address lookup, both families in one dump */
+	status = netlink_parse_info(netlink_if_address_filter, &nl_addr, NULL, false);
+
+end_lookup:
+	netlink_close(&nl_link);
+	netlink_close(&nl_addr);
+	return status;
+}
 #endif
 
 /* Addresses lookup bootstrap function */
@@ -1056,6 +1572,68 @@ end_addr:
 	return status;
 }
 
+#if !defined _DEBUG_ && defined _WITH_VRRP_ && defined _WITH_LVS_
+/* Drain the shared address-event ring. Runs in the checker process */
+static int
+netlink_shared_event_thread(__attribute__((unused)) thread_t *thread)
+{
+	nl_shared_event_t ev;
+	uint32_t head;
+	uint64_t cnt;
+
+	if (read(nl_shared_efd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+		log_message(LOG_INFO, "Read from shared netlink event doorbell failed (%s)", strerror(errno));
+
+	while (nl_shared_tail != (head = __atomic_load_n(&nl_shared->head, __ATOMIC_ACQUIRE))) {
+		if (head - nl_shared_tail > NL_SHARED_RING_SIZE) {
+			/* The producer lapped us - events were lost, so
+			 * re-read the address state from the kernel */
+			log_message(LOG_INFO, "Shared netlink event ring overrun - re-reading addresses");
+			nl_shared_tail = __atomic_load_n(&nl_shared->head, __ATOMIC_ACQUIRE);
+			netlink_address_lookup();
+			continue;
+		}
+
+		ev = nl_shared->ring[nl_shared_tail & (NL_SHARED_RING_SIZE - 1)];
+
+		/* If the producer wrapped onto the slot while we were
+		 * copying it the copy is torn - the check above takes
+		 * the overrun path on the next iteration */
+		if (__atomic_load_n(&nl_shared->head, __ATOMIC_ACQUIRE) - nl_shared_tail > NL_SHARED_RING_SIZE)
+			continue;
+
+		nl_shared_tail++;
+		update_checker_activity(ev.family, ev.addr, (ev.up == 1));
+	}
+
+	/* The persistent read registration stays armed */
+	return 0;
+}
+
+/* Start consuming address events from the vrrp process instead of
+ * running our own netlink reflection. Runs in the checker process;
+ * returns false when the shared channel isn't available, in which case
+ * the caller falls back to its own kernel channel */
+bool
+netlink_shared_consumer_init(void)
+{
+	if (!nl_shared)
+		return false;
+
+	/* Snapshot the cursor before the bootstrap dump, so any events
+	 * the vrrp process publishes while we dump are replayed
+	 * afterwards rather than lost */
+	nl_shared_tail = __atomic_load_n(&nl_shared->head, __ATOMIC_ACQUIRE);
+
+	netlink_address_lookup();
+
+	log_message(LOG_INFO, "Registering shared netlink event channel");
+	thread_add_read_persistent(master, netlink_shared_event_thread, NULL, nl_shared_efd, TIMER_NEVER);
+
+	return true;
+}
+#endif
+
 #ifdef _WITH_VRRP_
 /* Netlink flag Link update */
 static int
@@ -1099,11 +1677,13 @@ netlink_reflect_filter(__attribute__((unused)) struct sockaddr_nl *snl, struct n
 				memset(ifp, 0, sizeof(interface_t));
 			}
 			status = netlink_if_link_populate(ifp, tb, ifi);
-			if (status < 0)
+			if (status < 0) {
+				/* Retry on the next re-sync pass */
+				ifp->nl_stale = true;
 				return -1;
+			}
 		} else {
-			if (__test_bit(LOG_DETAIL_BIT, &debug))
-				log_message(LOG_INFO, "Unknown interface %s deleted", (char *)tb[IFLA_IFNAME]);
+			log_debug(LOG_SUBSYS_NETLINK, "Unknown interface %s deleted", (char *)tb[IFLA_IFNAME]);
 			return 0;
 		}
 	}
@@ -1114,13 +1694,17 @@ netlink_reflect_filter(__attribute__((unused)) struct sockaddr_nl *snl, struct n
 	 * by the base interface flags.
 	 */
 #ifdef _HAVE_VRRP_VMAC_
-	if (!ifp->vmac)
+	if (!ifp->vmac && ifp->flags != ifi->ifi_flags)
 	{
 		if_vmac_reflect_flags(ifp->ifindex, ifi->ifi_flags);
 		ifp->flags = ifi->ifi_flags;
+		if_linkbeat_reflect(ifp, ifi->ifi_flags);
+		vrrp_track_interface_update(ifp);
 	}
 #else
 	ifp->flags = ifi->ifi_flags;
+	if_linkbeat_reflect(ifp, ifi->ifi_flags);
+	vrrp_track_interface_update(ifp);
 #endif
 
 	return 0;
@@ -1156,9 +1740,14 @@ kernel_netlink(thread_t * thread)
 {
 	nl_handle_t *nl = THREAD_ARG(thread);
 
-	if (thread->type != THREAD_READ_TIMEOUT)
+	if (thread->type != THREAD_READ_TIMEOUT) {
 		netlink_parse_info(netlink_broadcast_filter, nl, NULL, true);
-	nl->thread = thread_add_read(master, kernel_netlink, nl, nl->fd,
+		/* The persistent read registration stays armed */
+		return 0;
+	}
+
+	/* The timeout tore the registration down - re-register */
+	nl->thread = thread_add_read_persistent(master, kernel_netlink, nl, nl->fd,
 				      NETLINK_TIMER);
 	return 0;
 }
@@ -1177,8 +1766,13 @@ kernel_netlink_poll(void)
 void
 kernel_netlink_init(void)
 {
-	/* Start with a netlink address lookup */
-	netlink_address_lookup();
+	/* Start with a netlink address lookup, unless the VRRP process
+	 * has already loaded the addresses with the interface bootstrap
+	 * dump in init_interface_queue(). */
+#if !defined _DEBUG_ && defined _WITH_VRRP_
+	if (prog_type != PROG_TYPE_VRRP)
+#endif
+		netlink_address_lookup();
 
 	/*
 	 * Prepare netlink kernel broadcast channel
@@ -1204,7 +1798,7 @@ kernel_netlink_init(void)
 
 	if (nl_kernel.fd > 0) {
 		log_message(LOG_INFO, "Registering Kernel netlink reflector");
-		nl_kernel.thread = thread_add_read(master, kernel_netlink, &nl_kernel, nl_kernel.fd,
+		nl_kernel.thread = thread_add_read_persistent(master, kernel_netlink, &nl_kernel, nl_kernel.fd,
 						   NETLINK_TIMER);
 	} else
 		log_message(LOG_INFO, "Error while registering Kernel netlink reflector channel");
@@ -1227,7 +1821,10 @@ kernel_netlink_init(void)
 void
 kernel_netlink_close(void)
 {
-	netlink_close(&nl_kernel);
+	/* The checker skips opening the kernel channel when it consumes
+	 * the vrrp process's shared event ring instead */
+	if (nl_kernel.fd > 0)
+		netlink_close(&nl_kernel);
 #ifdef _WITH_VRRP_
 #ifndef _DEBUG_
 	if (prog_type == PROG_TYPE_VRRP)
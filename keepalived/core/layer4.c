@@ -23,10 +23,22 @@
 
 #include "config.h"
 
+#include <netinet/tcp.h>
+
 #include "layer4.h"
 #include "utils.h"
 #include "logger.h"
 
+/* Linux 4.11+, may be missing from older toolchain headers */
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT	30
+#endif
+
+/* Linux 2.6.37+, may be missing from older toolchain headers */
+#ifndef TCP_USER_TIMEOUT
+#define TCP_USER_TIMEOUT	18
+#endif
+
 #ifndef _WITH_LVS_
 static
 #endif
@@ -38,7 +50,6 @@ socket_bind_connect(int fd, conn_opts_t *co)
 	struct linger li;
 	socklen_t addrlen;
 	int ret;
-	int val;
 	struct sockaddr_storage *addr = &co->dst;
 	struct sockaddr_storage *bind_addr = &co->bindto;
 
@@ -52,11 +63,41 @@ socket_bind_connect(int fd, conn_opts_t *co)
 		li.l_onoff = 1;
 		li.l_linger = 0;
 		setsockopt(fd, SOL_SOCKET, SO_LINGER, (char *) &li, sizeof (struct linger));
+
+		if (co->fast_open) {
+			/* Defer the SYN until the first write, which then
+			 * carries the request data when a fast open cookie is
+			 * cached for the destination. Not fatal when the
+			 * kernel doesn't support it. */
+			opt = 1;
+			if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &opt, sizeof(opt)) < 0)
+				log_message(LOG_INFO, "Checker can't enable TCP fast open: %s", strerror(errno));
+		}
+
+		if (co->connection_to) {
+			/* Offload the connect timeout to the kernel: cap the
+			 * SYN retransmits and set the overall user timeout so
+			 * an unreachable server comes back as an ETIMEDOUT
+			 * event on the socket at the configured moment,
+			 * instead of every probe carrying its own timer entry
+			 * in the scheduler. */
+			unsigned sec = (co->connection_to + TIMER_HZ - 1) / TIMER_HZ;
+
+			/* Smallest retransmit count whose exponential backoff
+			 * (1+2+4+... seconds) covers the timeout */
+			opt = 1;
+			while (sec > (1U << (opt + 1)) - 1 && opt < 8)
+				opt++;
+			setsockopt(fd, IPPROTO_TCP, TCP_SYNCNT, &opt, sizeof(opt));
+
+			opt = (int)(co->connection_to / (TIMER_HZ / 1000));	/* milliseconds */
+			co->kernel_to = setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &opt, sizeof(opt)) == 0;
+		}
 	}
 
-	/* Make socket non-block. */
-	val = fcntl(fd, F_GETFL, 0);
-	fcntl(fd, F_SETFL, val | O_NONBLOCK);
+	/* The callers create their sockets with SOCK_NONBLOCK, so the
+	 * connect below returns without blocking and there is no flag
+	 * juggling to do around it. */
 
 #ifdef _WITH_SO_MARK_
 	if (co->fwmark) {
@@ -88,10 +129,8 @@ socket_bind_connect(int fd, conn_opts_t *co)
 	ret = connect(fd, (struct sockaddr *) addr, addrlen);
 
 	/* Immediate success */
-	if (ret == 0) {
-		fcntl(fd, F_SETFL, val);
+	if (ret == 0)
 		return connect_success;
-	}
 
 	/* If connect is in progress then return 1 else it's real error. */
 	if (ret < 0) {
@@ -101,8 +140,6 @@ socket_bind_connect(int fd, conn_opts_t *co)
 		}
 	}
 
-	/* restore previous fd args */
-	fcntl(fd, F_SETFL, val);
 	return connect_in_progress;
 }
 
@@ -146,13 +183,19 @@ socket_state(thread_t * thread, int (*func) (thread_t *))
 	 * Recompute the write timeout (or pending connection).
 	 */
 	if (status == EINPROGRESS) {
-		timer_min = timer_sub_now(thread->sands);
-		thread_add_write(thread->master, func, THREAD_ARG(thread),
-				 thread->u.fd, -timer_long(timer_min));
+		if (thread->timer == TIMER_NEVER)
+			thread_add_write(thread->master, func, THREAD_ARG(thread),
+					 thread->u.fd, TIMER_NEVER);
+		else {
+			timer_min = timer_sub_now(thread->sands);
+			thread_add_write(thread->master, func, THREAD_ARG(thread),
+					 thread->u.fd, -timer_long(timer_min));
+		}
 		return connect_in_progress;
 	} else if (status != 0) {
 		close(thread->u.fd);
-		return connect_error;
+		/* A kernel-armed connect timeout surfaces here */
+		return status == ETIMEDOUT ? connect_timeout : connect_error;
 	}
 
 	return connect_success;
@@ -161,12 +204,22 @@ socket_state(thread_t * thread, int (*func) (thread_t *))
 #ifdef _WITH_LVS_
 int
 socket_connection_state(int fd, enum connect_result status, thread_t * thread,
-		     int (*func) (thread_t *), unsigned long timeout)
+		     int (*func) (thread_t *), conn_opts_t *co)
 {
+	unsigned long timeout;
 	void *checker;
 
 	checker = THREAD_ARG(thread);
 
+	/* Timestamp the probe so the adaptive timeout estimator can
+	 * sample its response time when it concludes */
+	co->probe_start = timer_long(time_now);
+
+	/* When the kernel is armed to time the connect out, the failure
+	 * arrives as an event on the socket and the write thread needs no
+	 * timer entry of its own. */
+	timeout = co->kernel_to ? TIMER_NEVER : co->connection_to;
+
 	switch (status) {
 	case connect_success:
 		thread_add_write(thread->master, func, checker, fd, timeout);
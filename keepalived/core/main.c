@@ -46,9 +46,11 @@
 #include "notify.h"
 #ifdef _WITH_LVS_
 #include "check_parser.h"
+#include "check_daemon.h"
 #endif
 #ifdef _WITH_VRRP_
 #include "vrrp_parser.h"
+#include "vrrp_daemon.h"
 #ifdef _WITH_JSON_
 #include "vrrp_json.h"
 #endif
@@ -296,6 +298,14 @@ stop_keepalived(void)
 static void
 start_keepalived(void)
 {
+#if !defined _DEBUG_ && defined _WITH_VRRP_ && defined _WITH_LVS_
+	/* When both children run, the vrrp process feeds address events
+	 * to the checker through a shared ring, rather than each child
+	 * running its own netlink reflection. Both inherit the mapping
+	 * and doorbell from us across the fork */
+	if (__test_bit(DAEMON_VRRP, &daemon_mode) && __test_bit(DAEMON_CHECKERS, &daemon_mode))
+		netlink_shared_create();
+#endif
 #ifdef _WITH_LVS_
 	/* start healthchecker child */
 	if (__test_bit(DAEMON_CHECKERS, &daemon_mode))
@@ -378,12 +388,14 @@ sigend(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
 	thread_add_terminate_event(master);
 
 	log_message(LOG_INFO, "Stopping");
+
+	/* SIGCHLD is normally blocked for delivery via the signalfd;
+	 * make sure it is blocked here so we can sigtimedwait() it */
+	sigemptyset(&child_wait);
+	sigaddset(&child_wait, SIGCHLD);
 	sigprocmask(0, NULL, &old_set);
-	if (!sigismember(&old_set, SIGCHLD)) {
-		sigemptyset(&child_wait);
-		sigaddset(&child_wait, SIGCHLD);
+	if (!sigismember(&old_set, SIGCHLD))
 		sigprocmask(SIG_BLOCK, &child_wait, NULL);
-	}
 
 #ifdef _WITH_VRRP_
 	if (vrrp_child > 0) {
@@ -547,6 +559,8 @@ usage(const char *prog)
 	fprintf(stderr, "  -g, --log-file=FILE          Also log to FILE (default /tmp/keepalived.log)\n");
 	fprintf(stderr, "      --flush-log-file         Flush log file on write\n");
 	fprintf(stderr, "  -G, --no-syslog              Don't log via syslog\n");
+	fprintf(stderr, "      --log-async              Send syslog messages without blocking, dropping on overflow\n");
+	fprintf(stderr, "      --log-journal            Send native structured records to systemd-journald\n");
 #ifdef _WITH_VRRP_
 	fprintf(stderr, "  -X, --release-vips           Drop VIP on transition from signal.\n");
 	fprintf(stderr, "  -V, --dont-release-vrrp      Don't remove VRRP VIPs and VROUTEs on daemon stop\n");
@@ -557,6 +571,7 @@ usage(const char *prog)
 	fprintf(stderr, "  -R, --dont-respawn           Don't respawn child processes\n");
 	fprintf(stderr, "  -n, --dont-fork              Don't fork the daemon process\n");
 	fprintf(stderr, "  -d, --dump-conf              Dump the configuration data\n");
+	fprintf(stderr, "  -t, --config-test            Check the configuration for errors and exit\n");
 	fprintf(stderr, "  -p, --pid=FILE               Use specified pidfile for parent process\n");
 #ifdef _WITH_VRRP_
 	fprintf(stderr, "  -r, --vrrp_pid=FILE          Use specified pidfile for VRRP child process\n");
@@ -612,6 +627,8 @@ parse_cmdline(int argc, char **argv)
 		{"log-facility",	required_argument,	NULL, 'S'},
 		{"log-file",		optional_argument,	NULL, 'g'},
 		{"flush-log-file",	no_argument,		NULL,  2 },
+		{"log-async",		no_argument,		NULL,  3 },
+		{"log-journal",		no_argument,		NULL,  5 },
 		{"no-syslog",		no_argument,		NULL, 'G'},
 #ifdef _WITH_VRRP_
 		{"release-vips",	no_argument,		NULL, 'X'},
@@ -623,6 +640,7 @@ parse_cmdline(int argc, char **argv)
 		{"dont-respawn",	no_argument,		NULL, 'R'},
 		{"dont-fork",		no_argument,		NULL, 'n'},
 		{"dump-conf",		no_argument,		NULL, 'd'},
+		{"config-test",		no_argument,		NULL, 't'},
 		{"pid",			required_argument,	NULL, 'p'},
 #ifdef _WITH_VRRP_
 		{"vrrp_pid",		required_argument,	NULL, 'r'},
@@ -655,7 +673,7 @@ parse_cmdline(int argc, char **argv)
 	 * of longindex, so we need to ensure that before calling getopt_long(), longindex
 	 * is set to a know invalid value */
 	curind = optind;
-	while (longindex = -1, (c = getopt_long(argc, argv, ":vhlndDRS:f:p:i:mM::g::G"
+	while (longindex = -1, (c = getopt_long(argc, argv, ":vhlndtDRS:f:p:i:mM::g::G"
 #if defined _WITH_VRRP_ && defined _WITH_LVS_
 					    "PC"
 #endif
@@ -713,6 +731,13 @@ parse_cmdline(int argc, char **argv)
 		case 'd':
 			__set_bit(DUMP_CONF_BIT, &debug);
 			break;
+		case 't':
+			__set_bit(CONFIG_TEST_BIT, &debug);
+			__set_bit(DONT_FORK_BIT, &debug);
+			__set_bit(LOG_CONSOLE_BIT, &debug);
+			__set_bit(NO_SYSLOG_BIT, &debug);
+			reopen_log = true;
+			break;
 #ifdef _WITH_VRRP_
 		case 'V':
 			__set_bit(DONT_RELEASE_VRRP_BIT, &debug);
@@ -725,6 +750,7 @@ parse_cmdline(int argc, char **argv)
 #endif
 		case 'D':
 			__set_bit(LOG_DETAIL_BIT, &debug);
+			log_subsys_set_level("all", "debug");
 			break;
 		case 'R':
 			__set_bit(DONT_RESPAWN_BIT, &debug);
@@ -755,6 +781,12 @@ parse_cmdline(int argc, char **argv)
 		case 2:		/* --flush-log-file */
 			set_flush_log_file();
 			break;
+		case 3:		/* --log-async */
+			__set_bit(LOG_ASYNC_BIT, &debug);
+			break;
+		case 5:		/* --log-journal */
+			__set_bit(LOG_JOURNAL_BIT, &debug);
+			break;
 #if defined _WITH_VRRP_ && defined _WITH_LVS_
 		case 'P':
 			daemon_mode = 0;
@@ -857,6 +889,33 @@ parse_cmdline(int argc, char **argv)
 	return reopen_log;
 }
 
+/* Validate-only mode: parse and cross-check the configuration in full
+ * - sync group membership, vsg links, interface existence - with no
+ * kernel side effects, then exit. Lets a CI pipeline or an operator
+ * reject a bad candidate config before it ever reaches a reload. */
+static void __attribute__ ((noreturn))
+config_test(void)
+{
+	bool valid = true;
+
+#ifdef _WITH_VRRP_
+	if (__test_bit(DAEMON_VRRP, &daemon_mode) && !vrrp_validate_config())
+		valid = false;
+#endif
+#ifdef _WITH_LVS_
+	if (__test_bit(DAEMON_CHECKERS, &daemon_mode) && !check_validate_config())
+		valid = false;
+#endif
+
+	if (!valid) {
+		log_message(LOG_INFO, "Configuration check failed");
+		exit(KEEPALIVED_EXIT_CONFIG);
+	}
+
+	log_message(LOG_INFO, "Configuration check succeeded");
+	exit(EXIT_SUCCESS);
+}
+
 /* Entry point */
 int
 keepalived_main(int argc, char **argv)
@@ -930,6 +989,12 @@ keepalived_main(int argc, char **argv)
 			openlog(PACKAGE_NAME, LOG_PID | ((__test_bit(LOG_CONSOLE_BIT, &debug)) ? LOG_CONS : 0) , log_facility);
 	}
 
+	if (__test_bit(LOG_ASYNC_BIT, &debug) && !__test_bit(NO_SYSLOG_BIT, &debug))
+		enable_async_log(PACKAGE_NAME, log_facility);
+
+	if (__test_bit(LOG_JOURNAL_BIT, &debug) && !__test_bit(NO_SYSLOG_BIT, &debug))
+		enable_journal_log(PACKAGE_NAME, log_facility);
+
 	if (__test_bit(LOG_CONSOLE_BIT, &debug))
 		enable_console_log();
 
@@ -994,6 +1059,10 @@ keepalived_main(int argc, char **argv)
 			log_message(LOG_INFO, "Changing syslog ident to %s", syslog_ident);
 			closelog();
 			openlog(syslog_ident, LOG_PID | ((__test_bit(LOG_CONSOLE_BIT, &debug)) ? LOG_CONS : 0), log_facility);
+			if (__test_bit(LOG_ASYNC_BIT, &debug))
+				enable_async_log(syslog_ident, log_facility);
+			if (__test_bit(LOG_JOURNAL_BIT, &debug))
+				enable_journal_log(syslog_ident, log_facility);
 		}
 		else
 			log_message(LOG_INFO, "Unable to change syslog ident");
@@ -1017,6 +1086,11 @@ keepalived_main(int argc, char **argv)
 	}
 #endif
 
+	/* Configuration check only - never gets as far as pidfiles,
+	 * daemonizing or forking the children */
+	if (__test_bit(CONFIG_TEST_BIT, &debug))
+		config_test();
+
 	if (instance_name) {
 		if (!main_pidfile && (main_pidfile = make_pidfile_name(KEEPALIVED_PID_DIR KEEPALIVED_PID_FILE, instance_name, PID_EXTENSION)))
 			free_main_pidfile = true;
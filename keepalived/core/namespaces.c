@@ -167,6 +167,7 @@
 #include <sys/types.h>
 #include <stdio.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
@@ -192,6 +193,7 @@ int setns(int fd, int nstype)
 }
 #endif
 
+#include "namespaces.h"
 #include "memory.h"
 #include "logger.h"
 #include "pidfile.h"
@@ -303,3 +305,49 @@ clear_namespaces(void)
 {
 	unmount_run();
 }
+
+/* Create a socket inside the named network namespace, then return to
+ * our own namespace. A socket keeps the namespace it was created in
+ * for its whole life, so this is all that is needed to multiplex
+ * sockets from several namespaces on one scheduler. */
+int
+socket_netns(const char *net_namespace, int domain, int type, int protocol)
+{
+	static int own_ns_fd = -1;
+	char netns_path[sizeof("/var/run/netns/") + NETNS_NAME_SIZE];
+	int ns_fd;
+	int fd;
+	int sav_errno;
+
+	if (!net_namespace || !net_namespace[0])
+		return socket(domain, type, protocol);
+
+	if (own_ns_fd == -1 &&
+	    (own_ns_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC)) == -1) {
+		log_message(LOG_INFO, "Failed to open own network namespace - errno %d", errno);
+		return -1;
+	}
+
+	snprintf(netns_path, sizeof(netns_path), "%s%s", netns_dir, net_namespace);
+	ns_fd = open(netns_path, O_RDONLY | O_CLOEXEC);
+	if (ns_fd == -1) {
+		log_message(LOG_INFO, "Failed to open %s", netns_path);
+		return -1;
+	}
+
+	if (setns(ns_fd, CLONE_NEWNET)) {
+		log_message(LOG_INFO, "setns(%s) failed with error %d", net_namespace, errno);
+		close(ns_fd);
+		return -1;
+	}
+	close(ns_fd);
+
+	fd = socket(domain, type, protocol);
+	sav_errno = errno;
+
+	if (setns(own_ns_fd, CLONE_NEWNET))
+		log_message(LOG_INFO, "Failed to return to own network namespace - errno %d", errno);
+
+	errno = sav_errno;
+	return fd;
+}
@@ -24,6 +24,7 @@
 
 #include <sys/mman.h>
 #include <sys/resource.h>
+#include <sched.h>
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
@@ -57,3 +58,31 @@ set_process_priority(int priority)
 			log_message(LOG_INFO, "Unable to set process priority to %d - %s", priority, strerror(errno));
 	}
 }
+
+/* Pin the process to the configured CPU set. Keeping the vrrp process
+ * away from the CPUs handling IRQs and the checkers removes the advert
+ * jitter that sharing a runqueue with them causes. */
+void
+set_process_cpu_affinity(unsigned long mask, const char *process)
+{
+	cpu_set_t cpus;
+	unsigned cpu;
+
+	CPU_ZERO(&cpus);
+	for (cpu = 0; cpu < sizeof(mask) * CHAR_BIT; cpu++) {
+		if (mask & (1UL << cpu))
+			CPU_SET(cpu, &cpus);
+	}
+
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+		log_message(LOG_INFO, "Unable to set %s process cpu affinity 0x%lx - %s", process, mask, strerror(errno));
+}
+
+void
+set_process_realtime_priority(int policy, unsigned priority, const char *process)
+{
+	struct sched_param param = { .sched_priority = (int)priority };
+
+	if (sched_setscheduler(0, policy, &param) == -1)
+		log_message(LOG_INFO, "Unable to set %s process realtime priority %u - %s", process, priority, strerror(errno));
+}
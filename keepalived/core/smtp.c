@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <time.h>
+#include <unistd.h>
 
 #include "smtp.h"
 #include "global_data.h"
@@ -62,6 +63,21 @@ static int quit_code(thread_t *, int);
 
 static int smtp_read_thread(thread_t *);
 static int smtp_send_thread(thread_t *);
+static int smtp_drain_thread(thread_t *);
+
+/* Queued alert message */
+typedef struct _smtp_alert_msg {
+	char		*subject;
+	char		*body;
+} smtp_alert_msg_t;
+
+/* Alerts are queued here and drained sequentially over a single
+ * connection, rather than opening one connection per alert. A burst of
+ * alerts accumulated during the coalesce window, or while a previous
+ * message is being sent, is grouped into one digest message. */
+static list smtp_alert_queue;
+static bool smtp_connection_active;
+static bool smtp_drain_pending;
 
 struct {
 	int (*send) (thread_t *);
@@ -81,6 +97,16 @@ struct {
 	{quit_cmd,			quit_code}		/* QUIT */
 };
 
+static void
+free_smtp_alert_msg(void *data)
+{
+	smtp_alert_msg_t *msg = data;
+
+	FREE(msg->subject);
+	FREE(msg->body);
+	FREE(msg);
+}
+
 static void
 free_smtp_all(smtp_t * smtp)
 {
@@ -89,6 +115,67 @@ free_smtp_all(smtp_t * smtp)
 	FREE(smtp->body);
 	FREE(smtp->email_to);
 	FREE(smtp);
+
+	/* If alerts were queued while this connection was active,
+	 * arrange for them to be sent */
+	smtp_connection_active = false;
+	if (!LIST_ISEMPTY(smtp_alert_queue) && !smtp_drain_pending) {
+		smtp_drain_pending = true;
+		thread_add_timer(master, smtp_drain_thread, NULL, SMTP_ALERT_COALESCE_DELAY);
+	}
+}
+
+/* Load the next message into the smtp buffers, consuming the queue.
+ * A single queued alert is sent as is. If a burst has accumulated, the
+ * alerts are coalesced into one digest message - far cheaper for both
+ * us and the relay than a message per alert. */
+static bool
+smtp_load_message(smtp_t * smtp)
+{
+	smtp_alert_msg_t *msg;
+	element e;
+	unsigned num_alerts;
+	size_t offs = 0;
+	int len;
+
+	if (LIST_ISEMPTY(smtp_alert_queue))
+		return false;
+
+	num_alerts = (unsigned)LIST_SIZE(smtp_alert_queue);
+
+	if (num_alerts == 1) {
+		msg = ELEMENT_DATA(LIST_HEAD(smtp_alert_queue));
+		strncpy(smtp->subject, msg->subject, MAX_HEADERS_LENGTH - 1);
+		smtp->subject[MAX_HEADERS_LENGTH - 1] = '\0';
+		strncpy(smtp->body, msg->body, MAX_BODY_LENGTH - 1);
+		smtp->body[MAX_BODY_LENGTH - 1] = '\0';
+	} else {
+		if (global_data->router_id)
+			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "[%s] %u grouped alerts"
+					      , global_data->router_id
+					      , num_alerts);
+		else
+			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "%u grouped alerts", num_alerts);
+
+		smtp->body[0] = '\0';
+		for (e = LIST_HEAD(smtp_alert_queue); e; ELEMENT_NEXT(e)) {
+			msg = ELEMENT_DATA(e);
+
+			len = snprintf(smtp->body + offs, MAX_BODY_LENGTH - offs,
+				       "%s\n%s\n\n", msg->subject, msg->body);
+			if (len < 0 || (size_t)len >= MAX_BODY_LENGTH - offs) {
+				/* Truncated - the subject carries the full count */
+				smtp->body[offs] = '\0';
+				break;
+			}
+			offs += (size_t)len;
+		}
+	}
+
+	free_list_elements(smtp_alert_queue);
+	smtp->email_it = 0;
+
+	return true;
 }
 
 static char *
@@ -545,7 +632,13 @@ body_code(thread_t * thread, int status)
 
 	if (status == 250) {
 		log_message(LOG_INFO, "SMTP alert successfully sent.");
-		smtp->stage++;
+		/* If alerts were queued while we were sending, reuse the
+		 * connection for the next message rather than opening a
+		 * fresh one */
+		if (smtp_load_message(smtp))
+			smtp->stage = MAIL;
+		else
+			smtp->stage++;
 	} else {
 		log_message(LOG_INFO, "Error processing DOT cmd on SMTP server %s."
 				      " SMTP status code = %d"
@@ -604,6 +697,146 @@ smtp_connect(smtp_t * smtp)
 	thread_add_event(master, SMTP_FSM[status].send, smtp, smtp->fd);
 }
 
+/* Drain the alert queue - runs once the coalesce window has expired */
+static int
+smtp_drain_thread(__attribute__((unused)) thread_t * thread)
+{
+	smtp_t *smtp;
+
+	smtp_drain_pending = false;
+
+	if (smtp_connection_active || LIST_ISEMPTY(smtp_alert_queue))
+		return 0;
+
+	/* allocate & initialize smtp argument data structure */
+	smtp = (smtp_t *) MALLOC(sizeof(smtp_t));
+	smtp->subject = (char *) MALLOC(MAX_HEADERS_LENGTH);
+	smtp->body = (char *) MALLOC(MAX_BODY_LENGTH);
+	smtp->buffer = (char *) MALLOC(SMTP_BUFFER_MAX);
+	smtp->email_to = (char *) MALLOC(SMTP_BUFFER_MAX);
+
+	smtp_load_message(smtp);
+	build_to_header_rcpt_addrs(smtp);
+
+#ifdef _SMTP_ALERT_DEBUG_
+	FILE *fp = fopen("/tmp/smtp-alert.log", "a");
+	struct tm tm;
+	char time_buf[25];
+	int time_buf_len;
+
+	localtime_r(&time_now.tv_sec, &tm);
+	time_buf_len = strftime(time_buf, sizeof time_buf, "%a %b %e %X %Y", &tm);
+
+	fprintf(fp, "%s: %s -> %s\n"
+		    "%*sSubject: %s\n"
+		    "%*sBody:    %s\n\n",
+		    time_buf, global_data->email_from, smtp->email_to,
+		    time_buf_len - 7, "", smtp->subject,
+		    time_buf_len - 7, "", smtp->body);
+
+	fclose(fp);
+
+	free_smtp_all(smtp);
+	return 0;
+#endif
+
+	smtp_connection_active = true;
+	smtp_connect(smtp);
+
+	return 0;
+}
+
+/* SMTP server name resolution. getaddrinfo() blocks for the resolver
+ * timeout when the DNS server is slow or unreachable, which would stall
+ * the event loop and stop adverts, so the lookup runs in a short-lived
+ * child process and the result comes back over a pipe. The name is
+ * re-resolved periodically so an smtp_server that moves behind a stable
+ * name is picked up without a reload. */
+#define SMTP_RESOLVE_TIMEOUT	(10 * TIMER_HZ)
+#define SMTP_RESOLVE_RETRY	(30 * TIMER_HZ)
+#define SMTP_RESOLVE_INTERVAL	(300 * TIMER_HZ)
+
+static int smtp_resolve_thread(thread_t *);
+
+static int
+smtp_resolve_read_thread(thread_t * thread)
+{
+	struct sockaddr_storage addr;
+	ssize_t len = -1;
+	unsigned long next = SMTP_RESOLVE_INTERVAL;
+
+	if (thread->type != THREAD_READ_TIMEOUT)
+		len = read(thread->u.fd, &addr, sizeof(addr));
+	close(thread->u.fd);
+
+	if (len == (ssize_t)sizeof(addr) && addr.ss_family) {
+		if (!global_data->smtp_server.ss_family)
+			log_message(LOG_INFO, "SMTP server %s resolved to %s",
+				    global_data->smtp_server_name, inet_sockaddrtos(&addr));
+		global_data->smtp_server = addr;
+	} else {
+		log_message(LOG_INFO, "SMTP server %s could not be resolved%s",
+			    global_data->smtp_server_name,
+			    global_data->smtp_server.ss_family ? ", keeping previous address" : "");
+		next = SMTP_RESOLVE_RETRY;
+	}
+
+	thread_add_timer(master, smtp_resolve_thread, NULL, next);
+	return 0;
+}
+
+static int
+smtp_resolve_thread(__attribute__((unused)) thread_t * thread)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) == -1) {
+		log_message(LOG_INFO, "SMTP resolver pipe error %d - %s", errno, strerror(errno));
+		thread_add_timer(master, smtp_resolve_thread, NULL, SMTP_RESOLVE_RETRY);
+		return 0;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		log_message(LOG_INFO, "SMTP resolver fork error %d - %s", errno, strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		thread_add_timer(master, smtp_resolve_thread, NULL, SMTP_RESOLVE_RETRY);
+		return 0;
+	}
+
+	if (!pid) {
+		/* Child - the blocking lookup happens here. An unresolvable
+		 * name exits without writing, which the parent sees as EOF. */
+		struct sockaddr_storage addr;
+
+		memset(&addr, 0, sizeof(addr));
+		if (domain_stosockaddr(global_data->smtp_server_name,
+				       global_data->smtp_server_port, &addr) == 0 &&
+		    write(fds[1], &addr, sizeof(addr)) != sizeof(addr)) {
+			/* Nothing the child can usefully do about it */
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	thread_add_read(master, smtp_resolve_read_thread, NULL, fds[0], SMTP_RESOLVE_TIMEOUT);
+	return 0;
+}
+
+/* Kick off deferred smtp_server name resolution once the scheduler is
+ * available. Reloads clean the thread master, so each (re)start queues
+ * a fresh resolution cycle. */
+void
+smtp_start_resolver(void)
+{
+	if (!global_data->smtp_server_name)
+		return;
+
+	thread_add_event(master, smtp_resolve_thread, NULL, 0);
+}
+
 /* Main entry point */
 void
 smtp_alert(
@@ -619,21 +852,19 @@ smtp_alert(
 #endif
 	   const char *subject, const char *body)
 {
-	smtp_t *smtp;
+	smtp_alert_msg_t *msg;
 
 	/* Only send mail if email specified */
 	if (!LIST_ISEMPTY(global_data->email) && global_data->smtp_server.ss_family != 0) {
-		/* allocate & initialize smtp argument data structure */
-		smtp = (smtp_t *) MALLOC(sizeof(smtp_t));
-		smtp->subject = (char *) MALLOC(MAX_HEADERS_LENGTH);
-		smtp->body = (char *) MALLOC(MAX_BODY_LENGTH);
-		smtp->buffer = (char *) MALLOC(SMTP_BUFFER_MAX);
-		smtp->email_to = (char *) MALLOC(SMTP_BUFFER_MAX);
+		/* allocate & initialize the queued alert */
+		msg = (smtp_alert_msg_t *) MALLOC(sizeof(smtp_alert_msg_t));
+		msg->subject = (char *) MALLOC(MAX_HEADERS_LENGTH);
+		msg->body = (char *) MALLOC(MAX_BODY_LENGTH);
 
 		/* format subject if rserver is specified */
 #ifdef _WITH_LVS_
 		if (checker) {
-			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "[%s] Realserver %s - %s",
+			snprintf(msg->subject, MAX_HEADERS_LENGTH, "[%s] Realserver %s - %s",
 						global_data->router_id,
 						FMT_RS(checker->rs, checker->vs),
 						subject);
@@ -642,51 +873,36 @@ smtp_alert(
 #endif
 #ifdef _WITH_VRRP_
 		if (vrrp)
-			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "[%s] VRRP Instance %s - %s"
+			snprintf(msg->subject, MAX_HEADERS_LENGTH, "[%s] VRRP Instance %s - %s"
 					      , global_data->router_id
 					      , vrrp->iname
 					      , subject);
 		else if (vgroup)
-			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "[%s] VRRP Group %s - %s"
+			snprintf(msg->subject, MAX_HEADERS_LENGTH, "[%s] VRRP Group %s - %s"
 					      , global_data->router_id
 					      , vgroup->gname
 					      , subject);
 		else
 #endif
 		if (global_data->router_id)
-			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "[%s] %s"
+			snprintf(msg->subject, MAX_HEADERS_LENGTH, "[%s] %s"
 					      , global_data->router_id
 					      , subject);
 		else
-			snprintf(smtp->subject, MAX_HEADERS_LENGTH, "%s", subject);
-
-		strncpy(smtp->body, body, MAX_BODY_LENGTH - 1);
-		smtp->body[MAX_BODY_LENGTH - 1]= '\0';
-
-		build_to_header_rcpt_addrs(smtp);
-
-#ifdef _SMTP_ALERT_DEBUG_
-		FILE *fp = fopen("/tmp/smtp-alert.log", "a");
-		struct tm tm;
-		char time_buf[25];
-		int time_buf_len;
-
-		localtime_r(&time_now.tv_sec, &tm);
-		time_buf_len = strftime(time_buf, sizeof time_buf, "%a %b %e %X %Y", &tm);
+			snprintf(msg->subject, MAX_HEADERS_LENGTH, "%s", subject);
 
-		fprintf(fp, "%s: %s -> %s\n"
-			    "%*sSubject: %s\n"
-			    "%*sBody:    %s\n\n",
-			    time_buf, global_data->email_from, smtp->email_to,
-			    time_buf_len - 7, "", smtp->subject,
-			    time_buf_len - 7, "", smtp->body);
+		strncpy(msg->body, body, MAX_BODY_LENGTH - 1);
+		msg->body[MAX_BODY_LENGTH - 1]= '\0';
 
-		fclose(fp);
+		/* Queue the alert. The drain thread coalesces whatever has
+		 * accumulated by the time the window expires */
+		if (!LIST_EXISTS(smtp_alert_queue))
+			smtp_alert_queue = alloc_list(free_smtp_alert_msg, NULL);
+		list_add(smtp_alert_queue, msg);
 
-		free_smtp_all(smtp);
-		return;
-#endif
-
-		smtp_connect(smtp);
+		if (!smtp_connection_active && !smtp_drain_pending) {
+			smtp_drain_pending = true;
+			thread_add_timer(master, smtp_drain_thread, NULL, SMTP_ALERT_COALESCE_DELAY);
+		}
 	}
 }
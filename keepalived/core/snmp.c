@@ -27,6 +27,10 @@
 #include "config.h"
 #include "global_data.h"
 #include "main.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "hashtab.h"
 
 #include <net-snmp/agent/agent_sysORTable.h>
 
@@ -53,13 +57,249 @@ snmp_scope(int scope)
 	return 0;
 }
 
+/* Trap spooler. A mass state change - a quorum collapse takes every
+ * real server trap with it - fires thousands of traps in one burst,
+ * each a synchronous send through the agent, stalling the event loop
+ * and flooding the NMS. With snmp_trap_rate_limit set, traps beyond
+ * the per-second budget are queued and trickled out; repeat traps for
+ * the same object are coalesced so only the latest state is reported,
+ * and a summary trap carrying the coalesced and dropped counts is
+ * emitted whenever either occurred. */
+#define TRAP_FLUSH_DELAY	TIMER_HZ
+#define TRAP_QUEUE_MAX		1024
+
+typedef struct _queued_trap {
+	netsnmp_variable_list	*vars;
+	uint64_t		key;
+} queued_trap_t;
+
+static list trap_queue;			/* queued_trap_t - owns the entries */
+static hashtab_t trap_htab;		/* object -> queued entry, for coalescing */
+static bool trap_flush_registered;
+static unsigned traps_sent_window;	/* traps sent in the current window */
+static unsigned traps_coalesced;
+static unsigned traps_dropped;
+
+static void
+free_queued_trap(void *data)
+{
+	queued_trap_t *qt = data;
+
+	snmp_free_varbind(qt->vars);
+	FREE(qt);
+}
+
+static void
+snmp_send_summary_trap(void)
+{
+	oid notification_oid[] = { KEEPALIVED_OID, 1, 9, 0, 1 };
+	size_t notification_oid_len = OID_LENGTH(notification_oid);
+	oid objid_snmptrap[] = { SNMPTRAP_OID };
+	size_t objid_snmptrap_len = OID_LENGTH(objid_snmptrap);
+	oid coalesced_oid[] = { KEEPALIVED_OID, 1, 9, 1, 0 };
+	size_t coalesced_oid_len = OID_LENGTH(coalesced_oid);
+	oid dropped_oid[] = { KEEPALIVED_OID, 1, 9, 2, 0 };
+	size_t dropped_oid_len = OID_LENGTH(dropped_oid);
+	oid routerId_oid[] = { KEEPALIVED_OID, 1, 2, 0 };
+	size_t routerId_oid_len = OID_LENGTH(routerId_oid);
+
+	netsnmp_variable_list *notification_vars = NULL;
+
+	snmp_varlist_add_variable(&notification_vars,
+				  objid_snmptrap, objid_snmptrap_len,
+				  ASN_OBJECT_ID,
+				  (u_char *) notification_oid,
+				  notification_oid_len * sizeof(oid));
+	snmp_varlist_add_variable(&notification_vars,
+				  coalesced_oid, coalesced_oid_len,
+				  ASN_UNSIGNED,
+				  (u_char *)&traps_coalesced,
+				  sizeof(traps_coalesced));
+	snmp_varlist_add_variable(&notification_vars,
+				  dropped_oid, dropped_oid_len,
+				  ASN_UNSIGNED,
+				  (u_char *)&traps_dropped,
+				  sizeof(traps_dropped));
+	snmp_varlist_add_variable(&notification_vars,
+				  routerId_oid, routerId_oid_len,
+				  ASN_OCTET_STR,
+				  (u_char *)global_data->router_id,
+				  strlen(global_data->router_id));
+
+	send_v2trap(notification_vars);
+	snmp_free_varbind(notification_vars);
+}
+
+static int
+snmp_trap_flush_thread(__attribute__((unused)) thread_t *thread)
+{
+	queued_trap_t *qt;
+	element e, next;
+
+	traps_sent_window = 0;
+
+	if (!LIST_ISEMPTY(trap_queue)) {
+		for (e = LIST_HEAD(trap_queue); e; e = next) {
+			if (traps_sent_window >= global_data->snmp_trap_rate_limit)
+				break;
+
+			next = e->next;
+			qt = ELEMENT_DATA(e);
+
+			send_v2trap(qt->vars);
+			traps_sent_window++;
+
+			htab_del(&trap_htab, qt->key);
+			free_list_element(trap_queue, e);
+		}
+	}
+
+	if (traps_coalesced || traps_dropped) {
+		log_message(LOG_INFO, "SNMP traps coalesced: %u, dropped: %u",
+			    traps_coalesced, traps_dropped);
+		snmp_send_summary_trap();
+		traps_sent_window++;
+		traps_coalesced = traps_dropped = 0;
+	}
+
+	if (!LIST_ISEMPTY(trap_queue))
+		thread_add_timer(master, snmp_trap_flush_thread, NULL, TRAP_FLUSH_DELAY);
+	else
+		trap_flush_registered = false;
+
+	return 0;
+}
+
+/* Send a trap, or queue it if the outbound rate budget for this window
+ * is spent. Takes ownership of vars. (obj, type) identifies what the
+ * trap reports on, so a newer trap for the same object can supersede a
+ * queued one. */
+void
+snmp_send_trap(netsnmp_variable_list *vars, const void *obj, enum snmp_trap_type type)
+{
+	queued_trap_t *qt;
+	uint64_t key = (uint64_t)(uintptr_t)obj ^ ((uint64_t)type << 56);
+
+	if (!global_data->snmp_trap_rate_limit) {
+		send_v2trap(vars);
+		snmp_free_varbind(vars);
+		return;
+	}
+
+	if (!trap_flush_registered) {
+		thread_add_timer(master, snmp_trap_flush_thread, NULL, TRAP_FLUSH_DELAY);
+		trap_flush_registered = true;
+	}
+
+	if (LIST_ISEMPTY(trap_queue) &&
+	    traps_sent_window < global_data->snmp_trap_rate_limit) {
+		send_v2trap(vars);
+		snmp_free_varbind(vars);
+		traps_sent_window++;
+		return;
+	}
+
+	/* The newer trap for the same object supersedes the queued one */
+	if ((qt = htab_find(&trap_htab, key))) {
+		snmp_free_varbind(qt->vars);
+		qt->vars = vars;
+		traps_coalesced++;
+		return;
+	}
+
+	if (!LIST_ISEMPTY(trap_queue) && LIST_SIZE(trap_queue) >= TRAP_QUEUE_MAX) {
+		snmp_free_varbind(vars);
+		traps_dropped++;
+		return;
+	}
+
+	if (!trap_queue)
+		trap_queue = alloc_list(free_queued_trap, NULL);
+
+	qt = (queued_trap_t *) MALLOC(sizeof(queued_trap_t));
+	qt->vars = vars;
+	qt->key = key;
+	list_add(trap_queue, qt);
+	htab_insert(&trap_htab, key, qt);
+}
+
+/* Snapshots of the lists backing the SNMP tables, indexed by row number.
+ * An snmpwalk issues one GETNEXT per row, and locating each row by walking
+ * its list from the head makes a whole table walk quadratic. The snapshot
+ * turns every lookup into a direct array access. It is rebuilt lazily
+ * whenever the list backing a table changes, and must be dropped
+ * explicitly when a configuration reload frees the old lists. */
+typedef struct _snmp_list_cache {
+	list		dlist;		/* list the rows were snapshot from */
+	unsigned int	count;		/* element count at snapshot time */
+	void		**rows;		/* row pointers, indexed from 0 */
+	unsigned int	size;		/* allocated row slots */
+} snmp_list_cache_t;
+
+#define SNMP_LIST_CACHES	8
+
+static snmp_list_cache_t snmp_list_caches[SNMP_LIST_CACHES];
+static unsigned int snmp_cache_replace;
+
+void
+snmp_cache_reset(void)
+{
+	snmp_list_cache_t *cache;
+	unsigned int i;
+
+	for (i = 0; i < SNMP_LIST_CACHES; i++) {
+		cache = &snmp_list_caches[i];
+		FREE_PTR(cache->rows);
+		cache->rows = NULL;
+		cache->dlist = NULL;
+		cache->count = 0;
+		cache->size = 0;
+	}
+}
+
+static snmp_list_cache_t *
+snmp_cache_list(list dlist)
+{
+	snmp_list_cache_t *cache = NULL;
+	element e;
+	unsigned int i;
+
+	for (i = 0; i < SNMP_LIST_CACHES; i++) {
+		if (snmp_list_caches[i].dlist == dlist) {
+			cache = &snmp_list_caches[i];
+			break;
+		}
+	}
+
+	if (cache && cache->count == LIST_SIZE(dlist))
+		return cache;
+
+	/* Snapshot (or re-snapshot) the list */
+	if (!cache) {
+		cache = &snmp_list_caches[snmp_cache_replace];
+		snmp_cache_replace = (snmp_cache_replace + 1) % SNMP_LIST_CACHES;
+		cache->dlist = dlist;
+	}
+
+	if (cache->size < LIST_SIZE(dlist)) {
+		cache->size = LIST_SIZE(dlist);
+		cache->rows = cache->rows ? REALLOC(cache->rows, cache->size * sizeof(void *))
+					  : MALLOC(cache->size * sizeof(void *));
+	}
+
+	cache->count = 0;
+	for (e = LIST_HEAD(dlist); e; ELEMENT_NEXT(e))
+		cache->rows[cache->count++] = ELEMENT_DATA(e);
+
+	return cache;
+}
+
 void*
 snmp_header_list_table(struct variable *vp, oid *name, size_t *length,
 		  int exact, size_t *var_len, WriteMethod **write_method, list dlist)
 {
-	element e;
-	void *scr;
-	oid target, current;
+	snmp_list_cache_t *cache;
+	oid target;
 
 	if (header_simple_table(vp, name, length, exact, var_len, write_method, -1))
 		return NULL;
@@ -67,27 +307,20 @@ snmp_header_list_table(struct variable *vp, oid *name, size_t *length,
 	if (LIST_ISEMPTY(dlist))
 		return NULL;
 
+	cache = snmp_cache_list(dlist);
 	target = name[*length - 1];
-	current = 0;
-
-	for (e = LIST_HEAD(dlist); e; ELEMENT_NEXT(e)) {
-		scr = ELEMENT_DATA(e);
-		current++;
-		if (current == target)
-			/* Exact match */
-			return scr;
-		if (current < target)
-			/* No match found yet */
-			continue;
-		if (exact)
-			/* No exact match found */
-			return NULL;
-		/* current is the best match */
-		name[*length - 1] = current;
-		return scr;
-	}
-	/* No match found at end */
-	return NULL;
+
+	if (target >= 1 && target <= cache->count)
+		/* Exact match */
+		return cache->rows[target - 1];
+
+	if (exact || target > cache->count)
+		/* No match found */
+		return NULL;
+
+	/* target is below the first row - it is the best match */
+	name[*length - 1] = 1;
+	return cache->rows[0];
 }
 
 enum snmp_global_magic {
@@ -321,6 +554,7 @@ snmp_agent_init(const char *snmp_socket, bool base_mib)
 				  sizeof(struct variable8),
 				  sizeof(global_vars)/sizeof(struct variable8));
 	init_snmp(global_name);
+	snmp_agent_mark_stale();
 }
 
 void
@@ -329,4 +563,11 @@ snmp_agent_close(bool base_mib)
 	if (base_mib)
 		snmp_unregister_mib(global_oid, OID_LENGTH(global_oid));
 	snmp_shutdown(global_name);
+	snmp_agent_mark_stale();
+
+	/* Drop any spooled traps - the objects they reference are going away */
+	free_list(&trap_queue);
+	htab_destroy(&trap_htab);
+	trap_flush_registered = false;
+	traps_sent_window = traps_coalesced = traps_dropped = 0;
 }
@@ -32,6 +32,25 @@
 #include "layer4.h"
 
 /* Checkers structure definition */
+/* Per-checker verdict counters, exported on the shared stats page */
+typedef struct _checker_stats {
+	uint64_t		up_verdicts;	/* probe concluded the server usable */
+	uint64_t		down_verdicts;
+	uint32_t		transitions;	/* is_up flips */
+} checker_stats_t;
+
+/* One slot of the per-checker verdict flight recorder: when the verdict
+ * flipped, how long the previous verdict had held, and how many failed
+ * probes were consumed getting there. */
+#define CHECKER_HIST_ENTRIES	16	/* power of two */
+
+typedef struct _checker_hist_entry {
+	uint32_t	ts;		/* seconds since the epoch */
+	uint32_t	dwell;		/* seconds the previous verdict held */
+	uint8_t		up;		/* verdict entered */
+	uint8_t		retries;	/* failed probes consumed before the flip */
+} checker_hist_entry_t;
+
 typedef struct _checker {
 	void				(*free_func) (void *);
 	void				(*dump_func) (void *);
@@ -51,6 +70,17 @@ typedef struct _checker {
 	unsigned			retry_it;		/* number of successive failures */
 	unsigned			default_retry;		/* number of retries before failing */
 	unsigned long			default_delay_before_retry; /* interval between retries */
+	unsigned			backoff_after;		/* failed cycles before the probe interval grows, 0 disables */
+	unsigned long			backoff_max;		/* cap on the grown probe interval */
+	unsigned			fail_cycles;		/* consecutive check cycles concluded down */
+	unsigned			id;			/* position in checkers_queue, identifies the
+								 * checker in shard worker state reports */
+	struct _checker			*probe_leader;		/* identical checker whose probe result we share */
+	list				probe_followers;	/* checkers subscribed to this checker's probe */
+	checker_stats_t			*stats;			/* verdict counters, on the stats page
+								 * once it has been published */
+	checker_hist_entry_t		hist[CHECKER_HIST_ENTRIES]; /* verdict flight recorder */
+	unsigned			hist_head;		/* entries ever recorded */
 
 } checker_t;
 
@@ -89,6 +119,12 @@ extern bool check_conn_opts(conn_opts_t *);
 extern bool compare_conn_opts(conn_opts_t *, conn_opts_t *);
 extern void dump_checkers_queue(void);
 extern void free_checkers_queue(void);
+extern void publish_checker_stats_page(void);
+extern void close_checker_stats_page(void);
+extern void checker_tw_gauge_init(void);
+extern unsigned long checker_adjust_delay(checker_t *, bool);
+extern void checker_state_save(void);
+extern void checker_state_restore(void);
 extern void register_checkers_thread(void);
 extern void install_checkers_keyword(void);
 extern void checker_set_dst_port(struct sockaddr_storage *, uint16_t);
@@ -28,14 +28,22 @@
 #include <signal.h>
 #include <stdbool.h>
 
+/* local includes */
+#include "check_api.h"
+
 /* Daemon define */
 #define PROG_CHECK	"Keepalived_healthcheckers"
 #define WDOG_CHECK	"/tmp/.healthcheckers"
 
 /* Global data */
 extern bool using_ha_suspend;
+extern int checker_shard_fd;
 
 /* Prototypes */
 extern int start_check_child(void);
+extern bool check_validate_config(void);
+extern bool checker_in_shard(checker_t *);
+extern void checker_shard_report(checker_t *, bool);
+extern void checker_shard_report_weight(checker_t *, int);
 
 #endif
@@ -83,6 +83,9 @@ typedef struct _real_server {
 	bool				set;		/* in the IPVS table */
 	bool				reloaded;	/* active state was copied from old config while reloading */
 	char				*virtualhost;	/* Default virtualhost for HTTP and SSL health checkers */
+	SSL_SESSION			*ssl_session;	/* Cached TLS session for abbreviated handshakes */
+	uint64_t			generation;	/* Bumped on every alive/weight change, so observers
+							 * can skip unchanged servers with one compare. */
 #if defined(_WITH_SNMP_CHECKER_) && defined(_WITH_LVS_)
 	/* Statistics */
 	uint32_t			activeconns;	/* active connections */
@@ -107,6 +110,9 @@ typedef struct _virtual_server_group_entry {
 	unsigned			fwm4_alive;
 	unsigned			fwm6_alive;
 	bool				reloaded;
+	union nf_inet_addr		*exp_addr;	/* range expanded once at config load into
+							 * concrete addresses, range + 1 entries */
+	uint32_t			exp_count;
 } virtual_server_group_entry_t;
 
 typedef struct _virtual_server_group {
@@ -154,7 +160,12 @@ typedef struct _virtual_server {
 	unsigned			quorum;		/* Minimum live RSs to consider VS up. */
 	unsigned			hysteresis;	/* up/down events "lag" WRT quorum. */
 	bool				quorum_state_up; /* Reflects result of the last transition done. */
+	bool				quorum_gate_pending; /* quorum-up parked behind the sync catch-up gate */
+	long				live_weight;	/* Incrementally maintained sum of alive RS weights. */
+	unsigned			live_weight_checks; /* Quorum evaluations since the last audit re-sum. */
 	bool				reloaded;	/* quorum_state was copied from old config while reloading */
+	uint64_t			generation;	/* Bumped whenever the service or any of its real
+							 * servers changes state or weight. */
 #if defined(_WITH_SNMP_CHECKER_) && defined(_WITH_LVS_)
 	/* Statistics */
 	time_t				lastupdated;
@@ -86,8 +86,10 @@ typedef struct _dns_check {
 	char *name;
 	uint8_t sbuf[DNS_BUFFER_SIZE];
 	size_t slen;
+	uint32_t rttl;		/* TTL of the last answer received */
 } dns_check_t;
 
 extern void install_dns_check_keyword(void);
+extern void dns_cache_clear(void);
 
 #endif
@@ -47,16 +47,28 @@ typedef struct _request {
 	SSL				*ssl;
 	BIO				*bio;
 	MD5_CTX				context;
+	uint32_t			crc;		/* running CRC32C fingerprint */
+	bool				use_crc;	/* this round fingerprints instead of MD5 */
 	size_t				content_len;
 	size_t				rx_bytes;
+	size_t				digest_limit;	/* body bytes to digest, UINT_MAX for all */
+	size_t				hdr_scanned;	/* bytes already searched for the end of headers */
+	char				*content_encoding; /* Content-Encoding of the response, NULL if none */
 } request_t;
 
 typedef struct _url {
 	char				*path;
 	char				*digest;
+	uint32_t			fingerprint;	/* expected CRC32C of the body */
+	bool				fingerprint_set;
+	size_t				digest_bytes;	/* digest only the first N body bytes, 0 = whole body */
 	int				status_code;
 	char				*virtualhost;
 	ssize_t				len_mismatch;
+	char				*request;	/* GET request bytes, formatted once on first use */
+	size_t				request_len;
+	char				*content_encoding; /* encoding the digest was last checked against */
+	bool				encoding_seen;	/* content_encoding has been recorded */
 } url_t;
 
 typedef struct _http_checker {
@@ -65,6 +77,18 @@ typedef struct _http_checker {
 	request_t			*req;		/* GET buffer and SSL args */
 	list				url;
 	char				*virtualhost;
+	char				*accept_encoding; /* Accept-Encoding header value, NULL = none sent */
+	bool				keepalive;	/* hold the connection between GETs */
+	int				ka_fd;		/* kept-alive connection, -1 if none */
+	SSL				*ka_ssl;	/* TLS session held with the connection */
+	BIO				*ka_bio;
+	bool				ka_reused;	/* current round runs on a reused connection */
+	bool				ka_keep;	/* response complete, connection reusable */
+	unsigned long			deep_interval;	/* usec between full digest/body rounds,
+							 * 0 = full validation every round */
+	timeval_t			last_deep;	/* start of the last full round */
+	bool				light_round;	/* current round checks the status line only */
+	bool				force_deep;	/* next round must be a full one */
 } http_checker_t;
 
 /* global defs */
@@ -83,6 +107,17 @@ typedef struct _http_checker {
 			 "User-Agent: KeepAliveClient\r\n" \
 			 "Host: [%s]%s\r\n\r\n"
 
+/* Variants asking the server to hold the connection open */
+#define REQUEST_TEMPLATE_KA "GET %s HTTP/1.0\r\n" \
+			 "User-Agent: KeepAliveClient\r\n" \
+			 "Connection: keep-alive\r\n" \
+			 "Host: %s%s\r\n\r\n"
+
+#define REQUEST_TEMPLATE_IPV6_KA "GET %s HTTP/1.0\r\n" \
+			 "User-Agent: KeepAliveClient\r\n" \
+			 "Connection: keep-alive\r\n" \
+			 "Host: [%s]%s\r\n\r\n"
+
 /* macro utility */
 #define FMT_HTTP_RS(C) FMT_CHK(C)
 
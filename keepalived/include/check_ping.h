@@ -0,0 +1,47 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        check_ping.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _CHECK_PING_CHECK_H
+#define _CHECK_PING_CHECK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+
+#define PING_DATA_LEN		16	/* echo request payload bytes */
+#define PING_HDR_LEN		8	/* both icmphdr and icmp6hdr */
+
+#define FMT_PING_RS(C) FMT_CHK(C)
+
+typedef struct _ping_check {
+	uint16_t probe_id;	/* demultiplexes replies on the shared socket */
+	uint16_t seq;		/* sequence of the probe in flight */
+	bool awaiting;		/* probe in flight */
+	thread_t *timeout_thread;	/* cancelled when the reply arrives */
+	uint8_t sbuf[PING_HDR_LEN + PING_DATA_LEN];
+} ping_check_t;
+
+extern void install_ping_check_keyword(void);
+extern void ping_close_sockets(void);
+
+#endif
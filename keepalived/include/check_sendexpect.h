@@ -0,0 +1,60 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        check_sendexpect.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _CHECK_SENDEXPECT_H
+#define _CHECK_SENDEXPECT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <regex.h>
+
+#include "list.h"
+#include "scheduler.h"
+
+#define SENDEXPECT_BUFFER_SIZE	4096
+
+#define FMT_SENDEXPECT_RS(C) FMT_CHK(C)
+
+/* One protocol exchange - write the send bytes (if any), then read
+ * until the reply satisfies the expectation (if any) */
+typedef struct _se_step {
+	char		*send;		/* bytes to write, NULL to read only */
+	size_t		send_len;
+	char		*expect;	/* expected reply prefix or regex source */
+	size_t		expect_len;
+	bool		expect_regex;	/* expect is a compiled ERE, not a prefix */
+	regex_t		re;
+} se_step_t;
+
+typedef struct _sendexpect_check {
+	list		steps;		/* se_step_t */
+
+	/* progress of the probe in flight */
+	element		step;		/* step being executed */
+	size_t		sent;		/* send bytes already written for it */
+	size_t		recv_len;	/* reply bytes collected for it */
+	char		rbuf[SENDEXPECT_BUFFER_SIZE + 1];
+} sendexpect_check_t;
+
+extern void install_sendexpect_check_keyword(void);
+
+#endif
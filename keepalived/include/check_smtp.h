@@ -48,8 +48,24 @@
 typedef struct _smtp_checker {
 	/* non per host config data goes here */
 	char				*helo_name;
-	unsigned			host_ctr;
-	conn_opts_t			*host_ptr;
+
+	/* list holding the host config data */
+	list				host;
+
+	/* round aggregation - all the hosts are probed concurrently */
+	list				probe;		/* in-flight smtp_probe_t */
+	unsigned			probes_left;	/* probes yet to report this round */
+	bool				round_failed;	/* a host failed definitively */
+} smtp_checker_t;
+
+/* Per host probe state. All the hosts of a checker are probed
+ * concurrently on the event loop - they are independent sockets -
+ * so each connection carries its own buffer and engine state. */
+typedef struct _smtp_probe {
+	checker_t			*checker;	/* owning checker */
+	conn_opts_t			*host;		/* host being probed */
+	int				fd;		/* connection, -1 if none */
+	unsigned			retry_it;	/* attempts made on this host */
 
 	/* data buffer */
 	char				buff[SMTP_BUFF_MAX];
@@ -57,10 +73,7 @@ typedef struct _smtp_checker {
 	int				(*buff_cb) (thread_t *);
 
 	int				state;
-
-	/* list holding the host config data */
-	list				host;
-} smtp_checker_t;
+} smtp_probe_t;
 
 /* macro utility */
 #define FMT_SMTP_RS(H) (inet_sockaddrtopair (&(H)->dst))
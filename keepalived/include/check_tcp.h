@@ -26,6 +26,8 @@
 /* system includes */
 #include <unistd.h>
 #include <netdb.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <arpa/inet.h>
 
 /* local includes */
@@ -34,7 +36,17 @@
 /* macro utility */
 #define FMT_TCP_RS(C) FMT_CHK(C)
 
+/* Checker argument structure */
+typedef struct _tcp_check {
+	bool		syn_probe;	/* half-open SYN probe instead of a full connect */
+	uint16_t	probe_port;	/* source port of the probe in flight */
+	uint32_t	probe_seq;	/* sequence sent in the SYN */
+	bool		awaiting;	/* probe in flight */
+	thread_t	*timeout_thread;	/* cancelled when the reply arrives */
+} tcp_check_t;
+
 /* Prototypes defs */
 extern void install_tcp_check_keyword(void);
+extern void syn_close_sockets(void);
 
 #endif
@@ -0,0 +1,43 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        check_udp.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _CHECK_UDP_CHECK_H
+#define _CHECK_UDP_CHECK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+
+#define UDP_BUFFER_SIZE		1500
+
+#define FMT_UDP_RS(C) FMT_CHK(C)
+
+typedef struct _udp_check {
+	char *payload;		/* datagram to probe with, may be empty */
+	size_t payload_len;
+	bool require_reply;	/* a silent server is a dead server */
+} udp_check_t;
+
+extern void install_udp_check_keyword(void);
+
+#endif
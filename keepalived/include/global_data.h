@@ -69,9 +69,13 @@ typedef struct _data {
 	char				*router_id;
 	char				*email_from;
 	struct sockaddr_storage		smtp_server;
+	char				*smtp_server_name;	/* smtp_server domain awaiting resolution */
+	char				*smtp_server_port;	/* port to apply once the name resolves */
 	char				*smtp_helo_name;
 	unsigned long			smtp_connection_to;
 	list				email;
+	bool				takeover;		/* leave IPVS/VIP kernel state installed on exit,
+								 * adopt matching state on start */
 #ifdef _WITH_VRRP_
 	interface_t			*default_ifp;		/* Default interface for static addresses */
 #endif
@@ -83,6 +87,12 @@ typedef struct _data {
 	struct lvs_syncd_config		lvs_syncd;
 #endif
 	bool				lvs_flush;		/* flush any residual LVS config at startup */
+	unsigned long			lvs_sync_catchup_delay;	/* hold quorum-up this long after a cold start
+								 * so the synced connection table can catch up,
+								 * TIMER_HZ units, 0 = no gate */
+#ifdef _WITH_SNMP_CHECKER_
+	unsigned			lvs_stats_refresh_interval;	/* seconds between IPVS stats snapshot refreshes, 0 = default */
+#endif
 #endif
 #ifdef _WITH_VRRP_
 	struct sockaddr_storage		vrrp_mcast_group4;
@@ -93,6 +103,7 @@ typedef struct _data {
 	unsigned			vrrp_garp_refresh_rep;
 	unsigned			vrrp_garp_lower_prio_delay;
 	unsigned			vrrp_garp_lower_prio_rep;
+	unsigned			vrrp_garp_refresh_rate;	/* token bucket frames/sec cap for garp refresh, 0 unpaced */
 	unsigned			vrrp_garp_interval;
 	unsigned			vrrp_gna_interval;
 	bool				vrrp_lower_prio_no_advert;
@@ -100,6 +111,14 @@ typedef struct _data {
 	int				vrrp_version;	/* VRRP version (2 or 3) */
 	char				vrrp_iptables_inchain[XT_EXTENSION_MAXNAMELEN];
 	char				vrrp_iptables_outchain[XT_EXTENSION_MAXNAMELEN];
+	bool				vrrp_nftables;
+	char				vrrp_nftables_table[XT_EXTENSION_MAXNAMELEN];
+	char				*vrrp_dump_socket;	/* Unix socket streaming the state dump on demand */
+	char				*vrrp_control_socket;	/* Unix socket for runtime VRRP control commands */
+	char				*vrrp_handoff_socket;	/* Unix socket for binary upgrade socket/state handoff */
+	char				*vrrp_state_file;	/* mmapped checkpoint of instance state for crash restarts */
+	char				*lvs_control_socket;	/* Unix socket for runtime healthchecker control commands */
+	struct sockaddr_storage		lvs_weight_socket;	/* UDP address receiving pushed real server weights */
 #ifdef _HAVE_LIBIPSET_
 	bool				using_ipsets;
 	char				vrrp_ipset_address[IPSET_MAXNAMELEN];
@@ -111,10 +130,24 @@ typedef struct _data {
 	bool				vrrp_strict;
 	char				vrrp_process_priority;
 	bool				vrrp_no_swap;
+	unsigned long			vrrp_cpu_mask;		/* CPUs the vrrp process may run on, 0 for no pinning */
+	int				vrrp_realtime_policy;	/* SCHED_FIFO/SCHED_RR, 0 for standard scheduling */
+	unsigned			vrrp_realtime_priority;	/* static priority for the realtime policy */
+	bool				vrrp_rx_ring;		/* use a PACKET_RX_RING mmap ring for advert receive */
+	unsigned			vrrp_rx_shards;		/* read sockets per interface/proto, VRIDs spread by filter */
 #endif
 #ifdef _WITH_LVS_
 	char				checker_process_priority;
 	bool				checker_no_swap;
+	unsigned long			checker_cpu_mask;	/* CPUs the checker process may run on, 0 for no pinning */
+	int				checker_realtime_policy; /* SCHED_FIFO/SCHED_RR, 0 for standard scheduling */
+	unsigned			checker_realtime_priority; /* static priority for the realtime policy */
+	unsigned			max_concurrent_checks;	/* limit on checkers starting in the same second, 0 for no limit */
+	unsigned			checker_shards;		/* number of checker worker processes, 0/1 for a single process */
+	char				*checker_state_file;	/* checkpoint of checker up/down state for warm restarts */
+	unsigned long			checker_timer_slack;	/* tolerated extra delay on checker interval timers, for wakeup coalescing */
+	unsigned long			weight_debounce_window;	/* accumulate dynamic checker weights this long, 0 applies immediately */
+	int				weight_debounce_threshold; /* net movement below this at flush is dropped as noise */
 #endif
 	notify_fifo_t			notify_fifo;
 #ifdef _WITH_VRRP_
@@ -126,6 +159,7 @@ typedef struct _data {
 #ifdef _WITH_SNMP_
 	bool				enable_traps;
 	char				*snmp_socket;
+	unsigned			snmp_trap_rate_limit;	/* max traps sent per second, 0 for no limit */
 #ifdef _WITH_VRRP_
 	bool				enable_snmp_keepalived;
 	bool				enable_snmp_rfcv2;
@@ -49,6 +49,7 @@
 
 /* locale includes */
 #include "scheduler.h"
+#include "statspage.h"
 #ifdef _WITH_LVS_
 #include "check_data.h"
 #endif
@@ -86,6 +87,20 @@ struct lvs_syncd_config {
 #endif
 	char				*vrrp_name;	/* used during configuration and SNMP */
 };
+
+/* Sync daemon state, published as a "# ipvs sync" record on the VRRP
+ * stats page. The kernel exposes no sync queue depth or sequence, so
+ * this records what is observable from the control side: which daemon
+ * runs, how often it has been cycled, and the pre-failover tightening
+ * activity. */
+typedef struct _ipvs_syncd_stats {
+	uint32_t	state;		/* IPVS_MASTER / IPVS_BACKUP, 0 = stopped */
+	uint32_t	syncid;
+	uint64_t	starts;
+	uint64_t	stops;
+	uint64_t	tightenings;	/* times sync_refresh_period was dropped pre-failover */
+	uint64_t	last_change;	/* wallclock seconds of the last daemon state change */
+} ipvs_syncd_stats_t;
 #endif
 
 /* prototypes */
@@ -97,10 +112,19 @@ extern virtual_server_group_t *ipvs_get_group_by_name(char *, list);
 extern void ipvs_group_sync_entry(virtual_server_t *vs, virtual_server_group_entry_t *vsge);
 extern void ipvs_group_remove_entry(virtual_server_t *, virtual_server_group_entry_t *);
 extern int ipvs_cmd(int, virtual_server_t *, real_server_t *);
+extern void ipvs_kernel_state_load(void);
+extern void ipvs_kernel_state_free(void);
+extern bool ipvs_kernel_vs_exists(virtual_server_t *);
+extern bool ipvs_kernel_rs_exists(virtual_server_t *, real_server_t *);
+extern void ipvs_batch_begin(void);
+extern int ipvs_batch_end(void);
 #ifdef _WITH_VRRP_
 extern void ipvs_syncd_cmd(int, const struct lvs_syncd_config *, int, bool, bool);
 extern void ipvs_syncd_master(const struct lvs_syncd_config *);
 extern void ipvs_syncd_backup(const struct lvs_syncd_config *);
+extern void ipvs_syncd_publish_stats(stats_page_t *);
+extern void ipvs_syncd_tighten(void);
+extern void ipvs_syncd_relax(void);
 #endif
 
 /* Refresh statistics at most every 5 seconds */
@@ -51,11 +51,14 @@
 
 /* prototypes */
 extern void update_svr_wgt(int, virtual_server_t *, real_server_t *, bool);
+extern void update_svr_wgt_lazy(int, virtual_server_t *, real_server_t *);
+extern void wgt_debounce_clear(void);
 extern void set_checker_state(checker_t *, bool);
 extern void update_svr_checker_state(bool, checker_t *);
 extern bool init_services(void);
 extern void clear_services(void);
 extern void set_quorum_states(void);
+extern void quorum_gate_arm(void);
 extern void clear_diff_services(list);
 extern void link_vsg_to_vs(void);
 
@@ -89,10 +89,20 @@ extern size_t rta_addattr8(struct rtattr *, size_t, unsigned short, uint8_t);
 extern struct rtattr *rta_nest(struct rtattr *, size_t, unsigned short);
 extern size_t rta_nest_end(struct rtattr *, struct rtattr *);
 extern ssize_t netlink_talk(nl_handle_t *, struct nlmsghdr *);
+extern void netlink_batch_begin(void (*)(void *, int));
+extern ssize_t netlink_talk_queue(nl_handle_t *, struct nlmsghdr *, void *);
+extern ssize_t netlink_batch_end(nl_handle_t *);
+extern void netlink_batch_hold(void);
+extern ssize_t netlink_batch_release(nl_handle_t *);
 extern int netlink_interface_lookup(char *);
+extern int netlink_interface_address_lookup(void);
 extern void kernel_netlink_poll(void);
 #endif
 extern void kernel_netlink_init(void);
 extern void kernel_netlink_close(void);
+#if !defined _DEBUG_ && defined _WITH_VRRP_ && defined _WITH_LVS_
+extern bool netlink_shared_create(void);
+extern bool netlink_shared_consumer_init(void);
+#endif
 
 #endif
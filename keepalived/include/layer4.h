@@ -26,6 +26,7 @@
 /* system includes */
 #include <unistd.h>
 #include <string.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -35,6 +36,7 @@
 
 /* local includes */
 #include "scheduler.h"
+#include "namespaces.h"
 
 enum connect_result {
 	connect_error,
@@ -48,7 +50,19 @@ typedef struct _conn_opts {
 	struct sockaddr_storage		dst;
 	struct sockaddr_storage		bindto;
 	char				bind_if[IFNAMSIZ];
+	char				netns[NETNS_NAME_SIZE]; /* network namespace to probe from, empty for our own */
 	unsigned int			connection_to; /* connection time-out */
+	unsigned int			configured_to; /* connection_to as configured - the
+							* ceiling while adapting */
+	unsigned int			adaptive_min; /* floor for the adaptively derived
+						       * timeout, 0 keeps the timeout static */
+	unsigned long			probe_start; /* timer_long(time_now) when the probe
+						      * launched, 0 when not timed */
+	unsigned long			rtt_avg; /* smoothed probe response time */
+	unsigned long			rtt_var; /* smoothed absolute deviation of it */
+	bool				fast_open; /* defer the SYN to the first write (TCP fast open) */
+	bool				kernel_to; /* kernel armed to deliver the connect timeout
+						    * (TCP_USER_TIMEOUT), no scheduler timer needed */
 #ifdef _WITH_SO_MARK_
 	unsigned int			fwmark; /* to mark packets going out of the socket using SO_MARK */
 #endif
@@ -70,7 +84,7 @@ extern enum connect_result
 extern int
  socket_connection_state(int, enum connect_result
 		      , thread_t *, int (*func) (thread_t *)
-		      , unsigned long);
+		      , conn_opts_t *);
 #endif
 
 /* Backward compatibility */
@@ -97,9 +111,9 @@ tcp_socket_state(thread_t * thread, int (*func) (thread_t *))
 #ifdef _WITH_LVS_
 static inline int
 tcp_connection_state(int fd, enum connect_result status, thread_t * thread,
-             int (*func) (thread_t *), unsigned long timeout)
+             int (*func) (thread_t *), conn_opts_t *co)
 {
-	return socket_connection_state(fd, status, thread, func, timeout);
+	return socket_connection_state(fd, status, thread, func, co);
 }
 #endif
 
@@ -62,6 +62,12 @@ extern int ipvs_update_dest(ipvs_service_t *svc, ipvs_dest_t *dest);
 /* remove a destination server from a service */
 extern int ipvs_del_dest(ipvs_service_t *svc, ipvs_dest_t *dest);
 
+#if defined LIBIPVS_USE_NL && defined _HAVE_LIBNL3_
+/* queue ACK-only commands and flush them as one netlink datagram */
+extern void ipvs_nl_batch_begin(void);
+extern int ipvs_nl_batch_end(void);
+#endif
+
 #ifdef _INCLUDE_UNUSED_CODE_
 /* set timeout */
 extern int ipvs_set_timeout(ipvs_timeout_t *to);
@@ -73,14 +79,15 @@ extern int ipvs_start_daemon(ipvs_daemon_t *dm);
 /* stop a connection synchronizaiton daemon (master/backup) */
 extern int ipvs_stop_daemon(ipvs_daemon_t *dm);
 
-#ifdef _WITH_SNMP_CHECKER_
 /* get the destination array of the specified service */
 extern struct ip_vs_get_dests_app *ipvs_get_dests(ipvs_service_entry_t *svc);
 
 /* get an ipvs service entry */
 extern ipvs_service_entry_t *
 ipvs_get_service(__u32 fwmark, __u16 af, __u16 protocol, union nf_inet_addr *addr, __u16 port);
-#endif
+
+/* dump all ipvs services in one request */
+extern struct ip_vs_get_services_app *ipvs_get_services(void);
 
 /* close the socket */
 extern void ipvs_close(void);
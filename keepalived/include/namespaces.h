@@ -25,8 +25,12 @@
 
 #include <stdbool.h>
 
+/* Maximum length of a network namespace name */
+#define NETNS_NAME_SIZE	64
+
 extern void free_dirname(void);
 extern bool set_namespaces(const char*);
 extern void clear_namespaces(void);
+extern int socket_netns(const char *, int, int, int);
 
 #endif
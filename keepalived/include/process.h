@@ -25,5 +25,7 @@
 
 extern void set_process_dont_swap(size_t);
 extern void set_process_priority(int);
+extern void set_process_cpu_affinity(unsigned long, const char *);
+extern void set_process_realtime_priority(int, unsigned, const char *);
 
 #endif
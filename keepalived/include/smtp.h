@@ -57,6 +57,9 @@
 #define MAX_HEADERS_LENGTH 256
 #define MAX_BODY_LENGTH    512
 
+/* Window for grouping a burst of alerts into a single message */
+#define SMTP_ALERT_COALESCE_DELAY	TIMER_HZ
+
 /* SMTP FSM Macro */
 #define SMTP_FSM_SEND(S, T)	\
 do {				\
@@ -104,6 +107,7 @@ typedef void vrrp_sgroup_t;
 #endif
 
 /* Prototypes defs */
+extern void smtp_start_resolver(void);
 extern void smtp_alert(
 #ifdef _WITH_LVS_
 			checker_t *,
@@ -56,6 +56,20 @@ typedef union _long_ret {
 } longret_t;
 
 extern unsigned long snmp_scope(int scope);
+/* Trap types for snmp_send_trap() coalescing - traps only coalesce
+ * within the same (object, type) pair */
+enum snmp_trap_type {
+	SNMP_TRAP_INSTANCE = 1,
+	SNMP_TRAP_GROUP,
+	SNMP_TRAP_RFCV2_NEW_MASTER,
+	SNMP_TRAP_RFCV2_AUTH_ERR,
+	SNMP_TRAP_RFCV3_NEW_MASTER,
+	SNMP_TRAP_RFCV3_PROTO_ERR,
+	SNMP_TRAP_RS,
+};
+
+extern void snmp_send_trap(netsnmp_variable_list *vars, const void *obj, enum snmp_trap_type type);
+extern void snmp_cache_reset(void);
 extern void* snmp_header_list_table(struct variable *vp, oid *name, size_t *length,
 				    int exact, size_t *var_len, WriteMethod **write_method,
 				    list dlist);
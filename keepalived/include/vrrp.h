@@ -37,10 +37,14 @@
 #endif
 #include "vrrp_if.h"
 #include "vrrp_track.h"
+#include "vrrp_bfd.h"
+#include "vrrp_file.h"
+#include "vrrp_process.h"
 #include "timer.h"
 #include "utils.h"
 #include "vector.h"
 #include "list.h"
+#include "hlist.h"
 #include "notify.h"
 
 /* Special value for parameters when we want to know they haven't been set */
@@ -104,6 +108,13 @@ typedef struct _vrrp_sgroup {
 	vector_t		*iname;			/* Set of VRRP instances in this group */
 	list			index_list;		/* List of VRRP instances */
 	int			state;			/* current stable state */
+
+	/* Member state accounting, maintained incrementally by
+	 * vrrp_sync_update_member_counts() so that group transition
+	 * decisions don't need to rescan the whole member list */
+	unsigned		num_member_master;	/* members in MASTER state */
+	unsigned		num_member_fault;	/* members in FAULT state */
+	unsigned		num_member_wantmaster;	/* members wanting MASTER state */
 	int			global_tracking;	/* Use floating priority and scripts
 							 * All VRRP must share same tracking conf
 							 */
@@ -140,6 +151,23 @@ typedef struct _vrrp_stats {
 	uint64_t	pri_zero_rcvd;
 	uint64_t	pri_zero_sent;
 
+#ifdef _VRRP_LATENCY_STATS_
+	/* Advert timer jitter: how late the scheduler fired against sands */
+#define VRRP_STATS_JITTER_BUCKETS 7
+	uint64_t	jitter_count;
+	uint64_t	jitter_usec_total;
+	uint32_t	jitter_max_usec;
+	uint32_t	jitter_hist[VRRP_STATS_JITTER_BUCKETS];
+
+	/* Advert inter-arrival: how much later than the master advert
+	 * interval each advert arrived, from kernel receive timestamps */
+	struct timespec	last_advert_ts;
+	uint64_t	interarrival_count;
+	uint64_t	interarrival_late_total;
+	uint32_t	interarrival_max_usec;
+	uint32_t	interarrival_hist[VRRP_STATS_JITTER_BUCKETS];
+#endif
+
 #ifdef _WITH_SNMP_RFC_
 	uint32_t	chk_err;
 	uint32_t	vers_err;
@@ -150,6 +178,12 @@ typedef struct _vrrp_stats {
 	uint32_t	proto_err_reason;
 #endif
 #endif
+
+	/* Mirror of the instance state, so out-of-process consumers of
+	 * the shared-memory stats page (management subagents) can serve
+	 * state queries without ever entering this process */
+	uint32_t	state;
+	uint32_t	last_transition;	/* seconds since the epoch */
 } vrrp_stats;
 
 #ifdef _WITH_UNICAST_CHKSUM_COMPAT_
@@ -163,13 +197,56 @@ typedef enum chksum_compatibility {
 } chksum_compatibility_t;
 #endif
 
+/* One slot of the per-instance transition flight recorder. The ring
+ * keeps the last VRRP_HIST_ENTRIES transitions at the fixed cost of one
+ * slot write per transition, so the recent history of an instance can
+ * be pulled from a running process after the event. */
+#define VRRP_HIST_ENTRIES	16	/* power of two */
+
+typedef struct _vrrp_hist_entry {
+	uint32_t	ts;		/* seconds since the epoch */
+	uint8_t		prev_state;	/* state left */
+	uint8_t		new_state;	/* state entered */
+	uint8_t		reason;		/* VRRP_HIST_REASON_* */
+	uint8_t		master_prio;	/* last heard master priority */
+} vrrp_hist_entry_t;
+
+/* Reasons recorded with each history entry, set by whichever event was
+ * driving the FSM when the transition landed */
+#define VRRP_HIST_REASON_STARTUP	0	/* initial bring-up */
+#define VRRP_HIST_REASON_ADVERT		1	/* peer advert drove the change */
+#define VRRP_HIST_REASON_TIMEOUT	2	/* master down timer expired */
+#define VRRP_HIST_REASON_FAULT		3	/* tracked object failed */
+#define VRRP_HIST_REASON_CONTROL	4	/* control socket command */
+
+/* Payload of one record in the vrrp_state_file checkpoint. The file is
+ * a stats page updated in place on every transition and advert, so a
+ * respawn after a crash can tell which instances were MASTER moments
+ * ago and resume them without waiting out the master down interval. */
+typedef struct _vrrp_chkpt {
+	uint32_t	state;			/* VRRP_STATE_* */
+	int32_t		effective_priority;
+	uint64_t	last_advert;		/* seconds since the epoch */
+	uint64_t	updated;		/* seconds since the epoch */
+} vrrp_chkpt_t;
+
 /* parameters per virtual router -- rfc2338.6.1.2 */
 typedef struct _vrrp_t {
 	sa_family_t		family;			/* AF_INET|AF_INET6 */
 	char			*iname;			/* Instance Name */
 	vrrp_sgroup_t		*sync;			/* Sync group we belong to */
+	int			sync_counted_state;	/* state last folded into the group counters */
+	bool			sync_counted_wantmaster; /* wantstate contribution currently counted */
 	vrrp_stats		*stats;			/* Statistics */
+	char			*dump_buf;		/* Cached state dump fragment (see vrrp_print.c) */
+	size_t			dump_len;		/* Length of the cached fragment */
+	uint64_t		dump_csum;		/* Fingerprint of the state the fragment reflects */
+	uint64_t		generation;		/* Bumped on every state transition and effective
+							 * priority change, so observers can skip
+							 * unchanged instances with one compare */
 	interface_t		*ifp;			/* Interface we belong to */
+	hlist_node_t		index_node;		/* Linkage in the vrid index bucket */
+	hlist_node_t		index_fd_node;		/* Linkage in the fd index bucket */
 	bool			dont_track_primary;	/* If set ignores ifp faults */
 	bool			skip_check_adv_addr;	/* If set, don't check the VIPs in subsequent
 							 * adverts from the same master */
@@ -180,7 +257,18 @@ typedef struct _vrrp_t {
 	ifindex_t		vmac_ifindex;		/* ifindex of vmac interface */
 #endif
 	list			track_ifp;		/* Interface state we monitor */
+	unsigned		num_track_if_down;	/* Tracked zero-weight interfaces currently down,
+							 * maintained by the interface fan-out index */
+	int			track_if_weight;	/* Summed weight of tracked interfaces,
+							 * maintained by the interface fan-out index */
 	list			track_script;		/* Script state we monitor */
+	unsigned		num_track_script_down;	/* Tracked zero-weight scripts currently KO,
+							 * maintained by the script fan-out index */
+	int			track_script_weight;	/* Summed weight of tracked scripts,
+							 * maintained by the script fan-out index */
+	list			track_bfd;		/* BFD session state we monitor */
+	list			track_file;		/* File state we monitor */
+	list			track_process;		/* Process existence we monitor */
 	struct sockaddr_storage	saddr;			/* Src IP address to use in VRRP IP header */
 	struct sockaddr_storage	pkt_saddr;		/* Src IP address received in VRRP IP header */
 	list			unicast_peer;		/* List of Unicast peer to send advert to */
@@ -190,6 +278,10 @@ typedef struct _vrrp_t {
 	struct sockaddr_storage master_saddr;		/* Store last heard Master address */
 	uint8_t			master_priority;	/* Store last heard priority */
 	timeval_t		last_transition;	/* Store transition time */
+	vrrp_hist_entry_t	hist[VRRP_HIST_ENTRIES]; /* transition flight recorder */
+	unsigned		hist_head;		/* entries ever recorded */
+	uint8_t			hist_reason;		/* reason for the transition in flight */
+	vrrp_chkpt_t		*chkpt;			/* slot in the state checkpoint file, NULL when unconfigured */
 	unsigned		garp_delay;		/* Delay to launch gratuitous ARP */
 	timeval_t		garp_refresh;		/* Next scheduled gratuitous ARP refresh */
 	timeval_t		garp_refresh_timer;	/* Next scheduled gratuitous ARP timer */
@@ -223,6 +315,8 @@ typedef struct _vrrp_t {
 							 * the packets destined to VIP.
 							 */
 	bool			iptable_rules_set;	/* Iptable drop rules set to VIP list ? */
+	bool			optimistic_dad;		/* Use optimistic DAD rather than nodad for the
+							 * instance's IPv6 VIPs */
 	bool			nopreempt;		/* true if higher prio does not preempt lower */
 	unsigned long		preempt_delay;		/* Seconds*TIMER_HZ after startup until
 							 * preemption based on higher prio over lower
@@ -234,6 +328,8 @@ typedef struct _vrrp_t {
 	int			init_state;		/* the initial state of the instance */
 #endif
 	int			wantstate;		/* user explicitly wants a state (back/mast) */
+	bool			forced_backup;		/* operator forced the instance to backup via
+							 * the control socket - hold priority at minimum */
 	int			fd_in;			/* IN socket descriptor */
 	int			fd_out;			/* OUT socket descriptor */
 
@@ -258,17 +354,38 @@ typedef struct _vrrp_t {
 
 	/* rfc2338.6.2 */
 	uint32_t		ms_down_timer;
-	timeval_t		sands;
+	timeus_t		sands;		/* next expiry, on the timer_us() scale */
+	timeus_t		*sands_hot;	/* this instance's slot in its socket's
+						 * contiguous timer-scan array */
 
 	/* Sending buffer */
 	char			*send_buffer;		/* Allocated send buffer */
 	size_t			send_buffer_size;
+	bool			send_buffer_valid;	/* cached advert frame is current */
+	uint8_t			send_buffer_prio;	/* priority in the cached frame */
+	uint32_t		send_buffer_dst;	/* IPv4 destination of the cached frame */
+	uint32_t		send_buffer_src;	/* IPv4 source of the cached frame */
+#ifdef _WITH_UNICAST_CHKSUM_COMPAT_
+	chksum_compatibility_t	send_buffer_chksum_compat; /* compat mode of the cached frame */
+#endif
+
+	/* Unicast fan-out - one cached frame per peer and the sendmmsg()
+	 * vector that flushes them in a single syscall per advert */
+	struct mmsghdr		*unicast_msg;		/* one entry per unicast peer */
+	struct iovec		*unicast_iov;
+	char			*unicast_frames;	/* unicast_npeers frames of send_buffer_size */
+	uint32_t		*unicast_dst;		/* cached IPv4 destination per frame */
+	bool			*unicast_frame_valid;	/* per frame cache validity */
+	char			*unicast_cbuf;		/* IPv6 ancillary data, per peer */
+	unsigned		unicast_npeers;
 
 #if defined _WITH_VRRP_AUTH_
 	/* Authentication data (only valid for VRRPv2) */
 	uint8_t			auth_type;		/* authentification type. VRRP_AUTH_* */
 	uint8_t			auth_data[8];		/* authentification data */
 	seq_counter_t		*ipsecah_counter;
+	hmac_md5_ctx_t		*ah_ctx;		/* precomputed HMAC-MD5 pad states
+							 * for auth_data */
 #endif
 
 	/*
@@ -326,11 +443,18 @@ typedef struct _vrrp_t {
 #define VRRP_PKT_SADDR6(V) (((V)->saddr.ss_family) ? ((struct sockaddr_in6 *) &(V)->saddr)->sin6_addr : IF_ADDR6((V)->ifp))
 
 #define VRRP_IF_ISUP(V)		((IF_ISUP((V)->ifp) || (V)->dont_track_primary) & \
-				((!LIST_ISEMPTY((V)->track_ifp)) ? TRACK_ISUP((V)->track_ifp) : 1))
+				((V)->num_track_if_down == 0))
+
+#define VRRP_SCRIPT_ISUP(V)	((V)->num_track_script_down == 0)
+
+#define VRRP_BFD_ISUP(V)	((!LIST_ISEMPTY((V)->track_bfd)) ? vrrp_bfd_up((V)->track_bfd) : 1)
+
+#define VRRP_FILE_ISUP(V)	((!LIST_ISEMPTY((V)->track_file)) ? vrrp_file_up((V)->track_file) : 1)
 
-#define VRRP_SCRIPT_ISUP(V)	((!LIST_ISEMPTY((V)->track_script)) ? SCRIPT_ISUP((V)->track_script) : 1)
+#define VRRP_PROCESS_ISUP(V)	((!LIST_ISEMPTY((V)->track_process)) ? vrrp_process_up((V)->track_process) : 1)
 
-#define VRRP_ISUP(V)		(VRRP_IF_ISUP(V) && VRRP_SCRIPT_ISUP(V))
+#define VRRP_ISUP(V)		(VRRP_IF_ISUP(V) && VRRP_SCRIPT_ISUP(V) && VRRP_BFD_ISUP(V) && \
+				 VRRP_FILE_ISUP(V) && VRRP_PROCESS_ISUP(V))
 
 /* Global variables */
 extern bool block_ipv4;
@@ -338,16 +462,21 @@ extern bool block_ipv6;
 
 /* prototypes */
 extern vrrphdr_t *vrrp_get_header(sa_family_t, char *, unsigned *);
+extern int vrrp_in_chk(vrrp_t *, char *, ssize_t, bool);
 extern int open_vrrp_send_socket(sa_family_t, int, ifindex_t, bool);
 extern int open_vrrp_read_socket(sa_family_t, int, ifindex_t, bool);
 extern int new_vrrp_socket(vrrp_t *);
 extern void vrrp_send_link_update(vrrp_t *, unsigned);
 extern int vrrp_send_adv(vrrp_t *, uint8_t);
+extern void vrrp_adv_flush(void);
 extern int vrrp_state_fault_rx(vrrp_t *, char *, ssize_t);
 extern int vrrp_state_master_rx(vrrp_t *, char *, ssize_t);
 extern int vrrp_state_master_tx(vrrp_t *, const int);
 extern void vrrp_state_backup(vrrp_t *, char *, ssize_t);
 extern void vrrp_state_goto_master(vrrp_t *);
+extern void vrrp_transition_batch_begin(void);
+extern void vrrp_transition_batch_commit(void);
+extern void vrrp_history_record(vrrp_t *, int);
 extern void vrrp_state_leave_master(vrrp_t *);
 extern bool vrrp_complete_init(void);
 extern void vrrp_restore_interfaces_startup(void);
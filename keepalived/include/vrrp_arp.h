@@ -55,5 +55,6 @@ typedef struct _arphdr {
 extern void gratuitous_arp_init(void);
 extern void gratuitous_arp_close(void);
 extern void send_gratuitous_arp(vrrp_t *, ip_address_t *);
+extern void gratuitous_arp_flush(void);
 extern ssize_t send_gratuitous_arp_immediate(interface_t *, ip_address_t *);
 #endif
@@ -0,0 +1,110 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        vrrp_bfd.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _VRRP_BFD_H
+#define _VRRP_BFD_H
+
+/* global includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/* local includes */
+#include "list.h"
+#include "vector.h"
+#include "scheduler.h"
+
+/* RFC 5881 single-hop BFD control packets */
+#define BFD_PORT_CTRL		3784
+#define BFD_PORT_SRC		49152	/* bottom of the RFC 5881 source range */
+#define BFD_PKT_LEN		24	/* mandatory section only */
+#define BFD_TTL			255	/* GTSM, RFC 5881 section 5 */
+
+/* Session defaults, microseconds */
+#define BFD_DEFAULT_MIN_TX	(50 * 1000)
+#define BFD_DEFAULT_MIN_RX	(50 * 1000)
+#define BFD_DEFAULT_MULT	3
+#define BFD_SLOW_TX		(1000 * 1000)	/* tx floor while not up, RFC 5880 6.8.3 */
+
+/* Session states (RFC 5880 section 4.1) */
+#define BFD_STATE_ADMINDOWN	0
+#define BFD_STATE_DOWN		1
+#define BFD_STATE_INIT		2
+#define BFD_STATE_UP		3
+
+/* Control packet mandatory section (RFC 5880 section 4.1) */
+typedef struct _bfd_pkt {
+	uint8_t			vers_diag;	/* version (3 bits) | diagnostic (5 bits) */
+	uint8_t			flags;		/* state (2 bits) | P F C A D M */
+	uint8_t			detect_mult;
+	uint8_t			len;
+	uint32_t		local_discr;
+	uint32_t		remote_discr;
+	uint32_t		min_tx_int;	/* usec */
+	uint32_t		min_rx_int;	/* usec */
+	uint32_t		min_echo_rx_int;
+} bfd_pkt_t;
+
+#define BFD_PKT_VER(p)		((p)->vers_diag >> 5)
+#define BFD_PKT_STATE(p)	((p)->flags >> 6)
+#define BFD_PKT_MBIT(p)		((p)->flags & 0x01)
+
+/* BFD session we run against a neighbor router */
+typedef struct _vrrp_bfd {
+	char			*bname;		/* session name */
+	struct sockaddr_storage	nbr_addr;	/* neighbor address */
+	uint32_t		local_discr;	/* our discriminator */
+	uint32_t		remote_discr;	/* learnt from the neighbor, 0 when unknown */
+	int			local_state;
+	int			remote_state;
+	uint32_t		min_tx;		/* configured desired tx interval, usec */
+	uint32_t		min_rx;		/* configured required rx interval, usec */
+	unsigned		multiplier;	/* our detection multiplier */
+	uint32_t		remote_min_rx;	/* neighbor's required rx interval, usec */
+	uint32_t		remote_min_tx;	/* neighbor's desired tx interval, usec */
+	unsigned		remote_mult;	/* neighbor's detection multiplier */
+	int			weight;		/* default weight for trackers */
+	thread_t		*tx_thread;	/* periodic control packet transmit */
+	thread_t		*detect_thread;	/* detection timeout, armed while a packet is owed */
+} vrrp_bfd_t;
+
+/* Tracked BFD session structure definition */
+typedef struct _tracked_bfd {
+	int			weight;		/* tracking weight when non-zero */
+	vrrp_bfd_t		*bfd;		/* session pointer, cannot be NULL */
+} tracked_bfd_t;
+
+#define BFD_ISUP(B)	((B)->local_state == BFD_STATE_UP)
+
+/* prototypes */
+extern void free_vrrp_bfd(void *);
+extern void dump_vrrp_bfd(void *);
+extern vrrp_bfd_t *find_bfd_by_name(char *);
+extern void dump_track_bfd(void *);
+extern void alloc_track_bfd(list, vector_t *, const char *);
+extern int vrrp_bfd_up(list);
+extern int vrrp_bfd_weight(list);
+extern void vrrp_bfd_init(list);
+extern void vrrp_bfd_close(void);
+extern void clear_diff_bfd(void);
+
+#endif
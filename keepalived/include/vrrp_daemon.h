@@ -23,11 +23,15 @@
 #ifndef _VRRP_DAEMON_H
 #define _VRRP_DAEMON_H
 
+/* system include */
+#include <stdbool.h>
+
 /* Daemon define */
 #define PROG_VRRP	"Keepalived_vrrp"
 #define WDOG_VRRP	"/tmp/.vrrp"
 
 /* Prototypes */
 extern int start_vrrp_child(void);
+extern bool vrrp_validate_config(void);
 
 #endif
@@ -32,11 +32,17 @@
 
 /* local includes */
 #include "list.h"
+#include "hlist.h"
 #include "vector.h"
 #include "scheduler.h"
 #include "vrrp.h"
 #include "vrrp_if.h"
 
+/* Intrusive index buckets. The vrid index is keyed directly on the
+ * (8 bit) vrid; the fd index is keyed on fd_in modulo the table size. */
+#define VRRP_INDEX_SIZE		256
+#define VRRP_INDEX_FD_SIZE	(1024 + 1)
+
 /*
  * Our instance dispatcher use a socket pool.
  * That way we handle VRRP protocol type per
@@ -48,9 +54,27 @@ typedef struct _sock {
 	int			proto;
 	ifindex_t		ifindex;
 	bool			unicast;
+	unsigned		shard;		/* receive shard this socket covers, VRIDs are spread */
+	unsigned		shards;		/* by vrid modulo shards; 1 when sharding is off */
 	int			fd_in;
 	int			fd_out;
+	struct _vrrp_ring	*ring;		/* PACKET_RX_RING receive engine, NULL when
+						 * disabled or unavailable */
 	thread_t		*thread;
+	uint64_t		*spurious_rx;	/* adverts the kernel delivered here for a VRID
+						 * this socket does not serve; lives on the
+						 * stats page once published */
+
+	/* Hot timer-scan state. The sands of every instance multiplexed
+	 * on this socket, packed contiguously so the per-tick scan
+	 * streams through one small array instead of dragging a cache
+	 * line of cold vrrp_t config per instance through the fd index.
+	 * Mirrors of vrrp->sands, kept in step by its few writers; the
+	 * parallel instance array is only dereferenced for the single
+	 * expiring entry. */
+	unsigned		hot_count;
+	timeus_t		*hot_sands;
+	struct _vrrp_t		**hot_vrrp;
 } sock_t;
 
 /* Configuration data root */
@@ -60,13 +84,20 @@ typedef struct _vrrp_data {
 	list			static_rules;
 	list			vrrp_sync_group;
 	list			vrrp;
-	list			vrrp_index;
-	list			vrrp_index_fd;
+	hlist_head_t		vrrp_index[VRRP_INDEX_SIZE];
+	hlist_head_t		vrrp_index_fd[VRRP_INDEX_FD_SIZE];
 	list			vrrp_socket_pool;
 	list			vrrp_script;
+	list			vrrp_bfd;
+	list			vrrp_file;
+	list			vrrp_process;
 	list			vrrp_switch;
 } vrrp_data_t;
 
+/* Number of adverts the dispatcher can drain from a socket in one
+ * recvmmsg() call. vrrp_buffer holds this many packet slots. */
+#define VRRP_RX_BATCH		16
+
 /* Global Vars exported */
 extern vrrp_data_t *vrrp_data;
 extern vrrp_data_t *old_vrrp_data;
@@ -83,6 +114,12 @@ extern void alloc_vrrp_unicast_peer(vector_t *);
 extern void alloc_vrrp_track(vector_t *);
 extern void alloc_vrrp_script(char *);
 extern void alloc_vrrp_track_script(vector_t *);
+extern void alloc_vrrp_bfd(char *);
+extern void alloc_vrrp_track_bfd(vector_t *);
+extern void alloc_vrrp_file(char *);
+extern void alloc_vrrp_track_file(vector_t *);
+extern void alloc_vrrp_process(char *);
+extern void alloc_vrrp_track_process(vector_t *);
 extern void alloc_vrrp_vip(vector_t *);
 extern void alloc_vrrp_evip(vector_t *);
 extern void alloc_vrrp_vroute(vector_t *);
@@ -92,5 +129,11 @@ extern void free_vrrp_buffer(void);
 extern vrrp_data_t *alloc_vrrp_data(void);
 extern void free_vrrp_data(vrrp_data_t *);
 extern void dump_vrrp_data(vrrp_data_t *);
+extern void vrrp_publish_stats_page(void);
+extern void vrrp_publish_sock_stats(void);
+extern void vrrp_close_stats_page(void);
+extern void vrrp_state_file_restore(void);
+extern void vrrp_publish_state_file(void);
+extern void vrrp_close_state_file(bool);
 
 #endif
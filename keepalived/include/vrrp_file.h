@@ -0,0 +1,65 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        vrrp_file.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _VRRP_FILE_H
+#define _VRRP_FILE_H
+
+/* global includes */
+#include <stdbool.h>
+
+/* local includes */
+#include "list.h"
+#include "vector.h"
+
+/* Tracked file we watch with inotify */
+typedef struct _vrrp_file {
+	char			*fname;		/* object name */
+	char			*file_path;	/* file to watch */
+	char			*file_part;	/* basename within file_path */
+	int			wd;		/* inotify watch on the parent directory */
+	int			weight;		/* default weight for trackers */
+	int			value;		/* last integer value read from the file */
+	bool			exists;		/* file currently present */
+} vrrp_file_t;
+
+/* Tracked file structure definition */
+typedef struct _tracked_file {
+	int			weight;		/* multiplies the file value when non-zero */
+	vrrp_file_t		*file;		/* file pointer, cannot be NULL */
+} tracked_file_t;
+
+/* A zero-weight tracked file holds the instance up while the file
+ * exists with a non-zero value */
+#define FILE_ISUP(F)	((F)->exists && (F)->value)
+
+/* prototypes */
+extern void free_vrrp_file(void *);
+extern void dump_vrrp_file(void *);
+extern vrrp_file_t *find_file_by_name(char *);
+extern void dump_track_file(void *);
+extern void alloc_track_file(list, vector_t *, const char *);
+extern int vrrp_file_up(list);
+extern int vrrp_file_weight(list);
+extern void vrrp_file_init(list);
+extern void vrrp_file_close(void);
+
+#endif
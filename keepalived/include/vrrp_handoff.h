@@ -0,0 +1,43 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        vrrp_handoff.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _VRRP_HANDOFF_H
+#define _VRRP_HANDOFF_H
+
+#include "config.h"
+
+#include <stdbool.h>
+
+#include "vrrp_data.h"
+
+/* Set once this daemon has handed its sockets and state to a successor;
+ * the shutdown path then leaves VIPs, VMACs and peers untouched */
+extern bool vrrp_handoff_done;
+
+/* prototypes */
+extern void vrrp_handoff_socket_init(void);
+extern void vrrp_handoff_socket_close(void);
+extern void vrrp_handoff_fetch(void);
+extern bool vrrp_handoff_adopt(sock_t *);
+extern void vrrp_handoff_release(void);
+
+#endif
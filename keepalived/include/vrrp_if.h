@@ -50,6 +50,7 @@
 #define LB_IOCTL   0x1
 #define LB_MII     0x2
 #define LB_ETHTOOL 0x4
+#define LB_NETLINK 0x8
 
 /* I don't know what the correct type is. 
  * The kernel has ifindex in the range [1, INT_MAX], but IFLA_LINK is defined
@@ -99,6 +100,9 @@ typedef struct _interface {
 	int			rp_filter;		/* > -1 if we have changed the value */
 #endif
 	bool			promote_secondaries_already_set; /* Set if promote_secondaries already set on interface */
+	list			tracking_vrrp;		/* tracking_vrrp_t - vrrp instances tracking this interface */
+	bool			tracked_up;		/* Last UP/DOWN state folded into the subscriber caches */
+	bool			nl_stale;		/* Netlink state may be out of date after lost or failed events */
 } interface_t;
 
 #define GARP_DELAY_PTR(X) ((X)->switch_delay ? (X)->switch_delay : &((X)->if_delay))
@@ -125,6 +129,7 @@ typedef struct _tracked_if {
 #define IF_HWADDR(X) ((X)->hw_addr)
 #define IF_MII_SUPPORTED(X) ((X)->lb_type & LB_MII)
 #define IF_ETHTOOL_SUPPORTED(X) ((X)->lb_type & LB_ETHTOOL)
+#define IF_NETLINK_SUPPORTED(X) ((X)->lb_type & LB_NETLINK)
 #define IF_LINKBEAT(X) ((X)->linkbeat)
 #define IF_ISUP(X) (((X)->flags & IFF_UP)      && \
 		    ((X)->flags & IFF_RUNNING) && \
@@ -141,9 +146,11 @@ extern interface_t *if_get_by_ifname(const char *);
 extern list get_if_list(void);
 extern void reset_interface_queue(void);
 #ifdef _HAVE_VRRP_VMAC_
+extern void if_vmac_add(interface_t *);
 extern void if_vmac_reflect_flags(ifindex_t, unsigned long);
 #endif
 extern int if_linkbeat(const interface_t *);
+extern void if_linkbeat_reflect(interface_t *, unsigned long);
 extern void alloc_garp_delay(void);
 extern void set_default_garp_delay(void);
 extern void if_add_queue(interface_t *);
@@ -162,6 +169,9 @@ extern int if_setsockopt_mcast_loop(sa_family_t, int *);
 extern int if_setsockopt_mcast_hops(sa_family_t, int *);
 extern int if_setsockopt_mcast_if(sa_family_t, int *, interface_t *);
 extern int if_setsockopt_priority(int *, int);
+#ifdef _VRRP_LATENCY_STATS_
+extern int if_setsockopt_timestampns(int *);
+#endif
 extern int if_setsockopt_rcvbuf(int *, int);
 extern void print_interface_list(FILE *fp);
 
@@ -33,6 +33,7 @@
 #include <string.h>
 #include <syslog.h>
 #include <linux/if_addr.h>
+#include <linux/netlink.h>
 #include <stdbool.h>
 
 /* local includes */
@@ -66,6 +67,9 @@ typedef struct _ip_address {
 	bool			iptable_rule_set;	/* TRUE if iptable drop rule
 							 * set to addr */
 	bool			garp_gna_pending;	/* Is a gratuitous ARP/NA message still to be sent */
+	char			*garp_frame;		/* Wire-ready gratuitous ARP (v4) or unsolicited NA
+							 * (v6) frame, built on first use */
+	bool			na_router;		/* Router flag the cached NA frame was built with */
 } ip_address_t;
 
 #define IPADDRESS_DEL 0
@@ -98,7 +102,15 @@ typedef struct _ip_address {
 struct ipt_handle;	// AAGH - TODO
 
 /* prototypes */
+/* Netlink request message for an address operation */
+typedef struct {
+	struct nlmsghdr n;
+	struct ifaddrmsg ifa;
+	char buf[256];
+} ipaddress_req_t;
+
 extern char *ipaddresstos(char *, ip_address_t *);
+extern void netlink_ipaddress_build(ip_address_t *, int, ipaddress_req_t *);
 extern int netlink_ipaddress(ip_address_t *, int);
 extern bool netlink_iplist(list, int, bool);
 extern void handle_iptable_rule_to_iplist(struct ipt_handle *, list, int, bool force);
@@ -108,6 +120,9 @@ extern ip_address_t *parse_ipaddress(ip_address_t *, char *, int);
 extern void alloc_ipaddress(list, vector_t *, interface_t *);
 extern void clear_diff_address(struct ipt_handle *, list, list);
 extern void clear_diff_saddresses(void);
-extern void iptables_init(void);
+extern void iptables_init_deferred(bool);
+extern void iptables_init_now(void);
+extern void iptables_shutdown(void);
+extern void nftables_fini(void);
 
 #endif
@@ -61,6 +61,16 @@ typedef struct _seq_counter {
 	uint32_t		seq_number;
 } seq_counter_t;
 
+/* Precomputed HMAC-MD5 pad states. The inner and outer key pads only
+ * depend on the key, so hashing them once per key instead of once per
+ * packet halves the MD5 work for the short AH frames. */
+typedef struct _hmac_md5_ctx {
+	MD5_CTX			ipad_ctx;	/* MD5 state after the inner key pad */
+	MD5_CTX			opad_ctx;	/* MD5 state after the outer key pad */
+} hmac_md5_ctx_t;
+
+extern void hmac_md5_init_ctx(hmac_md5_ctx_t *, unsigned char *, size_t);
+extern void hmac_md5_ctx(hmac_md5_ctx_t *, unsigned char *, size_t, unsigned char *);
 extern void hmac_md5(unsigned char *, size_t, unsigned char *, size_t, unsigned char *);
 
 #endif
@@ -32,6 +32,7 @@ bool has_ipset_setname(void*, const char *);
 bool ipset_init(void);
 void* ipset_session_start(void);
 void ipset_session_end(void*);
+bool ipset_session_commit(void*);
 void ipset_entry(void*, int cmd, const ip_address_t*);
 
 #endif
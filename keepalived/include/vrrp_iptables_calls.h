@@ -42,10 +42,16 @@ extern bool load_xtables_module(const char *, const char *);
 extern struct iptc_handle* ip4tables_open ( const char*);
 extern int ip4tables_close ( struct iptc_handle*, int);
 extern int ip4tables_is_chain(struct iptc_handle*, const char*);
+extern int ip4tables_create_chain(struct iptc_handle*, const char*);
+extern int ip4tables_flush_chain(struct iptc_handle*, const char*);
+extern int ip4tables_delete_chain(struct iptc_handle*, const char*);
 extern int ip4tables_process_entry( struct iptc_handle* handle, const char* chain_name, unsigned int rulenum, const char* target_name, const ip_address_t* src_ip_address, const ip_address_t* dst_ip_address, const char* in_iface, const char* out_iface, uint16_t protocol, uint8_t type, int cmd, bool force);
 extern struct ip6tc_handle* ip6tables_open ( const char* tablename );
 extern int ip6tables_close ( struct ip6tc_handle* handle, int updated );
 extern int ip6tables_is_chain(struct ip6tc_handle* handle, const char* chain_name);
+extern int ip6tables_create_chain(struct ip6tc_handle* handle, const char* chain_name);
+extern int ip6tables_flush_chain(struct ip6tc_handle* handle, const char* chain_name);
+extern int ip6tables_delete_chain(struct ip6tc_handle* handle, const char* chain_name);
 extern int ip6tables_process_entry( struct ip6tc_handle* handle, const char* chain_name, unsigned int rulenum, const char* target_name, const ip_address_t* src_ip_address, const ip_address_t* dst_ip_address, const char* in_iface, const char* out_iface, uint16_t protocol, uint8_t type, int cmd, bool force);
 extern int ip4tables_add_rules(struct iptc_handle* handle, const char* chain_name, unsigned int rulenum, uint8_t dim, uint8_t src_dst, const char* target_name, const char* set_name, uint16_t protocol, uint8_t param, int cmd, bool ignore_errors);
 extern int ip6tables_add_rules(struct ip6tc_handle* handle, const char* chain_name, unsigned int rulenum, uint8_t dim, uint8_t src_dst, const char* target_name, const char* set_name, uint16_t protocol, uint8_t param, int cmd, bool ignore_errors);
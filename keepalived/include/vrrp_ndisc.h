@@ -90,6 +90,7 @@ struct nd_opt_hdr {
 extern void ndisc_init(void);
 extern void ndisc_close(void);
 extern void ndisc_send_unsolicited_na(vrrp_t *, ip_address_t *);
+extern void ndisc_flush(void);
 extern void ndisc_send_unsolicited_na_immediate(interface_t *, ip_address_t *);
 
 #endif
@@ -27,7 +27,10 @@
 
 #include <stdio.h>
 
+extern void vrrp_dump_in_child(void (*) (void));
 extern void vrrp_print_data(void);
 extern void vrrp_print_stats(void);
+extern void vrrp_dump_socket_init(void);
+extern void vrrp_dump_socket_close(void);
 
 #endif
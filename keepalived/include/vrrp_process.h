@@ -0,0 +1,58 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        vrrp_process.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _VRRP_PROCESS_H
+#define _VRRP_PROCESS_H
+
+/* local includes */
+#include "list.h"
+#include "vector.h"
+
+/* Tracked process we count via the kernel proc connector */
+typedef struct _vrrp_process {
+	char			*pname;		/* object name */
+	char			*proc_name;	/* process name to match (comm, 15 chars) */
+	unsigned		count;		/* matching processes currently running */
+	unsigned		quorum;		/* processes required to be "up" */
+	int			weight;		/* default weight for trackers */
+} vrrp_process_t;
+
+/* Tracked process structure definition */
+typedef struct _tracked_process {
+	int			weight;		/* tracking weight when non-zero */
+	vrrp_process_t		*process;	/* process pointer, cannot be NULL */
+} tracked_process_t;
+
+#define PROCESS_ISUP(P)	((P)->count >= (P)->quorum)
+
+/* prototypes */
+extern void free_vrrp_process(void *);
+extern void dump_vrrp_process(void *);
+extern vrrp_process_t *find_process_by_name(char *);
+extern void dump_track_process(void *);
+extern void alloc_track_process(list, vector_t *, const char *);
+extern int vrrp_process_up(list);
+extern int vrrp_process_weight(list);
+extern void vrrp_process_init(list);
+extern void vrrp_process_close(void);
+
+#endif
@@ -65,9 +65,14 @@ do {						\
 
 /* extern prototypes */
 extern int vrrp_dispatcher_init(thread_t *);
+extern void vrrp_ring_close(sock_t *);
 extern void vrrp_dispatcher_release(vrrp_data_t *);
+extern void vrrp_dispatcher_park(vrrp_data_t *);
 extern int vrrp_lower_prio_gratuitous_arp_thread(thread_t *);
 extern void vrrp_set_effective_priority(vrrp_t *, uint8_t);
 extern int vrrp_arp_thread(thread_t *);
+extern void vrrp_garp_bucket_debit(unsigned);
+extern void vrrp_garp_refresh_reschedule(void);
+extern void vrrp_adv_flush_schedule(void);
 
 #endif
@@ -44,6 +44,7 @@
 extern void vrrp_init_instance_sands(vrrp_t *);
 extern void vrrp_sync_smtp_notifier(vrrp_sgroup_t *);
 extern void vrrp_sync_set_group(vrrp_sgroup_t *);
+extern void vrrp_sync_update_member_counts(vrrp_t *);
 extern int vrrp_sync_leave_fault(vrrp_t *);
 extern int vrrp_sync_goto_master(vrrp_t *);
 extern void vrrp_sync_backup(vrrp_t *);
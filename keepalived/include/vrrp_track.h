@@ -36,6 +36,7 @@
 #include "vector.h"
 #include "list.h"
 #include "notify.h"
+#include "vrrp_if.h"
 
 /* Macro definition */
 #define TRACK_ISUP(L)	(vrrp_tracked_up((L)))
@@ -70,6 +71,13 @@ typedef struct _vrrp_script {
 	uid_t			uid;		/* uid to run script as */
 	gid_t			gid;		/* gid to run script as */
 	bool			insecure;	/* Set if script is run by root, but is non-root modifiable */
+	bool			persistent;	/* script runs once and streams status lines on stdout */
+	pid_t			stream_pid;	/* pid of the persistent script, -1 when not running */
+	int			stream_fd;	/* read side of its stdout pipe, -1 when not running */
+	char			stream_buf[128];/* partial status line */
+	size_t			stream_len;
+	list			tracking_vrrp;	/* instances subscribed to this script's state */
+	bool			tracked_ok;	/* cached OK state last fanned out to subscribers */
 } vrrp_script_t;
 
 /* Tracked script structure definition */
@@ -78,11 +86,23 @@ typedef struct _tracked_sc {
 	vrrp_script_t		*scr;		/* script pointer, cannot be NULL */
 } tracked_sc_t;
 
+/* Subscription of a VRRP instance to a tracked interface, queued on the
+ * interface's tracking_vrrp list. Only a forward reference to the
+ * instance type is available here since vrrp.h includes this file. */
+struct _vrrp_t;
+typedef struct _tracking_vrrp {
+	struct _vrrp_t		*vrrp;		/* subscribing instance */
+	int			weight;		/* subscription weight, 0 for state tracking */
+} tracking_vrrp_t;
+
 /* prototypes */
 extern void dump_track(void *);
-extern void alloc_track(list, vector_t *);
+extern void alloc_track(struct _vrrp_t *, vector_t *);
+extern void vrrp_track_interface_update(interface_t *);
 extern void dump_track_script(void *);
-extern void alloc_track_script(list, vector_t *, const char *);
+extern void alloc_track_script(struct _vrrp_t *, vector_t *);
+extern void vrrp_script_tracker_update(vrrp_script_t *);
+extern void vrrp_dedup_scripts(void);
 extern int vrrp_tracked_up(list);
 extern void vrrp_log_tracked_down(list);
 extern int vrrp_tracked_weight(list);
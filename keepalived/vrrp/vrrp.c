@@ -67,6 +67,7 @@
 #include "vrrp_dbus.h"
 #include "global_data.h"
 #endif
+#include "trace.h"
 
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
@@ -126,6 +127,9 @@ vrrp_handle_accept_mode(vrrp_t *vrrp, int cmd, bool force)
 			log_message(LOG_INFO, "VRRP_Instance(%s) %s protocol %s", vrrp->iname,
 				(cmd == IPADDRESS_ADD) ? "setting" : "removing", "iptable drop rule");
 
+		/* The firewall subsystem initialises on first use */
+		iptables_init_now();
+
 #ifdef _HAVE_LIBIPTC_
 		do {
 #ifdef _LIBIPTC_DYNAMIC_
@@ -301,6 +305,18 @@ vrrp_get_header(sa_family_t family, char *buf, unsigned *proto)
 }
 
 #ifdef _WITH_VRRP_AUTH_
+/* Lazily build the per-instance HMAC pad states, so each AH advert
+ * only hashes the frame itself */
+static hmac_md5_ctx_t *
+vrrp_ah_hmac_ctx(vrrp_t * vrrp)
+{
+	if (!vrrp->ah_ctx) {
+		vrrp->ah_ctx = (hmac_md5_ctx_t *) MALLOC(sizeof (hmac_md5_ctx_t));
+		hmac_md5_init_ctx(vrrp->ah_ctx, vrrp->auth_data, sizeof (vrrp->auth_data));
+	}
+	return vrrp->ah_ctx;
+}
+
 /*
  * IPSEC AH incoming packet check.
  * return 0 for a valid pkt, != 0 otherwise.
@@ -359,10 +375,9 @@ vrrp_in_chk_ipsecah(vrrp_t * vrrp, char *buffer)
 	memset(digest, 0, 16);
 
 	/* Compute the ICV */
-	hmac_md5((unsigned char *) buffer,
-		 vrrp_iphdr_len() + vrrp_ipsecah_len() + vrrp_pkt_len(vrrp)
-		 , vrrp->auth_data, sizeof (vrrp->auth_data)
-		 , digest);
+	hmac_md5_ctx(vrrp_ah_hmac_ctx(vrrp), (unsigned char *) buffer,
+		     vrrp_iphdr_len() + vrrp_ipsecah_len() + vrrp_pkt_len(vrrp)
+		     , digest);
 
 	if (memcmp(backup_auth_data, digest, HMAC_MD5_TRUNC) != 0) {
 		log_message(LOG_INFO, "VRRP_Instance(%s) IPSEC-AH : invalid"
@@ -403,8 +418,9 @@ vrrp_in_chk_vips(vrrp_t * vrrp, ip_address_t *ipaddress, unsigned char *buffer)
  * return VRRP_PACKET_OK if the pkt is valid, or
  *	  VRRP_PACKET_KO if packet invalid or
  *	  VRRP_PACKET_DROP if packet not relevant to us
+ * Exported so the bench/ replay tool can drive the receive path.
  */
-static int
+int
 vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr)
 {
 	struct iphdr *ip;
@@ -793,6 +809,20 @@ vrrp_in_chk(vrrp_t * vrrp, char *buffer, ssize_t buflen_ret, bool check_vip_addr
 	return VRRP_PACKET_OK;
 }
 
+/* Incremental checksum update of a single 16 bit field, RFC 1624 eqn. 3:
+ * HC' = ~(~HC + ~m + m') */
+static uint16_t
+csum_update16(uint16_t old_check, uint16_t old_val, uint16_t new_val)
+{
+	uint32_t acc;
+
+	acc = (uint32_t)((uint16_t)~old_check) + (uint16_t)~old_val + new_val;
+	acc = (acc & 0xffff) + (acc >> 16);
+	acc = (acc & 0xffff) + (acc >> 16);
+
+	return (uint16_t)~acc;
+}
+
 /* build IP header */
 static void
 vrrp_build_ip4(vrrp_t * vrrp, char *buffer, uint32_t dst)
@@ -896,8 +926,51 @@ vrrp_build_ipsecah(vrrp_t * vrrp, char *buffer, size_t buflen)
 	   => No padding needed.
 	   -- rfc2402.3.3.3.1.1.1 & rfc2401.5
 	 */
-	hmac_md5((unsigned char *) buffer, buflen, vrrp->auth_data, sizeof (vrrp->auth_data)
-		 , digest);
+	memset(ah->auth_data, 0, sizeof (ah->auth_data));
+	hmac_md5_ctx(vrrp_ah_hmac_ctx(vrrp), (unsigned char *) buffer, buflen, digest);
+	memcpy(ah->auth_data, digest, HMAC_MD5_TRUNC);
+
+	/* Restore the ip mutable fields */
+	ip->tos = ip_mutable_fields.tos;
+	ip->frag_off = ip_mutable_fields.frag_off;
+	ip->check = ip_mutable_fields.check;
+	ip->ttl = ip_mutable_fields.ttl;
+}
+
+/* Refresh the per-advert AH fields of a cached frame: bump the sequence
+ * number and recompute the ICV. Everything else - addresses, lengths,
+ * SPI, VRRP payload - is reused exactly as built. */
+static void
+vrrp_ah_refresh(vrrp_t * vrrp, char *buffer, size_t buflen)
+{
+	ICV_mutable_fields ip_mutable_fields;
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	struct iphdr *ip = (struct iphdr *) (buffer);
+	ipsec_ah_t *ah = (ipsec_ah_t *) (buffer + sizeof (struct iphdr));
+
+	if (vrrp->ipsecah_counter->seq_number > 0xFFFFFFFD) {
+		vrrp->ipsecah_counter->cycle = 1;
+	} else {
+		vrrp->ipsecah_counter->seq_number++;
+	}
+
+	ah->seq_number = htonl(vrrp->ipsecah_counter->seq_number);
+
+	/* backup the ip mutable fields */
+	ip_mutable_fields.tos = ip->tos;
+	ip_mutable_fields.ttl = ip->ttl;
+	ip_mutable_fields.frag_off = ip->frag_off;
+	ip_mutable_fields.check = ip->check;
+
+	/* zero the ip mutable fields */
+	ip->tos = 0;
+	ip->frag_off = 0;
+	ip->check = 0;
+	if (!LIST_ISEMPTY(vrrp->unicast_peer))
+		ip->ttl = 0;
+
+	memset(ah->auth_data, 0, sizeof (ah->auth_data));
+	hmac_md5_ctx(vrrp_ah_hmac_ctx(vrrp), (unsigned char *) buffer, buflen, digest);
 	memcpy(ah->auth_data, digest, HMAC_MD5_TRUNC);
 
 	/* Restore the ip mutable fields */
@@ -1042,14 +1115,18 @@ vrrp_build_vrrp(vrrp_t *vrrp, uint8_t prio, char *buffer, struct iphdr* ip)
 	return vrrp_build_vrrp_v2(vrrp, prio, buffer);
 }
 
-/* build VRRP packet */
+/* build VRRP packet. The built frame is cached in the send buffer: as
+ * long as priority, source, destination and checksum mode are unchanged
+ * only the IP id needs patching, avoiding a full header/address-list
+ * rebuild and checksum every advert interval. */
 static void
 vrrp_build_pkt(vrrp_t * vrrp, uint8_t prio, struct sockaddr_storage *addr)
 {
 	char *bufptr;
-	uint32_t dst;
+	uint32_t dst = 0;
 	size_t len;
 	struct iphdr *ip;
+	uint16_t old_id;
 
 	/* save reference values */
 	bufptr = VRRP_SEND_BUFFER(vrrp);
@@ -1059,9 +1136,35 @@ vrrp_build_pkt(vrrp_t * vrrp, uint8_t prio, struct sockaddr_storage *addr)
 		/* build the ip header */
 		dst = (addr) ? inet_sockaddrip4(addr) :
 			       ((struct sockaddr_in *) &global_data->vrrp_mcast_group4)->sin_addr.s_addr;
-		vrrp_build_ip4(vrrp, bufptr, dst);
 		ip = (struct iphdr *)bufptr;
 
+		if (vrrp->send_buffer_valid &&
+		    vrrp->send_buffer_prio == prio &&
+		    vrrp->send_buffer_dst == dst &&
+#ifdef _WITH_UNICAST_CHKSUM_COMPAT_
+		    vrrp->send_buffer_chksum_compat == vrrp->unicast_chksum_compat &&
+#endif
+		    vrrp->send_buffer_src == VRRP_PKT_SADDR(vrrp)) {
+			/* Only the IP id changes; patch it and update the
+			 * header checksum incrementally */
+			old_id = ip->id;
+			ip->id = htons(++vrrp->ip_id);
+			/* kernel will fill in ID if left to 0, so we overflow to 1 */
+			if (vrrp->ip_id == 65535)
+				vrrp->ip_id = 1;
+			ip->check = csum_update16(ip->check, old_id, ip->id);
+
+#ifdef _WITH_VRRP_AUTH_
+			/* AH frames additionally carry a fresh sequence
+			 * number and ICV each advert */
+			if (vrrp->auth_type == VRRP_AUTH_AH)
+				vrrp_ah_refresh(vrrp, bufptr, len);
+#endif
+			return;
+		}
+
+		vrrp_build_ip4(vrrp, bufptr, dst);
+
 		/* build the vrrp header */
 		vrrp->send_buffer += vrrp_iphdr_len();
 
@@ -1085,12 +1188,28 @@ vrrp_build_pkt(vrrp_t * vrrp, uint8_t prio, struct sockaddr_storage *addr)
 		}
 #endif
 	} else if (vrrp->family == AF_INET6) {
+		/* The IPv6 frame has no mutable per-send field; reuse it as is */
+		if (vrrp->send_buffer_valid && vrrp->send_buffer_prio == prio)
+			return;
+
 		vrrp_build_vrrp(vrrp, prio, VRRP_SEND_BUFFER(vrrp), NULL);
+		dst = 0;
 	}
 
 	/* restore reference values */
 	vrrp->send_buffer = bufptr;
 	vrrp->send_buffer_size = len;
+
+	/* Note what the cached frame contains. AH frames are cached too;
+	 * their per-advert sequence number and ICV are refreshed in the
+	 * reuse path above. */
+	vrrp->send_buffer_prio = prio;
+	vrrp->send_buffer_dst = dst;
+	vrrp->send_buffer_src = (vrrp->family == AF_INET) ? VRRP_PKT_SADDR(vrrp) : 0;
+#ifdef _WITH_UNICAST_CHKSUM_COMPAT_
+	vrrp->send_buffer_chksum_compat = vrrp->unicast_chksum_compat;
+#endif
+	vrrp->send_buffer_valid = true;
 }
 
 /* send VRRP packet */
@@ -1119,48 +1238,77 @@ vrrp_build_ancillary_data(struct msghdr *msg, char *cbuf, struct sockaddr_storag
 	return 0;
 }
 
-static ssize_t
-vrrp_send_pkt(vrrp_t * vrrp, struct sockaddr_storage *addr)
-{
-	struct sockaddr_storage *src = &vrrp->saddr;
-	struct sockaddr_in6 dst6;
-	struct sockaddr_in dst4;
-	struct msghdr msg;
-	struct iovec iov;
-	char cbuf[256];
-
-	/* Build the message data */
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	iov.iov_base = VRRP_SEND_BUFFER(vrrp);
-	iov.iov_len = VRRP_SEND_BUFFER_SIZE(vrrp);
-
-	/* Unicast sending path */
-	if (addr && addr->ss_family == AF_INET) {
-		msg.msg_name = (struct sockaddr_in *) addr;
-		msg.msg_namelen = sizeof(struct sockaddr_in);
-	} else if (addr && addr->ss_family == AF_INET6) {
-		msg.msg_name = (struct sockaddr_in6 *) addr;
-		msg.msg_namelen = sizeof(struct sockaddr_in6);
-		vrrp_build_ancillary_data(&msg, cbuf, src);
-	} else if (vrrp->family == AF_INET) { /* Multicast sending path */
-		memset(&dst4, 0, sizeof(dst4));
-		dst4.sin_family = AF_INET;
-		dst4.sin_addr = ((struct sockaddr_in *) &global_data->vrrp_mcast_group4)->sin_addr;
-		msg.msg_name = &dst4;
-		msg.msg_namelen = sizeof(dst4);
-	} else if (vrrp->family == AF_INET6) {
-		memset(&dst6, 0, sizeof(dst6));
-		dst6.sin6_family = AF_INET6;
-		dst6.sin6_addr = ((struct sockaddr_in6 *) &global_data->vrrp_mcast_group6)->sin6_addr;
-		msg.msg_name = &dst6;
-		msg.msg_namelen = sizeof(dst6);
-		vrrp_build_ancillary_data(&msg, cbuf, src);
+/* Multicast advert transmit queue. Advert intervals cluster at whole
+ * seconds, so the instances' timers expire in the same scheduler wakeup;
+ * the adverts are collected here and flushed with one sendmmsg() per
+ * socket once the wakeup has run every due instance. The queued iovecs
+ * reference the instances' cached send buffers, so nothing is copied. */
+#define VRRP_ADV_TX_BATCH	64	/* adverts flushed per sendmmsg() call */
+
+static struct mmsghdr adv_tx_msg[VRRP_ADV_TX_BATCH];
+static struct iovec adv_tx_iov[VRRP_ADV_TX_BATCH];
+static struct sockaddr_storage adv_tx_dst[VRRP_ADV_TX_BATCH];
+static char adv_tx_cbuf[VRRP_ADV_TX_BATCH][CMSG_SPACE(sizeof(struct in6_pktinfo))];
+static int adv_tx_fd[VRRP_ADV_TX_BATCH];
+static unsigned adv_tx_count;
+
+/* Flush the queued adverts, one sendmmsg() per run of same-socket
+ * entries. Instances sharing an interface share fd_out and are walked
+ * in list order, so the runs are contiguous. */
+void
+vrrp_adv_flush(void)
+{
+	unsigned i, j;
+	int ret;
+
+	for (i = 0; i < adv_tx_count; i = j) {
+		for (j = i + 1; j < adv_tx_count && adv_tx_fd[j] == adv_tx_fd[i]; j++);
+
+		ret = sendmmsg(adv_tx_fd[i], &adv_tx_msg[i], j - i, MSG_DONTROUTE);
+		if (ret < (int)(j - i))
+			log_message(LOG_INFO, "VRRP: Error sending advert batch (%d of %u sent)",
+				    ret < 0 ? 0 : ret, j - i);
+	}
+
+	adv_tx_count = 0;
+}
+
+/* Queue the instance's cached advert into the next batch slot */
+static void
+vrrp_adv_queue(vrrp_t * vrrp)
+{
+	struct sockaddr_in6 *dst6;
+	struct sockaddr_in *dst4;
+	struct msghdr *msg;
+
+	msg = &adv_tx_msg[adv_tx_count].msg_hdr;
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_iov = &adv_tx_iov[adv_tx_count];
+	msg->msg_iovlen = 1;
+	adv_tx_iov[adv_tx_count].iov_base = VRRP_SEND_BUFFER(vrrp);
+	adv_tx_iov[adv_tx_count].iov_len = VRRP_SEND_BUFFER_SIZE(vrrp);
+
+	if (vrrp->family == AF_INET) {
+		dst4 = (struct sockaddr_in *) &adv_tx_dst[adv_tx_count];
+		memset(dst4, 0, sizeof(*dst4));
+		dst4->sin_family = AF_INET;
+		dst4->sin_addr = ((struct sockaddr_in *) &global_data->vrrp_mcast_group4)->sin_addr;
+		msg->msg_name = dst4;
+		msg->msg_namelen = sizeof(*dst4);
+	} else {
+		dst6 = (struct sockaddr_in6 *) &adv_tx_dst[adv_tx_count];
+		memset(dst6, 0, sizeof(*dst6));
+		dst6->sin6_family = AF_INET6;
+		dst6->sin6_addr = ((struct sockaddr_in6 *) &global_data->vrrp_mcast_group6)->sin6_addr;
+		msg->msg_name = dst6;
+		msg->msg_namelen = sizeof(*dst6);
+		vrrp_build_ancillary_data(msg, adv_tx_cbuf[adv_tx_count], &vrrp->saddr);
 	}
 
-	/* Send the packet */
-	return sendmsg(vrrp->fd_out, &msg, (addr) ? 0 : MSG_DONTROUTE);
+	adv_tx_fd[adv_tx_count] = vrrp->fd_out;
+
+	if (++adv_tx_count == VRRP_ADV_TX_BATCH)
+		vrrp_adv_flush();
 }
 
 /* Allocate the sending buffer */
@@ -1178,40 +1326,128 @@ vrrp_alloc_send_buffer(vrrp_t * vrrp)
 	}
 
 	vrrp->send_buffer = MALLOC(VRRP_SEND_BUFFER_SIZE(vrrp));
+	vrrp->send_buffer_valid = false;
+}
+
+/* Per-peer slot for the IPv6 ancillary data */
+#define VRRP_FANOUT_CBUF_LEN	CMSG_SPACE(sizeof(struct in6_pktinfo))
+
+/* Build the unicast fan-out vector - one msghdr per peer, pointing at
+ * that peer's cached frame. The peer list is config-stable, so this is
+ * done once per instance */
+static void
+vrrp_alloc_unicast_fanout(vrrp_t * vrrp)
+{
+	struct sockaddr_storage *addr;
+	struct msghdr *msg;
+	element e;
+	unsigned i;
+
+	vrrp->unicast_npeers = (unsigned)LIST_SIZE(vrrp->unicast_peer);
+	vrrp->unicast_frames = MALLOC(vrrp->unicast_npeers * VRRP_SEND_BUFFER_SIZE(vrrp));
+	vrrp->unicast_iov = MALLOC(vrrp->unicast_npeers * sizeof(struct iovec));
+	vrrp->unicast_msg = MALLOC(vrrp->unicast_npeers * sizeof(struct mmsghdr));
+	vrrp->unicast_dst = MALLOC(vrrp->unicast_npeers * sizeof(uint32_t));
+	vrrp->unicast_frame_valid = MALLOC(vrrp->unicast_npeers * sizeof(bool));
+	if (vrrp->family == AF_INET6)
+		vrrp->unicast_cbuf = MALLOC(vrrp->unicast_npeers * VRRP_FANOUT_CBUF_LEN);
+
+	i = 0;
+	for (e = LIST_HEAD(vrrp->unicast_peer); e; ELEMENT_NEXT(e), i++) {
+		addr = ELEMENT_DATA(e);
+		vrrp->unicast_iov[i].iov_base = vrrp->unicast_frames + i * VRRP_SEND_BUFFER_SIZE(vrrp);
+		vrrp->unicast_iov[i].iov_len = VRRP_SEND_BUFFER_SIZE(vrrp);
+		msg = &vrrp->unicast_msg[i].msg_hdr;
+		msg->msg_iov = &vrrp->unicast_iov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_name = addr;
+		msg->msg_namelen = (addr->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6)
+								 : sizeof(struct sockaddr_in);
+	}
+}
+
+/* Refresh each peer's cached frame and flush the whole fan-out with a
+ * single sendmmsg(). All the cache key fields are shared between the
+ * peers except the destination, which is swapped in and out around
+ * vrrp_build_pkt() so its caching stays effective per frame */
+static void
+vrrp_send_unicast_fanout(vrrp_t * vrrp, uint8_t prio)
+{
+	char *ref_buffer = vrrp->send_buffer;
+	struct sockaddr_storage *addr;
+	struct mmsghdr *msg;
+	element e;
+	unsigned i, left;
+	int ret;
+
+	for (i = 0, e = LIST_HEAD(vrrp->unicast_peer); e; ELEMENT_NEXT(e), i++) {
+		addr = ELEMENT_DATA(e);
+		vrrp->send_buffer = vrrp->unicast_iov[i].iov_base;
+		vrrp->send_buffer_dst = vrrp->unicast_dst[i];
+		vrrp->send_buffer_valid = vrrp->unicast_frame_valid[i];
+		vrrp_build_pkt(vrrp, prio, addr);
+		vrrp->unicast_dst[i] = vrrp->send_buffer_dst;
+		vrrp->unicast_frame_valid[i] = vrrp->send_buffer_valid;
+
+		if (addr->ss_family == AF_INET6)
+			vrrp_build_ancillary_data(&vrrp->unicast_msg[i].msg_hdr,
+						  vrrp->unicast_cbuf + i * VRRP_FANOUT_CBUF_LEN,
+						  &vrrp->saddr);
+	}
+	vrrp->send_buffer = ref_buffer;
+
+	msg = vrrp->unicast_msg;
+	left = vrrp->unicast_npeers;
+	while (left) {
+		ret = sendmmsg(vrrp->fd_out, msg, left, 0);
+		if (ret < 0) {
+			/* Skip the failing peer, the rest must still
+			 * get their advert */
+			log_message(LOG_INFO, "VRRP_Instance(%s) Cant send advert to %s (%m)"
+					    , vrrp->iname
+					    , inet_sockaddrtos(msg->msg_hdr.msg_name));
+			ret = 1;
+		}
+		msg += ret;
+		left -= (unsigned)ret;
+	}
 }
 
 /* send VRRP advertisement */
 int
 vrrp_send_adv(vrrp_t * vrrp, uint8_t prio)
 {
-	struct sockaddr_storage *addr;
-	list l = vrrp->unicast_peer;
-	element e;
-	ssize_t ret;
+	TRACE_PROBE3(vrrp_advert_send, vrrp->iname, vrrp->vrid, prio);
 
 	/* alloc send buffer */
 	if (!vrrp->send_buffer)
 		vrrp_alloc_send_buffer(vrrp);
-	else
-		memset(vrrp->send_buffer, 0, VRRP_SEND_BUFFER_SIZE(vrrp));
 
 	/* build the packet */
-	if (!LIST_ISEMPTY(l)) {
-		for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-			addr = ELEMENT_DATA(e);
-			vrrp_build_pkt(vrrp, prio, addr);
-			ret = vrrp_send_pkt(vrrp, addr);
-			if (ret < 0) {
-				log_message(LOG_INFO, "VRRP_Instance(%s) Cant send advert to %s (%m)"
-						    , vrrp->iname, inet_sockaddrtos(addr));
-			}
-		}
+	if (!LIST_ISEMPTY(vrrp->unicast_peer)) {
+		if (!vrrp->unicast_msg)
+			vrrp_alloc_unicast_fanout(vrrp);
+		vrrp_send_unicast_fanout(vrrp, prio);
 	} else {
 		vrrp_build_pkt(vrrp, prio, NULL);
-		vrrp_send_pkt(vrrp, NULL);
+		vrrp_adv_queue(vrrp);
+
+		/* Shutdown adverts must hit the wire before the socket is
+		 * closed; everything else is flushed at the end of the
+		 * scheduler wakeup so concurrent instances share syscalls */
+		if (prio == VRRP_PRIO_STOP)
+			vrrp_adv_flush();
+		else
+			vrrp_adv_flush_schedule();
 	}
 
 	++vrrp->stats->advert_sent;
+
+	/* A successor may only resume MASTER within the window this
+	 * timestamp anchors - see vrrp_state_file_restore() */
+	if (vrrp->chkpt && prio != VRRP_PRIO_STOP)
+		vrrp->chkpt->last_advert = (uint64_t)time_now.tv_sec;
+
 	/* sent it */
 	return 0;
 }
@@ -1269,6 +1505,7 @@ void
 vrrp_send_link_update(vrrp_t * vrrp, unsigned rep)
 {
 	unsigned j;
+	unsigned frames = 0;
 	ip_address_t *ipaddress;
 	element e;
 
@@ -1282,6 +1519,7 @@ vrrp_send_link_update(vrrp_t * vrrp, unsigned rep)
 			for (e = LIST_HEAD(vrrp->vip); e; ELEMENT_NEXT(e)) {
 				ipaddress = ELEMENT_DATA(e);
 				vrrp_send_update(vrrp, ipaddress, !j);
+				frames++;
 			}
 		}
 
@@ -1289,9 +1527,18 @@ vrrp_send_link_update(vrrp_t * vrrp, unsigned rep)
 			for (e = LIST_HEAD(vrrp->evip); e; ELEMENT_NEXT(e)) {
 				ipaddress = ELEMENT_DATA(e);
 				vrrp_send_update(vrrp, ipaddress, !j);
+				frames++;
 			}
 		}
 	}
+
+	/* All bursts debit the pacing bucket, so refreshes back off
+	 * after a transition storm */
+	vrrp_garp_bucket_debit(frames);
+
+	/* Flush the queued updates, one sendmmsg() per protocol */
+	gratuitous_arp_flush();
+	ndisc_flush();
 }
 
 static void
@@ -1317,18 +1564,46 @@ vrrp_remove_delayed_arp(vrrp_t *vrrp)
 	vrrp->gna_pending = false;
 }
 
-/* becoming master */
-static void
-vrrp_state_become_master(vrrp_t * vrrp)
+/* Append one slot to the instance's transition flight recorder.
+ * Called from notify_instance_exec() so every externally meaningful
+ * transition is captured at the cost of a single slot write. */
+void
+vrrp_history_record(vrrp_t * vrrp, int new_state)
 {
-	interface_t *ifp ;
-
-	++vrrp->stats->become_master;
+	vrrp_hist_entry_t *ent = &vrrp->hist[vrrp->hist_head % VRRP_HIST_ENTRIES];
+
+	ent->prev_state = vrrp->hist_head ?
+			  vrrp->hist[(vrrp->hist_head - 1) % VRRP_HIST_ENTRIES].new_state :
+			  (uint8_t)VRRP_STATE_INIT;
+	ent->new_state = (uint8_t)new_state;
+	/* Trackers force FAULT whatever event was being processed */
+	ent->reason = new_state == VRRP_STATE_FAULT ?
+		      VRRP_HIST_REASON_FAULT : vrrp->hist_reason;
+	ent->master_prio = vrrp->master_priority;
+	ent->ts = (uint32_t)time_now.tv_sec;
+	vrrp->hist_head++;
+
+	/* Keep the crash-restart checkpoint current */
+	if (vrrp->chkpt) {
+		vrrp->chkpt->state = (uint32_t)new_state;
+		vrrp->chkpt->effective_priority = vrrp->effective_priority;
+		vrrp->chkpt->updated = (uint64_t)time_now.tv_sec;
+	}
+}
 
-	if (vrrp->version == VRRP_VERSION_3)
-		log_message(LOG_INFO, "VRRP_Instance(%s) using locally configured advertisement interval (%d milli-sec)",
-					vrrp->iname, vrrp->adver_int / (TIMER_HZ / 1000));
+/* Two-phase transition support. While the dispatcher has a transition
+ * batch open, vrrp_state_become_master() applies only the kernel state
+ * and parks the instance; the link updates, notifications and traps of
+ * every parked instance run when the batch commits, after the kernel
+ * work of the whole tick has gone out in consolidated requests. */
+static bool transition_batch_open;
+static list transition_batch;		/* vrrp_t - borrowed pointers */
 
+/* becoming master - kernel phase: addresses, rules, routes and the
+ * accept-mode firewall entries */
+static void
+vrrp_state_master_kernel(vrrp_t * vrrp)
+{
 	/* add the ip addresses */
 	vrrp_handle_accept_mode(vrrp, IPADDRESS_ADD, false);
 	if (!LIST_ISEMPTY(vrrp->vip))
@@ -1338,16 +1613,23 @@ vrrp_state_become_master(vrrp_t * vrrp)
 	vrrp->vipset = 1;
 
 #ifdef _HAVE_FIB_ROUTING_
+	/* add virtual rules before the routes they select, so a lookup
+	 * hitting a rule is never routed by a stale table */
+	if (!LIST_ISEMPTY(vrrp->vrules))
+		vrrp_handle_iprules(vrrp, IPRULE_ADD, false);
+
 	/* add virtual routes */
 	if (!LIST_ISEMPTY(vrrp->vroutes))
 		vrrp_handle_iproutes(vrrp, IPROUTE_ADD);
-
-	/* add virtual rules */
-	if (!LIST_ISEMPTY(vrrp->vrules))
-		vrrp_handle_iprules(vrrp, IPRULE_ADD, false);
 #endif
+}
 
-	kernel_netlink_poll();
+/* becoming master - announcement phase: link updates, notifications,
+ * traps and sync daemon handling, once the kernel state is in place */
+static void
+vrrp_state_master_post(vrrp_t * vrrp)
+{
+	interface_t *ifp;
 
 	/* remotes neighbour update */
 	if (vrrp->family == AF_INET6) {
@@ -1360,6 +1642,7 @@ vrrp_state_become_master(vrrp_t * vrrp)
 	/* set refresh timer */
 	if (!timer_isnull(vrrp->garp_refresh)) {
 		vrrp->garp_refresh_timer = timer_add_now(vrrp->garp_refresh);
+		vrrp_garp_refresh_reschedule();
 	}
 
 	/* Check if notify is needed */
@@ -1383,9 +1666,72 @@ vrrp_state_become_master(vrrp_t * vrrp)
 	vrrp->last_transition = timer_now();
 }
 
+/* becoming master */
+static void
+vrrp_state_become_master(vrrp_t * vrrp)
+{
+	TRACE_PROBE2(vrrp_become_master, vrrp->iname, vrrp->vrid);
+
+	++vrrp->stats->become_master;
+
+	if (vrrp->version == VRRP_VERSION_3)
+		log_message(LOG_INFO, "VRRP_Instance(%s) using locally configured advertisement interval (%d milli-sec)",
+					vrrp->iname, vrrp->adver_int / (TIMER_HZ / 1000));
+
+	vrrp_state_master_kernel(vrrp);
+
+	/* Inside a batch the announcement phase is deferred until the
+	 * kernel work of every instance on the tick has been flushed */
+	if (transition_batch_open) {
+		if (!LIST_EXISTS(transition_batch))
+			transition_batch = alloc_list(NULL, NULL);
+		list_add(transition_batch, vrrp);
+		return;
+	}
+
+	kernel_netlink_poll();
+
+	vrrp_state_master_post(vrrp);
+}
+
+/* Open a transition batch: kernel requests the tick generates are held
+ * on the netlink command channel and the announcement phase of every
+ * master transition is parked until the commit. */
+void
+vrrp_transition_batch_begin(void)
+{
+	transition_batch_open = true;
+	netlink_batch_hold();
+}
+
+/* Push the tick's kernel work as consolidated requests, drain the
+ * resulting events once, then run the parked announcement phases */
+void
+vrrp_transition_batch_commit(void)
+{
+	element e;
+
+	transition_batch_open = false;
+	netlink_batch_release(&nl_cmd);
+
+	if (LIST_ISEMPTY(transition_batch)) {
+		free_list(&transition_batch);
+		return;
+	}
+
+	kernel_netlink_poll();
+
+	for (e = LIST_HEAD(transition_batch); e; ELEMENT_NEXT(e))
+		vrrp_state_master_post(ELEMENT_DATA(e));
+
+	free_list(&transition_batch);
+}
+
 void
 vrrp_state_goto_master(vrrp_t * vrrp)
 {
+	TRACE_PROBE2(vrrp_goto_master, vrrp->iname, vrrp->vrid);
+
 	/* check sync-group status */
 	if (vrrp->sync && !vrrp_sync_goto_master(vrrp))
 		return;
@@ -1462,11 +1808,17 @@ vrrp_restore_interface(vrrp_t * vrrp, bool advF, bool force)
 void
 vrrp_state_leave_master(vrrp_t * vrrp)
 {
+	TRACE_PROBE3(vrrp_leave_master, vrrp->iname, vrrp->vrid, vrrp->wantstate);
+
 	if (VRRP_VIP_ISSET(vrrp)) {
 #ifdef _WITH_LVS_
 		/* Check if sync daemon handling is needed */
-		if (global_data->lvs_syncd.vrrp == vrrp)
+		if (global_data->lvs_syncd.vrrp == vrrp) {
 			ipvs_syncd_backup(&global_data->lvs_syncd);
+			/* No longer the sync sender - undo any
+			 * pre-failover tightening */
+			ipvs_syncd_relax();
+		}
 #endif
 	}
 
@@ -1509,6 +1861,8 @@ vrrp_state_backup(vrrp_t * vrrp, char *buf, ssize_t buflen)
 	unsigned master_adver_int, proto;
 	bool check_addr = false;
 
+	TRACE_PROBE3(vrrp_advert_recv, vrrp->iname, vrrp->vrid, vrrp->state);
+
 	/* Process the incoming packet */
 	hd = vrrp_get_header(vrrp->family, buf, &proto);
 	if (!vrrp->skip_check_adv_addr ||
@@ -1600,11 +1954,9 @@ vrrp_state_master_tx(vrrp_t * vrrp, const int prio)
 				    , vrrp->iname);
 		vrrp_state_become_master(vrrp);
 		ret = 1;
-	} else if (!timer_isnull(vrrp->garp_refresh) &&
-		   timer_cmp(time_now, vrrp->garp_refresh_timer) > 0) {
-		vrrp_send_link_update(vrrp, vrrp->garp_refresh_rep);
-		vrrp->garp_refresh_timer = timer_add_now(vrrp->garp_refresh);
 	}
+	/* garp refreshes are fired by the consolidated per-tick
+	 * scheduler, not from each instance's advert timer */
 
 	vrrp_send_adv(vrrp,
 		      (prio == VRRP_PRIO_OWNER) ? VRRP_PRIO_OWNER :
@@ -1649,6 +2001,8 @@ vrrp_state_master_rx(vrrp_t * vrrp, char *buf, ssize_t buflen)
 	unsigned master_adver_int;
 	int addr_cmp;
 
+	TRACE_PROBE3(vrrp_advert_recv, vrrp->iname, vrrp->vrid, vrrp->state);
+
 	/* return on link failure */
 	if (vrrp->wantstate == VRRP_STATE_GOTO_FAULT) {
 		vrrp->ms_down_timer = 3 * vrrp->adver_int + VRRP_TIMER_SKEW(vrrp);
@@ -1842,6 +2196,7 @@ open_vrrp_send_socket(sa_family_t family, int proto, ifindex_t idx, bool unicast
 			if_setsockopt_bindtodevice(&fd, ifp);
 	} else if (family == AF_INET6) {
 		/* Set v6 related */
+		if_setsockopt_mcast_all(family, &fd);
 		if_setsockopt_ipv6_checksum(&fd);
 		if (!unicast)
 			if_setsockopt_mcast_hops(family, &fd);
@@ -1882,8 +2237,7 @@ open_vrrp_read_socket(sa_family_t family, int proto, ifindex_t idx, bool unicast
 #endif
 
 	/* Ensure no unwanted multicast packets are queued to this interface */
-	if (family == AF_INET)
-		if_setsockopt_mcast_all(family, &fd);
+	if_setsockopt_mcast_all(family, &fd);
 
 	if (!unicast) {
 		/* Join the VRRP multicast group */
@@ -1898,6 +2252,11 @@ open_vrrp_read_socket(sa_family_t family, int proto, ifindex_t idx, bool unicast
 	 */
 	if_setsockopt_bindtodevice(&fd, ifp);
 
+#ifdef _VRRP_LATENCY_STATS_
+	/* Kernel receive timestamps for the advert latency statistics */
+	if_setsockopt_timestampns(&fd);
+#endif
+
 	if (fd < 0)
 		return -1;
 
@@ -2001,7 +2360,7 @@ shutdown_vrrp_instances(void)
 
 		/* Run stop script */
 		if (vrrp->script_stop)
-			notify_exec(vrrp->script_stop);
+			notify_exec(vrrp->script_stop, vrrp);
 
 		notify_instance_fifo(vrrp, VRRP_STATE_STOP);
 
@@ -2140,6 +2499,26 @@ vrrp_complete_instance(vrrp_t * vrrp)
 		}
 	}
 
+#if defined IFA_F_OPTIMISTIC && defined IFA_F_NODAD
+	/* Propagate the instance DAD preference to any IPv6 VIP that has
+	 * not expressed its own */
+	if (vrrp->optimistic_dad) {
+		for (i = 0; i < 2; i++) {
+			list addr_list = i ? vrrp->evip : vrrp->vip;
+
+			if (LIST_ISEMPTY(addr_list))
+				continue;
+			for (e = LIST_HEAD(addr_list); e; ELEMENT_NEXT(e)) {
+				vip = ELEMENT_DATA(e);
+				if (IP_IS6(vip) && !(vip->flagmask & (IFA_F_OPTIMISTIC | IFA_F_NODAD))) {
+					vip->flags |= IFA_F_OPTIMISTIC;
+					vip->flagmask |= IFA_F_OPTIMISTIC | IFA_F_NODAD;
+				}
+			}
+		}
+	}
+#endif
+
 	if (vrrp->base_priority == 0) {
 		if (vrrp->wantstate == VRRP_STATE_MAST)
 			vrrp->base_priority = VRRP_PRIO_OWNER;
@@ -2404,8 +2783,10 @@ vrrp_complete_instance(vrrp_t * vrrp)
 			}
 		}
 
-		/* Create the interface if it doesn't already exist */
-		if (!__test_bit(VRRP_VMAC_UP_BIT, &vrrp->vmac_flags))
+		/* Create the interface if it doesn't already exist. In
+		 * config-test mode the validation must not touch the kernel */
+		if (!__test_bit(VRRP_VMAC_UP_BIT, &vrrp->vmac_flags) &&
+		    !__test_bit(CONFIG_TEST_BIT, &debug))
 			netlink_link_add_vmac(vrrp);
 
 		/* set scopeid of source address if IPv6 */
@@ -2474,8 +2855,7 @@ vrrp_complete_init(void)
 	element e, oe, se;
 	vrrp_t *vrrp;
 	vrrp_sgroup_t *sgroup, *old_sgroup;
-	list l_o;
-	element e_o;
+	hlist_node_t *n_o;
 	element next;
 	vrrp_t *vrrp_o;
 	ifindex_t ifindex;
@@ -2503,13 +2883,16 @@ vrrp_complete_init(void)
 	if (global_data->vrrp_garp_interval || global_data->vrrp_gna_interval)
 		set_default_garp_delay();
 
+	/* Merge vrrp_script entries that run the identical command, so it
+	 * is forked once per interval however many names it has */
+	vrrp_dedup_scripts();
+
 	/* Mark any scripts as insecure */
 	check_vrrp_script_security();
 
 	/* Make sure don't have same vrid on same interface with same address family */
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vrrp = ELEMENT_DATA(e);
-		l_o = &vrrp_data->vrrp_index[vrrp->vrid];
 #ifdef _HAVE_VRRP_VMAC_
 		if (__test_bit(VRRP_VMAC_BIT, &vrrp->vmac_flags))
 			ifindex = vrrp->ifp->base_ifindex;
@@ -2517,25 +2900,22 @@ vrrp_complete_init(void)
 #endif
 			ifindex = vrrp->ifp->ifindex;
 
-		/* Check if any other entries with same vrid conflict */
-		if (!LIST_ISEMPTY(l_o) && LIST_SIZE(l_o) > 1) {
-			/* Can't have same vrid with same family an interface */
-			for (e_o = LIST_HEAD(l_o); e_o; ELEMENT_NEXT(e_o)) {
-				vrrp_o = ELEMENT_DATA(e_o);
-				if (vrrp_o != vrrp &&
-				    vrrp_o->family == vrrp->family) {
+		/* Check if any other entries with same vrid conflict.
+		 * Can't have same vrid with same family an interface. */
+		hlist_for_each_entry(vrrp_o, n_o, &vrrp_data->vrrp_index[vrrp->vrid], index_node) {
+			if (vrrp_o != vrrp &&
+			    vrrp_o->family == vrrp->family) {
 #ifdef _HAVE_VRRP_VMAC_
-					if (__test_bit(VRRP_VMAC_BIT, &vrrp_o->vmac_flags))
-						ifindex_o = vrrp_o->ifp->base_ifindex;
-					else
+				if (__test_bit(VRRP_VMAC_BIT, &vrrp_o->vmac_flags))
+					ifindex_o = vrrp_o->ifp->base_ifindex;
+				else
 #endif
-						ifindex_o = vrrp_o->ifp->ifindex;
+					ifindex_o = vrrp_o->ifp->ifindex;
 
-					if (ifindex == ifindex_o)
-					{
-						log_message(LOG_INFO, "VRID %d is duplicated on interface %s", vrrp->vrid, if_get_by_ifindex(ifindex)->ifname);
-						return false;
-					}
+				if (ifindex == ifindex_o)
+				{
+					log_message(LOG_INFO, "VRID %d is duplicated on interface %s", vrrp->vrid, if_get_by_ifindex(ifindex)->ifname);
+					return false;
 				}
 			}
 		}
@@ -2621,6 +3001,8 @@ vrrp_complete_init(void)
 							/* Do nothing */
 							break;
 						}
+
+						vrrp_sync_update_member_counts(vrrp);
 					}
 
 					notify_group_exec(sgroup, sgroup->state);
@@ -2787,6 +3169,7 @@ restore_vrrp_state(vrrp_t *old_vrrp, vrrp_t *vrrp)
 	/* Keep VRRP state, ipsec AH seq_number */
 	vrrp->state = old_vrrp->state;
 	vrrp->wantstate = old_vrrp->state;
+	vrrp_sync_update_member_counts(vrrp);
 	if (!old_vrrp->sync)
 		vrrp->effective_priority = old_vrrp->effective_priority;
 	/* Save old stats */
@@ -2807,10 +3190,10 @@ restore_vrrp_state(vrrp_t *old_vrrp, vrrp_t *vrrp)
 				added_ip_addr = true;
 		}
 #ifdef _HAVE_FIB_ROUTING_
-		if (!LIST_ISEMPTY(vrrp->vroutes))
-			vrrp_handle_iproutes(vrrp, IPROUTE_ADD);
 		if (!LIST_ISEMPTY(vrrp->vrules))
 			vrrp_handle_iprules(vrrp, IPRULE_ADD, false);
+		if (!LIST_ISEMPTY(vrrp->vroutes))
+			vrrp_handle_iproutes(vrrp, IPROUTE_ADD);
 #endif
 	}
 
@@ -2894,6 +3277,7 @@ clear_diff_vrrp(void)
 				/* set refresh timer */
 				if (!timer_isnull(new_vrrp->garp_refresh)) {
 					new_vrrp->garp_refresh_timer = timer_add_now(new_vrrp->garp_refresh);
+					vrrp_garp_refresh_reschedule();
 				}
 			}
 		}
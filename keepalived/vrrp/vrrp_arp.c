@@ -38,42 +38,56 @@
 #endif
 
 /* static vars */
-static char *garp_buffer;
+#define GARP_TX_BATCH	64	/* frames flushed per sendmmsg() call */
+#define GARP_FRAME_LEN	(sizeof(arphdr_t) + ETHER_HDR_LEN)
+
+static char *garp_tx_frame[GARP_TX_BATCH];	/* cached frames queued for the next flush */
+static struct sockaddr_ll garp_tx_sll[GARP_TX_BATCH];
+static unsigned garp_tx_count;
 static int garp_fd;
 
-/* Send the gratuitous ARP message */
-static ssize_t send_arp(ip_address_t *ipaddress)
+/* Flush the queued gratuitous ARP frames with a single sendmmsg() call */
+void gratuitous_arp_flush(void)
 {
-	struct sockaddr_ll sll;
-	ssize_t len;
+	struct mmsghdr msgs[GARP_TX_BATCH];
+	struct iovec iovs[GARP_TX_BATCH];
+	unsigned i;
+	int ret;
 
-	/* Build the dst device */
-	memset(&sll, 0, sizeof(sll));
-	sll.sll_family = AF_PACKET;
-	memcpy(sll.sll_addr, IF_HWADDR(ipaddress->ifp), ETH_ALEN);
-	sll.sll_halen = ETHERNET_HW_LEN;
-	sll.sll_ifindex = (int)IF_INDEX(ipaddress->ifp);
+	if (!garp_tx_count)
+		return;
 
-	if (__test_bit(LOG_DETAIL_BIT, &debug))
-		log_message(LOG_INFO, "Sending gratuitous ARP on %s for %s",
-			    IF_NAME(ipaddress->ifp), inet_ntop2(ipaddress->u.sin.sin_addr.s_addr));
+	memset(msgs, 0, garp_tx_count * sizeof(msgs[0]));
+	for (i = 0; i < garp_tx_count; i++) {
+		iovs[i].iov_base = garp_tx_frame[i];
+		iovs[i].iov_len = GARP_FRAME_LEN;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &garp_tx_sll[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(garp_tx_sll[i]);
+	}
 
-	/* Send packet */
-	len = sendto(garp_fd, garp_buffer, sizeof(arphdr_t) + ETHER_HDR_LEN
-		     , 0, (struct sockaddr *)&sll, sizeof(sll));
-	if (len < 0)
-		log_message(LOG_INFO, "Error sending gratuitous ARP on %s for %s",
-			    IF_NAME(ipaddress->ifp), inet_ntop2(ipaddress->u.sin.sin_addr.s_addr));
-	return len;
+	/* Send packets */
+	ret = sendmmsg(garp_fd, msgs, garp_tx_count, 0);
+	if (ret < (int)garp_tx_count)
+		log_message(LOG_INFO, "Error sending gratuitous ARP batch (%d of %u sent)",
+			    ret < 0 ? 0 : ret, garp_tx_count);
+
+	/* Cleanup room for next round */
+	garp_tx_count = 0;
 }
 
-/* Build a gratuitous ARP message over a specific interface */
-ssize_t send_gratuitous_arp_immediate(interface_t *ifp, ip_address_t *ipaddress)
+/* Build the wire-ready gratuitous ARP frame for an address. The frame
+ * is fully determined by the address and the interface MAC, so it is
+ * built once and reused for every transition and refresh burst. Built
+ * lazily rather than at config load since VMAC interfaces only get
+ * their MAC when the instance starts. */
+static void build_garp_frame(ip_address_t *ipaddress)
 {
-	struct ether_header *eth = (struct ether_header *) garp_buffer;
-	arphdr_t *arph		 = (arphdr_t *) (garp_buffer + ETHER_HDR_LEN);
+	char *buf		 = (char *)MALLOC(GARP_FRAME_LEN);
+	struct ether_header *eth = (struct ether_header *) buf;
+	arphdr_t *arph		 = (arphdr_t *) (buf + ETHER_HDR_LEN);
 	char *hwaddr		 = (char *) IF_HWADDR(ipaddress->ifp);
-	ssize_t len;
 
 	/* Ethernet header */
 	memset(eth->ether_dhost, 0xFF, ETH_ALEN);
@@ -91,16 +105,45 @@ ssize_t send_gratuitous_arp_immediate(interface_t *ifp, ip_address_t *ipaddress)
 	memset(arph->__ar_tha, 0xFF, ETH_ALEN);
 	memcpy(arph->__ar_tip, &ipaddress->u.sin.sin_addr.s_addr, sizeof(struct in_addr));
 
-	/* Send the ARP message */
-	len = send_arp(ipaddress);
+	ipaddress->garp_frame = buf;
+}
+
+/* Queue the cached gratuitous ARP frame into the next batch slot */
+static void queue_garp_frame(interface_t *ifp, ip_address_t *ipaddress)
+{
+	struct sockaddr_ll *sll	 = &garp_tx_sll[garp_tx_count];
+
+	if (!ipaddress->garp_frame)
+		build_garp_frame(ipaddress);
+
+	garp_tx_frame[garp_tx_count] = ipaddress->garp_frame;
+
+	/* Build the dst device */
+	memset(sll, 0, sizeof(*sll));
+	sll->sll_family = AF_PACKET;
+	memcpy(sll->sll_addr, IF_HWADDR(ipaddress->ifp), ETH_ALEN);
+	sll->sll_halen = ETHERNET_HW_LEN;
+	sll->sll_ifindex = (int)IF_INDEX(ipaddress->ifp);
+
+	if (__test_bit(LOG_DETAIL_BIT, &debug))
+		log_message(LOG_INFO, "Sending gratuitous ARP on %s for %s",
+			    IF_NAME(ipaddress->ifp), inet_ntop2(ipaddress->u.sin.sin_addr.s_addr));
+
+	if (++garp_tx_count == GARP_TX_BATCH)
+		gratuitous_arp_flush();
 
 	/* If we have to delay between sending garps, note the next time we can */
 	if (ifp->garp_delay && ifp->garp_delay->have_garp_interval)
 		ifp->garp_delay->garp_next_time = timer_add_now(ifp->garp_delay->garp_interval);
+}
 
-	/* Cleanup room for next round */
-	memset(garp_buffer, 0, sizeof(arphdr_t) + ETHER_HDR_LEN);
-	return len;
+/* Build and send a gratuitous ARP message over a specific interface */
+ssize_t send_gratuitous_arp_immediate(interface_t *ifp, ip_address_t *ipaddress)
+{
+	queue_garp_frame(ifp, ipaddress);
+	gratuitous_arp_flush();
+
+	return 0;
 }
 
 static void queue_garp(vrrp_t *vrrp, interface_t *ifp, ip_address_t *ipaddress)
@@ -137,7 +180,9 @@ void send_gratuitous_arp(vrrp_t *vrrp, ip_address_t *ipaddress)
 		}
 	}
 
-	send_gratuitous_arp_immediate(ifp, ipaddress);
+	/* Queue the frame; the caller flushes the batch once all the
+	 * updates of a link update round have been built */
+	queue_garp_frame(ifp, ipaddress);
 }
 
 /*
@@ -145,9 +190,6 @@ void send_gratuitous_arp(vrrp_t *vrrp, ip_address_t *ipaddress)
  */
 void gratuitous_arp_init(void)
 {
-	/* Initalize shared buffer */
-	garp_buffer = (char *)MALLOC(sizeof(arphdr_t) + ETHER_HDR_LEN);
-
 	/* Create the socket descriptor */
 	garp_fd = socket(PF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_RARP));
 
@@ -165,6 +207,6 @@ void gratuitous_arp_init(void)
 }
 void gratuitous_arp_close(void)
 {
-	FREE(garp_buffer);
+	gratuitous_arp_flush();
 	close(garp_fd);
 }
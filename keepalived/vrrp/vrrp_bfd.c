@@ -0,0 +1,599 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        BFD session engine (RFC 5880/5881 asynchronous mode
+ *              subset) feeding the VRRP tracking framework, so that
+ *              neighbor failure can be detected in tens of milliseconds
+ *              without shrinking the advert interval.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+/* local include */
+#include "vrrp_bfd.h"
+#include "vrrp_data.h"
+#include "memory.h"
+#include "list.h"
+#include "logger.h"
+#include "utils.h"
+
+/* One control socket pair per address family, shared by every session.
+ * [0] is IPv4, [1] is IPv6. The rx socket is bound to the well-known
+ * BFD control port, the tx socket to the bottom of the RFC 5881 source
+ * port range with TTL forced to 255 (GTSM). */
+static int bfd_fd_in[2] = { -1, -1 };
+static int bfd_fd_out[2] = { -1, -1 };
+static thread_t *bfd_reader[2];
+
+/* Discriminator allocator - seeded from the clock so discriminators
+ * are unlikely to repeat across a daemon restart */
+static uint32_t bfd_next_discr;
+
+static int bfd_receive_thread(thread_t *);
+static int bfd_tx_thread(thread_t *);
+static int bfd_detect_thread(thread_t *);
+
+static const char *
+bfd_state_str(int state)
+{
+	switch (state) {
+	case BFD_STATE_ADMINDOWN:
+		return "ADMINDOWN";
+	case BFD_STATE_DOWN:
+		return "DOWN";
+	case BFD_STATE_INIT:
+		return "INIT";
+	case BFD_STATE_UP:
+		return "UP";
+	}
+	return "unknown";
+}
+
+static int
+bfd_family_slot(vrrp_bfd_t *bfd)
+{
+	return (bfd->nbr_addr.ss_family == AF_INET6) ? 1 : 0;
+}
+
+/* Compare a received source address against the configured neighbor,
+ * ignoring the (ephemeral) source port */
+static bool
+bfd_addr_match(struct sockaddr_storage *src, struct sockaddr_storage *nbr)
+{
+	if (src->ss_family != nbr->ss_family)
+		return false;
+
+	if (src->ss_family == AF_INET6)
+		return !memcmp(&((struct sockaddr_in6 *) src)->sin6_addr,
+			       &((struct sockaddr_in6 *) nbr)->sin6_addr,
+			       sizeof(struct in6_addr));
+
+	return ((struct sockaddr_in *) src)->sin_addr.s_addr ==
+	       ((struct sockaddr_in *) nbr)->sin_addr.s_addr;
+}
+
+/* Current control packet transmit interval, usec. Until both ends are
+ * up RFC 5880 6.8.3 imposes a 1s floor, afterwards we may not send
+ * faster than the neighbor agreed to receive. */
+static uint32_t
+bfd_tx_interval(vrrp_bfd_t *bfd)
+{
+	uint32_t interval;
+
+	if (bfd->local_state != BFD_STATE_UP || bfd->remote_state != BFD_STATE_UP)
+		return BFD_SLOW_TX;
+
+	interval = bfd->min_tx;
+	if (bfd->remote_min_rx > interval)
+		interval = bfd->remote_min_rx;
+	return interval;
+}
+
+/* Detection time - the neighbor's multiplier applied to the agreed
+ * receive interval (RFC 5880 6.8.4) */
+static uint32_t
+bfd_detect_time(vrrp_bfd_t *bfd)
+{
+	uint32_t interval = bfd->min_rx;
+
+	if (bfd->remote_min_tx > interval)
+		interval = bfd->remote_min_tx;
+	return bfd->remote_mult * interval;
+}
+
+/* Reschedule the periodic transmit, jittered to 75-100% of the
+ * interval as required by RFC 5880 6.8.7 */
+static void
+bfd_tx_schedule(vrrp_bfd_t *bfd)
+{
+	uint32_t interval = bfd_tx_interval(bfd);
+
+	if (bfd->tx_thread)
+		thread_cancel(bfd->tx_thread);
+	bfd->tx_thread = thread_add_timer(master, bfd_tx_thread, bfd,
+					  interval * (75 + rand() % 26) / 100);
+}
+
+static void
+bfd_state_transition(vrrp_bfd_t *bfd, int new_state)
+{
+	if (new_state == bfd->local_state)
+		return;
+
+	log_message(LOG_INFO, "BFD_Instance(%s) Entering %s STATE"
+			    , bfd->bname, bfd_state_str(new_state));
+	bfd->local_state = new_state;
+
+	if (new_state == BFD_STATE_DOWN) {
+		bfd->remote_discr = 0;
+		bfd->remote_min_rx = 0;
+		bfd->remote_min_tx = 0;
+		if (bfd->detect_thread) {
+			thread_cancel(bfd->detect_thread);
+			bfd->detect_thread = NULL;
+		}
+	}
+
+	/* Converge quickly - do not sit out the remainder of a slow
+	 * interval before telling the neighbor about the change */
+	bfd_tx_schedule(bfd);
+}
+
+static void
+bfd_build_pkt(vrrp_bfd_t *bfd, bfd_pkt_t *pkt)
+{
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->vers_diag = 1 << 5;
+	pkt->flags = (uint8_t) (bfd->local_state << 6);
+	pkt->detect_mult = (uint8_t) bfd->multiplier;
+	pkt->len = BFD_PKT_LEN;
+	pkt->local_discr = htonl(bfd->local_discr);
+	pkt->remote_discr = htonl(bfd->remote_discr);
+	pkt->min_tx_int = htonl(bfd->min_tx);
+	pkt->min_rx_int = htonl(bfd->min_rx);
+}
+
+/* Periodic control packet transmit */
+static int
+bfd_tx_thread(thread_t *thread)
+{
+	vrrp_bfd_t *bfd = THREAD_ARG(thread);
+	struct sockaddr_storage dst;
+	bfd_pkt_t pkt;
+	int fd = bfd_fd_out[bfd_family_slot(bfd)];
+
+	bfd->tx_thread = NULL;
+
+	bfd_build_pkt(bfd, &pkt);
+
+	dst = bfd->nbr_addr;
+	if (dst.ss_family == AF_INET6)
+		((struct sockaddr_in6 *) &dst)->sin6_port = htons(BFD_PORT_CTRL);
+	else
+		((struct sockaddr_in *) &dst)->sin_port = htons(BFD_PORT_CTRL);
+
+	if (sendto(fd, &pkt, sizeof(pkt), 0, (struct sockaddr *) &dst,
+		   sizeof(dst)) < 0 && errno != EAGAIN)
+		log_message(LOG_INFO, "BFD_Instance(%s) send error %d (%m)"
+				    , bfd->bname, errno);
+
+	bfd_tx_schedule(bfd);
+	return 0;
+}
+
+/* Detection time expired - the neighbor stopped talking to us */
+static int
+bfd_detect_thread(thread_t *thread)
+{
+	vrrp_bfd_t *bfd = THREAD_ARG(thread);
+
+	bfd->detect_thread = NULL;
+
+	log_message(LOG_INFO, "BFD_Instance(%s) Detection time expired"
+			    , bfd->bname);
+	bfd->remote_state = BFD_STATE_DOWN;
+	bfd_state_transition(bfd, BFD_STATE_DOWN);
+	return 0;
+}
+
+/* Match a received packet to a session - by our discriminator when the
+ * neighbor has echoed it back, by source address while it has not
+ * learnt it yet (RFC 5880 6.8.6) */
+static vrrp_bfd_t *
+bfd_find_session(uint32_t your_discr, struct sockaddr_storage *src)
+{
+	element e;
+	vrrp_bfd_t *bfd;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp_bfd))
+		return NULL;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_bfd); e; ELEMENT_NEXT(e)) {
+		bfd = ELEMENT_DATA(e);
+		if (your_discr) {
+			if (bfd->local_discr == your_discr)
+				return bfd;
+		} else if (bfd_addr_match(src, &bfd->nbr_addr))
+			return bfd;
+	}
+	return NULL;
+}
+
+static void
+bfd_handle_pkt(vrrp_bfd_t *bfd, bfd_pkt_t *pkt)
+{
+	bfd->remote_discr = ntohl(pkt->local_discr);
+	bfd->remote_state = BFD_PKT_STATE(pkt);
+	bfd->remote_min_rx = ntohl(pkt->min_rx_int);
+	bfd->remote_min_tx = ntohl(pkt->min_tx_int);
+	bfd->remote_mult = pkt->detect_mult;
+
+	/* State machine, RFC 5880 6.8.6 */
+	if (bfd->remote_state == BFD_STATE_ADMINDOWN) {
+		if (bfd->local_state != BFD_STATE_DOWN)
+			bfd_state_transition(bfd, BFD_STATE_DOWN);
+		return;
+	}
+
+	switch (bfd->local_state) {
+	case BFD_STATE_DOWN:
+		if (bfd->remote_state == BFD_STATE_DOWN)
+			bfd_state_transition(bfd, BFD_STATE_INIT);
+		else if (bfd->remote_state == BFD_STATE_INIT)
+			bfd_state_transition(bfd, BFD_STATE_UP);
+		break;
+	case BFD_STATE_INIT:
+		if (bfd->remote_state == BFD_STATE_INIT ||
+		    bfd->remote_state == BFD_STATE_UP)
+			bfd_state_transition(bfd, BFD_STATE_UP);
+		break;
+	case BFD_STATE_UP:
+		if (bfd->remote_state == BFD_STATE_DOWN)
+			bfd_state_transition(bfd, BFD_STATE_DOWN);
+		break;
+	}
+
+	/* Every valid packet restarts the detection timer */
+	if (bfd->detect_thread)
+		thread_cancel(bfd->detect_thread);
+	bfd->detect_thread = thread_add_timer(master, bfd_detect_thread, bfd,
+					      bfd_detect_time(bfd));
+}
+
+/* Shared receive path - drain the socket, validate and demultiplex */
+static int
+bfd_receive_thread(thread_t *thread)
+{
+	long slot = (long) THREAD_ARG(thread);
+	struct sockaddr_storage src;
+	socklen_t srclen;
+	char rbuf[128];
+	bfd_pkt_t *pkt = (bfd_pkt_t *) rbuf;
+	vrrp_bfd_t *bfd;
+	ssize_t len;
+
+	while (true) {
+		srclen = sizeof(src);
+		len = recvfrom(thread->u.fd, rbuf, sizeof(rbuf), 0,
+			       (struct sockaddr *) &src, &srclen);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* Packet sanity, RFC 5880 6.8.6 */
+		if (len < BFD_PKT_LEN || BFD_PKT_VER(pkt) != 1 ||
+		    pkt->len < BFD_PKT_LEN || pkt->len > len ||
+		    !pkt->detect_mult || BFD_PKT_MBIT(pkt) ||
+		    !pkt->local_discr)
+			continue;
+
+		bfd = bfd_find_session(ntohl(pkt->remote_discr), &src);
+		if (!bfd)
+			continue;
+
+		bfd_handle_pkt(bfd, pkt);
+	}
+
+	bfd_reader[slot] = thread_add_read(master, bfd_receive_thread,
+					   (void *) slot, thread->u.fd,
+					   TIMER_NEVER);
+	return 0;
+}
+
+/* Open the rx/tx socket pair for an address family */
+static bool
+bfd_open_sockets(int slot)
+{
+	int family = slot ? AF_INET6 : AF_INET;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int ttl = BFD_TTL;
+	int on = 1;
+	int fd;
+
+	if (bfd_fd_in[slot] != -1)
+		return true;
+
+	/* Receive side, well-known control port */
+	fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		log_message(LOG_INFO, "BFD rx socket error %d (%m)", errno);
+		return false;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.ss_family = (sa_family_t) family;
+	if (family == AF_INET6) {
+		((struct sockaddr_in6 *) &addr)->sin6_port = htons(BFD_PORT_CTRL);
+		addrlen = sizeof(struct sockaddr_in6);
+	} else {
+		((struct sockaddr_in *) &addr)->sin_port = htons(BFD_PORT_CTRL);
+		addrlen = sizeof(struct sockaddr_in);
+	}
+	if (bind(fd, (struct sockaddr *) &addr, addrlen) < 0) {
+		log_message(LOG_INFO, "BFD rx bind error %d (%m)", errno);
+		close(fd);
+		return false;
+	}
+	bfd_fd_in[slot] = fd;
+
+	/* Transmit side, RFC 5881 source port with TTL 255 so the
+	 * neighbor can apply GTSM */
+	fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		log_message(LOG_INFO, "BFD tx socket error %d (%m)", errno);
+		close(bfd_fd_in[slot]);
+		bfd_fd_in[slot] = -1;
+		return false;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (family == AF_INET6) {
+		setsockopt(fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+		((struct sockaddr_in6 *) &addr)->sin6_port = htons(BFD_PORT_SRC);
+	} else {
+		setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+		((struct sockaddr_in *) &addr)->sin_port = htons(BFD_PORT_SRC);
+	}
+	if (bind(fd, (struct sockaddr *) &addr, addrlen) < 0) {
+		log_message(LOG_INFO, "BFD tx bind error %d (%m)", errno);
+		close(fd);
+		close(bfd_fd_in[slot]);
+		bfd_fd_in[slot] = -1;
+		return false;
+	}
+	bfd_fd_out[slot] = fd;
+
+	bfd_reader[slot] = thread_add_read(master, bfd_receive_thread,
+					   (void *) (long) slot,
+					   bfd_fd_in[slot], TIMER_NEVER);
+	return true;
+}
+
+/* Kick off every configured session */
+void
+vrrp_bfd_init(list l)
+{
+	element e;
+	vrrp_bfd_t *bfd;
+
+	if (!bfd_next_discr)
+		bfd_next_discr = (uint32_t) time(NULL) << 8;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		bfd = ELEMENT_DATA(e);
+		if (!bfd_open_sockets(bfd_family_slot(bfd)))
+			continue;
+		if (!bfd->local_discr)
+			bfd->local_discr = ++bfd_next_discr;
+		bfd_tx_schedule(bfd);
+
+		/* A session carried across a reload must not stay up
+		 * forever if the neighbor died while we reloaded */
+		if (bfd->local_state != BFD_STATE_DOWN && bfd->remote_mult)
+			bfd->detect_thread = thread_add_timer(master, bfd_detect_thread,
+							      bfd, bfd_detect_time(bfd));
+	}
+}
+
+/* Close the shared sockets. Their read threads and the per-session
+ * timers went with the master thread. */
+void
+vrrp_bfd_close(void)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (bfd_fd_in[i] != -1) {
+			close(bfd_fd_in[i]);
+			bfd_fd_in[i] = -1;
+		}
+		if (bfd_fd_out[i] != -1) {
+			close(bfd_fd_out[i]);
+			bfd_fd_out[i] = -1;
+		}
+		bfd_reader[i] = NULL;
+	}
+}
+
+void
+free_vrrp_bfd(void *data)
+{
+	vrrp_bfd_t *bfd = data;
+
+	FREE(bfd->bname);
+	FREE(bfd);
+}
+
+void
+dump_vrrp_bfd(void *data)
+{
+	vrrp_bfd_t *bfd = data;
+
+	log_message(LOG_INFO, " BFD Instance = %s", bfd->bname);
+	log_message(LOG_INFO, "   Neighbor = %s", inet_sockaddrtos(&bfd->nbr_addr));
+	log_message(LOG_INFO, "   Min TX = %u usec", bfd->min_tx);
+	log_message(LOG_INFO, "   Min RX = %u usec", bfd->min_rx);
+	log_message(LOG_INFO, "   Multiplier = %u", bfd->multiplier);
+	log_message(LOG_INFO, "   Weight = %d", bfd->weight);
+	log_message(LOG_INFO, "   Status = %s", bfd_state_str(bfd->local_state));
+}
+
+vrrp_bfd_t *
+find_bfd_by_name(char *name)
+{
+	element e;
+	vrrp_bfd_t *bfd;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp_bfd))
+		return NULL;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_bfd); e; ELEMENT_NEXT(e)) {
+		bfd = ELEMENT_DATA(e);
+		if (!strcmp(bfd->bname, name))
+			return bfd;
+	}
+	return NULL;
+}
+
+/* Track BFD dump */
+void
+dump_track_bfd(void *track_data)
+{
+	tracked_bfd_t *tbfd = track_data;
+	log_message(LOG_INFO, "     %s weight %d", tbfd->bfd->bname, tbfd->weight);
+}
+
+void
+alloc_track_bfd(list track_list, vector_t *strvec, const char *vrrp_iname)
+{
+	vrrp_bfd_t *bfd = NULL;
+	tracked_bfd_t *tbfd = NULL;
+	int weight = 0;
+	char *tracked = strvec_slot(strvec, 0);
+
+	bfd = find_bfd_by_name(tracked);
+
+	/* Ignoring if no session found */
+	if (!bfd) {
+		log_message(LOG_INFO, "(%s): track bfd %s not found, ignoring...", vrrp_iname, tracked);
+		return;
+	}
+
+	/* default weight */
+	weight = bfd->weight;
+
+	if (vector_size(strvec) >= 3 &&
+	    !strcmp(strvec_slot(strvec, 1), "weight")) {
+		weight = atoi(strvec_slot(strvec, 2));
+		if (weight < -254 || weight > 254) {
+			weight = bfd->weight;
+			log_message(LOG_INFO, "(%s): track bfd %s: weight must be between [-254..254]"
+					 " inclusive, ignoring...",
+			       vrrp_iname, tracked);
+		}
+	}
+
+	tbfd	     = (tracked_bfd_t *) MALLOC(sizeof(tracked_bfd_t));
+	tbfd->bfd    = bfd;
+	tbfd->weight = weight;
+	list_add(track_list, tbfd);
+}
+
+/* Test if all tracked BFD sessions are either UP or weight-tracked */
+int
+vrrp_bfd_up(list l)
+{
+	element e;
+	tracked_bfd_t *tbfd;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tbfd = ELEMENT_DATA(e);
+		if (!tbfd->weight && !BFD_ISUP(tbfd->bfd))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Returns total weights of all tracked BFD sessions :
+ * - a positive weight adds to the global weight when the session is up
+ * - a negative weight subtracts from the global weight when it is down
+ *
+ */
+int
+vrrp_bfd_weight(list l)
+{
+	element e;
+	tracked_bfd_t *tbfd;
+	int weight = 0;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tbfd = ELEMENT_DATA(e);
+		if (BFD_ISUP(tbfd->bfd)) {
+			if (tbfd->weight > 0)
+				weight += tbfd->weight;
+		} else {
+			if (tbfd->weight < 0)
+				weight += tbfd->weight;
+		}
+	}
+
+	return weight;
+}
+
+/* Carry session state across a reload so an established session does
+ * not flap just because the configuration was re-read */
+void
+clear_diff_bfd(void)
+{
+	element e;
+	list l = old_vrrp_data->vrrp_bfd;
+	vrrp_bfd_t *bfd, *nbfd;
+
+	if (LIST_ISEMPTY(l))
+		return;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		bfd = ELEMENT_DATA(e);
+		nbfd = find_bfd_by_name(bfd->bname);
+		if (!nbfd || !bfd_addr_match(&bfd->nbr_addr, &nbfd->nbr_addr))
+			continue;
+		log_message(LOG_INFO, "BFD_Instance(%s) keeping %s state on reload"
+				    , nbfd->bname, bfd_state_str(bfd->local_state));
+		nbfd->local_discr = bfd->local_discr;
+		nbfd->local_state = bfd->local_state;
+		nbfd->remote_discr = bfd->remote_discr;
+		nbfd->remote_state = bfd->remote_state;
+		nbfd->remote_min_rx = bfd->remote_min_rx;
+		nbfd->remote_min_tx = bfd->remote_min_tx;
+		nbfd->remote_mult = bfd->remote_mult;
+	}
+}
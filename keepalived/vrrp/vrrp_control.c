@@ -0,0 +1,306 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Runtime control socket. Lets an operator apply one-line
+ *              state changes - force an instance to backup, release it,
+ *              query state - directly to the running configuration
+ *              instead of editing the config and reloading.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+/* system include */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* local include */
+#include "vrrp_control.h"
+#include "vrrp_data.h"
+#include "vrrp_scheduler.h"
+#include "vrrp.h"
+#include "global_data.h"
+#include "scheduler.h"
+#include "parser.h"
+#include "logger.h"
+#include "memory.h"
+#include "list.h"
+
+static int control_sock = -1;
+
+static vrrp_t *
+control_find_instance(const char *iname)
+{
+	element e;
+	vrrp_t *vrrp;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp))
+		return NULL;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+		if (!strcmp(vrrp->iname, iname))
+			return vrrp;
+	}
+
+	return NULL;
+}
+
+static const char *
+control_state_str(int state)
+{
+	switch (state) {
+	case VRRP_STATE_INIT: return "INIT";
+	case VRRP_STATE_BACK: return "BACKUP";
+	case VRRP_STATE_MAST: return "MASTER";
+	case VRRP_STATE_FAULT: return "FAULT";
+	}
+
+	return "UNKNOWN";
+}
+
+static const char *
+control_reason_str(int reason)
+{
+	switch (reason) {
+	case VRRP_HIST_REASON_STARTUP: return "startup";
+	case VRRP_HIST_REASON_ADVERT: return "advert";
+	case VRRP_HIST_REASON_TIMEOUT: return "timeout";
+	case VRRP_HIST_REASON_FAULT: return "fault";
+	case VRRP_HIST_REASON_CONTROL: return "control";
+	}
+
+	return "unknown";
+}
+
+/* Print an instance's transition flight recorder, oldest entry first */
+static void
+control_history(FILE *file, vrrp_t *vrrp)
+{
+	const vrrp_hist_entry_t *ent;
+	unsigned count = vrrp->hist_head;
+	unsigned i;
+
+	if (count > VRRP_HIST_ENTRIES)
+		count = VRRP_HIST_ENTRIES;
+
+	for (i = vrrp->hist_head - count; i != vrrp->hist_head; i++) {
+		ent = &vrrp->hist[i % VRRP_HIST_ENTRIES];
+		fprintf(file, "%u %s -> %s reason %s master-prio %u\n",
+			ent->ts, control_state_str(ent->prev_state),
+			control_state_str(ent->new_state),
+			control_reason_str(ent->reason), ent->master_prio);
+	}
+}
+
+static void
+control_status(FILE *file)
+{
+	element e;
+	vrrp_t *vrrp;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp))
+		return;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+		fprintf(file, "%s %s prio %d%s\n", vrrp->iname,
+			control_state_str(vrrp->state),
+			vrrp->effective_priority,
+			vrrp->forced_backup ? " forced-backup" : "");
+	}
+}
+
+static void
+control_backup(FILE *file, vrrp_t *vrrp)
+{
+	log_message(LOG_INFO, "VRRP_Instance(%s) forced to BACKUP via control socket", vrrp->iname);
+
+	/* Hold the effective priority at the minimum so any peer can take
+	 * over, and release mastership straight away rather than waiting
+	 * to be preempted. vrrp_update_priority() keeps the priority
+	 * clamped while the instance stays forced. */
+	vrrp->forced_backup = true;
+	vrrp->hist_reason = VRRP_HIST_REASON_CONTROL;
+	vrrp_set_effective_priority(vrrp, 1);
+
+	if (vrrp->state == VRRP_STATE_MAST) {
+		vrrp->wantstate = VRRP_STATE_BACK;
+		vrrp_state_leave_master(vrrp);
+	}
+
+	fprintf(file, "OK\n");
+}
+
+static void
+control_resume(FILE *file, vrrp_t *vrrp)
+{
+	log_message(LOG_INFO, "VRRP_Instance(%s) released from forced BACKUP via control socket", vrrp->iname);
+
+	/* Back to the configured priority; the priority update thread
+	 * reapplies any tracking weights on its next run */
+	vrrp->forced_backup = false;
+	vrrp_set_effective_priority(vrrp, vrrp->base_priority);
+
+	fprintf(file, "OK\n");
+}
+
+static void
+control_command(FILE *file, char *buf)
+{
+	vector_t *strvec;
+	char *cmd;
+	vrrp_t *vrrp;
+
+	strvec = alloc_strvec(buf);
+	if (!strvec) {
+		fprintf(file, "ERR empty command\n");
+		return;
+	}
+
+	cmd = vector_slot(strvec, 0);
+
+	if (!strcmp(cmd, "status"))
+		control_status(file);
+	else if (!strcmp(cmd, "memprof"))
+		mem_prof_print(file);
+	else if (!strcmp(cmd, "loopstats"))
+		thread_dump_callback_acct(file);
+	else if (!strcmp(cmd, "loglevel")) {
+		if (vector_size(strvec) < 2)
+			log_subsys_dump(file);
+		else if (vector_size(strvec) < 3 ||
+			 !log_subsys_set_level(vector_slot(strvec, 1), vector_slot(strvec, 2)))
+			fprintf(file, "ERR usage: loglevel [vrrp|check|netlink|scheduler|all emerg..debug]\n");
+		else {
+			log_message(LOG_INFO, "Logging level for %s set to %s via control socket",
+				    (char *)vector_slot(strvec, 1), (char *)vector_slot(strvec, 2));
+			fprintf(file, "OK\n");
+		}
+	}
+	else if (!strcmp(cmd, "backup") || !strcmp(cmd, "resume") || !strcmp(cmd, "history")) {
+		if (vector_size(strvec) < 2)
+			fprintf(file, "ERR %s requires an instance name\n", cmd);
+		else if (!(vrrp = control_find_instance(vector_slot(strvec, 1))))
+			fprintf(file, "ERR unknown instance %s\n", (char *)vector_slot(strvec, 1));
+		else if (!strcmp(cmd, "backup"))
+			control_backup(file, vrrp);
+		else if (!strcmp(cmd, "resume"))
+			control_resume(file, vrrp);
+		else
+			control_history(file, vrrp);
+	} else
+		fprintf(file, "ERR unknown command %s\n", cmd);
+
+	free_strvec(strvec);
+}
+
+static int
+vrrp_control_accept_thread(thread_t *thread)
+{
+	struct timeval timeo = { .tv_sec = 1, .tv_usec = 0 };
+	char buf[256];
+	ssize_t len;
+	FILE *file;
+	int fd;
+
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return 0;
+
+	fd = accept(control_sock, NULL, NULL);
+
+	/* Wait for the next connection */
+	thread_add_read(master, vrrp_control_accept_thread, NULL, control_sock, TIMER_NEVER);
+
+	if (fd < 0)
+		return 0;
+
+	/* Don't let a silent or stalled client block the VRRP process */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeo, sizeof(timeo));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeo, sizeof(timeo));
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len <= 0) {
+		close(fd);
+		return 0;
+	}
+	buf[len] = '\0';
+
+	if (!(file = fdopen(fd, "w"))) {
+		close(fd);
+		return 0;
+	}
+
+	control_command(file, buf);
+	fclose(file);
+
+	return 0;
+}
+
+void
+vrrp_control_socket_init(void)
+{
+	struct sockaddr_un addr;
+
+	if (!global_data->vrrp_control_socket || control_sock != -1)
+		return;
+
+	if (strlen(global_data->vrrp_control_socket) >= sizeof(addr.sun_path)) {
+		log_message(LOG_INFO, "Control socket path %s too long - ignoring", global_data->vrrp_control_socket);
+		return;
+	}
+
+	if ((control_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		log_message(LOG_INFO, "Unable to create control socket (%s)", strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, global_data->vrrp_control_socket);
+
+	/* Remove any socket left over from a previous invocation */
+	unlink(addr.sun_path);
+
+	if (bind(control_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(control_sock, 2) == -1) {
+		log_message(LOG_INFO, "Unable to bind control socket %s (%s)", addr.sun_path, strerror(errno));
+		close(control_sock);
+		control_sock = -1;
+		return;
+	}
+
+	thread_add_read(master, vrrp_control_accept_thread, NULL, control_sock, TIMER_NEVER);
+}
+
+void
+vrrp_control_socket_close(void)
+{
+	if (control_sock == -1)
+		return;
+
+	close(control_sock);
+	control_sock = -1;
+
+	if (global_data->vrrp_control_socket)
+		unlink(global_data->vrrp_control_socket);
+}
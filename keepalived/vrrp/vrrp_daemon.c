@@ -24,8 +24,12 @@
 
 #include <string.h>
 #include <sys/prctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "vrrp_daemon.h"
+#include "smtp.h"
 #include "vrrp_scheduler.h"
 #include "vrrp_if.h"
 #include "vrrp_arp.h"
@@ -41,6 +45,8 @@
 #include "vrrp_data.h"
 #include "vrrp.h"
 #include "vrrp_print.h"
+#include "vrrp_control.h"
+#include "vrrp_handoff.h"
 #include "global_data.h"
 #include "pidfile.h"
 #include "daemon.h"
@@ -54,6 +60,7 @@
   #include "ipvswrapper.h"
 #endif
 #ifdef _WITH_SNMP_
+  #include "snmp.h"
   #include "vrrp_snmp.h"
 #endif
 #ifdef _WITH_DBUS_
@@ -81,6 +88,15 @@ static int print_vrrp_json(thread_t * thread);
 #endif
 #ifndef _DEBUG_
 static int reload_vrrp_thread(thread_t * thread);
+static int reload_prepare_thread(thread_t * thread);
+
+/* Pipe the reload staging helper streams the expanded configuration
+ * lines back through. Only the read end stays open in this process;
+ * a non-negative fd doubles as the reload-in-progress flag. */
+static int reload_stage_fd = -1;
+static char *reload_stage_buf;
+static size_t reload_stage_len;
+static size_t reload_stage_size;
 #endif
 
 static char *vrrp_syslog_ident;
@@ -106,20 +122,26 @@ static void
 stop_vrrp(int status)
 {
 	/* Ensure any interfaces are in backup mode,
-	 * sending a priority 0 vrrp message
+	 * sending a priority 0 vrrp message. Not after a handoff - the
+	 * successor owns the sockets and the VIPs now, and a priority 0
+	 * advert would make the peers elect a new master. The same goes
+	 * for takeover mode - the VIPs stay installed for the replacement
+	 * daemon to adopt, so the peers must not see us leave.
 	 */
-	restore_vrrp_interfaces();
+	if (!vrrp_handoff_done && !global_data->takeover)
+		restore_vrrp_interfaces();
 
-#ifdef _HAVE_LIBIPTC_
-	iptables_fini();
-#endif
+	iptables_shutdown();
+	nftables_fini();
 
 	/* Clear static entries */
+	if (!global_data->takeover) {
 #ifdef _HAVE_FIB_ROUTING_
-	netlink_rulelist(vrrp_data->static_rules, IPRULE_DEL, false);
-	netlink_rtlist(vrrp_data->static_routes, IPROUTE_DEL);
+		netlink_rulelist(vrrp_data->static_rules, IPRULE_DEL, false);
+		netlink_rtlist(vrrp_data->static_routes, IPROUTE_DEL);
 #endif
-	netlink_iplist(vrrp_data->static_addresses, IPADDRESS_DEL, false);
+		netlink_iplist(vrrp_data->static_addresses, IPADDRESS_DEL, false);
+	}
 
 #ifdef _WITH_SNMP_
 	if (global_data->enable_snmp_keepalived || global_data->enable_snmp_rfcv2 || global_data->enable_snmp_rfcv3)
@@ -136,10 +158,10 @@ stop_vrrp(int status)
 	 * of an IGMP leave group being sent for some reason.
 	 * Since we are about to exit, it doesn't affect anything else
 	 * running. */
-	if (!LIST_ISEMPTY(vrrp_data->vrrp))
+	if (!vrrp_handoff_done && !global_data->takeover && !LIST_ISEMPTY(vrrp_data->vrrp))
 		sleep(1);
 
-	if (!__test_bit(DONT_RELEASE_VRRP_BIT, &debug))
+	if (!__test_bit(DONT_RELEASE_VRRP_BIT, &debug) && !vrrp_handoff_done && !global_data->takeover)
 		shutdown_vrrp_instances();
 
 #ifdef _WITH_LVS_
@@ -156,9 +178,14 @@ stop_vrrp(int status)
 	signal_handler_destroy();
 
 	kernel_netlink_close();
+#ifdef _MEM_CHECK_
 	thread_destroy_master(master);
+#endif
 	gratuitous_arp_close();
 	ndisc_close();
+	vrrp_bfd_close();
+	vrrp_file_close();
+	vrrp_process_close();
 
 #ifdef _WITH_DBUS_
 	if (global_data->enable_dbus)
@@ -168,11 +195,32 @@ stop_vrrp(int status)
 	if (global_data->vrrp_notify_fifo.fd != -1)
 		notify_fifo_close(&global_data->notify_fifo, &global_data->vrrp_notify_fifo);
 
+	/* After a handoff the successor has already bound fresh sockets
+	 * on these paths - closing would unlink them from under it */
+	if (!vrrp_handoff_done) {
+		vrrp_dump_socket_close();
+		vrrp_control_socket_close();
+		vrrp_handoff_socket_close();
+	}
+
+#ifdef _MEM_CHECK_
+	/* Walking every list free()ing every object takes seconds on a
+	 * large configuration and delays the replacement process; it
+	 * only matters when the allocator is auditing. Otherwise skip
+	 * it and let the OS reclaim everything at exit. */
 	free_global_data(global_data);
 	free_vrrp_data(vrrp_data);
 	free_vrrp_buffer();
 	free_interface_queue();
 	free_parent_mallocs_exit();
+#endif
+
+	vrrp_close_stats_page();
+
+	/* A clean stop releases the VIPs, so the checkpoint must not
+	 * survive to claim mastership on the next start. After a handoff
+	 * or with takeover the successor owns the state */
+	vrrp_close_state_file(!vrrp_handoff_done && !global_data->takeover);
 
 	/*
 	 * Reached when terminate signal catched.
@@ -197,6 +245,93 @@ stop_vrrp(int status)
 	exit(status);
 }
 
+/* Parse and cross-check the VRRP configuration without touching the
+ * kernel. Runs the full parser and vrrp_complete_init() - sync group
+ * membership, interface existence against the netlink interface
+ * snapshot, vrid conflicts - but skips vmac creation and never opens
+ * an advert socket, so a bad candidate config can be rejected before
+ * it ever reaches a live daemon. */
+bool
+vrrp_validate_config(void)
+{
+	bool ret;
+
+#ifndef _DEBUG_
+	/* The netlink address filter only populates the interfaces'
+	 * addresses for the vrrp process - act as it for the dump */
+	prog_type = PROG_TYPE_VRRP;
+#endif
+
+	/* Read-only netlink dump of the interfaces, so interface
+	 * references in the config can be resolved */
+	init_interface_queue();
+
+	global_data = alloc_global_data();
+	vrrp_data = alloc_vrrp_data();
+	if (!vrrp_data)
+		return false;
+
+	init_data(conf_file, vrrp_init_keywords);
+	init_global_data(global_data);
+
+	ret = vrrp_complete_init();
+
+	free_vrrp_data(vrrp_data);
+	free_global_data(global_data);
+	free_interface_queue();
+
+#ifndef _DEBUG_
+	prog_type = PROG_TYPE_PARENT;
+#endif
+
+	return ret;
+}
+
+/* Whether the pending deferred init belongs to a reload. Captured when
+ * it is scheduled - the global reload flag is already cleared by the
+ * time the low priority work runs. */
+static bool deferred_init_reload;
+
+/* Management plane initialization, run as low priority loop work once
+ * the dispatcher is live. Nothing here is needed for adverts to flow:
+ * SNMP agent registration, DBus objects, the notify FIFO and the local
+ * dump/control/handoff sockets all come up behind the protocol so a
+ * restart gives the peers' master down timers the least possible head
+ * start. */
+static int
+vrrp_deferred_init(__attribute__((unused)) thread_t *thread)
+{
+#ifdef _WITH_SNMP_
+	if (!deferred_init_reload && (global_data->enable_snmp_keepalived || global_data->enable_snmp_rfcv2 || global_data->enable_snmp_rfcv3)) {
+		vrrp_snmp_agent_init(global_data->snmp_socket);
+#ifdef _WITH_SNMP_RFC_
+		vrrp_start_time = timer_now();
+#endif
+	}
+#endif
+
+#ifdef _WITH_DBUS_
+	if (!deferred_init_reload && global_data->enable_dbus)
+		if (!dbus_start())
+			global_data->enable_dbus = false;
+#endif
+
+	/* Create a notify FIFO if needed, and open it */
+	if (global_data->vrrp_notify_fifo.name)
+		notify_fifo_open(&global_data->notify_fifo, &global_data->vrrp_notify_fifo, vrrp_notify_fifo_script_exit, "vrrp_");
+
+	/* Open the on-demand state dump socket if configured */
+	vrrp_dump_socket_init();
+
+	/* Open the runtime control socket if configured */
+	vrrp_control_socket_init();
+
+	/* Offer our own sockets and state to a future successor */
+	vrrp_handoff_socket_init();
+
+	return 0;
+}
+
 /* Daemon init sequence */
 static void
 start_vrrp(void)
@@ -227,14 +362,11 @@ start_vrrp(void)
 	if (global_data->vrrp_no_swap)
 		set_process_dont_swap(4096);	/* guess a stack size to reserve */
 
-#ifdef _WITH_SNMP_
-	if (!reload && (global_data->enable_snmp_keepalived || global_data->enable_snmp_rfcv2 || global_data->enable_snmp_rfcv3)) {
-		vrrp_snmp_agent_init(global_data->snmp_socket);
-#ifdef _WITH_SNMP_RFC_
-		vrrp_start_time = timer_now();
-#endif
-	}
-#endif
+	if (global_data->vrrp_cpu_mask)
+		set_process_cpu_affinity(global_data->vrrp_cpu_mask, "vrrp");
+
+	if (global_data->vrrp_realtime_policy)
+		set_process_realtime_priority(global_data->vrrp_realtime_policy, global_data->vrrp_realtime_priority, "vrrp");
 
 #ifdef _WITH_LVS_
 	if (vrrp_ipvs_needed()) {
@@ -265,6 +397,7 @@ start_vrrp(void)
 		clear_diff_sroutes();
 #endif
 		clear_diff_script();
+		clear_diff_bfd();
 	}
 	else {
 		/* Clear leftover static entries */
@@ -277,12 +410,6 @@ start_vrrp(void)
 #endif
 	}
 
-#ifdef _WITH_DBUS_
-	if (!reload && global_data->enable_dbus)
-		if (!dbus_start())
-			global_data->enable_dbus = false;
-#endif
-
 	/* Complete VRRP initialization */
 	if (!vrrp_complete_init()) {
 		stop_vrrp(KEEPALIVED_EXIT_CONFIG);
@@ -290,20 +417,20 @@ start_vrrp(void)
 	}
 
 	/* We need to delay the init of iptables to after vrrp_complete_init()
-	 * has been called so we know whether we want IPv4 and/or IPv6 */
-	iptables_init();
+	 * has been called so we know whether we want IPv4 and/or IPv6.
+	 * The setup itself is deferred further, to the first transaction
+	 * that installs a filter rule. */
+	iptables_init_deferred(reload);
 
-	/* Create a notify FIFO if needed, and open it */
-	if (global_data->vrrp_notify_fifo.name)
-		notify_fifo_open(&global_data->notify_fifo, &global_data->vrrp_notify_fifo, vrrp_notify_fifo_script_exit, "vrrp_");
+	/* Export the per-instance counters for monitoring agents */
+	vrrp_publish_stats_page();
 
-	/* Make sure we don't have any old iptables/ipsets settings left around */
-#ifdef _HAVE_LIBIPTC_
+	/* On a cold start pick up where a crashed predecessor left off,
+	 * then (re)create the checkpoint page - the restore must read the
+	 * old file before publishing truncates it */
 	if (!reload)
-		iptables_cleanup();
-
-	iptables_startup(reload);
-#endif
+		vrrp_state_file_restore();
+	vrrp_publish_state_file();
 
 	if (!reload)
 		vrrp_restore_interfaces_startup();
@@ -326,8 +453,8 @@ start_vrrp(void)
 	/* Set static entries */
 	netlink_iplist(vrrp_data->static_addresses, IPADDRESS_ADD, false);
 #ifdef _HAVE_FIB_ROUTING_
-	netlink_rtlist(vrrp_data->static_routes, IPROUTE_ADD);
 	netlink_rulelist(vrrp_data->static_rules, IPRULE_ADD, false);
+	netlink_rtlist(vrrp_data->static_routes, IPROUTE_ADD);
 #endif
 
 	/* Dump configuration */
@@ -346,16 +473,34 @@ start_vrrp(void)
 	/* Initialize linkbeat */
 	init_interface_linkbeat();
 
+	/* On a cold start try to take over from a running predecessor.
+	 * Must run before the dispatcher opens its own sockets; the
+	 * listening side is deferred with the rest of the management
+	 * plane, which also guarantees we never connect to ourselves. */
+	if (!reload)
+		vrrp_handoff_fetch();
+
+	/* Resolve a deferred smtp_server name without blocking */
+	smtp_start_resolver();
+
 	/* Init & start the VRRP packet dispatcher */
 	thread_add_event(master, vrrp_dispatcher_init, NULL,
 			 VRRP_DISPATCHER);
+
+	/* Everything the protocol does not need to start advertising is
+	 * deferred to low priority loop work behind the dispatcher, so a
+	 * restart's time-to-first-advert does not pay for the management
+	 * plane while the peers are running their master down timers */
+	deferred_init_reload = reload;
+	thread_set_priority(thread_add_timer(master, vrrp_deferred_init, NULL, 0),
+			    THREAD_PRIO_LO);
 }
 
 #ifndef _DEBUG_
 static void
 sighup_vrrp(__attribute__((unused)) void *v, __attribute__((unused)) int sig)
 {
-	thread_add_event(master, reload_vrrp_thread, NULL, 0);
+	thread_add_event(master, reload_prepare_thread, NULL, 0);
 }
 
 static void
@@ -412,16 +557,28 @@ vrrp_signal_init(void)
 static int
 reload_vrrp_thread(__attribute__((unused)) thread_t * thread)
 {
+	/* If no configuration file changed, a reload would rebuild an
+	 * identical configuration - don't bother */
+	if (!conf_files_changed()) {
+		log_message(LOG_INFO, "Configuration file(s) unchanged on SIGHUP - not reloading");
+		return 0;
+	}
+
 	/* set the reloading flag */
 	SET_RELOAD;
 
 	/* Terminate all script process */
 	script_killall(master, SIGTERM);
 
-	/* Destroy master thread */
-	vrrp_dispatcher_release(vrrp_data);
+	/* Destroy master thread, but keep the socket pool open so the new
+	 * configuration can adopt the sockets of unchanged instances */
+	vrrp_dispatcher_park(vrrp_data);
 	kernel_netlink_close();
 	thread_cleanup_master(master);
+
+	/* The threads tracking running notify scripts went with the master
+	 * thread - drop the pending script queue and reset the count */
+	notify_flush_pending();
 #ifdef _WITH_LVS_
 	if (global_data->lvs_syncd.ifname)
 		ipvs_syncd_cmd(IPVS_STOPDAEMON, &global_data->lvs_syncd,
@@ -433,11 +590,22 @@ reload_vrrp_thread(__attribute__((unused)) thread_t * thread)
 	/* Remove the notify fifo - we don't know if it will be the same after a reload */
 	notify_fifo_close(&global_data->notify_fifo, &global_data->vrrp_notify_fifo);
 
+	/* The dump, control and handoff socket paths may change across the reload */
+	vrrp_dump_socket_close();
+	vrrp_control_socket_close();
+	vrrp_handoff_socket_close();
+
 	free_global_data(global_data);
 	free_vrrp_buffer();
 	gratuitous_arp_close();
 	ndisc_close();
 
+	/* The BFD read threads went with the master thread - close the
+	 * sockets so vrrp_bfd_init() reopens them for the new config */
+	vrrp_bfd_close();
+	vrrp_file_close();
+	vrrp_process_close();
+
 #ifdef _WITH_LVS_
 	if (vrrp_ipvs_needed()) {
 		/* Clean ipvs related */
@@ -465,23 +633,131 @@ reload_vrrp_thread(__attribute__((unused)) thread_t * thread)
 	free_vrrp_data(old_vrrp_data);
 	free_old_interface_queue();
 
+#ifdef _WITH_SNMP_
+	/* The SNMP table snapshots reference the old configuration */
+	snmp_cache_reset();
+#endif
+
 	UNSET_RELOAD;
 
 	return 0;
 }
+
+/* Read the line stream from the reload staging helper. The loop keeps
+ * dispatching the old configuration between chunks; the reload proper
+ * only runs once the helper has sent everything */
+static int
+reload_stage_read_thread(thread_t * thread)
+{
+	ssize_t len;
+
+	while (true) {
+		if (reload_stage_len == reload_stage_size) {
+			reload_stage_size += 256 * 1024;
+			reload_stage_buf = REALLOC(reload_stage_buf, reload_stage_size);
+		}
+
+		len = read(reload_stage_fd, reload_stage_buf + reload_stage_len,
+			   reload_stage_size - reload_stage_len);
+		if (len > 0) {
+			reload_stage_len += (size_t)len;
+			continue;
+		}
+
+		if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			thread_add_read(master, reload_stage_read_thread, NULL, reload_stage_fd, TIMER_NEVER);
+			return 0;
+		}
+
+		if (len == -1)
+			log_message(LOG_INFO, "Read from reload staging pipe failed (%s)", strerror(errno));
+		break;
+	}
+
+	close(reload_stage_fd);
+	reload_stage_fd = -1;
+
+	/* Hand the line stream to the parser; on a failed or empty stage
+	 * fall back to reading the files on the loop as before */
+	if (reload_stage_len)
+		stage_conf_received(reload_stage_buf, reload_stage_len);
+	else
+		FREE_PTR(reload_stage_buf);
+	reload_stage_buf = NULL;
+	reload_stage_len = reload_stage_size = 0;
+
+	return reload_vrrp_thread(thread);
+}
+
+/* SIGHUP entry point. The filesystem side of the reload - globbing,
+ * reading and expanding the configuration - runs in a forked helper
+ * with the result streamed back over a pipe, so adverts keep flowing
+ * meanwhile; its directory changes for include handling stay in its
+ * own process, too. The teardown, parse and kernel delta still run on
+ * the loop once the stream is complete. */
+static int
+reload_prepare_thread(thread_t * thread)
+{
+	int stage_pipe[2];
+	pid_t pid;
+
+	/* If no configuration file changed, a reload would rebuild an
+	 * identical configuration - don't bother */
+	if (!conf_files_changed()) {
+		log_message(LOG_INFO, "Configuration file(s) unchanged on SIGHUP - not reloading");
+		return 0;
+	}
+
+	if (reload_stage_fd != -1) {
+		log_message(LOG_INFO, "Reload already in progress - ignoring SIGHUP");
+		return 0;
+	}
+
+	if (pipe2(stage_pipe, O_CLOEXEC) == -1) {
+		log_message(LOG_INFO, "Unable to create reload staging pipe (%s) - reloading directly", strerror(errno));
+		return reload_vrrp_thread(thread);
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		log_message(LOG_INFO, "Unable to fork reload staging helper (%s) - reloading directly", strerror(errno));
+		close(stage_pipe[0]);
+		close(stage_pipe[1]);
+		return reload_vrrp_thread(thread);
+	}
+
+	if (!pid) {
+		/* The helper only reads files and writes the pipe. Restore
+		 * the standard signal dispositions so a signal aimed at it
+		 * can't reach the signal pipe shared with this process */
+		signal_handler_script();
+		close(stage_pipe[0]);
+		stage_conf_files(conf_file, stage_pipe[1]);
+		close(stage_pipe[1]);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(stage_pipe[1]);
+	reload_stage_fd = stage_pipe[0];
+	fcntl(reload_stage_fd, F_SETFL, O_NONBLOCK);
+
+	thread_add_read(master, reload_stage_read_thread, NULL, reload_stage_fd, TIMER_NEVER);
+
+	return 0;
+}
 #endif
 
 static int
 print_vrrp_data(__attribute__((unused)) thread_t * thread)
 {
-	vrrp_print_data();
+	vrrp_dump_in_child(vrrp_print_data);
 	return 0;
 }
 
 static int
 print_vrrp_stats(__attribute__((unused)) thread_t * thread)
 {
-	vrrp_print_stats();
+	vrrp_dump_in_child(vrrp_print_stats);
 	return 0;
 }
 
@@ -489,7 +765,7 @@ print_vrrp_stats(__attribute__((unused)) thread_t * thread)
 static int
 print_vrrp_json(__attribute__((unused)) thread_t * thread)
 {
-	vrrp_print_json();
+	vrrp_dump_in_child(vrrp_print_json);
 	return 0;
 }
 #endif
@@ -557,6 +833,9 @@ start_vrrp_child(void)
 
 	prog_type = PROG_TYPE_VRRP;
 
+	/* Account this process's allocations to the vrrp subsystem */
+	mem_ctx_set(MEM_CTX_VRRP);
+
 	/* Opening local VRRP syslog channel */
 	if ((instance_name
 #if HAVE_DECL_CLONE_NEWNET
@@ -568,9 +847,14 @@ start_vrrp_child(void)
 	else
 		syslog_ident = PROG_VRRP;
 
-	if (!__test_bit(NO_SYSLOG_BIT, &debug))
+	if (!__test_bit(NO_SYSLOG_BIT, &debug)) {
 		openlog(syslog_ident, LOG_PID | ((__test_bit(LOG_CONSOLE_BIT, &debug)) ? LOG_CONS : 0)
 				    , (log_facility==LOG_DAEMON) ? LOG_LOCAL1 : log_facility);
+		if (__test_bit(LOG_ASYNC_BIT, &debug))
+			enable_async_log(syslog_ident, (log_facility==LOG_DAEMON) ? LOG_LOCAL1 : log_facility);
+		if (__test_bit(LOG_JOURNAL_BIT, &debug))
+			enable_journal_log(syslog_ident, (log_facility==LOG_DAEMON) ? LOG_LOCAL1 : log_facility);
+	}
 
 	if (log_file_name)
 		open_log_file(log_file_name, "vrrp", network_namespace, instance_name);
@@ -581,9 +865,8 @@ start_vrrp_child(void)
 
 	free_parent_mallocs_startup(true);
 
-	/* Clear any child finder functions set in parent */
+	/* Clear any child finder name function set in parent */
 	set_child_finder_name(NULL);
-	set_child_finder(NULL, NULL, NULL, NULL, NULL, 0);	/* Currently these won't be set */
 
 	/* Child process part, write pidfile */
 	if (!pidfile_write(vrrp_pidfile, getpid())) {
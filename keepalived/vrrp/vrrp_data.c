@@ -22,9 +22,19 @@
 
 #include "config.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
 #include "global_data.h"
 #include "vrrp_data.h"
+#include "vrrp_bfd.h"
+#include "vrrp_file.h"
+#include "vrrp_process.h"
 #include "vrrp_index.h"
+#include "vrrp_scheduler.h"
 #include "vrrp_sync.h"
 #include "vrrp_if.h"
 #ifdef _HAVE_VRRP_VMAC_
@@ -40,6 +50,17 @@
 #include "vrrp_iprule.h"
 #include "vrrp_iproute.h"
 #endif
+#include "parser.h"
+#include "statspage.h"
+#ifdef _WITH_LVS_
+  #include "ipvswrapper.h"
+#endif
+
+/* Shared-memory statistics page - the per-instance counter structures
+ * live on the page so monitoring agents can scrape them by mmap'ing
+ * the file, with no cost to the advert hot path */
+#define VRRP_STATS_PAGE_FILE	"/tmp/keepalived.vrrp.shm"
+static stats_page_t *vrrp_stats_page;
 
 /* global vars */
 vrrp_data_t *vrrp_data = NULL;
@@ -83,7 +104,7 @@ free_vgroup(void *data)
 	vrrp_sgroup_t *vgroup = data;
 
 	FREE(vgroup->gname);
-	free_strvec(vgroup->iname);
+	free_value_block(vgroup->iname);
 	free_list(&vgroup->index_list);
 	free_notify_script(&vgroup->script_backup);
 	free_notify_script(&vgroup->script_master);
@@ -116,6 +137,9 @@ dump_vgroup(void *data)
 	}
 	if (vgroup->global_tracking)
 		log_message(LOG_INFO, "   Same tracking for all VRRP instances");
+	log_message(LOG_INFO, "   Member states = %u master, %u fault, %u wanting master",
+	       vgroup->num_member_master, vgroup->num_member_fault,
+	       vgroup->num_member_wantmaster);
 	dump_notify_script(vgroup->script_backup, "Backup");
 	dump_notify_script(vgroup->script_master, "Master");
 	dump_notify_script(vgroup->script_fault, "Fault");
@@ -129,6 +153,9 @@ free_vscript(void *data)
 {
 	vrrp_script_t *vscript = data;
 
+	if (vscript->stream_fd != -1)
+		close(vscript->stream_fd);
+	free_list(&vscript->tracking_vrrp);
 	FREE(vscript->sname);
 	FREE_PTR(vscript->script);
 	FREE(vscript);
@@ -147,6 +174,8 @@ dump_vscript(void *data)
 	log_message(LOG_INFO, "   Rise = %d", vscript->rise);
 	log_message(LOG_INFO, "   Fall = %d", vscript->fall);
 	log_message(LOG_INFO, "   Insecure = %s", vscript->insecure ? "yes" : "no");
+	if (vscript->persistent)
+		log_message(LOG_INFO, "   Persistent = yes");
 
 	switch (vscript->init_state) {
 	case SCRIPT_INIT_STATE_INIT:
@@ -179,10 +208,15 @@ free_sock(void *sock_data)
 	thread_cancel(sock->thread);
 
 	/* Close related socket */
+	vrrp_ring_close(sock);
 	if (sock->fd_in > 0)
 		close(sock->fd_in);
 	if (sock->fd_out > 0)
 		close(sock->fd_out);
+	FREE_PTR(sock->hot_sands);
+	FREE_PTR(sock->hot_vrrp);
+	if (!stats_page_contains(vrrp_stats_page, sock->spurious_rx))
+		FREE_PTR(sock->spurious_rx);
 	FREE(sock_data);
 }
 
@@ -190,12 +224,15 @@ static void
 dump_sock(void *sock_data)
 {
 	sock_t *sock = sock_data;
-	log_message(LOG_INFO, "VRRP sockpool: [ifindex(%u), proto(%u), unicast(%d), fd(%d,%d)]"
+	log_message(LOG_INFO, "VRRP sockpool: [ifindex(%u), proto(%u), unicast(%d), shard(%u/%u), fd(%d,%d), spurious_rx(%" PRIu64 ")]"
 			    , sock->ifindex
 			    , sock->proto
 			    , sock->unicast
+			    , sock->shard
+			    , sock->shards
 			    , sock->fd_in
-			    , sock->fd_out);
+			    , sock->fd_out
+			    , *sock->spurious_rx);
 }
 
 static void
@@ -220,14 +257,24 @@ free_vrrp(void *data)
 
 	FREE(vrrp->iname);
 	FREE_PTR(vrrp->send_buffer);
+	FREE_PTR(vrrp->unicast_frames);
+	FREE_PTR(vrrp->unicast_iov);
+	FREE_PTR(vrrp->unicast_msg);
+	FREE_PTR(vrrp->unicast_dst);
+	FREE_PTR(vrrp->unicast_frame_valid);
+	FREE_PTR(vrrp->unicast_cbuf);
+	if (vrrp->dump_buf)
+		free(vrrp->dump_buf);	/* allocated by open_memstream() */
 	free_notify_script(&vrrp->script_backup);
 	free_notify_script(&vrrp->script_master);
 	free_notify_script(&vrrp->script_fault);
 	free_notify_script(&vrrp->script_stop);
 	free_notify_script(&vrrp->script);
-	FREE_PTR(vrrp->stats);
+	if (!stats_page_contains(vrrp_stats_page, vrrp->stats))
+		FREE_PTR(vrrp->stats);
 #ifdef _WITH_VRRP_AUTH_
 	FREE(vrrp->ipsecah_counter);
+	FREE_PTR(vrrp->ah_ctx);
 #endif
 
 	if (!LIST_ISEMPTY(vrrp->track_ifp))
@@ -240,6 +287,21 @@ free_vrrp(void *data)
 			FREE(ELEMENT_DATA(e));
 	free_list(&vrrp->track_script);
 
+	if (!LIST_ISEMPTY(vrrp->track_bfd))
+		for (e = LIST_HEAD(vrrp->track_bfd); e; ELEMENT_NEXT(e))
+			FREE(ELEMENT_DATA(e));
+	free_list(&vrrp->track_bfd);
+
+	if (!LIST_ISEMPTY(vrrp->track_file))
+		for (e = LIST_HEAD(vrrp->track_file); e; ELEMENT_NEXT(e))
+			FREE(ELEMENT_DATA(e));
+	free_list(&vrrp->track_file);
+
+	if (!LIST_ISEMPTY(vrrp->track_process))
+		for (e = LIST_HEAD(vrrp->track_process); e; ELEMENT_NEXT(e))
+			FREE(ELEMENT_DATA(e));
+	free_list(&vrrp->track_process);
+
 	free_list(&vrrp->unicast_peer);
 	free_list(&vrrp->vip);
 	free_list(&vrrp->evip);
@@ -292,6 +354,8 @@ dump_vrrp(void *data)
 		(vrrp->adver_int / (TIMER_HZ / 1000)),
 		(vrrp->version == VRRP_VERSION_2) ? "sec" : "milli-sec");
 	log_message(LOG_INFO, "   Accept %s", vrrp->accept ? "enabled" : "disabled");
+	if (vrrp->optimistic_dad)
+		log_message(LOG_INFO, "   Using optimistic DAD for IPv6 VIPs");
 	if (vrrp->nopreempt)
 		log_message(LOG_INFO, "   Preempt disabled");
 	if (vrrp->preempt_delay)
@@ -321,6 +385,18 @@ dump_vrrp(void *data)
 		log_message(LOG_INFO, "   Tracked scripts = %d", LIST_SIZE(vrrp->track_script));
 		dump_list(vrrp->track_script);
 	}
+	if (!LIST_ISEMPTY(vrrp->track_bfd)) {
+		log_message(LOG_INFO, "   Tracked BFD sessions = %d", LIST_SIZE(vrrp->track_bfd));
+		dump_list(vrrp->track_bfd);
+	}
+	if (!LIST_ISEMPTY(vrrp->track_file)) {
+		log_message(LOG_INFO, "   Tracked files = %d", LIST_SIZE(vrrp->track_file));
+		dump_list(vrrp->track_file);
+	}
+	if (!LIST_ISEMPTY(vrrp->track_process)) {
+		log_message(LOG_INFO, "   Tracked processes = %d", LIST_SIZE(vrrp->track_process));
+		dump_list(vrrp->track_process);
+	}
 	if (!LIST_ISEMPTY(vrrp->unicast_peer)) {
 		log_message(LOG_INFO, "   Unicast Peer = %d", LIST_SIZE(vrrp->unicast_peer));
 		dump_list(vrrp->unicast_peer);
@@ -491,7 +567,7 @@ alloc_vrrp_track(vector_t *strvec)
 
 	if (!LIST_EXISTS(vrrp->track_ifp))
 		vrrp->track_ifp = alloc_list(NULL, dump_track);
-	alloc_track(vrrp->track_ifp, strvec);
+	alloc_track(vrrp, strvec);
 }
 
 void
@@ -501,7 +577,37 @@ alloc_vrrp_track_script(vector_t *strvec)
 
 	if (!LIST_EXISTS(vrrp->track_script))
 		vrrp->track_script = alloc_list(NULL, dump_track_script);
-	alloc_track_script(vrrp->track_script, strvec, vrrp->iname);
+	alloc_track_script(vrrp, strvec);
+}
+
+void
+alloc_vrrp_track_bfd(vector_t *strvec)
+{
+	vrrp_t *vrrp = LIST_TAIL_DATA(vrrp_data->vrrp);
+
+	if (!LIST_EXISTS(vrrp->track_bfd))
+		vrrp->track_bfd = alloc_list(NULL, dump_track_bfd);
+	alloc_track_bfd(vrrp->track_bfd, strvec, vrrp->iname);
+}
+
+void
+alloc_vrrp_track_file(vector_t *strvec)
+{
+	vrrp_t *vrrp = LIST_TAIL_DATA(vrrp_data->vrrp);
+
+	if (!LIST_EXISTS(vrrp->track_file))
+		vrrp->track_file = alloc_list(NULL, dump_track_file);
+	alloc_track_file(vrrp->track_file, strvec, vrrp->iname);
+}
+
+void
+alloc_vrrp_track_process(vector_t *strvec)
+{
+	vrrp_t *vrrp = LIST_TAIL_DATA(vrrp_data->vrrp);
+
+	if (!LIST_EXISTS(vrrp->track_process))
+		vrrp->track_process = alloc_list(NULL, dump_track_process);
+	alloc_track_process(vrrp->track_process, strvec, vrrp->iname);
 }
 
 void
@@ -580,14 +686,64 @@ alloc_vrrp_script(char *sname)
 	new->inuse = 0;
 	new->rise = 1;
 	new->fall = 1;
+	new->stream_pid = -1;
+	new->stream_fd = -1;
 	list_add(vrrp_data->vrrp_script, new);
 }
 
+void
+alloc_vrrp_bfd(char *bname)
+{
+	size_t size = strlen(bname);
+	vrrp_bfd_t *new;
+
+	/* Allocate new BFD session structure */
+	new = (vrrp_bfd_t *) MALLOC(sizeof(vrrp_bfd_t));
+	new->bname = (char *) MALLOC(size + 1);
+	memcpy(new->bname, bname, size + 1);
+	new->min_tx = BFD_DEFAULT_MIN_TX;
+	new->min_rx = BFD_DEFAULT_MIN_RX;
+	new->multiplier = BFD_DEFAULT_MULT;
+	new->local_state = BFD_STATE_DOWN;
+	new->remote_state = BFD_STATE_DOWN;
+	list_add(vrrp_data->vrrp_bfd, new);
+}
+
+void
+alloc_vrrp_file(char *fname)
+{
+	size_t size = strlen(fname);
+	vrrp_file_t *new;
+
+	/* Allocate new track file structure */
+	new = (vrrp_file_t *) MALLOC(sizeof(vrrp_file_t));
+	new->fname = (char *) MALLOC(size + 1);
+	memcpy(new->fname, fname, size + 1);
+	new->wd = -1;
+	new->weight = 1;
+	list_add(vrrp_data->vrrp_file, new);
+}
+
+void
+alloc_vrrp_process(char *pname)
+{
+	size_t size = strlen(pname);
+	vrrp_process_t *new;
+
+	/* Allocate new track process structure */
+	new = (vrrp_process_t *) MALLOC(sizeof(vrrp_process_t));
+	new->pname = (char *) MALLOC(size + 1);
+	memcpy(new->pname, pname, size + 1);
+	new->quorum = 1;
+	list_add(vrrp_data->vrrp_process, new);
+}
+
 /* data facility functions */
 void
 alloc_vrrp_buffer(size_t len)
 {
-	vrrp_buffer = (char *) MALLOC(len);
+	/* One slot of len bytes per batched receive */
+	vrrp_buffer = (char *) MALLOC(len * VRRP_RX_BATCH);
 	vrrp_buffer_len = (vrrp_buffer) ? len : 0;
 }
 
@@ -611,10 +767,13 @@ alloc_vrrp_data(void)
 
 	new = (vrrp_data_t *) MALLOC(sizeof(vrrp_data_t));
 	new->vrrp = alloc_list(free_vrrp, dump_vrrp);
-	new->vrrp_index = alloc_mlist(NULL, NULL, 1151+1);
-	new->vrrp_index_fd = alloc_mlist(NULL, NULL, 1024+1);
+	/* vrrp_index and vrrp_index_fd are intrusive buckets; MALLOC
+	 * zeroing leaves every bucket head empty */
 	new->vrrp_sync_group = alloc_list(free_vgroup, dump_vgroup);
 	new->vrrp_script = alloc_list(free_vscript, dump_vscript);
+	new->vrrp_bfd = alloc_list(free_vrrp_bfd, dump_vrrp_bfd);
+	new->vrrp_file = alloc_list(free_vrrp_file, dump_vrrp_file);
+	new->vrrp_process = alloc_list(free_vrrp_process, dump_vrrp_process);
 	new->vrrp_socket_pool = alloc_list(free_sock, dump_sock);
 
 	return new;
@@ -626,11 +785,12 @@ free_vrrp_data(vrrp_data_t * data)
 	free_list(&data->static_addresses);
 	free_list(&data->static_routes);
 	free_list(&data->static_rules);
-	free_mlist(data->vrrp_index, 1151+1);
-	free_mlist(data->vrrp_index_fd, 1024+1);
 	free_list(&data->vrrp);
 	free_list(&data->vrrp_sync_group);
 	free_list(&data->vrrp_script);
+	free_list(&data->vrrp_bfd);
+	free_list(&data->vrrp_file);
+	free_list(&data->vrrp_process);
 	FREE(data);
 }
 
@@ -661,4 +821,248 @@ dump_vrrp_data(vrrp_data_t * data)
 		log_message(LOG_INFO, "------< VRRP Scripts >------");
 		dump_list(data->vrrp_script);
 	}
+	if (!LIST_ISEMPTY(data->vrrp_bfd)) {
+		log_message(LOG_INFO, "------< VRRP BFD Sessions >------");
+		dump_list(data->vrrp_bfd);
+	}
+	if (!LIST_ISEMPTY(data->vrrp_file)) {
+		log_message(LOG_INFO, "------< VRRP Track files >------");
+		dump_list(data->vrrp_file);
+	}
+	if (!LIST_ISEMPTY(data->vrrp_process)) {
+		log_message(LOG_INFO, "------< VRRP Track processes >------");
+		dump_list(data->vrrp_process);
+	}
+}
+
+/* Move the per-instance counters onto the shared stats page so they
+ * are exported to monitoring agents. Across a reload an instance finds
+ * its existing record by name and keeps its counter history; records
+ * for instances that went away simply stop moving. */
+void
+vrrp_publish_stats_page(void)
+{
+	element e;
+	vrrp_t *vrrp;
+	vrrp_stats *rec;
+	bool existing;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp))
+		return;
+
+	if (!vrrp_stats_page)
+		vrrp_stats_page = stats_page_create(VRRP_STATS_PAGE_FILE, sizeof(vrrp_stats),
+						    LIST_SIZE(vrrp_data->vrrp) * 2 + 16);
+	if (!vrrp_stats_page)
+		return;
+
+	vrrp_stats_page->hdr->generation++;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+
+		if (!stats_page_contains(vrrp_stats_page, vrrp->stats)) {
+			rec = stats_page_record(vrrp_stats_page, vrrp->iname, &existing);
+			if (!rec) {
+				log_message(LOG_INFO, "VRRP stats page full - VRRP_Instance(%s) keeps private counters",
+					    vrrp->iname);
+				continue;
+			}
+
+			if (!existing)
+				*rec = *vrrp->stats;
+			FREE(vrrp->stats);
+			vrrp->stats = rec;
+		}
+
+		vrrp->stats->state = (uint32_t)vrrp->state;
+	}
+
+#ifdef _WITH_LVS_
+	/* Sync daemon visibility alongside the instance counters */
+	if (global_data->lvs_syncd.ifname)
+		ipvs_syncd_publish_stats(vrrp_stats_page);
+#endif
+}
+
+/* Move the per-socket spurious-delivery counters onto the stats page.
+ * Runs once the dispatcher has built the socket pool; a socket with the
+ * same identity across a reload finds its record and keeps its count. */
+void
+vrrp_publish_sock_stats(void)
+{
+	element e;
+	sock_t *sock;
+	uint64_t *rec;
+	bool existing;
+	char name[STATS_REC_NAME_LEN];
+
+	if (!vrrp_stats_page || LIST_ISEMPTY(vrrp_data->vrrp_socket_pool))
+		return;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_socket_pool); e; ELEMENT_NEXT(e)) {
+		sock = ELEMENT_DATA(e);
+
+		if (stats_page_contains(vrrp_stats_page, sock->spurious_rx))
+			continue;
+
+		snprintf(name, sizeof(name), "# sock if%u proto%d shard%u/%u%s",
+			 sock->ifindex, sock->proto, sock->shard, sock->shards,
+			 sock->unicast ? " unicast" : "");
+		rec = stats_page_record(vrrp_stats_page, name, &existing);
+		if (!rec)
+			continue;
+
+		if (!existing)
+			*rec = *sock->spurious_rx;
+		FREE(sock->spurious_rx);
+		sock->spurious_rx = rec;
+	}
+}
+
+void
+vrrp_close_stats_page(void)
+{
+	stats_page_close(&vrrp_stats_page, true);
+}
+
+/* Per-instance state checkpoint. When vrrp_state_file is configured the
+ * instances keep a record in an mmap'd stats page, updated in place on
+ * every transition and advert, so it costs nothing on the hot path and
+ * survives a crash. On a cold start within the protocol's master down
+ * window, instances checkpointed as MASTER resume mastership through
+ * the usual GOTO_MASTER path - advert first, then listen - instead of
+ * waiting out the full interval as BACKUP. */
+static stats_page_t *vrrp_chkpt_page;
+
+/* Read back the checkpoint the previous daemon left. Runs on a cold
+ * start only, before the page is re-created over the old file */
+void
+vrrp_state_file_restore(void)
+{
+	struct stat st;
+	stats_page_hdr_t *hdr;
+	stats_rec_t *rec;
+	vrrp_chkpt_t *ck;
+	char *buf;
+	size_t rec_size;
+	unsigned i, restored = 0;
+	uint64_t now, window;
+	element e;
+	vrrp_t *vrrp;
+	int fd;
+
+	if (!global_data->vrrp_state_file || LIST_ISEMPTY(vrrp_data->vrrp))
+		return;
+
+	if ((fd = open(global_data->vrrp_state_file, O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(stats_page_hdr_t)) {
+		close(fd);
+		return;
+	}
+
+	buf = (char *) MALLOC((size_t)st.st_size);
+	if (read(fd, buf, (size_t)st.st_size) != (ssize_t)st.st_size) {
+		log_message(LOG_INFO, "Unable to read VRRP state file %s", global_data->vrrp_state_file);
+		close(fd);
+		FREE(buf);
+		return;
+	}
+	close(fd);
+
+	hdr = (stats_page_hdr_t *)buf;
+	if (memcmp(hdr->magic, STATS_PAGE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != STATS_PAGE_VERSION ||
+	    hdr->payload_size != sizeof(vrrp_chkpt_t)) {
+		log_message(LOG_INFO, "VRRP state file %s has unexpected layout - starting cold", global_data->vrrp_state_file);
+		FREE(buf);
+		return;
+	}
+
+	rec_size = sizeof(stats_rec_t) + ((sizeof(vrrp_chkpt_t) + 7) & ~(size_t)7);
+	if (hdr->used_records > ((size_t)st.st_size - sizeof(stats_page_hdr_t)) / rec_size)
+		hdr->used_records = (uint32_t)(((size_t)st.st_size - sizeof(stats_page_hdr_t)) / rec_size);
+
+	now = (uint64_t)time(NULL);
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+
+		for (i = 0; i < hdr->used_records; i++) {
+			rec = (stats_rec_t *)(buf + sizeof(stats_page_hdr_t) + i * rec_size);
+			if (rec->seq & 1 ||
+			    strncmp(rec->name, vrrp->iname, sizeof(rec->name)))
+				continue;
+
+			ck = (vrrp_chkpt_t *)(rec + 1);
+			if (ck->state != VRRP_STATE_MAST)
+				break;
+
+			/* Resume only while the backups cannot have timed us
+			 * out yet - one master down interval since our last
+			 * advert hit the wire */
+			window = 3 * vrrp->adver_int / TIMER_HZ + 1;
+			if (ck->last_advert > now || now - ck->last_advert > window) {
+				log_message(LOG_INFO, "VRRP_Instance(%s) checkpoint too old - starting as BACKUP", vrrp->iname);
+				break;
+			}
+
+			log_message(LOG_INFO, "VRRP_Instance(%s) resuming MASTER from state checkpoint", vrrp->iname);
+			vrrp->wantstate = VRRP_STATE_MAST;
+			vrrp_set_effective_priority(vrrp, (uint8_t)ck->effective_priority);
+			restored++;
+			break;
+		}
+	}
+
+	FREE(buf);
+
+	if (restored)
+		log_message(LOG_INFO, "Resuming %u MASTER instance(s) from %s", restored, global_data->vrrp_state_file);
+}
+
+/* (Re)create the checkpoint page and point the instances' records into
+ * it. Mirrors vrrp_publish_stats_page() across reloads. */
+void
+vrrp_publish_state_file(void)
+{
+	element e;
+	vrrp_t *vrrp;
+	vrrp_chkpt_t *rec;
+	bool existing;
+
+	if (!global_data->vrrp_state_file || LIST_ISEMPTY(vrrp_data->vrrp))
+		return;
+
+	if (!vrrp_chkpt_page)
+		vrrp_chkpt_page = stats_page_create(global_data->vrrp_state_file, sizeof(vrrp_chkpt_t),
+						    LIST_SIZE(vrrp_data->vrrp) * 2 + 16);
+	if (!vrrp_chkpt_page)
+		return;
+
+	vrrp_chkpt_page->hdr->generation++;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+
+		rec = stats_page_record(vrrp_chkpt_page, vrrp->iname, &existing);
+		if (!rec) {
+			log_message(LOG_INFO, "VRRP state file full - VRRP_Instance(%s) not checkpointed",
+				    vrrp->iname);
+			continue;
+		}
+
+		vrrp->chkpt = rec;
+		rec->state = (uint32_t)vrrp->state;
+		rec->effective_priority = vrrp->effective_priority;
+		rec->updated = (uint64_t)time(NULL);
+	}
+}
+
+void
+vrrp_close_state_file(bool unlink_file)
+{
+	stats_page_close(&vrrp_chkpt_page, unlink_file);
 }
@@ -3,7 +3,7 @@
  *              <www.linuxvirtualserver.org>. It monitor & manipulate
  *              a loadbalanced server pool using multi-layer checks.
  *
- * Part:        DBus server thread for VRRP
+ * Part:        DBus server for VRRP
  *
  * Author:      Alexandre Cassen, <acassen@linux-vs.org>
  *
@@ -38,15 +38,9 @@
 
 #include "config.h"
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-#include <pthread.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <gio/gio.h>
 #include <ctype.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdint.h>
@@ -62,20 +56,6 @@
 #include "timer.h"
 #include "scheduler.h"
 
-typedef enum dbus_action {
-	DBUS_ACTION_NONE,
-	DBUS_PRINT_DATA,
-	DBUS_PRINT_STATS,
-	DBUS_RELOAD,
-#ifdef _WITH_DBUS_CREATE_INSTANCE_
-	DBUS_CREATE_INSTANCE,
-	DBUS_DESTROY_INSTANCE,
-#endif
-	DBUS_SEND_GARP,
-	DBUS_GET_NAME,
-	DBUS_GET_STATUS,
-} dbus_action_t;
-
 typedef enum dbus_error {
 	DBUS_SUCCESS,
 	DBUS_INTERFACE_NOT_FOUND,
@@ -84,26 +64,52 @@ typedef enum dbus_error {
 	DBUS_INSTANCE_NOT_FOUND,
 } dbus_error_t;
 
-typedef struct dbus_queue_ent {
-	dbus_action_t action;
-	dbus_error_t reply;
-	char *ifname;
-	uint8_t vrid;
-	uint8_t family;
-	GVariant *args;
-} dbus_queue_ent_t;
-
 /* Global file variables */
 static GDBusNodeInfo *vrrp_introspection_data = NULL;
 static GDBusNodeInfo *vrrp_instance_introspection_data = NULL;
 static GDBusConnection *global_connection;
 static GHashTable *objects;
-static GMainLoop *loop;
-
-/* Data passing between main vrrp thread and dbus thread */
-dbus_queue_ent_t *ent_ptr;
-static int dbus_in_pipe[2], dbus_out_pipe[2];
-static sem_t thread_end;
+static guint dbus_owner_id;
+
+/* The connection runs on a private GMainContext dispatched from the
+ * scheduler rather than on a GLib main loop in its own thread. After
+ * each dispatch the context's poll fds and timeout are queried and
+ * armed as LO-priority read/timer threads; when one fires, the ready
+ * sources are dispatched and the set re-armed. Method and property
+ * handlers therefore run on the vrrp thread and use the protocol state
+ * directly - no extra thread, no pipe handshake per operation, no
+ * locking against the protocol hot path. */
+#define DBUS_MAX_POLL_FD	8
+
+static GMainContext *dbus_context;
+static GPollFD dbus_poll_fds[DBUS_MAX_POLL_FD];
+static int dbus_poll_n;
+static gint dbus_max_prio;
+static thread_t *dbus_io_thread[DBUS_MAX_POLL_FD];
+static thread_t *dbus_timer_thread;
+
+/* Deferred registration of the per instance objects. With a few
+ * thousand instances, registering them all inline in on_bus_acquired()
+ * stalls the scheduler, for objects most of which will never be
+ * queried. The instances are copied into a queue and registered a
+ * batch at a time from an idle source once the bus is up. */
+#define DBUS_REGISTER_BATCH	64
+
+#define DBUS_INAME_MAX	128
+
+typedef struct dbus_register_ent {
+	char		ifname[sizeof ((vrrp_t*)NULL)->ifp->ifname];
+	uint8_t		vrid;
+	uint8_t		family;
+	uint32_t	state;
+	char		iname[DBUS_INAME_MAX];
+} dbus_register_ent_t;
+
+static dbus_register_ent_t *register_queue;
+static unsigned register_queue_len;
+static unsigned register_queue_next;
+
+static int dbus_context_dispatch(thread_t *);
 
 /* The only characters that are valid in a dbus path are A-Z, a-z, 0-9, _ */
 static char *
@@ -233,46 +239,6 @@ dbus_object_create_path_instance(const gchar *interface, int vrid, sa_family_t f
 	return object_path;
 }
 
-static dbus_queue_ent_t *
-process_method_call(dbus_queue_ent_t *ent)
-{
-	ssize_t ret;
-
-	if (!ent)
-		return NULL;
-
-	/* Tell the main thread that a queue entry is waiting. Any data works */
-	ent_ptr = ent;
-	if (write(dbus_in_pipe[1], ent, 1) != 1)
-		log_message(LOG_INFO, "Write from DBus thread to main thread failed");
-
-	/* Wait for a response */
-	while ((ret = read(dbus_out_pipe[0], ent, 1)) == -1 && errno == EINTR) {
-		log_message(LOG_INFO, "dbus_out_pipe read returned EINTR");
-	}
-	if (ret == -1)
-		log_message(LOG_INFO, "DBus response read error - errno = %d", errno);
-
-#ifdef DBUS_DEBUG
-	if (ent->reply != DBUS_SUCCESS) {
-		char *iname;
-
-		if (ent->reply == DBUS_INTERFACE_NOT_FOUND)
-			log_message(LOG_INFO, "Unable to find DBus requested instance %s/%d/%s", ent->ifname, ent->vrid, family_str(ent->family));
-		else if (ent->reply == DBUS_OBJECT_ALREADY_EXISTS)
-			log_message(LOG_INFO, "Unable to create DBus requested object with instance %s/%d/%s", ent->ifname, ent->vrid, family_str(ent->family));
-		else if (ent->reply == DBUS_INSTANCE_NOT_FOUND) {
-			g_variant_get(ent->args, "(s)", &iname);
-			log_message(LOG_INFO, "Unable to find DBus requested instance %s", iname);
-		}
-		else
-			log_message(LOG_INFO, "Unknown DBus reply %d", ent->reply);
-	}
-#endif
-
-	return ent;
-}
-
 static void
 get_interface_ids(const gchar *object_path, gchar *interface, uint8_t *vrid, uint8_t *family)
 {
@@ -297,7 +263,8 @@ get_interface_ids(const gchar *object_path, gchar *interface, uint8_t *vrid, uin
 	g_strfreev(dirs);
 }
 
-/* handles reply to org.freedesktop.DBus.Properties.Get method on any object*/
+/* handles reply to org.freedesktop.DBus.Properties.Get method on any object.
+ * Runs on the vrrp thread, so the instance is read directly */
 static GVariant *
 handle_get_property(__attribute__((unused)) GDBusConnection  *connection,
 		    __attribute__((unused)) const gchar      *sender,
@@ -307,40 +274,35 @@ handle_get_property(__attribute__((unused)) GDBusConnection  *connection,
 		    GError          **error,
 		    __attribute__((unused)) gpointer          user_data)
 {
-	GVariant *ret = NULL;
-	dbus_queue_ent_t ent;
+	vrrp_t *vrrp;
 	char ifname_str[sizeof ((vrrp_t*)NULL)->ifp->ifname];
-	int action;
+	uint8_t vrid, family;
 
 	if (g_strcmp0(interface_name, DBUS_VRRP_INSTANCE_INTERFACE)) {
 		log_message(LOG_INFO, "Interface %s has not been implemented yet", interface_name);
 		return NULL;
 	}
 
-	if (!g_strcmp0(property_name, "Name"))
-		action = DBUS_GET_NAME;
-	else if (!g_strcmp0(property_name, "State"))
-		action = DBUS_GET_STATUS;
-	else {
-		log_message(LOG_INFO, "Property %s does not exist", property_name);
+	get_interface_ids(object_path, ifname_str, &vrid, &family);
+
+	if (!(vrrp = get_vrrp_instance(ifname_str, vrid, family))) {
+		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s/%d/%s' not found", ifname_str, vrid, family_str(family));
 		return NULL;
 	}
 
-	get_interface_ids(object_path, ifname_str, &ent.vrid, &ent.family);
-
-	ent.action = action;
-	ent.ifname = ifname_str;
-	ent.args = NULL;
-	process_method_call(&ent);
-	if (ent.reply == DBUS_SUCCESS)
-		ret = ent.args;
-	else
-		g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s/%d/%s' not found", ifname_str, ent.vrid, family_str(ent.family));
+	if (!g_strcmp0(property_name, "Name"))
+		return g_variant_new("(s)", vrrp->iname);
+	if (!g_strcmp0(property_name, "State"))
+		return g_variant_new("(us)", vrrp->state, state_str(vrrp->state));
 
-	return ret;
+	log_message(LOG_INFO, "Property %s does not exist", property_name);
+	return NULL;
 }
 
-/* handles method_calls on any object */
+static int dbus_create_object_params(char *, const char *, int, sa_family_t, bool);
+static gboolean dbus_unregister_object(char *);
+
+/* handles method_calls on any object. Runs on the vrrp thread */
 static void
 handle_method_call(__attribute__((unused)) GDBusConnection *connection,
 		   __attribute__((unused)) const gchar           *sender,
@@ -358,20 +320,22 @@ handle_method_call(__attribute__((unused)) GDBusConnection *connection,
 	char *iname;
 	char *ifname;
 	size_t len;
+	unsigned vrid_u;
 	unsigned family;
 #endif
-	dbus_queue_ent_t ent;
+	vrrp_t *vrrp;
+	uint8_t vrid, ifamily;
 	char ifname_str[sizeof ((vrrp_t*)NULL)->ifp->ifname];
 
 	if (!g_strcmp0(interface_name, DBUS_VRRP_INTERFACE)) {
 		if (!g_strcmp0(method_name, "PrintData")) {
-			ent.action = DBUS_PRINT_DATA;
-			process_method_call(&ent);
+			log_message(LOG_INFO, "Printing VRRP data on DBus request");
+			vrrp_dump_in_child(vrrp_print_data);
 			g_dbus_method_invocation_return_value(invocation, NULL);
 		}
 		else if (g_strcmp0(method_name, "PrintStats") == 0) {
-			ent.action = DBUS_PRINT_STATS;
-			process_method_call(&ent);
+			log_message(LOG_INFO, "Printing VRRP stats on DBus request");
+			vrrp_dump_in_child(vrrp_print_stats);
 			g_dbus_method_invocation_return_value(invocation, NULL);
 		}
 		else if (g_strcmp0(method_name, "ReloadConfig") == 0) {
@@ -380,33 +344,30 @@ handle_method_call(__attribute__((unused)) GDBusConnection *connection,
 		}
 #ifdef _WITH_DBUS_CREATE_INSTANCE_
 		else if (g_strcmp0(method_name, "CreateInstance") == 0) {
-			g_variant_get(parameters, "(ssuu)", &iname, &ifname, &ent.vrid, &family);
+			g_variant_get(parameters, "(ssuu)", &iname, &ifname, &vrid_u, &family);
 			len = strlen(ifname);
 			if (len == 0 || len >= IFNAMSIZ) {
 				log_message(LOG_INFO, "Interface name '%s' too long for CreateInstance", ifname);
 				g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Interface name empty or too long");
+				g_free(iname);
+				g_free(ifname);
 				return;
 			}
-			ent.action = DBUS_CREATE_INSTANCE;
-			ent.ifname = ifname;
-			ent.family = family == 4 ? AF_INET : family == 6 ? AF_INET6 : AF_UNSPEC;
-			ent.args = g_variant_new("(s)", iname);
-			process_method_call(&ent);
-			g_variant_unref(ent.args);
+			dbus_create_object_params(iname, ifname,
+						  (int)vrid_u,
+						  family == 4 ? AF_INET : family == 6 ? AF_INET6 : AF_UNSPEC,
+						  true);
+			g_free(ifname);
 			g_dbus_method_invocation_return_value(invocation, NULL);
 		}
 		else if (g_strcmp0(method_name, "DestroyInstance") == 0) {
 // TODO - this should be on the instance
-			ent.action = DBUS_DESTROY_INSTANCE;
-			ent.args = parameters;
-			process_method_call(&ent);
-
-			if (ent.reply == DBUS_INSTANCE_NOT_FOUND) {
-				g_variant_get(parameters, "(s)", &iname);
+			g_variant_get(parameters, "(s)", &iname);
+			if (!dbus_unregister_object(iname))
 				g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s' not found", iname);
-			}
 			else
 				g_dbus_method_invocation_return_value(invocation, NULL);
+			g_free(iname);
 		}
 #endif
 		else {
@@ -419,14 +380,14 @@ handle_method_call(__attribute__((unused)) GDBusConnection *connection,
 
 	if (!g_strcmp0(interface_name, DBUS_VRRP_INSTANCE_INTERFACE)) {
 		if (!g_strcmp0(method_name, "SendGarp")) {
-			get_interface_ids(object_path, ifname_str, &ent.vrid, &ent.family);
-			ent.action = DBUS_SEND_GARP;
-			ent.ifname = ifname_str;
-			process_method_call(&ent);
-			if (ent.reply ==  DBUS_INTERFACE_NOT_FOUND)
-				g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s/%d/%s' not found", ifname_str, ent.vrid, family_str(ent.family));
-			else
+			get_interface_ids(object_path, ifname_str, &vrid, &ifamily);
+			if (!(vrrp = get_vrrp_instance(ifname_str, vrid, ifamily)))
+				g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Instance '%s/%d/%s' not found", ifname_str, vrid, family_str(ifamily));
+			else {
+				log_message(LOG_INFO, "Sending garps on %s on DBus request", vrrp->iname);
+				vrrp_send_link_update(vrrp, 1);
 				g_dbus_method_invocation_return_value(invocation, NULL);
+			}
 		} else {
 			log_message(LOG_INFO, "Method %s has not been implemented yet", method_name);
 			g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_MATCH_RULE_NOT_FOUND, "Method not implemented");
@@ -506,6 +467,74 @@ dbus_emit_signal(GDBusConnection *connection,
 	return true;
 }
 
+/* Emit signal VrrpStatusChange for one instance */
+static void
+dbus_emit_state_signal(const gchar *ifname, uint8_t vrid, uint8_t family, uint32_t state)
+{
+	gchar *object_path;
+	GVariant *args;
+
+	if (global_connection == NULL)
+		return;
+
+	object_path = dbus_object_create_path_instance(ifname, vrid, family);
+
+	args = g_variant_new("(u)", state);
+	dbus_emit_signal(global_connection, object_path, DBUS_VRRP_INSTANCE_INTERFACE, "VrrpStatusChange", args);
+	g_free(object_path);
+}
+
+/* Attach an idle callback to our context - g_idle_add() would target
+ * the default context, which nothing dispatches */
+static void
+dbus_idle_add(GSourceFunc func)
+{
+	GSource *source = g_idle_source_new();
+
+	g_source_set_callback(source, func, NULL, NULL);
+	g_source_attach(source, dbus_context);
+	g_source_unref(source);
+}
+
+/* Idle callback registering the next batch of instance objects, and
+ * announcing each instance's state once its object exists. Reschedules
+ * itself until the queue is drained, then signals VrrpStarted */
+static gboolean
+dbus_register_batch(__attribute__((unused)) gpointer user_data)
+{
+	dbus_register_ent_t *ent;
+	unsigned stop = register_queue_next + DBUS_REGISTER_BATCH;
+	gchar *path;
+
+	/* The connection may have been lost since the batch was queued */
+	if (global_connection == NULL) {
+		FREE_PTR(register_queue);
+		register_queue = NULL;
+		return FALSE;
+	}
+
+	while (register_queue_next < register_queue_len && register_queue_next < stop) {
+		ent = &register_queue[register_queue_next++];
+
+		/* The objects hash table keeps the key, so hand it its own copy */
+		dbus_create_object_params(strdup(ent->iname), ent->ifname, ent->vrid, ent->family, false);
+		dbus_emit_state_signal(ent->ifname, ent->vrid, ent->family, ent->state);
+	}
+
+	if (register_queue_next < register_queue_len)
+		return TRUE;
+
+	FREE_PTR(register_queue);
+	register_queue = NULL;
+
+	/* Send a signal to say we have started */
+	path = dbus_object_create_path_vrrp();
+	dbus_emit_signal(global_connection, path, DBUS_VRRP_INTERFACE, "VrrpStarted", NULL);
+	g_free(path);
+
+	return FALSE;
+}
+
 /* first function to be run when trying to own bus,
  * exports objects to the bus */
 static void
@@ -515,17 +544,19 @@ on_bus_acquired(GDBusConnection *connection,
 {
 	global_connection = connection;
 	gchar *path;
-	element e;
 	GError *local_error = NULL;
+	element e;
+	vrrp_t *vrrp;
+	dbus_register_ent_t *ent;
 
 	log_message(LOG_INFO, "Acquired DBus bus %s\n", name);
 
 	/* register VRRP object */
 	path = dbus_object_create_path_vrrp();
-	guint vrrp = g_dbus_connection_register_object(connection, path,
+	guint vrrp_obj = g_dbus_connection_register_object(connection, path,
 							 vrrp_introspection_data->interfaces[0],
 							 &interface_vtable, NULL, NULL, &local_error);
-	g_hash_table_insert(objects, "__Vrrp__", GUINT_TO_POINTER(vrrp));
+	g_hash_table_insert(objects, "__Vrrp__", GUINT_TO_POINTER(vrrp_obj));
 	g_free(path);
 	if (local_error != NULL) {
 		log_message(LOG_INFO, "Registering VRRP object on %s failed: %s",
@@ -533,25 +564,39 @@ on_bus_acquired(GDBusConnection *connection,
 		g_clear_error(&local_error);
 	}
 
-	/* for each available VRRP instance, register an object */
-	if (LIST_ISEMPTY(vrrp_data->vrrp))
-		return;
-
-	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
-		vrrp_t * vrrp = ELEMENT_DATA(e);
-		dbus_create_object(vrrp);
+	/* Queue the per instance objects for batched registration from idle
+	 * callbacks rather than registering them all here. Copy the identities
+	 * out of the configuration so the queue stays valid across a reload */
+	FREE_PTR(register_queue);
+	register_queue = NULL;
+	register_queue_len = 0;
+	register_queue_next = 0;
+
+	if (!LIST_ISEMPTY(vrrp_data->vrrp)) {
+		register_queue = (dbus_register_ent_t *) MALLOC(LIST_SIZE(vrrp_data->vrrp) * sizeof(dbus_register_ent_t));
+		ent = register_queue;
+		for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e), ent++) {
+			vrrp = ELEMENT_DATA(e);
+
+			strcpy(ent->ifname, IF_NAME(IF_BASE_IFP(vrrp->ifp)));
+			ent->vrid = vrrp->vrid;
+			ent->family = (uint8_t)vrrp->family;
+			ent->state = (uint32_t)vrrp->state;
+			strncpy(ent->iname, vrrp->iname, DBUS_INAME_MAX - 1);
+			ent->iname[DBUS_INAME_MAX - 1] = '\0';
+			register_queue_len++;
+		}
 	}
 
-	/* Send a signal to say we have started */
-	path = dbus_object_create_path_vrrp();
-	dbus_emit_signal(global_connection, path, DBUS_VRRP_INTERFACE, "VrrpStarted", NULL);
-	g_free(path);
-
-	/* Notify DBus of the state of our instances */
-	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
-		vrrp_t * vrrp = ELEMENT_DATA(e);
-		dbus_send_state_signal(vrrp);
+	if (!register_queue_len) {
+		/* Send a signal to say we have started */
+		path = dbus_object_create_path_vrrp();
+		dbus_emit_signal(global_connection, path, DBUS_VRRP_INTERFACE, "VrrpStarted", NULL);
+		g_free(path);
+		return;
 	}
+
+	dbus_idle_add(dbus_register_batch);
 }
 
 /* run if bus name is acquired successfully */
@@ -589,8 +634,7 @@ read_file(gchar* filepath)
 		length = (size_t)ftell(f);
 		fseek(f, 0, SEEK_SET);
 
-		/* We can't use MALLOC since it isn't thread safe */
-		ret = malloc(length + 1);
+		ret = MALLOC(length + 1);
 		if (ret) {
 			if (fread(ret, length, 1, f) != 1) {
 				log_message(LOG_INFO, "Failed to read all of %s", filepath);
@@ -605,93 +649,80 @@ read_file(gchar* filepath)
 	return ret;
 }
 
-static void *
-dbus_main(__attribute__ ((unused)) void *unused)
+/* Cancel the read/timer threads armed on the context's poll fds. The
+ * thread that fired, if any, is already off the queues */
+static void
+dbus_context_disarm(thread_t *fired)
 {
-	gchar *introspection_xml;
-	guint owner_id;
-	const char *service_name;
+	int i;
 
-	objects = g_hash_table_new(g_str_hash, g_str_equal);
+	for (i = 0; i < dbus_poll_n; i++) {
+		if (dbus_io_thread[i] && dbus_io_thread[i] != fired)
+			thread_cancel(dbus_io_thread[i]);
+		dbus_io_thread[i] = NULL;
+	}
+	dbus_poll_n = 0;
 
-	/* DBus service org.keepalived.Vrrp1 exposes two interfaces, Vrrp and Instance.
-	 * Vrrp is implemented by a single VRRP object for general purposes, such as printing
-	 * data or signaling that the VRRP process has been stopped.
-	 * Instance is implemented by an Instance object for every VRRP Instance in vrrp_data.
-	 * It exposes instance specific methods and properties.
-	 */
-#ifdef DBUS_NEED_G_TYPE_INIT
-	g_type_init();
-#endif
-	GError *error = NULL;
+	if (dbus_timer_thread && dbus_timer_thread != fired)
+		thread_cancel(dbus_timer_thread);
+	dbus_timer_thread = NULL;
+}
 
-	/* read service interface data from xml files */
-	introspection_xml = read_file(DBUS_VRRP_INTERFACE_FILE_PATH);
-	if (!introspection_xml)
-		return NULL;
-	vrrp_introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
-	free(introspection_xml);
-	if (error != NULL) {
-		log_message(LOG_INFO, "Parsing DBus interface %s from file %s failed: %s",
-			    DBUS_VRRP_INTERFACE, DBUS_VRRP_INTERFACE_FILE_PATH, error->message);
-		g_clear_error(&error);
-		return NULL;
+/* Query the context's poll fds and next timeout and arm them on the
+ * scheduler as LO-priority work */
+static void
+dbus_context_arm(void)
+{
+	gint timeout;	/* milliseconds, -1 for none */
+	int i;
+
+	g_main_context_prepare(dbus_context, &dbus_max_prio);
+	dbus_poll_n = g_main_context_query(dbus_context, dbus_max_prio, &timeout,
+					   dbus_poll_fds, DBUS_MAX_POLL_FD);
+	if (dbus_poll_n > DBUS_MAX_POLL_FD) {
+		/* A GDBus connection uses a handful of fds, so this shouldn't happen */
+		log_message(LOG_INFO, "DBus context wants %d poll fds, only arming %d", dbus_poll_n, DBUS_MAX_POLL_FD);
+		dbus_poll_n = DBUS_MAX_POLL_FD;
 	}
 
-	introspection_xml = read_file(DBUS_VRRP_INSTANCE_INTERFACE_FILE_PATH);
-	if (!introspection_xml)
-		return NULL;
-	vrrp_instance_introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
-	free(introspection_xml);
-	if (error != NULL) {
-		log_message(LOG_INFO, "Parsing DBus interface %s from file %s failed: %s",
-			    DBUS_VRRP_INSTANCE_INTERFACE, DBUS_VRRP_INSTANCE_INTERFACE_FILE_PATH, error->message);
-		g_clear_error(&error);
-		return NULL;
+	for (i = 0; i < dbus_poll_n; i++) {
+		dbus_io_thread[i] = thread_add_read(master, dbus_context_dispatch, NULL,
+						    dbus_poll_fds[i].fd, TIMER_NEVER);
+		thread_set_priority(dbus_io_thread[i], THREAD_PRIO_LO);
 	}
 
-	service_name = global_data->dbus_service_name ? global_data->dbus_service_name : DBUS_SERVICE_NAME;
-	owner_id = g_bus_own_name(G_BUS_TYPE_SYSTEM,
-				  service_name,
-				  G_BUS_NAME_OWNER_FLAGS_NONE,
-				  on_bus_acquired,
-				  on_name_acquired,
-				  on_name_lost,
-				  NULL,  /* user_data */
-				  NULL); /* user_data_free_func */
-
-	loop = g_main_loop_new(NULL, FALSE);
-	g_main_loop_run(loop);
-
-	/* cleanup after loop terminates */
-	g_main_loop_unref(loop);
-	g_bus_unown_name(owner_id);
-	global_connection = NULL;
-
-	sem_post(&thread_end);
-	pthread_exit(0);
+	if (timeout >= 0) {
+		dbus_timer_thread = thread_add_timer(master, dbus_context_dispatch, NULL,
+						     (unsigned long)timeout * (TIMER_HZ / 1000));
+		thread_set_priority(dbus_timer_thread, THREAD_PRIO_LO);
+	}
 }
 
-/* The following functions are run in the context of the main vrrp thread */
+static int
+dbus_context_dispatch(thread_t *thread)
+{
+	dbus_context_disarm(thread);
+
+	/* Dispatch everything that is ready, then re-arm on the
+	 * possibly changed fd set */
+	while (g_main_context_iteration(dbus_context, FALSE));
+
+	dbus_context_arm();
+
+	return 0;
+}
 
 /* send signal VrrpStatusChange
  * containing the new state of vrrp */
 void
 dbus_send_state_signal(vrrp_t *vrrp)
 {
-	gchar *object_path;
-	GVariant *args;
-
-	/* the interface will go through the initial state changes before
-	 * the main loop can be started and global_connection initialised */
+	/* the bus may not have been acquired yet */
 	if (global_connection == NULL)
 		return;
 
-	object_path = dbus_object_create_path_instance(IF_NAME(IF_BASE_IFP(vrrp->ifp)), vrrp->vrid, vrrp->family);
-
-	args = g_variant_new("(u)", vrrp->state);
-	dbus_emit_signal(global_connection, object_path, DBUS_VRRP_INSTANCE_INTERFACE, "VrrpStatusChange", args);
-	g_free(object_path);
+	dbus_emit_state_signal(IF_NAME(IF_BASE_IFP(vrrp->ifp)), vrrp->vrid,
+			       (uint8_t)vrrp->family, (uint32_t)vrrp->state);
 }
 
 /* send signal VrrpRestarted */
@@ -732,78 +763,6 @@ dbus_remove_object(vrrp_t *vrrp)
 	dbus_unregister_object(vrrp->iname);
 }
 
-static int
-handle_dbus_msg(__attribute__((unused)) thread_t *thread)
-{
-	dbus_queue_ent_t *ent;
-	char recv_buf;
-	vrrp_t *vrrp;
-#ifdef _WITH_DBUS_CREATE_INSTANCE_
-	gchar *name;
-#endif
-
-	if (read(dbus_in_pipe[0], &recv_buf, 1) != 1)
-		log_message(LOG_INFO, "Read from DBus thread to vrrp thread failed");
-
-	if ((ent = ent_ptr) != NULL) {
-		ent->reply = DBUS_SUCCESS;
-
-		if (ent->action == DBUS_PRINT_DATA) {
-			log_message(LOG_INFO, "Printing VRRP data on DBus request");
-			vrrp_print_data();
-
-		}
-		else if (ent->action == DBUS_PRINT_STATS) {
-			log_message(LOG_INFO, "Printing VRRP stats on DBus request");
-			vrrp_print_stats();
-		}
-#ifdef _WITH_DBUS_CREATE_INSTANCE_
-		else if (ent->action == DBUS_CREATE_INSTANCE) {
-			g_variant_get(ent->args, "(s)", &name);
-			ent->reply = dbus_create_object_params(name, ent->ifname, ent->vrid, ent->family, true);
-		}
-		else if (ent->action == DBUS_DESTROY_INSTANCE) {
-			g_variant_get(ent->args, "(s)", &name);
-			if (!dbus_unregister_object(name))
-				ent->reply = DBUS_INSTANCE_NOT_FOUND;
-		}
-#endif
-		else if (ent->action == DBUS_SEND_GARP) {
-			ent->reply = DBUS_INTERFACE_NOT_FOUND;
-			vrrp = get_vrrp_instance(ent->ifname, ent->vrid, ent->family);
-			if (vrrp) {
-				log_message(LOG_INFO, "Sending garps on %s on DBus request", vrrp->iname);
-				vrrp_send_link_update(vrrp, 1);
-				ent->reply = DBUS_SUCCESS;
-			}
-		}
-		else if (ent->action == DBUS_GET_NAME ||
-			 ent->action == DBUS_GET_STATUS) {
-			/* we look for the vrrp instance object that corresponds to our interface and group */
-			ent->reply = DBUS_INTERFACE_NOT_FOUND;
-
-			vrrp = get_vrrp_instance(ent->ifname, ent->vrid, ent->family);
-
-			if (vrrp) {
-				/* the property_name argument is the property we want to Get */
-				if (ent->action == DBUS_GET_NAME)
-					ent->args = g_variant_new("(s)", vrrp->iname);
-				else if (ent->action == DBUS_GET_STATUS)
-					ent->args = g_variant_new("(us)", vrrp->state, state_str(vrrp->state));
-				else
-					ent->args = NULL;	 /* How did we get here? */
-				ent->reply = DBUS_SUCCESS;
-			}
-		}
-		if (write(dbus_out_pipe[1], ent, 1) != 1)
-			log_message(LOG_INFO, "Write from main thread to DBus thread failed");
-	}
-
-	thread_add_read(master, handle_dbus_msg, NULL, dbus_in_pipe[0], TIMER_NEVER);
-
-	return 0;
-}
-
 void
 dbus_reload(list o, list n)
 {
@@ -860,62 +819,74 @@ dbus_reload(list o, list n)
 	/* Signal we have reloaded */
 	dbus_send_reload_signal();
 
-	/* We need to reinstate the read thread */
-	thread_add_read(master, handle_dbus_msg, NULL, dbus_in_pipe[0], TIMER_NEVER);
+	/* The threads the context was armed on went with the old master
+	 * thread, so just forget them and re-arm on the new one */
+	memset(dbus_io_thread, 0, sizeof(dbus_io_thread));
+	dbus_poll_n = 0;
+	dbus_timer_thread = NULL;
+	dbus_context_arm();
 }
 
 bool
 dbus_start(void)
 {
-	pthread_t dbus_thread;
-	sigset_t sigset, cursigset;
+	gchar *introspection_xml;
+	const char *service_name;
+	GError *error = NULL;
+
+	objects = g_hash_table_new(g_str_hash, g_str_equal);
+
+	/* DBus service org.keepalived.Vrrp1 exposes two interfaces, Vrrp and Instance.
+	 * Vrrp is implemented by a single VRRP object for general purposes, such as printing
+	 * data or signaling that the VRRP process has been stopped.
+	 * Instance is implemented by an Instance object for every VRRP Instance in vrrp_data.
+	 * It exposes instance specific methods and properties.
+	 */
+#ifdef DBUS_NEED_G_TYPE_INIT
+	g_type_init();
+#endif
 
-#ifdef HAVE_PIPE2
-	if (pipe2(dbus_in_pipe, O_CLOEXEC)) {
-		log_message(LOG_INFO, "Unable to create inbound dbus pipe - disabling DBus");
+	/* read service interface data from xml files */
+	introspection_xml = read_file(DBUS_VRRP_INTERFACE_FILE_PATH);
+	if (!introspection_xml)
 		return false;
-	}
-	if (pipe2(dbus_out_pipe, O_CLOEXEC)) {
-		log_message(LOG_INFO, "Unable to create outbound dbus pipe - disabling DBus");
-		close(dbus_in_pipe[0]);
-		close(dbus_in_pipe[1]);
+	vrrp_introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
+	FREE(introspection_xml);
+	if (error != NULL) {
+		log_message(LOG_INFO, "Parsing DBus interface %s from file %s failed: %s",
+			    DBUS_VRRP_INTERFACE, DBUS_VRRP_INTERFACE_FILE_PATH, error->message);
+		g_clear_error(&error);
 		return false;
 	}
-#else
-	if (pipe(dbus_in_pipe)) {
-		log_message(LOG_INFO, "Unable to create inbound dbus pipe - disabling DBus");
+
+	introspection_xml = read_file(DBUS_VRRP_INSTANCE_INTERFACE_FILE_PATH);
+	if (!introspection_xml)
 		return false;
-	}
-	if (pipe(dbus_out_pipe)) {
-		log_message(LOG_INFO, "Unable to create outbound dbus pipe - disabling DBus");
-		close(dbus_in_pipe[0]);
-		close(dbus_in_pipe[1]);
+	vrrp_instance_introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
+	FREE(introspection_xml);
+	if (error != NULL) {
+		log_message(LOG_INFO, "Parsing DBus interface %s from file %s failed: %s",
+			    DBUS_VRRP_INSTANCE_INTERFACE, DBUS_VRRP_INSTANCE_INTERFACE_FILE_PATH, error->message);
+		g_clear_error(&error);
 		return false;
 	}
-	fcntl (dbus_in_pipe[0], F_SETFD, FD_CLOEXEC | fcntl(dbus_in_pipe[0], F_GETFD));
-	fcntl (dbus_in_pipe[1], F_SETFD, FD_CLOEXEC | fcntl(dbus_in_pipe[1], F_GETFD));
-	fcntl (dbus_out_pipe[0], F_SETFD, FD_CLOEXEC | fcntl(dbus_out_pipe[0], F_GETFD));
-	fcntl (dbus_out_pipe[1], F_SETFD, FD_CLOEXEC | fcntl(dbus_out_pipe[1], F_GETFD));
-#endif
-
-	/* We don't want the main thread to block when using the pipes */
-	fcntl(dbus_in_pipe[0], F_SETFL, O_NONBLOCK | fcntl(dbus_in_pipe[0], F_GETFL));
-	fcntl(dbus_out_pipe[1], F_SETFL, O_NONBLOCK | fcntl(dbus_out_pipe[1], F_GETFL));
-
-	thread_add_read(master, handle_dbus_msg, NULL, dbus_in_pipe[0], TIMER_NEVER);
 
-	/* Initialise the thread termination semaphore */
-	sem_init(&thread_end, 0, 0);
+	/* All the connection's sources go to our private context, which is
+	 * dispatched from the scheduler */
+	dbus_context = g_main_context_new();
+	g_main_context_push_thread_default(dbus_context);
 
-	/* Block signals (all) we don't want the new thread to process */
-	sigemptyset(&sigset);
-	pthread_sigmask(SIG_SETMASK, &sigset, &cursigset);
-
-	/* Now create the dbus thread */
-	pthread_create(&dbus_thread, NULL, &dbus_main, NULL);
+	service_name = global_data->dbus_service_name ? global_data->dbus_service_name : DBUS_SERVICE_NAME;
+	dbus_owner_id = g_bus_own_name(G_BUS_TYPE_SYSTEM,
+				       service_name,
+				       G_BUS_NAME_OWNER_FLAGS_NONE,
+				       on_bus_acquired,
+				       on_name_acquired,
+				       on_name_lost,
+				       NULL,  /* user_data */
+				       NULL); /* user_data_free_func */
 
-	/* Reenable our signals */
-	pthread_sigmask(SIG_SETMASK, &cursigset, NULL);
+	dbus_context_arm();
 
 	return true;
 }
@@ -923,8 +894,6 @@ dbus_start(void)
 void
 dbus_stop(void)
 {
-	struct timespec thread_end_wait;
-	int ret;
 	gchar *path;
 
 	if (global_connection != NULL) {
@@ -933,23 +902,20 @@ dbus_stop(void)
 		g_free(path);
 	}
 
-	g_main_loop_quit(loop);
+	dbus_context_disarm(NULL);
+
+	g_bus_unown_name(dbus_owner_id);
+
+	/* Let the stop signal and the unown go out */
+	while (g_main_context_iteration(dbus_context, FALSE));
+
+	g_main_context_pop_thread_default(dbus_context);
+	g_main_context_unref(dbus_context);
+	dbus_context = NULL;
+	global_connection = NULL;
 
 	g_dbus_node_info_unref(vrrp_introspection_data);
 	g_dbus_node_info_unref(vrrp_instance_introspection_data);
 
-	clock_gettime(CLOCK_REALTIME, &thread_end_wait);
-	thread_end_wait.tv_sec += 1;
-	while ((ret = sem_timedwait(&thread_end, &thread_end_wait)) == -1 && errno == EINTR) ;
-
-	if (ret == -1 ) {
-		if (errno == ETIMEDOUT)
-			log_message(LOG_INFO, "DBus thread termination timed out");
-		else
-			log_message(LOG_INFO, "sem_timewait error %d", errno);
-	}
-	else {
-		log_message(LOG_INFO, "Released DBus");
-		sem_destroy(&thread_end);
-	}
+	log_message(LOG_INFO, "Released DBus");
 }
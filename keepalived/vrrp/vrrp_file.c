@@ -0,0 +1,307 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        File tracking framework. Watches flag files with
+ *              inotify and feeds their integer value into the VRRP
+ *              tracking paths, replacing vrrp_script entries that just
+ *              cat a file - no fork per poll interval, and a change
+ *              takes effect as soon as the writer closes the file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+/* local include */
+#include "vrrp_file.h"
+#include "vrrp_data.h"
+#include "scheduler.h"
+#include "memory.h"
+#include "list.h"
+#include "logger.h"
+
+/* One inotify instance shared by every tracked file. Watches are set
+ * on the parent directories, not the files themselves, so writers that
+ * create, remove or rename-in the file (the usual atomic update
+ * pattern) are seen as well as in-place rewrites. */
+static int file_fd = -1;
+static thread_t *file_reader;
+
+static int file_read_thread(thread_t *);
+
+/* (Re-)read a tracked file. A missing file and an empty or
+ * non-numeric one both read as value 0. */
+static void
+vrrp_file_update(vrrp_file_t *tfile, bool log_change)
+{
+	char buf[32];
+	ssize_t len;
+	int value = 0;
+	bool exists = false;
+	int fd;
+
+	fd = open(tfile->file_path, O_RDONLY | O_CLOEXEC);
+	if (fd != -1) {
+		exists = true;
+		len = read(fd, buf, sizeof(buf) - 1);
+		if (len > 0) {
+			buf[len] = '\0';
+			value = atoi(buf);
+		}
+		close(fd);
+	}
+
+	if (exists == tfile->exists && value == tfile->value)
+		return;
+
+	tfile->exists = exists;
+	tfile->value = value;
+
+	if (log_change) {
+		if (exists)
+			log_message(LOG_INFO, "VRRP_File(%s) now reads %d"
+					    , tfile->fname, value);
+		else
+			log_message(LOG_INFO, "VRRP_File(%s) file %s removed"
+					    , tfile->fname, tfile->file_path);
+	}
+}
+
+/* Drain the inotify queue and refresh every file living in a
+ * directory that reported activity */
+static int
+file_read_thread(thread_t *thread)
+{
+	char ebuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	vrrp_file_t *tfile;
+	element e;
+	ssize_t len;
+	char *ptr;
+
+	while ((len = read(thread->u.fd, ebuf, sizeof(ebuf))) > 0) {
+		for (ptr = ebuf; ptr < ebuf + len;
+		     ptr += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *) ptr;
+			if (!event->len)
+				continue;
+
+			for (e = LIST_HEAD(vrrp_data->vrrp_file); e; ELEMENT_NEXT(e)) {
+				tfile = ELEMENT_DATA(e);
+				if (tfile->wd == event->wd &&
+				    !strcmp(tfile->file_part, event->name))
+					vrrp_file_update(tfile, true);
+			}
+		}
+	}
+
+	file_reader = thread_add_read(master, file_read_thread, NULL,
+				      thread->u.fd, TIMER_NEVER);
+	return 0;
+}
+
+/* Start watching every configured file and prime the current values */
+void
+vrrp_file_init(list l)
+{
+	element e;
+	vrrp_file_t *tfile;
+	char *dir;
+
+	if (file_fd == -1) {
+		file_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (file_fd == -1) {
+			log_message(LOG_INFO, "inotify_init error %d (%m)", errno);
+			return;
+		}
+		file_reader = thread_add_read(master, file_read_thread, NULL,
+					      file_fd, TIMER_NEVER);
+	}
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tfile = ELEMENT_DATA(e);
+
+		/* Watch the parent directory, remember the basename */
+		tfile->file_part = strrchr(tfile->file_path, '/');
+		if (tfile->file_part) {
+			dir = MALLOC((size_t)(tfile->file_part - tfile->file_path) + 2);
+			memcpy(dir, tfile->file_path,
+			       (size_t)(tfile->file_part - tfile->file_path) + 1);
+			tfile->file_part++;
+		} else {
+			dir = MALLOC(3);
+			memcpy(dir, "./", 3);
+			tfile->file_part = tfile->file_path;
+		}
+
+		tfile->wd = inotify_add_watch(file_fd, dir,
+					      IN_CLOSE_WRITE | IN_MOVED_TO |
+					      IN_CREATE | IN_DELETE | IN_MOVED_FROM);
+		if (tfile->wd == -1)
+			log_message(LOG_INFO, "VRRP_File(%s) cannot watch %s - error %d (%m)"
+					    , tfile->fname, dir, errno);
+		FREE(dir);
+
+		vrrp_file_update(tfile, false);
+	}
+}
+
+/* Close the shared inotify instance. Its read thread went with the
+ * master thread; the watches go with the fd. The values are re-read
+ * from the files themselves on init, so nothing carries over a reload. */
+void
+vrrp_file_close(void)
+{
+	if (file_fd != -1) {
+		close(file_fd);
+		file_fd = -1;
+	}
+	file_reader = NULL;
+}
+
+void
+free_vrrp_file(void *data)
+{
+	vrrp_file_t *tfile = data;
+
+	FREE(tfile->fname);
+	FREE(tfile->file_path);
+	FREE(tfile);
+}
+
+void
+dump_vrrp_file(void *data)
+{
+	vrrp_file_t *tfile = data;
+
+	log_message(LOG_INFO, " VRRP Track file = %s", tfile->fname);
+	log_message(LOG_INFO, "   File = %s", tfile->file_path);
+	log_message(LOG_INFO, "   Weight = %d", tfile->weight);
+	log_message(LOG_INFO, "   Status = %s value %d",
+		    tfile->exists ? "present" : "missing", tfile->value);
+}
+
+vrrp_file_t *
+find_file_by_name(char *name)
+{
+	element e;
+	vrrp_file_t *tfile;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp_file))
+		return NULL;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_file); e; ELEMENT_NEXT(e)) {
+		tfile = ELEMENT_DATA(e);
+		if (!strcmp(tfile->fname, name))
+			return tfile;
+	}
+	return NULL;
+}
+
+/* Track file dump */
+void
+dump_track_file(void *track_data)
+{
+	tracked_file_t *tfl = track_data;
+	log_message(LOG_INFO, "     %s weight %d", tfl->file->fname, tfl->weight);
+}
+
+void
+alloc_track_file(list track_list, vector_t *strvec, const char *vrrp_iname)
+{
+	vrrp_file_t *vfile = NULL;
+	tracked_file_t *tfl = NULL;
+	int weight = 0;
+	char *tracked = strvec_slot(strvec, 0);
+
+	vfile = find_file_by_name(tracked);
+
+	/* Ignoring if no file found */
+	if (!vfile) {
+		log_message(LOG_INFO, "(%s): track file %s not found, ignoring...", vrrp_iname, tracked);
+		return;
+	}
+
+	/* default weight */
+	weight = vfile->weight;
+
+	if (vector_size(strvec) >= 3 &&
+	    !strcmp(strvec_slot(strvec, 1), "weight")) {
+		weight = atoi(strvec_slot(strvec, 2));
+		if (weight < -254 || weight > 254) {
+			weight = vfile->weight;
+			log_message(LOG_INFO, "(%s): track file %s: weight must be between [-254..254]"
+					 " inclusive, ignoring...",
+			       vrrp_iname, tracked);
+		}
+	}
+
+	tfl	    = (tracked_file_t *) MALLOC(sizeof(tracked_file_t));
+	tfl->file   = vfile;
+	tfl->weight = weight;
+	list_add(track_list, tfl);
+}
+
+/* Test if all tracked files are either up or weight-tracked */
+int
+vrrp_file_up(list l)
+{
+	element e;
+	tracked_file_t *tfl;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tfl = ELEMENT_DATA(e);
+		if (!tfl->weight && !FILE_ISUP(tfl->file))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Returns total weights of all tracked files : the file value is
+ * multiplied by the tracker weight, so a file holding a small status
+ * integer can drive an arbitrary priority adjustment. The product of
+ * each file is clamped to [-254..254]. */
+int
+vrrp_file_weight(list l)
+{
+	element e;
+	tracked_file_t *tfl;
+	int weight = 0;
+	int adjust;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tfl = ELEMENT_DATA(e);
+		if (!tfl->weight)
+			continue;
+		adjust = tfl->file->value * tfl->weight;
+		if (adjust < -254)
+			adjust = -254;
+		else if (adjust > 254)
+			adjust = 254;
+		weight += adjust;
+	}
+
+	return weight;
+}
@@ -0,0 +1,477 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Seamless binary upgrade. The outgoing daemon passes its
+ *              open VRRP sockets and per-instance state to the incoming
+ *              binary over a unix socket with SCM_RIGHTS, then exits
+ *              without sending priority 0 adverts or releasing VIPs.
+ *              The new daemon adopts the sockets - multicast
+ *              memberships and all - and resumes advertising within
+ *              one advert interval, so peers never see a failover.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+/* system include */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+
+/* local include */
+#include "vrrp_handoff.h"
+#include "vrrp_data.h"
+#include "vrrp_scheduler.h"
+#include "vrrp.h"
+#include "global_data.h"
+#include "scheduler.h"
+#include "logger.h"
+#include "memory.h"
+#include "list.h"
+
+/* Wire protocol. One fixed-size message per datagram on a SEQPACKET
+ * socket, so message boundaries are preserved and SCM_RIGHTS fds arrive
+ * attached to the message describing them. The magic guards against a
+ * handoff between binaries whose message layout differs - on mismatch
+ * both sides abort and the upgrade degrades to an ordinary restart. */
+#define HANDOFF_MAGIC		0x4b414831	/* "KAH1" */
+
+#define HANDOFF_MSG_REQUEST	1
+#define HANDOFF_MSG_SOCK	2		/* carries fd_in + fd_out */
+#define HANDOFF_MSG_INSTANCE	3
+#define HANDOFF_MSG_END		4
+
+#define HANDOFF_INAME_SIZE	64
+
+typedef struct _handoff_msg {
+	uint32_t	magic;
+	uint8_t		type;
+
+	/* HANDOFF_MSG_SOCK - identity of the socket the fds belong to */
+	sa_family_t	family;
+	int		proto;
+	ifindex_t	ifindex;
+	bool		unicast;
+	unsigned	shard;
+	unsigned	shards;
+
+	/* HANDOFF_MSG_INSTANCE */
+	char		iname[HANDOFF_INAME_SIZE];
+	uint8_t		state;
+	uint8_t		effective_priority;
+} handoff_msg_t;
+
+/* Receiver side - fds from the old daemon waiting for the new socket
+ * pool to claim them */
+typedef struct _handoff_sock {
+	sa_family_t	family;
+	int		proto;
+	ifindex_t	ifindex;
+	bool		unicast;
+	unsigned	shard;
+	unsigned	shards;
+	int		fd_in;
+	int		fd_out;
+} handoff_sock_t;
+
+static int handoff_sock = -1;
+static list handoff_pool;
+
+bool vrrp_handoff_done;
+
+static vrrp_t *
+handoff_find_instance(const char *iname)
+{
+	element e;
+	vrrp_t *vrrp;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp))
+		return NULL;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+		if (!strcmp(vrrp->iname, iname))
+			return vrrp;
+	}
+
+	return NULL;
+}
+
+static void
+free_handoff_sock(void *data)
+{
+	handoff_sock_t *hs = data;
+
+	if (hs->fd_in != -1)
+		close(hs->fd_in);
+	if (hs->fd_out != -1)
+		close(hs->fd_out);
+	FREE(hs);
+}
+
+/* Send one protocol message, with the pair of socket fds attached as
+ * SCM_RIGHTS ancillary data when fd_in is valid */
+static bool
+handoff_send_msg(int fd, handoff_msg_t *msg, int fd_in, int fd_out)
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	int fds[2];
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(*msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	if (fd_in != -1) {
+		fds[0] = fd_in;
+		fds[1] = fd_out;
+		memset(cbuf, 0, sizeof(cbuf));
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+	}
+
+	return sendmsg(fd, &mh, 0) == (ssize_t)sizeof(*msg);
+}
+
+/* Donor side. A successor has connected - stream it the socket pool
+ * and the instance states, then terminate without releasing VRRP. */
+static int
+vrrp_handoff_accept_thread(thread_t *thread)
+{
+	struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+	handoff_msg_t msg;
+	sock_t *sock;
+	vrrp_t *vrrp;
+	element e;
+	unsigned socks = 0, insts = 0;
+	int fd;
+
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return 0;
+
+	fd = accept(handoff_sock, NULL, NULL);
+	if (fd == -1) {
+		thread_add_read(master, vrrp_handoff_accept_thread, NULL,
+				handoff_sock, TIMER_NEVER);
+		return 0;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (recv(fd, &msg, sizeof(msg), 0) != (ssize_t)sizeof(msg) ||
+	    msg.magic != HANDOFF_MAGIC || msg.type != HANDOFF_MSG_REQUEST) {
+		log_message(LOG_INFO, "VRRP handoff: bad request - protocol mismatch?");
+		goto abort;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = HANDOFF_MAGIC;
+
+	/* The socket pool, with the live fds attached */
+	if (!LIST_ISEMPTY(vrrp_data->vrrp_socket_pool)) {
+		for (e = LIST_HEAD(vrrp_data->vrrp_socket_pool); e; ELEMENT_NEXT(e)) {
+			sock = ELEMENT_DATA(e);
+			if (sock->fd_in == -1 || sock->fd_out == -1)
+				continue;
+			msg.type = HANDOFF_MSG_SOCK;
+			msg.family = sock->family;
+			msg.proto = sock->proto;
+			msg.ifindex = sock->ifindex;
+			msg.unicast = sock->unicast;
+			msg.shard = sock->shard;
+			msg.shards = sock->shards;
+			if (!handoff_send_msg(fd, &msg, sock->fd_in, sock->fd_out))
+				goto failed;
+			socks++;
+		}
+	}
+
+	/* The instance states */
+	if (!LIST_ISEMPTY(vrrp_data->vrrp)) {
+		for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+			vrrp = ELEMENT_DATA(e);
+			if (strlen(vrrp->iname) >= HANDOFF_INAME_SIZE) {
+				log_message(LOG_INFO, "VRRP handoff: instance name %s too long - successor will start it in BACKUP",
+					    vrrp->iname);
+				continue;
+			}
+			memset(&msg, 0, sizeof(msg));
+			msg.magic = HANDOFF_MAGIC;
+			msg.type = HANDOFF_MSG_INSTANCE;
+			strcpy(msg.iname, vrrp->iname);
+			msg.state = (uint8_t)vrrp->state;
+			msg.effective_priority = vrrp->effective_priority;
+			if (!handoff_send_msg(fd, &msg, -1, -1))
+				goto failed;
+			insts++;
+		}
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = HANDOFF_MAGIC;
+	msg.type = HANDOFF_MSG_END;
+	if (!handoff_send_msg(fd, &msg, -1, -1))
+		goto failed;
+
+	close(fd);
+
+	log_message(LOG_INFO, "Handed off %u sockets and %u instance states - exiting without releasing VRRP",
+		    socks, insts);
+	vrrp_handoff_done = true;
+#ifndef _DEBUG_
+	/* Take the whole daemon down - if only this child exited, the
+	 * parent would respawn it and the respawned child would fetch
+	 * the handoff straight back from our successor */
+	kill(getppid(), SIGTERM);
+#endif
+	thread_add_terminate_event(master);
+	return 0;
+
+failed:
+	log_message(LOG_INFO, "VRRP handoff: send failed (%s) - continuing as before",
+		    strerror(errno));
+abort:
+	close(fd);
+	thread_add_read(master, vrrp_handoff_accept_thread, NULL,
+			handoff_sock, TIMER_NEVER);
+	return 0;
+}
+
+void
+vrrp_handoff_socket_init(void)
+{
+	struct sockaddr_un addr;
+
+	if (!global_data->vrrp_handoff_socket || handoff_sock != -1)
+		return;
+
+	if (strlen(global_data->vrrp_handoff_socket) >= sizeof(addr.sun_path)) {
+		log_message(LOG_INFO, "Handoff socket path %s too long - ignoring", global_data->vrrp_handoff_socket);
+		return;
+	}
+
+	if ((handoff_sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		log_message(LOG_INFO, "Unable to create handoff socket (%s)", strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, global_data->vrrp_handoff_socket);
+
+	/* Remove any socket left over from a previous invocation */
+	unlink(addr.sun_path);
+
+	if (bind(handoff_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(handoff_sock, 2) == -1) {
+		log_message(LOG_INFO, "Unable to bind handoff socket %s (%s)", addr.sun_path, strerror(errno));
+		close(handoff_sock);
+		handoff_sock = -1;
+		return;
+	}
+
+	thread_add_read(master, vrrp_handoff_accept_thread, NULL, handoff_sock, TIMER_NEVER);
+}
+
+void
+vrrp_handoff_socket_close(void)
+{
+	if (handoff_sock == -1)
+		return;
+
+	close(handoff_sock);
+	handoff_sock = -1;
+
+	if (global_data->vrrp_handoff_socket)
+		unlink(global_data->vrrp_handoff_socket);
+}
+
+/* Receiver side. At startup, ask a running predecessor for its sockets
+ * and state. Nothing listening means an ordinary cold start. */
+void
+vrrp_handoff_fetch(void)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	handoff_msg_t msg;
+	handoff_sock_t *hs;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	vrrp_t *vrrp;
+	unsigned socks = 0, insts = 0;
+	int fd, fds[2];
+	bool done = false;
+
+	if (!global_data->vrrp_handoff_socket ||
+	    strlen(global_data->vrrp_handoff_socket) >= sizeof(addr.sun_path))
+		return;
+
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1)
+		return;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, global_data->vrrp_handoff_socket);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		/* No predecessor - a normal cold start */
+		close(fd);
+		return;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = HANDOFF_MAGIC;
+	msg.type = HANDOFF_MSG_REQUEST;
+	if (!handoff_send_msg(fd, &msg, -1, -1)) {
+		close(fd);
+		return;
+	}
+
+	while (!done) {
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = &msg;
+		iov.iov_len = sizeof(msg);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+
+		if (recvmsg(fd, &mh, 0) != (ssize_t)sizeof(msg) ||
+		    msg.magic != HANDOFF_MAGIC) {
+			log_message(LOG_INFO, "VRRP handoff: receive failed - starting cold");
+			break;
+		}
+
+		fds[0] = fds[1] = -1;
+		cmsg = CMSG_FIRSTHDR(&mh);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+			memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+
+		switch (msg.type) {
+		case HANDOFF_MSG_SOCK:
+			if (fds[0] == -1)
+				break;
+			if (!handoff_pool)
+				handoff_pool = alloc_list(free_handoff_sock, NULL);
+			hs = (handoff_sock_t *)MALLOC(sizeof(handoff_sock_t));
+			hs->family = msg.family;
+			hs->proto = msg.proto;
+			hs->ifindex = msg.ifindex;
+			hs->unicast = msg.unicast;
+			hs->shard = msg.shard;
+			hs->shards = msg.shards;
+			hs->fd_in = fds[0];
+			hs->fd_out = fds[1];
+			list_add(handoff_pool, hs);
+			socks++;
+			break;
+		case HANDOFF_MSG_INSTANCE:
+			msg.iname[HANDOFF_INAME_SIZE - 1] = '\0';
+			vrrp = handoff_find_instance(msg.iname);
+			if (!vrrp)
+				break;
+			/* Resume where the predecessor left off. A
+			 * MASTER keeps mastership through the usual
+			 * GOTO_MASTER path; anything else waits out a
+			 * full master down interval as BACKUP even if
+			 * the configuration says initial MASTER. */
+			vrrp->wantstate = msg.state == VRRP_STATE_MAST ?
+					  VRRP_STATE_MAST : VRRP_STATE_BACK;
+			vrrp_set_effective_priority(vrrp, msg.effective_priority);
+			insts++;
+			break;
+		case HANDOFF_MSG_END:
+			done = true;
+			break;
+		default:
+			/* Unknown message - close any fds it carried */
+			if (fds[0] != -1)
+				close(fds[0]);
+			if (fds[1] != -1)
+				close(fds[1]);
+			break;
+		}
+	}
+
+	close(fd);
+
+	if (done)
+		log_message(LOG_INFO, "Adopted %u sockets and %u instance states from running daemon",
+			    socks, insts);
+	else
+		vrrp_handoff_release();
+}
+
+/* Claim a handed-off fd pair for a socket pool entry. Mirrors the
+ * reload-time vrrp_sockpool_adopt() match. */
+bool
+vrrp_handoff_adopt(sock_t *sock)
+{
+	handoff_sock_t *hs;
+	element e;
+
+	if (LIST_ISEMPTY(handoff_pool))
+		return false;
+
+	for (e = LIST_HEAD(handoff_pool); e; ELEMENT_NEXT(e)) {
+		hs = ELEMENT_DATA(e);
+		if (hs->family == sock->family	&&
+		    hs->proto == sock->proto	&&
+		    hs->ifindex == sock->ifindex &&
+		    hs->unicast == sock->unicast &&
+		    hs->shard == sock->shard	&&
+		    hs->shards == sock->shards	&&
+		    hs->fd_in != -1) {
+			sock->fd_in = hs->fd_in;
+			sock->fd_out = hs->fd_out;
+			hs->fd_in = -1;
+			hs->fd_out = -1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Close whatever the new socket pool did not claim */
+void
+vrrp_handoff_release(void)
+{
+	free_list(&handoff_pool);
+}
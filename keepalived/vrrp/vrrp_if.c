@@ -49,12 +49,17 @@
 #include "vrrp.h"
 #include "vrrp_if.h"
 #include "keepalived_netlink.h"
+#include "hashtab.h"
 #include "memory.h"
 #include "utils.h"
 #include "logger.h"
 
 /* Local vars */
 static list if_queue;
+static hashtab_t if_index_tab;	/* ifindex -> interface_t lookup */
+#ifdef _HAVE_VRRP_VMAC_
+static list vmac_if_queue;	/* VMAC interfaces only, for flag reflection */
+#endif
 static struct ifreq ifr;
 
 static list old_if_queue;
@@ -68,18 +73,7 @@ list garp_delay;
 interface_t *
 if_get_by_ifindex(ifindex_t ifindex)
 {
-	interface_t *ifp;
-	element e;
-
-	if (LIST_ISEMPTY(if_queue))
-		return NULL;
-
-	for (e = LIST_HEAD(if_queue); e; ELEMENT_NEXT(e)) {
-		ifp = ELEMENT_DATA(e);
-		if (ifp->ifindex == ifindex)
-			return ifp;
-	}
-	return NULL;
+	return (interface_t *) htab_find(&if_index_tab, ifindex);
 }
 
 /* Return base interface from interface index incase of VMAC */
@@ -138,9 +132,29 @@ reset_interface_queue(void)
 
 	if_queue = NULL;
 	garp_delay = NULL;
+	htab_destroy(&if_index_tab);
+#ifdef _HAVE_VRRP_VMAC_
+	free_list(&vmac_if_queue);
+#endif
 }
 
 #ifdef _HAVE_VRRP_VMAC_
+/* Register a VMAC interface for base interface flag reflection */
+void
+if_vmac_add(interface_t * ifp)
+{
+	element e;
+
+	if (!LIST_ISEMPTY(vmac_if_queue)) {
+		for (e = LIST_HEAD(vmac_if_queue); e; ELEMENT_NEXT(e)) {
+			if (ELEMENT_DATA(e) == ifp)
+				return;
+		}
+	}
+
+	list_add(vmac_if_queue, ifp);
+}
+
 /*
  * Reflect base interface flags on VMAC interfaces.
  * VMAC interfaces should never update it own flags, only be reflected
@@ -152,13 +166,15 @@ if_vmac_reflect_flags(ifindex_t ifindex, unsigned long flags)
 	interface_t *ifp;
 	element e;
 
-	if (LIST_ISEMPTY(if_queue) || !ifindex)
+	if (LIST_ISEMPTY(vmac_if_queue) || !ifindex)
 		return;
 
-	for (e = LIST_HEAD(if_queue); e; ELEMENT_NEXT(e)) {
+	for (e = LIST_HEAD(vmac_if_queue); e; ELEMENT_NEXT(e)) {
 		ifp = ELEMENT_DATA(e);
-		if (ifp->vmac && ifp->base_ifindex == ifindex)
+		if (ifp->vmac && ifp->base_ifindex == ifindex) {
 			ifp->flags = flags;
+			vrrp_track_interface_update(ifp);
+		}
 	}
 }
 #endif
@@ -324,7 +340,10 @@ if_ioctl_flags(interface_t * ifp)
 static void
 free_if(void *data)
 {
-	FREE(data);
+	interface_t *ifp = data;
+
+	free_list(&ifp->tracking_vrrp);
+	FREE(ifp);
 }
 
 /* garp_delay facility function */
@@ -425,7 +444,9 @@ dump_if(void *data)
 
 	if (global_data->linkbeat_use_polling) {
 		/* MII channel supported ? */
-		if (IF_MII_SUPPORTED(ifp))
+		if (IF_NETLINK_SUPPORTED(ifp))
+			log_message(LOG_INFO, " NIC netlink carrier reflection");
+		else if (IF_MII_SUPPORTED(ifp))
 			log_message(LOG_INFO, " NIC support MII regs");
 		else if (IF_ETHTOOL_SUPPORTED(ifp))
 			log_message(LOG_INFO, " NIC support ETHTOOL GLINK interface");
@@ -452,12 +473,67 @@ static void
 init_if_queue(void)
 {
 	if_queue = alloc_list(free_if, dump_if);
+#ifdef _HAVE_VRRP_VMAC_
+	/* the interfaces are owned by if_queue */
+	vmac_if_queue = alloc_list(NULL, NULL);
+#endif
 }
 
 void
 if_add_queue(interface_t * ifp)
 {
 	list_add(if_queue, ifp);
+	htab_insert(&if_index_tab, ifp->ifindex, ifp);
+}
+
+/* One-time /sys/class/net probes, used at linkbeat initialisation to
+ * decide whether a NIC's carrier state can be taken from the netlink
+ * reflection channel instead of being polled. */
+static int
+if_sysfs_read(const char *ifname, const char *node, char *buf, size_t len)
+{
+	char path[IF_NAMESIZ + 32];
+	int fd;
+	ssize_t n;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/%s", ifname, node);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+
+	buf[n] = '\0';
+	return 0;
+}
+
+/* Drivers that don't report carrier changes leave operstate "unknown",
+ * in which case RTM_NEWLINK cannot be trusted for linkbeat and we must
+ * keep polling the NIC. */
+static bool
+if_operstate_usable(const char *ifname)
+{
+	char buf[16];
+
+	if (if_sysfs_read(ifname, "operstate", buf, sizeof(buf)) < 0)
+		return false;
+
+	return strncmp(buf, "unknown", 7) != 0;
+}
+
+static int
+if_sys_carrier(const char *ifname)
+{
+	char buf[4];
+
+	/* carrier is unreadable (EINVAL) while the interface is down */
+	if (if_sysfs_read(ifname, "carrier", buf, sizeof(buf)) < 0)
+		return -1;
+
+	return buf[0] == '1';
 }
 
 static int
@@ -478,6 +554,9 @@ if_linkbeat_refresh_thread(thread_t * thread)
 	 */
 	if_ioctl_flags(ifp);
 
+	/* Propagate any state change to the instances tracking us */
+	vrrp_track_interface_update(ifp);
+
 	/* Register next polling thread */
 	thread_add_timer(master, if_linkbeat_refresh_thread, ifp, POLLING_DELAY);
 	return 0;
@@ -492,6 +571,18 @@ init_if_linkbeat(void)
 
 	for (e = LIST_HEAD(if_queue); e; ELEMENT_NEXT(e)) {
 		ifp = ELEMENT_DATA(e);
+
+		/* If the NIC reports a usable operstate, RTM_NEWLINK already
+		 * tells us the carrier state, so there is nothing to poll;
+		 * seed linkbeat once from sysfs and track it from the
+		 * netlink reflection channel from then on. */
+		if (if_operstate_usable(ifp->ifname)) {
+			ifp->lb_type = LB_NETLINK;
+			status = if_sys_carrier(ifp->ifname);
+			ifp->linkbeat = (status >= 0) ? !!status : !!(ifp->flags & IFF_RUNNING);
+			continue;
+		}
+
 		ifp->lb_type = LB_IOCTL;
 		status = if_mii_probe(ifp->ifname);
 		if (status >= 0) {
@@ -515,18 +606,34 @@ if_linkbeat(const interface_t * ifp)
 	if (!global_data->linkbeat_use_polling)
 		return 1;
 
-	if (IF_MII_SUPPORTED(ifp) || IF_ETHTOOL_SUPPORTED(ifp))
+	if (IF_MII_SUPPORTED(ifp) || IF_ETHTOOL_SUPPORTED(ifp) || IF_NETLINK_SUPPORTED(ifp))
 		return IF_LINKBEAT(ifp);
 
 	return 1;
 }
 
+/* Update linkbeat from a reflected RTM_NEWLINK. Only interfaces whose
+ * carrier state is tracked via netlink are updated here; the polled
+ * ones are refreshed by their if_linkbeat_refresh_thread(). */
+void
+if_linkbeat_reflect(interface_t *ifp, unsigned long flags)
+{
+	if (!global_data->linkbeat_use_polling || !IF_NETLINK_SUPPORTED(ifp))
+		return;
+
+	ifp->linkbeat = !!(flags & IFF_RUNNING);
+}
+
 /* Interface queue helpers*/
 void
 free_interface_queue(void)
 {
+#ifdef _HAVE_VRRP_VMAC_
+	free_list(&vmac_if_queue);
+#endif
 	free_list(&if_queue);
 	free_list(&garp_delay);
+	htab_destroy(&if_index_tab);
 }
 
 void
@@ -540,7 +647,7 @@ void
 init_interface_queue(void)
 {
 	init_if_queue();
-	netlink_interface_lookup(NULL);
+	netlink_interface_address_lookup();
 //	dump_list(if_queue);
 }
 
@@ -548,7 +655,7 @@ void
 init_interface_linkbeat(void)
 {
 	if (global_data->linkbeat_use_polling) {
-		log_message(LOG_INFO, "Using MII-BMSR/ETHTOOL NIC polling thread...");
+		log_message(LOG_INFO, "Using MII-BMSR/ETHTOOL NIC polling, netlink carrier reflection where supported...");
 		init_if_linkbeat();
 	} else {
 		log_message(LOG_INFO, "Using LinkWatch kernel netlink reflector...");
@@ -702,6 +809,10 @@ if_setsockopt_ipv6_checksum(int *sd)
 }
 
 
+#ifndef IPV6_MULTICAST_ALL	/* Since Linux 4.20 */
+#define IPV6_MULTICAST_ALL 29
+#endif
+
 int
 #ifndef IP_MULTICAST_ALL	/* Since Linux 2.6.31 */
 if_setsockopt_mcast_all(__attribute__((unused)) sa_family_t family, __attribute__((unused)) int *sd)
@@ -714,12 +825,21 @@ if_setsockopt_mcast_all(sa_family_t family, int *sd)
 {
 	int ret;
 	unsigned char no = 0;
+	int no6 = 0;
 
 	if (*sd < 0)
 		return -1;
 
-	if (family == AF_INET6)
+	if (family == AF_INET6) {
+		/* IPV6_MULTICAST_ALL needs Linux 4.20. Without it every v6
+		 * socket still sees every group's adverts and relies on the
+		 * demux to drop them, so failure here is not fatal. */
+		ret = setsockopt(*sd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &no6, sizeof(no6));
+		if (ret < 0 && errno != ENOPROTOOPT)
+			log_message(LOG_INFO, "cant set IPV6_MULTICAST_ALL IP option. errno=%d (%m)",
+				    errno);
 		return *sd;
+	}
 
 	/* Don't accept multicast packets we haven't requested */
 	ret = setsockopt(*sd, IPPROTO_IP, IP_MULTICAST_ALL, &no, sizeof(no));
@@ -845,6 +965,28 @@ if_setsockopt_priority(int *sd, int family)
 	return *sd;
 }
 
+#ifdef _VRRP_LATENCY_STATS_
+int
+if_setsockopt_timestampns(int *sd)
+{
+	int ret;
+	int val = 1;
+
+	if (*sd < 0)
+		return -1;
+
+	/* Ask for kernel receive timestamps for the advert latency
+	 * statistics. Not having them is no reason to fail the socket -
+	 * the statistics fall back on the scheduler clock. */
+	ret = setsockopt(*sd, SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val));
+
+	if (ret < 0)
+		log_message(LOG_INFO, "cant set SO_TIMESTAMPNS option. errno=%d (%m)", errno);
+
+	return *sd;
+}
+#endif
+
 int
 if_setsockopt_rcvbuf(int *sd, int val)
 {
@@ -72,6 +72,7 @@
 
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "logger.h"
 
@@ -338,32 +339,44 @@ reset_interface_parameters_devconf(interface_t *base_ifp)
 #endif
 #endif
 
-/* Sysctl get and set functions */
+/* Sysctl get and set functions. We keep an open fd on /proc/sys and
+ * use openat() with paths relative to it, to avoid the kernel walking
+ * the leading path components again for every parameter accessed. */
+static int proc_sys_fd = -1;
+
 static void
 make_sysctl_filename(char *dest, const char* prefix, const char* iface, const char* parameter)
 {
-	strcpy(dest, "/proc/sys/");
-	strcat(dest, prefix);
+	strcpy(dest, prefix);
 	strcat(dest, "/");
 	strcat(dest, iface);
 	strcat(dest, "/");
 	strcat(dest, parameter);
 }
 
+static int
+open_sysctl(const char* prefix, const char* iface, const char* parameter, int flags)
+{
+	char filename[PATH_MAX];
+
+	if (proc_sys_fd == -1 &&
+	    (proc_sys_fd = open("/proc/sys", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return -1;
+
+	/* Make the filename, relative to /proc/sys */
+	make_sysctl_filename(filename, prefix, iface, parameter);
+
+	return openat(proc_sys_fd, filename, flags);
+}
+
 static int
 set_sysctl(const char* prefix, const char* iface, const char* parameter, int value)
 {
-	char* filename;
 	char buf[1];
 	int fd;
 	ssize_t len;
 
-	/* Make the filename */
-	filename = MALLOC(PATH_MAX);
-	make_sysctl_filename(filename, prefix, iface, parameter);
-
-	fd = open(filename, O_WRONLY);
-	FREE(filename);
+	fd = open_sysctl(prefix, iface, parameter, O_WRONLY);
 	if (fd < 0)
 		return -1;
 
@@ -382,17 +395,11 @@ set_sysctl(const char* prefix, const char* iface, const char* parameter, int val
 static int
 get_sysctl(const char* prefix, const char* iface, const char* parameter)
 {
-	char *filename;
 	char buf[1];
 	int fd;
 	ssize_t len;
 
-	/* Make the filename */
-	filename = MALLOC(PATH_MAX);
-	make_sysctl_filename(filename, prefix, iface, parameter);
-
-	fd = open(filename, O_RDONLY);
-	FREE(filename);
+	fd = open_sysctl(prefix, iface, parameter, O_RDONLY);
 	if (fd < 0)
 		return -1;
 
@@ -26,50 +26,28 @@
 #include "vrrp_index.h"
 #include "vrrp_data.h"
 #include "vrrp.h"
-#include "memory.h"
-#include "list.h"
-
-/* VRID hash table */
-int
-get_vrrp_hash(const int vrid, const int fd)
-{
-	return ( vrid * 31 + ( fd/2 ) * 37 )%1151;
-}
+#include "hlist.h"
 
+/* VRID index. Keyed directly on the vrid, so a bucket only ever holds
+ * instances sharing the same vrid (different interfaces or families)
+ * and linking an instance costs no allocation. */
 void
 alloc_vrrp_bucket(vrrp_t *vrrp)
 {
-	list_add(&vrrp_data->vrrp_index[get_vrrp_hash(vrrp->vrid, vrrp->fd_in)], vrrp);
+	hlist_add_head(&vrrp->index_node, &vrrp_data->vrrp_index[vrrp->vrid]);
 }
 
 vrrp_t *
 vrrp_index_lookup(const int vrid, const int fd)
 {
 	vrrp_t *vrrp;
-	element e;
-	list l = &vrrp_data->vrrp_index[get_vrrp_hash(vrid, fd)];
-
-	/* return if list is empty */
-	if (LIST_ISEMPTY(l))
-		return NULL;
+	hlist_node_t *n;
 
-	/*
-	 * If list size's is 1 then no collisions. So
-	 * Test and return the singleton.
-	 */
-	if (LIST_SIZE(l) == 1) {
-		vrrp = ELEMENT_DATA(LIST_HEAD(l));
-		return ((vrrp->fd_in == fd) && (vrrp->vrid == vrid)) ? vrrp : NULL;
-	}
-
-	/*
-	 * List collision on the vrid bucket. The same
-	 * vrid is used on a different interface. We perform
-	 * a fd lookup as collisions solver.
-	 */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		vrrp =  ELEMENT_DATA(e);
-		if ((vrrp->fd_in == fd) && (vrrp->vrid == vrid))
+	/* A bucket only collides when the same vrid is used on
+	 * different interfaces. We perform a fd lookup as
+	 * collisions solver. */
+	hlist_for_each_entry(vrrp, n, &vrrp_data->vrrp_index[vrid], index_node) {
+		if (vrrp->fd_in == fd)
 			return vrrp;
 	}
 
@@ -77,48 +55,33 @@ vrrp_index_lookup(const int vrid, const int fd)
 	return NULL;
 }
 
-/* FD hash table */
+/* FD index */
 void
 alloc_vrrp_fd_bucket(vrrp_t *vrrp)
 {
 	/* We use a mod key plus 1 */
-	list_add(&vrrp_data->vrrp_index_fd[vrrp->fd_in%1024 + 1], vrrp);
+	hlist_add_head(&vrrp->index_fd_node, &vrrp_data->vrrp_index_fd[vrrp->fd_in%1024 + 1]);
 }
 
 void
 remove_vrrp_fd_bucket(vrrp_t *vrrp)
 {
-	list l = &vrrp_data->vrrp_index_fd[vrrp->fd_in%1024 + 1];
-	list_del(l, vrrp);
+	hlist_del(&vrrp->index_fd_node);
 }
 
 void set_vrrp_fd_bucket(int old_fd, vrrp_t *vrrp)
 {
 	vrrp_t *vrrp_ptr;
 	element e;
-	element next;
-	list l = &vrrp_data->vrrp_index_fd[old_fd%1024 + 1];
+	hlist_node_t *pos, *next;
+	list l;
 
 	/* Release old stalled entries */
-	for (e = LIST_HEAD(l); e; e = next) {
-		next = e->next;
-		vrrp_ptr =  ELEMENT_DATA(e);
-		if (vrrp_ptr->fd_in == old_fd) {
-			if (e->prev)
-				e->prev->next = e->next;
-			else
-				 l->head = e->next;
-
-			if (e->next)
-				e->next->prev = e->prev;
-			else
-				l->tail = e->prev;
-			l->count--;
-			FREE(e);
-		}
+	hlist_for_each_safe(pos, next, &vrrp_data->vrrp_index_fd[old_fd%1024 + 1]) {
+		vrrp_ptr = hlist_entry(pos, vrrp_t, index_fd_node);
+		if (vrrp_ptr->fd_in == old_fd)
+			hlist_del(&vrrp_ptr->index_fd_node);
 	}
-	if (LIST_ISEMPTY(l))
-		l->head = l->tail = NULL;
 
 	/* Hash refreshed entries */
 	l = vrrp_data->vrrp;
@@ -22,6 +22,12 @@
 
 #include "config.h"
 
+/* system include */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 /* local include */
 #include "vrrp_ipaddress.h"
 #ifdef _HAVE_LIBIPTC_
@@ -50,6 +56,16 @@ static bool iptables_cmd_available;
 static bool ip6tables_cmd_available;
 #endif
 
+/* The nftables backend holds the VIPs in two sets in a dedicated table,
+ * so a transition only adds or deletes set elements. All the updates for
+ * one transition are written to a single batch file and handed to one
+ * 'nft -f' invocation, which applies them as one transaction without
+ * having to snapshot or replay any existing ruleset. */
+static bool nft_setup_done;
+static char *nft_batch;
+static size_t nft_batch_len;
+static size_t nft_batch_size;
+
 char *
 ipaddresstos(char *buf, ip_address_t *ipaddress)
 {
@@ -67,29 +83,23 @@ ipaddresstos(char *buf, ip_address_t *ipaddress)
 	return buf;
 }
 
-/* Add/Delete IP address to a specific interface_t */
-int
-netlink_ipaddress(ip_address_t *ipaddress, int cmd)
+/* Build an RTM_NEWADDR/RTM_DELADDR request for an address */
+void
+netlink_ipaddress_build(ip_address_t *ipaddress, int cmd, ipaddress_req_t *req)
 {
 	struct ifa_cacheinfo cinfo;
-	int status = 1;
-	struct {
-		struct nlmsghdr n;
-		struct ifaddrmsg ifa;
-		char buf[256];
-	} req;
 #if HAVE_DECL_IFA_FLAGS
 	uint32_t ifa_flags;
 #else
 	uint8_t ifa_flags;
 #endif
 
-	memset(&req, 0, sizeof (req));
+	memset(req, 0, sizeof (*req));
 
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof (struct ifaddrmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
-	req.n.nlmsg_type = (cmd == IPADDRESS_DEL) ? RTM_DELADDR : RTM_NEWADDR;
-	req.ifa = ipaddress->ifa;
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof (struct ifaddrmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_type = (cmd == IPADDRESS_DEL) ? RTM_DELADDR : RTM_NEWADDR;
+	req->ifa = ipaddress->ifa;
 
 	if (cmd == IPADDRESS_ADD)
 		ifa_flags = ipaddress->flags;
@@ -104,7 +114,7 @@ netlink_ipaddress(ip_address_t *ipaddress, int cmd)
 				cinfo.ifa_prefered = 0;
 				cinfo.ifa_valid = INFINITY_LIFE_TIME;
 
-				addattr_l(&req.n, sizeof(req), IFA_CACHEINFO, &cinfo,
+				addattr_l(&req->n, sizeof(*req), IFA_CACHEINFO, &cinfo,
 					  sizeof(cinfo));
 			}
 
@@ -125,22 +135,22 @@ netlink_ipaddress(ip_address_t *ipaddress, int cmd)
 #endif
 		}
 
-		addattr_l(&req.n, sizeof(req), IFA_LOCAL,
+		addattr_l(&req->n, sizeof(*req), IFA_LOCAL,
 			  &ipaddress->u.sin6_addr, sizeof(ipaddress->u.sin6_addr));
 
 
 	} else {
-		addattr_l(&req.n, sizeof(req), IFA_LOCAL,
+		addattr_l(&req->n, sizeof(*req), IFA_LOCAL,
 			  &ipaddress->u.sin.sin_addr, sizeof(ipaddress->u.sin.sin_addr));
 
 		if (cmd == IPADDRESS_ADD) {
 			if (ipaddress->u.sin.sin_brd.s_addr)
-				addattr_l(&req.n, sizeof(req), IFA_BROADCAST,
+				addattr_l(&req->n, sizeof(*req), IFA_BROADCAST,
 					  &ipaddress->u.sin.sin_brd, sizeof(ipaddress->u.sin.sin_brd));
 		}
 		else {
 			/* IPADDRESS_DEL */
-			addattr_l(&req.n, sizeof(req), IFA_ADDRESS,
+			addattr_l(&req->n, sizeof(*req), IFA_ADDRESS,
 				  &ipaddress->u.sin.sin_addr, sizeof(ipaddress->u.sin.sin_addr));
 		}
 	}
@@ -148,14 +158,24 @@ netlink_ipaddress(ip_address_t *ipaddress, int cmd)
 	if (cmd == IPADDRESS_ADD) {
 #if HAVE_DECL_IFA_FLAGS
 		if (ifa_flags)
-			addattr32(&req.n, sizeof(req), IFA_FLAGS, ifa_flags);
+			addattr32(&req->n, sizeof(*req), IFA_FLAGS, ifa_flags);
 #else
-		req.ifa.ifa_flags = ifa_flags;
+		req->ifa.ifa_flags = ifa_flags;
 #endif
 		if (ipaddress->label)
-			addattr_l(&req.n, sizeof (req), IFA_LABEL,
+			addattr_l(&req->n, sizeof (*req), IFA_LABEL,
 				  ipaddress->label, strlen(ipaddress->label) + 1);
 	}
+}
+
+/* Add/Delete IP address to a specific interface_t */
+int
+netlink_ipaddress(ip_address_t *ipaddress, int cmd)
+{
+	int status = 1;
+	ipaddress_req_t req;
+
+	netlink_ipaddress_build(ipaddress, cmd, &req);
 
 	if (netlink_talk(&nl_cmd, &req.n) < 0)
 		status = -1;
@@ -163,18 +183,39 @@ netlink_ipaddress(ip_address_t *ipaddress, int cmd)
 	return status;
 }
 
+/* Batch completion handler, updating bookkeeping for one address */
+static int iplist_cmd;
+static bool iplist_changed;
+
+static void
+iplist_ack_handler(void *cookie, int error)
+{
+	ip_address_t *ipaddr = cookie;
+
+	if (!error) {
+		ipaddr->set = !(iplist_cmd == IPADDRESS_DEL);
+		iplist_changed = true;
+	}
+	else
+		ipaddr->set = false;
+}
+
 /* Add/Delete a list of IP addresses */
 bool
 netlink_iplist(list ip_list, int cmd, bool force)
 {
 	ip_address_t *ipaddr;
 	element e;
-	bool changed_entries = false;
+	ipaddress_req_t req;
 
 	/* No addresses in this list */
 	if (LIST_ISEMPTY(ip_list))
 		return false;
 
+	iplist_cmd = cmd;
+	iplist_changed = false;
+	netlink_batch_begin(iplist_ack_handler);
+
 	/*
 	 * If "--dont-release-vrrp" is set then try to release addresses
 	 * that may be there, even if we didn't set them.
@@ -189,16 +230,14 @@ netlink_iplist(list ip_list, int cmd, bool force)
 			if (force)
 				netlink_error_ignore = ENODEV;
 
-			if (netlink_ipaddress(ipaddr, cmd) > 0) {
-				ipaddr->set = !(cmd == IPADDRESS_DEL);
-				changed_entries = true;
-			}
-			else
-				ipaddr->set = false;
+			netlink_ipaddress_build(ipaddr, cmd, &req);
+			netlink_talk_queue(&nl_cmd, &req.n, ipaddr);
 		}
 	}
 
-	return changed_entries;
+	netlink_batch_end(&nl_cmd);
+
+	return iplist_changed;
 }
 
 #if !defined _HAVE_LIBIPTC_ || defined _LIBIPTC_DYNAMIC_
@@ -331,6 +370,146 @@ handle_iptable_rule_to_vip_cmd(ip_address_t *ipaddress, int cmd, bool force)
 }
 #endif
 
+/* Append one nft command to the pending batch */
+static void
+nft_batch_cmd(const char *format, ...)
+{
+	va_list args;
+	int len;
+
+	if (!nft_batch) {
+		nft_batch_size = 1024;
+		nft_batch = MALLOC(nft_batch_size);
+	}
+
+	while (true) {
+		va_start(args, format);
+		len = vsnprintf(nft_batch + nft_batch_len, nft_batch_size - nft_batch_len, format, args);
+		va_end(args);
+
+		if (len >= 0 && (size_t)len < nft_batch_size - nft_batch_len)
+			break;
+
+		nft_batch_size *= 2;
+		nft_batch = REALLOC(nft_batch, nft_batch_size);
+	}
+
+	nft_batch_len += (size_t)len;
+}
+
+/* Apply the pending batch as a single transaction */
+static bool
+nft_batch_commit(void)
+{
+	char file_name[] = "/tmp/keepalived_nft.XXXXXX";
+	char *argv[4];
+	ssize_t written;
+	int fd;
+	bool res = true;
+
+	if (!nft_batch_len)
+		return true;
+
+	if ((fd = mkstemp(file_name)) < 0) {
+		log_message(LOG_INFO, "Unable to create nft batch file (%s)", strerror(errno));
+		nft_batch_len = 0;
+		return false;
+	}
+
+	written = write(fd, nft_batch, nft_batch_len);
+	close(fd);
+
+	if (written != (ssize_t)nft_batch_len) {
+		log_message(LOG_INFO, "Unable to write nft batch file %s", file_name);
+		res = false;
+	} else {
+		argv[0] = "nft";
+		argv[1] = "-f";
+		argv[2] = file_name;
+		argv[3] = NULL;
+
+		if (fork_exec(argv) < 0) {
+			log_message(LOG_INFO, "nft batch failed - VIP filter rules may be incomplete");
+			res = false;
+		}
+	}
+
+	unlink(file_name);
+	nft_batch_len = 0;
+
+	return res;
+}
+
+/* Create the nftables table holding the VIP sets and the rules using them.
+ * The add/delete/add sequence leaves a freshly flushed table whether or
+ * not one was left behind by a previous invocation. */
+static void
+nft_setup(void)
+{
+	const char *table = global_data->vrrp_nftables_table;
+
+	nft_batch_cmd("add table inet %s\n", table);
+	nft_batch_cmd("delete table inet %s\n", table);
+	nft_batch_cmd("add table inet %s\n", table);
+	nft_batch_cmd("add set inet %s vips { type ipv4_addr; }\n", table);
+	nft_batch_cmd("add set inet %s vips6 { type ipv6_addr; }\n", table);
+	nft_batch_cmd("add chain inet %s in { type filter hook input priority -20; }\n", table);
+	nft_batch_cmd("add chain inet %s out { type filter hook output priority -20; }\n", table);
+	if (block_ipv6) {
+		/* Neighbour discovery must keep working for the VIPs */
+		nft_batch_cmd("add rule inet %s in icmpv6 type { nd-neighbor-solicit, nd-neighbor-advert } accept\n", table);
+		nft_batch_cmd("add rule inet %s out icmpv6 type { nd-neighbor-solicit, nd-neighbor-advert } accept\n", table);
+	}
+	if (block_ipv4) {
+		nft_batch_cmd("add rule inet %s in ip daddr @vips drop\n", table);
+		nft_batch_cmd("add rule inet %s out ip saddr @vips drop\n", table);
+	}
+	if (block_ipv6) {
+		nft_batch_cmd("add rule inet %s in ip6 daddr @vips6 drop\n", table);
+		nft_batch_cmd("add rule inet %s out ip6 saddr @vips6 drop\n", table);
+	}
+
+	if (!nft_batch_commit())
+		log_message(LOG_INFO, "Unable to set up nftables table %s - falling back to iptables", table);
+	else
+		nft_setup_done = true;
+}
+
+/* Remove the nftables table on shutdown */
+void
+nftables_fini(void)
+{
+	if (!nft_setup_done)
+		return;
+
+	nft_batch_cmd("delete table inet %s\n", global_data->vrrp_nftables_table);
+	nft_batch_commit();
+	nft_setup_done = false;
+
+	FREE_PTR(nft_batch);
+	nft_batch = NULL;
+	nft_batch_size = 0;
+}
+
+/* Queue a VIP set element update. The table is private to us and flushed
+ * at startup, so iptable_rule_set tracks set membership exactly; skipping
+ * already applied updates keeps deletes of absent elements - which would
+ * abort the whole transaction - out of the batch. */
+static void
+handle_nftable_rule_to_vip(ip_address_t *ipaddress, int cmd)
+{
+	if ((cmd == IPADDRESS_DEL) != ipaddress->iptable_rule_set)
+		return;
+
+	nft_batch_cmd("%s element inet %s %s { %s }\n",
+		      (cmd == IPADDRESS_DEL) ? "delete" : "add",
+		      global_data->vrrp_nftables_table,
+		      IP_IS6(ipaddress) ? "vips6" : "vips",
+		      ipaddresstos(NULL, ipaddress));
+
+	ipaddress->iptable_rule_set = (cmd != IPADDRESS_DEL);
+}
+
 static inline void
 handle_iptable_rule_to_vip(ip_address_t *ipaddr, int cmd,
 #ifdef _HAVE_LIBIPTC_
@@ -348,6 +527,11 @@ handle_iptable_rule_to_vip(ip_address_t *ipaddr, int cmd,
 			return;
 	}
 
+	if (nft_setup_done) {
+		handle_nftable_rule_to_vip(ipaddr, cmd);
+		return;
+	}
+
 #ifdef _HAVE_LIBIPTC_
 #ifdef _LIBIPTC_DYNAMIC_
 	if ((IP_IS6(ipaddr) && using_libip6tc) ||
@@ -380,6 +564,9 @@ handle_iptable_rule_to_iplist(struct ipt_handle *h, list ip_list, int cmd, bool
 		    force)
 			handle_iptable_rule_to_vip(ipaddr, cmd, h, force);
 	}
+
+	if (nft_setup_done)
+		nft_batch_commit();
 }
 
 /* IP address dump/allocation */
@@ -389,6 +576,7 @@ free_ipaddress(void *if_data)
 	ip_address_t *ipaddr = if_data;
 
 	FREE_PTR(ipaddr->label);
+	FREE_PTR(ipaddr->garp_frame);
 	FREE(ipaddr);
 }
 
@@ -582,6 +770,17 @@ alloc_ipaddress(list ip_list, vector_t *strvec, interface_t *ifp)
 		} else if (!strcmp(str, "-nodad")) {
 			new->flagmask |= IFA_F_NODAD;
 #endif
+#if defined IFA_F_OPTIMISTIC && defined IFA_F_NODAD	/* Linux 2.6.23 */
+		} else if (!strcmp(str, "optimistic")) {
+			/* Use optimistic DAD rather than suppressing DAD
+			 * entirely: the address is usable at once, but a
+			 * genuine duplicate is still detected. Marking
+			 * IFA_F_NODAD in the flagmask stops the default
+			 * nodad being added as well, since the two are
+			 * mutually exclusive. */
+			new->flags |= IFA_F_OPTIMISTIC;
+			new->flagmask |= IFA_F_OPTIMISTIC | IFA_F_NODAD;
+#endif
 #ifdef IFA_F_MANAGETEMPADDR		/* Linux 3.14 */
 		} else if (!strcmp(str, "mngtmpaddr")) {
 			new->flags |= IFA_F_MANAGETEMPADDR;
@@ -698,6 +897,9 @@ clear_diff_address(struct ipt_handle *h, list l, list n)
 				handle_iptable_rule_to_vip(ipaddr, IPADDRESS_DEL, h, false);
 		}
 	}
+
+	if (nft_setup_done)
+		nft_batch_commit();
 }
 
 /* Clear static ip address */
@@ -771,7 +973,7 @@ check_chains_exist(void)
 #endif
 }
 
-void
+static void
 iptables_init(void)
 {
 	if (!block_ipv4 && !block_ipv6) {
@@ -781,6 +983,22 @@ iptables_init(void)
 		return;
 	}
 
+	/* Prefer nftables if configured and the nft command is usable -
+	 * VIP updates then only touch set elements, without the full table
+	 * snapshot and replay a libiptc commit needs */
+	if (global_data->vrrp_nftables) {
+		char *nft_argv[] = { "nft", "-v", NULL };
+
+		if (fork_exec(nft_argv) >= 0) {
+			/* The table survives a reload, so only set it up once */
+			if (!nft_setup_done)
+				nft_setup();
+			if (nft_setup_done)
+				return;
+		} else
+			log_message(LOG_INFO, "nft command not available - falling back to iptables");
+	}
+
 #ifdef _HAVE_LIBIPTC_
 	iptables_init_lib();
 #endif
@@ -826,3 +1044,71 @@ iptables_init(void)
 		global_data->using_ipsets = false;
 #endif
 }
+
+/* Firewall initialisation is kept off the startup critical path. Even
+ * when an instance uses no_accept filtering, the first drop rule is
+ * only needed once that instance starts owning addresses, and the
+ * libiptc/ipset setup snapshots the whole filter table. The pending
+ * setup is recorded here and performed by iptables_init_now() from the
+ * first transaction that needs it, so a node that stays BACKUP never
+ * pays for it. */
+static bool iptables_ready;		/* subsystem initialised */
+static bool iptables_setup_pending;	/* setup recorded, awaiting first use */
+static bool iptables_setup_reload;	/* reload flag saved for the deferred setup */
+
+void
+iptables_init_deferred(bool reload)
+{
+	if (!block_ipv4 && !block_ipv6) {
+#ifdef _HAVE_LIBIPSET_
+		global_data->using_ipsets = false;
+#endif
+		iptables_setup_pending = false;
+		return;
+	}
+
+	/* Once the subsystem is live the previous configuration's rules
+	 * and sets exist, so a reload must reconcile them immediately */
+	if (iptables_ready) {
+		iptables_init();
+#ifdef _HAVE_LIBIPTC_
+		iptables_startup(reload);
+#endif
+		return;
+	}
+
+	iptables_setup_pending = true;
+	iptables_setup_reload = reload;
+}
+
+void
+iptables_init_now(void)
+{
+	if (!iptables_setup_pending)
+		return;
+
+	iptables_setup_pending = false;
+	iptables_ready = true;
+
+	iptables_init();
+
+#ifdef _HAVE_LIBIPTC_
+	/* Make sure we don't have any old iptables/ipsets settings left around */
+	if (!iptables_setup_reload)
+		iptables_cleanup();
+
+	iptables_startup(iptables_setup_reload);
+#endif
+}
+
+void
+iptables_shutdown(void)
+{
+	/* Nothing was ever set up if no transaction forced the init */
+	if (!iptables_ready)
+		return;
+
+#ifdef _HAVE_LIBIPTC_
+	iptables_fini();
+#endif
+}
@@ -291,85 +291,86 @@ add_nexthops(ip_route_t *route, struct nlmsghdr *nlh, struct rtmsg *rtm)
 		addattr_l(nlh, sizeof(buf), RTA_MULTIPATH, RTA_DATA(rta), RTA_PAYLOAD(rta));
 }
 
-/* Add/Delete IP route to/from a specific interface */
-static int
-netlink_route(ip_route_t *iproute, int cmd)
+/* Netlink request message */
+typedef struct {
+	struct nlmsghdr n;
+	struct rtmsg r;
+	char buf[RTM_SIZE];
+} iproute_req_t;
+
+/* Build an RTM_NEWROUTE/RTM_DELROUTE request for a route */
+static void
+netlink_route_build(ip_route_t *iproute, int cmd, iproute_req_t *reqp)
 {
-	int status = 1;
-	struct {
-		struct nlmsghdr n;
-		struct rtmsg r;
-		char buf[RTM_SIZE];
-	} req;
 	char buf[RTA_SIZE];
 	struct rtattr *rta = (void*)buf;
 
-	memset(&req, 0, sizeof (req));
+	memset(reqp, 0, sizeof (*reqp));
 
-	req.n.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
+	reqp->n.nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
 	if (cmd == IPROUTE_DEL) {
-		req.n.nlmsg_flags = NLM_F_REQUEST;
-		req.n.nlmsg_type  = RTM_DELROUTE;
+		reqp->n.nlmsg_flags = NLM_F_REQUEST;
+		reqp->n.nlmsg_type  = RTM_DELROUTE;
 	}
 	else {
-		req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE;
+		reqp->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE;
 		if (cmd == IPROUTE_REPLACE)
-			req.n.nlmsg_flags |= NLM_F_REPLACE;
-		req.n.nlmsg_type  = RTM_NEWROUTE;
+			reqp->n.nlmsg_flags |= NLM_F_REPLACE;
+		reqp->n.nlmsg_type  = RTM_NEWROUTE;
 	}
 
 	rta->rta_type = RTA_METRICS;
 	rta->rta_len = RTA_LENGTH(0);
 
-	req.r.rtm_family = iproute->family;
+	reqp->r.rtm_family = iproute->family;
 	if (iproute->table < 256)
-		req.r.rtm_table = (unsigned char)iproute->table;
+		reqp->r.rtm_table = (unsigned char)iproute->table;
 	else {
-		req.r.rtm_table = RT_TABLE_UNSPEC;
-		addattr32(&req.n, sizeof(req), RTA_TABLE, iproute->table);
+		reqp->r.rtm_table = RT_TABLE_UNSPEC;
+		addattr32(&reqp->n, sizeof(*reqp), RTA_TABLE, iproute->table);
 	}
 
 	if (cmd == IPROUTE_DEL) {
-		req.r.rtm_scope = RT_SCOPE_NOWHERE;
+		reqp->r.rtm_scope = RT_SCOPE_NOWHERE;
 		if (iproute->mask & IPROUTE_BIT_TYPE)
-			req.r.rtm_type = iproute->type;
+			reqp->r.rtm_type = iproute->type;
 	}
 	else {
-		req.r.rtm_protocol = RTPROT_BOOT;
-		req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-		req.r.rtm_type = iproute->type;
+		reqp->r.rtm_protocol = RTPROT_BOOT;
+		reqp->r.rtm_scope = RT_SCOPE_UNIVERSE;
+		reqp->r.rtm_type = iproute->type;
 	}
 
 	if (iproute->mask & IPROUTE_BIT_PROTOCOL)
-		req.r.rtm_protocol = iproute->protocol;
+		reqp->r.rtm_protocol = iproute->protocol;
 
 	if (iproute->mask & IPROUTE_BIT_SCOPE)
-		req.r.rtm_scope = iproute->scope;
+		reqp->r.rtm_scope = iproute->scope;
 
 	if (iproute->dst) {
-		req.r.rtm_dst_len = iproute->dst->ifa.ifa_prefixlen;
-		add_addr2req(&req.n, sizeof(req), RTA_DST, iproute->dst);
+		reqp->r.rtm_dst_len = iproute->dst->ifa.ifa_prefixlen;
+		add_addr2req(&reqp->n, sizeof(*reqp), RTA_DST, iproute->dst);
 	}
 
 	if (iproute->src) {
-		req.r.rtm_src_len = iproute->src->ifa.ifa_prefixlen;
-		add_addr2req(&req.n, sizeof(req), RTA_SRC, iproute->src);
+		reqp->r.rtm_src_len = iproute->src->ifa.ifa_prefixlen;
+		add_addr2req(&reqp->n, sizeof(*reqp), RTA_SRC, iproute->src);
 	}
 
 	if (iproute->pref_src)
-		add_addr2req(&req.n, sizeof(req), RTA_PREFSRC, iproute->pref_src);
+		add_addr2req(&reqp->n, sizeof(*reqp), RTA_PREFSRC, iproute->pref_src);
 
 //#if HAVE_DECL_RTA_NEWDST
 //	if (iproute->as_to)
-//		add_addr2req(&req.n, sizeof(req), RTA_NEWDST, iproute->as_to);
+//		add_addr2req(&reqp->n, sizeof(*reqp), RTA_NEWDST, iproute->as_to);
 //#endif
 
 	if (iproute->via) {
 		if (iproute->via->ifa.ifa_family == iproute->family)
-			add_addr2req(&req.n, sizeof(req), RTA_GATEWAY, iproute->via);
+			add_addr2req(&reqp->n, sizeof(*reqp), RTA_GATEWAY, iproute->via);
 #if HAVE_DECL_RTA_VIA
 		else
-			add_addr_fam2req(&req.n, sizeof(req), RTA_VIA, iproute->via);
+			add_addr_fam2req(&reqp->n, sizeof(*reqp), RTA_VIA, iproute->via);
 #endif
 	}
 
@@ -383,27 +384,27 @@ netlink_route(ip_route_t *iproute, int cmd)
 		add_encap(encap_rta, sizeof(encap_buf), &iproute->encap);
 
 		if (encap_rta->rta_len > RTA_LENGTH(0))
-			addraw_l(&req.n, sizeof(encap_buf), RTA_DATA(encap_rta), RTA_PAYLOAD(encap_rta));
+			addraw_l(&reqp->n, sizeof(encap_buf), RTA_DATA(encap_rta), RTA_PAYLOAD(encap_rta));
 	}
 #endif
 
 	if (iproute->mask & IPROUTE_BIT_DSFIELD)
-		req.r.rtm_tos = iproute->tos;
+		reqp->r.rtm_tos = iproute->tos;
 	
 	if (iproute->oif)
-		addattr32(&req.n, sizeof(req), RTA_OIF, iproute->oif->ifindex);
+		addattr32(&reqp->n, sizeof(*reqp), RTA_OIF, iproute->oif->ifindex);
 
 	if (iproute->mask & IPROUTE_BIT_METRIC)
-		addattr32(&req.n, sizeof(req), RTA_PRIORITY, iproute->metric);
+		addattr32(&reqp->n, sizeof(*reqp), RTA_PRIORITY, iproute->metric);
 
-	req.r.rtm_flags = iproute->flags;
+	reqp->r.rtm_flags = iproute->flags;
 
 	if (iproute->realms)
-		addattr32(&req.n, sizeof(req), RTA_FLOW, iproute->realms);
+		addattr32(&reqp->n, sizeof(*reqp), RTA_FLOW, iproute->realms);
 
 #if HAVE_DECL_RTA_EXPIRES
 	if (iproute->mask & IPROUTE_BIT_EXPIRES)
-		addattr32(&req.n, sizeof(req), RTA_EXPIRES, iproute->expires);
+		addattr32(&reqp->n, sizeof(*reqp), RTA_EXPIRES, iproute->expires);
 #endif
 
 #if HAVE_DECL_RTAX_CC_ALGO
@@ -457,17 +458,17 @@ netlink_route(ip_route_t *iproute, int cmd)
 
 #if HAVE_DECL_RTA_PREF
 	if (iproute->mask & IPROUTE_BIT_PREF)
-		addattr8(&req.n, sizeof(req), RTA_PREF, iproute->pref);
+		addattr8(&reqp->n, sizeof(*reqp), RTA_PREF, iproute->pref);
 #endif
 
 	if (rta->rta_len > RTA_LENGTH(0)) {
 		if (iproute->lock)
 			rta_addattr32(rta, sizeof(buf), RTAX_LOCK, iproute->lock);
-		addattr_l(&req.n, sizeof(req), RTA_METRICS, RTA_DATA(rta), RTA_PAYLOAD(rta));
+		addattr_l(&reqp->n, sizeof(*reqp), RTA_METRICS, RTA_DATA(rta), RTA_PAYLOAD(rta));
 	}
 
 	if (!LIST_ISEMPTY(iproute->nhs))
-		add_nexthops(iproute, &req.n, &req.r);
+		add_nexthops(iproute, &reqp->n, &reqp->r);
 
 #ifdef DEBUG_NETLINK_MSG
 	size_t i, j;
@@ -475,33 +476,41 @@ netlink_route(ip_route_t *iproute, int cmd)
 	char lbuf[3072];
 	char *op = lbuf;
 
-	log_message(LOG_INFO, "rtmsg buffer used %lu, rtattr buffer used %d", req.n.nlmsg_len - NLMSG_LENGTH(sizeof(struct rtmsg)), rta->rta_len);
+	log_message(LOG_INFO, "rtmsg buffer used %lu, rtattr buffer used %d", reqp->n.nlmsg_len - NLMSG_LENGTH(sizeof(struct rtmsg)), rta->rta_len);
 
-	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "nlmsghdr %p(%u):", &req.n, req.n.nlmsg_len);
-	for (i = 0, p = (uint8_t*)&req.n; i < sizeof(struct nlmsghdr); i++)
+	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "nlmsghdr %p(%u):", &reqp->n, reqp->n.nlmsg_len);
+	for (i = 0, p = (uint8_t*)&reqp->n; i < sizeof(struct nlmsghdr); i++)
 		op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), " %2.2hhx", *(p++));
 	log_message(LOG_INFO, "%s\n", lbuf);
 
 	op = lbuf;
-	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "rtmsg %p(%lu):", &req.r, req.n.nlmsg_len - sizeof(struct nlmsghdr));
-	for (i = 0, p = (uint8_t*)&req.r; i < + req.n.nlmsg_len - sizeof(struct nlmsghdr); i++)
+	op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), "rtmsg %p(%lu):", &reqp->r, reqp->n.nlmsg_len - sizeof(struct nlmsghdr));
+	for (i = 0, p = (uint8_t*)&reqp->r; i < + reqp->n.nlmsg_len - sizeof(struct nlmsghdr); i++)
 		op += (size_t)snprintf(op, sizeof(lbuf) - (op - lbuf), " %2.2hhx", *(p++));
 
 	for (j = 0; lbuf + j < op; j+= MAX_LOG_MSG)
 		log_message(LOG_INFO, "%.*\n", MAX_LOG_MSG, lbuf+j);
 #endif
+}
+
+/* Batch completion handler, updating bookkeeping for one route */
+static int rtlist_cmd;
+
+static void
+rtlist_ack_handler(void *cookie, int error)
+{
+	ip_route_t *iproute = cookie;
 
-	/* This returns ESRCH if the address of via address doesn't exist */
-	/* ENETDOWN if dev p33p1.40 for example is down */
-	if (netlink_talk(&nl_cmd, &req.n) < 0) {
 #if HAVE_DECL_RTA_EXPIRES
-		/* If an expiry was set on the route, it may have disappeared already */
-		if (cmd != IPADDRESS_DEL || !(iproute->mask & IPROUTE_BIT_EXPIRES))
+	/* If an expiry was set on the route, it may have disappeared already */
+	if (error && rtlist_cmd == IPROUTE_DEL && (iproute->mask & IPROUTE_BIT_EXPIRES))
+		error = 0;
 #endif
-			status = -1;
-	}
 
-	return status;
+	if (!error)
+		iproute->set = (rtlist_cmd != IPROUTE_DEL);
+	else
+		iproute->set = false;
 }
 
 /* Add/Delete a list of IP routes */
@@ -510,20 +519,24 @@ netlink_rtlist(list rt_list, int cmd)
 {
 	ip_route_t *iproute;
 	element e;
+	iproute_req_t req;
 
 	/* No routes to add */
 	if (LIST_ISEMPTY(rt_list))
 		return;
 
+	rtlist_cmd = cmd;
+	netlink_batch_begin(rtlist_ack_handler);
+
 	for (e = LIST_HEAD(rt_list); e; ELEMENT_NEXT(e)) {
 		iproute = ELEMENT_DATA(e);
 		if ((cmd == IPROUTE_DEL) == iproute->set) {
-			if (netlink_route(iproute, cmd) > 0)
-				iproute->set = (cmd == IPROUTE_ADD);
-			else
-				iproute->set = false;
+			netlink_route_build(iproute, cmd, &req);
+			netlink_talk_queue(&nl_cmd, &req.n, iproute);
 		}
 	}
+
+	netlink_batch_end(&nl_cmd);
 }
 
 /* Route dump/allocation */
@@ -1686,8 +1699,8 @@ err:
 	free_iproute(new);
 }
 
-/* Try to find a route in a list */
-static int
+/* Try to find a route in a list, returning the matching entry */
+static ip_route_t *
 route_exist(list l, ip_route_t *iproute)
 {
 	ip_route_t *ipr;
@@ -1704,10 +1717,10 @@ route_exist(list l, ip_route_t *iproute)
 		     ipr->metric == iproute->metric) &&
 		    ipr->table == iproute->table) {
 			ipr->set = iproute->set;
-			return 1;
+			return ipr;
 		}
 	}
-	return 0;
+	return NULL;
 }
 
 /* Clear diff routes */
@@ -1715,7 +1728,9 @@ void
 clear_diff_routes(list l, list n)
 {
 	ip_route_t *iproute;
+	ip_route_t *new_route;
 	element e;
+	iproute_req_t req;
 
 	/* No route in previous conf */
 	if (LIST_ISEMPTY(l))
@@ -1728,22 +1743,39 @@ clear_diff_routes(list l, list n)
 		return;
 	}
 
+	/* Remove the routes that have gone */
+	rtlist_cmd = IPROUTE_DEL;
+	netlink_batch_begin(rtlist_ack_handler);
+
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		iproute = ELEMENT_DATA(e);
-		if (iproute->set) {
-			if (!route_exist(n, iproute)) {
-				log_message(LOG_INFO, "ip route %s/%d ... , no longer exist"
-						    , ipaddresstos(NULL, iproute->dst), iproute->dst->ifa.ifa_prefixlen);
-				netlink_route(iproute, IPROUTE_DEL);
-			}
-			else {
-				/* There are too many route options to compare to see if the
-				 * routes are the same or not, so just replace the existing route
-				 * with the new one. */
-				netlink_route(iproute, IPROUTE_REPLACE);
-			}
+		if (iproute->set && !route_exist(n, iproute)) {
+			log_message(LOG_INFO, "ip route %s/%d ... , no longer exist"
+					    , ipaddresstos(NULL, iproute->dst), iproute->dst->ifa.ifa_prefixlen);
+			netlink_route_build(iproute, IPROUTE_DEL, &req);
+			netlink_talk_queue(&nl_cmd, &req.n, iproute);
 		}
 	}
+
+	netlink_batch_end(&nl_cmd);
+
+	/* There are too many route options to compare to see if the
+	 * surviving routes have changed or not, so atomically replace
+	 * each one with its new definition - a single NLM_F_REPLACE
+	 * message leaves no window with the route missing, unlike a
+	 * delete/add pair. */
+	rtlist_cmd = IPROUTE_REPLACE;
+	netlink_batch_begin(rtlist_ack_handler);
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		iproute = ELEMENT_DATA(e);
+		if (iproute->set && (new_route = route_exist(n, iproute))) {
+			netlink_route_build(new_route, IPROUTE_REPLACE, &req);
+			netlink_talk_queue(&nl_cmd, &req.n, new_route);
+		}
+	}
+
+	netlink_batch_end(&nl_cmd);
 }
 
 /* Diff conf handler */
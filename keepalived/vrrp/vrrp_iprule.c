@@ -83,112 +83,122 @@ rule_is_equal(const ip_rule_t *x, const ip_rule_t *y)
 	return true;
 }
 
-/* Add/Delete IP rule to/from a specific IP/network */
-static int
-netlink_rule(ip_rule_t *iprule, int cmd)
+/* Netlink request message for a rule operation */
+typedef struct {
+	struct nlmsghdr n;
+	struct fib_rule_hdr frh;
+	char buf[1024];
+} iprule_req_t;
+
+/* Build a netlink request from an IP rule */
+static void
+netlink_rule_build(ip_rule_t *iprule, int cmd, iprule_req_t *req)
 {
-	int status = 1;
-	struct {
-		struct nlmsghdr n;
-		struct fib_rule_hdr frh;
-		char buf[1024];
-	} req;
-
-	memset(&req, 0, sizeof (req));
+	memset(req, 0, sizeof (*req));
 
-	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
 
 	if (cmd != IPRULE_DEL) {
-		req.n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
-		req.n.nlmsg_type = RTM_NEWRULE;
-		req.frh.action = FR_ACT_UNSPEC;
+		req->n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+		req->n.nlmsg_type = RTM_NEWRULE;
+		req->frh.action = FR_ACT_UNSPEC;
 	}
 	else {
-		req.frh.action = FR_ACT_UNSPEC;
-		req.n.nlmsg_type = RTM_DELRULE;
+		req->frh.action = FR_ACT_UNSPEC;
+		req->n.nlmsg_type = RTM_DELRULE;
 	}
-	req.frh.table = RT_TABLE_UNSPEC;
-	req.frh.flags = 0;
+	req->frh.table = RT_TABLE_UNSPEC;
+	req->frh.flags = 0;
 
 	if (iprule->from_addr)
-		req.frh.family = IP_FAMILY(iprule->from_addr);
+		req->frh.family = IP_FAMILY(iprule->from_addr);
 	else if (iprule->to_addr)
-		req.frh.family = IP_FAMILY(iprule->to_addr);
+		req->frh.family = IP_FAMILY(iprule->to_addr);
 	else
-		req.frh.family = AF_INET;
+		req->frh.family = AF_INET;
 
 	if (iprule->action == FR_ACT_TO_TBL) {
 		if (iprule->table < 256)	// "Table" or "lookup"
-			req.frh.table = iprule->table ? iprule->table & 0xff : RT_TABLE_MAIN;
+			req->frh.table = iprule->table ? iprule->table & 0xff : RT_TABLE_MAIN;
 		else {
-			req.frh.table = RT_TABLE_UNSPEC;
-			addattr32(&req.n, sizeof(req), FRA_TABLE, iprule->table);
+			req->frh.table = RT_TABLE_UNSPEC;
+			addattr32(&req->n, sizeof(*req), FRA_TABLE, iprule->table);
 		}
 	}
 
 	if (iprule->invert)
-		req.frh.flags |= FIB_RULE_INVERT;	// "not"
+		req->frh.flags |= FIB_RULE_INVERT;	// "not"
 
 	/* Set rule entry */
 	if (iprule->from_addr) {	// can be "default"/"any"/"all" - and to addr => bytelen == bitlen == 0
-		add_addr2req(&req.n, sizeof(req), FRA_SRC, iprule->from_addr);
-		req.frh.src_len = iprule->from_addr->ifa.ifa_prefixlen;
+		add_addr2req(&req->n, sizeof(*req), FRA_SRC, iprule->from_addr);
+		req->frh.src_len = iprule->from_addr->ifa.ifa_prefixlen;
 	}
 	if (iprule->to_addr) {
-		add_addr2req(&req.n, sizeof(req), FRA_DST, iprule->to_addr);
-		req.frh.dst_len = iprule->to_addr->ifa.ifa_prefixlen;
+		add_addr2req(&req->n, sizeof(*req), FRA_DST, iprule->to_addr);
+		req->frh.dst_len = iprule->to_addr->ifa.ifa_prefixlen;
 	}
 
 	if (iprule->mask & IPRULE_BIT_PRIORITY)	// "priority/order/preference"
-		addattr32(&req.n, sizeof(req), FRA_PRIORITY, iprule->priority);
+		addattr32(&req->n, sizeof(*req), FRA_PRIORITY, iprule->priority);
 
 	if (iprule->mask & IPRULE_BIT_DSFIELD)	// "tos/dsfield"
-		req.frh.tos = iprule->tos;	// Hex value - 0xnn <= 255, or name from rt_dsfield
+		req->frh.tos = iprule->tos;	// Hex value - 0xnn <= 255, or name from rt_dsfield
 
 	if (iprule->mask & IPRULE_BIT_FWMARK)	// "fwmark"
-		addattr32(&req.n, sizeof(req), FRA_FWMARK, iprule->fwmark);
+		addattr32(&req->n, sizeof(*req), FRA_FWMARK, iprule->fwmark);
 
 	if (iprule->mask & IPRULE_BIT_FWMASK)	// "fwmark number followed by /nn"
-		addattr32(&req.n, sizeof(req), FRA_FWMASK, iprule->fwmask);
+		addattr32(&req->n, sizeof(*req), FRA_FWMASK, iprule->fwmask);
 
 	if (iprule->realms)	// "realms u16[/u16] using rt_realms. after / is 16 msb (src), pre slash is 16 lsb (dest)"
-		addattr32(&req.n, sizeof(req), FRA_FLOW, iprule->realms);
+		addattr32(&req->n, sizeof(*req), FRA_FLOW, iprule->realms);
 
 #if HAVE_DECL_FRA_SUPPRESS_PREFIXLEN
 	if (iprule->mask & IPRULE_BIT_SUP_PREFIXLEN)	// "suppress_prefixlength" - only valid if table !=0
-		addattr32(&req.n, sizeof(req), FRA_SUPPRESS_PREFIXLEN, iprule->suppress_prefix_len);
+		addattr32(&req->n, sizeof(*req), FRA_SUPPRESS_PREFIXLEN, iprule->suppress_prefix_len);
 #endif
 
 #if HAVE_DECL_FRA_SUPPRESS_IFGROUP
 	if (iprule->mask & IPRULE_BIT_SUP_GROUP)	// "suppress_ifgroup" or "sup_group" int32 - only valid if table !=0
-		addattr32(&req.n, sizeof(req), FRA_SUPPRESS_IFGROUP, iprule->suppress_group);
+		addattr32(&req->n, sizeof(*req), FRA_SUPPRESS_IFGROUP, iprule->suppress_group);
 #endif
 
 	if (iprule->iif)	// "dev/iif"
-		addattr_l(&req.n, sizeof(req), FRA_IFNAME, iprule->iif, strlen(iprule->iif->ifname)+1);
+		addattr_l(&req->n, sizeof(*req), FRA_IFNAME, iprule->iif, strlen(iprule->iif->ifname)+1);
 
 #if HAVE_DECL_FRA_OIFNAME
 	if (iprule->oif)	// "oif"
-		addattr_l(&req.n, sizeof(req), FRA_OIFNAME, iprule->oif, strlen(iprule->oif->ifname)+1);
+		addattr_l(&req->n, sizeof(*req), FRA_OIFNAME, iprule->oif, strlen(iprule->oif->ifname)+1);
 #endif
 
 #if HAVE_DECL_FRA_TUN_ID
 	if (iprule->tunnel_id)
-		addattr64(&req.n, sizeof(req), FRA_TUN_ID, htobe64(iprule->tunnel_id));
+		addattr64(&req->n, sizeof(*req), FRA_TUN_ID, htobe64(iprule->tunnel_id));
 #endif
 
 #if HAVE_DECL_FRA_UID_RANGE
 	if (iprule->mask & IPRULE_BIT_UID_RANGE)
-		addattr_l(&req.n, sizeof(req), FRA_UID_RANGE, &iprule->uid_range, sizeof(iprule->uid_range));
+		addattr_l(&req->n, sizeof(*req), FRA_UID_RANGE, &iprule->uid_range, sizeof(iprule->uid_range));
 #endif
 
 	if (iprule->action == FR_ACT_GOTO) {	// "goto"
-		addattr32(&req.n, sizeof(req), FRA_GOTO, iprule->goto_target);
-		req.frh.action = FR_ACT_GOTO;
+		addattr32(&req->n, sizeof(*req), FRA_GOTO, iprule->goto_target);
+		req->frh.action = FR_ACT_GOTO;
 	}
 
-	req.frh.action = iprule->action;
+	req->frh.action = iprule->action;
+}
+
+/* Add/Delete IP rule to/from a specific IP/network */
+static int
+netlink_rule(ip_rule_t *iprule, int cmd)
+{
+	int status = 1;
+	iprule_req_t req;
+
+	netlink_rule_build(iprule, cmd, &req);
 
 	if (netlink_talk(&nl_cmd, &req.n) < 0)
 		status = -1;
@@ -196,11 +206,26 @@ netlink_rule(ip_rule_t *iprule, int cmd)
 	return status;
 }
 
+/* Batch completion handler, updating bookkeeping for one rule */
+static int rulelist_cmd;
+
+static void
+rulelist_ack_handler(void *cookie, int error)
+{
+	ip_rule_t *iprule = cookie;
+
+	if (!error)
+		iprule->set = (rulelist_cmd == IPRULE_ADD);
+	else
+		iprule->set = false;
+}
+
 void
 netlink_rulelist(list rule_list, int cmd, bool force)
 {
 	ip_rule_t *iprule;
 	element e;
+	iprule_req_t req;
 
 	/* No rules to add */
 	if (LIST_ISEMPTY(rule_list))
@@ -212,18 +237,21 @@ netlink_rulelist(list rule_list, int cmd, bool force)
 	if (force && cmd == IPRULE_DEL)
 	         netlink_error_ignore = ENOENT;
 
+	rulelist_cmd = cmd;
+	netlink_batch_begin(rulelist_ack_handler);
+
 	for (e = LIST_HEAD(rule_list); e; ELEMENT_NEXT(e)) {
 		iprule = ELEMENT_DATA(e);
 		if (force ||
 		    (cmd == IPRULE_ADD && !iprule->set) ||
 		    (cmd == IPRULE_DEL && iprule->set)) {
-			if (netlink_rule(iprule, cmd) > 0)
-				iprule->set = (cmd == IPRULE_ADD);
-			else
-				iprule->set = false;
+			netlink_rule_build(iprule, cmd, &req);
+			netlink_talk_queue(&nl_cmd, &req.n, iprule);
 		}
 	}
 
+	netlink_batch_end(&nl_cmd);
+
 	netlink_error_ignore = 0;
 }
 
@@ -28,22 +28,16 @@
 
 #define	BLOCK_SIZE	64
 
-/* hmac_md5 computation according to the RFCs 2085 & 2104 */
+/* Precompute the HMAC-MD5 pad states for a key, according to the
+ * RFCs 2085 & 2104 */
 void
-hmac_md5(unsigned char *buffer, size_t buffer_len, unsigned char *key, size_t key_len,
-	 unsigned char *digest)
+hmac_md5_init_ctx(hmac_md5_ctx_t *ctx, unsigned char *key, size_t key_len)
 {
-	MD5_CTX context;
 	unsigned char k_ipad[BLOCK_SIZE+1];	/* inner padding - key XORd with ipad */
 	unsigned char k_opad[BLOCK_SIZE+1];	/* outer padding - key XORd with opad */
 	unsigned char tk[MD5_DIGEST_LENGTH];
 	int i;
 
-	/* Initialize data */
-	memset(k_ipad, 0, sizeof (k_ipad));
-	memset(k_opad, 0, sizeof (k_opad));
-	memset(tk, 0, sizeof (tk));
-
 	/* If the key is longer than 64 bytes => set it to key=MD5(key) */
 	if (key_len > BLOCK_SIZE) {
 		MD5_CTX tctx;
@@ -75,15 +69,38 @@ hmac_md5(unsigned char *buffer, size_t buffer_len, unsigned char *key, size_t ke
 		k_opad[i] ^= 0x5c;
 	}
 
+	/* Hash the pads once; per packet computation restarts from here */
+	MD5_Init(&ctx->ipad_ctx);
+	MD5_Update(&ctx->ipad_ctx, k_ipad, BLOCK_SIZE);
+	MD5_Init(&ctx->opad_ctx);
+	MD5_Update(&ctx->opad_ctx, k_opad, BLOCK_SIZE);
+}
+
+/* hmac_md5 over one buffer from precomputed pad states */
+void
+hmac_md5_ctx(hmac_md5_ctx_t *ctx, unsigned char *buffer, size_t buffer_len,
+	     unsigned char *digest)
+{
+	MD5_CTX context;
+
 	/* Compute inner MD5 */
-	MD5_Init(&context);				/* Init context for 1st pass */
-	MD5_Update(&context, k_ipad, BLOCK_SIZE);		/* start with inner pad */
+	context = ctx->ipad_ctx;			/* resume after inner pad */
 	MD5_Update(&context, buffer, buffer_len);	/* next with buffer datagram */
 	MD5_Final(digest, &context);			/* Finish 1st pass */
 
 	/* Compute outer MD5 */
-	MD5_Init(&context);				/* Init context for 2nd pass */
-	MD5_Update(&context, k_opad, BLOCK_SIZE);		/* start with inner pad */
+	context = ctx->opad_ctx;			/* resume after outer pad */
 	MD5_Update(&context, digest, MD5_DIGEST_LENGTH); /* next result of 1st pass */
 	MD5_Final(digest, &context);			/* Finish 2nd pass */
 }
+
+/* One-shot hmac_md5 computation */
+void
+hmac_md5(unsigned char *buffer, size_t buffer_len, unsigned char *key, size_t key_len,
+	 unsigned char *digest)
+{
+	hmac_md5_ctx_t ctx;
+
+	hmac_md5_init_ctx(&ctx, key, key_len);
+	hmac_md5_ctx(&ctx, buffer, buffer_len, digest);
+}
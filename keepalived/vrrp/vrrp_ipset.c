@@ -69,6 +69,7 @@ int (*ipset_envopt_parse_addr)(struct ipset_session *session, int env, const cha
 const struct ipset_type* (*ipset_type_get_addr)(struct ipset_session *session, enum ipset_cmd cmd);
 int (*ipset_data_set_addr)(struct ipset_data *data, enum ipset_opt opt, const void *value);
 int (*ipset_cmd_addr)(struct ipset_session *session, enum ipset_cmd cmd, uint32_t lineno);
+int (*ipset_commit_addr)(struct ipset_session *session);
 void (*ipset_load_types_addr)(void);
 
 /* We can (almost) make it look as though normal linking is being used */
@@ -81,13 +82,23 @@ void (*ipset_load_types_addr)(void);
 #define ipset_data_set (*ipset_data_set_addr)
 /* Unfortunately ipset_cmd conflicts with struct ipset_cmd */
 #define ipset_cmd1 (*ipset_cmd_addr)
+#define ipset_commit1 (*ipset_commit_addr)
 #define ipset_load_types (*ipset_load_types_addr)
 
 static void* libipset_handle;
 #else
 #define ipset_cmd1 ipset_cmd
+#define ipset_commit1 ipset_commit
 #endif
 
+/* Entries queued on a session since its last commit. Passing a non-zero
+ * line number to ipset_cmd() puts libipset into restore mode, where the
+ * adds/deletes are aggregated into a netlink batch rather than each being
+ * sent (and acknowledged) individually. With many VIPs per instance that
+ * turns a transition's worth of set updates into a handful of messages.
+ * The line number also identifies the failing entry in error reports. */
+static uint32_t ipset_lineno;
+
 static bool
 do_ipset_cmd(struct ipset_session* session, enum ipset_cmd cmd, const char *setname,
 		const ip_address_t *addr, uint32_t timeout, const char* iface)
@@ -112,7 +123,8 @@ do_ipset_cmd(struct ipset_session* session, enum ipset_cmd cmd, const char *setn
 	if (iface)
 		ipset_session_data_set(session, IPSET_OPT_IFACE, iface);
 
-	r = ipset_cmd1(session, cmd, 0);
+	/* Queued in the session's batch; sent by ipset_session_commit() */
+	r = ipset_cmd1(session, cmd, ++ipset_lineno);
 
 	return r == 0;
 }
@@ -258,6 +270,7 @@ bool ipset_init(void)
 	    !(ipset_type_get_addr = dlsym(libipset_handle,"ipset_type_get")) ||
 	    !(ipset_data_set_addr = dlsym(libipset_handle,"ipset_data_set")) ||
 	    !(ipset_cmd_addr = dlsym(libipset_handle,"ipset_cmd")) ||
+	    !(ipset_commit_addr = dlsym(libipset_handle,"ipset_commit")) ||
 	    !(ipset_load_types_addr = dlsym(libipset_handle,"ipset_load_types"))) {
 		log_message(LOG_INFO, "Failed to dynamic link an ipset function - %s", dlerror());
 		return false;
@@ -322,6 +335,25 @@ void ipset_session_end(void* vsession)
 	ipset_session_fini(session);
 }
 
+bool ipset_session_commit(void* vsession)
+{
+	struct ipset_session *session = vsession;
+	int r;
+
+	if (!ipset_lineno)
+		return true;
+
+	r = ipset_commit1(session);
+	ipset_lineno = 0;
+
+	if (r < 0) {
+		log_message(LOG_INFO, "ipset commit failed - %s", ipset_session_error(session));
+		return false;
+	}
+
+	return true;
+}
+
 void ipset_entry(void* vsession, int cmd, const ip_address_t* addr)
 {
 	const char* set;
@@ -93,6 +93,35 @@ bool using_libip4tc = false;
 bool using_libip6tc = false;
 #endif
 
+/* Working directly in the configured (usually built-in) chains means every
+ * insert or delete linearly scans whatever else the administrator keeps
+ * there, and on a busy firewall that can be thousands of rules. Instead we
+ * create a chain of our own per direction, jump to it once from the top of
+ * the configured chain, and keep all our rules in it. Lookups and deletions
+ * then only scan our own entries, and removing everything is a single
+ * chain flush. If chain creation fails (e.g. insufficient privilege) we
+ * fall back to using the configured chains directly. */
+#define IPTABLES_VIP_CHAIN_IN	"KEEPALIVED-IN"
+#define IPTABLES_VIP_CHAIN_OUT	"KEEPALIVED-OUT"
+
+static bool using_own_chains_v4;
+static bool using_own_chains_v6;
+
+/* Map the configured chain to the keepalived-owned chain holding our rules.
+ * Callers always pass global_data->vrrp_iptables_inchain/outchain themselves,
+ * so the pointer identifies the direction even if both have the same name. */
+static const char *
+vip_chain_name(const char *chain_name, bool is_ipv6)
+{
+	if (is_ipv6 ? !using_own_chains_v6 : !using_own_chains_v4)
+		return chain_name;
+
+	if (chain_name == global_data->vrrp_iptables_outchain)
+		return IPTABLES_VIP_CHAIN_OUT;
+
+	return IPTABLES_VIP_CHAIN_IN;
+}
+
 #ifdef _HAVE_LIBIPSET_
 static
 void add_del_sets(int cmd, bool reload)
@@ -121,9 +150,9 @@ void add_del_rules(int cmd, bool ignore_errors)
 			      ) {
 		if ((h4 = ip4tables_open("filter"))) {
 			if (global_data->vrrp_iptables_inchain[0])
-				ip4tables_add_rules(h4, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_DROP, global_data->vrrp_ipset_address, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip4tables_add_rules(h4, vip_chain_name(global_data->vrrp_iptables_inchain, false), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_DROP, global_data->vrrp_ipset_address, IPPROTO_NONE, 0, cmd, ignore_errors);
 			if (global_data->vrrp_iptables_outchain[0])
-				ip4tables_add_rules(h4, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip4tables_add_rules(h4, vip_chain_name(global_data->vrrp_iptables_outchain, false), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address, IPPROTO_NONE, 0, cmd, ignore_errors);
 			ip4tables_close(h4, true);
 		}
 	}
@@ -138,32 +167,32 @@ void add_del_rules(int cmd, bool ignore_errors)
 		if ((h6 = ip6tables_open("filter"))) {
 			if (global_data->vrrp_iptables_inchain[0]) {
 #ifdef HAVE_IPSET_ATTR_IFACE
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_TWO_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_TWO_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_TWO_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_TWO_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_TWO_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_TWO_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
 #else
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
 #endif
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_DROP, global_data->vrrp_ipset_address6, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_inchain, true), APPEND_RULE, IPSET_DIM_ONE, 0, XTC_LABEL_DROP, global_data->vrrp_ipset_address6, IPPROTO_NONE, 0, cmd, ignore_errors);
 			}
 
 			if (global_data->vrrp_iptables_outchain[0]) {
 #ifdef HAVE_IPSET_ATTR_IFACE
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_TWO, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
 #else
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address_iface6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address_iface6, IPPROTO_NONE, 0, cmd, ignore_errors);
 #endif
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
-				ip6tables_add_rules(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address6, IPPROTO_NONE, 0, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 135, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_ACCEPT, global_data->vrrp_ipset_address6, IPPROTO_ICMPV6, 136, cmd, ignore_errors);
+				ip6tables_add_rules(h6, vip_chain_name(global_data->vrrp_iptables_outchain, true), APPEND_RULE, IPSET_DIM_ONE, IPSET_DIM_ONE_SRC, XTC_LABEL_DROP, global_data->vrrp_ipset_address6, IPPROTO_NONE, 0, cmd, ignore_errors);
 			}
 
 			ip6tables_close(h6, true);
@@ -189,8 +218,12 @@ int iptables_close(struct ipt_handle* h)
 		res += ip6tables_close(h->h6, h->updated_v6);
 
 #ifdef _HAVE_LIBIPSET_
-	if (h->session)
+	if (h->session) {
+		/* Flush the batched set updates in one go before the
+		 * transition carries on to the gratuitous ARP/NA storm */
+		ipset_session_commit(h->session);
 		ipset_session_end(h->session);
+	}
 #endif
 
 	FREE(h);
@@ -267,7 +300,7 @@ static int iptables_entry(struct ipt_handle* h, const char* chain_name, unsigned
 		if (!h->h4)
 			h->h4 = ip4tables_open ("filter");
 
-		res = ip4tables_process_entry(h->h4, chain_name, rulenum, target_name, src_ip_address, dst_ip_address, in_iface, out_iface, protocol, type, cmd, force);
+		res = ip4tables_process_entry(h->h4, vip_chain_name(chain_name, false), rulenum, target_name, src_ip_address, dst_ip_address, in_iface, out_iface, protocol, type, cmd, force);
 		if (!res)
 			h->updated_v4 = true ;
 		return res;
@@ -277,7 +310,7 @@ static int iptables_entry(struct ipt_handle* h, const char* chain_name, unsigned
 		if (!h->h6)
 			h->h6 = ip6tables_open ("filter");
 
-		res = ip6tables_process_entry(h->h6, chain_name, rulenum, target_name, src_ip_address, dst_ip_address, in_iface, out_iface, protocol, type, cmd, force);
+		res = ip6tables_process_entry(h->h6, vip_chain_name(chain_name, true), rulenum, target_name, src_ip_address, dst_ip_address, in_iface, out_iface, protocol, type, cmd, force);
 		if (!res)
 			h->updated_v6 = true;
 		return res;
@@ -370,17 +403,150 @@ iptables_remove_structure(bool ignore_errors)
 }
 #endif
 
-void
-iptables_startup(
-#ifndef _HAVE_LIBIPSET_
-		 __attribute__((unused))
+/* Create the keepalived-owned chain if it doesn't already exist, and make
+ * sure the configured chain has exactly one jump to it. Everything happens
+ * on the one handle, so the change is committed atomically. */
+static bool
+setup_own_chain4(struct iptc_handle *h, const char *parent, const char *own, bool reload)
+{
+	if (!ip4tables_is_chain(h, own)) {
+		if (ip4tables_create_chain(h, own))
+			return false;
+	} else if (!reload) {
+		/* Leftover rules from a previous run - one flush clears them all */
+		if (ip4tables_flush_chain(h, own))
+			return false;
+	}
+
+	/* Delete any existing jump before inserting so we never stack them up */
+	ip4tables_process_entry(h, parent, APPEND_RULE, own, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_DEL, true);
+	if (ip4tables_process_entry(h, parent, 0, own, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_ADD, false))
+		return false;
+
+	return true;
+}
+
+static bool
+setup_own_chain6(struct ip6tc_handle *h, const char *parent, const char *own, bool reload)
+{
+	if (!ip6tables_is_chain(h, own)) {
+		if (ip6tables_create_chain(h, own))
+			return false;
+	} else if (!reload) {
+		if (ip6tables_flush_chain(h, own))
+			return false;
+	}
+
+	ip6tables_process_entry(h, parent, APPEND_RULE, own, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_DEL, true);
+	if (ip6tables_process_entry(h, parent, 0, own, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_ADD, false))
+		return false;
+
+	return true;
+}
+
+static void
+setup_own_chains(bool reload)
+{
+	struct iptc_handle *h4;
+	struct ip6tc_handle *h6;
+
+	if (block_ipv4
+#ifdef _LIBIPTC_DYNAMIC_
+	    && using_libip4tc
 #endif
-					 bool reload)
+			  ) {
+		using_own_chains_v4 = false;
+		if ((h4 = ip4tables_open("filter"))) {
+			using_own_chains_v4 = true;
+			if (global_data->vrrp_iptables_inchain[0] &&
+			    !setup_own_chain4(h4, global_data->vrrp_iptables_inchain, IPTABLES_VIP_CHAIN_IN, reload))
+				using_own_chains_v4 = false;
+			if (using_own_chains_v4 &&
+			    global_data->vrrp_iptables_outchain[0] &&
+			    !setup_own_chain4(h4, global_data->vrrp_iptables_outchain, IPTABLES_VIP_CHAIN_OUT, reload))
+				using_own_chains_v4 = false;
+			ip4tables_close(h4, true);
+		}
+
+		if (!using_own_chains_v4)
+			log_message(LOG_INFO, "Unable to set up iptables chain %s - using configured chains directly", IPTABLES_VIP_CHAIN_IN);
+	}
+
+	if (block_ipv6
+#ifdef _LIBIPTC_DYNAMIC_
+	    && using_libip6tc
+#endif
+			  ) {
+		using_own_chains_v6 = false;
+		if ((h6 = ip6tables_open("filter"))) {
+			using_own_chains_v6 = true;
+			if (global_data->vrrp_iptables_inchain[0] &&
+			    !setup_own_chain6(h6, global_data->vrrp_iptables_inchain, IPTABLES_VIP_CHAIN_IN, reload))
+				using_own_chains_v6 = false;
+			if (using_own_chains_v6 &&
+			    global_data->vrrp_iptables_outchain[0] &&
+			    !setup_own_chain6(h6, global_data->vrrp_iptables_outchain, IPTABLES_VIP_CHAIN_OUT, reload))
+				using_own_chains_v6 = false;
+			ip6tables_close(h6, true);
+		}
+
+		if (!using_own_chains_v6)
+			log_message(LOG_INFO, "Unable to set up ip6tables chain %s - using configured chains directly", IPTABLES_VIP_CHAIN_IN);
+	}
+}
+
+static void
+remove_own_chains(void)
+{
+	struct iptc_handle *h4;
+	struct ip6tc_handle *h6;
+
+	if (using_own_chains_v4) {
+		if ((h4 = ip4tables_open("filter"))) {
+			if (global_data->vrrp_iptables_inchain[0]) {
+				ip4tables_process_entry(h4, global_data->vrrp_iptables_inchain, APPEND_RULE, IPTABLES_VIP_CHAIN_IN, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_DEL, true);
+				ip4tables_flush_chain(h4, IPTABLES_VIP_CHAIN_IN);
+				ip4tables_delete_chain(h4, IPTABLES_VIP_CHAIN_IN);
+			}
+			if (global_data->vrrp_iptables_outchain[0]) {
+				ip4tables_process_entry(h4, global_data->vrrp_iptables_outchain, APPEND_RULE, IPTABLES_VIP_CHAIN_OUT, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_DEL, true);
+				ip4tables_flush_chain(h4, IPTABLES_VIP_CHAIN_OUT);
+				ip4tables_delete_chain(h4, IPTABLES_VIP_CHAIN_OUT);
+			}
+			ip4tables_close(h4, true);
+		}
+		using_own_chains_v4 = false;
+	}
+
+	if (using_own_chains_v6) {
+		if ((h6 = ip6tables_open("filter"))) {
+			if (global_data->vrrp_iptables_inchain[0]) {
+				ip6tables_process_entry(h6, global_data->vrrp_iptables_inchain, APPEND_RULE, IPTABLES_VIP_CHAIN_IN, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_DEL, true);
+				ip6tables_flush_chain(h6, IPTABLES_VIP_CHAIN_IN);
+				ip6tables_delete_chain(h6, IPTABLES_VIP_CHAIN_IN);
+			}
+			if (global_data->vrrp_iptables_outchain[0]) {
+				ip6tables_process_entry(h6, global_data->vrrp_iptables_outchain, APPEND_RULE, IPTABLES_VIP_CHAIN_OUT, NULL, NULL, NULL, NULL, IPPROTO_NONE, 0, IPADDRESS_DEL, true);
+				ip6tables_flush_chain(h6, IPTABLES_VIP_CHAIN_OUT);
+				ip6tables_delete_chain(h6, IPTABLES_VIP_CHAIN_OUT);
+			}
+			ip6tables_close(h6, true);
+		}
+		using_own_chains_v6 = false;
+	}
+}
+
+void
+iptables_startup(bool reload)
 {
 #ifdef _HAVE_LIBIPSET_
 	if (!block_ipv4 && !block_ipv6)
 		global_data->using_ipsets = false;
+#endif
+
+	setup_own_chains(reload);
 
+#ifdef _HAVE_LIBIPSET_
 	if (global_data->using_ipsets) {
 		add_del_sets(IPADDRESS_ADD, reload);
 		add_del_rules(IPADDRESS_ADD, false);
@@ -481,4 +647,6 @@ iptables_fini(void)
 #ifdef _HAVE_LIBIPSET_
 	iptables_remove_structure(false);
 #endif
+
+	remove_own_chains();
 }
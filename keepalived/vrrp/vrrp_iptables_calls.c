@@ -81,6 +81,9 @@ int (*iptc_is_chain_addr)(const char *chain, struct iptc_handle *const handle);
 int (*iptc_insert_entry_addr)(const ipt_chainlabel chain, const struct ipt_entry *e, unsigned int rulenum, struct iptc_handle *handle);
 int (*iptc_append_entry_addr)(const ipt_chainlabel chain, const struct ipt_entry *e, struct iptc_handle *handle);
 int (*iptc_delete_entry_addr)(const ipt_chainlabel chain, const struct ipt_entry *origfw, unsigned char *matchmask, struct iptc_handle *handle);
+int (*iptc_create_chain_addr)(const ipt_chainlabel chain, struct iptc_handle *handle);
+int (*iptc_flush_entries_addr)(const ipt_chainlabel chain, struct iptc_handle *handle);
+int (*iptc_delete_chain_addr)(const ipt_chainlabel chain, struct iptc_handle *handle);
 int (*iptc_commit_addr)(struct iptc_handle *handle);
 const char *(*iptc_strerror_addr)(int err);
 
@@ -90,6 +93,9 @@ int (*ip6tc_is_chain_addr)(const char *chain, struct ip6tc_handle *const handle)
 int (*ip6tc_insert_entry_addr)(const ip6t_chainlabel chain, const struct ip6t_entry *e, unsigned int rulenum, struct ip6tc_handle *handle);
 int (*ip6tc_append_entry_addr)(const ip6t_chainlabel chain, const struct ip6t_entry *e, struct ip6tc_handle *handle);
 int (*ip6tc_delete_entry_addr)(const ip6t_chainlabel chain, const struct ip6t_entry *origfw, unsigned char *matchmask, struct ip6tc_handle *handle);
+int (*ip6tc_create_chain_addr)(const ip6t_chainlabel chain, struct ip6tc_handle *handle);
+int (*ip6tc_flush_entries_addr)(const ip6t_chainlabel chain, struct ip6tc_handle *handle);
+int (*ip6tc_delete_chain_addr)(const ip6t_chainlabel chain, struct ip6tc_handle *handle);
 int (*ip6tc_commit_addr)(struct ip6tc_handle *handle);
 const char *(*ip6tc_strerror_addr)(int err);
 
@@ -100,6 +106,9 @@ const char *(*ip6tc_strerror_addr)(int err);
 #define iptc_insert_entry (*iptc_insert_entry_addr)
 #define iptc_append_entry (*iptc_append_entry_addr)
 #define iptc_delete_entry (*iptc_delete_entry_addr)
+#define iptc_create_chain (*iptc_create_chain_addr)
+#define iptc_flush_entries (*iptc_flush_entries_addr)
+#define iptc_delete_chain (*iptc_delete_chain_addr)
 #define iptc_commit (*iptc_commit_addr)
 #define iptc_strerror (*iptc_strerror_addr)
 
@@ -109,6 +118,9 @@ const char *(*ip6tc_strerror_addr)(int err);
 #define ip6tc_insert_entry (*ip6tc_insert_entry_addr)
 #define ip6tc_append_entry (*ip6tc_append_entry_addr)
 #define ip6tc_delete_entry (*ip6tc_delete_entry_addr)
+#define ip6tc_create_chain (*ip6tc_create_chain_addr)
+#define ip6tc_flush_entries (*ip6tc_flush_entries_addr)
+#define ip6tc_delete_chain (*ip6tc_delete_chain_addr)
 #define ip6tc_commit (*ip6tc_commit_addr)
 #define ip6tc_strerror (*ip6tc_strerror_addr)
 
@@ -180,6 +192,57 @@ int ip4tables_is_chain(struct iptc_handle* handle, const char* chain_name)
 	return iptc_is_chain(chain_name, handle);
 }
 
+int ip4tables_create_chain(struct iptc_handle* handle, const char* chain_name)
+{
+	ipt_chainlabel chain;
+	int res;
+
+	memset (chain, 0, sizeof (chain));
+	strcpy (chain, chain_name);
+
+	if ( ( res = iptc_create_chain (chain, handle) ) != 1 )
+	{
+		log_message(LOG_INFO, "iptc_create_chain for chain %s returned %d: %s", chain_name, res, iptc_strerror (errno) );
+		return errno;
+	}
+
+	return 0;
+}
+
+int ip4tables_flush_chain(struct iptc_handle* handle, const char* chain_name)
+{
+	ipt_chainlabel chain;
+	int res;
+
+	memset (chain, 0, sizeof (chain));
+	strcpy (chain, chain_name);
+
+	if ( ( res = iptc_flush_entries (chain, handle) ) != 1 )
+	{
+		log_message(LOG_INFO, "iptc_flush_entries for chain %s returned %d: %s", chain_name, res, iptc_strerror (errno) );
+		return errno;
+	}
+
+	return 0;
+}
+
+int ip4tables_delete_chain(struct iptc_handle* handle, const char* chain_name)
+{
+	ipt_chainlabel chain;
+	int res;
+
+	memset (chain, 0, sizeof (chain));
+	strcpy (chain, chain_name);
+
+	if ( ( res = iptc_delete_chain (chain, handle) ) != 1 )
+	{
+		log_message(LOG_INFO, "iptc_delete_chain for chain %s returned %d: %s", chain_name, res, iptc_strerror (errno) );
+		return errno;
+	}
+
+	return 0;
+}
+
 int ip4tables_process_entry( struct iptc_handle* handle, const char* chain_name, unsigned int rulenum, const char* target_name, const ip_address_t* src_ip_address, const ip_address_t* dst_ip_address, const char* in_iface, const char* out_iface, uint16_t protocol, uint8_t type, int cmd, bool force)
 {
 	size_t size;
@@ -311,6 +374,57 @@ int ip6tables_is_chain(struct ip6tc_handle* handle, const char* chain_name)
 	return ip6tc_is_chain(chain_name, handle);
 }
 
+int ip6tables_create_chain(struct ip6tc_handle* handle, const char* chain_name)
+{
+	ip6t_chainlabel chain;
+	int res;
+
+	memset (chain, 0, sizeof (chain));
+	strcpy (chain, chain_name);
+
+	if ( ( res = ip6tc_create_chain (chain, handle) ) != 1 )
+	{
+		log_message(LOG_INFO, "ip6tc_create_chain for chain %s returned %d: %s", chain_name, res, ip6tc_strerror (errno) );
+		return errno;
+	}
+
+	return 0;
+}
+
+int ip6tables_flush_chain(struct ip6tc_handle* handle, const char* chain_name)
+{
+	ip6t_chainlabel chain;
+	int res;
+
+	memset (chain, 0, sizeof (chain));
+	strcpy (chain, chain_name);
+
+	if ( ( res = ip6tc_flush_entries (chain, handle) ) != 1 )
+	{
+		log_message(LOG_INFO, "ip6tc_flush_entries for chain %s returned %d: %s", chain_name, res, ip6tc_strerror (errno) );
+		return errno;
+	}
+
+	return 0;
+}
+
+int ip6tables_delete_chain(struct ip6tc_handle* handle, const char* chain_name)
+{
+	ip6t_chainlabel chain;
+	int res;
+
+	memset (chain, 0, sizeof (chain));
+	strcpy (chain, chain_name);
+
+	if ( ( res = ip6tc_delete_chain (chain, handle) ) != 1 )
+	{
+		log_message(LOG_INFO, "ip6tc_delete_chain for chain %s returned %d: %s", chain_name, res, ip6tc_strerror (errno) );
+		return errno;
+	}
+
+	return 0;
+}
+
 int ip6tables_process_entry( struct ip6tc_handle* handle, const char* chain_name, unsigned int rulenum, const char* target_name, const ip_address_t* src_ip_address, const ip_address_t* dst_ip_address, const char* in_iface, const char* out_iface, uint16_t protocol, uint8_t type, int cmd, bool force)
 {
 	size_t size;
@@ -889,6 +1003,9 @@ bool iptables_lib_init(void)
 			 !(iptc_insert_entry_addr = dlsym(libip4tc_handle,"iptc_insert_entry")) ||
 			 !(iptc_append_entry_addr = dlsym(libip4tc_handle,"iptc_append_entry")) ||
 			 !(iptc_delete_entry_addr = dlsym(libip4tc_handle,"iptc_delete_entry")) ||
+			 !(iptc_create_chain_addr = dlsym(libip4tc_handle,"iptc_create_chain")) ||
+			 !(iptc_flush_entries_addr = dlsym(libip4tc_handle,"iptc_flush_entries")) ||
+			 !(iptc_delete_chain_addr = dlsym(libip4tc_handle,"iptc_delete_chain")) ||
 			 !(iptc_commit_addr = dlsym(libip4tc_handle,"iptc_commit")) ||
 			 !(iptc_strerror_addr = dlsym(libip4tc_handle,"iptc_strerror"))) {
 			log_message(LOG_INFO, "Failed to dynamic link an iptc function - %s", dlerror());
@@ -911,6 +1028,9 @@ bool iptables_lib_init(void)
 			 !(ip6tc_insert_entry_addr = dlsym(libip6tc_handle,"ip6tc_insert_entry")) ||
 			 !(ip6tc_append_entry_addr = dlsym(libip6tc_handle,"ip6tc_append_entry")) ||
 			 !(ip6tc_delete_entry_addr = dlsym(libip6tc_handle,"ip6tc_delete_entry")) ||
+			 !(ip6tc_create_chain_addr = dlsym(libip6tc_handle,"ip6tc_create_chain")) ||
+			 !(ip6tc_flush_entries_addr = dlsym(libip6tc_handle,"ip6tc_flush_entries")) ||
+			 !(ip6tc_delete_chain_addr = dlsym(libip6tc_handle,"ip6tc_delete_chain")) ||
 			 !(ip6tc_commit_addr = dlsym(libip6tc_handle,"ip6tc_commit")) ||
 			 !(ip6tc_strerror_addr = dlsym(libip6tc_handle,"ip6tc_strerror"))) {
 			log_message(LOG_INFO, "Failed to dynamic link an ip6tc function - %s", dlerror());
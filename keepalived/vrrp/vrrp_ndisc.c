@@ -42,25 +42,65 @@
 #include "bitops.h"
 
 /* static vars */
-static char *ndisc_buffer;
+#define NDISC_TX_BATCH	64	/* frames flushed per sendmmsg() call */
+#define NDISC_FRAME_LEN	(ETHER_HDR_LEN + sizeof(struct ip6hdr) + \
+			 sizeof(struct ndhdr) + sizeof(struct nd_opt_hdr) + ETH_ALEN)
+
+static char *ndisc_tx_frame[NDISC_TX_BATCH];	/* cached frames queued for the next flush */
+static struct sockaddr_ll ndisc_tx_sll[NDISC_TX_BATCH];
+static unsigned ndisc_tx_count;
 static int ndisc_fd;
 
+/* Flush the queued Neighbour Advertisements with a single sendmmsg() call */
+void
+ndisc_flush(void)
+{
+	struct mmsghdr msgs[NDISC_TX_BATCH];
+	struct iovec iovs[NDISC_TX_BATCH];
+	unsigned i;
+	int ret;
+
+	if (!ndisc_tx_count)
+		return;
+
+	memset(msgs, 0, ndisc_tx_count * sizeof(msgs[0]));
+	for (i = 0; i < ndisc_tx_count; i++) {
+		iovs[i].iov_base = ndisc_tx_frame[i];
+		iovs[i].iov_len = NDISC_FRAME_LEN;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &ndisc_tx_sll[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(ndisc_tx_sll[i]);
+	}
+
+	/* Send packets */
+	ret = sendmmsg(ndisc_fd, msgs, ndisc_tx_count, 0);
+	if (ret < (int)ndisc_tx_count)
+		log_message(LOG_INFO, "VRRP: Error sending ndisc batch (%d of %u sent)",
+			    ret < 0 ? 0 : ret, ndisc_tx_count);
+
+	/* Cleanup room for next round */
+	ndisc_tx_count = 0;
+}
+
 /*
- *	Neighbour Advertisement sending routine.
+ *	Neighbour Advertisement queueing routine. Queues the cached frame
+ *	of the address into the next batch slot.
  */
 static void
-ndisc_send_na(ip_address_t *ipaddress)
+ndisc_queue_na(interface_t *ifp, ip_address_t *ipaddress)
 {
-	struct sockaddr_ll sll;
-	ssize_t len;
+	struct sockaddr_ll *sll = &ndisc_tx_sll[ndisc_tx_count];
 	char addr_str[INET6_ADDRSTRLEN] = "";
 
+	ndisc_tx_frame[ndisc_tx_count] = ipaddress->garp_frame;
+
 	/* Build the dst device */
-	memset(&sll, 0, sizeof (sll));
-	sll.sll_family = AF_PACKET;
-	memcpy(sll.sll_addr, IF_HWADDR(ipaddress->ifp), ETH_ALEN);
-	sll.sll_halen = ETHERNET_HW_LEN;
-	sll.sll_ifindex = (int)IF_INDEX(ipaddress->ifp);
+	memset(sll, 0, sizeof (*sll));
+	sll->sll_family = AF_PACKET;
+	memcpy(sll->sll_addr, IF_HWADDR(ipaddress->ifp), ETH_ALEN);
+	sll->sll_halen = ETHERNET_HW_LEN;
+	sll->sll_ifindex = (int)IF_INDEX(ipaddress->ifp);
 
 	if (__test_bit(LOG_DETAIL_BIT, &debug)) {
 		inet_ntop(AF_INET6, &ipaddress->u.sin6_addr, addr_str, sizeof(addr_str));
@@ -69,17 +109,12 @@ ndisc_send_na(ip_address_t *ipaddress)
 	
 	}
 
-	/* Send packet */
-	len = sendto(ndisc_fd, ndisc_buffer,
-		     ETHER_HDR_LEN + sizeof(struct ip6hdr) + sizeof(struct ndhdr) +
-		     sizeof(struct nd_opt_hdr) + ETH_ALEN, 0,
-		     (struct sockaddr *) &sll, sizeof (sll));
-	if (len < 0) {
-		if (!addr_str[0])
-			inet_ntop(AF_INET6, &ipaddress->u.sin6_addr, addr_str, sizeof(addr_str));
-		log_message(LOG_INFO, "VRRP: Error sending ndisc unsolicited neighbour advert on %s for %s",
-			    IF_NAME(ipaddress->ifp), addr_str);
-	}
+	if (++ndisc_tx_count == NDISC_TX_BATCH)
+		ndisc_flush();
+
+	/* If we have to delay between sending NAs, note the next time we can */
+	if (ifp->garp_delay && ifp->garp_delay->have_gna_interval)
+		ifp->garp_delay->gna_next_time = timer_add_now(ifp->garp_delay->gna_interval);
 }
 
 /*
@@ -132,18 +167,39 @@ ndisc_icmp6_cksum(const struct ip6hdr *ip6, const struct icmp6hdr *icp, uint32_t
  *	As explained in rfc4861.4.4, a node sends unsolicited
  *	Neighbor Advertisements in order to (unreliably) propagate
  *	new information quickly.
+ *
+ *	The frame is cached on the address and rebuilt only if the
+ *	router flag of the interface has changed since it was built,
+ *	so repeated bursts for the same address are memcpy free.
  */
-void
-ndisc_send_unsolicited_na_immediate(interface_t *ifp, ip_address_t *ipaddress)
+static void
+ndisc_build_na(interface_t *ifp, ip_address_t *ipaddress)
 {
-	struct ether_header *eth = (struct ether_header *) ndisc_buffer;
-	struct ip6hdr *ip6h = (struct ip6hdr *) ((char *)eth + ETHER_HDR_LEN);
-	struct ndhdr *ndh = (struct ndhdr*) ((char *)ip6h + sizeof(struct ip6hdr));
-	struct icmp6hdr *icmp6h = &ndh->icmph;
-	struct nd_opt_hdr *nd_opt_h = (struct nd_opt_hdr *) ((char *)ndh + sizeof(struct ndhdr));
-	char *nd_opt_lladdr = (char *) ((char *)nd_opt_h + sizeof(struct nd_opt_hdr));
+	char *buf;
+	struct ether_header *eth;
+	struct ip6hdr *ip6h;
+	struct ndhdr *ndh;
+	struct icmp6hdr *icmp6h;
+	struct nd_opt_hdr *nd_opt_h;
+	char *nd_opt_lladdr;
 	char *lladdr = (char *) IF_HWADDR(ipaddress->ifp);
 
+	if (ipaddress->garp_frame) {
+		if (ipaddress->na_router == ifp->gna_router)
+			return;
+		buf = ipaddress->garp_frame;
+	} else {
+		buf = (char *)MALLOC(NDISC_FRAME_LEN);
+		ipaddress->garp_frame = buf;
+	}
+
+	eth = (struct ether_header *) buf;
+	ip6h = (struct ip6hdr *) (buf + ETHER_HDR_LEN);
+	ndh = (struct ndhdr*) ((char *)ip6h + sizeof(struct ip6hdr));
+	icmp6h = &ndh->icmph;
+	nd_opt_h = (struct nd_opt_hdr *) ((char *)ndh + sizeof(struct ndhdr));
+	nd_opt_lladdr = (char *) ((char *)nd_opt_h + sizeof(struct nd_opt_hdr));
+
 	/* Ethernet header:
 	 * Destination ethernet address MUST use specific address Mapping
 	 * as specified in rfc2464.7 Address Mapping for
@@ -180,19 +236,19 @@ ndisc_send_unsolicited_na_immediate(interface_t *ifp, ip_address_t *ipaddress)
 	memcpy(nd_opt_lladdr, lladdr, ETH_ALEN);
 
 	/* Compute checksum */
+	icmp6h->icmp6_cksum = 0;
 	icmp6h->icmp6_cksum = ndisc_icmp6_cksum(ip6h, icmp6h,
 						sizeof(struct ndhdr) + sizeof(struct nd_opt_hdr) + ETH_ALEN);
 
-	/* Send the neighbor advertisement message */
-	ndisc_send_na(ipaddress);
-
-	/* Cleanup room for next round */
-	memset(ndisc_buffer, 0, ETHER_HDR_LEN + sizeof(struct ip6hdr) +
-	       sizeof(struct ndhdr) + sizeof(struct nd_opt_hdr) + ETH_ALEN);
+	ipaddress->na_router = ifp->gna_router;
+}
 
-	/* If we have to delay between sending NAs, note the next time we can */
-	if (ifp->garp_delay && ifp->garp_delay->have_gna_interval)
-		ifp->garp_delay->gna_next_time = timer_add_now(ifp->garp_delay->gna_interval);
+void
+ndisc_send_unsolicited_na_immediate(interface_t *ifp, ip_address_t *ipaddress)
+{
+	ndisc_build_na(ifp, ipaddress);
+	ndisc_queue_na(ifp, ipaddress);
+	ndisc_flush();
 }
 
 static void
@@ -229,7 +285,10 @@ ndisc_send_unsolicited_na(vrrp_t *vrrp, ip_address_t *ipaddress)
 		}
 	}
 
-	ndisc_send_unsolicited_na_immediate(ifp, ipaddress);
+	/* Queue the frame; the caller flushes the batch once all the
+	 * updates of a link update round have been built */
+	ndisc_build_na(ifp, ipaddress);
+	ndisc_queue_na(ifp, ipaddress);
 }
 
 /*
@@ -238,10 +297,6 @@ ndisc_send_unsolicited_na(vrrp_t *vrrp, ip_address_t *ipaddress)
 void
 ndisc_init(void)
 {
-	/* Initalize shared buffer */
-	ndisc_buffer = (char *) MALLOC(ETHER_HDR_LEN + sizeof(struct ip6hdr) +
-				       sizeof(struct ndhdr) + sizeof(struct nd_opt_hdr) + ETH_ALEN);
-
 	/* Create the socket descriptor */
 	ndisc_fd = socket(PF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_IPV6));
 #if !HAVE_DECL_SOCK_CLOEXEC
@@ -252,6 +307,6 @@ ndisc_init(void)
 void
 ndisc_close(void)
 {
-	FREE(ndisc_buffer);
+	ndisc_flush();
 	close(ndisc_fd);
 }
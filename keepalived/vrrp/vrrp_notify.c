@@ -151,12 +151,8 @@ notify_fifo(const char *name, int state_num, bool group, uint8_t priority)
 
 	snprintf(line, size, "%s \"%s\" %s %d\n", type, name, state, priority);
 
-	if (global_data->notify_fifo.fd != -1) {
-		if (write(global_data->notify_fifo.fd, line, strlen(line)) == -1) {}
-	}
-	if (global_data->vrrp_notify_fifo.fd != -1) {
-		if (write(global_data->vrrp_notify_fifo.fd, line, strlen(line)) == -1) {}
-	}
+	notify_fifo_write(&global_data->notify_fifo, line, strlen(line));
+	notify_fifo_write(&global_data->vrrp_notify_fifo, line, strlen(line));
 
 	FREE(line);
 }
@@ -174,7 +170,7 @@ notify_group_fifo(const vrrp_sgroup_t *vgroup, int state_num)
 }
 
 static void
-notify_script_exec(notify_script_t* script, const char *type, int state_num, char* name, int prio)
+notify_script_exec(notify_script_t* script, const char *type, int state_num, char* name, int prio, const void *key)
 {
 	const char *state = "{UNKNOWN}";
 	size_t size = 0;
@@ -224,7 +220,7 @@ notify_script_exec(notify_script_t* script, const char *type, int state_num, cha
 	new_script.uid = script->uid;
 	new_script.gid = script->gid;
 
-	notify_exec(&new_script);
+	notify_exec(&new_script, key);
 
 	FREE(new_script.name);
 }
@@ -236,16 +232,22 @@ notify_instance_exec(vrrp_t * vrrp, int state)
 	notify_script_t *gscript = get_igscript(vrrp);
 	int ret = 0;
 
+	/* Every externally meaningful transition passes through here,
+	 * so this is where the instance generation advances and the
+	 * transition flight recorder gets its slot */
+	vrrp->generation++;
+	vrrp_history_record(vrrp, state);
+
 	/* Launch the notify_* script */
 	if (script && script_open(script)) {
-		notify_exec(script);
+		notify_exec(script, vrrp);
 		ret = 1;
 	}
 
 	/* Launch the generic notify script */
 	if (gscript && script_open_literal(gscript->name)) {
 		notify_script_exec(gscript, "INSTANCE", state, vrrp->iname,
-				   vrrp->effective_priority);
+				   vrrp->effective_priority, vrrp);
 		ret = 1;
 	}
 
@@ -268,13 +270,13 @@ notify_group_exec(vrrp_sgroup_t * vgroup, int state)
 
 	/* Launch the notify_* script */
 	if (script && script_open(script)) {
-		notify_exec(script);
+		notify_exec(script, vgroup);
 		ret = 1;
 	}
 
 	/* Launch the generic notify script */
 	if (gscript && script_open_literal(gscript->name)) {
-		notify_script_exec(gscript, "GROUP", state, vgroup->gname, 0);
+		notify_script_exec(gscript, "GROUP", state, vgroup->gname, 0, vgroup);
 		ret = 1;
 	}
 
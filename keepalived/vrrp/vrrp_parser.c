@@ -323,6 +323,21 @@ vrrp_track_scr_handler(__attribute__((unused)) vector_t *strvec)
 	alloc_value_block(alloc_vrrp_track_script);
 }
 static void
+vrrp_track_bfd_handler(__attribute__((unused)) vector_t *strvec)
+{
+	alloc_value_block(alloc_vrrp_track_bfd);
+}
+static void
+vrrp_track_file_handler(__attribute__((unused)) vector_t *strvec)
+{
+	alloc_value_block(alloc_vrrp_track_file);
+}
+static void
+vrrp_track_proc_handler(__attribute__((unused)) vector_t *strvec)
+{
+	alloc_value_block(alloc_vrrp_track_process);
+}
+static void
 vrrp_dont_track_handler(__attribute__((unused)) vector_t *strvec)
 {
 	vrrp_t *vrrp = LIST_TAIL_DATA(vrrp_data->vrrp);
@@ -747,6 +762,12 @@ vrrp_vscript_fall_handler(vector_t *strvec)
 		vscript->fall = 1;
 }
 static void
+vrrp_vscript_persistent_handler(__attribute__((unused)) vector_t *strvec)
+{
+	vrrp_script_t *vscript = LIST_TAIL_DATA(vrrp_data->vrrp_script);
+	vscript->persistent = true;
+}
+static void
 vrrp_vscript_user_handler(vector_t *strvec)
 {
 	vrrp_script_t *vscript = LIST_TAIL_DATA(vrrp_data->vrrp_script);
@@ -791,6 +812,131 @@ vrrp_vscript_init_fail_handler(__attribute__((unused)) vector_t *strvec)
 	vscript->init_state = SCRIPT_INIT_STATE_FAILED;
 }
 static void
+vrrp_bfd_handler(vector_t *strvec)
+{
+	alloc_vrrp_bfd(strvec_slot(strvec, 1));
+}
+static void
+vrrp_bfd_neighbor_handler(vector_t *strvec)
+{
+	vrrp_bfd_t *bfd = LIST_TAIL_DATA(vrrp_data->vrrp_bfd);
+
+	if (inet_stosockaddr(strvec_slot(strvec, 1), 0, &bfd->nbr_addr) < 0)
+		log_message(LOG_INFO, "BFD_Instance(%s) malformed neighbor address %s"
+				    , bfd->bname, FMT_STR_VSLOT(strvec, 1));
+}
+static void
+vrrp_bfd_min_tx_handler(vector_t *strvec)
+{
+	vrrp_bfd_t *bfd = LIST_TAIL_DATA(vrrp_data->vrrp_bfd);
+
+	/* configured in milliseconds, used in microseconds */
+	bfd->min_tx = (uint32_t)strtoul(strvec_slot(strvec, 1), NULL, 10) * 1000;
+	if (bfd->min_tx < 1000)
+		bfd->min_tx = 1000;
+}
+static void
+vrrp_bfd_min_rx_handler(vector_t *strvec)
+{
+	vrrp_bfd_t *bfd = LIST_TAIL_DATA(vrrp_data->vrrp_bfd);
+
+	bfd->min_rx = (uint32_t)strtoul(strvec_slot(strvec, 1), NULL, 10) * 1000;
+	if (bfd->min_rx < 1000)
+		bfd->min_rx = 1000;
+}
+static void
+vrrp_bfd_multiplier_handler(vector_t *strvec)
+{
+	vrrp_bfd_t *bfd = LIST_TAIL_DATA(vrrp_data->vrrp_bfd);
+
+	bfd->multiplier = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10);
+	if (bfd->multiplier < 1 || bfd->multiplier > 255) {
+		log_message(LOG_INFO, "BFD_Instance(%s) multiplier must be between [1..255]"
+				      " inclusive, using %d", bfd->bname, BFD_DEFAULT_MULT);
+		bfd->multiplier = BFD_DEFAULT_MULT;
+	}
+}
+static void
+vrrp_bfd_weight_handler(vector_t *strvec)
+{
+	vrrp_bfd_t *bfd = LIST_TAIL_DATA(vrrp_data->vrrp_bfd);
+
+	bfd->weight = atoi(strvec_slot(strvec, 1));
+}
+static void
+vrrp_bfd_end_handler(void)
+{
+	vrrp_bfd_t *bfd = LIST_TAIL_DATA(vrrp_data->vrrp_bfd);
+
+	if (!bfd->nbr_addr.ss_family) {
+		log_message(LOG_INFO, "No neighbor_ip set for bfd_instance %s - removing", bfd->bname);
+		free_list_element(vrrp_data->vrrp_bfd, vrrp_data->vrrp_bfd->tail);
+	}
+}
+static void
+vrrp_tfile_handler(vector_t *strvec)
+{
+	alloc_vrrp_file(strvec_slot(strvec, 1));
+}
+static void
+vrrp_tfile_file_handler(vector_t *strvec)
+{
+	vrrp_file_t *tfile = LIST_TAIL_DATA(vrrp_data->vrrp_file);
+	tfile->file_path = set_value(strvec);
+}
+static void
+vrrp_tfile_weight_handler(vector_t *strvec)
+{
+	vrrp_file_t *tfile = LIST_TAIL_DATA(vrrp_data->vrrp_file);
+	tfile->weight = atoi(strvec_slot(strvec, 1));
+}
+static void
+vrrp_tfile_end_handler(void)
+{
+	vrrp_file_t *tfile = LIST_TAIL_DATA(vrrp_data->vrrp_file);
+
+	if (!tfile->file_path) {
+		log_message(LOG_INFO, "No file set for track_file %s - removing", tfile->fname);
+		free_list_element(vrrp_data->vrrp_file, vrrp_data->vrrp_file->tail);
+	}
+}
+static void
+vrrp_tproc_handler(vector_t *strvec)
+{
+	alloc_vrrp_process(strvec_slot(strvec, 1));
+}
+static void
+vrrp_tproc_process_handler(vector_t *strvec)
+{
+	vrrp_process_t *vprocess = LIST_TAIL_DATA(vrrp_data->vrrp_process);
+	vprocess->proc_name = set_value(strvec);
+}
+static void
+vrrp_tproc_quorum_handler(vector_t *strvec)
+{
+	vrrp_process_t *vprocess = LIST_TAIL_DATA(vrrp_data->vrrp_process);
+
+	vprocess->quorum = (unsigned)strtoul(strvec_slot(strvec, 1), NULL, 10);
+	if (vprocess->quorum < 1)
+		vprocess->quorum = 1;
+}
+static void
+vrrp_tproc_weight_handler(vector_t *strvec)
+{
+	vrrp_process_t *vprocess = LIST_TAIL_DATA(vrrp_data->vrrp_process);
+	vprocess->weight = atoi(strvec_slot(strvec, 1));
+}
+static void
+vrrp_tproc_end_handler(void)
+{
+	vrrp_process_t *vprocess = LIST_TAIL_DATA(vrrp_data->vrrp_process);
+
+	if (!vprocess->proc_name) {
+		log_message(LOG_INFO, "No process set for track_process %s - removing", vprocess->pname);
+		free_list_element(vrrp_data->vrrp_process, vrrp_data->vrrp_process->tail);
+	}
+}
+static void
 vrrp_version_handler(vector_t *strvec)
 {
 	vrrp_t *vrrp = LIST_TAIL_DATA(vrrp_data->vrrp);
@@ -827,6 +973,14 @@ vrrp_no_accept_handler(__attribute__((unused)) vector_t *strvec)
 	vrrp->accept = false;
 }
 
+static void
+vrrp_optimistic_dad_handler(__attribute__((unused)) vector_t *strvec)
+{
+	vrrp_t *vrrp = LIST_TAIL_DATA(vrrp_data->vrrp);
+
+	vrrp->optimistic_dad = true;
+}
+
 static void
 garp_group_handler(__attribute__((unused)) vector_t *strvec)
 {
@@ -919,7 +1073,7 @@ garp_group_interfaces_handler(vector_t *strvec)
 		ifp->garp_delay = delay;
 	}
 
-	free_strvec(interface_vec);
+	free_value_block(interface_vec);
 }
 
 void
@@ -963,6 +1117,9 @@ init_vrrp_keywords(bool active)
 	install_keyword("dont_track_primary", &vrrp_dont_track_handler);
 	install_keyword("track_interface", &vrrp_track_int_handler);
 	install_keyword("track_script", &vrrp_track_scr_handler);
+	install_keyword("track_bfd", &vrrp_track_bfd_handler);
+	install_keyword("track_file", &vrrp_track_file_handler);
+	install_keyword("track_process", &vrrp_track_proc_handler);
 	install_keyword("mcast_src_ip", &vrrp_srcip_handler);
 	install_keyword("unicast_src_ip", &vrrp_srcip_handler);
 	install_keyword("virtual_router_id", &vrrp_vrid_handler);
@@ -978,6 +1135,7 @@ init_vrrp_keywords(bool active)
 #endif
 	install_keyword("accept", &vrrp_accept_handler);
 	install_keyword("no_accept", &vrrp_no_accept_handler);
+	install_keyword("optimistic_dad", &vrrp_optimistic_dad_handler);
 	install_keyword("skip_check_adv_addr", &vrrp_skip_check_adv_addr_handler);
 	install_keyword("strict_mode", &vrrp_strict_mode_handler);
 	install_keyword("preempt", &vrrp_preempt_handler);
@@ -1015,9 +1173,26 @@ init_vrrp_keywords(bool active)
 	install_keyword("weight", &vrrp_vscript_weight_handler);
 	install_keyword("rise", &vrrp_vscript_rise_handler);
 	install_keyword("fall", &vrrp_vscript_fall_handler);
+	install_keyword("persistent", &vrrp_vscript_persistent_handler);
 	install_keyword("user", &vrrp_vscript_user_handler);
 	install_keyword("init_fail", &vrrp_vscript_init_fail_handler);
 	install_sublevel_end_handler(&vrrp_vscript_end_handler);
+	install_keyword_root("bfd_instance", &vrrp_bfd_handler, active);
+	install_keyword("neighbor_ip", &vrrp_bfd_neighbor_handler);
+	install_keyword("min_tx", &vrrp_bfd_min_tx_handler);
+	install_keyword("min_rx", &vrrp_bfd_min_rx_handler);
+	install_keyword("multiplier", &vrrp_bfd_multiplier_handler);
+	install_keyword("weight", &vrrp_bfd_weight_handler);
+	install_sublevel_end_handler(&vrrp_bfd_end_handler);
+	install_keyword_root("track_file", &vrrp_tfile_handler, active);
+	install_keyword("file", &vrrp_tfile_file_handler);
+	install_keyword("weight", &vrrp_tfile_weight_handler);
+	install_sublevel_end_handler(&vrrp_tfile_end_handler);
+	install_keyword_root("track_process", &vrrp_tproc_handler, active);
+	install_keyword("process", &vrrp_tproc_process_handler);
+	install_keyword("quorum", &vrrp_tproc_quorum_handler);
+	install_keyword("weight", &vrrp_tproc_weight_handler);
+	install_sublevel_end_handler(&vrrp_tproc_end_handler);
 }
 
 vector_t *
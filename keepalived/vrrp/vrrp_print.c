@@ -37,10 +37,18 @@
 #include "rttables.h"
 #include "logger.h"
 #include "vrrp_if.h"
+#include "global_data.h"
+#include "scheduler.h"
 
 #include <time.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 static void
 vrrp_print_list(FILE *file, list l, void (*fptr)(FILE*, void*))
@@ -64,6 +72,9 @@ vgroup_print(FILE *file, void *data)
 		str = vector_slot(vgroup->iname, i);
 		fprintf(file, "   monitor = %s\n", str);
 	}
+	fprintf(file, "   Member states = %u master, %u fault, %u wanting master\n",
+		vgroup->num_member_master, vgroup->num_member_fault,
+		vgroup->num_member_wantmaster);
 	if (vgroup->script_backup)
 		fprintf(file, "   Backup state transition script = %s, uid:gid %d:%d\n",
 		       vgroup->script_backup->name, vgroup->script_backup->uid, vgroup->script_backup->gid);
@@ -297,6 +308,8 @@ vrrp_print(FILE *file, void *data)
 	if (vrrp->state == VRRP_STATE_BACK && vrrp->version == VRRP_VERSION_3)
 		fprintf(file, "   Master advert interval = %d milli-sec", vrrp->master_adver_int / (TIMER_HZ / 1000));
 	fprintf(file, "   Accept = %s\n", vrrp->accept ? "enabled" : "disabled");
+	if (vrrp->optimistic_dad)
+		fprintf(file, "   Using optimistic DAD for IPv6 VIPs\n");
 	fprintf(file, "   Preempt = %s\n", vrrp->nopreempt ? "disabled" : "enabled");
 	fprintf(file, "   Promote_secondaries = %s\n", vrrp->promote_secondaries ? "enabled" : "disabled");
 	if (vrrp->preempt_delay)
@@ -378,6 +391,123 @@ vrrp_print(FILE *file, void *data)
 			fprintf(file, "   Using smtp notification\n");
 }
 
+/* Fingerprint of everything volatile that appears in an instance dump.
+ * The rest of the output only changes on a configuration reload, which
+ * recreates the vrrp_t and so starts with an empty fragment cache. */
+static uint64_t
+vrrp_dump_csum(vrrp_t *vrrp)
+{
+	uint64_t csum = 0xcbf29ce484222325ULL;
+	tracked_sc_t *tsc;
+	tracked_if_t *tip;
+	const uint8_t *p;
+	element e;
+	size_t i;
+
+#define CSUM_FIELD(f)	do {						\
+		for (p = (const uint8_t *)&(f), i = 0; i < sizeof(f); i++) \
+			csum = (csum ^ p[i]) * 0x100000001b3ULL;	\
+	} while (0)
+
+	CSUM_FIELD(vrrp->state);
+	CSUM_FIELD(vrrp->effective_priority);
+	CSUM_FIELD(vrrp->master_priority);
+	CSUM_FIELD(vrrp->master_saddr);
+	CSUM_FIELD(vrrp->master_adver_int);
+	CSUM_FIELD(vrrp->saddr);
+	CSUM_FIELD(vrrp->last_transition);
+
+	if (!LIST_ISEMPTY(vrrp->track_ifp)) {
+		for (e = LIST_HEAD(vrrp->track_ifp); e; ELEMENT_NEXT(e)) {
+			tip = ELEMENT_DATA(e);
+			CSUM_FIELD(tip->ifp->flags);
+		}
+	}
+	if (!LIST_ISEMPTY(vrrp->track_script)) {
+		for (e = LIST_HEAD(vrrp->track_script); e; ELEMENT_NEXT(e)) {
+			tsc = ELEMENT_DATA(e);
+			CSUM_FIELD(tsc->scr->init_state);
+			CSUM_FIELD(tsc->scr->result);
+		}
+	}
+#undef CSUM_FIELD
+
+	return csum;
+}
+
+/* Write an instance dump from its cached fragment, re-rendering the
+ * fragment only when the state it reflects has changed */
+static void
+vrrp_print_cached(FILE *file, void *data)
+{
+	vrrp_t *vrrp = data;
+	uint64_t csum = vrrp_dump_csum(vrrp);
+	FILE *stream;
+
+	if (!vrrp->dump_buf || vrrp->dump_csum != csum) {
+		/* open_memstream() allocates the buffer with malloc(),
+		 * so it is released with free() rather than FREE() */
+		if (vrrp->dump_buf) {
+			free(vrrp->dump_buf);
+			vrrp->dump_buf = NULL;
+		}
+
+		if (!(stream = open_memstream(&vrrp->dump_buf, &vrrp->dump_len))) {
+			/* Render straight to the target */
+			vrrp_print(file, vrrp);
+			return;
+		}
+
+		vrrp_print(stream, vrrp);
+		fclose(stream);
+		vrrp->dump_csum = csum;
+	}
+
+	fwrite(vrrp->dump_buf, 1, vrrp->dump_len, file);
+}
+
+static void
+vrrp_print_all(FILE *file)
+{
+	fprintf(file, "------< VRRP Topology >------\n");
+	vrrp_print_list(file, vrrp_data->vrrp, &vrrp_print_cached);
+
+	if (!LIST_ISEMPTY(vrrp_data->vrrp_sync_group)) {
+		fprintf(file, "------< VRRP Sync groups >------\n");
+		vrrp_print_list(file, vrrp_data->vrrp_sync_group, &vgroup_print);
+	}
+
+	print_interface_list(file);
+
+	mem_ctx_print(file);
+}
+
+/* Run one dump function in a forked child. The child inherits a
+ * copy-on-write snapshot of the whole state, formats and writes it at
+ * leisure and exits, so the VRRP process is back to processing adverts
+ * in the time a fork takes, however large the configuration. The
+ * scheduler's SIGCHLD handler reaps pids it is not waiting on. */
+void
+vrrp_dump_in_child(void (*dump) (void))
+{
+	pid_t pid = fork();
+
+	if (pid == -1) {
+		log_message(LOG_INFO, "Unable to fork for state dump (%s) - dumping inline",
+			    strerror(errno));
+		(*dump) ();
+		return;
+	}
+
+	if (pid > 0)
+		return;
+
+	/* Child. Exit without running the parent's cleanup handlers or
+	 * flushing its inherited stdio buffers. */
+	(*dump) ();
+	_exit(EXIT_SUCCESS);
+}
+
 void
 vrrp_print_data(void)
 {
@@ -390,19 +520,98 @@ vrrp_print_data(void)
 		return;
 	}
 
-	fprintf(file, "------< VRRP Topology >------\n");
-	vrrp_print_list(file, vrrp_data->vrrp, &vrrp_print);
+	vrrp_print_all(file);
 
-	if (!LIST_ISEMPTY(vrrp_data->vrrp_sync_group)) {
-		fprintf(file, "------< VRRP Sync groups >------\n");
-		vrrp_print_list(file, vrrp_data->vrrp_sync_group, &vgroup_print);
-	}
+	fclose(file);
 
-	print_interface_list(file);
+	clear_rt_names();
+}
+
+/* On-demand dump socket. Each connection receives the current state
+ * dump, streamed straight from the fragment cache - no temporary file */
+static int dump_sock = -1;
+
+static int
+vrrp_dump_accept_thread(thread_t *thread)
+{
+	struct timeval snd_timeo = { .tv_sec = 1, .tv_usec = 0 };
+	FILE *file;
+	int fd;
 
+	if (thread->type == THREAD_READ_TIMEOUT)
+		return 0;
+
+	fd = accept(dump_sock, NULL, NULL);
+
+	/* Wait for the next connection */
+	thread_add_read(master, vrrp_dump_accept_thread, NULL, dump_sock, TIMER_NEVER);
+
+	if (fd < 0)
+		return 0;
+
+	/* Don't let a stalled reader block the VRRP process */
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd_timeo, sizeof(snd_timeo));
+
+	if (!(file = fdopen(fd, "w"))) {
+		close(fd);
+		return 0;
+	}
+
+	vrrp_print_all(file);
 	fclose(file);
 
 	clear_rt_names();
+
+	return 0;
+}
+
+void
+vrrp_dump_socket_init(void)
+{
+	struct sockaddr_un addr;
+
+	if (!global_data->vrrp_dump_socket || dump_sock != -1)
+		return;
+
+	if (strlen(global_data->vrrp_dump_socket) >= sizeof(addr.sun_path)) {
+		log_message(LOG_INFO, "Dump socket path %s too long - ignoring", global_data->vrrp_dump_socket);
+		return;
+	}
+
+	if ((dump_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		log_message(LOG_INFO, "Unable to create dump socket (%s)", strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, global_data->vrrp_dump_socket);
+
+	/* Remove any socket left over from a previous invocation */
+	unlink(addr.sun_path);
+
+	if (bind(dump_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(dump_sock, 2) == -1) {
+		log_message(LOG_INFO, "Unable to bind dump socket %s (%s)", addr.sun_path, strerror(errno));
+		close(dump_sock);
+		dump_sock = -1;
+		return;
+	}
+
+	thread_add_read(master, vrrp_dump_accept_thread, NULL, dump_sock, TIMER_NEVER);
+}
+
+void
+vrrp_dump_socket_close(void)
+{
+	if (dump_sock == -1)
+		return;
+
+	close(dump_sock);
+	dump_sock = -1;
+
+	if (global_data->vrrp_dump_socket)
+		unlink(global_data->vrrp_dump_socket);
 }
 
 void
@@ -451,6 +660,39 @@ vrrp_print_stats(void)
 		fprintf(file, "  Priority Zero:\n");
 		fprintf(file, "    Received: %" PRIu64 "\n", vrrp->stats->pri_zero_rcvd);
 		fprintf(file, "    Sent: %" PRIu64 "\n", vrrp->stats->pri_zero_sent);
+#ifdef _VRRP_LATENCY_STATS_
+		fprintf(file, "  Advert Timer Jitter:\n");
+		fprintf(file, "    Samples: %" PRIu64 "\n", vrrp->stats->jitter_count);
+		fprintf(file, "    Average: %" PRIu64 "us\n",
+			vrrp->stats->jitter_count ?
+			vrrp->stats->jitter_usec_total / vrrp->stats->jitter_count : 0);
+		fprintf(file, "    Max: %uus\n", vrrp->stats->jitter_max_usec);
+		fprintf(file, "    Histogram: <100us %u, <500us %u, <1ms %u, <5ms %u,"
+			      " <10ms %u, <30ms %u, >=30ms %u\n",
+			vrrp->stats->jitter_hist[0], vrrp->stats->jitter_hist[1],
+			vrrp->stats->jitter_hist[2], vrrp->stats->jitter_hist[3],
+			vrrp->stats->jitter_hist[4], vrrp->stats->jitter_hist[5],
+			vrrp->stats->jitter_hist[6]);
+		fprintf(file, "  Advert Inter-arrival Lateness:\n");
+		fprintf(file, "    Samples: %" PRIu64 "\n",
+			vrrp->stats->interarrival_count);
+		fprintf(file, "    Average: %" PRIu64 "us\n",
+			vrrp->stats->interarrival_count ?
+			vrrp->stats->interarrival_late_total / vrrp->stats->interarrival_count : 0);
+		fprintf(file, "    Max: %uus\n", vrrp->stats->interarrival_max_usec);
+		fprintf(file, "    Histogram: <100us %u, <500us %u, <1ms %u, <5ms %u,"
+			      " <10ms %u, <30ms %u, >=30ms %u\n",
+			vrrp->stats->interarrival_hist[0], vrrp->stats->interarrival_hist[1],
+			vrrp->stats->interarrival_hist[2], vrrp->stats->interarrival_hist[3],
+			vrrp->stats->interarrival_hist[4], vrrp->stats->interarrival_hist[5],
+			vrrp->stats->interarrival_hist[6]);
+#endif
 	}
+
+	fprintf(file, "Scheduler:\n");
+	fprintf(file, "  Max ready backlog: %u\n", master->ready_depth_max);
+	fprintf(file, "  Polls forced by drain budget: %" PRIu64 "\n",
+		master->ready_budget_polls);
+
 	fclose(file);
 }
@@ -0,0 +1,416 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Process tracking framework. Subscribes to the kernel
+ *              proc connector and maintains a running count per tracked
+ *              process name, feeding the VRRP tracking paths - the
+ *              event-driven replacement for "pgrep daemon" vrrp_script
+ *              entries, with no polling at all.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+/* local include */
+#include "vrrp_process.h"
+#include "vrrp_data.h"
+#include "scheduler.h"
+#include "memory.h"
+#include "list.h"
+#include "logger.h"
+
+/* The proc connector reports exits by pid only, so remember which pids
+ * we counted for which tracked process */
+typedef struct _tracked_pid {
+	pid_t			pid;
+	vrrp_process_t		*process;
+} tracked_pid_t;
+
+static int proc_fd = -1;
+static thread_t *proc_reader;
+static list proc_pids;
+
+static int proc_read_thread(thread_t *);
+
+static void
+free_tracked_pid(void *data)
+{
+	FREE(data);
+}
+
+/* Read the comm (short command name) of a pid; returns false once the
+ * process is already gone */
+static bool
+proc_get_comm(pid_t pid, char *comm, size_t len)
+{
+	char path[32];
+	ssize_t rlen;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	rlen = read(fd, comm, len - 1);
+	close(fd);
+	if (rlen <= 0)
+		return false;
+	if (comm[rlen - 1] == '\n')
+		rlen--;
+	comm[rlen] = '\0';
+	return true;
+}
+
+static void
+vrrp_process_log(vrrp_process_t *vprocess)
+{
+	log_message(LOG_INFO, "VRRP_Process(%s) %u of %u required %s running"
+			    , vprocess->pname, vprocess->count, vprocess->quorum
+			    , vprocess->proc_name);
+}
+
+/* A pid running one of the tracked names appeared */
+static void
+proc_pid_added(pid_t pid, bool log_change)
+{
+	char comm[32];
+	element e;
+	vrrp_process_t *vprocess;
+	tracked_pid_t *tpid;
+
+	if (!proc_get_comm(pid, comm, sizeof(comm)))
+		return;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_process); e; ELEMENT_NEXT(e)) {
+		vprocess = ELEMENT_DATA(e);
+		if (strcmp(vprocess->proc_name, comm))
+			continue;
+
+		tpid	      = (tracked_pid_t *) MALLOC(sizeof(tracked_pid_t));
+		tpid->pid     = pid;
+		tpid->process = vprocess;
+		list_add(proc_pids, tpid);
+
+		vprocess->count++;
+		if (log_change && vprocess->count == vprocess->quorum)
+			vrrp_process_log(vprocess);
+	}
+}
+
+/* An exec may rename a pid we already counted - forget the old
+ * identity before re-evaluating the new one */
+static void
+proc_pid_removed(pid_t pid, bool log_change)
+{
+	element e, next;
+	tracked_pid_t *tpid;
+	vrrp_process_t *vprocess;
+
+	for (e = LIST_HEAD(proc_pids); e; e = next) {
+		next = e->next;
+		tpid = ELEMENT_DATA(e);
+		if (tpid->pid != pid)
+			continue;
+
+		vprocess = tpid->process;
+		vprocess->count--;
+		if (log_change && vprocess->count == vprocess->quorum - 1)
+			vrrp_process_log(vprocess);
+		free_list_element(proc_pids, e);
+	}
+}
+
+/* Drain the connector socket. Thread events are filtered out - only
+ * thread group leaders are counted, matching what pgrep reports. */
+static int
+proc_read_thread(thread_t *thread)
+{
+	char rbuf[4096] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	struct nlmsghdr *nlh;
+	struct cn_msg *cn;
+	struct proc_event *ev;
+	ssize_t len;
+
+	while ((len = recv(thread->u.fd, rbuf, sizeof(rbuf), 0)) > 0) {
+		for (nlh = (struct nlmsghdr *) rbuf; NLMSG_OK(nlh, (size_t) len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type != NLMSG_DONE)
+				continue;
+			cn = NLMSG_DATA(nlh);
+			ev = (struct proc_event *) cn->data;
+
+			switch (ev->what) {
+			case PROC_EVENT_FORK:
+				if (ev->event_data.fork.child_pid ==
+				    ev->event_data.fork.child_tgid)
+					proc_pid_added(ev->event_data.fork.child_tgid, true);
+				break;
+			case PROC_EVENT_EXEC:
+				if (ev->event_data.exec.process_pid ==
+				    ev->event_data.exec.process_tgid) {
+					proc_pid_removed(ev->event_data.exec.process_tgid, true);
+					proc_pid_added(ev->event_data.exec.process_tgid, true);
+				}
+				break;
+			case PROC_EVENT_EXIT:
+				if (ev->event_data.exit.process_pid ==
+				    ev->event_data.exit.process_tgid)
+					proc_pid_removed(ev->event_data.exit.process_tgid, true);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	proc_reader = thread_add_read(master, proc_read_thread, NULL,
+				      thread->u.fd, TIMER_NEVER);
+	return 0;
+}
+
+/* Prime the counts from the processes already running */
+static void
+proc_scan(void)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char *endptr;
+	long pid;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return;
+
+	while ((ent = readdir(dir))) {
+		pid = strtol(ent->d_name, &endptr, 10);
+		if (*endptr || pid <= 0)
+			continue;
+		proc_pid_added((pid_t) pid, false);
+	}
+	closedir(dir);
+}
+
+/* Subscribe to the proc connector and take the initial census */
+void
+vrrp_process_init(list l)
+{
+	struct sockaddr_nl snl;
+	struct {
+		struct nlmsghdr nlh;
+		struct cn_msg cn;
+		enum proc_cn_mcast_op op;
+	} req;
+	element e;
+	vrrp_process_t *vprocess;
+
+	if (proc_fd == -1) {
+		proc_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+				 NETLINK_CONNECTOR);
+		if (proc_fd == -1) {
+			log_message(LOG_INFO, "proc connector socket error %d (%m)", errno);
+			return;
+		}
+		fcntl(proc_fd, F_SETFL, O_NONBLOCK | fcntl(proc_fd, F_GETFL));
+
+		memset(&snl, 0, sizeof(snl));
+		snl.nl_family = AF_NETLINK;
+		snl.nl_groups = CN_IDX_PROC;
+		if (bind(proc_fd, (struct sockaddr *) &snl, sizeof(snl)) < 0) {
+			log_message(LOG_INFO, "proc connector bind error %d (%m)", errno);
+			close(proc_fd);
+			proc_fd = -1;
+			return;
+		}
+
+		memset(&req, 0, sizeof(req));
+		req.nlh.nlmsg_len = sizeof(req);
+		req.nlh.nlmsg_type = NLMSG_DONE;
+		req.cn.id.idx = CN_IDX_PROC;
+		req.cn.id.val = CN_VAL_PROC;
+		req.cn.len = sizeof(req.op);
+		req.op = PROC_CN_MCAST_LISTEN;
+		if (send(proc_fd, &req, sizeof(req), 0) < 0) {
+			log_message(LOG_INFO, "proc connector subscribe error %d (%m)", errno);
+			close(proc_fd);
+			proc_fd = -1;
+			return;
+		}
+
+		proc_reader = thread_add_read(master, proc_read_thread, NULL,
+					      proc_fd, TIMER_NEVER);
+	}
+
+	proc_pids = alloc_list(free_tracked_pid, NULL);
+	proc_scan();
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		vprocess = ELEMENT_DATA(e);
+		vrrp_process_log(vprocess);
+	}
+}
+
+/* Unsubscribe and drop the pid table. Its read thread went with the
+ * master thread; the census is re-taken on init. */
+void
+vrrp_process_close(void)
+{
+	if (proc_fd != -1) {
+		close(proc_fd);
+		proc_fd = -1;
+	}
+	proc_reader = NULL;
+	free_list(&proc_pids);
+}
+
+void
+free_vrrp_process(void *data)
+{
+	vrrp_process_t *vprocess = data;
+
+	FREE(vprocess->pname);
+	FREE_PTR(vprocess->proc_name);
+	FREE(vprocess);
+}
+
+void
+dump_vrrp_process(void *data)
+{
+	vrrp_process_t *vprocess = data;
+
+	log_message(LOG_INFO, " VRRP Track process = %s", vprocess->pname);
+	log_message(LOG_INFO, "   Process = %s", vprocess->proc_name);
+	log_message(LOG_INFO, "   Quorum = %u", vprocess->quorum);
+	log_message(LOG_INFO, "   Weight = %d", vprocess->weight);
+	log_message(LOG_INFO, "   Running = %u", vprocess->count);
+}
+
+vrrp_process_t *
+find_process_by_name(char *name)
+{
+	element e;
+	vrrp_process_t *vprocess;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp_process))
+		return NULL;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_process); e; ELEMENT_NEXT(e)) {
+		vprocess = ELEMENT_DATA(e);
+		if (!strcmp(vprocess->pname, name))
+			return vprocess;
+	}
+	return NULL;
+}
+
+/* Track process dump */
+void
+dump_track_process(void *track_data)
+{
+	tracked_process_t *tpr = track_data;
+	log_message(LOG_INFO, "     %s weight %d", tpr->process->pname, tpr->weight);
+}
+
+void
+alloc_track_process(list track_list, vector_t *strvec, const char *vrrp_iname)
+{
+	vrrp_process_t *vprocess = NULL;
+	tracked_process_t *tpr = NULL;
+	int weight = 0;
+	char *tracked = strvec_slot(strvec, 0);
+
+	vprocess = find_process_by_name(tracked);
+
+	/* Ignoring if no process found */
+	if (!vprocess) {
+		log_message(LOG_INFO, "(%s): track process %s not found, ignoring...", vrrp_iname, tracked);
+		return;
+	}
+
+	/* default weight */
+	weight = vprocess->weight;
+
+	if (vector_size(strvec) >= 3 &&
+	    !strcmp(strvec_slot(strvec, 1), "weight")) {
+		weight = atoi(strvec_slot(strvec, 2));
+		if (weight < -254 || weight > 254) {
+			weight = vprocess->weight;
+			log_message(LOG_INFO, "(%s): track process %s: weight must be between [-254..254]"
+					 " inclusive, ignoring...",
+			       vrrp_iname, tracked);
+		}
+	}
+
+	tpr	     = (tracked_process_t *) MALLOC(sizeof(tracked_process_t));
+	tpr->process = vprocess;
+	tpr->weight  = weight;
+	list_add(track_list, tpr);
+}
+
+/* Test if all tracked processes are either at quorum or weight-tracked */
+int
+vrrp_process_up(list l)
+{
+	element e;
+	tracked_process_t *tpr;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tpr = ELEMENT_DATA(e);
+		if (!tpr->weight && !PROCESS_ISUP(tpr->process))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Returns total weights of all tracked processes :
+ * - a positive weight adds to the global weight at quorum
+ * - a negative weight subtracts from the global weight below it
+ *
+ */
+int
+vrrp_process_weight(list l)
+{
+	element e;
+	tracked_process_t *tpr;
+	int weight = 0;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		tpr = ELEMENT_DATA(e);
+		if (PROCESS_ISUP(tpr->process)) {
+			if (tpr->weight > 0)
+				weight += tpr->weight;
+		} else {
+			if (tpr->weight < 0)
+				weight += tpr->weight;
+		}
+	}
+
+	return weight;
+}
@@ -32,6 +32,7 @@
 #endif
 #include "vrrp.h"
 #include "vrrp_sync.h"
+#include "vrrp_handoff.h"
 #include "vrrp_notify.h"
 #include "keepalived_netlink.h"
 #include "vrrp_data.h"
@@ -55,12 +56,49 @@
 #include "vrrp_snmp.h"
 #endif
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <stdint.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <sys/mman.h>
 
 /* global vars */
 timeval_t garp_next_time;
 thread_t *garp_thread;
 
+/* Consolidated gratuitous ARP refresh. Instead of every MASTER
+ * instance firing its own refresh burst from its advert timer, one
+ * thread wakes on whole-second ticks and fires every refresh due in
+ * that tick, so hundreds of instances yield a few paced batches
+ * rather than scattered micro-bursts all day. */
+static thread_t *garp_refresh_thread;
+static long garp_bucket_tokens;		/* frames the refresh rate cap lets us send now */
+static timeval_t garp_bucket_stamp;	/* last time the bucket was refilled */
+
+/* Advert transmit aggregation. The flush runs as a low priority zero
+ * delay timer, so it only fires once all the dispatcher threads that
+ * became ready in the same scheduler wakeup have queued their adverts. */
+static thread_t *adv_flush_thread;
+
+/* PACKET_RX_RING receive engine. The kernel writes incoming adverts
+ * straight into a mmap()ed ring shared with us; the dispatcher walks
+ * the ready blocks in place and feeds frame pointers to the protocol
+ * handler, so a high advert rate costs neither a copy nor a syscall
+ * per packet. Opened per read socket when vrrp_rx_ring is configured,
+ * falling back silently to the plain socket path when unavailable. */
+#define VRRP_RING_BLOCK_SIZE	(1U << 16)
+#define VRRP_RING_BLOCK_NR	16U
+#define VRRP_RING_FRAME_SIZE	2048U
+#define VRRP_RING_BLOCK_TOV	10U	/* ms before a part-filled block is retired */
+
+typedef struct _vrrp_ring {
+	int		fd;		/* bound AF_PACKET socket */
+	char		*map;		/* the shared block ring */
+	size_t		map_len;
+	unsigned	block;		/* next block to reap */
+} vrrp_ring_t;
+
 /* VRRP FSM (Finite State Machine) design.
  *
  * The state transition diagram implemented is :
@@ -97,6 +135,8 @@ static void vrrp_fault(vrrp_t *);
 static int vrrp_update_priority(thread_t * thread);
 static int vrrp_script_child_thread(thread_t * thread);
 static int vrrp_script_thread(thread_t * thread);
+static int vrrp_script_stream_thread(thread_t * thread);
+static int vrrp_script_stream_child_thread(thread_t * thread);
 
 static int vrrp_read_dispatcher_thread(thread_t *);
 
@@ -316,6 +356,22 @@ vrrp_init_state(list l)
 	}
 }
 
+/* Deterministic per-instance phase within one advert interval. A hash
+ * of the instance identity, so both routers of a pair compute the same
+ * offset and their relative timing is unchanged. */
+static uint64_t
+vrrp_stagger_phase(const vrrp_t *vrrp)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const char *p;
+
+	for (p = vrrp->iname; *p; p++)
+		h = (h ^ (uint8_t)*p) * 0x100000001b3ULL;
+	h = (h ^ vrrp->vrid) * 0x100000001b3ULL;
+
+	return h % vrrp->adver_int;
+}
+
 static void
 vrrp_init_sands(list l)
 {
@@ -325,6 +381,18 @@ vrrp_init_sands(list l)
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vrrp = ELEMENT_DATA(e);
 		vrrp_init_instance_sands(vrrp);
+
+		/* Spread the first expiries across one advert interval so
+		 * thousands of instances don't elect in the same few ticks,
+		 * bursting adverts, garps, netlink programming and notify
+		 * scripts all at once. The one-time delay is well inside
+		 * the 3x master down timer, and instances that kept their
+		 * VIPs across a reload are left on their cadence. */
+		if (!vrrp->vipset) {
+			vrrp->sands += vrrp_stagger_phase(vrrp);
+			if (vrrp->sands_hot)
+				*vrrp->sands_hot = vrrp->sands;
+		}
 	}
 }
 
@@ -336,7 +404,6 @@ vrrp_init_script(list l)
 {
 	vrrp_script_t *vscript;
 	element e;
-	size_t num_active_scripts = 0;
 
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		vscript = ELEMENT_DATA(e);
@@ -364,81 +431,93 @@ vrrp_init_script(list l)
 			}
 
 			thread_add_event(master, vrrp_script_thread, vscript, (int)vscript->interval);
-
-			num_active_scripts++;
 		}
-	}
-
-	if (num_active_scripts)
-		set_child_finder(DEFAULT_CHILD_FINDER, NULL, NULL, NULL, NULL, num_active_scripts);
 
+		/* Fold the initial state into the subscribed instances */
+		vrrp_script_tracker_update(vscript);
+	}
 }
 
 /* Timer functions */
-static timeval_t
-vrrp_compute_timer(const int fd)
+
+/* (Re)build each socket's contiguous timer-scan arrays. The per-tick
+ * scans used to walk the fd index hlist, pulling a cache line of cold
+ * vrrp_t configuration for every instance just to compare one sands
+ * value; with 2000 instances that scan is cache-miss-bound. Here each
+ * instance gets one slot in its socket's packed sands array - scanned
+ * as a stream - and the cold vrrp_t is only touched for the entry that
+ * actually expires. */
+static void
+vrrp_build_hot_arrays(list l)
 {
+	sock_t *sock;
 	vrrp_t *vrrp;
+	hlist_node_t *n;
 	element e;
-	list l = &vrrp_data->vrrp_index_fd[fd%1024 + 1];
-	timeval_t timer;
-	timer_reset(timer);
+	unsigned count;
 
-	/*
-	 * If list size's is 1 then no collisions. So
-	 * Test and return the singleton.
-	 */
-	if (LIST_SIZE(l) == 1) {
-		vrrp = ELEMENT_DATA(LIST_HEAD(l));
-			return vrrp->sands;
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		sock = ELEMENT_DATA(e);
+
+		/* The fd index buckets can be shared between sockets,
+		 * so count this socket's instances only */
+		count = 0;
+		hlist_for_each_entry(vrrp, n, &vrrp_data->vrrp_index_fd[sock->fd_in%1024 + 1], index_fd_node) {
+			if (vrrp->fd_in == sock->fd_in)
+				count++;
+		}
+
+		FREE_PTR(sock->hot_sands);
+		FREE_PTR(sock->hot_vrrp);
+		sock->hot_count = 0;
+		sock->hot_sands = NULL;
+		sock->hot_vrrp = NULL;
+
+		if (!count)
+			continue;
+
+		sock->hot_sands = MALLOC(count * sizeof(timeus_t));
+		sock->hot_vrrp = MALLOC(count * sizeof(vrrp_t *));
+
+		hlist_for_each_entry(vrrp, n, &vrrp_data->vrrp_index_fd[sock->fd_in%1024 + 1], index_fd_node) {
+			if (vrrp->fd_in != sock->fd_in)
+				continue;
+			sock->hot_sands[sock->hot_count] = vrrp->sands;
+			sock->hot_vrrp[sock->hot_count] = vrrp;
+			vrrp->sands_hot = &sock->hot_sands[sock->hot_count];
+			sock->hot_count++;
+		}
 	}
+}
 
-	/* Multiple instances on the same interface */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		vrrp = ELEMENT_DATA(e);
-		if (timer_cmp(vrrp->sands, timer) < 0 ||
-		    timer_isnull(timer))
-			timer = timer_dup(vrrp->sands);
+static timeus_t
+vrrp_compute_timer(const sock_t *sock)
+{
+	timeus_t timer = TIMER_NEVER_US;
+	unsigned i;
+
+	/* Contiguous streaming scan - no pointer chasing */
+	for (i = 0; i < sock->hot_count; i++) {
+		if (sock->hot_sands[i] < timer)
+			timer = sock->hot_sands[i];
 	}
 
 	return timer;
 }
 
 static unsigned long
-vrrp_timer_fd(const int fd)
+vrrp_timer_fd(const sock_t *sock)
 {
-	timeval_t timer;
+	timeus_t timer;
 
-	timer = vrrp_compute_timer(fd);
+	timer = vrrp_compute_timer(sock);
 // TODO - if the result of the following test is -ve, then a thread has already expired
 // and so shouldn't we run straight away? Or else ignore timers in past and take the next
 // one in the future?
-	if (timer_cmp(timer, time_now) < 0)
+	if (timer == TIMER_NEVER_US || timer < time_now_us)
 		return TIMER_MAX_SEC;
 
-	return timer_long(timer_sub(timer, time_now));
-}
-
-static int
-vrrp_timer_vrid_timeout(const int fd)
-{
-	vrrp_t *vrrp;
-	element e;
-	list l = &vrrp_data->vrrp_index_fd[fd%1024 + 1];
-	timeval_t timer;
-	int vrid = 0;
-
-	/* Multiple instances on the same interface */
-	timer_reset(timer);
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		vrrp = ELEMENT_DATA(e);
-		if (timer_cmp(vrrp->sands, timer) < 0 ||
-		    timer_isnull(timer)) {
-			timer = timer_dup(vrrp->sands);
-			vrid = vrrp->vrid;
-		}
-	}
-	return vrid;
+	return (unsigned long)(timer - time_now_us);
 }
 
 /* Thread functions */
@@ -464,23 +543,56 @@ vrrp_register_workers(list l)
 		vrrp_init_script(vrrp_data->vrrp_script);
 	}
 
+	/* Init BFD sessions */
+	if (!LIST_ISEMPTY(vrrp_data->vrrp_bfd))
+		vrrp_bfd_init(vrrp_data->vrrp_bfd);
+
+	/* Init tracked files */
+	if (!LIST_ISEMPTY(vrrp_data->vrrp_file))
+		vrrp_file_init(vrrp_data->vrrp_file);
+
+	/* Init tracked processes */
+	if (!LIST_ISEMPTY(vrrp_data->vrrp_process))
+		vrrp_process_init(vrrp_data->vrrp_process);
+
 	/* Register VRRP workers threads */
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		sock = ELEMENT_DATA(e);
 		/* jump to asynchronous handling */
-		vrrp_timer = vrrp_timer_fd(sock->fd_in);
+		vrrp_timer = vrrp_timer_fd(sock);
 
 		/* Register a timer thread if interface is shut */
 		if (sock->fd_in == -1)
 			sock->thread = thread_add_timer(master, vrrp_read_dispatcher_thread,
 							sock, vrrp_timer);
 		else
-			sock->thread = thread_add_read(master, vrrp_read_dispatcher_thread,
-						       sock, sock->fd_in, vrrp_timer);
+			sock->thread = thread_add_read_persistent(master, vrrp_read_dispatcher_thread,
+						       sock, sock->ring ? sock->ring->fd : sock->fd_in,
+						       vrrp_timer);
+
+		/* Protocol deadlines must beat any housekeeping work */
+		thread_set_priority(sock->thread, THREAD_PRIO_HI);
 	}
 }
 
 /* VRRP dispatcher functions */
+static void
+vrrp_sock_tuple(vrrp_t *vrrp, int *proto, ifindex_t *ifindex, bool *unicast)
+{
+	*ifindex =
+#ifdef _HAVE_VRRP_VMAC_
+		   (__test_bit(VRRP_VMAC_XMITBASE_BIT, &vrrp->vmac_flags)) ? IF_BASE_INDEX(vrrp->ifp) :
+#endif
+									     IF_INDEX(vrrp->ifp);
+	*unicast = !LIST_ISEMPTY(vrrp->unicast_peer);
+#if defined _WITH_VRRP_AUTH_
+	if (vrrp->version == VRRP_VERSION_2 && vrrp->auth_type == VRRP_AUTH_AH)
+		*proto = IPPROTO_IPSEC_AH;
+	else
+#endif
+		*proto = IPPROTO_VRRP;
+}
+
 static int
 already_exist_sock(list l, sa_family_t family, int proto, ifindex_t ifindex, bool unicast)
 {
@@ -499,7 +611,8 @@ already_exist_sock(list l, sa_family_t family, int proto, ifindex_t ifindex, boo
 }
 
 static void
-alloc_sock(sa_family_t family, list l, int proto, ifindex_t ifindex, bool unicast)
+alloc_sock(sa_family_t family, list l, int proto, ifindex_t ifindex, bool unicast,
+	   unsigned shard, unsigned shards)
 {
 	sock_t *new;
 
@@ -508,6 +621,9 @@ alloc_sock(sa_family_t family, list l, int proto, ifindex_t ifindex, bool unicas
 	new->proto = proto;
 	new->ifindex = ifindex;
 	new->unicast = unicast;
+	new->shard = shard;
+	new->shards = shards;
+	new->spurious_rx = (uint64_t *) MALLOC(sizeof(uint64_t));
 
 	list_add(l, new);
 }
@@ -515,34 +631,120 @@ alloc_sock(sa_family_t family, list l, int proto, ifindex_t ifindex, bool unicas
 static void
 vrrp_create_sockpool(list l)
 {
-	vrrp_t *vrrp;
+	vrrp_t *vrrp, *vrrp2;
 	list p = vrrp_data->vrrp;
-	element e;
-	ifindex_t ifindex;
-	int proto;
-	bool unicast;
+	element e, e2;
+	ifindex_t ifindex, ifindex2;
+	int proto, proto2;
+	bool unicast, unicast2;
+	unsigned shards, n_inst, shard;
 
 	for (e = LIST_HEAD(p); e; ELEMENT_NEXT(e)) {
 		vrrp = ELEMENT_DATA(e);
-		ifindex =
-#ifdef _HAVE_VRRP_VMAC_
-			  (__test_bit(VRRP_VMAC_XMITBASE_BIT, &vrrp->vmac_flags)) ? IF_BASE_INDEX(vrrp->ifp) :
-#endif
-										    IF_INDEX(vrrp->ifp);
-		unicast = !LIST_ISEMPTY(vrrp->unicast_peer);
-#if defined _WITH_VRRP_AUTH_
-		if (vrrp->version == VRRP_VERSION_2 && vrrp->auth_type == VRRP_AUTH_AH)
-			proto = IPPROTO_IPSEC_AH;
-		else
-#endif
-			proto = IPPROTO_VRRP;
+		vrrp_sock_tuple(vrrp, &proto, &ifindex, &unicast);
 
 		/* add the vrrp element if not exist */
-		if (!already_exist_sock(l, vrrp->family, proto, ifindex, unicast))
-			alloc_sock(vrrp->family, l, proto, ifindex, unicast);
+		if (already_exist_sock(l, vrrp->family, proto, ifindex, unicast))
+			continue;
+
+		/* Spread the VRIDs of a busy interface over several read
+		 * sockets, each drained by its own dispatcher registration.
+		 * The per socket VRID filters attached below do the kernel
+		 * side steering. AH sockets cannot be filtered, so they
+		 * are never sharded. Never open more shards than there
+		 * are instances behind this tuple. */
+		shards = 1;
+		if (proto == IPPROTO_VRRP && global_data->vrrp_rx_shards > 1) {
+			n_inst = 0;
+			for (e2 = LIST_HEAD(p); e2; ELEMENT_NEXT(e2)) {
+				vrrp2 = ELEMENT_DATA(e2);
+				vrrp_sock_tuple(vrrp2, &proto2, &ifindex2, &unicast2);
+				if (vrrp2->family == vrrp->family &&
+				    proto2 == proto		&&
+				    ifindex2 == ifindex		&&
+				    unicast2 == unicast)
+					n_inst++;
+			}
+			shards = global_data->vrrp_rx_shards < n_inst ?
+					global_data->vrrp_rx_shards : n_inst;
+		}
+
+		for (shard = 0; shard < shards; shard++)
+			alloc_sock(vrrp->family, l, proto, ifindex, unicast, shard, shards);
 	}
 }
 
+/* Socket pool parked across a reload, so the fds of unchanged
+ * (family, proto, ifindex, unicast) entries can be adopted by the new
+ * pool instead of being closed and re-opened */
+static list old_socket_pool;
+
+/* The advert groups the parked sockets joined, so adoption can tell
+ * whether their multicast membership is still the configured one */
+static struct sockaddr_storage old_mcast_group4;
+static struct sockaddr_storage old_mcast_group6;
+
+void
+vrrp_dispatcher_park(vrrp_data_t *data)
+{
+	sock_t *sock;
+	element e;
+
+	/* The pending threads are about to be destroyed wholesale, so
+	 * just forget them */
+	for (e = LIST_HEAD(data->vrrp_socket_pool); e; ELEMENT_NEXT(e)) {
+		sock = ELEMENT_DATA(e);
+		thread_cancel(sock->thread);
+		sock->thread = NULL;
+	}
+
+	old_mcast_group4 = global_data->vrrp_mcast_group4;
+	old_mcast_group6 = global_data->vrrp_mcast_group6;
+
+	old_socket_pool = data->vrrp_socket_pool;
+	data->vrrp_socket_pool = NULL;
+}
+
+static bool
+vrrp_sockpool_adopt(sock_t *sock)
+{
+	sock_t *old;
+	element e;
+
+	if (LIST_ISEMPTY(old_socket_pool))
+		return false;
+
+	/* If the advert group was changed by the reload, the parked
+	 * sockets hold a membership of the old group - reopening is the
+	 * only way to get the IGMP/MLD join for the new one */
+	if (!sock->unicast &&
+	    inet_sockaddrcmp(sock->family == AF_INET ? &old_mcast_group4 : &old_mcast_group6,
+			     sock->family == AF_INET ? &global_data->vrrp_mcast_group4 :
+						       &global_data->vrrp_mcast_group6))
+		return false;
+
+	for (e = LIST_HEAD(old_socket_pool); e; ELEMENT_NEXT(e)) {
+		old = ELEMENT_DATA(e);
+		if (old->family == sock->family	&&
+		    old->proto == sock->proto	&&
+		    old->ifindex == sock->ifindex &&
+		    old->unicast == sock->unicast &&
+		    old->shard == sock->shard	&&
+		    old->shards == sock->shards	&&
+		    old->fd_in > 0) {
+			sock->fd_in = old->fd_in;
+			sock->fd_out = old->fd_out;
+			sock->ring = old->ring;
+			old->fd_in = -1;
+			old->fd_out = -1;
+			old->ring = NULL;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static void
 vrrp_open_sockpool(list l)
 {
@@ -551,6 +753,10 @@ vrrp_open_sockpool(list l)
 
 	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
 		sock = ELEMENT_DATA(e);
+		if (vrrp_sockpool_adopt(sock))
+			continue;
+		if (vrrp_handoff_adopt(sock))
+			continue;
 		sock->fd_in = open_vrrp_read_socket(sock->family, sock->proto,
 					       sock->ifindex, sock->unicast);
 		if (sock->fd_in == -1)
@@ -559,6 +765,10 @@ vrrp_open_sockpool(list l)
 			sock->fd_out = open_vrrp_send_socket(sock->family, sock->proto,
 							     sock->ifindex, sock->unicast);
 	}
+
+	/* Close whatever was not adopted */
+	free_list(&old_socket_pool);
+	vrrp_handoff_release();
 }
 
 static void
@@ -577,23 +787,13 @@ vrrp_set_fds(list l)
 		sock = ELEMENT_DATA(e_sock);
 		for (e_vrrp = LIST_HEAD(p); e_vrrp; ELEMENT_NEXT(e_vrrp)) {
 			vrrp = ELEMENT_DATA(e_vrrp);
-			ifindex =
-#ifdef _HAVE_VRRP_VMAC_
-				  (__test_bit(VRRP_VMAC_XMITBASE_BIT, &vrrp->vmac_flags)) ? IF_BASE_INDEX(vrrp->ifp) :
-#endif
-											    IF_INDEX(vrrp->ifp);
-			unicast = !LIST_ISEMPTY(vrrp->unicast_peer);
-#if defined _WITH_VRRP_AUTH_
-			if (vrrp->version == VRRP_VERSION_2 && vrrp->auth_type == VRRP_AUTH_AH)
-				proto = IPPROTO_IPSEC_AH;
-			else
-#endif
-				proto = IPPROTO_VRRP;
+			vrrp_sock_tuple(vrrp, &proto, &ifindex, &unicast);
 
 			if ((sock->ifindex == ifindex)	&&
 			    (sock->family == vrrp->family) &&
 			    (sock->proto == proto)	&&
-			    (sock->unicast == unicast)) {
+			    (sock->unicast == unicast)	&&
+			    (vrrp->vrid % sock->shards == sock->shard)) {
 				vrrp->fd_in = sock->fd_in;
 				vrrp->fd_out = sock->fd_out;
 
@@ -605,6 +805,198 @@ vrrp_set_fds(list l)
 	}
 }
 
+static void vrrp_sock_park_filter(sock_t *);
+
+/* Attach a classic BPF filter to a read socket accepting only the
+ * VRIDs multiplexed over it, so adverts for foreign VRIDs on the
+ * segment are dropped in the kernel instead of waking the dispatcher.
+ * With rx sharding the same filters steer each VRID to exactly one of
+ * the shard sockets. AH sockets are left unfiltered - the VRRP header
+ * offset depends on the variable length AH header. */
+static void
+vrrp_sock_attach_filter(sock_t *sock)
+{
+	struct sock_filter insns[4 + 255];	/* 2 loads + max 255 VRIDs + 2 returns */
+	struct sock_fprog prog = { .filter = insns };
+	vrrp_t *vrrp;
+	element e;
+	uint8_t vrids[255];
+	unsigned n = 0, nvrid = 0, i;
+
+	if (sock->fd_in == -1 || sock->proto != IPPROTO_VRRP)
+		return;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+		if (vrrp->fd_in == sock->fd_in && nvrid < 255)
+			vrids[nvrid++] = vrrp->vrid;
+	}
+
+	if (!nvrid) {
+		/* A shard the VRID hash left empty must not see every
+		 * advert the other shards handle */
+		if (sock->shards > 1)
+			vrrp_sock_park_filter(sock);
+		return;
+	}
+
+	if (sock->family == AF_INET) {
+		/* X = IP header length, A = VRID */
+		insns[n++] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+		insns[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1);
+	} else {
+		/* Raw IPv6 sockets deliver the payload only */
+		insns[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1);
+	}
+
+	for (i = 0; i < nvrid; i++)
+		insns[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, vrids[i], (uint8_t)(nvrid - i), 0);
+
+	insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+	insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+	prog.len = (unsigned short)n;
+	if (setsockopt(sock->fd_in, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+		log_message(LOG_INFO, "VRRP fd [%d] - unable to attach VRID filter (%s)", sock->fd_in, strerror(errno));
+}
+
+static void
+vrrp_sockpool_attach_filters(list l)
+{
+	sock_t *sock;
+	element e;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		sock = ELEMENT_DATA(e);
+		vrrp_sock_attach_filter(sock);
+	}
+}
+
+/* Drop everything on the plain receive socket. It stays open to hold
+ * the multicast memberships, but must not queue what the ring already
+ * delivers. */
+static void
+vrrp_sock_park_filter(sock_t *sock)
+{
+	struct sock_filter insns[1] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+	struct sock_fprog prog = { .filter = insns, .len = 1 };
+
+	if (setsockopt(sock->fd_in, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+		log_message(LOG_INFO, "VRRP fd [%d] - unable to park receive socket (%s)",
+			    sock->fd_in, strerror(errno));
+}
+
+static void
+vrrp_ring_open(sock_t *sock)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size = VRRP_RING_BLOCK_SIZE,
+		.tp_block_nr = VRRP_RING_BLOCK_NR,
+		.tp_frame_size = VRRP_RING_FRAME_SIZE,
+		.tp_frame_nr = VRRP_RING_BLOCK_SIZE / VRRP_RING_FRAME_SIZE * VRRP_RING_BLOCK_NR,
+		.tp_retire_blk_tov = VRRP_RING_BLOCK_TOV,
+	};
+	struct sock_filter insns[4];
+	struct sock_fprog prog = { .filter = insns, .len = 4 };
+	struct sockaddr_ll sll = { .sll_family = AF_PACKET };
+	vrrp_ring_t *ring;
+	int version = TPACKET_V3;
+	char *map;
+	int fd;
+
+	/* Protocol 0 - nothing is delivered until the bind() below, once
+	 * the ring and the filter are already in place */
+	fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		log_message(LOG_INFO, "VRRP fd [%d] - PACKET_RX_RING unavailable (%s), using socket receive",
+			    sock->fd_in, strerror(errno));
+		return;
+	}
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1 ||
+	    setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+		goto error;
+
+	/* Accept VRRP only. A cooked socket presents the IP header at
+	 * offset 0, the way the raw receive socket does for IPv4 */
+	insns[0] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+						 sock->family == AF_INET ? 9 : 6);
+	insns[1] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_VRRP, 0, 1);
+	insns[2] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	insns[3] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+		goto error;
+
+	sll.sll_protocol = htons(sock->family == AF_INET ? ETH_P_IP : ETH_P_IPV6);
+	sll.sll_ifindex = (int)sock->ifindex;
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) == -1)
+		goto error;
+
+	map = mmap(NULL, (size_t)VRRP_RING_BLOCK_SIZE * VRRP_RING_BLOCK_NR,
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto error;
+
+	ring = (vrrp_ring_t *) MALLOC(sizeof(vrrp_ring_t));
+	ring->fd = fd;
+	ring->map = map;
+	ring->map_len = (size_t)VRRP_RING_BLOCK_SIZE * VRRP_RING_BLOCK_NR;
+	sock->ring = ring;
+
+	vrrp_sock_park_filter(sock);
+	log_message(LOG_INFO, "VRRP fd [%d] - using PACKET_RX_RING receive, ring fd [%d]",
+		    sock->fd_in, fd);
+	return;
+
+      error:
+	log_message(LOG_INFO, "VRRP fd [%d] - PACKET_RX_RING unavailable (%s), using socket receive",
+		    sock->fd_in, strerror(errno));
+	close(fd);
+}
+
+void
+vrrp_ring_close(sock_t *sock)
+{
+	if (!sock->ring)
+		return;
+
+	munmap(sock->ring->map, sock->ring->map_len);
+	close(sock->ring->fd);
+	FREE(sock->ring);
+	sock->ring = NULL;
+}
+
+static void
+vrrp_sockpool_open_rings(list l)
+{
+	sock_t *sock;
+	element e;
+
+	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
+		sock = ELEMENT_DATA(e);
+
+		/* AH sockets keep the plain path - the VRRP header offset
+		 * depends on the variable length AH header. Sharded sockets
+		 * do too - a ring accepts every advert on the interface, so
+		 * it would undo the VRID steering. */
+		if (!global_data->vrrp_rx_ring || sock->fd_in == -1 ||
+		    sock->proto != IPPROTO_VRRP || sock->shards > 1) {
+			/* A reload may have turned the ring off; the VRID
+			 * filter just re-attached reopens the socket path */
+			vrrp_ring_close(sock);
+			continue;
+		}
+
+		if (!sock->ring)
+			vrrp_ring_open(sock);
+		else
+			/* Ring adopted across a reload - park the receive
+			 * socket again, attaching the VRID filters above
+			 * reopened it */
+			vrrp_sock_park_filter(sock);
+	}
+}
+
 /*
  * We create & allocate a socket pool here. The soft design
  * can be sum up by the following sketch :
@@ -631,9 +1023,22 @@ vrrp_dispatcher_init(__attribute__((unused)) thread_t * thread)
 	/* set VRRP instance fds to sockpool */
 	vrrp_set_fds(vrrp_data->vrrp_socket_pool);
 
+	/* pack the per-socket timer-scan arrays */
+	vrrp_build_hot_arrays(vrrp_data->vrrp_socket_pool);
+
+	/* drop foreign VRIDs in the kernel. Attaching after adoption
+	 * replaces whatever filter a reload inherited */
+	vrrp_sockpool_attach_filters(vrrp_data->vrrp_socket_pool);
+
+	/* switch the pool to the mmap ring receive engine if configured */
+	vrrp_sockpool_open_rings(vrrp_data->vrrp_socket_pool);
+
 	/* register read dispatcher worker thread */
 	vrrp_register_workers(vrrp_data->vrrp_socket_pool);
 
+	/* export the per-socket spurious-delivery counters */
+	vrrp_publish_sock_stats();
+
 	/* Dump socket pool */
 	if (__test_bit(LOG_DETAIL_BIT, &debug))
 		dump_list(vrrp_data->vrrp_socket_pool);
@@ -850,6 +1255,22 @@ vrrp_set_effective_priority(vrrp_t *vrrp, uint8_t new_prio)
 		    vrrp->iname, vrrp->effective_priority, new_prio);
 
 	vrrp->effective_priority = new_prio;
+	vrrp->generation++;
+
+	if (vrrp->chkpt)
+		vrrp->chkpt->effective_priority = new_prio;
+
+#ifdef _WITH_LVS_
+	/* A degraded master is the pre-failover window for the sync
+	 * daemon - push connection state to the backup at full rate
+	 * while it lasts */
+	if (global_data->lvs_syncd.vrrp == vrrp && vrrp->state == VRRP_STATE_MAST) {
+		if (new_prio < vrrp->base_priority)
+			ipvs_syncd_tighten();
+		else
+			ipvs_syncd_relax();
+	}
+#endif
 }
 
 
@@ -867,18 +1288,43 @@ vrrp_update_priority(thread_t * thread)
 	/* compute prio_offset right here */
 	prio_offset = 0;
 
-	/* Now we will sum the weights of all interfaces which are tracked. */
-	if (!LIST_ISEMPTY(vrrp->track_ifp))
-		 prio_offset += vrrp_tracked_weight(vrrp->track_ifp);
+	/* Now we will sum the weights of all interfaces which are tracked.
+	 * The sum is maintained by the interface fan-out index, so no need
+	 * to walk the tracked interface list here. */
+	prio_offset += vrrp->track_if_weight;
+
+	/* Now we will sum the weights of all scripts which are tracked.
+	 * The sum is maintained by the script fan-out index. */
+	prio_offset += vrrp->track_script_weight;
+
+#ifdef _DEBUG_
+	/* Audit the incremental sums against a full re-sum */
+	if (!LIST_ISEMPTY(vrrp->track_script) &&
+	    vrrp->track_script_weight != vrrp_script_weight(vrrp->track_script))
+		log_message(LOG_INFO, "BUG - VRRP_Instance(%s) incremental script weight %d, re-sum %d",
+			    vrrp->iname, vrrp->track_script_weight, vrrp_script_weight(vrrp->track_script));
+	if (!LIST_ISEMPTY(vrrp->track_ifp) &&
+	    vrrp->track_if_weight != vrrp_tracked_weight(vrrp->track_ifp))
+		log_message(LOG_INFO, "BUG - VRRP_Instance(%s) incremental interface weight %d, re-sum %d",
+			    vrrp->iname, vrrp->track_if_weight, vrrp_tracked_weight(vrrp->track_ifp));
+#endif
+
+	/* And the weights of all tracked BFD sessions. */
+	if (!LIST_ISEMPTY(vrrp->track_bfd))
+		prio_offset += vrrp_bfd_weight(vrrp->track_bfd);
 
-	/* Now we will sum the weights of all scripts which are tracked. */
-	if (!LIST_ISEMPTY(vrrp->track_script))
-		prio_offset += vrrp_script_weight(vrrp->track_script);
+	/* And the values of all tracked files. */
+	if (!LIST_ISEMPTY(vrrp->track_file))
+		prio_offset += vrrp_file_weight(vrrp->track_file);
+
+	/* And the weights of all tracked processes. */
+	if (!LIST_ISEMPTY(vrrp->track_process))
+		prio_offset += vrrp_process_weight(vrrp->track_process);
 
 	/* WARNING! we must compute new_prio on a signed int in order
 	   to detect overflows and avoid wrapping. */
 	new_prio = vrrp->base_priority + prio_offset;
-	if (new_prio < 1)
+	if (new_prio < 1 || vrrp->forced_backup)
 		new_prio = 1;
 	else if (new_prio >= VRRP_PRIO_OWNER)
 		new_prio = VRRP_PRIO_OWNER - 1;
@@ -988,96 +1434,352 @@ vrrp_fault(vrrp_t * vrrp)
 #endif
 }
 
-/* Handle dispatcher read timeout */
+#ifdef _VRRP_LATENCY_STATS_
+static const unsigned long vrrp_stats_bucket_limit[VRRP_STATS_JITTER_BUCKETS - 1] =
+	{ 100, 500, 1000, 5000, 10000, 30000 };
+
+/* Account how late the dispatcher fired against the instance timer.
+ * time_now was refreshed when the scheduler woke up, so the delta
+ * measures the advert clocking jitter, not the FSM processing time. */
+static void
+vrrp_stats_timer_jitter(vrrp_t * vrrp)
+{
+	unsigned long late;
+	int i;
+
+	if (time_now_us <= vrrp->sands)
+		late = 0;
+	else
+		late = (unsigned long)(time_now_us - vrrp->sands);
+
+	vrrp->stats->jitter_count++;
+	vrrp->stats->jitter_usec_total += late;
+	if (late > vrrp->stats->jitter_max_usec)
+		vrrp->stats->jitter_max_usec = (uint32_t)late;
+
+	for (i = 0; i < VRRP_STATS_JITTER_BUCKETS - 1; i++) {
+		if (late < vrrp_stats_bucket_limit[i])
+			break;
+	}
+	vrrp->stats->jitter_hist[i]++;
+}
+
+/* Account the advert inter-arrival time against the master advert
+ * interval. The kernel receive timestamp is used when available, so the
+ * measurement shows network loss/delay rather than how long the advert
+ * sat in the socket buffer waiting for the dispatcher. */
+static void
+vrrp_stats_interarrival(vrrp_t * vrrp, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	long interval;
+	unsigned long late;
+	int i;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			break;
+		}
+	}
+	if (!cmsg) {
+		/* No kernel timestamp - fall back on the scheduler clock */
+		ts.tv_sec = time_now.tv_sec;
+		ts.tv_nsec = time_now.tv_usec * 1000;
+	}
+
+	if (vrrp->stats->last_advert_ts.tv_sec) {
+		interval = (ts.tv_sec - vrrp->stats->last_advert_ts.tv_sec) * 1000000L +
+			   (ts.tv_nsec - vrrp->stats->last_advert_ts.tv_nsec) / 1000;
+		late = interval > (long)vrrp->master_adver_int ?
+		       (unsigned long)interval - vrrp->master_adver_int : 0;
+
+		vrrp->stats->interarrival_count++;
+		vrrp->stats->interarrival_late_total += late;
+		if (late > vrrp->stats->interarrival_max_usec)
+			vrrp->stats->interarrival_max_usec = (uint32_t)late;
+
+		for (i = 0; i < VRRP_STATS_JITTER_BUCKETS - 1; i++) {
+			if (late < vrrp_stats_bucket_limit[i])
+				break;
+		}
+		vrrp->stats->interarrival_hist[i]++;
+	}
+
+	vrrp->stats->last_advert_ts = ts;
+}
+#endif
+
+/* Handle dispatcher read timeout. Every instance whose timer expired on
+ * this tick is processed in one pass: the state decisions all run first,
+ * with the kernel work they generate held on the transition batch, then
+ * the commit pushes that work as consolidated requests and fires the
+ * parked notifications. A large sync-group failover thus converges in a
+ * single pass instead of one fragmented timer fire per member. */
 static int
-vrrp_dispatcher_read_timeout(int fd)
+vrrp_dispatcher_read_timeout(sock_t *sock)
 {
 	vrrp_t *vrrp;
-	int vrid = 0;
-	int prev_state = 0;
+	int prev_state;
+	int fd = sock->fd_in;
+	unsigned i;
 
-	/* Searching for matching instance */
-	vrid = vrrp_timer_vrid_timeout(fd);
-	vrrp = vrrp_index_lookup(vrid, fd);
+	vrrp_transition_batch_begin();
 
-	/* Run the FSM handler */
-	prev_state = vrrp->state;
-	VRRP_FSM_READ_TO(vrrp);
+	for (i = 0; i < sock->hot_count; i++) {
+		if (sock->hot_sands[i] > time_now_us)
+			continue;
+		vrrp = sock->hot_vrrp[i];
 
-	/* handle instance synchronization */
-//	printf("Send [%s] TSM transtition : [%d,%d] Wantstate = [%d]\n"
-//	       , vrrp->iname
-//	       , prev_state
-//	       , vrrp->state
-//	       , vrrp->wantstate);
-	VRRP_TSM_HANDLE(prev_state, vrrp);
+#ifdef _VRRP_LATENCY_STATS_
+		vrrp_stats_timer_jitter(vrrp);
+#endif
 
-	/*
-	 * We are sure the instance exist. So we can
-	 * compute new sands timer safely.
-	 */
-	vrrp_init_instance_sands(vrrp);
+		/* Attach the instance to log records emitted while its FSM runs */
+		log_set_context("VRRP_INSTANCE", vrrp->iname);
+
+		/* Run the FSM handler */
+		prev_state = vrrp->state;
+		vrrp->hist_reason = VRRP_HIST_REASON_TIMEOUT;
+		VRRP_FSM_READ_TO(vrrp);
+
+		/* Refresh the sync group counters before taking group decisions */
+		vrrp_sync_update_member_counts(vrrp);
+
+		/* handle instance synchronization */
+//		printf("Send [%s] TSM transtition : [%d,%d] Wantstate = [%d]\n"
+//		       , vrrp->iname
+//		       , prev_state
+//		       , vrrp->state
+//		       , vrrp->wantstate);
+		VRRP_TSM_HANDLE(prev_state, vrrp);
+
+		/* Mirror any state change into the shared stats page */
+		if (vrrp->state != prev_state) {
+			vrrp->stats->state = (uint32_t)vrrp->state;
+			vrrp->stats->last_transition = (uint32_t)time_now.tv_sec;
+		}
 
-	/*
-	 * If quick sync is set, refresh sands to one advert interval, i.e. the next
-	 * timeout will occur in one interval instead of three, and a check for a
-	 * possible transition check will perform more quickly.
-	 */
-	if (vrrp->quick_sync) {
-		vrrp->sands = timer_add_long(time_now, vrrp->adver_int);
-		vrrp->quick_sync = 0;
+		/*
+		 * We are sure the instance exist. So we can
+		 * compute new sands timer safely.
+		 */
+		vrrp_init_instance_sands(vrrp);
+
+		/*
+		 * If quick sync is set, refresh sands to one advert interval, i.e. the next
+		 * timeout will occur in one interval instead of three, and a check for a
+		 * possible transition check will perform more quickly.
+		 */
+		if (vrrp->quick_sync) {
+			vrrp->sands = time_now_us + vrrp->adver_int;
+			if (vrrp->sands_hot)
+				*vrrp->sands_hot = vrrp->sands;
+			vrrp->quick_sync = 0;
+		}
+
+		log_set_context("VRRP_INSTANCE", NULL);
+
+		/* The FSM may have reopened the socket */
+		fd = vrrp->fd_in;
 	}
 
-	return vrrp->fd_in;
+	vrrp_transition_batch_commit();
+
+	return fd;
 }
 
-/* Handle dispatcher read packet */
-static int
-vrrp_dispatcher_read(sock_t * sock)
+/* Demux one received advert to its instance and run the FSM on it */
+static void
+vrrp_dispatcher_process(sock_t * sock, char *buf, ssize_t len,
+			struct sockaddr_storage *src,
+			__attribute__((unused)) struct msghdr *msgh)
 {
 	vrrp_t *vrrp;
 	vrrphdr_t *hd;
-	ssize_t len = 0;
-	int prev_state = 0;
 	unsigned proto = 0;
-	struct sockaddr_storage src_addr;
-	socklen_t src_addr_len = sizeof(src_addr);
-
-	/* Clean the read buffer */
-	memset(vrrp_buffer, 0, vrrp_buffer_len);
+	int prev_state;
 
-	/* read & affect received buffer */
-	len = recvfrom(sock->fd_in, vrrp_buffer, vrrp_buffer_len, 0,
-		       (struct sockaddr *) &src_addr, &src_addr_len);
-	hd = vrrp_get_header(sock->family, vrrp_buffer, &proto);
+	hd = vrrp_get_header(sock->family, buf, &proto);
 
 	/* Searching for matching instance */
 	vrrp = vrrp_index_lookup(hd->vrid, sock->fd_in);
 
-	/* If no instance found => ignore the advert */
-	if (!vrrp)
-		return sock->fd_in;
+	/* If no instance found => ignore the advert. Count it - with
+	 * IP(V6)_MULTICAST_ALL cleared these should only be foreign VRIDs
+	 * on our own group, so a climbing counter means wasted wakeups */
+	if (!vrrp) {
+		++*sock->spurious_rx;
+		log_debug(LOG_SUBSYS_VRRP, "VRRP: spurious advert for vrid %u on fd %d",
+			  hd->vrid, sock->fd_in);
+		return;
+	}
+
+#ifdef _VRRP_LATENCY_STATS_
+	if (msgh)
+		vrrp_stats_interarrival(vrrp, msgh);
+#endif
 
-	vrrp->pkt_saddr = src_addr;
+	vrrp->pkt_saddr = *src;
+
+	/* Attach the instance to log records emitted while its FSM runs */
+	log_set_context("VRRP_INSTANCE", vrrp->iname);
 
 	/* Run the FSM handler */
 	prev_state = vrrp->state;
-	VRRP_FSM_READ(vrrp, vrrp_buffer, len);
+	vrrp->hist_reason = VRRP_HIST_REASON_ADVERT;
+	VRRP_FSM_READ(vrrp, buf, len);
+
+	/* Refresh the sync group counters before taking group decisions */
+	vrrp_sync_update_member_counts(vrrp);
 
 	/* handle instance synchronization */
-//	printf("Read [%s] TSM transtition : [%d,%d] Wantstate = [%d]\n"
-//	       , vrrp->iname
-//	       , prev_state
-//	       , vrrp->state
-//	       , vrrp->wantstate);
 	VRRP_TSM_HANDLE(prev_state, vrrp);
 
+	/* Mirror any state change into the shared stats page */
+	if (vrrp->state != prev_state) {
+		vrrp->stats->state = (uint32_t)vrrp->state;
+		vrrp->stats->last_transition = (uint32_t)time_now.tv_sec;
+	}
+
 	/*
 	 * Refresh sands only if found matching instance.
 	 * Otherwize the packet is simply ignored...
 	 */
 	vrrp_init_instance_sands(vrrp);
 
+	log_set_context("VRRP_INSTANCE", NULL);
+}
+
+/* Handle dispatcher read packet. The socket is drained with a single
+ * recvmmsg() call, so a burst of adverts costs one syscall and one
+ * trip round the event loop instead of N. */
+static int
+vrrp_dispatcher_read(sock_t * sock)
+{
+	struct mmsghdr msgs[VRRP_RX_BATCH];
+	struct iovec iovs[VRRP_RX_BATCH];
+	struct sockaddr_storage src_addrs[VRRP_RX_BATCH];
+#ifdef _VRRP_LATENCY_STATS_
+	char cbufs[VRRP_RX_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+#endif
+	char *buf;
+	int nrcv, i;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < VRRP_RX_BATCH; i++) {
+		iovs[i].iov_base = vrrp_buffer + (size_t)i * vrrp_buffer_len;
+		iovs[i].iov_len = vrrp_buffer_len;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &src_addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(src_addrs[i]);
+#ifdef _VRRP_LATENCY_STATS_
+		msgs[i].msg_hdr.msg_control = cbufs[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(cbufs[i]);
+#endif
+	}
+
+	/* read & affect received buffers */
+	nrcv = recvmmsg(sock->fd_in, msgs, VRRP_RX_BATCH, MSG_DONTWAIT, NULL);
+
+	if (nrcv > 0)
+		log_debug(LOG_SUBSYS_VRRP, "VRRP: dispatching %d received packet(s) on fd %d",
+			  nrcv, sock->fd_in);
+
+	for (i = 0; i < nrcv; i++) {
+		buf = vrrp_buffer + (size_t)i * vrrp_buffer_len;
+
+		/* Clean the unused tail of the slot */
+		if (msgs[i].msg_len < vrrp_buffer_len)
+			memset(buf + msgs[i].msg_len, 0, vrrp_buffer_len - msgs[i].msg_len);
+
+		vrrp_dispatcher_process(sock, buf, (ssize_t)msgs[i].msg_len,
+					&src_addrs[i], &msgs[i].msg_hdr);
+	}
+
+	return sock->fd_in;
+}
+
+/* Reap the ready ring blocks, feeding frame pointers to the FSM in
+ * place - no copy between the kernel and the protocol handler. */
+static int
+vrrp_ring_read(sock_t * sock)
+{
+	vrrp_ring_t *ring = sock->ring;
+	struct tpacket_block_desc *desc;
+	struct tpacket3_hdr *ppd;
+	struct sockaddr_ll *sll;
+	struct sockaddr_storage src;
+	struct sockaddr_in *sin;
+	struct sockaddr_in6 *sin6;
+	struct iphdr *iph;
+	struct ip6_hdr *ip6h;
+	char *buf;
+	ssize_t len;
+	unsigned i;
+
+	for (;;) {
+		desc = (struct tpacket_block_desc *)
+		       (ring->map + (size_t)ring->block * VRRP_RING_BLOCK_SIZE);
+		if (!(desc->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+
+		ppd = (struct tpacket3_hdr *) ((char *)desc + desc->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < desc->hdr.bh1.num_pkts; i++,
+		     ppd = (struct tpacket3_hdr *) ((char *)ppd + ppd->tp_next_offset)) {
+			/* Packet sockets tap our own transmissions too;
+			 * a raw receive socket never sees those */
+			sll = (struct sockaddr_ll *)
+			      ((char *)ppd + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			if (sll->sll_pkttype == PACKET_OUTGOING)
+				continue;
+
+			buf = (char *)ppd + ppd->tp_net;
+			memset(&src, 0, sizeof(src));
+
+			if (sock->family == AF_INET) {
+				if (ppd->tp_snaplen < sizeof(struct iphdr))
+					continue;
+
+				/* Trim the padding a short ethernet frame carries */
+				iph = (struct iphdr *) buf;
+				len = ntohs(iph->tot_len);
+				if (len > (ssize_t)ppd->tp_snaplen)
+					len = (ssize_t)ppd->tp_snaplen;
+
+				sin = (struct sockaddr_in *) &src;
+				sin->sin_family = AF_INET;
+				sin->sin_addr.s_addr = iph->saddr;
+			} else {
+				if (ppd->tp_snaplen < sizeof(struct ip6_hdr))
+					continue;
+
+				/* The raw receive path presents the VRRP header
+				 * directly for IPv6, so skip the IPv6 header */
+				ip6h = (struct ip6_hdr *) buf;
+				if (ip6h->ip6_nxt != IPPROTO_VRRP)
+					continue;
+				len = ntohs(ip6h->ip6_plen);
+				if (len > (ssize_t)(ppd->tp_snaplen - sizeof(*ip6h)))
+					len = (ssize_t)(ppd->tp_snaplen - sizeof(*ip6h));
+
+				sin6 = (struct sockaddr_in6 *) &src;
+				sin6->sin6_family = AF_INET6;
+				sin6->sin6_addr = ip6h->ip6_src;
+				buf += sizeof(*ip6h);
+			}
+
+			vrrp_dispatcher_process(sock, buf, len, &src, NULL);
+		}
+
+		/* Hand the block back to the kernel */
+		__sync_synchronize();
+		desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		ring->block = (ring->block + 1) % VRRP_RING_BLOCK_NR;
+	}
+
 	return sock->fd_in;
 }
 
@@ -1094,27 +1796,100 @@ vrrp_read_dispatcher_thread(thread_t * thread)
 
 	/* Dispatcher state handler */
 	if (thread->type == THREAD_READ_TIMEOUT || sock->fd_in == -1)
-		fd = vrrp_dispatcher_read_timeout(sock->fd_in);
+		fd = vrrp_dispatcher_read_timeout(sock);
+	else if (sock->ring)
+		fd = vrrp_ring_read(sock);
 	else
 		fd = vrrp_dispatcher_read(sock);
 
-	/* register next dispatcher thread */
-	vrrp_timer = vrrp_timer_fd(fd);
-	if (fd == -1)
+	/* Register next dispatcher thread. On a plain read fire the
+	 * persistent registration is still armed - just refresh its
+	 * timeout. A timeout or timer fire left us unregistered (and may
+	 * have reopened the socket), so register afresh. */
+	vrrp_timer = vrrp_timer_fd(sock);
+	if (fd == -1) {
+		if (thread->type == THREAD_READY_FD)
+			thread_cancel(sock->thread);
 		sock->thread = thread_add_timer(thread->master, vrrp_read_dispatcher_thread,
 						sock, vrrp_timer);
-	else
-		sock->thread = thread_add_read(thread->master, vrrp_read_dispatcher_thread,
-					       sock, fd, vrrp_timer);
+		thread_set_priority(sock->thread, THREAD_PRIO_HI);
+	} else if (thread->type == THREAD_READY_FD &&
+		   sock->thread->u.fd == (sock->ring ? sock->ring->fd : fd)) {
+		thread_read_rearm(sock->thread, vrrp_timer);
+	} else {
+		if (thread->type == THREAD_READY_FD)
+			thread_cancel(sock->thread);
+		sock->thread = thread_add_read_persistent(thread->master, vrrp_read_dispatcher_thread,
+					       sock, sock->ring ? sock->ring->fd : fd,
+					       vrrp_timer);
+		thread_set_priority(sock->thread, THREAD_PRIO_HI);
+	}
 
 	return 0;
 }
 
+/* Apply one script result to the rise/fall accounting */
+static void
+vrrp_script_apply(vrrp_script_t *vscript, bool script_success, char *script_exit_type, char *reason, int reason_code)
+{
+	if (script_success) {
+		if (vscript->result < vscript->rise - 1) {
+			vscript->result++;
+		} else {
+			if (vscript->result < vscript->rise)	/* i.e. == vscript->rise - 1 */
+				log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
+			vscript->result = vscript->rise + vscript->fall - 1;
+		}
+	} else {
+		if (vscript->result > vscript->rise) {
+			vscript->result--;
+		} else {
+			if (vscript->result == vscript->rise ||
+			    vscript->init_state == SCRIPT_INIT_STATE_INIT) {
+				if (reason)
+					log_message(LOG_INFO, "VRRP_Script(%s) %s (%s %d)", vscript->sname, script_exit_type, reason, reason_code);
+				else
+					log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
+			}
+			vscript->result = 0;
+		}
+	}
+
+	vrrp_script_tracker_update(vscript);
+}
+
 static int
 vrrp_script_thread(thread_t * thread)
 {
 	vrrp_script_t *vscript = THREAD_ARG(thread);
 	int ret;
+	int stream_fd;
+	pid_t pid;
+
+	if (vscript->persistent) {
+		/* (re)start the streaming script if it is not running.
+		 * Status lines drive the state from here on, so no
+		 * interval timer is registered. */
+		if (vscript->stream_pid != -1)
+			return 0;
+
+		pid = system_call_stream(vscript->script, vscript->uid,
+					 vscript->gid, &stream_fd);
+		if (pid == -1) {
+			thread_add_timer(thread->master, vrrp_script_thread,
+					 vscript, vscript->interval);
+			return 0;
+		}
+
+		vscript->stream_pid = pid;
+		vscript->stream_fd = stream_fd;
+		vscript->stream_len = 0;
+		thread_add_child(thread->master, vrrp_script_stream_child_thread,
+				 vscript, pid, TIMER_NEVER);
+		thread_add_read(thread->master, vrrp_script_stream_thread,
+				vscript, stream_fd, TIMER_NEVER);
+		return 0;
+	}
 
 	/* Register next timer tracker */
 	thread_add_timer(thread->master, vrrp_script_thread, vscript,
@@ -1149,7 +1924,7 @@ vrrp_script_child_thread(thread_t * thread)
 	char *script_exit_type = NULL;
 	bool script_success;
 	char *reason = NULL;
-	int reason_code;
+	int reason_code = 0;
 
 	if (thread->type == THREAD_CHILD_TIMEOUT) {
 		pid = THREAD_CHILD_PID(thread);
@@ -1189,6 +1964,15 @@ vrrp_script_child_thread(thread_t * thread)
 	if (WIFEXITED(wait_status)) {
 		int status = WEXITSTATUS(wait_status);
 
+		/* The shell exits 126/127 when it cannot run the script.
+		 * That is a configuration problem, not a script failure, so
+		 * treat it as the forked launcher always has. */
+		if (status >= 126) {
+			log_message(LOG_INFO, "Track script %s couldn't be executed (status %d)",
+				    vscript->sname, status);
+			status = 0;
+		}
+
 		if (status == 0) {
 			/* success */
 			script_exit_type = "succeeded";
@@ -1222,30 +2006,8 @@ vrrp_script_child_thread(thread_t * thread)
 		script_success = false;
 	}
 
-	if (script_exit_type) {
-		if (script_success) {
-			if (vscript->result < vscript->rise - 1) {
-				vscript->result++;
-			} else {
-				if (vscript->result < vscript->rise)	/* i.e. == vscript->rise - 1 */
-					log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
-				vscript->result = vscript->rise + vscript->fall - 1;
-			}
-		} else {
-			if (vscript->result > vscript->rise) {
-				vscript->result--;
-			} else {
-				if (vscript->result == vscript->rise ||
-				    vscript->init_state == SCRIPT_INIT_STATE_INIT) {
-					if (reason)
-						log_message(LOG_INFO, "VRRP_Script(%s) %s (%s %d)", vscript->sname, script_exit_type, reason, reason_code);
-					else
-						log_message(LOG_INFO, "VRRP_Script(%s) %s", vscript->sname, script_exit_type);
-				}
-				vscript->result = 0;
-			}
-		}
-	}
+	if (script_exit_type)
+		vrrp_script_apply(vscript, script_success, script_exit_type, reason, reason_code);
 
 	vscript->state = SCRIPT_STATE_IDLE;
 	vscript->init_state = SCRIPT_INIT_STATE_DONE;
@@ -1253,6 +2015,97 @@ vrrp_script_child_thread(thread_t * thread)
 	return 0;
 }
 
+/* Persistent script support. Rather than being re-executed every
+ * interval, a persistent script is launched once with its stdout
+ * connected to a pipe and streams status lines; each line feeds the
+ * same rise/fall accounting as an exit status would. */
+static int
+vrrp_script_stream_child_thread(thread_t * thread)
+{
+	vrrp_script_t *vscript = THREAD_ARG(thread);
+
+	if (thread->type == THREAD_CHILD_TIMEOUT)
+		return 0;
+
+	vscript->stream_pid = -1;
+	if (vscript->stream_fd != -1) {
+		close(vscript->stream_fd);
+		vscript->stream_fd = -1;
+	}
+
+	log_message(LOG_INFO, "VRRP_Script(%s) persistent script exited - restarting in %lu seconds",
+		    vscript->sname, vscript->interval / TIMER_HZ);
+	vrrp_script_apply(vscript, false, "failed", "exited with status",
+			  WIFEXITED(THREAD_CHILD_STATUS(thread)) ? WEXITSTATUS(THREAD_CHILD_STATUS(thread)) : -1);
+	vscript->init_state = SCRIPT_INIT_STATE_DONE;
+
+	thread_add_timer(thread->master, vrrp_script_thread, vscript, vscript->interval);
+
+	return 0;
+}
+
+/* Evaluate one status line from a persistent script. Numeric lines
+ * follow exit status semantics (0 is a success), otherwise "up"/"ok"
+ * report a success and anything else a failure. */
+static void
+vrrp_script_stream_status(vrrp_script_t *vscript, char *line)
+{
+	bool success;
+	char *endptr;
+	long status;
+
+	if (!line[0])
+		return;
+
+	status = strtol(line, &endptr, 10);
+	if (*endptr == '\0')
+		success = (status == 0);
+	else
+		success = (!strcasecmp(line, "up") || !strcasecmp(line, "ok"));
+
+	vrrp_script_apply(vscript, success,
+			  success ? "reported success" : "reported failure", NULL, 0);
+	vscript->init_state = SCRIPT_INIT_STATE_DONE;
+}
+
+static int
+vrrp_script_stream_thread(thread_t * thread)
+{
+	vrrp_script_t *vscript = THREAD_ARG(thread);
+	char buf[256];
+	ssize_t len;
+	ssize_t i;
+
+	len = read(thread->u.fd, buf, sizeof(buf));
+
+	if (len <= 0) {
+		if (len == -1 && (errno == EAGAIN || errno == EINTR)) {
+			thread_add_read(thread->master, vrrp_script_stream_thread,
+					vscript, thread->u.fd, TIMER_NEVER);
+			return 0;
+		}
+
+		/* EOF - the child thread handles the exit and the restart */
+		close(thread->u.fd);
+		vscript->stream_fd = -1;
+		return 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			vscript->stream_buf[vscript->stream_len] = '\0';
+			vrrp_script_stream_status(vscript, vscript->stream_buf);
+			vscript->stream_len = 0;
+		} else if (vscript->stream_len < sizeof(vscript->stream_buf) - 1)
+			vscript->stream_buf[vscript->stream_len++] = buf[i];
+	}
+
+	thread_add_read(thread->master, vrrp_script_stream_thread, vscript,
+			thread->u.fd, TIMER_NEVER);
+
+	return 0;
+}
+
 /* Delayed ARP/NA thread */
 int
 vrrp_arp_thread(thread_t *thread)
@@ -1345,3 +2198,137 @@ vrrp_arp_thread(thread_t *thread)
 
 	return 0;
 }
+
+/* Token bucket pacing the gratuitous ARP/NA output. The transition
+ * bursts debit it as well, so after a large failover the refresh
+ * traffic backs off until the bucket recovers, keeping the combined
+ * rate the NIC and switches see bounded. */
+static void
+vrrp_garp_bucket_refill(void)
+{
+	long cap = (long)global_data->vrrp_garp_refresh_rate;
+	unsigned long elapsed;
+
+	elapsed = timer_long(timer_sub(time_now, garp_bucket_stamp));
+	garp_bucket_tokens += (long)(elapsed / TIMER_HZ * global_data->vrrp_garp_refresh_rate +
+				     elapsed % TIMER_HZ * global_data->vrrp_garp_refresh_rate / TIMER_HZ);
+	if (garp_bucket_tokens > cap)
+		garp_bucket_tokens = cap;
+	garp_bucket_stamp = time_now;
+}
+
+void
+vrrp_garp_bucket_debit(unsigned frames)
+{
+	if (!global_data->vrrp_garp_refresh_rate)
+		return;
+
+	vrrp_garp_bucket_refill();
+	garp_bucket_tokens -= (long)frames;
+}
+
+static unsigned
+vrrp_garp_burst_frames(vrrp_t *vrrp, unsigned rep)
+{
+	unsigned vips = 0;
+
+	if (!LIST_ISEMPTY(vrrp->vip))
+		vips += LIST_SIZE(vrrp->vip);
+	if (!LIST_ISEMPTY(vrrp->evip))
+		vips += LIST_SIZE(vrrp->evip);
+
+	return rep * vips;
+}
+
+static int
+vrrp_garp_refresh_thread(thread_t *thread)
+{
+	timeval_t next_time = {
+		.tv_sec = INT_MAX
+	};
+	unsigned long delay;
+	unsigned frames;
+	element e;
+	vrrp_t *vrrp;
+
+	set_time_now();
+	garp_refresh_thread = NULL;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp))
+		return 0;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp); e; ELEMENT_NEXT(e)) {
+		vrrp = ELEMENT_DATA(e);
+
+		if (timer_isnull(vrrp->garp_refresh) ||
+		    vrrp->state != VRRP_STATE_MAST ||
+		    !VRRP_VIP_ISSET(vrrp))
+			continue;
+
+		if (timer_cmp(time_now, vrrp->garp_refresh_timer) >= 0) {
+			frames = vrrp_garp_burst_frames(vrrp, vrrp->garp_refresh_rep);
+			vrrp_garp_bucket_refill();
+			if (global_data->vrrp_garp_refresh_rate &&
+			    garp_bucket_tokens < (long)frames) {
+				/* Bucket empty - leave the refresh due, the
+				 * next tick retries once tokens accrue */
+			} else {
+				vrrp_send_link_update(vrrp, vrrp->garp_refresh_rep);
+				vrrp->garp_refresh_timer = timer_add_now(vrrp->garp_refresh);
+			}
+		}
+
+		if (timer_cmp(vrrp->garp_refresh_timer, next_time) < 0)
+			next_time = vrrp->garp_refresh_timer;
+	}
+
+	/* Dormant until the next MASTER transition reschedules us */
+	if (next_time.tv_sec == INT_MAX)
+		return 0;
+
+	/* Round the wakeup up to a whole second, so refreshes falling
+	 * close together aggregate into the same tick */
+	if (timer_cmp(next_time, time_now) <= 0)
+		delay = TIMER_HZ;
+	else
+		delay = (timer_long(timer_sub(next_time, time_now)) + TIMER_HZ - 1) / TIMER_HZ * TIMER_HZ;
+
+	garp_refresh_thread = thread_add_timer(thread->master, vrrp_garp_refresh_thread, NULL, delay);
+
+	return 0;
+}
+
+/* Make sure the refresh scheduler is running - called when an instance
+ * with garp refresh configured enters MASTER state */
+void
+vrrp_garp_refresh_reschedule(void)
+{
+	if (garp_refresh_thread)
+		return;
+
+	garp_refresh_thread = thread_add_timer(master, vrrp_garp_refresh_thread, NULL, TIMER_HZ);
+}
+
+/* Flush the adverts queued during this scheduler wakeup */
+static int
+vrrp_adv_flush_thread(__attribute__((unused)) thread_t * thread)
+{
+	adv_flush_thread = NULL;
+	vrrp_adv_flush();
+
+	return 0;
+}
+
+/* Arrange for the queued adverts to be flushed once every dispatcher
+ * thread of the current wakeup has run. The dispatchers run at high
+ * priority and the flush at low, so however many instances' timers
+ * expired together, their adverts leave in one sendmmsg() per socket. */
+void
+vrrp_adv_flush_schedule(void)
+{
+	if (adv_flush_thread)
+		return;
+
+	adv_flush_thread = thread_add_timer(master, vrrp_adv_flush_thread, NULL, 0);
+	thread_set_priority(adv_flush_thread, THREAD_PRIO_LO);
+}
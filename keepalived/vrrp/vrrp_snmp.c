@@ -2504,8 +2504,7 @@ vrrp_snmp_instance_trap(vrrp_t *vrrp)
 	log_message(LOG_INFO,
 		    "VRRP_Instance(%s): Sending SNMP notification",
 		    vrrp->iname);
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, vrrp, SNMP_TRAP_INSTANCE);
 }
 
 void
@@ -2561,8 +2560,7 @@ vrrp_snmp_group_trap(vrrp_sgroup_t *group)
 	log_message(LOG_INFO,
 		    "VRRP_Group(%s): Sending SNMP notification",
 		    group->gname);
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, group, SNMP_TRAP_GROUP);
 }
 #endif
 
@@ -3160,8 +3158,7 @@ vrrp_rfcv2_snmp_new_master_trap(vrrp_t *vrrp)
 	log_message(LOG_INFO, "VRRP_Instance(%s): Sending SNMP notification"
 			      " vrrpTrapNewMaster"
 			    , vrrp->iname);
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, vrrp, SNMP_TRAP_RFCV2_NEW_MASTER);
 }
 
 void
@@ -3209,8 +3206,7 @@ vrrp_rfcv2_snmp_auth_err_trap(vrrp_t *vrrp, struct in_addr src, enum rfcv2_trap_
 	log_message(LOG_INFO, "VRRP_Instance(%s): Sending SNMP notification"
 			      " vrrpTrapAuthFailure"
 			    , vrrp->iname);
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, vrrp, SNMP_TRAP_RFCV2_AUTH_ERR);
 }
 #endif
 
@@ -3561,7 +3557,7 @@ vrrp_rfcv3_snmp_opertable(struct variable *vp, oid *name, size_t *length,
 	case VRRP_RFCv3_SNMP_OPER_VR_UPTIME:
 		if (rt->state == VRRP_STATE_BACK ||
 		    rt->state == VRRP_STATE_MAST) {
-			time_now = timer_now();
+			set_time_now();
 			uptime = timer_sub(time_now, rt->stats->uptime);
 			long_ret.s = uptime.tv_sec * 100 + uptime.tv_usec / 10000;	// unit is centi-seconds
 		}
@@ -3878,8 +3874,7 @@ vrrp_rfcv3_snmp_new_master_notify(vrrp_t *vrrp)
 	log_message(LOG_INFO, "VRRP_Instance(%s): Sending SNMP notification"
 			      " vrrpv3NotifyNewMaster, reason %d"
 			    , vrrp->iname, reason);
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, vrrp, SNMP_TRAP_RFCV3_NEW_MASTER);
 }
 
 void
@@ -3918,8 +3913,7 @@ vrrp_rfcv3_snmp_proto_err_notify(vrrp_t *vrrp)
 	log_message(LOG_INFO, "VRRP_Instance(%s): Sending SNMP notification"
 			      " vrrpTrapProtoError"
 			    , vrrp->iname);
-	send_v2trap(notification_vars);
-	snmp_free_varbind(notification_vars);
+	snmp_send_trap(notification_vars, vrrp, SNMP_TRAP_RFCV3_PROTO_ERR);
 }
 #endif
 
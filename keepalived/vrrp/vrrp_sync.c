@@ -46,7 +46,9 @@ vrrp_init_instance_sands(vrrp_t * vrrp)
 // i) backup and expire timer
 // ii) backup and receive prio 0
 // iii) master and receive higher prio advert
-		vrrp->sands = timer_add_long(time_now, vrrp->adver_int);
+		vrrp->sands = time_now_us + vrrp->adver_int;
+		if (vrrp->sands_hot)
+			*vrrp->sands_hot = vrrp->sands;
 		return;
 	}
 
@@ -56,8 +58,11 @@ vrrp_init_instance_sands(vrrp_t * vrrp)
 	 * received. (When a preemptable packet is received, the wantstate is
 	 * moved to GOTO_MASTER and this condition is caught above).
 	 */
-	if (vrrp->state == VRRP_STATE_BACK || vrrp->state == VRRP_STATE_FAULT)
-		vrrp->sands = timer_add_long(time_now, vrrp->ms_down_timer);
+	if (vrrp->state == VRRP_STATE_BACK || vrrp->state == VRRP_STATE_FAULT) {
+		vrrp->sands = time_now_us + vrrp->ms_down_timer;
+		if (vrrp->sands_hot)
+			*vrrp->sands_hot = vrrp->sands;
+	}
 }
 
 /* Instance name lookup */
@@ -76,6 +81,43 @@ vrrp_get_instance(char *iname)
 	return NULL;
 }
 
+/* Fold a member's current state into its group counters. Only the delta
+ * against what was previously accounted is applied, so the function is
+ * cheap and safe to call even when nothing has changed. The counters
+ * let the group transition decisions below run in O(1) instead of
+ * walking every member on each transition. */
+void
+vrrp_sync_update_member_counts(vrrp_t * vrrp)
+{
+	vrrp_sgroup_t *vgroup = vrrp->sync;
+	bool wantmaster;
+
+	if (!vgroup)
+		return;
+
+	if (vrrp->state != vrrp->sync_counted_state) {
+		if (vrrp->sync_counted_state == VRRP_STATE_MAST)
+			vgroup->num_member_master--;
+		else if (vrrp->sync_counted_state == VRRP_STATE_FAULT)
+			vgroup->num_member_fault--;
+		if (vrrp->state == VRRP_STATE_MAST)
+			vgroup->num_member_master++;
+		else if (vrrp->state == VRRP_STATE_FAULT)
+			vgroup->num_member_fault++;
+		vrrp->sync_counted_state = vrrp->state;
+	}
+
+	wantmaster = (vrrp->wantstate == VRRP_STATE_MAST ||
+		      vrrp->wantstate == VRRP_STATE_GOTO_MASTER);
+	if (wantmaster != vrrp->sync_counted_wantmaster) {
+		if (wantmaster)
+			vgroup->num_member_wantmaster++;
+		else
+			vgroup->num_member_wantmaster--;
+		vrrp->sync_counted_wantmaster = wantmaster;
+	}
+}
+
 /* Set instances group pointer */
 void
 vrrp_sync_set_group(vrrp_sgroup_t *vgroup)
@@ -99,6 +141,7 @@ vrrp_sync_set_group(vrrp_sgroup_t *vgroup)
 			else {
 				list_add(vgroup->index_list, vrrp);
 				vrrp->sync = vgroup;
+				vrrp_sync_update_member_counts(vrrp);
 			}
 		}
 		else
@@ -170,10 +213,8 @@ vrrp_sync_leave_fault(vrrp_t * vrrp)
 int
 vrrp_sync_goto_master(vrrp_t * vrrp)
 {
-	vrrp_t *isync;
 	vrrp_sgroup_t *vgroup = vrrp->sync;
-	list l = vgroup->index_list;
-	element e;
+	unsigned want_master;
 
 	if (GROUP_STATE(vgroup) == VRRP_STATE_MAST)
 		return 1;
@@ -182,13 +223,11 @@ vrrp_sync_goto_master(vrrp_t * vrrp)
 
 	/* Only sync to master if everyone wants to
 	 * i.e. prefer backup state to avoid thrashing */
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		isync = ELEMENT_DATA(e);
-		if (isync != vrrp && (isync->wantstate != VRRP_STATE_GOTO_MASTER &&
-				      isync->wantstate != VRRP_STATE_MAST)) {
-			return 0;
-		}
-	}
+	want_master = vgroup->num_member_wantmaster;
+	if (vrrp->sync_counted_wantmaster)
+		want_master--;
+	if (want_master + 1 < (unsigned)LIST_SIZE(vgroup->index_list))
+		return 0;
 	return 1;
 }
 
@@ -214,6 +253,7 @@ vrrp_sync_master_election(vrrp_t * vrrp)
 		if (isync != vrrp && isync->wantstate != VRRP_STATE_GOTO_MASTER) {
 			/* Force a new protocol master election */
 			isync->wantstate = VRRP_STATE_GOTO_MASTER;
+			vrrp_sync_update_member_counts(isync);
 			log_message(LOG_INFO,
 			       "VRRP_Instance(%s) forcing a new MASTER election",
 			       isync->iname);
@@ -243,6 +283,7 @@ vrrp_sync_backup(vrrp_t * vrrp)
 			isync->wantstate = VRRP_STATE_BACK;
 			vrrp_state_leave_master(isync);
 			vrrp_init_instance_sands(isync);
+			vrrp_sync_update_member_counts(isync);
 		}
 	}
 	vgroup->state = VRRP_STATE_BACK;
@@ -278,6 +319,7 @@ vrrp_sync_master(vrrp_t * vrrp)
 			isync->wantstate = VRRP_STATE_MAST;
 			vrrp_state_goto_master(isync);
 			vrrp_init_instance_sands(isync);
+			vrrp_sync_update_member_counts(isync);
 		}
 	}
 	vgroup->state = VRRP_STATE_MAST;
@@ -322,6 +364,7 @@ vrrp_sync_fault(vrrp_t * vrrp)
 				vrrp_snmp_instance_trap(isync);
 #endif
 			}
+			vrrp_sync_update_member_counts(isync);
 		}
 	}
 	vgroup->state = VRRP_STATE_FAULT;
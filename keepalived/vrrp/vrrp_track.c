@@ -36,8 +36,83 @@ dump_track(void *track_data)
 	tracked_if_t *tip = track_data;
 	log_message(LOG_INFO, "     %s weight %d", IF_NAME(tip->ifp), tip->weight);
 }
+
+static void
+free_tracking_vrrp(void *data)
+{
+	FREE(data);
+}
+
+/* Subscribe a vrrp instance to state changes of a tracked interface, so
+ * that an interface transition updates exactly the instances tracking
+ * it rather than every instance re-walking its tracked interface list
+ * on each scheduler tick. The current interface state is folded into
+ * the instance's cached track state straight away. */
+static void
+vrrp_track_subscribe(vrrp_t *vrrp, interface_t *ifp, int weight)
+{
+	tracking_vrrp_t *tvp;
+
+	if (!LIST_EXISTS(ifp->tracking_vrrp)) {
+		ifp->tracking_vrrp = alloc_list(free_tracking_vrrp, NULL);
+		ifp->tracked_up = !!IF_ISUP(ifp);
+	}
+
+	tvp	    = (tracking_vrrp_t *) MALLOC(sizeof(tracking_vrrp_t));
+	tvp->vrrp   = vrrp;
+	tvp->weight = weight;
+
+	list_add(ifp->tracking_vrrp, tvp);
+
+	if (ifp->tracked_up) {
+		if (weight > 0)
+			vrrp->track_if_weight += weight;
+	} else {
+		if (!weight)
+			vrrp->num_track_if_down++;
+		else if (weight < 0)
+			vrrp->track_if_weight += weight;
+	}
+}
+
+/* Fan an interface state transition out to the subscribed instances,
+ * updating their cached tracked interface state. Cheap to call after
+ * any flags or linkbeat refresh; nothing is done unless the UP/DOWN
+ * state really changed. */
 void
-alloc_track(list track_list, vector_t *strvec)
+vrrp_track_interface_update(interface_t *ifp)
+{
+	tracking_vrrp_t *tvp;
+	vrrp_t *vrrp;
+	element e;
+	bool up;
+
+	if (LIST_ISEMPTY(ifp->tracking_vrrp))
+		return;
+
+	up = !!IF_ISUP(ifp);
+	if (up == ifp->tracked_up)
+		return;
+	ifp->tracked_up = up;
+
+	for (e = LIST_HEAD(ifp->tracking_vrrp); e; ELEMENT_NEXT(e)) {
+		tvp = ELEMENT_DATA(e);
+		vrrp = tvp->vrrp;
+		if (!tvp->weight) {
+			if (up)
+				vrrp->num_track_if_down--;
+			else
+				vrrp->num_track_if_down++;
+		} else if ((tvp->weight > 0) == up) {
+			/* positive weights count while up, negative while down */
+			vrrp->track_if_weight += tvp->weight;
+		} else
+			vrrp->track_if_weight -= tvp->weight;
+	}
+}
+
+void
+alloc_track(vrrp_t *vrrp, vector_t *strvec)
 {
 	interface_t *ifp = NULL;
 	tracked_if_t *tip = NULL;
@@ -66,7 +141,9 @@ alloc_track(list track_list, vector_t *strvec)
 	tip->ifp    = ifp;
 	tip->weight = weight;
 
-	list_add(track_list, tip);
+	list_add(vrrp->track_ifp, tip);
+
+	vrrp_track_subscribe(vrrp, ifp, weight);
 }
 
 vrrp_script_t *
@@ -93,8 +170,78 @@ dump_track_script(void *track_data)
 	tracked_sc_t *tsc = track_data;
 	log_message(LOG_INFO, "     %s weight %d", tsc->scr->sname, tsc->weight);
 }
+/* Subscribe a vrrp instance to state changes of a tracked script, the
+ * same way vrrp_track_subscribe() does for interfaces. The instance
+ * counters start from the all-KO baseline; vrrp_script_tracker_update()
+ * folds the real state in once the script results are initialised. */
+static void
+vrrp_script_subscribe(vrrp_t *vrrp, vrrp_script_t *vsc, int weight)
+{
+	tracking_vrrp_t *tvp;
+
+	if (!LIST_EXISTS(vsc->tracking_vrrp)) {
+		vsc->tracking_vrrp = alloc_list(free_tracking_vrrp, NULL);
+		vsc->tracked_ok = false;
+	}
+
+	tvp	    = (tracking_vrrp_t *) MALLOC(sizeof(tracking_vrrp_t));
+	tvp->vrrp   = vrrp;
+	tvp->weight = weight;
+
+	list_add(vsc->tracking_vrrp, tvp);
+
+	if (vsc->tracked_ok) {
+		if (weight > 0)
+			vrrp->track_script_weight += weight;
+	} else {
+		if (!weight)
+			vrrp->num_track_script_down++;
+		else if (weight < 0)
+			vrrp->track_script_weight += weight;
+	}
+}
+
+/* Fan a script OK/KO transition out to the subscribed instances. Called
+ * whenever a script result or init state changes; nothing is done
+ * unless the effective OK state really changed, so each transition
+ * costs the subscriber count rather than a full track list re-sum. */
 void
-alloc_track_script(list track_list, vector_t *strvec, const char *vrrp_iname)
+vrrp_script_tracker_update(vrrp_script_t *vscript)
+{
+	tracking_vrrp_t *tvp;
+	vrrp_t *vrrp;
+	element e;
+	bool ok;
+
+	if (LIST_ISEMPTY(vscript->tracking_vrrp))
+		return;
+
+	/* A disabled script neither contributes weight nor holds an
+	 * instance down */
+	ok = vscript->init_state == SCRIPT_INIT_STATE_DISABLED ||
+	     vscript->result >= vscript->rise;
+	if (ok == vscript->tracked_ok)
+		return;
+	vscript->tracked_ok = ok;
+
+	for (e = LIST_HEAD(vscript->tracking_vrrp); e; ELEMENT_NEXT(e)) {
+		tvp = ELEMENT_DATA(e);
+		vrrp = tvp->vrrp;
+		if (!tvp->weight) {
+			if (ok)
+				vrrp->num_track_script_down--;
+			else
+				vrrp->num_track_script_down++;
+		} else if ((tvp->weight > 0) == ok) {
+			/* positive weights count while OK, negative while KO */
+			vrrp->track_script_weight += tvp->weight;
+		} else
+			vrrp->track_script_weight -= tvp->weight;
+	}
+}
+
+void
+alloc_track_script(vrrp_t *vrrp, vector_t *strvec)
 {
 	vrrp_script_t *vsc = NULL;
 	tracked_sc_t *tsc = NULL;
@@ -105,7 +252,7 @@ alloc_track_script(list track_list, vector_t *strvec, const char *vrrp_iname)
 
 	/* Ignoring if no script found */
 	if (!vsc) {
-		log_message(LOG_INFO, "(%s): track script %s not found, ignoring...", vrrp_iname, tracked);
+		log_message(LOG_INFO, "(%s): track script %s not found, ignoring...", vrrp->iname, tracked);
 		return;
 	}
 
@@ -119,7 +266,7 @@ alloc_track_script(list track_list, vector_t *strvec, const char *vrrp_iname)
 			weight = vsc->weight;
 			log_message(LOG_INFO, "(%s): track script %s: weight must be between [-254..254]"
 					 " inclusive, ignoring...",
-			       vrrp_iname, tracked);
+			       vrrp->iname, tracked);
 		}
 	}
 
@@ -127,7 +274,82 @@ alloc_track_script(list track_list, vector_t *strvec, const char *vrrp_iname)
 	tsc->scr    = vsc;
 	tsc->weight = weight;
 	vsc->inuse++;
-	list_add(track_list, tsc);
+	list_add(vrrp->track_script, tsc);
+
+	vrrp_script_subscribe(vrrp, vsc, weight);
+}
+
+/* With many instances built from one template it is common for several
+ * vrrp_script blocks to run the same command under different names, and
+ * each of them forks it independently every interval. Merge scripts
+ * that would behave identically - same command, same credentials, same
+ * interval and timeout, same rise/fall thresholds - into the first one
+ * defined: its single execution then feeds all the merged subscribers,
+ * so the fork rate depends on the number of distinct commands rather
+ * than the number of names they were given. Must run once the whole
+ * configuration is loaded, before the script results are initialised. */
+void
+vrrp_dedup_scripts(void)
+{
+	vrrp_script_t *scr, *dup;
+	tracking_vrrp_t *tvp;
+	tracked_sc_t *tsc;
+	vrrp_t *vrrp;
+	element e, e2, next, te, ve;
+
+	if (LIST_ISEMPTY(vrrp_data->vrrp_script))
+		return;
+
+	for (e = LIST_HEAD(vrrp_data->vrrp_script); e; ELEMENT_NEXT(e)) {
+		scr = ELEMENT_DATA(e);
+		if (!scr->script)
+			continue;
+
+		for (e2 = e->next; e2; e2 = next) {
+			next = e2->next;
+			dup = ELEMENT_DATA(e2);
+
+			if (!dup->script ||
+			    strcmp(scr->script, dup->script) ||
+			    scr->uid != dup->uid ||
+			    scr->gid != dup->gid ||
+			    scr->interval != dup->interval ||
+			    scr->timeout != dup->timeout ||
+			    scr->rise != dup->rise ||
+			    scr->fall != dup->fall ||
+			    scr->persistent != dup->persistent)
+				continue;
+
+			log_message(LOG_INFO, "VRRP_Script(%s) runs the same command as VRRP_Script(%s) - merging",
+				    dup->sname, scr->sname);
+
+			/* Re-point the instance references at the survivor */
+			for (ve = LIST_HEAD(vrrp_data->vrrp); ve; ELEMENT_NEXT(ve)) {
+				vrrp = ELEMENT_DATA(ve);
+				if (LIST_ISEMPTY(vrrp->track_script))
+					continue;
+				for (te = LIST_HEAD(vrrp->track_script); te; ELEMENT_NEXT(te)) {
+					tsc = ELEMENT_DATA(te);
+					if (tsc->scr == dup)
+						tsc->scr = scr;
+				}
+			}
+
+			/* Move the subscribers over. Both scripts still
+			 * carry the all-KO baseline set at subscribe time,
+			 * so the instance counters remain consistent. */
+			while (!LIST_ISEMPTY(dup->tracking_vrrp)) {
+				tvp = ELEMENT_DATA(LIST_HEAD(dup->tracking_vrrp));
+				list_del(dup->tracking_vrrp, tvp);
+				if (!LIST_EXISTS(scr->tracking_vrrp))
+					scr->tracking_vrrp = alloc_list(free_tracking_vrrp, NULL);
+				list_add(scr->tracking_vrrp, tvp);
+			}
+			scr->inuse += dup->inuse;
+
+			free_list_element(vrrp_data->vrrp_script, e2);
+		}
+	}
 }
 
 /* Test if all tracked interfaces are either UP or weight-tracked */
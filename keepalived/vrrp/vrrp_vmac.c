@@ -58,10 +58,20 @@ make_link_local_address(struct in6_addr* l3_addr, const u_char* ll_addr)
 	l3_addr->s6_addr[15] = ll_addr[5];
 }
 
-static int
+/* Log a failed request from the pipelined configuration batch below.
+ * The cookie is a string describing the failed step. */
+static void
+vmac_batch_ack_handler(void *cookie, int error)
+{
+	if (error)
+		log_message(LOG_INFO, "vmac: %s failed: %s",
+			    (const char *)cookie, strerror(error));
+}
+
+/* Queue the request bringing the interface up on the current batch */
+static void
 netlink_link_up(vrrp_t *vrrp)
 {
-	int status = 1;
 	struct {
 		struct nlmsghdr n;
 		struct ifinfomsg ifi;
@@ -78,10 +88,7 @@ netlink_link_up(vrrp_t *vrrp)
 	req.ifi.ifi_change |= IFF_UP;
 	req.ifi.ifi_flags |= IFF_UP;
 
-	if (netlink_talk(&nl_cmd, &req.n) < 0)
-		status = -1;
-
-	return status;
+	netlink_talk_queue(&nl_cmd, &req.n, "bringing VMAC interface up");
 }
 
 int
@@ -99,6 +106,7 @@ netlink_link_add_vmac(vrrp_t *vrrp)
 		struct ifinfomsg ifi;
 		char buf[256];
 	} req;
+	ipaddress_req_t addr_req;
 
 	if (!vrrp->ifp || __test_bit(VRRP_VMAC_UP_BIT, &vrrp->vmac_flags) || !vrrp->vrid)
 		return -1;
@@ -125,28 +133,59 @@ netlink_link_add_vmac(vrrp_t *vrrp)
 
 			/* Be safe here - we don't want to remove a physical interface */
 			if (ifp->vmac) {
-				/* We have found a VIF but the vmac do not match */
-				log_message(LOG_INFO, "vmac: Removing old VMAC interface %s due to conflicting "
-						      "interface or MAC for vrrp_instance %s!!!"
-						    , vrrp->vmac_ifname, vrrp->iname);
-
-				/* Request that NETLINK remove the VIF interface first */
-				memset(&req, 0, sizeof (req));
-				req.n.nlmsg_len = NLMSG_LENGTH(sizeof (struct ifinfomsg));
-				req.n.nlmsg_flags = NLM_F_REQUEST;
-				req.n.nlmsg_type = RTM_DELLINK;
-				req.ifi.ifi_family = AF_INET;
-				req.ifi.ifi_index = (int)IF_INDEX(ifp);
-
-				if (netlink_talk(&nl_cmd, &req.n) < 0) {
-					log_message(LOG_INFO, "vmac: Error removing VMAC interface %s for "
-							      "vrrp_instance %s!!!"
-							    , vrrp->vmac_ifname, vrrp->iname);
-					return -1;
+				if (ifp->base_ifindex == vrrp->ifp->ifindex) {
+					/* Right underlying interface, wrong MAC.
+					 * Fix the address in place rather than
+					 * recreating the link, so the carrier
+					 * doesn't flap and neighbour entries
+					 * survive the restart. */
+					memset(&req, 0, sizeof (req));
+					req.n.nlmsg_len = NLMSG_LENGTH(sizeof (struct ifinfomsg));
+					req.n.nlmsg_flags = NLM_F_REQUEST;
+					req.n.nlmsg_type = RTM_NEWLINK;
+					req.ifi.ifi_family = AF_UNSPEC;
+					req.ifi.ifi_index = (int)IF_INDEX(ifp);
+					addattr_l(&req.n, sizeof(req), IFLA_ADDRESS, ll_addr, ETH_ALEN);
+
+					if (netlink_talk(&nl_cmd, &req.n) >= 0) {
+						log_message(LOG_INFO, "vmac: Fixed MAC of existing VMAC interface %s "
+								      "for vrrp_instance %s"
+								    , vrrp->vmac_ifname, vrrp->iname);
+						memcpy(ifp->hw_addr, ll_addr, ETH_ALEN);
+						create_interface = false;
+					}
+					else
+						log_message(LOG_INFO, "vmac: Error setting MAC of VMAC interface %s for "
+								      "vrrp_instance %s - recreating it"
+								    , vrrp->vmac_ifname, vrrp->iname);
 				}
 
-				/* Interface successfully removed, now recreate */
-				ifp = NULL;
+				/* The underlying interface of a macvlan cannot be
+				 * changed once created, so here removal is the only
+				 * option left */
+				if (create_interface) {
+					log_message(LOG_INFO, "vmac: Removing old VMAC interface %s due to conflicting "
+							      "interface or MAC for vrrp_instance %s!!!"
+							    , vrrp->vmac_ifname, vrrp->iname);
+
+					/* Request that NETLINK remove the VIF interface first */
+					memset(&req, 0, sizeof (req));
+					req.n.nlmsg_len = NLMSG_LENGTH(sizeof (struct ifinfomsg));
+					req.n.nlmsg_flags = NLM_F_REQUEST;
+					req.n.nlmsg_type = RTM_DELLINK;
+					req.ifi.ifi_family = AF_INET;
+					req.ifi.ifi_index = (int)IF_INDEX(ifp);
+
+					if (netlink_talk(&nl_cmd, &req.n) < 0) {
+						log_message(LOG_INFO, "vmac: Error removing VMAC interface %s for "
+								      "vrrp_instance %s!!!"
+								    , vrrp->vmac_ifname, vrrp->iname);
+						return -1;
+					}
+
+					/* Interface successfully removed, now recreate */
+					ifp = NULL;
+				}
 			}
 		}
 		else
@@ -199,11 +238,19 @@ netlink_link_add_vmac(vrrp_t *vrrp)
 	base_ifp = vrrp->ifp;
 	base_ifindex = vrrp->ifp->ifindex;
 	ifp->flags = vrrp->ifp->flags; /* Copy base interface flags */
+	vrrp_track_interface_update(ifp);
 	vrrp->ifp = ifp;
 	vrrp->ifp->base_ifindex = base_ifindex;
 	vrrp->ifp->vmac = true;
+	if_vmac_add(vrrp->ifp);
 	vrrp->vmac_ifindex = IF_INDEX(vrrp->ifp); /* For use on delete */
 
+	/* The remaining configuration requests don't need their results, so
+	 * pipeline them on the command channel and only collect the ACKs once,
+	 * rather than a synchronous round-trip per request. The kernel processes
+	 * requests on a socket in order, so the sequencing is preserved. */
+	netlink_batch_begin(vmac_batch_ack_handler);
+
 	if (vrrp->family == AF_INET) {
 		/* Set the necessary kernel parameters to make macvlans work for us */
 		set_interface_parameters(ifp, base_ifp);
@@ -237,8 +284,7 @@ netlink_link_add_vmac(vrrp_t *vrrp)
 		data->rta_len = (unsigned short)((void *)NLMSG_TAIL(&req.n) - (void *)data);
 		spec->rta_len = (unsigned short)((void *)NLMSG_TAIL(&req.n) - (void *)spec);
 
-		if (netlink_talk(&nl_cmd, &req.n) < 0)
-			log_message(LOG_INFO, "vmac: Error setting ADDR_GEN_MODE to NONE");
+		netlink_talk_queue(&nl_cmd, &req.n, "setting ADDR_GEN_MODE to NONE");
 #endif
 
 		if (vrrp->family == AF_INET6) {
@@ -263,8 +309,8 @@ netlink_link_add_vmac(vrrp_t *vrrp)
 			ipaddress.ifa.ifa_prefixlen = 64;
 			ipaddress.ifa.ifa_index = vrrp->vmac_ifindex;
 
-			if (netlink_ipaddress(&ipaddress, IPADDRESS_ADD) != 1)
-				log_message(LOG_INFO, "Adding link-local address to vmac failed");
+			netlink_ipaddress_build(&ipaddress, IPADDRESS_ADD, &addr_req);
+			netlink_talk_queue(&nl_cmd, &addr_req.n, "adding link-local address");
 
 			/* Save the address as source for vrrp packets */
 			if (vrrp->saddr.ss_family == AF_UNSPEC)
@@ -295,11 +341,13 @@ netlink_link_add_vmac(vrrp_t *vrrp)
 		ipaddress.ifa.ifa_prefixlen = 64;
 		ipaddress.ifa.ifa_index = vrrp->vmac_ifindex;
 
-		if (netlink_ipaddress(&ipaddress, IPADDRESS_DEL) != 1)
-			log_message(LOG_INFO, "Deleting auto link-local address from vmac failed");
+		netlink_ipaddress_build(&ipaddress, IPADDRESS_DEL, &addr_req);
+		netlink_talk_queue(&nl_cmd, &addr_req.n, "deleting auto link-local address");
 	}
 #endif
 
+	netlink_batch_end(&nl_cmd);
+
 	/* If we are adding a large number of interfaces, the netlink socket
 	 * may run out of buffers if we don't receive the netlink messages
 	 * as we progress */
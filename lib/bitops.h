@@ -50,8 +50,11 @@ static inline bool __test_bit(unsigned idx, unsigned long *bmap)
 enum global_bits {
 	LOG_CONSOLE_BIT,
 	NO_SYSLOG_BIT,
+	LOG_ASYNC_BIT,
+	LOG_JOURNAL_BIT,
 	DONT_FORK_BIT,
 	DUMP_CONF_BIT,
+	CONFIG_TEST_BIT,
 #ifdef _WITH_VRRP_
 	DONT_RELEASE_VRRP_BIT,
 	RELEASE_VIPS_BIT,
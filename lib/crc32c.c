@@ -0,0 +1,114 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        CRC32C (Castagnoli) - a fast non-cryptographic
+ *              fingerprint for content-change detection where
+ *              cryptographic strength is irrelevant. Uses the SSE4.2
+ *              crc32 instruction when the CPU has it, a table-driven
+ *              software implementation otherwise.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY_REFLECTED	0x82f63b78U
+
+static uint32_t crc32c_table[256];
+
+static void
+crc32c_table_init(void)
+{
+	uint32_t crc;
+	unsigned i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY_REFLECTED : 0);
+		crc32c_table[i] = crc;
+	}
+}
+
+static uint32_t
+crc32c_update_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len--)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+#if defined __x86_64__ || defined __i386__
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_update_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+
+	while (len >= sizeof(uint64_t)) {
+		uint64_t v;
+
+		__builtin_memcpy(&v, p, sizeof(v));
+		crc64 = __builtin_ia32_crc32di(crc64, v);
+		p += sizeof(v);
+		len -= sizeof(v);
+	}
+	crc = (uint32_t)crc64;
+#endif
+
+	while (len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+
+	return crc;
+}
+
+#endif
+
+uint32_t
+crc32c_update(uint32_t crc, const void *buf, size_t len)
+{
+	static enum { CRC_UNRESOLVED, CRC_HW, CRC_SW } mode = CRC_UNRESOLVED;
+
+	if (mode == CRC_UNRESOLVED) {
+#if defined __x86_64__ || defined __i386__
+		if (__builtin_cpu_supports("sse4.2"))
+			mode = CRC_HW;
+		else
+#endif
+		{
+			crc32c_table_init();
+			mode = CRC_SW;
+		}
+	}
+
+#if defined __x86_64__ || defined __i386__
+	if (mode == CRC_HW)
+		return crc32c_update_hw(crc, buf, len);
+#endif
+
+	return crc32c_update_sw(crc, buf, len);
+}
@@ -0,0 +1,38 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        crc32c.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Streaming CRC32C (Castagnoli). Start from CRC32C_INIT, feed chunks
+ * through crc32c_update(), apply CRC32C_FINAL to the result. Uses the
+ * SSE4.2 crc32 instruction when the CPU has it. */
+
+#define CRC32C_INIT	0xffffffffU
+#define CRC32C_FINAL(c)	((c) ^ 0xffffffffU)
+
+extern uint32_t crc32c_update(uint32_t, const void *, size_t);
+
+#endif
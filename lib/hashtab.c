@@ -0,0 +1,183 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Open-addressing hash table. Used for the hot lookup
+ *              structures (interface by ifindex, ...) where walking a
+ *              malloc-per-node linked list costs a pointer chase and a
+ *              cache miss per element.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include "hashtab.h"
+#include "memory.h"
+
+/* Sentinel marking a slot whose entry has been deleted */
+#define HTAB_TOMBSTONE	((void *)-1)
+
+#define HTAB_MIN_SIZE	16
+
+/* splitmix64 finaliser - good avalanche for sequential keys
+ * such as fds and ifindexes */
+static uint64_t
+htab_hash(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+
+	return key;
+}
+
+void
+htab_init(hashtab_t *htab, unsigned hint)
+{
+	unsigned size = HTAB_MIN_SIZE;
+
+	/* Size for the hint at no more than 50% load */
+	while (size < hint * 2)
+		size <<= 1;
+
+	htab->keys = (uint64_t *) MALLOC(size * sizeof(uint64_t));
+	htab->vals = (void **) MALLOC(size * sizeof(void *));
+	htab->size = size;
+	htab->count = 0;
+	htab->tombstones = 0;
+}
+
+void
+htab_destroy(hashtab_t *htab)
+{
+	FREE_PTR(htab->keys);
+	FREE_PTR(htab->vals);
+	htab->size = htab->count = htab->tombstones = 0;
+}
+
+static void
+htab_rehash(hashtab_t *htab, unsigned new_size)
+{
+	uint64_t *old_keys = htab->keys;
+	void **old_vals = htab->vals;
+	unsigned old_size = htab->size;
+	unsigned i, slot;
+
+	htab->keys = (uint64_t *) MALLOC(new_size * sizeof(uint64_t));
+	htab->vals = (void **) MALLOC(new_size * sizeof(void *));
+	htab->size = new_size;
+	htab->tombstones = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (!old_vals[i] || old_vals[i] == HTAB_TOMBSTONE)
+			continue;
+
+		slot = (unsigned)htab_hash(old_keys[i]) & (new_size - 1);
+		while (htab->vals[slot])
+			slot = (slot + 1) & (new_size - 1);
+		htab->keys[slot] = old_keys[i];
+		htab->vals[slot] = old_vals[i];
+	}
+
+	FREE(old_keys);
+	FREE(old_vals);
+}
+
+/* Insert or replace the entry for key. Returns true if a new entry
+ * was created, false if an existing value was replaced. */
+bool
+htab_insert(hashtab_t *htab, uint64_t key, void *val)
+{
+	unsigned slot, free_slot;
+
+	if (!htab->size)
+		htab_init(htab, 0);
+
+	/* Grow when the table is 70% occupied (including tombstones) */
+	if ((htab->count + htab->tombstones) * 10 >= htab->size * 7)
+		htab_rehash(htab, htab->count * 4 > htab->size * 2 ? htab->size * 2 : htab->size);
+
+	/* Read the size only once the table exists and has been resized */
+	free_slot = htab->size;
+	slot = (unsigned)htab_hash(key) & (htab->size - 1);
+	while (htab->vals[slot]) {
+		if (htab->vals[slot] == HTAB_TOMBSTONE) {
+			if (free_slot == htab->size)
+				free_slot = slot;
+		} else if (htab->keys[slot] == key) {
+			htab->vals[slot] = val;
+			return false;
+		}
+		slot = (slot + 1) & (htab->size - 1);
+	}
+
+	if (free_slot != htab->size) {
+		slot = free_slot;
+		htab->tombstones--;
+	}
+
+	htab->keys[slot] = key;
+	htab->vals[slot] = val;
+	htab->count++;
+
+	return true;
+}
+
+void *
+htab_find(const hashtab_t *htab, uint64_t key)
+{
+	unsigned slot;
+
+	if (!htab->size)
+		return NULL;
+
+	slot = (unsigned)htab_hash(key) & (htab->size - 1);
+	while (htab->vals[slot]) {
+		if (htab->vals[slot] != HTAB_TOMBSTONE && htab->keys[slot] == key)
+			return htab->vals[slot];
+		slot = (slot + 1) & (htab->size - 1);
+	}
+
+	return NULL;
+}
+
+/* Remove the entry for key, returning its value (NULL if not found) */
+void *
+htab_del(hashtab_t *htab, uint64_t key)
+{
+	unsigned slot;
+	void *val;
+
+	if (!htab->size)
+		return NULL;
+
+	slot = (unsigned)htab_hash(key) & (htab->size - 1);
+	while (htab->vals[slot]) {
+		if (htab->vals[slot] != HTAB_TOMBSTONE && htab->keys[slot] == key) {
+			val = htab->vals[slot];
+			htab->vals[slot] = HTAB_TOMBSTONE;
+			htab->count--;
+			htab->tombstones++;
+			return val;
+		}
+		slot = (slot + 1) & (htab->size - 1);
+	}
+
+	return NULL;
+}
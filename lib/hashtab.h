@@ -0,0 +1,47 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        hashtab.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _HASHTAB_H
+#define _HASHTAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Open-addressing hash table mapping a 64 bit key to a pointer.
+ * Linear probing, grown when 70% full; O(1) expected find/insert/del
+ * with no per-entry allocation. */
+typedef struct _hashtab {
+	uint64_t *keys;
+	void **vals;		/* NULL = empty, HTAB_TOMBSTONE = deleted */
+	unsigned size;		/* number of slots, power of two */
+	unsigned count;		/* live entries */
+	unsigned tombstones;	/* deleted slots awaiting rehash */
+} hashtab_t;
+
+/* Prototypes */
+extern void htab_init(hashtab_t *, unsigned);
+extern void htab_destroy(hashtab_t *);
+extern bool htab_insert(hashtab_t *, uint64_t, void *);
+extern void *htab_find(const hashtab_t *, uint64_t);
+extern void *htab_del(hashtab_t *, uint64_t);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Intrusive hash-list primitives. Unlike lib/list.c the
+ *              node lives inside the linked object, so adding and
+ *              removing an entry costs no allocation and lookups do a
+ *              single pointer chase per element.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _HLIST_H
+#define _HLIST_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Singly linked bucket chain with O(1) unlink via pprev */
+typedef struct _hlist_node {
+	struct _hlist_node *next;
+	struct _hlist_node **pprev;
+} hlist_node_t;
+
+typedef struct _hlist_head {
+	hlist_node_t *first;
+} hlist_head_t;
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+#define hlist_entry(ptr, type, member)	container_of(ptr, type, member)
+
+static inline void
+hlist_head_init(hlist_head_t *h)
+{
+	h->first = NULL;
+}
+
+static inline void
+hlist_node_init(hlist_node_t *n)
+{
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+static inline bool
+hlist_empty(const hlist_head_t *h)
+{
+	return !h->first;
+}
+
+static inline bool
+hlist_unhashed(const hlist_node_t *n)
+{
+	return !n->pprev;
+}
+
+static inline void
+hlist_add_head(hlist_node_t *n, hlist_head_t *h)
+{
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void
+hlist_del(hlist_node_t *n)
+{
+	if (hlist_unhashed(n))
+		return;
+
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	hlist_node_init(n);
+}
+
+#define hlist_for_each(pos, head) \
+	for ((pos) = (head)->first; (pos); (pos) = (pos)->next)
+
+#define hlist_for_each_safe(pos, n, head) \
+	for ((pos) = (head)->first; (pos) && ((n) = (pos)->next, true); (pos) = (n))
+
+#define hlist_for_each_entry(entry, pos, head, member)			\
+	for ((pos) = (head)->first;					\
+	     (pos) && ((entry) = hlist_entry(pos, __typeof__(*(entry)), member), true); \
+	     (pos) = (pos)->next)
+
+#endif
@@ -29,6 +29,7 @@
 
 /* HTTP header tag */
 #define CONTENT_LENGTH	"Content-Length:"
+#define CONTENT_ENCODING "Content-Encoding:"
 
 /* Return the http header content length */
 size_t extract_content_length(char *buffer, size_t size)
@@ -43,6 +44,33 @@ size_t extract_content_length(char *buffer, size_t size)
 	return atoi(clen + strlen(CONTENT_LENGTH));
 }
 
+/* Return the http header content encoding, NULL if not present.
+ * The returned string is allocated and must be freed by the caller. */
+char *extract_content_encoding(char *buffer, size_t size)
+{
+	char *cenc = strstr(buffer, CONTENT_ENCODING);
+	char *end = buffer + size;
+	char *p;
+	char *value;
+	size_t len;
+
+	/* Pattern not found */
+	if (!cenc || cenc > end)
+		return NULL;
+
+	/* Content-Encoding extraction */
+	cenc += strlen(CONTENT_ENCODING);
+	while (cenc < end && (*cenc == ' ' || *cenc == '\t'))
+		cenc++;
+	for (p = cenc; p < end && *p != '\r' && *p != '\n'; p++);
+
+	len = (size_t)(p - cenc);
+	value = (char *)MALLOC(len + 1);
+	memcpy(value, cenc, len);
+
+	return value;
+}
+
 /*
  * Return the http header error code. According
  * to rfc2616.6.1 status code is between HTTP_Version
@@ -82,3 +110,22 @@ char *extract_html(char *buffer, size_t size_buffer)
 			return cur + 4;
 	return NULL;
 }
+
+/* Incremental variant of extract_html. *scanned holds the number of
+ * bytes already searched, so a caller accumulating the headers over
+ * several reads only scans each byte once instead of re-scanning the
+ * whole buffer after every read. Start 3 bytes back in case the
+ * separator straddles two reads. */
+char *extract_html_incr(char *buffer, size_t size_buffer, size_t *scanned)
+{
+	char *end = buffer + size_buffer;
+	char *cur = buffer + (*scanned > 3 ? *scanned - 3 : 0);
+
+	for (; cur + 3 < end; cur++)
+		if (*cur == '\r' && *(cur+1) == '\n'
+		    && *(cur+2) == '\r' && *(cur+3) == '\n')
+			return cur + 4;
+
+	*scanned = size_buffer;
+	return NULL;
+}
@@ -25,7 +25,9 @@
 
 /* Prototypes */
 extern size_t extract_content_length(char *buffer, size_t size);
+extern char *extract_content_encoding(char *buffer, size_t size);
 extern int extract_status_code(char *buffer, size_t size);
 extern char *extract_html(char *buffer, size_t size_buffer);
+extern char *extract_html_incr(char *buffer, size_t size_buffer, size_t *scanned);
 
 #endif
@@ -24,11 +24,15 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <memory.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "logger.h"
 #include "bitops.h"
@@ -42,6 +46,129 @@ char *log_file_name;
 static FILE *log_file;
 bool always_flush_log_file;
 
+/* Async syslog. syslog() can block when syslogd is slow, which delays
+ * advert transmission enough to cause spurious failovers when many
+ * instances transition at once. When enabled, messages are sent as
+ * non-blocking datagrams straight to /dev/log and dropped (counted)
+ * if the socket buffer is full, so the caller never blocks. */
+static int log_sock = -1;
+static char log_ident[64];
+static int log_async_facility;
+static pid_t log_pid;
+static unsigned log_dropped;
+
+/* Native journald logging. When the consumer is journald anyway, the
+ * syslog(3) path costs a needless round trip: a fully rendered line is
+ * handed over, and journald re-parses the priority, identifier and pid
+ * back out of it. The native protocol sends them as separate fields in
+ * one datagram to the journal socket, and the fields that never change
+ * - identifier, pid, facility - are rendered exactly once at enable
+ * time. Structured context fields (instance names etc.) ride along as
+ * their own indexed fields instead of being embedded in the message
+ * text. */
+#define JOURNAL_SOCKET	"/run/systemd/journal/socket"
+#define LOG_CTX_FIELDS	4
+
+static int journal_sock = -1;
+static char journal_static[160];	/* SYSLOG_IDENTIFIER, SYSLOG_PID, SYSLOG_FACILITY */
+static size_t journal_static_len;
+
+/* Sticky structured context, e.g. VRRP_INSTANCE=VI_1. Rendered once
+ * when set, attached to every record until cleared. Slots are owned by
+ * field name pointer, the same way the rate limiter keys on the format
+ * pointer, so callers pass string literals. */
+typedef struct _log_ctx {
+	const char	*field;
+	char		rendered[136];	/* FIELD=value\n */
+	size_t		len;
+} log_ctx_t;
+
+static log_ctx_t log_ctx[LOG_CTX_FIELDS];
+
+/* Rate limiting. A flapping interface produces the same log lines
+ * thousands of times per minute, each formatted and sent to syslog.
+ * Each callsite - identified by its format string pointer, so the
+ * decision is made before any formatting work - is allowed a burst of
+ * messages per window; further repeats only bump a counter, reported
+ * as "last message repeated N times" once the callsite quiets down.
+ * A token bucket caps the overall rate across callsites on top. The
+ * limits are far above anything steady-state operation produces. */
+#define LOG_RATE_SLOTS		128		/* power of two */
+#define LOG_RATE_WINDOW		10		/* seconds */
+#define LOG_RATE_BURST		30		/* messages per callsite per window */
+#define LOG_BUCKET_MAX		200		/* global burst */
+#define LOG_BUCKET_RATE		100		/* global messages per second */
+
+typedef struct _log_rate {
+	const char	*format;	/* callsite owning this slot */
+	time_t		window;		/* start of its current window */
+	unsigned	count;		/* messages sent in the window */
+	unsigned	suppressed;	/* messages swallowed since last report */
+} log_rate_t;
+
+static log_rate_t log_rates[LOG_RATE_SLOTS];
+static time_t log_bucket_time;
+static unsigned log_bucket_tokens = LOG_BUCKET_MAX;
+static unsigned log_limited;		/* messages dropped by the global cap */
+
+/* Per-subsystem levels - see logger.h. LOG_INFO by default, so debug
+ * gated callsites compile to a compare-and-skip until a subsystem is
+ * raised; -D raises them all at startup. */
+int log_subsys_level[LOG_SUBSYS_COUNT] = {
+	LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO
+};
+
+static const char * const log_subsys_names[LOG_SUBSYS_COUNT] = {
+	"vrrp", "check", "netlink", "scheduler"
+};
+
+static const char * const log_level_names[LOG_DEBUG + 1] = {
+	"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+/* Set one subsystem's level, or every subsystem's with "all". The
+ * level is a syslog priority name or digit. Returns false if either
+ * name fails to parse; the caller reports to the operator. */
+bool
+log_subsys_set_level(const char *subsys, const char *level)
+{
+	int new_level = -1;
+	bool all = !strcmp(subsys, "all");
+	bool found = false;
+	unsigned i;
+
+	for (i = 0; i <= LOG_DEBUG; i++) {
+		if (!strcmp(level, log_level_names[i])) {
+			new_level = (int)i;
+			break;
+		}
+	}
+	if (new_level == -1) {
+		if (level[0] < '0' || level[0] > '0' + LOG_DEBUG || level[1])
+			return false;
+		new_level = level[0] - '0';
+	}
+
+	for (i = 0; i < LOG_SUBSYS_COUNT; i++) {
+		if (!all && strcmp(subsys, log_subsys_names[i]))
+			continue;
+		log_subsys_level[i] = new_level;
+		found = true;
+	}
+
+	return found;
+}
+
+void
+log_subsys_dump(FILE *file)
+{
+	unsigned i;
+
+	for (i = 0; i < LOG_SUBSYS_COUNT; i++)
+		fprintf(file, "%s %s\n", log_subsys_names[i],
+			log_level_names[log_subsys_level[i]]);
+}
+
 void
 enable_console_log(void)
 {
@@ -122,12 +249,163 @@ flush_log_file(void)
 }
 
 void
-vlog_message(const int facility, const char* format, va_list args)
+enable_async_log(const char *ident, int facility)
 {
-	char buf[MAX_LOG_MSG+1];
+	struct sockaddr_un sa = { .sun_family = AF_UNIX, .sun_path = "/dev/log" };
 
-	vsnprintf(buf, sizeof(buf), format, args);
+	if (log_sock != -1) {
+		close(log_sock);
+		log_sock = -1;
+	}
+
+	log_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (log_sock == -1) {
+		log_message(LOG_INFO, "Unable to open async log socket (%s) - using syslog()", strerror(errno));
+		return;
+	}
+
+	if (connect(log_sock, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		log_message(LOG_INFO, "Unable to connect async log socket (%s) - using syslog()", strerror(errno));
+		close(log_sock);
+		log_sock = -1;
+		return;
+	}
+
+	strncpy(log_ident, ident, sizeof(log_ident) - 1);
+	log_async_facility = facility;
+	log_pid = getpid();
+}
+
+void
+enable_journal_log(const char *ident, int facility)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX, .sun_path = JOURNAL_SOCKET };
+	int len;
+
+	if (journal_sock != -1) {
+		close(journal_sock);
+		journal_sock = -1;
+	}
 
+	journal_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (journal_sock == -1) {
+		log_message(LOG_INFO, "Unable to open journal socket (%s) - using syslog()", strerror(errno));
+		return;
+	}
+
+	if (connect(journal_sock, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		log_message(LOG_INFO, "Unable to connect journal socket (%s) - using syslog()", strerror(errno));
+		close(journal_sock);
+		journal_sock = -1;
+		return;
+	}
+
+	len = snprintf(journal_static, sizeof(journal_static),
+		       "SYSLOG_IDENTIFIER=%s\nSYSLOG_PID=%d\nSYSLOG_FACILITY=%d\n",
+		       ident, getpid(), LOG_FAC(facility));
+	journal_static_len = (size_t)len;
+}
+
+/* Set (value != NULL) or clear a sticky structured context field */
+void
+log_set_context(const char *field, const char *value)
+{
+	log_ctx_t *ctx = NULL;
+	unsigned i;
+	int len;
+
+	for (i = 0; i < LOG_CTX_FIELDS; i++) {
+		if (log_ctx[i].field == field) {
+			ctx = &log_ctx[i];
+			break;
+		}
+		if (!log_ctx[i].field && !ctx)
+			ctx = &log_ctx[i];
+	}
+
+	if (!ctx)
+		return;
+
+	if (!value) {
+		ctx->field = NULL;
+		ctx->len = 0;
+		return;
+	}
+
+	len = snprintf(ctx->rendered, sizeof(ctx->rendered), "%s=%s\n", field, value);
+	if (len >= (int)sizeof(ctx->rendered))
+		len = sizeof(ctx->rendered) - 1;
+	ctx->field = field;
+	ctx->len = (size_t)len;
+}
+
+/* Send one native journald record without blocking. The static and
+ * context fields are pre-rendered; only PRIORITY and MESSAGE are
+ * assembled here. Returns false if the datagram had to be dropped. */
+static bool
+journal_log(int priority, const char *msg)
+{
+	char prio[sizeof("PRIORITY=7\n")];
+	char message[MAX_LOG_MSG + sizeof("MESSAGE=\n")];
+	struct iovec iov[3 + LOG_CTX_FIELDS];
+	struct msghdr msgh = { .msg_iov = iov };
+	unsigned n = 0, i;
+	int len;
+
+	iov[n].iov_base = journal_static;
+	iov[n++].iov_len = journal_static_len;
+
+	iov[n].iov_base = prio;
+	iov[n++].iov_len = (size_t)snprintf(prio, sizeof(prio), "PRIORITY=%d\n", LOG_PRI(priority));
+
+	for (i = 0; i < LOG_CTX_FIELDS; i++) {
+		if (!log_ctx[i].field)
+			continue;
+		iov[n].iov_base = log_ctx[i].rendered;
+		iov[n++].iov_len = log_ctx[i].len;
+	}
+
+	/* Our messages never contain newlines, so the simple field
+	 * encoding is always usable */
+	len = snprintf(message, sizeof(message), "MESSAGE=%s\n", msg);
+	if (len >= (int)sizeof(message))
+		len = sizeof(message) - 1;
+	iov[n].iov_base = message;
+	iov[n++].iov_len = (size_t)len;
+
+	msgh.msg_iovlen = n;
+
+	return sendmsg(journal_sock, &msgh, MSG_DONTWAIT) != -1;
+}
+
+/* Format and send one RFC3164 style datagram without blocking.
+ * Returns false if the message had to be dropped. */
+static bool
+async_syslog(int priority, const char *msg)
+{
+	char dgram[MAX_LOG_MSG + 128];
+	char timestamp[32];
+	time_t t = time(NULL);
+	struct tm tm;
+	int len;
+
+	if (!(priority & LOG_FACMASK))
+		priority |= log_async_facility;
+
+	localtime_r(&t, &tm);
+	strftime(timestamp, sizeof(timestamp), "%h %e %T", &tm);
+
+	len = snprintf(dgram, sizeof(dgram), "<%d>%s %s[%d]: %s", priority, timestamp, log_ident, log_pid, msg);
+	if (len >= (int)sizeof(dgram))
+		len = sizeof(dgram) - 1;
+
+	return send(log_sock, dgram, (size_t)len, MSG_DONTWAIT) != -1;
+}
+
+/* Write one already formatted message to the configured outputs */
+static void
+log_emit(const int facility, const char *buf)
+{
 	if (log_file || (__test_bit(DONT_FORK_BIT, &debug) && log_console)) {
 		/* timestamp setup */
 		time_t t = time(NULL);
@@ -145,8 +423,92 @@ vlog_message(const int facility, const char* format, va_list args)
 		}
 	}
 
-	if (!__test_bit(NO_SYSLOG_BIT, &debug))
-		syslog(facility, "%s", buf);
+	if (!__test_bit(NO_SYSLOG_BIT, &debug)) {
+		if (journal_sock != -1) {
+			/* Report any earlier overflow before sending more */
+			if (log_dropped) {
+				char drop_msg[64];
+
+				snprintf(drop_msg, sizeof(drop_msg), "%u log messages dropped - journal not keeping up", log_dropped);
+				if (journal_log(LOG_WARNING, drop_msg))
+					log_dropped = 0;
+			}
+
+			if (log_dropped || !journal_log(facility, buf))
+				log_dropped++;
+		} else if (log_sock != -1) {
+			/* Report any earlier overflow before sending more */
+			if (log_dropped) {
+				char drop_msg[64];
+
+				snprintf(drop_msg, sizeof(drop_msg), "%u log messages dropped - syslog not keeping up", log_dropped);
+				if (async_syslog(LOG_WARNING, drop_msg))
+					log_dropped = 0;
+			}
+
+			if (log_dropped || !async_syslog(facility, buf))
+				log_dropped++;
+		} else
+			syslog(facility, "%s", buf);
+	}
+}
+
+void
+vlog_message(const int facility, const char* format, va_list args)
+{
+	char buf[MAX_LOG_MSG+1];
+	char summary[64];
+	log_rate_t *rate;
+	unsigned refill;
+	time_t now = time(NULL);
+
+	/* Per-callsite limit */
+	rate = &log_rates[((uintptr_t)format >> 4) & (LOG_RATE_SLOTS - 1)];
+	if (rate->format == format && now < rate->window + LOG_RATE_WINDOW) {
+		if (rate->count >= LOG_RATE_BURST) {
+			rate->suppressed++;
+			return;
+		}
+	} else {
+		/* New window, or another callsite taking over the slot -
+		 * settle the suppression account of the previous one */
+		if (rate->suppressed) {
+			snprintf(summary, sizeof(summary), "last message repeated %u times", rate->suppressed);
+			log_emit(facility, summary);
+		}
+		rate->format = format;
+		rate->window = now;
+		rate->count = 0;
+		rate->suppressed = 0;
+	}
+	rate->count++;
+
+	/* Global cap - a storm spread across many callsites still cannot
+	 * flood the syslog pipeline */
+	if (now != log_bucket_time) {
+		refill = log_bucket_time && now > log_bucket_time ?
+			(unsigned)(now - log_bucket_time) * LOG_BUCKET_RATE : LOG_BUCKET_MAX;
+		log_bucket_tokens = refill >= LOG_BUCKET_MAX - log_bucket_tokens ?
+			LOG_BUCKET_MAX : log_bucket_tokens + refill;
+		log_bucket_time = now;
+	}
+	if (!log_bucket_tokens) {
+		rate->suppressed++;
+		log_limited++;
+		return;
+	}
+	log_bucket_tokens--;
+
+	if (log_limited) {
+		snprintf(summary, sizeof(summary), "%u log messages suppressed by rate limit", log_limited);
+		log_emit(LOG_WARNING, summary);
+		log_limited = 0;
+		if (log_bucket_tokens)
+			log_bucket_tokens--;
+	}
+
+	vsnprintf(buf, sizeof(buf), format, args);
+	log_emit(facility, buf);
 }
 
 void
@@ -24,10 +24,37 @@
 #define _LOGGER_H
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <syslog.h>
 
 #define	MAX_LOG_MSG	255
 
+/* Per-subsystem logging levels. A callsite gated by log_subsys()
+ * evaluates nothing - not even its arguments - unless the subsystem's
+ * level admits the priority, so a suppressed debug diagnostic on a hot
+ * path costs a single compare. The levels are syslog priorities,
+ * default LOG_INFO, and can be raised at runtime through the control
+ * sockets ("loglevel netlink debug") to get verbose diagnostics from
+ * one subsystem without paying formatting costs anywhere else. */
+typedef enum {
+	LOG_SUBSYS_VRRP,
+	LOG_SUBSYS_CHECK,
+	LOG_SUBSYS_NETLINK,
+	LOG_SUBSYS_SCHED,
+	LOG_SUBSYS_COUNT
+} log_subsys_t;
+
+extern int log_subsys_level[LOG_SUBSYS_COUNT];
+
+#define log_subsys(sub, prio, fmt, ...)				\
+do {								\
+	if ((prio) <= log_subsys_level[sub])			\
+		log_message((prio), (fmt), ##__VA_ARGS__);	\
+} while (0)
+
+#define log_debug(sub, fmt, ...)	log_subsys((sub), LOG_DEBUG, (fmt), ##__VA_ARGS__)
+
 extern char *log_file_name;
 
 extern void enable_console_log(void);
@@ -35,9 +62,14 @@ extern void set_flush_log_file(void);
 extern void close_log_file(void);
 extern void open_log_file(const char *, const char *, const char *, const char *);
 extern void flush_log_file(void);
+extern void enable_async_log(const char *, int);
+extern void enable_journal_log(const char *, int);
+extern void log_set_context(const char *, const char *);
 extern void vlog_message(const int facility, const char* format, va_list args)
 	__attribute__ ((format (printf, 2, 0)));
 extern void log_message(int priority, const char* format, ...)
 	__attribute__ ((format (printf, 2, 3)));
+extern bool log_subsys_set_level(const char *, const char *);
+extern void log_subsys_dump(FILE *);
 
 #endif
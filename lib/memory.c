@@ -34,6 +34,8 @@
 
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "memory.h"
 #include "utils.h"
@@ -83,6 +85,315 @@ zalloc(unsigned long size)
 	return mem;
 }
 
+/* Always-on memory accounting.
+ *
+ * Production builds used to have no visibility of memory use at all -
+ * tracking was only available with the O(n)-per-free _MEM_CHECK_ build.
+ * Here each allocation is prefixed with a header recording its size and
+ * the subsystem it belongs to, so per-subsystem byte counters can be
+ * maintained with one add/subtract per allocation and free. The
+ * counters are reported in the state dumps. */
+
+typedef struct {
+	size_t size;		/* requested size */
+	size_t ctx;		/* owning subsystem */
+} mem_hdr_t;
+
+static size_t mem_ctx_allocated[MEM_CTX_MAX];
+static mem_ctx_t mem_ctx_current = MEM_CTX_DEFAULT;
+
+static const char * const mem_ctx_names[MEM_CTX_MAX] = {
+	"default",
+	"parser",
+	"scheduler",
+	"vrrp",
+	"check",
+};
+
+/* Set the subsystem subsequent allocations are accounted to, returning
+ * the previous one so callers can restore it */
+mem_ctx_t
+mem_ctx_set(mem_ctx_t ctx)
+{
+	mem_ctx_t old = mem_ctx_current;
+
+	mem_ctx_current = ctx;
+	return old;
+}
+
+size_t
+mem_ctx_get_bytes(mem_ctx_t ctx)
+{
+	return mem_ctx_allocated[ctx];
+}
+
+const char *
+mem_ctx_name(mem_ctx_t ctx)
+{
+	return mem_ctx_names[ctx];
+}
+
+void
+mem_ctx_print(FILE *fp)
+{
+	int ctx;
+
+	fprintf(fp, "------< Memory usage >------\n");
+	for (ctx = 0; ctx < MEM_CTX_MAX; ctx++)
+		fprintf(fp, " %s = %zu bytes\n", mem_ctx_names[ctx], mem_ctx_allocated[ctx]);
+}
+
+void
+mem_ctx_log(void)
+{
+	int ctx;
+
+	log_message(LOG_INFO, "------< Memory usage >------");
+	for (ctx = 0; ctx < MEM_CTX_MAX; ctx++)
+		log_message(LOG_INFO, " %s = %zu bytes", mem_ctx_names[ctx], mem_ctx_allocated[ctx]);
+}
+
+/* Sampled allocation profiler.
+ *
+ * Every allocation arrives with its callsite (the MALLOC macro passes
+ * __FILE__/__FUNCTION__/__LINE__ in all builds), and 1 in
+ * MEM_PROF_SAMPLE of them is accounted into a fixed open-addressed
+ * table keyed on the callsite. The hot path cost is one counter
+ * decrement for unsampled allocations, so this stays on in production
+ * and a slowly leaking callsite can be named from a running daemon
+ * instead of reproducing under _MEM_CHECK_. Scaled totals and rates
+ * are printed by the control socket "memprof" command. */
+
+#define MEM_PROF_SAMPLE	64	/* account 1 allocation in this many */
+#define MEM_PROF_SLOTS	256	/* power of two */
+#define MEM_PROF_PROBES	8	/* linear probes before giving up */
+
+typedef struct {
+	const char	*file;
+	const char	*func;
+	int		line;
+	uint64_t	bytes;		/* sampled; scale by MEM_PROF_SAMPLE */
+	uint64_t	count;		/* sampled allocations */
+} mem_prof_slot_t;
+
+static mem_prof_slot_t mem_prof[MEM_PROF_SLOTS];
+static unsigned mem_prof_countdown = MEM_PROF_SAMPLE;
+static uint64_t mem_prof_dropped;	/* samples lost to table collisions */
+static time_t mem_prof_start;
+
+static void
+mem_prof_account(size_t size, const char *file, const char *func, int line)
+{
+	mem_prof_slot_t *slot;
+	unsigned h, i;
+
+	if (!mem_prof_start)
+		mem_prof_start = time(NULL);
+
+	/* __FILE__ literals have stable addresses, so the pointer value
+	 * plus the line is the callsite identity */
+	h = (unsigned)(((uintptr_t)file >> 4) ^ ((unsigned)line * 2654435761U)) & (MEM_PROF_SLOTS - 1);
+	for (i = 0; i < MEM_PROF_PROBES; i++, h = (h + 1) & (MEM_PROF_SLOTS - 1)) {
+		slot = &mem_prof[h];
+		if (!slot->file) {
+			slot->file = file;
+			slot->func = func;
+			slot->line = line;
+		} else if (slot->file != file || slot->line != line)
+			continue;
+		slot->bytes += size;
+		slot->count++;
+		return;
+	}
+
+	mem_prof_dropped++;
+}
+
+/* Print the profiled callsites hottest first */
+void
+mem_prof_print(FILE *fp)
+{
+	const mem_prof_slot_t *order[MEM_PROF_SLOTS];
+	const mem_prof_slot_t *slot;
+	unsigned used = 0;
+	time_t elapsed;
+	unsigned i, j;
+
+	for (i = 0; i < MEM_PROF_SLOTS; i++) {
+		slot = &mem_prof[i];
+		if (!slot->file)
+			continue;
+		for (j = used; j > 0 && order[j - 1]->bytes < slot->bytes; j--)
+			order[j] = order[j - 1];
+		order[j] = slot;
+		used++;
+	}
+
+	elapsed = mem_prof_start ? time(NULL) - mem_prof_start : 0;
+	if (!elapsed)
+		elapsed = 1;
+
+	fprintf(fp, "------< Allocation profile >------\n");
+	fprintf(fp, " sampling 1 in %d allocations over %lds, estimates scaled; %lu samples dropped\n",
+		MEM_PROF_SAMPLE, (long)elapsed, (unsigned long)mem_prof_dropped);
+	for (i = 0; i < used; i++) {
+		slot = order[i];
+		fprintf(fp, " %12lu bytes %9lu allocs %9lu bytes/min  %s:%d %s()\n",
+			(unsigned long)(slot->bytes * MEM_PROF_SAMPLE),
+			(unsigned long)(slot->count * MEM_PROF_SAMPLE),
+			(unsigned long)(slot->bytes * MEM_PROF_SAMPLE * 60 / (unsigned long)elapsed),
+			slot->file, slot->line, slot->func);
+	}
+}
+
+#ifndef _MEM_CHECK_
+void *
+keepalived_alloc(size_t size, const char *file, const char *function, int line)
+{
+	mem_hdr_t *hdr = zalloc(size + sizeof(mem_hdr_t));
+
+	hdr->size = size;
+	hdr->ctx = mem_ctx_current;
+	mem_ctx_allocated[mem_ctx_current] += size;
+
+	if (--mem_prof_countdown == 0) {
+		mem_prof_countdown = MEM_PROF_SAMPLE;
+		mem_prof_account(size, file, function, line);
+	}
+
+	return hdr + 1;
+}
+
+void
+keepalived_release(void *buffer)
+{
+	mem_hdr_t *hdr;
+
+	if (!buffer)
+		return;
+
+	hdr = (mem_hdr_t *)buffer - 1;
+	mem_ctx_allocated[hdr->ctx] -= hdr->size;
+	free(hdr);
+}
+
+void *
+keepalived_resize(void *buffer, size_t size, const char *file, const char *function, int line)
+{
+	mem_hdr_t *hdr;
+
+	if (!buffer)
+		return keepalived_alloc(size, file, function, line);
+
+	hdr = (mem_hdr_t *)buffer - 1;
+	hdr = realloc(hdr, size + sizeof(mem_hdr_t));
+	if (!hdr)
+		return NULL;
+
+	mem_ctx_allocated[hdr->ctx] -= hdr->size;
+	mem_ctx_allocated[hdr->ctx] += size;
+	hdr->size = size;
+
+	if (--mem_prof_countdown == 0) {
+		mem_prof_countdown = MEM_PROF_SAMPLE;
+		mem_prof_account(size, file, function, line);
+	}
+
+	return hdr + 1;
+}
+#endif
+
+/* Parse-time arena.
+ *
+ * Tokenising the configuration allocates and frees millions of tiny
+ * strings on large configurations. Strings which only live for the
+ * duration of a parse pass are bump-allocated from large slabs, and
+ * the whole region is released in one go when the pass completes.
+ * Arena allocations are not tracked by _MEM_CHECK_. */
+
+typedef struct _arena_slab {
+	struct _arena_slab *next;
+	size_t size;
+	size_t used;
+	/* allocations follow */
+} arena_slab_t;
+
+#define ARENA_SLAB_SIZE	(256 * 1024)
+
+static arena_slab_t *arena_slabs;
+static bool arena_open;
+
+void
+mem_arena_open(void)
+{
+	arena_open = true;
+}
+
+bool
+mem_arena_active(void)
+{
+	return arena_open;
+}
+
+void *
+mem_arena_alloc(size_t size)
+{
+	arena_slab_t *slab = arena_slabs;
+	size_t slab_size;
+	void *mem;
+
+	/* Keep allocations pointer aligned */
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	if (!slab || slab->size - slab->used < size) {
+		slab_size = size > ARENA_SLAB_SIZE ? size : ARENA_SLAB_SIZE;
+		slab = malloc(sizeof(*slab) + slab_size);
+		if (!slab) {
+			log_message(LOG_INFO, "Keepalived mem_arena_alloc() error - %s", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		slab->size = slab_size;
+		slab->used = 0;
+		slab->next = arena_slabs;
+		arena_slabs = slab;
+	}
+
+	mem = (char *)(slab + 1) + slab->used;
+	slab->used += size;
+
+	return memset(mem, 0, size);
+}
+
+/* Is ptr arena allocated? The most recent slab is checked first, which
+ * is where a just-allocated token will be. */
+bool
+mem_arena_contains(const void *ptr)
+{
+	const arena_slab_t *slab;
+	const char *p = ptr;
+
+	for (slab = arena_slabs; slab; slab = slab->next) {
+		if (p >= (const char *)(slab + 1) &&
+		    p < (const char *)(slab + 1) + slab->used)
+			return true;
+	}
+
+	return false;
+}
+
+void
+mem_arena_close(void)
+{
+	arena_slab_t *slab, *next;
+
+	for (slab = arena_slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	arena_slabs = NULL;
+	arena_open = false;
+}
+
 /* KeepAlived memory management. in debug mode,
  * help finding eventual memory leak.
  * Allocation memory types manipulated are :
@@ -157,6 +468,11 @@ keepalived_malloc(size_t size, char *file, char *function, int line)
 	alloc_list[i].csum = check;
 	alloc_list[i].type = 9;
 
+	if (--mem_prof_countdown == 0) {
+		mem_prof_countdown = MEM_PROF_SAMPLE;
+		mem_prof_account(size, file, function, line);
+	}
+
 	fprintf(log_op, "zalloc[%3d:%3d], %p, %4zu at %s, %3d, %s\n",
 	       i, number_alloc_list, buf, size, file, line, function);
 #ifdef _MEM_CHECK_LOG_
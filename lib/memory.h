@@ -27,6 +27,7 @@
 /* system includes */
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 /* Local defines */
 #ifdef _MEM_CHECK_
@@ -56,14 +57,54 @@ extern void enable_mem_log_termination(void);
 
 #else
 
+/* Always-on lightweight accounting. Each allocation carries a small
+ * header recording its size and owning subsystem, maintaining the
+ * per-subsystem byte counters below at near-zero cost - enough to see
+ * which subsystem grows across reloads without a _MEM_CHECK_ build. */
 extern void *zalloc(unsigned long size);
+extern void *keepalived_alloc(size_t, const char *, const char *, int)
+		__attribute__((alloc_size(1))) __attribute__((malloc));
+extern void keepalived_release(void *);
+extern void *keepalived_resize(void *, size_t, const char *, const char *, int)
+		__attribute__((alloc_size(2)));
 
-#define MALLOC(n)    (zalloc(n))
-#define FREE(p)      (free(p), (p) = NULL)
-#define REALLOC(p,n) (realloc((p),(n)))
+#define MALLOC(n)    ( keepalived_alloc((n), \
+		      (__FILE__), (__FUNCTION__), (__LINE__)) )
+#define FREE(p)      (keepalived_release(p), (p) = NULL)
+#define REALLOC(p,n) ( keepalived_resize((p), (n), \
+		      (__FILE__), (__FUNCTION__), (__LINE__)) )
 
 #endif
 
+/* Subsystem tags for the accounting counters. The current tag is set
+ * per process and temporarily overridden around the parser and
+ * scheduler allocation sites. */
+typedef enum {
+	MEM_CTX_DEFAULT,
+	MEM_CTX_PARSER,
+	MEM_CTX_SCHEDULER,
+	MEM_CTX_VRRP,
+	MEM_CTX_CHECK,
+	MEM_CTX_MAX
+} mem_ctx_t;
+
+extern mem_ctx_t mem_ctx_set(mem_ctx_t);
+extern size_t mem_ctx_get_bytes(mem_ctx_t);
+extern const char *mem_ctx_name(mem_ctx_t);
+extern void mem_ctx_print(FILE *);
+extern void mem_ctx_log(void);
+
+/* Sampled allocation profiler */
+extern void mem_prof_print(FILE *);
+
+/* Parse-time arena allocator */
+extern void mem_arena_open(void);
+extern bool mem_arena_active(void);
+extern void *mem_arena_alloc(size_t)
+		__attribute__((alloc_size(1))) __attribute__((malloc));
+extern bool mem_arena_contains(const void *);
+extern void mem_arena_close(void);
+
 /* Common defines */
 #define FREE_PTR(p)	{ if (p) { FREE(p);} }
 #endif
@@ -38,13 +38,19 @@
 #include <pwd.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <spawn.h>
+#include <sys/uio.h>
 
 #include "notify.h"
 #include "signals.h"
+#include "list.h"
 #include "logger.h"
 #include "utils.h"
 #include "vector.h"
 #include "parser.h"
+#include "bitops.h"
+
+extern char **environ;
 
 
 uid_t default_script_uid;				/* Default user/group for script execution */
@@ -107,13 +113,150 @@ notify_fifo_open(notify_fifo_t* global_fifo, notify_fifo_t* fifo, int (*script_e
 	fifo_open(fifo, script_exit, type);
 }
 
+/* Buffered FIFO writer. The notify FIFOs are opened non blocking, so
+ * with a slow consumer a burst of state changes (e.g. a quorum flap)
+ * used to lose lines silently once the pipe filled. Lines that cannot
+ * be written immediately are queued in a per FIFO ring buffer and
+ * flushed with writev() once the scheduler reports the FIFO writable.
+ * Only whole lines are queued or dropped, and drops are counted. */
+#define FIFO_BUF_SIZE	65536
+
+static int fifo_flush_thread(thread_t *);
+
+static void
+fifo_flush_schedule(notify_fifo_t *fifo)
+{
+	if (!fifo->flush_thread)
+		fifo->flush_thread = thread_add_write(master, fifo_flush_thread, fifo, fifo->fd, TIMER_NEVER);
+}
+
+static void
+fifo_flush(notify_fifo_t *fifo)
+{
+	struct iovec iov[2];
+	int iovcnt;
+	size_t tail_len;
+	ssize_t len;
+
+	if (!fifo->buf_len)
+		return;
+
+	iov[0].iov_base = fifo->buf + fifo->buf_head;
+	tail_len = fifo->buf_size - fifo->buf_head;
+	if (fifo->buf_len <= tail_len) {
+		iov[0].iov_len = fifo->buf_len;
+		iovcnt = 1;
+	} else {
+		iov[0].iov_len = tail_len;
+		iov[1].iov_base = fifo->buf;
+		iov[1].iov_len = fifo->buf_len - tail_len;
+		iovcnt = 2;
+	}
+
+	len = writev(fifo->fd, iov, iovcnt);
+	if (len > 0) {
+		fifo->buf_head = (fifo->buf_head + (size_t)len) % fifo->buf_size;
+		fifo->buf_len -= (size_t)len;
+	}
+}
+
+static int
+fifo_flush_thread(thread_t *thread)
+{
+	notify_fifo_t *fifo = THREAD_ARG(thread);
+
+	fifo->flush_thread = NULL;
+
+	fifo_flush(fifo);
+
+	if (fifo->buf_len)
+		fifo_flush_schedule(fifo);
+
+	return 0;
+}
+
+static void
+fifo_buf_queue(notify_fifo_t *fifo, const char *line, size_t len)
+{
+	size_t tail, tail_len;
+
+	if (!fifo->buf) {
+		fifo->buf = MALLOC(FIFO_BUF_SIZE);
+		if (!fifo->buf) {
+			fifo->dropped++;
+			return;
+		}
+		fifo->buf_size = FIFO_BUF_SIZE;
+	}
+
+	if (len > fifo->buf_size - fifo->buf_len) {
+		/* The consumer cannot keep up; drop the whole line */
+		if (!fifo->dropped++)
+			log_message(LOG_INFO, "notify fifo %s full - dropping state change lines", fifo->name);
+		return;
+	}
+
+	tail = (fifo->buf_head + fifo->buf_len) % fifo->buf_size;
+	tail_len = fifo->buf_size - tail;
+	if (len <= tail_len)
+		memcpy(fifo->buf + tail, line, len);
+	else {
+		memcpy(fifo->buf + tail, line, tail_len);
+		memcpy(fifo->buf, line + tail_len, len - tail_len);
+	}
+	fifo->buf_len += len;
+
+	fifo_flush_schedule(fifo);
+}
+
+void
+notify_fifo_write(notify_fifo_t *fifo, const char *line, size_t len)
+{
+	ssize_t ret;
+
+	if (fifo->fd == -1)
+		return;
+
+	/* Write directly only while nothing is queued, to preserve the
+	 * line ordering */
+	if (!fifo->buf_len) {
+		ret = write(fifo->fd, line, len);
+		if (ret == (ssize_t)len)
+			return;
+		if (ret > 0) {
+			line += ret;
+			len -= (size_t)ret;
+		}
+	}
+
+	fifo_buf_queue(fifo, line, len);
+}
+
 static void
 fifo_close(notify_fifo_t* fifo)
 {
+	if (fifo->flush_thread) {
+		thread_cancel(fifo->flush_thread);
+		fifo->flush_thread = NULL;
+	}
+
 	if (fifo->fd != -1) {
+		/* A last attempt to hand pending lines to the consumer */
+		fifo_flush(fifo);
+
 		close(fifo->fd);
 		fifo->fd = -1;
 	}
+
+	if (fifo->dropped) {
+		log_message(LOG_INFO, "notify fifo %s dropped %lu state change lines", fifo->name, fifo->dropped);
+		fifo->dropped = 0;
+	}
+
+	FREE_PTR(fifo->buf);
+	fifo->buf = NULL;
+	fifo->buf_size = fifo->buf_head = fifo->buf_len = 0;
+
 	if (fifo->created_fifo)
 		unlink(fifo->name);
 }
@@ -160,15 +303,116 @@ set_privileges(uid_t uid, gid_t gid)
 	return false;
 }
 
+/* Any of these make a command line need the shell. Quote grouping is
+ * handled when splitting, but $ and ` expand even inside double quotes,
+ * so expansion and control characters are rejected wherever they
+ * appear. */
+static const char shell_specials[] = "$`\\!&|;<>()[]{}*?~#\n\r";
+
+#define SCRIPT_ARGV_MAX	64
+
+/* Extract the next word, removing enclosing quotes */
+static char *
+script_argv_token(const char **cp)
+{
+	const char *p = *cp;
+	char *token, *t;
+	char quote;
+
+	/* Quote removal can only shrink the word */
+	t = token = MALLOC(strlen(p) + 1);
+	while (*p && *p != ' ' && *p != '\t') {
+		if (*p == '"' || *p == '\'') {
+			quote = *p++;
+			while (*p && *p != quote)
+				*t++ = *p++;
+			if (!*p) {
+				/* Unterminated quote - let the shell complain */
+				FREE(token);
+				return NULL;
+			}
+			p++;
+		} else
+			*t++ = *p++;
+	}
+	*t = '\0';
+	*cp = p;
+
+	return token;
+}
+
+static void
+script_argv_free(char **argv)
+{
+	char **v;
+
+	if (!argv)
+		return;
+
+	for (v = argv; *v; v++)
+		FREE(*v);
+	FREE(argv);
+}
+
+/* Split a command line into an exec argv. Returns NULL when the line
+ * uses shell features, or a bare executable name that would need a
+ * PATH search; the caller then falls back to "/bin/sh -c". */
+static char **
+script_argv_build(const char *cmdline)
+{
+	char *words[SCRIPT_ARGV_MAX];
+	const char *p = cmdline;
+	char **argv;
+	unsigned argc = 0, i;
+
+	if (strpbrk(cmdline, shell_specials))
+		return NULL;
+
+	while (*p) {
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (!*p)
+			break;
+		if (argc == SCRIPT_ARGV_MAX - 1 ||
+		    !(words[argc] = script_argv_token(&p)))
+			goto fail;
+		argc++;
+	}
+
+	if (!argc || !strchr(words[0], '/'))
+		goto fail;
+
+	argv = MALLOC((argc + 1) * sizeof(char *));
+	for (i = 0; i < argc; i++)
+		argv[i] = words[i];
+	argv[argc] = NULL;
+
+	return argv;
+
+fail:
+	while (argc)
+		FREE(words[--argc]);
+	return NULL;
+}
+
 /* perform a system call */
 static int
 system_call(const char *cmdline, uid_t uid, gid_t gid)
 {
+	char **sargv;
 	int retval;
 
 	if (set_privileges(uid, gid))
 		return -1;
 
+	/* A plain "path arg arg" line execs directly, skipping the
+	 * intermediate /bin/sh and halving the processes created */
+	if ((sargv = script_argv_build(cmdline))) {
+		execv(sargv[0], sargv);
+		log_message(LOG_INFO, "Direct exec of %s failed (%m) - retrying via shell", cmdline);
+		script_argv_free(sargv);
+	}
+
 	/* system() fails if SIGCHLD is set to SIG_IGN */
 	signal_set(SIGCHLD, (void*)SIG_DFL, NULL);
 
@@ -197,11 +441,159 @@ script_setup(void)
 	set_std_fd(false);
 }
 
+/* Spawn an external program directly. posix_spawn() clones the daemon
+ * with vfork semantics, so launching a script no longer copies our page
+ * tables and its cost no longer scales with the daemon RSS. It cannot
+ * change uid/gid in the child though, so scripts configured to run as
+ * another user keep the fork() path. */
+static pid_t
+spawn_exec(const char *file, char *const argv[], int stdout_fd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t empty_set;
+	pid_t pid;
+	int ret;
+
+	if (log_file_name)
+		flush_log_file();
+
+	posix_spawnattr_init(&attr);
+	sigemptyset(&empty_set);
+	posix_spawnattr_setsigmask(&attr, &empty_set);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+	posix_spawn_file_actions_init(&actions);
+	if (__test_bit(DONT_FORK_BIT, &debug)) {
+		/* set_std_fd() equivalent when running on a console */
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+		posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
+	}
+	if (stdout_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+
+	ret = posix_spawn(&pid, file, &actions, &attr, argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if (ret) {
+		log_message(LOG_INFO, "Unable to spawn %s - errno %d", file, ret);
+		return -1;
+	}
+
+	return pid;
+}
+
+/* Spawn "/bin/sh -c cmdline", replicating what system() would run.
+ * When the command line uses no shell features it is exec'd directly
+ * instead, saving the intermediate /bin/sh process. */
+static pid_t
+spawn_command(const char *cmdline)
+{
+	char *argv[4];
+	char **sargv;
+	pid_t pid;
+
+	if ((sargv = script_argv_build(cmdline))) {
+		pid = spawn_exec(sargv[0], sargv, -1);
+		script_argv_free(sargv);
+		return pid;
+	}
+
+	argv[0] = "sh";
+	argv[1] = "-c";
+	argv[2] = (char *) cmdline;
+	argv[3] = NULL;
+
+	return spawn_exec("/bin/sh", argv, -1);
+}
+
+/* Launch a long-running script with its stdout connected to a pipe, so
+ * it can stream status reports back instead of being re-executed */
+pid_t
+system_call_stream(const char *cmdline, uid_t uid, gid_t gid, int *read_fd)
+{
+	char *argv[4];
+	char **sargv;
+	int pipefd[2];
+	pid_t pid;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		log_message(LOG_INFO, "Unable to create pipe for script %s - errno %d", cmdline, errno);
+		return -1;
+	}
+
+	if (!uid && !gid) {
+		if ((sargv = script_argv_build(cmdline))) {
+			pid = spawn_exec(sargv[0], sargv, pipefd[1]);
+			script_argv_free(sargv);
+		} else {
+			argv[0] = "sh";
+			argv[1] = "-c";
+			argv[2] = (char *) cmdline;
+			argv[3] = NULL;
+			pid = spawn_exec("/bin/sh", argv, pipefd[1]);
+		}
+	} else {
+		if (log_file_name)
+			flush_log_file();
+
+		pid = fork();
+
+		if (pid < 0)
+			log_message(LOG_INFO, "Failed fork process");
+		else if (!pid) {
+			/* Child part */
+#ifdef _MEM_CHECK_
+			skip_mem_dump();
+#endif
+			setpgid(0, 0);
+			set_privileges(uid, gid);
+			script_setup();
+			dup2(pipefd[1], STDOUT_FILENO);
+			close(pipefd[0]);
+			close(pipefd[1]);
+
+			if ((sargv = script_argv_build(cmdline)))
+				execv(sargv[0], sargv);
+			else
+				execl("/bin/sh", "sh", "-c", cmdline, (char *)NULL);
+			exit(127);
+		}
+	}
+
+	close(pipefd[1]);
+	if (pid == -1) {
+		close(pipefd[0]);
+		return -1;
+	}
+
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK | fcntl(pipefd[0], F_GETFL));
+	*read_fd = pipefd[0];
+
+	return pid;
+}
+
 /* Execute external script/program to process FIFO */
 pid_t
 notify_fifo_exec(thread_master_t *m, int (*func) (thread_t *), void *arg, const notify_script_t *script, const char *fifo_name)
 {
 	pid_t pid;
+	char *argv[3];
+
+	if (!script->uid && !script->gid) {
+		argv[0] = script->name;
+		argv[1] = (char *) fifo_name;
+		argv[2] = NULL;
+		pid = spawn_exec(script->name, argv, -1);
+		if (pid == -1)
+			return -1;
+		thread_add_child(m, func, arg, pid, TIMER_NEVER);
+		return 0;
+	}
 
 	if (log_file_name)
 		flush_log_file();
@@ -239,35 +631,158 @@ notify_fifo_exec(thread_master_t *m, int (*func) (thread_t *), void *arg, const
 	exit(0);
 }
 
-int
-notify_exec(const notify_script_t *script)
+/* Notify script concurrency limiter. A mass transition can fire a
+ * notify for every affected instance at once; forking them all
+ * simultaneously drives the load average up and slows the protocol
+ * threads. With max_concurrent_scripts set, the excess notifies are
+ * queued FIFO and drained as the running children exit. */
+typedef struct _queued_notify {
+	notify_script_t		script;		/* name is a private copy */
+	const void		*key;		/* identity for coalescing, may be NULL */
+} queued_notify_t;
+
+static unsigned max_concurrent_scripts;	/* 0 for no limit */
+static unsigned scripts_running;	/* notify children currently running */
+static list notify_queue;		/* queued_notify_t awaiting a free slot */
+
+static int notify_script_exit_thread(thread_t *);
+
+void
+set_max_concurrent_scripts(unsigned limit)
+{
+	max_concurrent_scripts = limit;
+}
+
+unsigned
+get_max_concurrent_scripts(void)
+{
+	return max_concurrent_scripts;
+}
+
+static void
+free_queued_notify(void *data)
+{
+	queued_notify_t *entry = data;
+
+	FREE(entry->script.name);
+	FREE(entry);
+}
+
+/* Drop anything still queued and forget the running children. Used on
+ * reload, when the child threads tracking them have been destroyed. */
+void
+notify_flush_pending(void)
+{
+	free_list(&notify_queue);
+	scripts_running = 0;
+}
+
+static int
+notify_exec_now(const notify_script_t *script)
 {
 	pid_t pid;
 
-	if (log_file_name)
-		flush_log_file();
+	if (!script->uid && !script->gid)
+		pid = spawn_command(script->name);
+	else {
+		if (log_file_name)
+			flush_log_file();
 
-	pid = fork();
+		pid = fork();
 
-	/* In case of fork is error. */
-	if (pid < 0) {
-		log_message(LOG_INFO, "Failed fork process");
+		/* In case of fork is error. */
+		if (pid < 0) {
+			log_message(LOG_INFO, "Failed fork process");
+			return -1;
+		}
+
+		if (!pid) {
+			/* Child part */
+#ifdef _MEM_CHECK_
+			skip_mem_dump();
+#endif
+
+			script_setup();
+
+			system_call(script->name, script->uid, script->gid);
+
+			exit(0);
+		}
+	}
+
+	if (pid == -1)
 		return -1;
+
+	/* Track the child when a limit is set, so its exit frees a slot */
+	if (max_concurrent_scripts) {
+		scripts_running++;
+		thread_add_child(master, notify_script_exit_thread, NULL, pid,
+				 TIMER_NEVER);
 	}
 
-	/* In case of this is parent process */
-	if (pid)
-		return 0;
+	return 0;
+}
 
-#ifdef _MEM_CHECK_
-	skip_mem_dump();
-#endif
+/* A notify child has exited - drain the overflow queue into the slot */
+static int
+notify_script_exit_thread(__attribute__((unused)) thread_t *thread)
+{
+	queued_notify_t *entry;
 
-	script_setup();
+	if (scripts_running)
+		scripts_running--;
 
-	system_call(script->name, script->uid, script->gid);
+	while (!LIST_ISEMPTY(notify_queue) &&
+	       (!max_concurrent_scripts || scripts_running < max_concurrent_scripts)) {
+		entry = ELEMENT_DATA(LIST_HEAD(notify_queue));
+		notify_exec_now(&entry->script);
+		free_list_element(notify_queue, LIST_HEAD(notify_queue));
+	}
 
-	exit(0);
+	return 0;
+}
+
+/* Queue a notify for later execution. If the same instance (key) already
+ * has a notify waiting, it has been superseded by this one - the old
+ * state is no longer worth reporting - so it is replaced. */
+static void
+notify_queue_add(const notify_script_t *script, const void *key)
+{
+	queued_notify_t *entry;
+	element e, next;
+
+	if (!notify_queue)
+		notify_queue = alloc_list(free_queued_notify, NULL);
+
+	if (key) {
+		for (e = LIST_HEAD(notify_queue); e; e = next) {
+			next = e->next;
+			entry = ELEMENT_DATA(e);
+			if (entry->key == key) {
+				log_message(LOG_INFO, "Notify script %s superseded before running - coalescing"
+						    , entry->script.name);
+				free_list_element(notify_queue, e);
+			}
+		}
+	}
+
+	entry = (queued_notify_t *)MALLOC(sizeof(queued_notify_t));
+	entry->script.name = (char *)MALLOC(strlen(script->name) + 1);
+	strcpy(entry->script.name, script->name);
+	entry->script.uid = script->uid;
+	entry->script.gid = script->gid;
+	entry->key = key;
+	list_add(notify_queue, entry);
+}
+
+int
+notify_exec(const notify_script_t *script, const void *key)
+{
+	if (!max_concurrent_scripts || scripts_running < max_concurrent_scripts)
+		return notify_exec_now(script);
+
+	notify_queue_add(script, key);
+	return 0;
 }
 
 int
@@ -276,6 +791,16 @@ system_call_script(thread_master_t *m, int (*func) (thread_t *), void * arg, uns
 	int status;
 	pid_t pid;
 
+	if (!uid && !gid) {
+		/* The shell's exit status reaches the child thread directly;
+		 * exec failures (126/127) are normalised by the callers */
+		pid = spawn_command(script);
+		if (pid == -1)
+			return -1;
+		thread_add_child(m, func, arg, pid, timer);
+		return 0;
+	}
+
 	/* Daemonization to not degrade our scheduling timer */
 	if (log_file_name)
 		flush_log_file();
@@ -320,6 +845,7 @@ script_killall(thread_master_t *m, int signo)
 	sigset_t old_set, child_wait;
 	thread_t *thread;
 	pid_t p_pgid, c_pgid;
+	unsigned i;
 
 	sigprocmask(0, NULL, &old_set);
 	if (!sigismember(&old_set, SIGCHLD)) {
@@ -328,16 +854,14 @@ script_killall(thread_master_t *m, int signo)
 		sigprocmask(SIG_BLOCK, &child_wait, NULL);
 	}
 
-	thread = m->child.head;
-
 	p_pgid = getpgid(0);
 
-	while (thread) {
+	for (i = 0; i < m->child.count; i++) {
+		thread = m->child.nodes[i];
 		c_pgid = getpgid(thread->u.c.pid);
 		if (c_pgid != p_pgid) {
 			kill(-c_pgid, signo);
 		}
-		thread = thread->next;
 	}
 
 	if (!sigismember(&old_set, SIGCHLD))
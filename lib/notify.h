@@ -67,6 +67,12 @@ typedef struct _notify_fifo {
 	int 	fd;
 	bool	created_fifo;	/* We created the FIFO */
 	notify_script_t *script; /* Script to run to process FIFO */
+	char	*buf;		/* ring buffer of lines awaiting a writable FIFO */
+	size_t	buf_size;
+	size_t	buf_head;	/* offset of the first pending byte */
+	size_t	buf_len;	/* number of pending bytes */
+	unsigned long dropped;	/* lines dropped because the buffer was full */
+	thread_t *flush_thread;	/* registered write-ready flush thread */
 } notify_fifo_t;
 
 static inline void
@@ -85,10 +91,15 @@ extern gid_t default_script_gid;
 
 /* prototypes */
 extern void notify_fifo_open(notify_fifo_t*, notify_fifo_t*, int (*)(thread_t *), const char *);
+extern void notify_fifo_write(notify_fifo_t*, const char *, size_t);
 extern void notify_fifo_close(notify_fifo_t*, notify_fifo_t*);
 extern int system_call_script(thread_master_t *, int (*)(thread_t *), void *, unsigned long, const char*, uid_t, gid_t);
+extern pid_t system_call_stream(const char *, uid_t, gid_t, int *);
 extern pid_t notify_fifo_exec(thread_master_t *, int (*func) (thread_t *), void *, const notify_script_t *, const char *);
-extern int notify_exec(const notify_script_t *);
+extern int notify_exec(const notify_script_t *, const void *);
+extern void set_max_concurrent_scripts(unsigned);
+extern unsigned get_max_concurrent_scripts(void);
+extern void notify_flush_pending(void);
 extern void script_killall(thread_master_t *, int);
 extern int check_script_secure(notify_script_t *, bool, bool);
 extern int check_notify_script_secure(notify_script_t **, bool, bool);
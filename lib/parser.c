@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <linux/version.h>
@@ -42,6 +43,7 @@
 #include "rttables.h"
 #include "scheduler.h"
 #include "list.h"
+#include "hashtab.h"
 
 #define DUMP_KEYWORDS	0
 
@@ -50,6 +52,8 @@ typedef struct _defs {
 	size_t name_len;
 	char *value;
 	size_t value_len;
+	char **lines;		/* multiline value split once into NUL terminated
+				 * lines, NULL terminated. lines[0] owns the copy. */
 	bool multiline;
 } def_t;
 
@@ -60,14 +64,37 @@ vector_t *keywords;
 bool reload = 0;
 char *config_id;
 
+/* The current config file, mmap'd read-only. Lines are copied out of the
+ * mapping into the caller's buffer since parameter substitution needs to
+ * modify them. */
+typedef struct _conf_map {
+	const char *data;
+	size_t size;
+	size_t pos;
+} conf_map_t;
+
 /* local vars */
 static vector_t *current_keywords;
-static FILE *current_stream;
+static conf_map_t current_conf;
 static int sublevel = 0;
 static int skip_sublevel = 0;
 
-/* Parameter definitions */
+/* Parameter definitions. The list owns the entries; the hash table
+ * indexes them by name so substitution doesn't walk the list for
+ * every '$' encountered. */
 static list defs;
+static hashtab_t defs_htab;
+
+/* Reload staging. A forked helper runs the whole read side of the
+ * parser - globbing, mapping, include following, definition expansion -
+ * and streams the resulting lines back NUL-terminated over a pipe,
+ * while the event loop keeps dispatching the old configuration. The
+ * parse then works through the received lines without touching the
+ * filesystem. */
+static int stage_fd = -1;	/* helper side: pipe the lines are written to */
+static char *staged_buf;	/* loop side: received line stream */
+static size_t staged_len;
+static size_t staged_pos;
 
 /* Forward declarations for recursion */
 static bool read_line(char *, size_t);
@@ -209,6 +236,53 @@ dump_keywords(vector_t *keydump, int level, FILE *fp)
 }
 #endif
 
+static int
+keyword_cmp(const void *a, const void *b)
+{
+	return strcmp((*(keyword_t * const *)a)->string, (*(keyword_t * const *)b)->string);
+}
+
+/* Sort each keyword level by name once all keywords have been installed,
+ * so that process_stream() can binary search rather than scan linearly.
+ * This must not be called until installation is complete, since
+ * install_keyword() navigates via the last slot of each level. */
+static void
+sort_keywords(vector_t *keywords_vec)
+{
+	keyword_t *keyword_vec;
+	unsigned int i;
+
+	for (i = 0; i < vector_size(keywords_vec); i++) {
+		keyword_vec = vector_slot(keywords_vec, i);
+		if (keyword_vec->sub)
+			sort_keywords(keyword_vec->sub);
+	}
+
+	qsort(keywords_vec->slot, vector_size(keywords_vec), sizeof(void *), keyword_cmp);
+}
+
+static keyword_t *
+find_keyword(vector_t *keywords_vec, const char *str)
+{
+	keyword_t *keyword_vec;
+	int low = 0, high = (int)vector_size(keywords_vec) - 1;
+	int mid, res;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		keyword_vec = vector_slot(keywords_vec, mid);
+		res = strcmp(str, keyword_vec->string);
+		if (!res)
+			return keyword_vec;
+		if (res < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
+
 static void
 free_keywords(vector_t *keywords_vec)
 {
@@ -224,10 +298,16 @@ free_keywords(vector_t *keywords_vec)
 	vector_free(keywords_vec);
 }
 
+/* Tokenize a line in place. The returned vector's slots are slices of
+ * the caller's buffer, NUL-terminated by overwriting the delimiter that
+ * ended each token, so no token is ever copied; handlers that keep a
+ * value must copy it (set_value() and read_value_block() already do).
+ * The slots are only valid until the buffer is reused for the next
+ * line, and are released by free_strvec() freeing just the vector. */
 vector_t *
 alloc_strvec(char *string)
 {
-	char *cp, *start, *token;
+	char *cp, *start, *prev_end = NULL;
 	size_t str_len;
 	vector_t *strvec;
 
@@ -248,7 +328,7 @@ alloc_strvec(char *string)
 	if (*cp == '!' || *cp == '#')
 		return NULL;
 
-	/* Create a vector and alloc each command piece */
+	/* Create a vector and set each command piece */
 	strvec = vector_alloc();
 
 	while (1) {
@@ -258,7 +338,9 @@ alloc_strvec(char *string)
 		if (*cp == '"') {
 			start++;
 			if (!(cp = strchr(start, '"'))) {
-				log_message(LOG_INFO, "Unmatched quote: '%s'", string);
+				if (prev_end)
+					*prev_end = '\0';
+				log_message(LOG_INFO, "Unmatched quote: '%s'", start);
 				return strvec;
 			}
 			str_len = (size_t)(cp - start);
@@ -269,18 +351,24 @@ alloc_strvec(char *string)
 				cp++;
 			str_len = (size_t)(cp - start);
 		}
-		token = MALLOC(str_len + 1);
-		memcpy(token, start, str_len);
-		token[str_len] = '\0';
+
+		/* The previous token can only be terminated once the scanner
+		 * is past its delimiter - writing eagerly could clobber a
+		 * quote introducing this token */
+		if (prev_end)
+			*prev_end = '\0';
+		prev_end = start + str_len;
 
 		/* Alloc & set the slot */
 		vector_alloc_slot(strvec);
-		vector_set_slot(strvec, token);
+		vector_set_slot(strvec, start);
 
 		while (isspace((int) *cp) && *cp != '\0')
 			cp++;
-		if (*cp == '\0' || *cp == '!' || *cp == '#')
+		if (*cp == '\0' || *cp == '!' || *cp == '#') {
+			*prev_end = '\0';
 			return strvec;
+		}
 	}
 }
 
@@ -355,46 +443,38 @@ process_stream(vector_t *keywords_vec, int need_bob)
 			break;
 		}
 
-		for (i = 0; i < vector_size(keywords_vec); i++) {
-			keyword_vec = vector_slot(keywords_vec, i);
-
-			if (!strcmp(keyword_vec->string, str)) {
-				if (!keyword_vec->active) {
-					if (!strcmp(vector_slot(strvec, vector_size(strvec)-1), BOB))
-						skip_sublevel = 1;
-					else
-						skip_sublevel = -1;
-				}
+		keyword_vec = find_keyword(keywords_vec, str);
+		if (keyword_vec) {
+			if (!keyword_vec->active) {
+				if (!strcmp(vector_slot(strvec, vector_size(strvec)-1), BOB))
+					skip_sublevel = 1;
+				else
+					skip_sublevel = -1;
+			}
 
-				/* There is an inconsistency here. 'static_ipaddress' for example
-				 * does not have sub levels, but needs a '{' */
-				if (keyword_vec->sub) {
-					/* Remove a trailing '{' */
-					char *bob = vector_slot(strvec, vector_size(strvec)-1) ;
-					if (!strcmp(bob, BOB)) {
-						vector_unset(strvec, vector_size(strvec)-1);
-						FREE(bob);
-						bob_needed = 0;
-					}
-					else
-						bob_needed = 1;
+			/* There is an inconsistency here. 'static_ipaddress' for example
+			 * does not have sub levels, but needs a '{' */
+			if (keyword_vec->sub) {
+				/* Remove a trailing '{' */
+				if (!strcmp(vector_slot(strvec, vector_size(strvec)-1), BOB)) {
+					vector_unset(strvec, vector_size(strvec)-1);
+					bob_needed = 0;
 				}
+				else
+					bob_needed = 1;
+			}
 
-				if (keyword_vec->handler)
-					(*keyword_vec->handler) (strvec);
+			if (keyword_vec->handler)
+				(*keyword_vec->handler) (strvec);
 
-				if (keyword_vec->sub) {
-					kw_level++;
-					process_stream(keyword_vec->sub, bob_needed);
-					kw_level--;
-					if (keyword_vec->active && keyword_vec->sub_close_handler)
-						(*keyword_vec->sub_close_handler) ();
-				}
-				break;
+			if (keyword_vec->sub) {
+				kw_level++;
+				process_stream(keyword_vec->sub, bob_needed);
+				kw_level--;
+				if (keyword_vec->active && keyword_vec->sub_close_handler)
+					(*keyword_vec->sub_close_handler) ();
 			}
-		}
-
-		if (i >= vector_size(keywords_vec))
+		} else
 			log_message(LOG_INFO, "Unknown keyword '%s'", str );
 
 		free_strvec(strvec);
@@ -405,16 +485,241 @@ process_stream(vector_t *keywords_vec, int need_bob)
 	return;
 }
 
+/* Copy the next line of the current mapping, fgets-style (the trailing
+ * '\n' is retained, overlong lines are split). */
+static char *
+conf_gets(char *buf, size_t size)
+{
+	const char *start, *end;
+	size_t len;
+
+	if (current_conf.pos >= current_conf.size)
+		return NULL;
+
+	start = current_conf.data + current_conf.pos;
+	end = memchr(start, '\n', current_conf.size - current_conf.pos);
+	len = end ? (size_t)(end - start) + 1 : current_conf.size - current_conf.pos;
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, start, len);
+	buf[len] = '\0';
+	current_conf.pos += len;
+
+	return buf;
+}
+
+/* Details of the globs and files the configuration was read from, used
+ * on reload to tell whether the configuration can have changed at all
+ * without re-reading it. A file entry records the identity of one file;
+ * a pattern entry records which files its glob resolved to. */
+typedef struct _conf_file_detail {
+	char		*path;		/* file read, or the glob pattern used */
+	vector_t	*matches;	/* for a pattern, the files it matched */
+	ino_t		ino;
+	off_t		size;
+	struct timespec	mtime;
+	uint64_t	csum;		/* FNV-1a of the file content */
+} conf_file_detail_t;
+
+static list conf_file_details;
+
+static void
+free_conf_file_detail(void *data)
+{
+	conf_file_detail_t *detail = data;
+	unsigned i;
+
+	if (detail->matches) {
+		for (i = 0; i < vector_size(detail->matches); i++)
+			FREE(vector_slot(detail->matches, i));
+		vector_free(detail->matches);
+	}
+	FREE(detail->path);
+	FREE(detail);
+}
+
+/* FNV-1a over a file's content. A rewritten but byte-identical file
+ * keeps its hash, which is what lets a no-op SIGHUP be skipped even
+ * though the inode and mtime moved. */
+static uint64_t
+conf_file_csum(const char *path)
+{
+	uint8_t buf[4096];
+	uint64_t csum = 0xcbf29ce484222325ULL;
+	ssize_t len;
+	ssize_t i;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return 0;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		for (i = 0; i < len; i++)
+			csum = (csum ^ buf[i]) * 0x100000001b3ULL;
+	close(fd);
+
+	return csum;
+}
+
+static char *
+conf_detail_strdup(const char *str)
+{
+	char *copy = MALLOC(strlen(str) + 1);
+
+	strcpy(copy, str);
+	return copy;
+}
+
+static void
+record_conf_files(const char *pattern, const glob_t *globbuf)
+{
+	conf_file_detail_t *detail;
+	struct stat stb;
+	size_t i;
+
+	if (!LIST_EXISTS(conf_file_details))
+		conf_file_details = alloc_list(free_conf_file_detail, NULL);
+
+	detail = (conf_file_detail_t *) MALLOC(sizeof(conf_file_detail_t));
+	detail->path = conf_detail_strdup(pattern);
+	detail->matches = vector_alloc();
+	list_add(conf_file_details, detail);
+
+	for (i = 0; i < globbuf->gl_pathc; i++) {
+		if (globbuf->gl_pathv[i][strlen(globbuf->gl_pathv[i])-1] == '/')
+			continue;
+
+		vector_alloc_slot(detail->matches);
+		vector_set_slot(detail->matches, conf_detail_strdup(globbuf->gl_pathv[i]));
+
+		detail = (conf_file_detail_t *) MALLOC(sizeof(conf_file_detail_t));
+		detail->path = conf_detail_strdup(globbuf->gl_pathv[i]);
+		if (!stat(detail->path, &stb)) {
+			detail->ino = stb.st_ino;
+			detail->size = stb.st_size;
+			detail->mtime = stb.st_mtim;
+			detail->csum = conf_file_csum(detail->path);
+		}
+		list_add(conf_file_details, detail);
+	}
+}
+
+/* Check whether the configuration files have changed since they were
+ * last read - any glob resolving differently, or any file's identity
+ * (inode, size or mtime) differing, counts as changed. */
+bool
+conf_files_changed(void)
+{
+	conf_file_detail_t *detail;
+	element e;
+	glob_t globbuf;
+	struct stat stb;
+	size_t i;
+	unsigned n;
+	bool changed = false;
+
+	if (LIST_ISEMPTY(conf_file_details))
+		return true;
+
+	for (e = LIST_HEAD(conf_file_details); e && !changed; ELEMENT_NEXT(e)) {
+		detail = ELEMENT_DATA(e);
+
+		if (!detail->matches) {
+			if (stat(detail->path, &stb)) {
+				changed = !!detail->ino;
+				continue;
+			}
+
+			if (stb.st_ino == detail->ino &&
+			    stb.st_size == detail->size &&
+			    stb.st_mtim.tv_sec == detail->mtime.tv_sec &&
+			    stb.st_mtim.tv_nsec == detail->mtime.tv_nsec)
+				continue;
+
+			/* The identity moved but only the content decides -
+			 * config management rewrites files in place on every
+			 * run, and the same bytes mean a reload is a no-op.
+			 * Refresh the identity so the next check is a stat
+			 * again rather than another full read. */
+			if (conf_file_csum(detail->path) == detail->csum) {
+				detail->ino = stb.st_ino;
+				detail->size = stb.st_size;
+				detail->mtime = stb.st_mtim;
+			} else
+				changed = true;
+			continue;
+		}
+
+		globbuf.gl_offs = 0;
+		if (glob(detail->path, GLOB_MARK
+#if HAVE_DECL_GLOB_BRACE
+					       | GLOB_BRACE
+#endif
+							   , NULL, &globbuf)) {
+			changed = !!vector_size(detail->matches);
+			continue;
+		}
+
+		n = 0;
+		for (i = 0; i < globbuf.gl_pathc; i++) {
+			if (globbuf.gl_pathv[i][strlen(globbuf.gl_pathv[i])-1] == '/')
+				continue;
+
+			if (n >= vector_size(detail->matches) ||
+			    strcmp(vector_slot(detail->matches, n), globbuf.gl_pathv[i])) {
+				changed = true;
+				break;
+			}
+			n++;
+		}
+		if (n != vector_size(detail->matches))
+			changed = true;
+
+		globfree(&globbuf);
+	}
+
+	return changed;
+}
+
+/* Drain the line stream of the current file (and anything it includes)
+ * to the staging pipe. Runs in the reload staging helper */
+static void
+stage_lines(void)
+{
+	char *buf = MALLOC(MAXBUF);
+
+	while (read_line(buf, MAXBUF)) {
+		if (write(stage_fd, buf, strlen(buf) + 1) == -1) {
+			log_message(LOG_INFO, "Write to reload staging pipe failed (%s)", strerror(errno));
+			break;
+		}
+	}
+
+	FREE(buf);
+}
+
 static bool
 read_conf_file(const char *conf_file)
 {
-	FILE *stream;
+	int fd;
+	void *conf_data;
 	glob_t globbuf;
 	size_t i;
 	int	res;
 	struct stat stb;
 	unsigned num_matches = 0;
 
+	/* Parse lines received from a reload staging helper instead of
+	 * reading the filesystem again. The helper recorded the file
+	 * details in its own address space, so ours stay freed and the
+	 * next reload's change check errs on the side of reloading */
+	if (staged_buf) {
+		process_stream(current_keywords, 0);
+		FREE(staged_buf);
+		staged_buf = NULL;
+		return false;
+	}
+
 	globbuf.gl_offs = 0;
 	res = glob(conf_file, GLOB_MARK
 #if HAVE_DECL_GLOB_BRACE
@@ -430,6 +735,23 @@ read_conf_file(const char *conf_file)
 		return true;
 	}
 
+	record_conf_files(conf_file, &globbuf);
+
+	/* Ask the kernel to start reading every matched file before we parse
+	 * the first one. With a large include tree on a cold cache this
+	 * overlaps the remaining file reads with the parsing, rather than
+	 * faulting each file in on demand as we reach it. */
+	for (i = 0; i < globbuf.gl_pathc; i++) {
+		if (globbuf.gl_pathv[i][strlen(globbuf.gl_pathv[i])-1] == '/')
+			continue;
+
+		if ((fd = open(globbuf.gl_pathv[i], O_RDONLY)) == -1)
+			continue;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+
 	for (i = 0; i < globbuf.gl_pathc; i++) {
 		if (globbuf.gl_pathv[i][strlen(globbuf.gl_pathv[i])-1] == '/') {
 			/* This is a directory - so skip */
@@ -437,25 +759,40 @@ read_conf_file(const char *conf_file)
 		}
 
 		log_message(LOG_INFO, "Opening file '%s'.", globbuf.gl_pathv[i]);
-		stream = fopen(globbuf.gl_pathv[i], "r");
-		if (!stream) {
+		fd = open(globbuf.gl_pathv[i], O_RDONLY);
+		if (fd == -1) {
 			log_message(LOG_INFO, "Configuration file '%s' open problem (%s) - skipping"
 				       , globbuf.gl_pathv[i], strerror(errno));
 			continue;
 		}
 
 		/* Make sure what we have opened is a regular file, and not for example a directory or executable */
-		if (fstat(fileno(stream), &stb) ||
+		if (fstat(fd, &stb) ||
 		    !S_ISREG(stb.st_mode) ||
 		    (stb.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
 			log_message(LOG_INFO, "Configuration file '%s' is not a regular non-executable file - skipping", globbuf.gl_pathv[i]);
-			fclose(stream);
+			close(fd);
 			continue;
 		}
 
+		/* Map the whole file and read lines straight from the mapping,
+		 * rather than dribbling it through stdio */
+		if (stb.st_size) {
+			conf_data = mmap(NULL, (size_t)stb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (conf_data == MAP_FAILED) {
+				log_message(LOG_INFO, "Unable to map configuration file '%s' (%s) - skipping", globbuf.gl_pathv[i], strerror(errno));
+				close(fd);
+				continue;
+			}
+		} else
+			conf_data = NULL;
+		close(fd);
+
 		num_matches++;
 
-		current_stream = stream;
+		current_conf.data = conf_data;
+		current_conf.size = (size_t)stb.st_size;
+		current_conf.pos = 0;
 
 		int curdir_fd = -1;
 		if (strchr(globbuf.gl_pathv[i], '/')) {
@@ -476,8 +813,12 @@ read_conf_file(const char *conf_file)
 			free(confpath);
 		}
 
-		process_stream(current_keywords, 0);
-		fclose(stream);
+		if (stage_fd >= 0)
+			stage_lines();
+		else
+			process_stream(current_keywords, 0);
+		if (conf_data)
+			munmap(conf_data, (size_t)stb.st_size);
 
 		/* If we changed directory, restore the previous directory */
 		if (curdir_fd != -1) {
@@ -492,6 +833,7 @@ read_conf_file(const char *conf_file)
 	globfree(&globbuf);
 	if (LIST_EXISTS(defs))
 		free_list(&defs);
+	htab_destroy(&defs_htab);
 
 	if (!num_matches)
 		log_message(LOG_INFO, "No config files matched '%s'.", conf_file);
@@ -562,7 +904,13 @@ check_include(char *buf)
 {
 	vector_t *strvec;
 	bool ret = false;
-	FILE *prev_stream;
+	conf_map_t prev_conf;
+	const char *p = buf + strspn(buf, " \t");
+
+	/* Tokenizing is destructive, so peek at the first word before
+	 * committing the line to it */
+	if (strncmp(p, "include", 7) || (p[7] != ' ' && p[7] != '\t'))
+		return false;
 
 	strvec = alloc_strvec(buf);
 
@@ -570,11 +918,11 @@ check_include(char *buf)
 		return false;
 
 	if(!strcmp("include", vector_slot(strvec, 0)) && vector_size(strvec) == 2) {
-		prev_stream = current_stream;
+		prev_conf = current_conf;
 
 		read_conf_file(vector_slot(strvec, 1));
 
-		current_stream = prev_stream;
+		current_conf = prev_conf;
 		ret = true;
 	}
 
@@ -582,6 +930,22 @@ check_include(char *buf)
 	return ret;
 }
 
+/* FNV-1a. Definition names are short, and this avalanches enough
+ * for the open-addressing table */
+static uint64_t
+def_name_hash(const char *name, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint8_t)name[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
 static def_t *
 find_definition(const char *name, size_t len, bool definition)
 {
@@ -621,18 +985,50 @@ find_definition(const char *name, size_t len, bool definition)
 	else
 		allow_multiline = false;
 
-	for (e = LIST_HEAD(defs); e; ELEMENT_NEXT(e)) {
-		def = ELEMENT_DATA(e);
-		if (def->name_len == len &&
-		    (allow_multiline || !def->multiline) &&
-		    !strncmp(def->name, name, len))
-			return def;
+	def = htab_find(&defs_htab, def_name_hash(name, len));
+	if (def && (def->name_len != len || strncmp(def->name, name, len))) {
+		/* A 64 bit hash collision - fall back to the list */
+		def = NULL;
+		for (e = LIST_HEAD(defs); e; ELEMENT_NEXT(e)) {
+			if (((def_t *)ELEMENT_DATA(e))->name_len == len &&
+			    !strncmp(((def_t *)ELEMENT_DATA(e))->name, name, len)) {
+				def = ELEMENT_DATA(e);
+				break;
+			}
+		}
 	}
 
-	return NULL;
+	if (!def || (def->multiline && !allow_multiline))
+		return NULL;
+
+	return def;
 }
 
-static char *
+/* Split a completed multiline value into NUL terminated lines once, so
+ * each subsequent expansion is a pointer step rather than rescanning
+ * the value for line ends */
+static void
+def_split_lines(def_t *def)
+{
+	char *copy, *p;
+	unsigned nlines = 1, i;
+
+	for (p = def->value; (p = strchr(p, DEF_LINE_END)); p++)
+		nlines++;
+
+	copy = MALLOC(def->value_len + 1);
+	strcpy(copy, def->value);
+
+	def->lines = MALLOC((nlines + 1) * sizeof(char *));
+	def->lines[0] = copy;
+	for (i = 1, p = copy; (p = strchr(p, DEF_LINE_END)); i++) {
+		*p++ = '\0';
+		def->lines[i] = p;
+	}
+	def->lines[nlines] = NULL;
+}
+
+static char **
 replace_param(char *buf, size_t max_len, bool in_multiline)
 {
 	char *cur_pos = buf;
@@ -642,7 +1038,7 @@ replace_param(char *buf, size_t max_len, bool in_multiline)
 	ssize_t i;
 	size_t extra_braces;
 	size_t replacing_len;
-	char *next_ptr = NULL;
+	char **next_lines = NULL;
 
 	while ((cur_pos = strchr(cur_pos, '$')) && cur_pos[1] != '\0') {
 		if ((def = find_definition(cur_pos + 1, 0, false))) {
@@ -657,9 +1053,11 @@ replace_param(char *buf, size_t max_len, bool in_multiline)
 
 			/* Ensure there is enough room to replace $PARAM or ${PARAM} with value */
 			if (def->multiline) {
-				replacing_len = strchr(def->value, DEF_LINE_END) - def->value;
+				if (!def->lines)
+					def_split_lines(def);
+				replacing_len = strlen(def->lines[0]);
 				in_multiline = true;
-				next_ptr = def->value + replacing_len + 1;
+				next_lines = def->lines[1] ? def->lines + 1 : NULL;
 			}
 			else
 				replacing_len = def->value_len;
@@ -703,7 +1101,7 @@ replace_param(char *buf, size_t max_len, bool in_multiline)
 			cur_pos++;
 	}
 
-	return next_ptr;
+	return next_lines;
 }
 
 static void
@@ -713,6 +1111,10 @@ free_definition(void *d)
 
 	FREE(def->name);
 	FREE(def->value);
+	if (def->lines) {
+		FREE(def->lines[0]);
+		FREE(def->lines);
+	}
 	FREE(def);
 }
 
@@ -742,9 +1144,14 @@ check_definition(const char *buf)
 	if (*p != '=')
 		return false;
 
-	if ((def = find_definition(&buf[1], p - &buf[1], true)))
+	if ((def = find_definition(&buf[1], p - &buf[1], true))) {
 		FREE(def->value);
-	else {
+		if (def->lines) {
+			FREE(def->lines[0]);
+			FREE(def->lines);
+			def->lines = NULL;
+		}
+	} else {
 		def = MALLOC(sizeof(*def));
 		def->name_len = p - &buf[1];
 		str = MALLOC(def->name_len + 1);
@@ -755,6 +1162,7 @@ check_definition(const char *buf)
 		if (!LIST_EXISTS(defs))
 			defs = alloc_list(free_definition, NULL);
 		list_add(defs, def);
+		htab_insert(&defs_htab, def_name_hash(def->name, def->name_len), def);
 	}
 
 	p++;
@@ -783,6 +1191,250 @@ check_definition(const char *buf)
 	return def;
 }
 
+/* Template instantiation. A '~' directive replays the remainder of its
+ * line once per value, with the named parameter defined as each value
+ * in turn:
+ *
+ *   ~SEQ(N, 1, 40) $RS_BLOCK
+ *   ~LST(PORT, 80, 8080, 8443) $VS_BLOCK
+ *
+ * The replayed text is typically a reference to a multiline definition,
+ * which then acts as a block template parameterised by the variable
+ * (and any other definitions). The lines are generated one at a time as
+ * the parser asks for them - the configuration is never expanded into a
+ * buffer or file, so a template covering thousands of blocks costs no
+ * more memory than the template itself. ~SEQ counts from START to END
+ * inclusive, with an optional third STEP argument; ~LST iterates over
+ * its comma separated values. An argument may itself be a $PARAMETER
+ * reference. Instantiations cannot be nested. */
+static struct {
+	bool active;
+	def_t *var;		/* the iteration parameter */
+	char *text;		/* the line replayed per value */
+	bool is_seq;
+	long next_val;
+	long end_val;
+	long step;
+	vector_t *values;	/* ~LST values */
+	unsigned value_idx;
+} expand;
+
+static void
+set_definition_value(def_t *def, const char *value)
+{
+	FREE_PTR(def->value);
+	if (def->lines) {
+		FREE(def->lines[0]);
+		FREE(def->lines);
+		def->lines = NULL;
+	}
+	def->value_len = strlen(value);
+	def->value = MALLOC(def->value_len + 1);
+	strcpy(def->value, value);
+	def->multiline = false;
+}
+
+static def_t *
+get_or_create_definition(const char *name, size_t len)
+{
+	def_t *def;
+	char *str;
+
+	if ((def = find_definition(name, len, true)))
+		return def;
+
+	def = MALLOC(sizeof(*def));
+	def->name_len = len;
+	str = MALLOC(len + 1);
+	strncpy(str, name, len);
+	str[len] = '\0';
+	def->name = str;
+
+	if (!LIST_EXISTS(defs))
+		defs = alloc_list(free_definition, NULL);
+	list_add(defs, def);
+	htab_insert(&defs_htab, def_name_hash(def->name, def->name_len), def);
+
+	return def;
+}
+
+/* A directive argument may be a $PARAMETER reference to a single line
+ * definition */
+static const char *
+expand_arg(const char *tok)
+{
+	def_t *def;
+
+	if (*tok != '$')
+		return tok;
+
+	if (!(def = find_definition(tok + 1, 0, false)) || def->multiline)
+		return tok;
+
+	return def->value;
+}
+
+static void
+expand_end(void)
+{
+	FREE_PTR(expand.text);
+	expand.text = NULL;
+	free_value_block(expand.values);
+	expand.values = NULL;
+	expand.active = false;
+}
+
+/* Serve the directive text for the next value, false once the values
+ * are exhausted */
+static bool
+expand_next(char *buf, size_t size)
+{
+	char val[24];
+	const char *value;
+
+	if (expand.is_seq) {
+		if (expand.step > 0 ? expand.next_val > expand.end_val
+				    : expand.next_val < expand.end_val)
+			return false;
+		snprintf(val, sizeof(val), "%ld", expand.next_val);
+		expand.next_val += expand.step;
+		value = val;
+	} else {
+		if (expand.value_idx >= vector_size(expand.values))
+			return false;
+		value = vector_slot(expand.values, expand.value_idx++);
+	}
+
+	set_definition_value(expand.var, value);
+
+	strncpy(buf, expand.text, size - 1);
+	buf[size - 1] = '\0';
+
+	return true;
+}
+
+static void
+check_expand(char *text_start)
+{
+	char *p;
+	char *close;
+	char *name;
+	const char *argp;
+	size_t name_len;
+	size_t vlen;
+	char *tok;
+	char *endptr;
+	char *dup;
+	char *text;
+	long vals[3];
+	int nvals = 0;
+	bool is_seq;
+	vector_t *values = NULL;
+
+	if (!strncmp(text_start, "~SEQ(", 5))
+		is_seq = true;
+	else if (!strncmp(text_start, "~LST(", 5))
+		is_seq = false;
+	else {
+		log_message(LOG_INFO, "Unknown '~' directive '%s' - ignoring", text_start);
+		return;
+	}
+
+	if (expand.active) {
+		log_message(LOG_INFO, "~SEQ/~LST cannot be nested - ignoring '%s'", text_start);
+		return;
+	}
+
+	if (!(close = strchr(text_start + 5, ')'))) {
+		log_message(LOG_INFO, "Missing ')' in '%s' - ignoring", text_start);
+		return;
+	}
+	*close = '\0';
+
+	/* The iteration parameter name */
+	p = text_start + 5;
+	p += strspn(p, " \t");
+	name = p;
+	for (name_len = 0; isalnum(name[name_len]) || name[name_len] == '_'; name_len++);
+	if (!name_len || (!isalpha(name[0]) && name[0] != '_')) {
+		log_message(LOG_INFO, "Invalid parameter name in ~%s directive - ignoring", is_seq ? "SEQ" : "LST");
+		return;
+	}
+
+	p = name + name_len;
+	p += strspn(p, " \t");
+	if (*p != ',') {
+		log_message(LOG_INFO, "Missing values in ~%s directive - ignoring", is_seq ? "SEQ" : "LST");
+		return;
+	}
+	p++;
+
+	/* Split the arguments on ',' and trim each */
+	if (!is_seq)
+		values = vector_alloc();
+	while (p) {
+		if ((tok = strchr(p, ',')))
+			*tok = '\0';
+		p += strspn(p, " \t");
+		for (vlen = strlen(p); vlen && isblank(p[vlen - 1]); vlen--);
+		p[vlen] = '\0';
+
+		argp = expand_arg(p);
+		if (!*argp)
+			goto invalid;
+
+		if (is_seq) {
+			if (nvals == 3)
+				goto invalid;
+			vals[nvals] = strtol(argp, &endptr, 0);
+			if (*endptr)
+				goto invalid;
+			nvals++;
+		} else {
+			dup = MALLOC(strlen(argp) + 1);
+			strcpy(dup, argp);
+			vector_alloc_slot(values);
+			vector_set_slot(values, dup);
+		}
+
+		p = tok ? tok + 1 : NULL;
+	}
+
+	if (is_seq) {
+		if (nvals < 2)
+			goto invalid;
+		expand.next_val = vals[0];
+		expand.end_val = vals[1];
+		expand.step = nvals == 3 ? vals[2] : (vals[0] <= vals[1] ? 1 : -1);
+		if (!expand.step ||
+		    (vals[0] != vals[1] && (expand.step > 0) != (vals[0] < vals[1])))
+			goto invalid;
+	} else if (!vector_size(values))
+		goto invalid;
+
+	/* The text replayed per value */
+	text = close + 1;
+	text += strspn(text, " \t");
+	if (!*text) {
+		log_message(LOG_INFO, "~%s directive has nothing to instantiate - ignoring", is_seq ? "SEQ" : "LST");
+		free_value_block(values);
+		return;
+	}
+
+	expand.text = MALLOC(strlen(text) + 1);
+	strcpy(expand.text, text);
+	expand.values = values;
+	expand.value_idx = 0;
+	expand.is_seq = is_seq;
+	expand.var = get_or_create_definition(name, name_len);
+	expand.active = true;
+	return;
+
+invalid:
+	log_message(LOG_INFO, "Invalid values in ~%s directive - ignoring", is_seq ? "SEQ" : "LST");
+	free_value_block(values);
+}
+
 static bool
 read_line(char *buf, size_t size)
 {
@@ -795,27 +1447,39 @@ read_line(char *buf, size_t size)
 	char *text_start;
 	bool recheck;
 	static def_t *def = NULL;
-	static char *next_ptr = NULL;
+	static char **next_line = NULL;
 	bool multiline_param_def = false;
 	char *new_str;
-	char *end;
-	char *next_ptr1;
+	char **next_line1;
+
+	/* Serve lines received from a reload staging helper - the helper
+	 * already did the include following and definition expansion */
+	if (staged_buf) {
+		if (staged_pos >= staged_len)
+			return false;
+		strncpy(buf, staged_buf + staged_pos, size - 1);
+		buf[size - 1] = '\0';
+		staged_pos += strlen(staged_buf + staged_pos) + 1;
+		return true;
+	}
 
 	config_id_len = config_id ? strlen(config_id) : 0;
 	do {
-		if (next_ptr) {
+		if (next_line) {
 			/* We are expanding a multiline parameter, so copy next line */
-			end = strchr(next_ptr, DEF_LINE_END);
-			if (!end) {
-				strcpy(buf, next_ptr);
-				next_ptr = NULL;
-			} else {
-				strncpy(buf, next_ptr, end - next_ptr);
-				buf[end - next_ptr] = '\0';
-				next_ptr = end + 1;
+			strcpy(buf, *next_line);
+			if (!*++next_line)
+				next_line = NULL;
+		}
+		else if (expand.active) {
+			/* Serve the next instantiation of a ~SEQ/~LST directive */
+			if (!expand_next(buf, size)) {
+				expand_end();
+				buf[0] = '\0';
+				continue;
 			}
 		}
-		else if (!fgets(buf, (int)size, current_stream))
+		else if (!conf_gets(buf, size))
 		{
 			eof = true;
 			buf[0] = '\0';
@@ -904,6 +1568,14 @@ read_line(char *buf, size_t size)
 				text_start += strspn(text_start, " \t");
 			}
 
+			if (text_start[0] == '~') {
+				/* A template instantiation directive - subsequent
+				 * reads serve its generated lines */
+				check_expand(text_start);
+				buf[0] = '\0';
+				break;
+			}
+
 			if (text_start[0] == '$' && (def = check_definition(text_start))) {
 				/* check_definition() saves the definition */
 				if (def->multiline)
@@ -913,9 +1585,9 @@ read_line(char *buf, size_t size)
 			}
 
 			if (!LIST_ISEMPTY(defs) && strchr(text_start, '$')) {
-				next_ptr1 = replace_param(buf, size, !!next_ptr);
-				if (!next_ptr)
-					next_ptr = next_ptr1;
+				next_line1 = replace_param(buf, size, !!next_line);
+				if (!next_line)
+					next_line = next_line1;
 				text_start += strspn(text_start, " \t");
 				if (text_start[0] == '@')
 					recheck = true;
@@ -963,7 +1635,7 @@ read_value_block(vector_t *strvec)
 				str = vector_slot(vec, word);
 				if (!strcmp(str, EOB)) {
 					if (word != vector_size(vec) - 1)
-						log_message(LOG_INFO, "Extra characters after '}' - \"%s\"", buf);
+						log_message(LOG_INFO, "Extra characters after '}' - \"%s\"", FMT_STR_VSLOT(vec, word + 1));
 					got_eob = 1;
 					break;
 				}
@@ -985,6 +1657,21 @@ read_value_block(vector_t *strvec)
 	return elements;
 }
 
+/* Free a vector returned by read_value_block() - unlike strvec tokens
+ * its elements are copies owned by the vector */
+void
+free_value_block(vector_t *elements)
+{
+	unsigned int i;
+
+	if (!elements)
+		return;
+
+	for (i = 0; i < vector_size(elements); i++)
+		FREE_PTR(vector_slot(elements, i));
+	vector_free(elements);
+}
+
 void
 alloc_value_block(void (*alloc_func) (vector_t *))
 {
@@ -1063,10 +1750,35 @@ void skip_block(void)
 	skip_sublevel = 1;
 }
 
+/* Run the read side of the parser only, streaming the expanded lines
+ * NUL-terminated to fd. Runs in a forked reload helper, so the real
+ * parse can later consume the lines without the event loop waiting on
+ * the filesystem */
+void
+stage_conf_files(const char *conf_file, int fd)
+{
+	stage_fd = fd;
+	read_conf_file(conf_file);
+	stage_fd = -1;
+}
+
+/* Hand over a line stream received from a reload helper; the next
+ * init_data() parses it in place of the configuration files. Takes
+ * ownership of the buffer */
+void
+stage_conf_received(char *data, size_t len)
+{
+	staged_buf = data;
+	staged_len = len;
+	staged_pos = 0;
+}
+
 /* Data initialization */
 void
 init_data(const char *conf_file, vector_t * (*init_keywords) (void))
 {
+	mem_ctx_t prev_ctx;
+
 	/* Init Keywords structure */
 	keywords = vector_alloc();
 
@@ -1077,11 +1789,23 @@ init_data(const char *conf_file, vector_t * (*init_keywords) (void))
 	dump_keywords(keywords, 0, NULL);
 #endif
 
+	/* Installation is complete - index each level for binary search */
+	sort_keywords(keywords);
+
 	/* Stream handling */
 	current_keywords = keywords;
 
 	register_null_strvec_handler(null_strvec);
+
+	/* Forget the file list of the previous configuration */
+	free_list(&conf_file_details);
+
+	/* Tokens are slices of the line buffer and never allocated; the
+	 * remaining parse-time allocations are accounted to the parser */
+	prev_ctx = mem_ctx_set(MEM_CTX_PARSER);
 	read_conf_file(conf_file);
+	mem_ctx_set(prev_ctx);
+
 	unregister_null_strvec_handler();
 
 	/* Close the password database if it was opened */
@@ -69,12 +69,16 @@ extern void install_sublevel_end_handler(void (*handler) (void));
 extern void install_keyword(const char *, void (*handler) (vector_t *));
 extern vector_t *alloc_strvec(char *);
 extern bool check_conf_file(const char*);
+extern bool conf_files_changed(void);
 extern vector_t *read_value_block(vector_t *);
+extern void free_value_block(vector_t *);
 extern void alloc_value_block(void (*alloc_func) (vector_t *));
 extern void *set_value(vector_t *);
 extern unsigned long read_timer(vector_t *);
 extern int check_true_false(char *);
 extern void skip_block(void);
+extern void stage_conf_files(const char *, int);
+extern void stage_conf_received(char *, size_t);
 extern void init_data(const char *, vector_t * (*init_keywords) (void));
 
 #endif
@@ -31,7 +31,6 @@
 #include <linux/rtnetlink.h>
 
 #include "vector.h"
-#include "list.h"
 #include "memory.h"
 #include "logger.h"
 #include "parser.h"
@@ -54,6 +53,19 @@ struct rt_entry {
 } ;
 typedef struct rt_entry rt_entry_t;
 
+/* The iproute2 name tables are kept in arrays sorted by name, so each
+ * lookup during config parsing costs one binary search rather than a
+ * scan of the whole table. */
+struct rt_name_table {
+	rt_entry_t *entries;	/* sorted by name */
+	size_t count;
+	size_t allocated;
+	bool initialised;
+} ;
+typedef struct rt_name_table rt_name_table_t;
+
+#define RT_ENTRY_ALLOC_CHUNK	16
+
 static rt_entry_t rtntypes[] = {
 	{ RTN_LOCAL, "local"},
 	{ RTN_NAT, "nat"},
@@ -110,40 +122,71 @@ static rt_entry_t rttable_default[] = {
 
 #define	MAX_RT_BUF	128
 
-static list rt_tables;
-static list rt_dsfields;
+static rt_name_table_t rt_tables;
+static rt_name_table_t rt_dsfields;
 #if HAVE_DECL_FRA_SUPPRESS_IFGROUP
-static list rt_groups;
+static rt_name_table_t rt_groups;
 #endif
-static list rt_realms;
-static list rt_protos;
-static list rt_scopes;
+static rt_name_table_t rt_realms;
+static rt_name_table_t rt_protos;
+static rt_name_table_t rt_scopes;
 
 static char ret_buf[11];	/* uint32_t in decimal */
 
-static void
-free_rt_entry(void *e)
+static int
+rt_entry_name_cmp(const void *a, const void *b)
 {
-	rt_entry_t *rte = (rt_entry_t*)e;
+	return strcmp(((const rt_entry_t *)a)->name, ((const rt_entry_t *)b)->name);
+}
 
-	if (rte->name)
-		FREE(rte->name);
-	FREE(rte);
+static int
+rt_entry_name_lookup_cmp(const void *key, const void *entry)
+{
+	return strcmp((const char *)key, ((const rt_entry_t *)entry)->name);
 }
 
 static void
-dump_rt_entry(void *e)
+free_table(rt_name_table_t *t)
 {
-	rt_entry_t *rte = (rt_entry_t *)e;
+	size_t i;
+
+	for (i = 0; i < t->count; i++)
+		FREE(t->entries[i].name);
+	FREE_PTR(t->entries);
+	t->entries = NULL;
+	t->count = t->allocated = 0;
+	t->initialised = false;
+}
+
+static bool
+add_entry(rt_name_table_t *t, unsigned int id, const char *name)
+{
+	rt_entry_t *rte;
 
-	log_message(LOG_INFO, "rt_table %u, name %s", rte->id, rte->name);
+	if (t->count == t->allocated) {
+		rte = REALLOC(t->entries, (t->allocated + RT_ENTRY_ALLOC_CHUNK) * sizeof(*rte));
+		if (!rte)
+			return false;
+		t->entries = rte;
+		t->allocated += RT_ENTRY_ALLOC_CHUNK;
+	}
+
+	rte = &t->entries[t->count];
+	rte->name = MALLOC(strlen(name) + 1);
+	if (!rte->name)
+		return false;
+
+	strcpy(rte->name, name);
+	rte->id = id;
+	t->count++;
+
+	return true;
 }
 
 static void
-read_file(const char* file_name, list *l, uint32_t max)
+read_file(const char* file_name, rt_name_table_t *t, uint32_t max)
 {
 	FILE *fp;
-	rt_entry_t *rte;
 	vector_t *strvec = NULL;
 	char buf[MAX_RT_BUF];
 	unsigned long id;
@@ -163,31 +206,17 @@ read_file(const char* file_name, list *l, uint32_t max)
 			continue;
 		}
 
-		rte = MALLOC(sizeof(rt_entry_t));
-		if (!rte) {
-			free_strvec(strvec);
-			goto err;
-		}
-
 		id = strtoul(FMT_STR_VSLOT(strvec, 0), NULL, 0);
 		if (id > max) {
-			FREE(rte);
 			free_strvec(strvec);
 			continue;
 		}
-		rte->id = (unsigned)id;
 
-		rte->name = MALLOC(strlen(FMT_STR_VSLOT(strvec, 1)) + 1);
-		if (!rte->name) {
-			FREE(rte);
+		if (!add_entry(t, (unsigned)id, FMT_STR_VSLOT(strvec, 1))) {
 			free_strvec(strvec);
 			goto err;
 		}
 
-		strcpy(rte->name, FMT_STR_VSLOT(strvec, 1));
-
-		list_add(*l, rte);
-
 		free_strvec(strvec);
 	}
 
@@ -197,10 +226,7 @@ read_file(const char* file_name, list *l, uint32_t max)
 err:
 	fclose(fp);
 
-	if (strvec)
-		free_strvec(strvec);
-
-	free_list(l);
+	free_table(t);
 
 	return;
 }
@@ -208,28 +234,25 @@ err:
 void
 clear_rt_names(void)
 {
-	free_list(&rt_tables);
-	free_list(&rt_dsfields);
+	free_table(&rt_tables);
+	free_table(&rt_dsfields);
 #if HAVE_DECL_FRA_SUPPRESS_IFGROUP
-	free_list(&rt_groups);
+	free_table(&rt_groups);
 #endif
-	free_list(&rt_realms);
-	free_list(&rt_protos);
-	free_list(&rt_scopes);
+	free_table(&rt_realms);
+	free_table(&rt_protos);
+	free_table(&rt_scopes);
 }
 
 static void
-add_default(list *l, const struct rt_entry* default_list)
+add_default(rt_name_table_t *t, const struct rt_entry* default_list)
 {
 	bool found;
-	rt_entry_t *rte;
-	element e;
+	size_t i;
 
 	for (;default_list->name; default_list++) {
-		for (e = LIST_HEAD(*l), found = false; e; ELEMENT_NEXT(e)) {
-			rte = ELEMENT_DATA(e);
-
-			if (rte->id == default_list->id) {
+		for (i = 0, found = false; i < t->count; i++) {
+			if (t->entries[i].id == default_list->id) {
 				found = true;
 				break;
 			}
@@ -238,41 +261,30 @@ add_default(list *l, const struct rt_entry* default_list)
 		if (found)
 			continue;
 
-		rte = MALLOC(sizeof(rt_entry_t));
-		rte->name = MALLOC(strlen(default_list->name) + 1);
-		if (!rte->name) {
-			FREE(rte);
-			return;
-		}
-
-		strcpy(rte->name, default_list->name);
-		rte->id = default_list->id;
-
-		list_add(*l, rte);
+		add_entry(t, default_list->id, default_list->name);
 	}
 }
 
 static void
-initialise_list(list *l, const char *file_name, const struct rt_entry *default_list, uint32_t max)
+initialise_table(rt_name_table_t *t, const char *file_name, const struct rt_entry *default_list, uint32_t max)
 {
-
-	if (*l)
+	if (t->initialised)
 		return;
 
-	*l = alloc_list(free_rt_entry, dump_rt_entry);
-	if (!*l)
-		return;
+	t->initialised = true;
 
-	read_file(file_name, l, max);
+	read_file(file_name, t, max);
 
 	if (default_list)
-		add_default(l, default_list);
+		add_default(t, default_list);
+
+	qsort(t->entries, t->count, sizeof(*t->entries), rt_entry_name_cmp);
 }
 
 static bool
-find_entry(const char *name, unsigned int *id, list *l, const char* file_name, const struct rt_entry* default_list, uint32_t max)
+find_entry(const char *name, unsigned int *id, rt_name_table_t *t, const char* file_name, const struct rt_entry* default_list, uint32_t max)
 {
-	element e;
+	rt_entry_t *rte;
 	char	*endptr;
 	unsigned long l_id;
 
@@ -281,21 +293,18 @@ find_entry(const char *name, unsigned int *id, list *l, const char* file_name, c
 	if (endptr != name && *endptr == '\0')
 		return (*id <= max);
 
-	if (!(*l))
-		initialise_list(l, file_name, default_list, max);
+	if (!t->initialised)
+		initialise_table(t, file_name, default_list, max);
 
-	if (LIST_ISEMPTY(*l))
+	if (!t->count)
 		return false;
 
-	for (e = LIST_HEAD(*l); e; ELEMENT_NEXT(e)) {
-		rt_entry_t *rte = ELEMENT_DATA(e);
+	rte = bsearch(name, t->entries, t->count, sizeof(*t->entries), rt_entry_name_lookup_cmp);
+	if (!rte)
+		return false;
 
-		if (!strcmp(rte->name, name)) {
-			*id = rte->id;
-			return true;
-		}
-	}
-	return false;
+	*id = rte->id;
+	return true;
 }
 
 bool
@@ -377,20 +386,16 @@ find_rttables_rtntype(const char *str, uint8_t *id)
 }
 
 static const char *
-get_entry(unsigned int id, list* l, const char* file_name, const struct rt_entry* default_list, uint32_t max)
+get_entry(unsigned int id, rt_name_table_t *t, const char* file_name, const struct rt_entry* default_list, uint32_t max)
 {
-	element e;
+	size_t i;
 
-	if (!(*l))
-		initialise_list(l, file_name, default_list, max);
+	if (!t->initialised)
+		initialise_table(t, file_name, default_list, max);
 
-	if (!LIST_ISEMPTY(*l)) {
-		for (e = LIST_HEAD(*l); e; ELEMENT_NEXT(e)) {
-			rt_entry_t *rte = ELEMENT_DATA(e);
-
-			if (rte->id == id)
-				return rte->name;
-		}
+	for (i = 0; i < t->count; i++) {
+		if (t->entries[i].id == id)
+			return t->entries[i].name;
 	}
 
 	snprintf(ret_buf, sizeof(ret_buf), "%u", id);
@@ -40,7 +40,23 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <stdint.h>
+#ifndef _NO_EPOLL_
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if defined __has_include
+# if __has_include(<execinfo.h>)
+#  define _HAVE_EXECINFO_H_
+#  include <execinfo.h>
+# endif
+#endif
 
 #include "scheduler.h"
 #include "memory.h"
@@ -48,6 +64,7 @@
 #include "signals.h"
 #include "logger.h"
 #include "bitops.h"
+#include "trace.h"
 
 /* global vars */
 thread_master_t *master = NULL;
@@ -66,130 +83,12 @@ prog_type_t prog_type;		/* Parent/VRRP/Checker process */
 /* Function that returns prog_name if pid is a known child */
 static char const * (*child_finder_name)(pid_t);
 
-/* Functions for handling an optimised list of child threads if there can be many */
-static void (*child_adder)(thread_t *);
-static thread_t *(*child_finder)(pid_t);
-static void (*child_remover)(thread_t *);
-static void (*child_finder_destroy)(void);
-static size_t child_finder_list_size;
-
-static size_t
-get_pid_hash(pid_t pid)
-{
-	return (unsigned)pid % child_finder_list_size;
-}
-
-static void
-default_child_adder(thread_t *thread)
-{
-	list_add(&thread->master->child_pid_index[get_pid_hash(thread->u.c.pid)], thread);
-}
-
-static thread_t *
-default_child_finder(pid_t pid)
-{
-	thread_t *thread;
-	element e;
-	list l = &master->child_pid_index[get_pid_hash(pid)];
-
-	if (LIST_ISEMPTY(l))
-		return NULL;
-
-	for (e = LIST_HEAD(l); e; ELEMENT_NEXT(e)) {
-		thread = ELEMENT_DATA(e);
-		if (thread->u.c.pid == pid)
-			return thread;
-	}
-
-	return NULL;
-}
-
-static void
-default_child_remover(thread_t *thread)
-{
-	list_del(&thread->master->child_pid_index[get_pid_hash(thread->u.c.pid)], thread);
-}
-
-static bool
-default_child_finder_init(size_t num_entries)
-{
-	child_finder_list_size = 1;
-
-	if (num_entries < 32)
-		return false;
-
-	/* We make the default list size largest power of 2 < num_entries / 2,
-	 * subject to a limit of 256 */
-	while ((num_entries /= 2) > 1 && child_finder_list_size < 256)
-		child_finder_list_size <<= 1;
-
-	master->child_pid_index = alloc_mlist(NULL, NULL, child_finder_list_size);
-
-	return true;
-}
-
-static void
-default_child_finder_destroy(void)
-{
-	if (master->child_pid_index) {
-		free_mlist(master->child_pid_index, child_finder_list_size);
-		master->child_pid_index = NULL;
-	}
-}
-
 void
 set_child_finder_name(char const * (*func)(pid_t))
 {
 	child_finder_name = func;
 }
 
-void
-set_child_finder(void (*adder_func)(thread_t *),
-		 thread_t *(*finder_func)(pid_t),
-		 void (*remover_func)(thread_t *),
-		 bool (*init_func)(size_t),	/* returns true if child_finder to be used */
-		 void (*destroy_func)(void),
-		 size_t num_entries)
-{
-	bool using_child_finder = false;
-
-	if (child_finder_destroy)
-		child_finder_destroy();
-
-	if (adder_func == DEFAULT_CHILD_FINDER) {
-		if (default_child_finder_init(num_entries)) {
-			child_adder = default_child_adder;
-			child_finder = default_child_finder;
-			child_remover = default_child_remover;
-			child_finder_destroy = default_child_finder_destroy;
-
-			using_child_finder = true;
-		}
-	} else if (child_adder && init_func && init_func(num_entries)) {
-		child_adder = adder_func;
-		child_finder = finder_func;
-		child_remover = remover_func;
-		child_finder_destroy = destroy_func;
-
-		using_child_finder = true;
-	}
-
-	if (using_child_finder)
-		log_message(LOG_INFO, "Using optimised child finder");
-	else {
-		child_adder = NULL;
-		child_finder = NULL;
-		child_remover = NULL;
-		child_finder_destroy = NULL;
-	}
-}
-
-static void
-destroy_child_finder(void)
-{
-	set_child_finder(NULL, NULL, NULL, NULL, NULL, 0);
-}
-
 #ifndef _DEBUG_
 /* report_child_status returns true if the exit is a hard error, so unable to continue */
 bool
@@ -236,6 +135,158 @@ report_child_status(int status, pid_t pid, char const *prog_name)
 }
 #endif
 
+/* fd registration bitmaps. Unlike fd_set these grow on demand, so the
+ * number of monitored fds is not capped at FD_SETSIZE. */
+#define FD_BITS_PER_LONG	(8 * sizeof(unsigned long))
+
+static bool
+thread_fd_isset(const unsigned long *bits, unsigned size, int fd)
+{
+	if (!bits || (unsigned)fd / FD_BITS_PER_LONG >= size)
+		return false;
+
+	return !!(bits[(unsigned)fd / FD_BITS_PER_LONG] & (1UL << ((unsigned)fd % FD_BITS_PER_LONG)));
+}
+
+static void
+thread_fd_bits_grow(thread_master_t * m, int fd)
+{
+	unsigned size = (unsigned)fd / FD_BITS_PER_LONG + 1;
+	unsigned i;
+
+	if (size <= m->fd_bits_size)
+		return;
+
+	m->fd_read_bits = REALLOC(m->fd_read_bits, size * sizeof(unsigned long));
+	m->fd_write_bits = REALLOC(m->fd_write_bits, size * sizeof(unsigned long));
+	m->fd_read_thread = REALLOC(m->fd_read_thread, size * FD_BITS_PER_LONG * sizeof(thread_t *));
+	m->fd_write_thread = REALLOC(m->fd_write_thread, size * FD_BITS_PER_LONG * sizeof(thread_t *));
+	for (i = m->fd_bits_size; i < size; i++) {
+		m->fd_read_bits[i] = 0;
+		m->fd_write_bits[i] = 0;
+	}
+	for (i = m->fd_bits_size * FD_BITS_PER_LONG; i < size * FD_BITS_PER_LONG; i++) {
+		m->fd_read_thread[i] = NULL;
+		m->fd_write_thread[i] = NULL;
+	}
+	m->fd_bits_size = size;
+}
+
+#ifndef _NO_EPOLL_
+/* O(1) lookup of the thread monitoring an fd */
+static thread_t *
+thread_fd_thread(thread_master_t * m, int fd, bool read_side)
+{
+	if ((unsigned)fd >= m->fd_bits_size * FD_BITS_PER_LONG)
+		return NULL;
+
+	return read_side ? m->fd_read_thread[fd] : m->fd_write_thread[fd];
+}
+#endif
+
+#ifndef _NO_EPOLL_
+/* Maximum events fetched per epoll_wait() call */
+#define THREAD_MAX_EVENTS	64
+
+/* Update the epoll registration of an fd to match the bitmaps */
+static void
+thread_event_update(thread_master_t * m, int fd, bool was_registered)
+{
+	struct epoll_event ev;
+	int op;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	if (thread_fd_isset(m->fd_read_bits, m->fd_bits_size, fd))
+		ev.events |= EPOLLIN;
+	if (thread_fd_isset(m->fd_write_bits, m->fd_bits_size, fd))
+		ev.events |= EPOLLOUT;
+
+	if (!ev.events)
+		op = EPOLL_CTL_DEL;
+	else if (was_registered)
+		op = EPOLL_CTL_MOD;
+	else
+		op = EPOLL_CTL_ADD;
+
+	if (epoll_ctl(m->epoll_fd, op, fd, &ev) < 0)
+		log_message(LOG_INFO, "scheduler: epoll_ctl error %d on fd [%d]"
+			      , errno, fd);
+}
+#endif
+
+/* Register interest in an fd with the event engine */
+static void
+thread_fd_acquire(thread_master_t * m, thread_t * thread, int fd, bool read_side)
+{
+	unsigned long *bits;
+#ifndef _NO_EPOLL_
+	bool was_registered;
+#endif
+
+	thread_fd_bits_grow(m, fd);
+#ifndef _NO_EPOLL_
+	was_registered = thread_fd_isset(m->fd_read_bits, m->fd_bits_size, fd) ||
+			 thread_fd_isset(m->fd_write_bits, m->fd_bits_size, fd);
+#endif
+	bits = read_side ? m->fd_read_bits : m->fd_write_bits;
+	bits[(unsigned)fd / FD_BITS_PER_LONG] |= 1UL << ((unsigned)fd % FD_BITS_PER_LONG);
+
+	if (read_side)
+		m->fd_read_thread[fd] = thread;
+	else
+		m->fd_write_thread[fd] = thread;
+
+#ifndef _NO_EPOLL_
+	thread_event_update(m, fd, was_registered);
+#endif
+}
+
+/* Drop interest in an fd from the event engine */
+static void
+thread_fd_release(thread_master_t * m, int fd, bool read_side)
+{
+	unsigned long *bits = read_side ? m->fd_read_bits : m->fd_write_bits;
+
+	bits[(unsigned)fd / FD_BITS_PER_LONG] &= ~(1UL << ((unsigned)fd % FD_BITS_PER_LONG));
+
+	if (read_side)
+		m->fd_read_thread[fd] = NULL;
+	else
+		m->fd_write_thread[fd] = NULL;
+
+#ifndef _NO_EPOLL_
+	thread_event_update(m, fd, true);
+#endif
+}
+
+#ifndef _NO_EPOLL_
+/* Create the timerfd clocking the timer expiries and register it with
+ * epoll. The epoll_wait() timeout only has millisecond granularity,
+ * which at centisecond VRRPv3 advert intervals is measurable jitter;
+ * the timerfd expires with microsecond accuracy. Falling back to the
+ * epoll timeout is not an error. */
+static void
+thread_timer_fd_init(thread_master_t * m)
+{
+	struct epoll_event ev;
+
+	m->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (m->timer_fd >= 0) {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = m->timer_fd;
+		if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->timer_fd, &ev) < 0) {
+			close(m->timer_fd);
+			m->timer_fd = -1;
+		}
+	}
+
+	if (m->timer_fd < 0)
+		log_message(LOG_INFO, "scheduler: no timerfd, using epoll timeouts - %s", strerror(errno));
+}
+#endif
+
 /* Make thread master. */
 thread_master_t *
 thread_make_master(void)
@@ -243,6 +294,15 @@ thread_make_master(void)
 	thread_master_t *new;
 
 	new = (thread_master_t *) MALLOC(sizeof (thread_master_t));
+#ifndef _NO_EPOLL_
+	new->epoll_fd = epoll_create(THREAD_MAX_EVENTS);
+	if (new->epoll_fd < 0) {
+		log_message(LOG_ERR, "scheduler: epoll_create error %d", errno);
+		exit(KEEPALIVED_EXIT_FATAL);
+	}
+	new->signal_fd = -1;
+	thread_timer_fd_init(new);
+#endif
 	return new;
 }
 
@@ -260,35 +320,85 @@ thread_list_add(thread_list_t * list, thread_t * thread)
 	list->count++;
 }
 
-/* Add a new thread to the list. */
+/* 4-ary min-heap of threads keyed on thread->sands. A wide heap keeps
+ * the tree shallow and the node array cache-friendly. */
+#define THREAD_HEAP_ARITY	4
+
+#define thread_heap_peek(heap)	((heap)->count ? (heap)->nodes[0] : NULL)
+
 static void
-thread_list_add_before(thread_list_t * list, thread_t * point, thread_t * thread)
+thread_heap_sift_up(thread_heap_t * heap, unsigned pos)
 {
-	thread->next = point;
-	thread->prev = point->prev;
-	if (point->prev)
-		point->prev->next = thread;
-	else
-		list->head = thread;
-	point->prev = thread;
-	list->count++;
+	thread_t *t = heap->nodes[pos];
+	unsigned parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / THREAD_HEAP_ARITY;
+		if (timer_cmp(t->sands, heap->nodes[parent]->sands) >= 0)
+			break;
+		heap->nodes[pos] = heap->nodes[parent];
+		heap->nodes[pos]->heap_pos = pos;
+		pos = parent;
+	}
+	heap->nodes[pos] = t;
+	t->heap_pos = pos;
 }
 
-/* Add a thread in the list sorted by timeval */
 static void
-thread_list_add_timeval(thread_list_t * list, thread_t * thread)
+thread_heap_sift_down(thread_heap_t * heap, unsigned pos)
 {
-	thread_t *tt;
+	thread_t *t = heap->nodes[pos];
+	unsigned child, best, i;
 
-	for (tt = list->head; tt; tt = tt->next) {
-		if (timer_cmp(thread->sands, tt->sands) <= 0)
+	for (;;) {
+		child = pos * THREAD_HEAP_ARITY + 1;
+		if (child >= heap->count)
+			break;
+		best = child;
+		for (i = child + 1; i < child + THREAD_HEAP_ARITY && i < heap->count; i++) {
+			if (timer_cmp(heap->nodes[i]->sands, heap->nodes[best]->sands) < 0)
+				best = i;
+		}
+		if (timer_cmp(heap->nodes[best]->sands, t->sands) >= 0)
 			break;
+		heap->nodes[pos] = heap->nodes[best];
+		heap->nodes[pos]->heap_pos = pos;
+		pos = best;
 	}
+	heap->nodes[pos] = t;
+	t->heap_pos = pos;
+}
+
+/* Add a thread to a timer heap. O(log n) */
+static void
+thread_heap_insert(thread_heap_t * heap, thread_t * thread)
+{
+	if (heap->count == heap->size) {
+		heap->size = heap->size ? heap->size * 2 : 16;
+		heap->nodes = REALLOC(heap->nodes, heap->size * sizeof(thread_t *));
+	}
+	heap->nodes[heap->count] = thread;
+	thread->heap_pos = heap->count++;
+	thread_heap_sift_up(heap, thread->heap_pos);
+}
+
+/* Delete a thread from a timer heap. O(log n) */
+static void
+thread_heap_delete(thread_heap_t * heap, thread_t * thread)
+{
+	unsigned pos = thread->heap_pos;
+
+	heap->count--;
+	if (pos == heap->count)
+		return;
 
-	if (tt)
-		thread_list_add_before(list, tt, thread);
+	heap->nodes[pos] = heap->nodes[heap->count];
+	heap->nodes[pos]->heap_pos = pos;
+	if (pos > 0 &&
+	    timer_cmp(heap->nodes[pos]->sands, heap->nodes[(pos - 1) / THREAD_HEAP_ARITY]->sands) < 0)
+		thread_heap_sift_up(heap, pos);
 	else
-		thread_list_add(list, thread);
+		thread_heap_sift_down(heap, pos);
 }
 
 /* Delete a thread from the list. */
@@ -308,25 +418,137 @@ thread_list_delete(thread_list_t * list, thread_t * thread)
 	return thread;
 }
 
-/* Free all unused thread. */
+/* Timer wheel tick and horizon. A 125ms tick over 256 slots covers 32s,
+ * which takes in every recurring checker and advert interval we see in
+ * practice; anything longer stays in the heap. */
+#define TIMER_WHEEL_TICK	(TIMER_HZ / 8)
+#define TIMER_WHEEL_HORIZON	((unsigned long)TIMER_WHEEL_SLOTS * TIMER_WHEEL_TICK)
+
+/* heap_pos sentinel marking a timer thread parked in the wheel */
+#define THREAD_IN_WHEEL		((unsigned)-1)
+
+static inline unsigned
+timer_wheel_hash(timeval_t sands)
+{
+	return (unsigned)(timer_long(sands) / TIMER_WHEEL_TICK) % TIMER_WHEEL_SLOTS;
+}
+
+/* Park a timer thread in the wheel. O(1) */
 static void
-thread_clean_unuse(thread_master_t * m)
+timer_wheel_insert(timer_wheel_t * w, thread_t * thread)
 {
-	thread_t *thread;
+	thread_list_add(&w->slots[timer_wheel_hash(thread->sands)], thread);
+	thread->heap_pos = THREAD_IN_WHEEL;
+	w->count++;
+}
 
-	thread = m->unuse.head;
-	while (thread) {
-		thread_t *t;
+/* Remove a timer thread from the wheel. The slot is recomputed from the
+ * deadline, so no per-thread slot bookkeeping is needed. O(1) */
+static void
+timer_wheel_delete(timer_wheel_t * w, thread_t * thread)
+{
+	thread_list_delete(&w->slots[timer_wheel_hash(thread->sands)], thread);
+	w->count--;
+}
 
-		t = thread;
-		thread = t->next;
+/* Move expired wheel entries to the ready list. Cost per sweep is the
+ * ticks the cursor advances plus the entries that actually fire - it
+ * does not grow with the number of pending timers. */
+static void
+timer_wheel_expire(thread_master_t * m)
+{
+	timer_wheel_t *w = &m->wheel;
+	unsigned long now_tick = timer_long(time_now) / TIMER_WHEEL_TICK;
+	unsigned long nticks, i;
+	thread_list_t *slot;
+	thread_t *t, *next;
+
+	if (now_tick < w->cursor)
+		return;
+
+	if (!w->count) {
+		w->cursor = now_tick;
+		return;
+	}
+
+	/* One full revolution visits every slot */
+	nticks = now_tick - w->cursor;
+	if (nticks >= TIMER_WHEEL_SLOTS)
+		nticks = TIMER_WHEEL_SLOTS - 1;
+
+	for (i = 0; i <= nticks; i++) {
+		slot = &w->slots[(unsigned)(w->cursor + i) % TIMER_WHEEL_SLOTS];
+
+		for (t = slot->head; t; t = next) {
+			next = t->next;
+
+			/* The slot can hold entries a revolution ahead */
+			if (timer_cmp(time_now, t->sands) < 0)
+				continue;
+
+			thread_list_delete(slot, t);
+			w->count--;
+			thread_list_add(&m->ready[t->prio], t);
+			t->type = THREAD_READY;
+		}
+	}
+	w->cursor = now_tick;
+}
+
+/* Earliest deadline parked in the wheel. A slot can hold entries from a
+ * later revolution, so the scan only stops once a slot yields a deadline
+ * falling within its own tick of the current revolution. */
+static void
+timer_wheel_update_timer(timer_wheel_t * w, timeval_t * timer_min)
+{
+	unsigned long tick = w->cursor;
+	timeval_t best;
+	thread_t *t;
+	unsigned i;
+	bool found = false;
+
+	if (!w->count)
+		return;
+
+	for (i = 0; i < TIMER_WHEEL_SLOTS; i++, tick++) {
+		thread_list_t *slot = &w->slots[(unsigned)tick % TIMER_WHEEL_SLOTS];
+
+		for (t = slot->head; t; t = t->next) {
+			if (!found || timer_cmp(t->sands, best) < 0) {
+				best = t->sands;
+				found = true;
+			}
+		}
+
+		/* A deadline due within this tick cannot be beaten by
+		 * anything parked further round the wheel */
+		if (found && timer_long(best) / TIMER_WHEEL_TICK <= tick)
+			break;
+	}
+
+	if (!found)
+		return;
+
+	if (timer_isnull(*timer_min) || timer_cmp(best, *timer_min) < 0)
+		*timer_min = best;
+}
 
-		thread_list_delete(&m->unuse, t);
+/* Free all unused thread. All thread_t are carved from the slabs, so
+ * releasing the slabs releases the unuse list with them. Only safe
+ * once every thread has been moved to the unuse list. */
+static void
+thread_clean_unuse(thread_master_t * m)
+{
+	thread_slab_t *slab, *next;
 
-		/* free the thread */
-		FREE(t);
-		m->alloc--;
+	for (slab = m->slabs; slab; slab = next) {
+		next = slab->next;
+		FREE(slab);
 	}
+	m->slabs = NULL;
+
+	memset(&m->unuse, 0, sizeof (m->unuse));
+	m->alloc = 0;
 }
 
 /* Move thread to unuse list. */
@@ -360,29 +582,75 @@ thread_destroy_list(thread_master_t * m, thread_list_t thread_list)
 	}
 }
 
+/* Move heap members to unuse queue and release the node array */
+static void
+thread_destroy_heap(thread_master_t * m, thread_heap_t * heap)
+{
+	thread_t *t;
+	unsigned i;
+
+	for (i = 0; i < heap->count; i++) {
+		t = heap->nodes[i];
+		/* A fired persistent read thread is also linked on a ready
+		 * list - that sweep recycles it */
+		if (t->persistent && t->type != THREAD_READ)
+			continue;
+		t->next = t->prev = NULL;
+		t->type = THREAD_UNUSED;
+		thread_add_unuse(m, t);
+	}
+	heap->count = 0;
+	heap->size = 0;
+	FREE_PTR(heap->nodes);
+}
+
 /* Cleanup master */
 void
 thread_cleanup_master(thread_master_t * m)
 {
+	unsigned i;
+
 	/* Unuse current thread lists */
-	thread_destroy_list(m, m->read);
-	thread_destroy_list(m, m->write);
-	thread_destroy_list(m, m->timer);
-	thread_destroy_list(m, m->child);
+	thread_destroy_heap(m, &m->read);
+	thread_destroy_heap(m, &m->write);
+	thread_destroy_heap(m, &m->timer);
+	thread_destroy_heap(m, &m->child);
+	for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+		thread_destroy_list(m, m->wheel.slots[i]);
 	thread_destroy_list(m, m->event);
-	thread_destroy_list(m, m->ready);
+	for (i = 0; i < THREAD_PRIO_CLASSES; i++)
+		thread_destroy_list(m, m->ready[i]);
 
-	destroy_child_finder();
+	htab_destroy(&m->child_pid_htab);
 
 	/* Clear all FDs */
-	FD_ZERO(&m->readfd);
-	FD_ZERO(&m->writefd);
-	FD_ZERO(&m->exceptfd);
+	FREE_PTR(m->fd_read_bits);
+	FREE_PTR(m->fd_write_bits);
+	FREE_PTR(m->fd_read_thread);
+	FREE_PTR(m->fd_write_thread);
 
 	/* Clean garbage */
 	thread_clean_unuse(m);
 
+#ifndef _NO_EPOLL_
+	if (m->timer_fd >= 0)
+		close(m->timer_fd);
+	if (m->epoll_fd >= 0)
+		close(m->epoll_fd);
+#endif
+
 	memset(m, 0, sizeof(*m));
+
+#ifndef _NO_EPOLL_
+	/* Recreate the epoll instance to flush any stale fd registrations */
+	m->epoll_fd = epoll_create(THREAD_MAX_EVENTS);
+	if (m->epoll_fd < 0) {
+		log_message(LOG_ERR, "scheduler: epoll_create error %d", errno);
+		exit(KEEPALIVED_EXIT_FATAL);
+	}
+	m->signal_fd = -1;
+	thread_timer_fd_init(m);
+#endif
 }
 
 /* Stop thread scheduler. */
@@ -390,6 +658,11 @@ void
 thread_destroy_master(thread_master_t * m)
 {
 	thread_cleanup_master(m);
+#ifndef _NO_EPOLL_
+	if (m->timer_fd >= 0)
+		close(m->timer_fd);
+	close(m->epoll_fd);
+#endif
 	FREE(m);
 }
 
@@ -402,10 +675,17 @@ thread_trim_head(thread_list_t * list)
 	return NULL;
 }
 
+/* Carve thread_t on cache line boundaries so that neighbouring entries
+ * don't share a line */
+#define THREAD_CACHE_ALIGN	64
+#define THREAD_STRIDE		((sizeof(thread_t) + THREAD_CACHE_ALIGN - 1) & ~(size_t)(THREAD_CACHE_ALIGN - 1))
+#define THREAD_SLAB_BASE(slab)	(((uintptr_t)((slab) + 1) + THREAD_CACHE_ALIGN - 1) & ~(uintptr_t)(THREAD_CACHE_ALIGN - 1))
+
 /* Make new thread. */
 static thread_t *
 thread_new(thread_master_t * m)
 {
+	thread_slab_t *slab;
 	thread_t *new;
 
 	/* If one thread is already allocated return it */
@@ -415,21 +695,32 @@ thread_new(thread_master_t * m)
 		return new;
 	}
 
-	new = (thread_t *) MALLOC(sizeof (thread_t));
+	/* Carve a fresh entry from the current slab */
+	slab = m->slabs;
+	if (!slab || slab->used == THREAD_SLAB_ENTRIES) {
+		mem_ctx_t prev_ctx = mem_ctx_set(MEM_CTX_SCHEDULER);
+		slab = (thread_slab_t *) MALLOC(sizeof (thread_slab_t) + THREAD_SLAB_ENTRIES * THREAD_STRIDE + THREAD_CACHE_ALIGN - 1);
+		mem_ctx_set(prev_ctx);
+		slab->next = m->slabs;
+		m->slabs = slab;
+	}
+
+	new = (thread_t *) (THREAD_SLAB_BASE(slab) + slab->used * THREAD_STRIDE);
+	slab->used++;
 	m->alloc++;
 	return new;
 }
 
 /* Add new read thread. */
-thread_t *
-thread_add_read(thread_master_t * m, int (*func) (thread_t *)
-		, void *arg, int fd, unsigned long timer)
+static thread_t *
+thread_add_read_common(thread_master_t * m, int (*func) (thread_t *)
+		, void *arg, int fd, unsigned long timer, bool persistent)
 {
 	thread_t *thread;
 
 	assert(m != NULL);
 
-	if (FD_ISSET(fd, &m->readfd)) {
+	if (thread_fd_isset(m->fd_read_bits, m->fd_bits_size, fd)) {
 		log_message(LOG_WARNING, "There is already read fd [%d]", fd);
 		return NULL;
 	}
@@ -440,19 +731,51 @@ thread_add_read(thread_master_t * m, int (*func) (thread_t *)
 	thread->master = m;
 	thread->func = func;
 	thread->arg = arg;
-	FD_SET(fd, &m->readfd);
+	thread->timer = timer ? timer : 1;
+	thread->persistent = persistent;
+	thread_fd_acquire(m, thread, fd, true);
 	thread->u.fd = fd;
 
 	/* Compute read timeout value */
-	set_time_now();
-	thread->sands = timer_add_long(time_now, timer);
+	thread->sands = timer_add_now_long(timer);
 
-	/* Sort the thread. */
-	thread_list_add_timeval(&m->read, thread);
+	thread_heap_insert(&m->read, thread);
 
 	return thread;
 }
 
+thread_t *
+thread_add_read(thread_master_t * m, int (*func) (thread_t *)
+		, void *arg, int fd, unsigned long timer)
+{
+	return thread_add_read_common(m, func, arg, fd, timer, false);
+}
+
+/* Add a read thread that stays registered across fires. The callback
+ * still runs on a copy, but the fd table entry, event engine
+ * registration and timeout stay armed in place - none of the
+ * alloc/unlink/relink churn a one-shot registration pays per event.
+ * Each fire re-arms the timeout; thread_read_rearm() changes it and
+ * thread_cancel() removes the registration. A timeout delivers
+ * THREAD_READ_TIMEOUT and tears the registration down like a one-shot,
+ * so fault handling that closes and reopens fds keeps working. */
+thread_t *
+thread_add_read_persistent(thread_master_t * m, int (*func) (thread_t *)
+		, void *arg, int fd, unsigned long timer)
+{
+	return thread_add_read_common(m, func, arg, fd, timer, true);
+}
+
+/* Refresh the timeout of a persistent read registration in place */
+void
+thread_read_rearm(thread_t * thread, unsigned long timer)
+{
+	thread->timer = timer ? timer : 1;
+	thread_heap_delete(&thread->master->read, thread);
+	thread->sands = timer_add_now_long(thread->timer);
+	thread_heap_insert(&thread->master->read, thread);
+}
+
 /* Add new write thread. */
 thread_t *
 thread_add_write(thread_master_t * m, int (*func) (thread_t *)
@@ -462,7 +785,7 @@ thread_add_write(thread_master_t * m, int (*func) (thread_t *)
 
 	assert(m != NULL);
 
-	if (FD_ISSET(fd, &m->writefd)) {
+	if (thread_fd_isset(m->fd_write_bits, m->fd_bits_size, fd)) {
 		log_message(LOG_WARNING, "There is already write fd [%d]", fd);
 		return NULL;
 	}
@@ -473,25 +796,30 @@ thread_add_write(thread_master_t * m, int (*func) (thread_t *)
 	thread->master = m;
 	thread->func = func;
 	thread->arg = arg;
-	FD_SET(fd, &m->writefd);
+	thread_fd_acquire(m, thread, fd, false);
 	thread->u.fd = fd;
 
 	/* Compute write timeout value */
-	set_time_now();
-	thread->sands = timer_add_long(time_now, timer);
+	thread->timer = timer;
+	thread->sands = timer_add_now_long(timer);
 
-	/* Sort the thread. */
-	thread_list_add_timeval(&m->write, thread);
+	thread_heap_insert(&m->write, thread);
 
 	return thread;
 }
 
-/* Add timer event thread. */
+/* Add timer event thread, tolerating up to slack of extra delay.
+ * Tolerant deadlines are rounded up onto shared boundaries - the wheel
+ * tick, or the tolerance itself when that is tighter - so however many
+ * of them are pending, the process takes one wakeup per boundary
+ * rather than one per timer, and the idle loop sleeps through the
+ * gaps. */
 thread_t *
-thread_add_timer(thread_master_t * m, int (*func) (thread_t *)
-		 , void *arg, unsigned long timer)
+thread_add_timer_slack(thread_master_t * m, int (*func) (thread_t *)
+		 , void *arg, unsigned long timer, unsigned long slack)
 {
 	thread_t *thread;
+	unsigned long align, rem;
 
 	assert(m != NULL);
 
@@ -503,15 +831,34 @@ thread_add_timer(thread_master_t * m, int (*func) (thread_t *)
 	thread->arg = arg;
 
 	/* Do we need jitter here? */
-	set_time_now();
-	thread->sands = timer_add_long(time_now, timer);
+	thread->sands = timer_add_now_long(timer);
+
+	if (slack) {
+		align = slack < TIMER_WHEEL_TICK ? slack : TIMER_WHEEL_TICK;
+		rem = timer_long(thread->sands) % align;
+		if (rem)
+			thread->sands = timer_add_long(thread->sands, align - rem);
+	}
 
-	/* Sort by timeval. */
-	thread_list_add_timeval(&m->timer, thread);
+	/* Short intervals - the recurring checker and advert case - go
+	 * into the wheel for O(1) re-arm; longer one-shot deadlines keep
+	 * the heap. */
+	if (timer < TIMER_WHEEL_HORIZON)
+		timer_wheel_insert(&m->wheel, thread);
+	else
+		thread_heap_insert(&m->timer, thread);
 
 	return thread;
 }
 
+/* Add timer event thread. */
+thread_t *
+thread_add_timer(thread_master_t * m, int (*func) (thread_t *)
+		 , void *arg, unsigned long timer)
+{
+	return thread_add_timer_slack(m, func, arg, timer, 0);
+}
+
 /* Add a child thread. */
 thread_t *
 thread_add_child(thread_master_t * m, int (*func) (thread_t *)
@@ -531,18 +878,66 @@ thread_add_child(thread_master_t * m, int (*func) (thread_t *)
 	thread->u.c.status = 0;
 
 	/* Compute write timeout value */
-	set_time_now();
-	thread->sands = timer_add_long(time_now, timer);
-
-	/* Sort by timeval. */
-	thread_list_add_timeval(&m->child, thread);
+	thread->sands = timer_add_now_long(timer);
 
-	if (child_adder)
-		child_adder(thread);
+	thread_heap_insert(&m->child, thread);
+	htab_insert(&m->child_pid_htab, (uint64_t)pid, thread);
 
 	return thread;
 }
 
+/* Expire pending timer threads early. Every timer thread belonging to
+ * arg has its deadline moved to now, so it fires on the next scheduler
+ * iteration instead of waiting out its interval. Timers already due are
+ * left alone. Returns the number of timers moved. */
+unsigned
+thread_timer_expire_arg(thread_master_t * m, void *arg)
+{
+	thread_list_t *slot;
+	thread_t *t, *next;
+	unsigned moved = 0;
+	unsigned i;
+	bool found;
+
+	set_time_now();
+
+	/* Heap entries. Deletion backfills the vacated slot, so rescan
+	 * from the start after each hit; moved entries are already due
+	 * and no longer match. */
+	do {
+		found = false;
+		for (i = 0; i < m->timer.count; i++) {
+			t = m->timer.nodes[i];
+			if (t->arg != arg || timer_cmp(t->sands, time_now) <= 0)
+				continue;
+			thread_heap_delete(&m->timer, t);
+			t->sands = time_now;
+			thread_heap_insert(&m->timer, t);
+			moved++;
+			found = true;
+			break;
+		}
+	} while (found);
+
+	/* Wheel entries are moved to the heap - their slot no longer
+	 * matches the new deadline */
+	for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		slot = &m->wheel.slots[i];
+		for (t = slot->head; t; t = next) {
+			next = t->next;
+			if (t->arg != arg || timer_cmp(t->sands, time_now) <= 0)
+				continue;
+			thread_list_delete(slot, t);
+			m->wheel.count--;
+			t->sands = time_now;
+			thread_heap_insert(&m->timer, t);
+			moved++;
+		}
+	}
+
+	return moved;
+}
+
 /* Add simple event thread. */
 thread_t *
 thread_add_event(thread_master_t * m, int (*func) (thread_t *)
@@ -584,6 +979,17 @@ thread_add_terminate_event(thread_master_t * m)
 	return thread;
 }
 
+/* Set the dispatch class of a queued thread. Call right after the
+ * thread_add_*() that created it, before it can become ready. */
+void
+thread_set_priority(thread_t * thread, unsigned char prio)
+{
+	if (!thread)
+		return;
+
+	thread->prio = prio;
+}
+
 /* Cancel thread from scheduler. */
 int
 thread_cancel(thread_t * thread)
@@ -593,24 +999,28 @@ thread_cancel(thread_t * thread)
 
 	switch (thread->type) {
 	case THREAD_READ:
-		assert(FD_ISSET(thread->u.fd, &thread->master->readfd));
-		FD_CLR(thread->u.fd, &thread->master->readfd);
-		thread_list_delete(&thread->master->read, thread);
+		assert(thread_fd_isset(thread->master->fd_read_bits, thread->master->fd_bits_size, thread->u.fd));
+		thread_fd_release(thread->master, thread->u.fd, true);
+		thread_heap_delete(&thread->master->read, thread);
 		break;
 	case THREAD_WRITE:
-		assert(FD_ISSET(thread->u.fd, &thread->master->writefd));
-		FD_CLR(thread->u.fd, &thread->master->writefd);
-		thread_list_delete(&thread->master->write, thread);
+		assert(thread_fd_isset(thread->master->fd_write_bits, thread->master->fd_bits_size, thread->u.fd));
+		thread_fd_release(thread->master, thread->u.fd, false);
+		thread_heap_delete(&thread->master->write, thread);
 		break;
 	case THREAD_TIMER:
-		thread_list_delete(&thread->master->timer, thread);
+		if (thread->heap_pos == THREAD_IN_WHEEL)
+			timer_wheel_delete(&thread->master->wheel, thread);
+		else
+			thread_heap_delete(&thread->master->timer, thread);
 		break;
 	case THREAD_CHILD:
 		/* Does this need to kill the child, or is that the
 		 * caller's job?
 		 * This function is currently unused, so leave it for now.
 		 */
-		thread_list_delete(&thread->master->child, thread);
+		thread_heap_delete(&thread->master->child, thread);
+		htab_del(&thread->master->child_pid_htab, (uint64_t)thread->u.c.pid);
 		break;
 	case THREAD_EVENT:
 		thread_list_delete(&thread->master->event, thread);
@@ -620,7 +1030,13 @@ thread_cancel(thread_t * thread)
 	case THREAD_READ_TIMEOUT:
 	case THREAD_WRITE_TIMEOUT:
 	case THREAD_CHILD_TIMEOUT:
-		thread_list_delete(&thread->master->ready, thread);
+		/* A queued persistent read thread is still registered and
+		 * parked in the read heap as well */
+		if (thread->persistent) {
+			thread_fd_release(thread->master, thread->u.fd, true);
+			thread_heap_delete(&thread->master->read, thread);
+		}
+		thread_list_delete(&thread->master->ready[thread->prio], thread);
 		break;
 	default:
 		break;
@@ -631,44 +1047,295 @@ thread_cancel(thread_t * thread)
 	return 0;
 }
 
-#ifdef _INCLUDE_UNUSED_CODE_
-/* Delete all events which has argument value arg. */
-void
-thread_cancel_event(thread_master_t * m, void *arg)
+/* Cancel every thread in a heap whose argument is arg. The matches are
+ * collected before any is cancelled - thread_heap_delete() refills the
+ * hole from the end of the array and re-sifts, so deleting while
+ * scanning can move an unvisited node behind the scan position. */
+static void
+thread_heap_cancel_arg(thread_heap_t * heap, void *arg)
 {
-	thread_t *thread;
+	thread_t **matches;
+	unsigned n = 0;
+	unsigned i;
 
-	thread = m->event.head;
-	while (thread) {
-		thread_t *t;
-
-		t = thread;
-		thread = t->next;
+	if (!heap->count)
+		return;
 
-		if (t->arg == arg) {
-			thread_list_delete(&m->event, t);
-			t->type = THREAD_UNUSED;
-			thread_add_unuse(m, t);
-		}
+	matches = MALLOC(sizeof(thread_t *) * heap->count);
+	for (i = 0; i < heap->count; i++) {
+		if (heap->nodes[i]->arg == arg)
+			matches[n++] = heap->nodes[i];
 	}
-}
-#endif
+
+	for (i = 0; i < n; i++)
+		thread_cancel(matches[i]);
+
+	FREE(matches);
+}
+
+/* Cancel every queued thread whose argument is arg. For tearing down an
+ * object that may still have threads in flight - one sweep of the
+ * queues replaces a cancellation scan per thread, and each unlink is
+ * the same pointer surgery thread_cancel() does. */
+void
+thread_cancel_arg(thread_master_t * m, void *arg)
+{
+	thread_t *t, *next;
+	unsigned i;
+
+	thread_heap_cancel_arg(&m->read, arg);
+	thread_heap_cancel_arg(&m->write, arg);
+	thread_heap_cancel_arg(&m->timer, arg);
+	thread_heap_cancel_arg(&m->child, arg);
+
+	for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		for (t = m->wheel.slots[i].head; t; t = next) {
+			next = t->next;
+			if (t->arg == arg)
+				thread_cancel(t);
+		}
+	}
+
+	for (t = m->event.head; t; t = next) {
+		next = t->next;
+		if (t->arg == arg)
+			thread_cancel(t);
+	}
+
+	for (i = 0; i < THREAD_PRIO_CLASSES; i++) {
+		for (t = m->ready[i].head; t; t = next) {
+			next = t->next;
+			if (t->arg == arg)
+				thread_cancel(t);
+		}
+	}
+}
 
 /* Update timer value */
 static void
-thread_update_timer(thread_list_t *list, timeval_t *timer_min)
+thread_update_timer(thread_heap_t *heap, timeval_t *timer_min)
 {
-	if (list->head) {
+	thread_t *t = thread_heap_peek(heap);
+
+	if (t) {
 		if (!timer_isnull(*timer_min)) {
-			if (timer_cmp(list->head->sands, *timer_min) <= 0) {
-				*timer_min = list->head->sands;
+			if (timer_cmp(t->sands, *timer_min) <= 0) {
+				*timer_min = t->sands;
 			}
 		} else {
-			*timer_min = list->head->sands;
+			*timer_min = t->sands;
 		}
 	}
 }
 
+/*
+ * Event-loop self-monitoring. A blocked loop is the worst failure mode
+ * we have - adverts stop being sent but nothing is logged locally - so
+ * every callback's wall time is measured and bucketed, callbacks that
+ * hold the loop longer than THREAD_SLOW_CALLBACK_USEC are logged, and
+ * when systemd supplies a watchdog the loop pets it so a seized daemon
+ * is restarted instead of stalling silently.
+ */
+#define THREAD_SLOW_CALLBACK_USEC	(TIMER_HZ / 10)	/* 100ms holds off adverts */
+#define LAG_HIST_BUCKETS		28		/* log2(usec) buckets */
+
+static uint64_t cb_lag_hist[LAG_HIST_BUCKETS];
+
+/* Per-callback budget accounting. Every dispatch adds its wall and CPU
+ * time to a fixed open-addressed table keyed by the callback pointer -
+ * two clock reads and a short probe per call, cheap enough to stay on
+ * in production. The last slot aggregates overflow should a process
+ * ever run more distinct callbacks than the table holds. */
+#define CALLBACK_ACCT_SLOTS	64
+
+typedef struct _cb_acct {
+	int (*func) (thread_t *);	/* NULL = free, or the overflow slot */
+	uint64_t calls;
+	uint64_t wall;			/* usec on the loop */
+	uint64_t cpu;			/* usec actually computing */
+} cb_acct_t;
+
+static cb_acct_t cb_acct[CALLBACK_ACCT_SLOTS];
+
+static int watchdog_sock = -1;
+static timeus_t watchdog_pet_interval;	/* usec between WATCHDOG=1, 0 = disabled */
+static timeus_t watchdog_next_pet;
+
+/* Resolve a callback pointer as well as the symbol tables allow; static
+ * functions come out as module+offset for addr2line */
+static const char *
+thread_symbolize(int (*func) (thread_t *), char *buf, size_t len)
+{
+#ifdef _HAVE_EXECINFO_H_
+	void *addr = (void *)func;
+	char **sym = backtrace_symbols(&addr, 1);
+
+	if (sym) {
+		strncpy(buf, sym[0], len - 1);
+		buf[len - 1] = '\0';
+		free(sym);
+		return buf;
+	}
+#endif
+	snprintf(buf, len, "%p", (void *)func);
+	return buf;
+}
+
+static cb_acct_t *
+thread_acct_slot(int (*func) (thread_t *))
+{
+	unsigned probes;
+	unsigned slot = (unsigned)(((uintptr_t)func >> 4) % (CALLBACK_ACCT_SLOTS - 1));
+	cb_acct_t *a;
+
+	for (probes = 0; probes < CALLBACK_ACCT_SLOTS - 1; probes++) {
+		a = &cb_acct[slot];
+		if (a->func == func || !a->func) {
+			a->func = func;
+			return a;
+		}
+		slot = (slot + 1) % (CALLBACK_ACCT_SLOTS - 1);
+	}
+
+	/* Table full - aggregate the rest rather than lose them */
+	return &cb_acct[CALLBACK_ACCT_SLOTS - 1];
+}
+
+static void
+thread_account_callback(int (*func) (thread_t *), timeus_t duration, timeus_t cpu)
+{
+	unsigned bucket;
+	char symbuf[256];
+	cb_acct_t *acct;
+
+	bucket = duration ? 63 - (unsigned)__builtin_clzll(duration) : 0;
+	if (bucket >= LAG_HIST_BUCKETS)
+		bucket = LAG_HIST_BUCKETS - 1;
+	cb_lag_hist[bucket]++;
+
+	acct = thread_acct_slot(func);
+	acct->calls++;
+	acct->wall += duration;
+	acct->cpu += cpu;
+
+	if (duration >= THREAD_SLOW_CALLBACK_USEC)
+		log_message(LOG_INFO, "Scheduler: callback %s held the event loop for %" PRIu64 ".%6.6" PRIu64 " sec",
+			    thread_symbolize(func, symbuf, sizeof(symbuf)),
+			    duration / TIMER_HZ, duration % TIMER_HZ);
+}
+
+/* "top for the event loop" - the accumulated budget per callback since
+ * start, heaviest wall time first, for the control socket */
+void
+thread_dump_callback_acct(FILE *fp)
+{
+	cb_acct_t *order[CALLBACK_ACCT_SLOTS];
+	cb_acct_t *a;
+	uint64_t total_wall = 0;
+	char symbuf[256];
+	unsigned i, j, n = 0;
+
+	for (i = 0; i < CALLBACK_ACCT_SLOTS; i++) {
+		if (!cb_acct[i].calls)
+			continue;
+		order[n++] = &cb_acct[i];
+		total_wall += cb_acct[i].wall;
+	}
+
+	if (!n) {
+		fprintf(fp, "no callbacks dispatched yet\n");
+		return;
+	}
+
+	/* Insertion sort - the table is small */
+	for (i = 1; i < n; i++) {
+		a = order[i];
+		for (j = i; j > 0 && a->wall > order[j - 1]->wall; j--)
+			order[j] = order[j - 1];
+		order[j] = a;
+	}
+
+	fprintf(fp, "%12s %14s %14s %6s  %s\n",
+		"calls", "wall_usec", "cpu_usec", "wall%", "callback");
+	for (i = 0; i < n; i++) {
+		a = order[i];
+		fprintf(fp, "%12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %5" PRIu64 "%%  %s\n",
+			a->calls, a->wall, a->cpu,
+			total_wall ? a->wall * 100 / total_wall : 0,
+			a->func ? thread_symbolize(a->func, symbuf, sizeof(symbuf))
+				: "(other)");
+	}
+}
+
+/* Logged once at shutdown; armed tracers can read the live counters */
+static void
+thread_dump_lag_histogram(void)
+{
+	unsigned i;
+
+	for (i = 0; i < LAG_HIST_BUCKETS; i++) {
+		if (!cb_lag_hist[i])
+			continue;
+		log_message(LOG_INFO, "Scheduler: callbacks < %" PRIu64 " usec: %" PRIu64,
+			    (uint64_t)1 << (i + 1), cb_lag_hist[i]);
+	}
+}
+
+/* Arm the systemd watchdog if we were started with one. sd_notify() is
+ * a trivial datagram protocol, so speak it directly rather than pull in
+ * libsystemd. */
+static void
+scheduler_watchdog_init(void)
+{
+	const char *usec_str = getenv("WATCHDOG_USEC");
+	const char *pid_str = getenv("WATCHDOG_PID");
+	const char *sock_path = getenv("NOTIFY_SOCKET");
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	uint64_t usec;
+	size_t path_len;
+
+	if (!usec_str || !sock_path)
+		return;
+
+	/* The watchdog may be meant for our parent */
+	if (pid_str && (pid_t)strtol(pid_str, NULL, 10) != getpid())
+		return;
+
+	usec = strtoull(usec_str, NULL, 10);
+	path_len = strlen(sock_path);
+	if (!usec || path_len == 0 || path_len >= sizeof(addr.sun_path))
+		return;
+
+	memcpy(addr.sun_path, sock_path, path_len);
+	if (addr.sun_path[0] == '@')	/* abstract namespace */
+		addr.sun_path[0] = '\0';
+
+	if ((watchdog_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1) {
+		log_message(LOG_INFO, "Scheduler: watchdog socket error %d (%m)", errno);
+		return;
+	}
+	if (connect(watchdog_sock, (struct sockaddr *)&addr,
+		    (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len)) == -1) {
+		log_message(LOG_INFO, "Scheduler: watchdog connect error %d (%m)", errno);
+		close(watchdog_sock);
+		watchdog_sock = -1;
+		return;
+	}
+
+	/* Pet at half the timeout as systemd recommends */
+	watchdog_pet_interval = usec / 2;
+	watchdog_next_pet = 0;
+	log_message(LOG_INFO, "Scheduler: petting systemd watchdog every %" PRIu64 " usec", watchdog_pet_interval);
+}
+
+static void
+scheduler_watchdog_pet(void)
+{
+	if (send(watchdog_sock, "WATCHDOG=1", 10, MSG_NOSIGNAL) == -1)
+		log_message(LOG_INFO, "Scheduler: watchdog pet error %d (%m)", errno);
+	watchdog_next_pet = time_now_us + watchdog_pet_interval;
+}
+
 /* Compute the wait timer. Take care of timeouted fd */
 static void
 thread_compute_timer(thread_master_t * m, timeval_t * timer_wait)
@@ -677,6 +1344,7 @@ thread_compute_timer(thread_master_t * m, timeval_t * timer_wait)
 
 	/* Prepare timer */
 	timer_reset(timer_min);
+	timer_wheel_update_timer(&m->wheel, &timer_min);
 	thread_update_timer(&m->timer, &timer_min);
 	thread_update_timer(&m->write, &timer_min);
 	thread_update_timer(&m->read, &timer_min);
@@ -700,65 +1368,255 @@ thread_compute_timer(thread_master_t * m, timeval_t * timer_wait)
 	}
 }
 
-/* Fetch next ready thread. */
-thread_t *
-thread_fetch(thread_master_t * m, thread_t * fetch)
+#ifndef _NO_EPOLL_
+#ifdef _WITH_SNMP_
+/* fds the SNMP agent asked us to monitor, currently registered with epoll */
+static fd_set snmp_registered_fds;
+static bool snmp_agent_stale = true;	/* agent fds or timers may have changed */
+static bool snmp_timer_armed;		/* the agent has a pending timeout */
+static timeval_t snmp_sands;		/* when that timeout expires */
+
+/* The agent's fd set and timers only change when the agent itself has
+ * run, or when the agent connection is opened or closed outside the
+ * event loop (startup, reload). This forces the next thread_wait() to
+ * re-run the snmp_select_info() registration sync. */
+void
+snmp_agent_mark_stale(void)
 {
-	int ret, old_errno;
-	thread_t *thread;
-	fd_set readfd;
-	fd_set writefd;
-	fd_set exceptfd;
-	timeval_t timer_wait;
+	snmp_agent_stale = true;
+}
+#endif
+
+/* Wait for an fd event or the next timer expiry. Ready fd threads are
+ * moved to the ready queue; timeouts are handled by the caller. The
+ * dispatch cost scales with the number of ready fds, not monitored fds. */
+static int
+thread_wait(thread_master_t * m, timeval_t * timer_wait)
+{
+	struct epoll_event events[THREAD_MAX_EVENTS];
+	int ret, old_errno, timeout, i, fd;
 	int signal_fd;
+	thread_t *t;
 #ifdef _WITH_SNMP_
 	timeval_t snmp_timer_wait;
-	int snmpblock = 0;
+	int snmpblock;
 	int fdsetsize;
+	fd_set snmp_fdset;
+	fd_set snmp_readyset;
+	bool snmp_ready = false;
+	bool snmp_processed = false;
+	bool timer_popped = false;
+	struct epoll_event sev;
 #endif
-	bool timers_done;
 
-	assert(m != NULL);
+	/* The signal pipe can be recreated, so refresh its registration */
+	signal_fd = signal_rfd();
+	if (signal_fd != m->signal_fd) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = signal_fd;
+		if (signal_fd != -1 &&
+		    epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0)
+			log_message(LOG_INFO, "scheduler: epoll_ctl error %d on signal fd [%d]"
+				      , errno, signal_fd);
+		m->signal_fd = signal_fd;
+	}
 
-	/* Timer initialization */
-	memset(&timer_wait, 0, sizeof (timeval_t));
+#ifdef _WITH_SNMP_
+	/* When SNMP is enabled, we may have to monitor additional FDs.
+	 * snmp_select_info() still talks fd_set, so sync the set it wants
+	 * into the epoll registrations. The agent's fds and timers only
+	 * change when the agent itself has run, so the sync - and the
+	 * FD_SETSIZE scan it entails - is skipped until then. Passing
+	 * snmpblock as 1 makes snmp_select_info() report the agent's own
+	 * timeout rather than the minimum with ours; it clears the flag
+	 * if the agent has one. */
+	if (snmp_agent_stale) {
+		fdsetsize = FD_SETSIZE;
+		snmpblock = 1;
+		FD_ZERO(&snmp_fdset);
+		timer_reset(snmp_timer_wait);
+		snmp_select_info(&fdsetsize, &snmp_fdset, &snmp_timer_wait, &snmpblock);
+		snmp_timer_armed = (snmpblock == 0);
+		if (snmp_timer_armed)
+			snmp_sands = timer_add_now(snmp_timer_wait);
+
+		memset(&sev, 0, sizeof(sev));
+		sev.events = EPOLLIN;
+		for (fd = 0; fd < fdsetsize; fd++) {
+			if (FD_ISSET(fd, &snmp_fdset) == FD_ISSET(fd, &snmp_registered_fds))
+				continue;
+			sev.data.fd = fd;
+			if (FD_ISSET(fd, &snmp_fdset)) {
+				epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, fd, &sev);
+				FD_SET(fd, &snmp_registered_fds);
+			} else {
+				epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, fd, &sev);
+				FD_CLR(fd, &snmp_registered_fds);
+			}
+		}
 
-retry:	/* When thread can't fetch try to find next thread again. */
+		snmp_agent_stale = false;
+	}
 
-	/* If there is event process it first. */
-	while ((thread = thread_trim_head(&m->event))) {
-		*fetch = *thread;
+	if (snmp_timer_armed) {
+		snmp_timer_wait = timer_sub_now(snmp_sands);
+		if (snmp_timer_wait.tv_sec < 0)
+			timer_reset(snmp_timer_wait);
+		if (timer_cmp(snmp_timer_wait, *timer_wait) < 0)
+			memcpy(timer_wait, &snmp_timer_wait, sizeof(timeval_t));
+	}
+	FD_ZERO(&snmp_readyset);
+#endif
 
-		/* If daemon hanging event is received return NULL pointer */
-		if (thread->type == THREAD_TERMINATE) {
-			thread->type = THREAD_UNUSED;
-			thread_add_unuse(m, thread);
-			return NULL;
+	if (m->timer_fd >= 0) {
+		struct itimerspec its;
+
+		its.it_interval.tv_sec = 0;
+		its.it_interval.tv_nsec = 0;
+		its.it_value.tv_sec = timer_wait->tv_sec;
+		its.it_value.tv_nsec = timer_wait->tv_usec * 1000;
+		/* an all zero it_value would disarm the timer */
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+		timerfd_settime(m->timer_fd, 0, &its, NULL);
+		timeout = -1;
+	} else
+		timeout = timer_wait->tv_sec * 1000 + (timer_wait->tv_usec + 999) / 1000;
+
+	ret = epoll_wait(m->epoll_fd, events, THREAD_MAX_EVENTS, timeout);
+
+	/* we have to save errno here because the next syscalls will set it */
+	old_errno = errno;
+
+	if (ret < 0 && old_errno != EINTR) {
+		/* Real error. */
+		DBG("epoll_wait error: %s", strerror(old_errno));
+		assert(0);
+	}
+
+	for (i = 0; i < ret; i++) {
+		fd = events[i].data.fd;
+
+		/* drain the timer expiry; the caller handles the timeouts */
+		if (fd == m->timer_fd) {
+			uint64_t expiries;
+
+			if (read(m->timer_fd, &expiries, sizeof(expiries)) < 0) {
+				DBG("timerfd read error: %s", strerror(errno));
+			}
+#ifdef _WITH_SNMP_
+			timer_popped = true;
+#endif
+			continue;
+		}
+
+		/* handle signals synchronously, including child reaping */
+		if (fd == m->signal_fd) {
+			signal_run_callback();
+			continue;
+		}
+
+#ifdef _WITH_SNMP_
+		if (fd < FD_SETSIZE && FD_ISSET(fd, &snmp_registered_fds)) {
+			FD_SET(fd, &snmp_readyset);
+			snmp_ready = true;
+			continue;
+		}
+#endif
+
+		if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			t = thread_fd_thread(m, fd, true);
+			/* A persistent thread already queued for dispatch is
+			 * reported again while its data sits unread - the
+			 * queued fire covers it */
+			if (t && t->type == THREAD_READ) {
+				if (t->persistent) {
+					/* Stays registered - re-arm the
+					 * timeout and queue the fire */
+					if (t->timer != TIMER_NEVER) {
+						thread_heap_delete(&m->read, t);
+						t->sands = timer_add_now_long(t->timer);
+						thread_heap_insert(&m->read, t);
+					}
+				} else {
+					thread_fd_release(m, fd, true);
+					thread_heap_delete(&m->read, t);
+				}
+				thread_list_add(&m->ready[t->prio], t);
+				t->type = THREAD_READY_FD;
+			}
+		}
+		if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+			t = thread_fd_thread(m, fd, false);
+			if (t) {
+				thread_fd_release(m, fd, false);
+				thread_heap_delete(&m->write, t);
+				thread_list_add(&m->ready[t->prio], t);
+				t->type = THREAD_READY_FD;
+			}
 		}
-		thread->type = THREAD_UNUSED;
-		thread_add_unuse(m, thread);
-		return fetch;
 	}
 
-	/* If there is ready threads process them */
-	while ((thread = thread_trim_head(&m->ready))) {
-		*fetch = *thread;
-		thread->type = THREAD_UNUSED;
-		thread_add_unuse(m, thread);
-		return fetch;
+	/* Handle SNMP stuff */
+#ifdef _WITH_SNMP_
+	if (snmp_ready) {
+		snmp_read(&snmp_readyset);
+		snmp_processed = true;
+	} else if (snmp_timer_armed && (ret == 0 || timer_popped) &&
+		   timer_cmp(timer_now_precise(), snmp_sands) >= 0) {
+		snmp_timeout();
+		snmp_processed = true;
 	}
 
-	/*
-	 * Re-read the current time to get the maximum accuracy.
-	 * Calculate select wait timer. Take care of timeouted fd.
-	 */
-	set_time_now();
-	thread_compute_timer(m, &timer_wait);
+	if (snmp_processed) {
+		/* Reading or timing out a request can fire alarms, create
+		 * delegated requests and change the agent's fds or timers */
+		run_alarms();
+		netsnmp_check_outstanding_agent_requests();
+		snmp_agent_stale = true;
+	}
+#endif
 
-	/* Call select function. */
-	readfd = m->readfd;
-	writefd = m->writefd;
-	exceptfd = m->exceptfd;
+	return ret;
+}
+
+#else	/* _NO_EPOLL_ */
+
+#ifdef _WITH_SNMP_
+/* The select() engine rebuilds the agent's fd set every iteration, so
+ * there is no cached registration to invalidate */
+void
+snmp_agent_mark_stale(void)
+{
+}
+#endif
+
+/* select() fallback engine. O(max_fd) per wakeup and limited to
+ * FD_SETSIZE fds, but available on any platform. */
+static int
+thread_wait(thread_master_t * m, timeval_t * timer_wait)
+{
+	int ret, old_errno;
+	thread_t *t;
+	unsigned i;
+	fd_set readfd;
+	fd_set writefd;
+	int signal_fd;
+#ifdef _WITH_SNMP_
+	timeval_t snmp_timer_wait;
+	int snmpblock = 0;
+	int fdsetsize;
+#endif
+
+	FD_ZERO(&readfd);
+	FD_ZERO(&writefd);
+	for (i = 0; i < m->read.count; i++)
+		FD_SET(m->read.nodes[i]->u.fd, &readfd);
+	for (i = 0; i < m->write.count; i++)
+		FD_SET(m->write.nodes[i]->u.fd, &writefd);
 
 	signal_fd = signal_rfd();
 	if (signal_fd != -1)
@@ -772,13 +1630,13 @@ retry:	/* When thread can't fetch try to find next thread again. */
 	 * is still set to 0. */
 	fdsetsize = FD_SETSIZE;
 	snmpblock = 0;
-	memcpy(&snmp_timer_wait, &timer_wait, sizeof(timeval_t));
+	memcpy(&snmp_timer_wait, timer_wait, sizeof(timeval_t));
 	snmp_select_info(&fdsetsize, &readfd, &snmp_timer_wait, &snmpblock);
 	if (snmpblock == 0)
-		memcpy(&timer_wait, &snmp_timer_wait, sizeof(timeval_t));
+		memcpy(timer_wait, &snmp_timer_wait, sizeof(timeval_t));
 #endif
 
-	ret = select(FD_SETSIZE, &readfd, &writefd, &exceptfd, &timer_wait);
+	ret = select(FD_SETSIZE, &readfd, &writefd, NULL, timer_wait);
 
 	/* we have to save errno here because the next syscalls will set it */
 	old_errno = errno;
@@ -795,120 +1653,230 @@ retry:	/* When thread can't fetch try to find next thread again. */
 		snmp_read(&readfd);
 	else if (ret == 0)
 		snmp_timeout();
+	run_alarms();
+	netsnmp_check_outstanding_agent_requests();
 #endif
 
 	/* handle signals synchronously, including child reaping */
-	if (ret > 0 && FD_ISSET(signal_fd, &readfd))
+	if (ret > 0 && signal_fd != -1 && FD_ISSET(signal_fd, &readfd))
 		signal_run_callback();
 
-	/* Update current time */
-	set_time_now();
+	if (ret > 0) {
+		/* thread_heap_delete() backfills the vacated slot, so only
+		 * advance when the current slot is kept */
+		i = 0;
+		while (i < m->read.count) {
+			t = m->read.nodes[i];
+			if (FD_ISSET(t->u.fd, &readfd) && t->type == THREAD_READ) {
+				if (t->persistent) {
+					/* Stays parked in the heap; the
+					 * callback re-arms the timeout */
+					thread_list_add(&m->ready[t->prio], t);
+					t->type = THREAD_READY_FD;
+					i++;
+					continue;
+				}
+				thread_fd_release(m, t->u.fd, true);
+				thread_heap_delete(&m->read, t);
+				thread_list_add(&m->ready[t->prio], t);
+				t->type = THREAD_READY_FD;
+			} else
+				i++;
+		}
+		i = 0;
+		while (i < m->write.count) {
+			t = m->write.nodes[i];
+			if (FD_ISSET(t->u.fd, &writefd)) {
+				thread_fd_release(m, t->u.fd, false);
+				thread_heap_delete(&m->write, t);
+				thread_list_add(&m->ready[t->prio], t);
+				t->type = THREAD_READY_FD;
+			} else
+				i++;
+		}
+	}
 
-	/* Timeout children */
-	thread = m->child.head;
-	while (thread) {
-		thread_t *t;
+	return ret;
+}
+#endif	/* _NO_EPOLL_ */
 
-		t = thread;
-		thread = t->next;
+/* Consecutive low priority threads dispatched before forcing a poll */
+#define THREAD_LO_BUDGET	8
 
-		if (timer_cmp(time_now, t->sands) >= 0) {
-			thread_list_delete(&m->child, t);
-			thread_list_add(&m->ready, t);
-			if (child_remover)
-				child_remover(t);
-			t->type = THREAD_CHILD_TIMEOUT;
-		} else
-			break;
+/* Ready threads of any class dispatched before forcing a poll. A burst
+ * of completions (e.g. many checkers concluding at once) is run in
+ * slices of this size with a zero timeout poll in between, so fd events
+ * keep being collected before receive buffers overflow. */
+#define THREAD_READY_BUDGET	32
+
+/* Pick the next ready thread, a priority class at a time. Low priority
+ * work only runs when nothing else is ready, and is budgeted so a long
+ * backlog of it cannot starve the poller. */
+static thread_t *
+thread_ready_trim(thread_master_t * m)
+{
+	thread_t *thread;
+
+	if ((thread = thread_trim_head(&m->ready[THREAD_PRIO_HI])) ||
+	    (thread = thread_trim_head(&m->ready[THREAD_PRIO_NORM]))) {
+		m->lo_runs = 0;
+		return thread;
 	}
 
-	/* Read thead. */
-	thread = m->read.head;
-	timers_done = false;
-	while (thread) {
-		thread_t *t;
+	if (m->lo_runs >= THREAD_LO_BUDGET)
+		return NULL;
 
-		t = thread;
-		thread = t->next;
+	if ((thread = thread_trim_head(&m->ready[THREAD_PRIO_LO])))
+		m->lo_runs++;
 
-		if (ret > 0 && FD_ISSET(t->u.fd, &readfd)) {
-			assert(FD_ISSET(t->u.fd, &m->readfd));
-			FD_CLR(t->u.fd, &m->readfd);
-			thread_list_delete(&m->read, t);
-			thread_list_add(&m->ready, t);
-			t->type = THREAD_READY_FD;
-		} else if (!timers_done) {
-			if (timer_cmp(time_now, t->sands) >= 0) {
-				FD_CLR(t->u.fd, &m->readfd);
-				thread_list_delete(&m->read, t);
-				thread_list_add(&m->ready, t);
-				t->type = THREAD_READ_TIMEOUT;
-			}
-			else
-				timers_done = true;
-		}
+	return thread;
+}
+
+/* The caller dispatches a copy of the fetched thread. A persistent read
+ * registration reverts to its armed state instead of being recycled -
+ * it is still sitting in the fd table, the event engine and the read
+ * heap. */
+static void
+thread_ready_consumed(thread_master_t * m, thread_t * thread)
+{
+	if (thread->persistent) {
+		thread->type = THREAD_READ;
+		return;
 	}
 
-	/* Write thead. */
-	thread = m->write.head;
-	timers_done = false;
-	while (thread) {
-		thread_t *t;
+	thread->type = THREAD_UNUSED;
+	thread_add_unuse(m, thread);
+}
 
-		t = thread;
-		thread = t->next;
+/* Fetch next ready thread. */
+thread_t *
+thread_fetch(thread_master_t * m, thread_t * fetch)
+{
+	thread_t *thread;
+	timeval_t timer_wait;
+	unsigned depth;
 
-		if (ret > 0 && FD_ISSET(t->u.fd, &writefd)) {
-			assert(FD_ISSET(t->u.fd, &writefd));
-			FD_CLR(t->u.fd, &m->writefd);
-			thread_list_delete(&m->write, t);
-			thread_list_add(&m->ready, t);
-			t->type = THREAD_READY_FD;
-		} else if (!timers_done) {
-			if (timer_cmp(time_now, t->sands) >= 0) {
-				FD_CLR(t->u.fd, &m->writefd);
-				thread_list_delete(&m->write, t);
-				thread_list_add(&m->ready, t);
-				t->type = THREAD_WRITE_TIMEOUT;
-			}
-			else
-				timers_done = true;
+	assert(m != NULL);
+
+	/* Timer initialization */
+	memset(&timer_wait, 0, sizeof (timeval_t));
+
+retry:	/* When thread can't fetch try to find next thread again. */
+
+	/* If there is event process it first. */
+	while ((thread = thread_trim_head(&m->event))) {
+		*fetch = *thread;
+
+		/* If daemon hanging event is received return NULL pointer */
+		if (thread->type == THREAD_TERMINATE) {
+			thread->type = THREAD_UNUSED;
+			thread_add_unuse(m, thread);
+			return NULL;
 		}
+		thread->type = THREAD_UNUSED;
+		thread_add_unuse(m, thread);
+		return fetch;
 	}
-	/* Exception thead. */
-	/*... */
 
-	/* Timer update. */
-	thread = m->timer.head;
-	while (thread) {
-		thread_t *t;
+	/* If there is ready threads process them, within the drain budget */
+	while (m->ready_runs < THREAD_READY_BUDGET &&
+	       (thread = thread_ready_trim(m))) {
+		m->ready_runs++;
+		*fetch = *thread;
+		thread_ready_consumed(m, thread);
+		return fetch;
+	}
 
-		t = thread;
-		thread = t->next;
+	/*
+	 * Re-read the current time to get the maximum accuracy.
+	 * Calculate the wait timer. Take care of timeouted fd.
+	 */
+	set_time_now();
+	if (m->ready[THREAD_PRIO_HI].head || m->ready[THREAD_PRIO_NORM].head ||
+	    m->ready[THREAD_PRIO_LO].head) {
+		/* Ready work is still queued - its budget ran out. Just
+		 * collect whatever else became ready, don't sleep. */
+		timer_wait.tv_sec = timer_wait.tv_usec = 0;
+		m->ready_budget_polls++;
+	} else
+		thread_compute_timer(m, &timer_wait);
+
+	/* Wait for fd events. Ready fd threads are queued by thread_wait(). */
+	thread_wait(m, &timer_wait);
+	m->lo_runs = 0;
+	m->ready_runs = 0;
 
-		if (timer_cmp(time_now, t->sands) >= 0) {
-			thread_list_delete(&m->timer, t);
-			thread_list_add(&m->ready, t);
-			t->type = THREAD_READY;
-		} else
-			break;
+	/* Update current time */
+	set_time_now();
+
+	if (watchdog_pet_interval && time_now_us >= watchdog_next_pet)
+		scheduler_watchdog_pet();
+
+	/* Timeout children */
+	while ((thread = thread_heap_peek(&m->child)) &&
+	       timer_cmp(time_now, thread->sands) >= 0) {
+		thread_heap_delete(&m->child, thread);
+		htab_del(&m->child_pid_htab, (uint64_t)thread->u.c.pid);
+		thread_list_add(&m->ready[thread->prio], thread);
+		thread->type = THREAD_CHILD_TIMEOUT;
 	}
 
-	/* Return one event. */
-	thread = thread_trim_head(&m->ready);
+	/* Read timeouts */
+	while ((thread = thread_heap_peek(&m->read)) &&
+	       timer_cmp(time_now, thread->sands) >= 0) {
+		if (thread->persistent && thread->type != THREAD_READ) {
+			/* Fired and waiting for dispatch - hold the timeout
+			 * off until the callback has run and re-armed it */
+			thread_heap_delete(&m->read, thread);
+			thread->sands = timer_add_now_long(thread->timer);
+			thread_heap_insert(&m->read, thread);
+			continue;
+		}
+		/* A timed out persistent registration is torn down like a
+		 * one-shot - the callback re-registers if it wants more */
+		thread->persistent = false;
+		thread_fd_release(m, thread->u.fd, true);
+		thread_heap_delete(&m->read, thread);
+		thread_list_add(&m->ready[thread->prio], thread);
+		thread->type = THREAD_READ_TIMEOUT;
+	}
 
-#ifdef _WITH_SNMP_
-	run_alarms();
-	netsnmp_check_outstanding_agent_requests();
-#endif
+	/* Write timeouts */
+	while ((thread = thread_heap_peek(&m->write)) &&
+	       timer_cmp(time_now, thread->sands) >= 0) {
+		thread_fd_release(m, thread->u.fd, false);
+		thread_heap_delete(&m->write, thread);
+		thread_list_add(&m->ready[thread->prio], thread);
+		thread->type = THREAD_WRITE_TIMEOUT;
+	}
+
+	/* Timer update. */
+	timer_wheel_expire(m);
+	while ((thread = thread_heap_peek(&m->timer)) &&
+	       timer_cmp(time_now, thread->sands) >= 0) {
+		thread_heap_delete(&m->timer, thread);
+		thread_list_add(&m->ready[thread->prio], thread);
+		thread->type = THREAD_READY;
+	}
+
+	/* Track the deepest post-poll backlog for the stats dump */
+	depth = (unsigned)(m->ready[THREAD_PRIO_HI].count +
+			   m->ready[THREAD_PRIO_NORM].count +
+			   m->ready[THREAD_PRIO_LO].count);
+	if (depth > m->ready_depth_max)
+		m->ready_depth_max = depth;
+
+	/* Return one event. */
+	thread = thread_ready_trim(m);
+	if (thread)
+		m->ready_runs++;
 
 	/* There is no ready thread. */
 	if (!thread)
 		goto retry;
 
 	*fetch = *thread;
-	thread->type = THREAD_UNUSED;
-	thread_add_unuse(m, thread);
+	thread_ready_consumed(m, thread);
 
 	return fetch;
 }
@@ -935,21 +1903,14 @@ thread_child_handler(void * v, __attribute__ ((unused)) int unused)
 				permanent_vrrp_checker_error = report_child_status(status, pid, NULL);
 #endif
 
-			if (child_finder)
-				thread = child_finder(pid);
-			else {
-				for (thread = m->child.head; thread; thread = thread->next) {
-					if (pid == thread->u.c.pid)
-						break;
-				}
-			}
-
+			/* A pid we are not waiting on (e.g. reaped on
+			 * behalf of a library fork) mustn't stop us
+			 * draining the remaining exited children */
+			thread = htab_del(&m->child_pid_htab, (uint64_t)pid);
 			if (!thread)
-				return;
+				continue;
 
-			thread_list_delete(&m->child, thread);
-			if (child_remover)
-				child_remover(thread);
+			thread_heap_delete(&m->child, thread);
 
 			if (permanent_vrrp_checker_error)
 			{
@@ -963,7 +1924,7 @@ thread_child_handler(void * v, __attribute__ ((unused)) int unused)
 			{
 				thread->type = THREAD_READY;
 				thread->u.c.status = status;
-				thread_list_add(&m->ready, thread);
+				thread_list_add(&m->ready[thread->prio], thread);
 			}
 		}
 	}
@@ -979,11 +1940,40 @@ thread_get_id(void)
 }
 
 /* Call thread ! */
+/* Process CPU time in usec; wall minus this is time the callback spent
+ * blocked (I/O, page faults, preemption) rather than computing */
+static timeus_t
+thread_cpu_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts))
+		return 0;
+
+	return (timeus_t)ts.tv_sec * TIMER_HZ + (timeus_t)(ts.tv_nsec / 1000);
+}
+
 void
 thread_call(thread_t * thread)
 {
+	timeus_t before, after;
+	timeus_t cpu_before, cpu_after;
+
+	/* sands is on the monotonic clock, so a tracer can compute the
+	 * expiry-to-dispatch latency against its own timestamp */
+	TRACE_PROBE3(thread_run, thread->type, thread->func, timer_us(thread->sands));
+
 	thread->id = thread_get_id();
+
+	log_debug(LOG_SUBSYS_SCHED, "Scheduler: dispatching thread type %d", thread->type);
+
+	before = timer_us(timer_now_precise());
+	cpu_before = thread_cpu_us();
 	(*thread->func) (thread);
+	cpu_after = thread_cpu_us();
+	after = timer_us(timer_now_precise());
+
+	thread_account_callback(thread->func, after - before, cpu_after - cpu_before);
 }
 
 /* Our infinite scheduling loop */
@@ -994,6 +1984,8 @@ launch_scheduler(void)
 
 	signal_set(SIGCHLD, thread_child_handler, master);
 
+	scheduler_watchdog_init();
+
 	/*
 	 * Processing the master thread queues,
 	 * return and execute one ready thread.
@@ -1015,4 +2007,6 @@ launch_scheduler(void)
 #endif
 		thread_call(&thread);
 	}
+
+	thread_dump_lag_histogram();
 }
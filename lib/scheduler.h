@@ -31,20 +31,34 @@
 #include <errno.h>
 #include <syslog.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "timer.h"
 #include "list.h"
+#include "hashtab.h"
+
+/* Thread priority classes. Ready threads are dispatched a class at a
+ * time, so protocol deadlines are never queued behind housekeeping or
+ * observability work. Zero is the default class. */
+#define THREAD_PRIO_NORM	0	/* checkers, housekeeping */
+#define THREAD_PRIO_HI		1	/* protocol send/receive/timeout */
+#define THREAD_PRIO_LO		2	/* snmp/dbus/dump work */
+#define THREAD_PRIO_CLASSES	3
 
 /* Thread itself. */
 typedef struct _thread {
 	unsigned long id;
 	unsigned char type;		/* thread type */
+	unsigned char prio;		/* dispatch class, THREAD_PRIO_* */
 	struct _thread *next;		/* next pointer of the thread */
 	struct _thread *prev;		/* previous pointer of the thread */
+	unsigned heap_pos;		/* index in the owning timer heap */
 	struct _thread_master *master;	/* pointer to the struct thread_master. */
 	int (*func) (struct _thread *);	/* event function */
 	void *arg;			/* event argument */
 	timeval_t sands;		/* rest of time sands value. */
+	unsigned long timer;		/* registered timeout interval */
+	bool persistent;		/* read stays registered across fires */
 	union {
 		int val;		/* second argument of the event. */
 		int fd;			/* file descriptor in case of read/write. */
@@ -62,19 +76,64 @@ typedef struct _thread_list {
 	int count;
 } thread_list_t;
 
+/* 4-ary min-heap of threads, keyed on thread->sands. O(log n) insert
+ * and delete, O(1) peek of the next expiry. */
+typedef struct _thread_heap {
+	thread_t **nodes;
+	unsigned count;
+	unsigned size;
+} thread_heap_t;
+
+/* Hashed timer wheel for short-interval timers. Recurring checker and
+ * advert timers re-arm once per interval; parking them in a wheel makes
+ * each re-arm and cancel O(1) where the heap pays O(log n), which shows
+ * at high checker counts. The heap is kept for deadlines beyond the
+ * wheel horizon. */
+#define TIMER_WHEEL_SLOTS	256		/* power of two */
+
+typedef struct _timer_wheel {
+	thread_list_t slots[TIMER_WHEEL_SLOTS];	/* deadline tick hashed onto a slot */
+	unsigned long cursor;	/* absolute tick the wheel was last swept to */
+	unsigned count;		/* threads currently parked in the wheel */
+} timer_wheel_t;
+
+/* Grow-only slab of thread_t storage. The scheduler churns through a
+ * thread_t per event; carving them from slabs and recycling them via
+ * the unuse list means zero heap traffic in steady state. */
+typedef struct _thread_slab {
+	struct _thread_slab *next;
+	unsigned used;			/* entries carved so far */
+	/* cache-line aligned thread storage follows */
+} thread_slab_t;
+
+#define THREAD_SLAB_ENTRIES	256
+
 /* Master of the threads. */
 typedef struct _thread_master {
-	thread_list_t read;
-	thread_list_t write;
-	thread_list_t timer;
-	thread_list_t child;
+	thread_heap_t read;
+	thread_heap_t write;
+	thread_heap_t timer;
+	thread_heap_t child;
+	timer_wheel_t wheel;		/* short-interval timer threads */
 	thread_list_t event;
-	thread_list_t ready;
+	thread_list_t ready[THREAD_PRIO_CLASSES];	/* per priority class */
 	thread_list_t unuse;
-	list child_pid_index;
-	fd_set readfd;
-	fd_set writefd;
-	fd_set exceptfd;
+	unsigned lo_runs;		/* low priority threads run since the last poll */
+	unsigned ready_runs;		/* ready threads dispatched since the last poll */
+	unsigned ready_depth_max;	/* deepest ready backlog seen after a poll */
+	uint64_t ready_budget_polls;	/* polls forced by the drain budget before the backlog emptied */
+	hashtab_t child_pid_htab;	/* pid -> child thread, for reaping */
+#ifndef _NO_EPOLL_
+	int epoll_fd;		/* epoll instance the fd threads are registered with */
+	int signal_fd;		/* signal pipe fd currently registered with epoll */
+	int timer_fd;		/* CLOCK_MONOTONIC timerfd clocking the timer expiries */
+#endif
+	unsigned long *fd_read_bits;	/* bitmap of fds with a registered read thread */
+	unsigned long *fd_write_bits;	/* bitmap of fds with a registered write thread */
+	unsigned fd_bits_size;		/* number of longs in each fd bitmap */
+	thread_t **fd_read_thread;	/* fd-indexed dispatch table of read threads */
+	thread_t **fd_write_thread;	/* fd-indexed dispatch table of write threads */
+	thread_slab_t *slabs;		/* backing storage for all thread_t */
 	unsigned long alloc;
 } thread_master_t;
 
@@ -119,8 +178,6 @@ typedef enum {
 #define KEEPALIVED_EXIT_FATAL	(EXIT_FAILURE+1)
 #define KEEPALIVED_EXIT_CONFIG	(EXIT_FAILURE+2)
 
-#define DEFAULT_CHILD_FINDER ((void *)1)
-
 /* global vars exported */
 extern thread_master_t *master;
 #ifndef _DEBUG_
@@ -129,7 +186,6 @@ extern prog_type_t prog_type;		/* Parent/VRRP/Checker process */
 
 /* Prototypes. */
 extern void set_child_finder_name(char const * (*)(pid_t));
-extern void set_child_finder(void (*)(thread_t *), thread_t *(*)(pid_t), void (*)(thread_t *), bool (*)(size_t), void(*)(void), size_t);
 #ifndef _DEBUG_
 extern bool report_child_status(int, pid_t, const char *);
 #endif
@@ -138,13 +194,23 @@ extern thread_t *thread_add_terminate_event(thread_master_t *);
 extern void thread_cleanup_master(thread_master_t *);
 extern void thread_destroy_master(thread_master_t *);
 extern thread_t *thread_add_read(thread_master_t *, int (*func) (thread_t *), void *, int, unsigned long);
+extern thread_t *thread_add_read_persistent(thread_master_t *, int (*func) (thread_t *), void *, int, unsigned long);
+extern void thread_read_rearm(thread_t *, unsigned long);
 extern thread_t *thread_add_write(thread_master_t *, int (*func) (thread_t *), void *, int, unsigned long);
 extern thread_t *thread_add_timer(thread_master_t *, int (*func) (thread_t *), void *, unsigned long);
+extern thread_t *thread_add_timer_slack(thread_master_t *, int (*func) (thread_t *), void *, unsigned long, unsigned long);
+extern unsigned thread_timer_expire_arg(thread_master_t *, void *);
 extern thread_t *thread_add_child(thread_master_t *, int (*func) (thread_t *), void *, pid_t, unsigned long);
 extern thread_t *thread_add_event(thread_master_t *, int (*func) (thread_t *), void *, int);
+extern void thread_set_priority(thread_t *, unsigned char);
 extern int thread_cancel(thread_t *);
+extern void thread_cancel_arg(thread_master_t *, void *);
 extern thread_t *thread_fetch(thread_master_t *, thread_t *);
 extern void thread_call(thread_t *);
+extern void thread_dump_callback_acct(FILE *);
 extern void launch_scheduler(void);
+#ifdef _WITH_SNMP_
+extern void snmp_agent_mark_stale(void);
+#endif
 
 #endif
@@ -34,6 +34,7 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
 #include <errno.h>
 #ifndef _DEBUG_
 #define NDEBUG
@@ -78,6 +79,18 @@
 static void (*signal_handler_func[SIG_MAX]) (void *, int sig);
 static void *signal_v[SIG_MAX];
 
+/* Signals are delivered via a signalfd read by the scheduler. The
+ * handled signals stay blocked, so there is no async handler and a
+ * storm of signals (e.g. SIGCHLD from script children) is drained in
+ * batches of SIGFD_BATCH entries per read rather than one write/read
+ * syscall pair per signal. The self-pipe is kept as a fallback for
+ * kernels without signalfd support. */
+#define SIGFD_BATCH	32
+
+static int signal_fd = -1;
+static pid_t signal_fd_pid = -1;	/* Process that created signal_fd */
+static sigset_t sfd_sig;		/* Signals routed to the signalfd */
+
 static int signal_pipe[2] = { -1, -1 };
 
 /* Remember our initial signal disposition */
@@ -140,6 +153,18 @@ signal_handler(int sig)
 	}
 }
 
+/* After a fork the signalfd's file description, and hence its signal
+ * mask, is still shared with the parent. A child must drop its
+ * reference rather than update the mask under the parent's feet. */
+static void
+signal_fd_check_inherited(void)
+{
+	if (signal_fd != -1 && signal_fd_pid != getpid()) {
+		close(signal_fd);
+		signal_fd = -1;
+	}
+}
+
 /* Signal wrapper */
 void *
 signal_set(int signo, void (*func) (void *, int), void *v)
@@ -154,6 +179,8 @@ signal_set(int signo, void (*func) (void *, int), void *v)
 		return NULL;
 	}
 
+	signal_fd_check_inherited();
+
 	if (func == (void*)SIG_IGN || func == (void*)SIG_DFL) {
 		sig.sa_handler = (void*)func;
 
@@ -163,6 +190,11 @@ signal_set(int signo, void (*func) (void *, int), void *v)
 		func = NULL;
 		v = NULL;
 	}
+	else if (signal_fd != -1) {
+		/* The signal stays blocked and is read from the
+		 * signalfd, so the disposition is never invoked */
+		sig.sa_handler = SIG_DFL;
+	}
 	else
 		sig.sa_handler = signal_handler;
 	sigemptyset(&sig.sa_mask);
@@ -172,9 +204,9 @@ signal_set(int signo, void (*func) (void *, int), void *v)
 	/* Block the signal we are about to configure, to avoid
 	 * any race conditions while setting the handler and
 	 * parameter */
+	sigemptyset(&sset);
+	sigaddset(&sset, signo);
 	if (func != NULL) {
-		sigemptyset(&sset);
-		sigaddset(&sset, signo);
 		sigprocmask(SIG_BLOCK, &sset, NULL);
 
 		/* If we are the parent, remember what signals
@@ -187,11 +219,25 @@ signal_set(int signo, void (*func) (void *, int), void *v)
 	signal_handler_func[signo-1] = func;
 	signal_v[signo-1] = v;
 
+	if (signal_fd != -1) {
+		if (func != NULL)
+			sigaddset(&sfd_sig, signo);
+		else
+			sigdelset(&sfd_sig, signo);
+		signalfd(signal_fd, &sfd_sig, 0);
+	}
+
 	if (ret < 0)
 		return (SIG_ERR);
 
-	/* Release the signal */
-	if (func != NULL)
+	/* Release the signal, unless it is being delivered via the
+	 * signalfd, in which case it must remain blocked. A signal
+	 * no longer routed to the signalfd needs unblocking. */
+	if (func != NULL) {
+		if (signal_fd == -1)
+			sigprocmask(SIG_UNBLOCK, &sset, NULL);
+	}
+	else if (signal_fd != -1)
 		sigprocmask(SIG_UNBLOCK, &sset, NULL);
 
 	return ((osig.sa_flags & SA_SIGINFO) ? (void*)osig.sa_sigaction : (void*)osig.sa_handler);
@@ -238,6 +284,35 @@ open_signal_pipe(void)
 #endif
 }
 
+static void
+open_signal_fd(void)
+{
+	sigemptyset(&sfd_sig);
+	signal_fd = signalfd(-1, &sfd_sig, SFD_NONBLOCK | SFD_CLOEXEC);
+	signal_fd_pid = getpid();
+	if (signal_fd == -1) {
+		log_message(LOG_INFO, "signals: no signalfd, using self-pipe - %s", strerror(errno));
+		open_signal_pipe();
+	}
+}
+
+static void
+close_signal_fds(void)
+{
+	if (signal_fd != -1) {
+		close(signal_fd);
+		signal_fd = -1;
+	}
+	if (signal_pipe[0] != -1) {
+		close(signal_pipe[0]);
+		signal_pipe[0] = -1;
+	}
+	if (signal_pipe[1] != -1) {
+		close(signal_pipe[1]);
+		signal_pipe[1] = -1;
+	}
+}
+
 void
 signal_handler_init(void)
 {
@@ -245,7 +320,7 @@ signal_handler_init(void)
 	int sig;
 	struct sigaction act, oact;
 
-	open_signal_pipe();
+	open_signal_fd();
 
 	clear_signal_handler_addresses();
 
@@ -298,7 +373,14 @@ signal_handler_child_clear(void)
 			sigaction(sig, &act, NULL);
 	}
 
-	open_signal_pipe();
+	/* The parent's signals were blocked for signalfd delivery */
+	sigprocmask(SIG_UNBLOCK, &parent_sig, NULL);
+
+	/* Don't share the parent's signalfd/pipe - the underlying
+	 * file description, and hence its signal mask, is common to
+	 * both processes after fork() */
+	close_signal_fds();
+	open_signal_fd();
 
 	clear_signal_handler_addresses();
 }
@@ -321,11 +403,10 @@ signal_handlers_clear(void *state)
 void
 signal_handler_destroy(void)
 {
+	/* Clearing the handlers also unblocks any signals that were
+	 * routed to the signalfd, so do it before closing the fds */
 	signal_handlers_clear(SIG_IGN);
-	close(signal_pipe[1]);
-	close(signal_pipe[0]);
-	signal_pipe[1] = -1;
-	signal_pipe[0] = -1;
+	close_signal_fds();
 }
 
 /* Called prior to exec'ing a script. The script can reasonably
@@ -334,6 +415,7 @@ void
 signal_handler_script(void)
 {
 	struct sigaction ign, dfl;
+	sigset_t sset;
 	int sig;
 
 	ign.sa_handler = SIG_IGN;
@@ -349,11 +431,26 @@ signal_handler_script(void)
 		else if (sigismember(&dfl_sig, sig))
 			sigaction(sig, &dfl, NULL);
 	}
+
+	/* The signals we handle are blocked for signalfd delivery,
+	 * and the blocked mask survives exec - give the script the
+	 * standard one. Drop our reference to the signalfd too, as
+	 * its file description is shared with the parent. */
+	sigemptyset(&sset);
+	sigprocmask(SIG_SETMASK, &sset, NULL);
+
+	if (signal_fd != -1) {
+		close(signal_fd);
+		signal_fd = -1;
+	}
 }
 
 int
 signal_rfd(void)
 {
+	if (signal_fd != -1)
+		return signal_fd;
+
 	return(signal_pipe[0]);
 }
 
@@ -361,8 +458,24 @@ signal_rfd(void)
 void
 signal_run_callback(void)
 {
+	struct signalfd_siginfo siginfo[SIGFD_BATCH];
+	ssize_t len;
+	size_t i, num;
 	int sig;
 
+	if (signal_fd != -1) {
+		while ((len = read(signal_fd, siginfo, sizeof(siginfo))) > 0) {
+			num = (size_t)len / sizeof(siginfo[0]);
+			for (i = 0; i < num; i++) {
+				sig = (int)siginfo[i].ssi_signo;
+				if (sig >= 1 && sig <= SIG_MAX && signal_handler_func[sig-1])
+					signal_handler_func[sig-1](signal_v[sig-1], sig);
+			}
+		}
+
+		return;
+	}
+
 	while(read(signal_pipe[0], &sig, sizeof(int)) == sizeof(int)) {
 		if (sig >= 1 && sig <= SIG_MAX && signal_handler_func[sig-1])
 			signal_handler_func[sig-1](signal_v[sig-1], sig);
@@ -371,8 +484,16 @@ signal_run_callback(void)
 
 void signal_pipe_close(int min_fd)
 {
-	if (signal_pipe[0] && signal_pipe[0] >= min_fd)
+	if (signal_fd != -1 && signal_fd >= min_fd) {
+		close(signal_fd);
+		signal_fd = -1;
+	}
+	if (signal_pipe[0] != -1 && signal_pipe[0] >= min_fd) {
 		close(signal_pipe[0]);
-	if (signal_pipe[1] && signal_pipe[1] >= min_fd)
+		signal_pipe[0] = -1;
+	}
+	if (signal_pipe[1] != -1 && signal_pipe[1] >= min_fd) {
 		close(signal_pipe[1]);
+		signal_pipe[1] = -1;
+	}
 }
@@ -0,0 +1,165 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        Shared-memory statistics page. A versioned, fixed-layout
+ *              mmap'd file of named counter records. The daemon points
+ *              its hot-path counter structures into the page, so they
+ *              are exported to monitoring agents at the cost of the
+ *              stores the hot path was already doing.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "statspage.h"
+#include "memory.h"
+#include "logger.h"
+
+static stats_rec_t *
+stats_page_rec(const stats_page_t *page, unsigned idx)
+{
+	return (stats_rec_t *)((char *)page->hdr + sizeof(stats_page_hdr_t) +
+			       idx * page->rec_size);
+}
+
+/* Create (or truncate) the page file and map it. payload_size is the
+ * size of the counter structure each record exports. */
+stats_page_t *
+stats_page_create(const char *path, size_t payload_size, unsigned max_records)
+{
+	stats_page_t *page;
+	stats_page_hdr_t *hdr;
+	size_t rec_size, map_len;
+	void *map;
+	int fd;
+
+	/* Keep each record's payload 8-byte aligned */
+	rec_size = sizeof(stats_rec_t) + ((payload_size + 7) & ~(size_t)7);
+	map_len = sizeof(stats_page_hdr_t) + (size_t)max_records * rec_size;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_message(LOG_INFO, "Unable to create stats page %s (%d: %s)",
+			    path, errno, strerror(errno));
+		return NULL;
+	}
+
+	if (ftruncate(fd, (off_t)map_len) < 0) {
+		log_message(LOG_INFO, "Unable to size stats page %s (%d: %s)",
+			    path, errno, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_message(LOG_INFO, "Unable to map stats page %s (%d: %s)",
+			    path, errno, strerror(errno));
+		return NULL;
+	}
+
+	hdr = map;
+	memcpy(hdr->magic, STATS_PAGE_MAGIC, sizeof(hdr->magic));
+	hdr->version = STATS_PAGE_VERSION;
+	hdr->payload_size = (uint32_t)payload_size;
+	hdr->max_records = max_records;
+	hdr->used_records = 0;
+	hdr->pid = (uint32_t)getpid();
+	hdr->generation = 0;
+
+	page = (stats_page_t *) MALLOC(sizeof(stats_page_t));
+	page->hdr = hdr;
+	page->map_len = map_len;
+	page->rec_size = rec_size;
+	page->path = (char *) MALLOC(strlen(path) + 1);
+	strcpy(page->path, path);
+
+	return page;
+}
+
+/* Find the record with the given name, appending it if new. Returns a
+ * pointer to the record's payload, or NULL if the page is full. A found
+ * record keeps its counters - across a reload this is what preserves
+ * counter continuity. *existing tells the caller which case it got. */
+void *
+stats_page_record(stats_page_t *page, const char *name, bool *existing)
+{
+	stats_rec_t *rec;
+	unsigned i;
+
+	for (i = 0; i < page->hdr->used_records; i++) {
+		rec = stats_page_rec(page, i);
+		if (!strncmp(rec->name, name, sizeof(rec->name))) {
+			if (existing)
+				*existing = true;
+			return rec + 1;
+		}
+	}
+
+	if (page->hdr->used_records >= page->hdr->max_records)
+		return NULL;
+
+	rec = stats_page_rec(page, page->hdr->used_records);
+	rec->seq++;		/* odd - identity being written */
+	strncpy(rec->name, name, sizeof(rec->name) - 1);
+	rec->name[sizeof(rec->name) - 1] = '\0';
+	memset(rec + 1, 0, page->hdr->payload_size);
+	rec->seq++;		/* even - record valid */
+	page->hdr->used_records++;
+
+	if (existing)
+		*existing = false;
+	return rec + 1;
+}
+
+/* Does ptr point into the page's mapping? Used by the owners of the
+ * counter structures to tell page records from private allocations
+ * when freeing. */
+bool
+stats_page_contains(const stats_page_t *page, const void *ptr)
+{
+	if (!page)
+		return false;
+
+	return (const char *)ptr >= (const char *)page->hdr &&
+	       (const char *)ptr < (const char *)page->hdr + page->map_len;
+}
+
+void
+stats_page_close(stats_page_t **page_p, bool unlink_file)
+{
+	stats_page_t *page = *page_p;
+
+	if (!page)
+		return;
+
+	munmap(page->hdr, page->map_len);
+	if (unlink_file)
+		unlink(page->path);
+	FREE(page->path);
+	FREE(page);
+	*page_p = NULL;
+}
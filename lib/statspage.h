@@ -0,0 +1,84 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        statspage.c include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _STATSPAGE_H
+#define _STATSPAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Shared-memory statistics page.
+ *
+ * A fixed-layout file of named counter records, mmap'd MAP_SHARED by
+ * the daemon. The daemon's hot paths point their counter structures
+ * straight into the page, so every counter update is just the store
+ * it always was - a monitoring agent mmaps the file read-only and
+ * scrapes at any frequency with zero impact on the daemon.
+ *
+ * Reader contract:
+ *  - validate magic, version and payload_size before use;
+ *  - a record's seq is odd while its identity (name) is being
+ *    (re)assigned - re-read if seq is odd or changed across the copy;
+ *  - the counters themselves are naturally-aligned single-word stores
+ *    updated without any locking, so individual counters are always
+ *    consistent but a set of counters is only loosely coherent;
+ *  - records are never removed; after a reload, records belonging to
+ *    configuration that went away simply stop moving;
+ *  - generation changes whenever the owner re-publishes (daemon start
+ *    or reload) - re-enumerate the records when it does.
+ */
+
+#define STATS_PAGE_MAGIC	"KASTATS1"
+#define STATS_PAGE_VERSION	1
+#define STATS_REC_NAME_LEN	116
+
+typedef struct _stats_page_hdr {
+	char		magic[8];
+	uint32_t	version;	/* STATS_PAGE_VERSION */
+	uint32_t	payload_size;	/* counter bytes per record */
+	uint32_t	max_records;
+	uint32_t	used_records;
+	uint32_t	pid;		/* the writing daemon */
+	uint32_t	generation;	/* bumped by the owner on each (re)publish */
+} stats_page_hdr_t;
+
+typedef struct _stats_rec {
+	uint32_t	seq;		/* odd while the identity is being written */
+	char		name[STATS_REC_NAME_LEN];
+	/* payload_size bytes of counters follow, 8-byte aligned */
+} stats_rec_t;
+
+typedef struct _stats_page {
+	stats_page_hdr_t *hdr;
+	size_t		map_len;
+	size_t		rec_size;	/* sizeof(stats_rec_t) + aligned payload */
+	char		*path;
+} stats_page_t;
+
+/* prototypes */
+extern stats_page_t *stats_page_create(const char *, size_t, unsigned);
+extern void *stats_page_record(stats_page_t *, const char *, bool *);
+extern bool stats_page_contains(const stats_page_t *, const void *);
+extern void stats_page_close(stats_page_t **, bool);
+
+#endif
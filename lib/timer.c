@@ -29,6 +29,7 @@
 
 /* time_now holds current time */
 timeval_t time_now;
+timeus_t time_now_us;
 
 /* set a timer to a specific value */
 timeval_t
@@ -181,9 +182,9 @@ monotonic_gettimeofday(timeval_t *now)
 	return 0;
 }
 
-/* current time */
+/* current time, read fresh from the clock */
 timeval_t
-timer_now(void)
+timer_now_precise(void)
 {
 	timeval_t curr_time;
 	int old_errno = errno;
@@ -197,6 +198,20 @@ timer_now(void)
 	return curr_time;
 }
 
+/* current time, from the cache. set_time_now() refreshes the cache at
+ * least once per scheduler iteration, so the error is bounded by the
+ * dispatch time of the current batch of threads - cheap enough to call
+ * per instance on hot paths. Use timer_now_precise() where that error
+ * matters. */
+timeval_t
+timer_now(void)
+{
+	if (!timer_isnull(time_now))
+		return time_now;
+
+	return timer_now_precise();
+}
+
 /* sets and returns current time from system time */
 timeval_t
 set_time_now(void)
@@ -208,6 +223,7 @@ set_time_now(void)
 		timer_reset(time_now);
 		errno = old_errno;
 	}
+	time_now_us = timer_us(time_now);
 
 	return time_now;
 }
@@ -230,6 +246,17 @@ timer_add_now(timeval_t a)
 	return timer_add(time_now, a);
 }
 
+/* interval add to current time */
+timeval_t
+timer_add_now_long(unsigned long timer)
+{
+	/* Init current time if needed */
+	if (timer_isnull(time_now))
+		set_time_now();
+
+	return timer_add_long(time_now, timer);
+}
+
 /* Return time as unsigned long */
 unsigned long
 timer_tol(timeval_t a)
@@ -25,11 +25,19 @@
 
 #include <sys/time.h>
 #include <limits.h>
+#include <stdint.h>
 
 typedef struct timeval timeval_t;
 
+/* 64-bit microsecond scalar for hot-path deadlines. timeval compares
+ * go through the carry branches of timer_cmp(); as a single integer
+ * the compare is one op and the value can key heaps and wheels
+ * directly. */
+typedef uint64_t timeus_t;
+
 /* Global vars */
 extern timeval_t time_now;
+extern timeus_t time_now_us;	/* time_now on the timer_us() scale */
 
 /* Some defines */
 #define TIME_MAX_FORWARD_US	2000000U
@@ -38,10 +46,12 @@ extern timeval_t time_now;
 #define TIMER_CENTI_HZ		10000U
 #define TIMER_MAX_SEC		1000U
 #define TIMER_NEVER		ULONG_MAX
+#define TIMER_NEVER_US		UINT64_MAX
 
 /* Some usefull macros */
 #define timer_sec(T) ((T).tv_sec)
 #define timer_long(T) (unsigned long)(((T).tv_sec * TIMER_HZ + (T).tv_usec))
+#define timer_us(T) ((timeus_t)(T).tv_sec * TIMER_HZ + (timeus_t)(T).tv_usec)
 #define timer_isnull(T) ((T).tv_sec == 0 && (T).tv_usec == 0)
 #define timer_reset(T) (memset(&(T), 0, sizeof(timeval_t)))
 /* call this instead of timer_reset() when you intend to set
@@ -53,6 +63,7 @@ extern timeval_t time_now;
 
 /* prototypes */
 extern timeval_t timer_now(void);
+extern timeval_t timer_now_precise(void);
 extern timeval_t set_time_now(void);
 extern timeval_t timer_dup(timeval_t);
 extern int timer_cmp(timeval_t, timeval_t);
@@ -61,6 +72,7 @@ extern timeval_t timer_add(timeval_t, timeval_t);
 extern timeval_t timer_add_long(timeval_t, unsigned long);
 extern timeval_t timer_sub_now(timeval_t);
 extern timeval_t timer_add_now(timeval_t);
+extern timeval_t timer_add_now_long(unsigned long);
 extern unsigned long timer_tol(timeval_t);
 #ifdef _INCLUDE_UNUSED_CODE_
 extern void timer_dump(timeval_t);
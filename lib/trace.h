@@ -0,0 +1,59 @@
+/*
+ * Soft:        Keepalived is a failover program for the LVS project
+ *              <www.linuxvirtualserver.org>. It monitor & manipulate
+ *              a loadbalanced server pool using multi-layer checks.
+ *
+ * Part:        trace.h include file.
+ *
+ * Author:      Alexandre Cassen, <acassen@linux-vs.org>
+ *
+ *              This program is distributed in the hope that it will be useful,
+ *              but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *              MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *              See the GNU General Public License for more details.
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2001-2017 Alexandre Cassen, <acassen@gmail.com>
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Static tracepoints (USDT) under the "keepalived" provider. When
+ * sys/sdt.h is available each probe compiles to a single nop that
+ * perf/systemtap/bpftrace can arm at runtime, so production binaries
+ * can be traced without rebuilding and without measurable overhead.
+ * Keep probe arguments to plain variables or cheap expressions - they
+ * are materialised at the probe site even when it is disarmed. */
+
+#if defined __has_include
+# if __has_include(<sys/sdt.h>)
+#  define _HAVE_SYS_SDT_H_
+# endif
+#endif
+
+#ifdef _HAVE_SYS_SDT_H_
+
+#include <sys/sdt.h>
+
+#define TRACE_PROBE(name)		DTRACE_PROBE(keepalived, name)
+#define TRACE_PROBE1(name, a)		DTRACE_PROBE1(keepalived, name, a)
+#define TRACE_PROBE2(name, a, b)	DTRACE_PROBE2(keepalived, name, a, b)
+#define TRACE_PROBE3(name, a, b, c)	DTRACE_PROBE3(keepalived, name, a, b, c)
+#define TRACE_PROBE4(name, a, b, c, d)	DTRACE_PROBE4(keepalived, name, a, b, c, d)
+
+#else
+
+#define TRACE_PROBE(name)		do { } while (0)
+#define TRACE_PROBE1(name, a)		do { } while (0)
+#define TRACE_PROBE2(name, a, b)	do { } while (0)
+#define TRACE_PROBE3(name, a, b, c)	do { } while (0)
+#define TRACE_PROBE4(name, a, b, c, d)	do { } while (0)
+
+#endif
+
+#endif
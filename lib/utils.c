@@ -105,32 +105,65 @@ write_stacktrace(const char *file_name)
 }
 #endif
 
-/* Compute a checksum */
+/* Ones' complement addition with end-around carry */
+static inline uint64_t
+csum_add64(uint64_t sum, uint64_t w)
+{
+	sum += w;
+	return sum + (sum < w);
+}
+
+/* Compute a checksum.
+ *
+ * Ones' complement addition is associative and byte-order agnostic as
+ * long as the words are taken in memory order, so the bulk of the
+ * buffer is accumulated eight bytes at a time with end-around carry
+ * and only folded down to 16 bits at the end. The loop is also simple
+ * enough for the compiler to vectorize. */
 uint16_t
 in_csum(const uint16_t *addr, size_t len, uint32_t csum, uint32_t *acc)
 {
-	register size_t nleft = len;
-	const uint16_t *w = addr;
-	register uint16_t answer;
-	register uint32_t sum = csum;
+	const unsigned char *p = (const unsigned char *) addr;
+	uint64_t sum = csum;
+	uint64_t w = 0;
+	uint32_t w32 = 0;
+	uint16_t w16 = 0;
+	uint16_t answer;
+
+	while (len >= 8) {
+		memcpy(&w, p, sizeof(w));
+		sum = csum_add64(sum, w);
+		p += 8;
+		len -= 8;
+	}
 
-	/*
-	 *  Our algorithm is simple, using a 32 bit accumulator (sum),
-	 *  we add sequential 16 bit words to it, and at the end, fold
-	 *  back all the carry bits from the top 16 bits into the lower
-	 *  16 bits.
-	 */
-	while (nleft > 1) {
-		sum += *w++;
-		nleft -= 2;
+	if (len >= 4) {
+		memcpy(&w32, p, sizeof(w32));
+		sum = csum_add64(sum, w32);
+		p += 4;
+		len -= 4;
 	}
 
-	/* mop up an odd byte, if necessary */
-	if (nleft == 1)
-		sum += htons(*(u_char *) w << 8);
+	if (len >= 2) {
+		memcpy(&w16, p, sizeof(w16));
+		sum = csum_add64(sum, w16);
+		p += 2;
+		len -= 2;
+	}
+
+	/* mop up an odd byte, if necessary, padding with a zero byte */
+	if (len == 1) {
+		w16 = 0;
+		memcpy(&w16, p, 1);
+		sum = csum_add64(sum, w16);
+	}
+
+	/* fold to 32 bits for the partial sum the callers carry around */
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
 
 	if (acc)
-		*acc = sum;
+		*acc = (uint32_t)sum;
 
 	/*
 	 * add back carry outs from top 16 bits to low 16 bits
@@ -282,7 +315,7 @@ inet_ip6scopeid(uint32_t ifindex, struct sockaddr_storage *addr)
 }
 
 /* IP network to string representation */
-static char *
+char *
 inet_sockaddrtos2(struct sockaddr_storage *addr, char *addr_str)
 {
 	void *addr_ip;
@@ -301,12 +334,92 @@ inet_sockaddrtos2(struct sockaddr_storage *addr, char *addr_str)
 	return addr_str;
 }
 
+/* Small direct-mapped cache of formatted addresses. The hot logging
+ * and dump paths keep formatting the same stable addresses (real
+ * servers, VIPs); a hit returns the previously formatted string
+ * without running inet_ntop() or snprintf() again. Entries are
+ * overwritten on collision, so the returned string, like the static
+ * buffers it replaces, is only valid until a subsequent call. */
+enum addr_str_kind {
+	ADDR_STR_ADDR = 1,
+	ADDR_STR_PAIR,
+	ADDR_STR_TRIO
+};
+
+typedef struct {
+	struct sockaddr_storage	addr;
+	uint32_t		proto_kind;	/* protocol << 8 | format kind */
+	bool			used;
+	char			str[INET_SOCKADDR_TRIO_STRLEN];
+} addr_str_cache_entry_t;
+
+#define ADDR_STR_CACHE_SIZE	256	/* must be a power of two */
+static addr_str_cache_entry_t addr_str_cache[ADDR_STR_CACHE_SIZE];
+
+static bool
+addr_str_cache_cmp(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return false;
+
+	if (a->ss_family == AF_INET6) {
+		struct sockaddr_in6 *a6 = (struct sockaddr_in6 *) a;
+		struct sockaddr_in6 *b6 = (struct sockaddr_in6 *) b;
+
+		return a6->sin6_port == b6->sin6_port &&
+		       IN6_ARE_ADDR_EQUAL(&a6->sin6_addr, &b6->sin6_addr);
+	}
+
+	return ((struct sockaddr_in *) a)->sin_port == ((struct sockaddr_in *) b)->sin_port &&
+	       ((struct sockaddr_in *) a)->sin_addr.s_addr == ((struct sockaddr_in *) b)->sin_addr.s_addr;
+}
+
+static addr_str_cache_entry_t *
+addr_str_cache_get(struct sockaddr_storage *addr, uint32_t proto_kind, bool *hit)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const unsigned char *p;
+	size_t len;
+	addr_str_cache_entry_t *e;
+
+	if (addr->ss_family == AF_INET6) {
+		p = (const unsigned char *) &((struct sockaddr_in6 *) addr)->sin6_addr;
+		len = sizeof(struct in6_addr);
+	} else {
+		p = (const unsigned char *) &((struct sockaddr_in *) addr)->sin_addr;
+		len = sizeof(struct in_addr);
+	}
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	h ^= (uint64_t)addr->ss_family << 32 |
+	     (uint64_t)inet_sockaddrport(addr) << 16 | proto_kind;
+	h *= 0x100000001b3ULL;
+
+	e = &addr_str_cache[h & (ADDR_STR_CACHE_SIZE - 1)];
+	*hit = e->used && e->proto_kind == proto_kind &&
+	       addr_str_cache_cmp(&e->addr, addr);
+	if (!*hit) {
+		e->addr = *addr;
+		e->proto_kind = proto_kind;
+		e->used = true;
+	}
+
+	return e;
+}
+
 char *
 inet_sockaddrtos(struct sockaddr_storage *addr)
 {
-	static char addr_str[INET6_ADDRSTRLEN];
-	inet_sockaddrtos2(addr, addr_str);
-	return addr_str;
+	addr_str_cache_entry_t *e;
+	bool hit;
+
+	e = addr_str_cache_get(addr, ADDR_STR_ADDR, &hit);
+	if (!hit)
+		inet_sockaddrtos2(addr, e->str);
+	return e->str;
 }
 
 uint16_t
@@ -327,30 +440,56 @@ inet_sockaddrport(struct sockaddr_storage *addr)
 	return port;
 }
 
+/* Reentrant variant formatting into a caller buffer of at least
+ * INET_SOCKADDR_PAIR_STRLEN bytes */
 char *
-inet_sockaddrtopair(struct sockaddr_storage *addr)
+inet_sockaddrtopair_r(struct sockaddr_storage *addr, char *buf, size_t len)
 {
 	char addr_str[INET6_ADDRSTRLEN];
-	static char ret[sizeof(addr_str) + 8];	/* '[' + addr_str + ']' + ':' + 'nnnnn' */
 
 	inet_sockaddrtos2(addr, addr_str);
-	snprintf(ret, sizeof(ret) - 1, "[%s]:%d"
+	snprintf(buf, len, "[%s]:%d"
 		, addr_str
 		, ntohs(inet_sockaddrport(addr)));
-	return ret;
+	return buf;
 }
 
 char *
-inet_sockaddrtotrio(struct sockaddr_storage *addr, uint16_t proto)
+inet_sockaddrtopair(struct sockaddr_storage *addr)
+{
+	addr_str_cache_entry_t *e;
+	bool hit;
+
+	e = addr_str_cache_get(addr, ADDR_STR_PAIR, &hit);
+	if (!hit)
+		inet_sockaddrtopair_r(addr, e->str, sizeof(e->str));
+	return e->str;
+}
+
+/* Reentrant variant formatting into a caller buffer of at least
+ * INET_SOCKADDR_TRIO_STRLEN bytes */
+char *
+inet_sockaddrtotrio_r(struct sockaddr_storage *addr, uint16_t proto, char *buf, size_t len)
 {
 	char addr_str[INET6_ADDRSTRLEN];
-	static char ret[sizeof(addr_str) + 13];	/* '[' + addr_str + ']' + ':' + 'sctp' + ':' + 'nnnnn' */
 	char *proto_str = proto == IPPROTO_TCP ? "tcp" : proto == IPPROTO_UDP ? "udp" : proto == IPPROTO_SCTP ? "sctp" : proto == 0 ? "none" : "?";
 
 	inet_sockaddrtos2(addr, addr_str);
-	snprintf(ret, sizeof(ret) - 1, "[%s]:%s:%d" ,addr_str, proto_str,
+	snprintf(buf, len, "[%s]:%s:%d" ,addr_str, proto_str,
 		 ntohs(inet_sockaddrport(addr)));
-	return ret;
+	return buf;
+}
+
+char *
+inet_sockaddrtotrio(struct sockaddr_storage *addr, uint16_t proto)
+{
+	addr_str_cache_entry_t *e;
+	bool hit;
+
+	e = addr_str_cache_get(addr, ((uint32_t)proto << 8) | ADDR_STR_TRIO, &hit);
+	if (!hit)
+		inet_sockaddrtotrio_r(addr, proto, e->str, sizeof(e->str));
+	return e->str;
 }
 
 uint32_t
@@ -61,9 +61,16 @@ extern int inet_stosockaddr(char *, const char *, struct sockaddr_storage *);
 extern void inet_ip4tosockaddr(struct in_addr *, struct sockaddr_storage *);
 extern void inet_ip6tosockaddr(struct in6_addr *, struct sockaddr_storage *);
 extern void inet_ip6scopeid(uint32_t, struct sockaddr_storage *);
+/* Formatted address string lengths:
+ * pair: '[' + addr + ']' + ':' + 'nnnnn', trio adds ':' + 'sctp' */
+#define INET_SOCKADDR_PAIR_STRLEN	(INET6_ADDRSTRLEN + 8)
+#define INET_SOCKADDR_TRIO_STRLEN	(INET6_ADDRSTRLEN + 13)
 extern char *inet_sockaddrtos(struct sockaddr_storage *);
+extern char *inet_sockaddrtos2(struct sockaddr_storage *, char *);
 extern char *inet_sockaddrtopair(struct sockaddr_storage *);
+extern char *inet_sockaddrtopair_r(struct sockaddr_storage *, char *, size_t);
 extern char *inet_sockaddrtotrio(struct sockaddr_storage *, uint16_t);
+extern char *inet_sockaddrtotrio_r(struct sockaddr_storage *, uint16_t, char *, size_t);
 extern uint16_t inet_sockaddrport(struct sockaddr_storage *);
 extern uint32_t inet_sockaddrip4(struct sockaddr_storage *);
 extern int inet_sockaddrip6(struct sockaddr_storage *, struct in6_addr *);
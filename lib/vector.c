@@ -22,6 +22,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "vector.h"
 #include "memory.h"
 
@@ -67,9 +69,35 @@ vector_t *
 vector_alloc(void)
 {
 	vector_t *v = (vector_t *) MALLOC(sizeof(vector_t));
+
+	v->slot = v->inline_slot;
+	v->capacity = VECTOR_INLINE_SLOTS;
+
 	return v;
 }
 
+/* Ensure the slot array can hold at least size slots. Grown slots are
+ * zeroed, matching the initial allocation. */
+void
+vector_reserve(vector_t *v, unsigned int size)
+{
+	void **new_slot;
+
+	if (size <= v->capacity)
+		return;
+
+	if (v->slot == v->inline_slot) {
+		new_slot = (void **) MALLOC(sizeof(void *) * size);
+		memcpy(new_slot, v->inline_slot, sizeof(v->inline_slot));
+		v->slot = new_slot;
+	} else {
+		v->slot = REALLOC(v->slot, sizeof(void *) * size);
+		memset(&v->slot[v->capacity], 0, sizeof(void *) * (size - v->capacity));
+	}
+
+	v->capacity = size;
+}
+
 #ifdef _INCLUDE_UNUSED_CODE_
 vector_t *
 vector_init(unsigned int size)
@@ -87,15 +115,13 @@ vector_init(unsigned int size)
 }
 #endif
 
-/* allocated one slot */
+/* allocated one slot, doubling the array when it is full so appending
+ * N slots costs O(log N) reallocs instead of N */
 void
 vector_alloc_slot(vector_t *v)
 {
-	v->allocated += VECTOR_DEFAULT_SIZE;
-	if (v->slot)
-		v->slot = REALLOC(v->slot, sizeof (void *) * v->allocated);
-	else
-		v->slot = (void *) MALLOC(sizeof (void *) * v->allocated);
+	if (++v->allocated > v->capacity)
+		vector_reserve(v, v->capacity * 2);
 }
 
 #ifdef _INCLUDE_UNUSED_CODE_
@@ -285,7 +311,8 @@ vector_only_index_free(void *slot)
 void
 vector_free(vector_t *v)
 {
-	FREE(v->slot);
+	if (v->slot != v->inline_slot)
+		FREE(v->slot);
 	FREE(v);
 }
 
@@ -304,22 +331,14 @@ vector_dump(FILE *fp, vector_t *v)
 	}
 }
 
-/* String vector related */
+/* String vector related. alloc_strvec() tokens are slices into the
+ * caller's line buffer, so only the vector itself is owned here. */
 void
 free_strvec(vector_t *strvec)
 {
-	unsigned int i;
-	char *str;
-
 	if (!strvec)
 		return;
 
-	for (i = 0; i < vector_size(strvec); i++) {
-		if ((str = vector_slot(strvec, i)) != NULL) {
-			FREE(str);
-		}
-	}
-
 	vector_free(strvec);
 }
 
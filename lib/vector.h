@@ -26,11 +26,18 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+/* Slots stored inside the vector itself. Most vectors - strvec tokens,
+ * keyword parameter lists - never outgrow these, and so never touch
+ * the heap for their slot array. */
+#define VECTOR_INLINE_SLOTS 4
+
 /* vector definition */
 typedef struct _vector {
 	unsigned int	active;
-	unsigned int	allocated;
+	unsigned int	allocated;	/* slots in use */
+	unsigned int	capacity;	/* slots the array can hold */
 	void		**slot;
+	void		*inline_slot[VECTOR_INLINE_SLOTS];
 } vector_t;
 
 typedef char *(*null_strvec_handler_t)(const vector_t *, size_t);
@@ -53,6 +60,7 @@ extern null_strvec_handler_t register_null_strvec_handler(null_strvec_handler_t)
 extern null_strvec_handler_t unregister_null_strvec_handler(void);
 extern void *strvec_slot(const vector_t *strvec, size_t index);
 extern vector_t *vector_alloc(void);
+extern void vector_reserve(vector_t *, unsigned int);
 extern void vector_alloc_slot(vector_t *);
 extern void vector_set_slot(vector_t *, void *);
 extern void vector_unset(vector_t *, unsigned int);
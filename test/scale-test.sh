@@ -0,0 +1,327 @@
+#! /bin/bash
+
+# Usage:
+#  scale-test.sh [options]
+#
+# This script builds a scale-test topology of master/backup keepalived
+# pairs, each pair connected through its own bridge by veth links so that
+# VRIDs can be reused across pairs, then drives scripted failure events
+# (link down, process kill, packet loss) against every pair and reports
+# per-phase convergence times measured from VIP movement and state
+# transition counts collected from the instances' logs.
+#
+# A "pair" is two network namespaces, each running one keepalived process
+# with the same set of vrrp instances; the master side has the higher
+# priority. With -n 1000 -v 2 this exercises 2000 vrrp instances.
+
+DFLT_PAIRS=4
+DFLT_INSTANCES=1
+DFLT_KEEPALIVED=../bin/keepalived
+DFLT_WORKDIR=/tmp/keepalived-scale
+DFLT_TIMEOUT=30
+DFLT_LOSS=30
+DFLT_HOLD=15
+
+PAIRS=$DFLT_PAIRS
+INSTANCES=$DFLT_INSTANCES
+KEEPALIVED=$DFLT_KEEPALIVED
+WORKDIR=$DFLT_WORKDIR
+TIMEOUT=$DFLT_TIMEOUT
+LOSS=$DFLT_LOSS
+HOLD=$DFLT_HOLD
+IP=ip
+KEEP_TOPOLOGY=
+SKIP_PHASES=
+
+show_help()
+{
+	cat <<EOF
+$0 - Usage:
+	-h		Show this!
+	-n		number of master/backup pairs (default $DFLT_PAIRS)
+	-v		vrrp instances per process (default $DFLT_INSTANCES, max 255)
+	-k		keepalived binary to test (default $DFLT_KEEPALIVED)
+	-d		working directory for configs/logs/pids (default $DFLT_WORKDIR)
+	-t		per-phase convergence timeout in seconds (default $DFLT_TIMEOUT)
+	-l		packet loss percentage for the qdisc phase (default $DFLT_LOSS)
+	-w		hold time in seconds under packet loss (default $DFLT_HOLD)
+	-i		command to use instead of \`ip\`
+	-s		comma separated phases to skip (link,kill,loss)
+	-p		preserve topology and processes on exit (for inspection)
+EOF
+}
+
+while getopts ":hn:v:k:d:t:l:w:i:s:p" opt; do
+	case $opt in
+	h)
+		show_help
+		exit 0
+		;;
+	n)
+		PAIRS=$OPTARG
+		;;
+	v)
+		INSTANCES=$OPTARG
+		;;
+	k)
+		KEEPALIVED=$OPTARG
+		;;
+	d)
+		WORKDIR=$OPTARG
+		;;
+	t)
+		TIMEOUT=$OPTARG
+		;;
+	l)
+		LOSS=$OPTARG
+		;;
+	w)
+		HOLD=$OPTARG
+		;;
+	i)
+		IP=$OPTARG
+		;;
+	s)
+		SKIP_PHASES=",$OPTARG,"
+		;;
+	p)
+		KEEP_TOPOLOGY=yes
+		;;
+	?)
+		echo Unknown option \'$OPTARG\' && show_help && exit 1
+		;;
+	esac
+done
+
+[[ ! -x $KEEPALIVED ]] && echo Cannot execute keepalived binary $KEEPALIVED && exit 1
+[[ $INSTANCES -gt 255 ]] && echo At most 255 instances per pair \(VRID range\) && exit 1
+[[ $(id -u) -ne 0 ]] && echo Must be run as root && exit 1
+
+# Namespace/interface naming. Bridge and the root-side veth ends live in
+# the default namespace so link state and qdiscs can be manipulated from
+# here; the peer ends are moved into the pair's namespaces.
+#   pair $i: ns ksm$i (master), ksb$i (backup), bridge kbr$i,
+#            root-side ports kpm$i and kpb$i.
+ns_master() { echo ksm$1; }
+ns_backup() { echo ksb$1; }
+
+# Per-pair /24 out of 10.210/16 for the interface addresses, VIPs at
+# .100 + instance number. Pair numbers wrap at 255 to stay within the
+# second octet; addresses never leave the pair's bridge so reuse is fine.
+pair_net() { echo 10.210.$(($1 % 255)); }
+
+now() { date +%s.%N; }
+
+elapsed() { echo "$(now) $1" | awk '{ printf "%.2f", $1 - $2 }'; }
+
+log_phase() { echo; echo "=== $* ==="; }
+
+cleanup()
+{
+	[[ -n $KEEP_TOPOLOGY ]] && echo Topology preserved in namespaces ksm\*/ksb\* && exit
+
+	for i in $(seq 1 $PAIRS); do
+		destroy_pair $i
+	done
+	pkill -9 -f "$KEEPALIVED .*$WORKDIR" 2>/dev/null
+}
+
+trap cleanup EXIT
+
+# Delete the veth ports before the namespaces: namespace teardown is
+# asynchronous in the kernel and a lingering old veth would make the
+# next ip link add fail with EEXIST.
+destroy_pair()
+{
+	local i=$1
+
+	$IP link del kpm$i 2>/dev/null
+	$IP link del kpb$i 2>/dev/null
+	$IP link del kbr$i 2>/dev/null
+	$IP netns del $(ns_master $i) 2>/dev/null
+	$IP netns del $(ns_backup $i) 2>/dev/null
+}
+
+create_pair()
+{
+	local i=$1 net=$(pair_net $1)
+
+	$IP link add kbr$i type bridge
+	$IP link set up kbr$i
+
+	for side in m b; do
+		local ns=ks$side$i
+		$IP netns add $ns
+		$IP link add kp$side$i type veth peer name eth0 netns $ns
+		$IP link set kp$side$i master kbr$i
+		$IP link set up kp$side$i
+		$IP netns exec $ns $IP link set up lo
+		$IP netns exec $ns $IP link set up eth0
+	done
+	$IP netns exec $(ns_master $i) $IP addr add $net.1/24 dev eth0
+	$IP netns exec $(ns_backup $i) $IP addr add $net.2/24 dev eth0
+}
+
+gen_config()
+{
+	local i=$1 side=$2 prio=$3 conf=$4 net=$(pair_net $1) j
+
+	{
+	echo "global_defs {"
+	echo "	router_id scale-$side$i"
+	echo "}"
+	for j in $(seq 1 $INSTANCES); do
+		echo "vrrp_instance SI_$j {"
+		echo "	state BACKUP"
+		echo "	interface eth0"
+		echo "	virtual_router_id $j"
+		echo "	priority $prio"
+		echo "	advert_int 1"
+		echo "	virtual_ipaddress {"
+		echo "		$net.$((100 + j))/24"
+		echo "	}"
+		echo "}"
+	done
+	} > $conf
+}
+
+start_instance()
+{
+	local i=$1 side=$2
+	# Separate line: $side must be the local one, not the caller's
+	local ns=ks$side$i conf=$WORKDIR/$side$i.conf log=$WORKDIR/$side$i.log
+
+	$IP netns exec $ns $KEEPALIVED -n -l -P -f $conf \
+		-p $WORKDIR/$side$i.pid -r $WORKDIR/$side$i-vrrp.pid \
+		> $log 2>&1 &
+}
+
+# Wait until all of a pair's VIPs are held (or not held) in a namespace.
+# Prints nothing; caller times the call.
+wait_vips()
+{
+	local ns=$1 want=$2 begun=$SECONDS
+	local net=$(pair_net $3) held
+
+	while :; do
+		held=$($IP netns exec $ns $IP -4 addr show eth0 2>/dev/null | grep -c " $net\.1[0-9][0-9]/24")
+		[[ $want = yes && $held -eq $INSTANCES ]] && return 0
+		[[ $want = no && $held -eq 0 ]] && return 0
+		[[ $((SECONDS - begun)) -ge $TIMEOUT ]] && return 1
+		sleep 0.1
+	done
+}
+
+# Run "wait for VIPs on $2 of every pair" and report min/avg/max elapsed.
+# $1 names the phase for the report; per-pair waits run sequentially so
+# max is the honest figure, min/avg show the spread.
+measure_convergence()
+{
+	local phase=$1 side=$2 start times= failed=0 i t
+
+	for i in $(seq 1 $PAIRS); do
+		start=$(now)
+		if wait_vips ks$side$i yes $i; then
+			t=$(elapsed $start)
+			times="$times $t"
+		else
+			failed=$((failed + 1))
+		fi
+	done
+
+	if [[ $failed -gt 0 ]]; then
+		echo "$phase: $failed/$PAIRS pairs FAILED to converge within ${TIMEOUT}s"
+		RESULT=1
+	else
+		echo -n "$phase: "
+		echo $times | tr ' ' '\n' | \
+			awk '{ s += $1; if (NR == 1 || $1 < min) min = $1;
+			       if ($1 > max) max = $1 }
+			     END { printf "converged %d pairs  min %.2fs  avg %.2fs  max %.2fs\n",
+				   NR, min, s / NR, max }'
+	fi
+}
+
+transition_counts()
+{
+	local i total=0
+
+	for i in $(seq 1 $PAIRS); do
+		total=$((total + $(grep -c "Entering MASTER STATE" $WORKDIR/m$i.log) \
+			       + $(grep -c "Entering MASTER STATE" $WORKDIR/b$i.log)))
+	done
+	echo $total
+}
+
+RESULT=0
+rm -rf $WORKDIR
+mkdir -p $WORKDIR
+
+log_phase Building $PAIRS pair topology \($((PAIRS * 2)) namespaces, $((PAIRS * 2 * INSTANCES)) vrrp instances\)
+for i in $(seq 1 $PAIRS); do
+	destroy_pair $i
+	create_pair $i
+	gen_config $i m 200 $WORKDIR/m$i.conf
+	gen_config $i b 100 $WORKDIR/b$i.conf
+done
+
+log_phase Phase 1: startup convergence
+for i in $(seq 1 $PAIRS); do
+	start_instance $i m
+	start_instance $i b
+done
+measure_convergence startup m
+BASE_TRANSITIONS=$(transition_counts)
+
+if [[ ! $SKIP_PHASES =~ ",link," ]]; then
+	log_phase Phase 2: link-down failover \(master port down\)
+	for i in $(seq 1 $PAIRS); do
+		$IP link set down kpm$i
+	done
+	measure_convergence link-down b
+
+	# Restore the links and let the masters preempt back before the
+	# next phase so every pair starts from the same state.
+	for i in $(seq 1 $PAIRS); do
+		$IP link set up kpm$i
+	done
+	measure_convergence link-restore m
+fi
+
+if [[ ! $SKIP_PHASES =~ ",kill," ]]; then
+	log_phase Phase 3: process-kill failover \(master killed\)
+	for i in $(seq 1 $PAIRS); do
+		kill -9 $(cat $WORKDIR/m$i.pid) 2>/dev/null
+	done
+	measure_convergence process-kill b
+
+	for i in $(seq 1 $PAIRS); do
+		start_instance $i m
+	done
+	measure_convergence master-restart m
+fi
+
+if [[ ! $SKIP_PHASES =~ ",loss," ]]; then
+	log_phase Phase 4: $LOSS% packet loss on master ports for ${HOLD}s
+	if ! tc qdisc add dev kpm1 root netem loss $LOSS% 2>/dev/null; then
+		echo "packet-loss: netem qdisc not available on this kernel - skipped"
+	else
+		PRE_LOSS=$(transition_counts)
+		for i in $(seq 2 $PAIRS); do
+			tc qdisc add dev kpm$i root netem loss $LOSS%
+		done
+		sleep $HOLD
+		for i in $(seq 1 $PAIRS); do
+			tc qdisc del dev kpm$i root
+		done
+		FLAPS=$(($(transition_counts) - PRE_LOSS))
+		echo "packet-loss: $FLAPS state transitions across $PAIRS pairs during hold"
+		measure_convergence loss-recovery m
+	fi
+fi
+
+log_phase Summary
+echo "Total MASTER transitions: $(transition_counts) (startup baseline $BASE_TRANSITIONS)"
+echo "Logs and configs are in $WORKDIR"
+[[ $RESULT -eq 0 ]] && echo PASS || echo FAIL
+exit $RESULT
@@ -1,6 +1,34 @@
+/*
+ * Checker load harness.
+ *
+ * Historically this was a minimal accept-and-sleep server used for
+ * exercising TCP_CHECK by hand.  It has grown into a backend simulator
+ * for load testing the checker daemon: one process simulates many
+ * listening backends on consecutive ports (SO_REUSEPORT + epoll), with
+ * configurable response latency, response bodies, failure injection
+ * and per-backend flap schedules.  Point a keepalived configuration
+ * with thousands of (vs,rs) pairs at it to measure checker throughput,
+ * verdict latency and event-loop headroom.
+ *
+ * Build:  cc -O2 -o tcp_server tcp_server.c
+ *
+ * Examples:
+ *   Simulate 4000 backends on ports 30080-34079, replying after
+ *   2-20ms with a small HTTP response, dropping 1% of connections
+ *   and flapping each backend 60s up / 10s down:
+ *     tcp_server -4 -n 4000 -l 2-20 -H -f 1 -F 60,10
+ *
+ *   Legacy behaviour (accept, hold 1s, close):
+ *     tcp_server -p 30080
+ */
+
+#define _GNU_SOURCE	/* accept4() */
+
 #include <strings.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -8,24 +36,322 @@
 #include <signal.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
 
-int main(int argc, char **argv)
+#define EV_LISTEN	0
+#define EV_CONN		1
+
+struct backend {
+	int type;		/* EV_LISTEN */
+	int idx;
+	int port;
+	int lfd;		/* -1 while flapped down */
+	int64_t next_flap;	/* ms, 0 if no flap schedule */
+	uint64_t accepted;
+};
+
+struct conn {
+	int type;		/* EV_CONN */
+	int fd;
+	struct backend *be;
+	int64_t deadline;	/* ms, when to send the response */
+	struct conn *next;
+	struct conn *prev;
+};
+
+static int family = AF_INET6;
+static int base_port = 30080;
+static int num_backends = 1;
+static int lat_min_ms = 1000;	/* legacy accept-then-sleep(1) behaviour */
+static int lat_max_ms = 1000;
+static int fail_rate = 0;	/* percent of connections to kill unanswered */
+static bool fail_rst = false;	/* kill with RST rather than FIN */
+static int flap_up_s = 0;
+static int flap_down_s = 0;
+static bool http_mode = false;
+static int body_len = 0;
+static const char *body_str = NULL;
+static bool silent = false;
+
+static int epfd;
+static struct backend *backends;
+static struct conn conns;	/* doubly linked list head */
+static uint64_t total_accepted;
+static uint64_t total_failed;
+
+static int64_t
+now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static int
+open_listener(int port)
+{
+	struct sockaddr_in servaddr;
+	struct sockaddr_in6 servaddr6;
+	int fd;
+	int one = 1;
+
+	fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+	if (family == AF_INET) {
+		bzero(&servaddr, sizeof(servaddr));
+		servaddr.sin_family = AF_INET;
+		servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		servaddr.sin_port = htons(port);
+
+		if (bind(fd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
+			perror("bind");
+			close(fd);
+			return -1;
+		}
+	}
+	else {
+		bzero(&servaddr6, sizeof(servaddr6));
+		servaddr6.sin6_family = AF_INET6;
+		servaddr6.sin6_addr = in6addr_any;
+		servaddr6.sin6_port = htons(port);
+
+		if (bind(fd, (struct sockaddr *)&servaddr6, sizeof(servaddr6)) < 0) {
+			perror("bind");
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (listen(fd, 1024) < 0) {
+		perror("listen");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void
+conn_close(struct conn *c)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->prev->next = c->next;
+	c->next->prev = c->prev;
+	free(c);
+}
+
+static void
+conn_respond(struct conn *c)
+{
+	char hdr[256];
+	char *body;
+	int len;
+
+	if (http_mode) {
+		len = snprintf(hdr, sizeof(hdr),
+			       "HTTP/1.0 200 OK\r\n"
+			       "Content-Type: text/plain\r\n"
+			       "Content-Length: %d\r\n"
+			       "\r\n", body_len);
+		send(c->fd, hdr, len, MSG_NOSIGNAL | (body_len ? MSG_MORE : 0));
+	}
+
+	if (body_len) {
+		if (body_str)
+			send(c->fd, body_str, body_len, MSG_NOSIGNAL);
+		else {
+			body = malloc(body_len);
+			memset(body, 'x', body_len);
+			send(c->fd, body, body_len, MSG_NOSIGNAL);
+			free(body);
+		}
+	}
+
+	conn_close(c);
+}
+
+static void
+backend_accept(struct backend *be)
+{
+	struct epoll_event ev;
+	struct conn *c;
+	int fd;
+	int span;
+
+	for (;;) {
+		fd = accept4(be->lfd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0)
+			return;
+
+		be->accepted++;
+		total_accepted++;
+		if (!silent)
+			printf("backend %d (port %d): connection %llu\n",
+			       be->idx, be->port,
+			       (unsigned long long)be->accepted);
+
+		if (fail_rate && rand() % 100 < fail_rate) {
+			struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+
+			if (fail_rst)
+				setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+			close(fd);
+			total_failed++;
+			continue;
+		}
+
+		c = malloc(sizeof(*c));
+		c->type = EV_CONN;
+		c->fd = fd;
+		c->be = be;
+
+		span = lat_max_ms - lat_min_ms;
+		c->deadline = now_ms() + lat_min_ms + (span ? rand() % (span + 1) : 0);
+
+		c->next = conns.next;
+		c->prev = &conns;
+		conns.next->prev = c;
+		conns.next = c;
+
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+static void
+backend_flap(struct backend *be, int64_t now)
+{
+	struct epoll_event ev;
+
+	if (be->lfd >= 0) {
+		/* Going down - stop listening so new probes get RSTs.
+		 * In-flight connections are left to run out. */
+		epoll_ctl(epfd, EPOLL_CTL_DEL, be->lfd, NULL);
+		close(be->lfd);
+		be->lfd = -1;
+		be->next_flap = now + (int64_t)flap_down_s * 1000;
+		if (!silent)
+			printf("backend %d (port %d): down\n", be->idx, be->port);
+	}
+	else {
+		be->lfd = open_listener(be->port);
+		if (be->lfd >= 0) {
+			ev.events = EPOLLIN;
+			ev.data.ptr = be;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, be->lfd, &ev);
+		}
+		be->next_flap = now + (int64_t)flap_up_s * 1000;
+		if (!silent)
+			printf("backend %d (port %d): up\n", be->idx, be->port);
+	}
+}
+
+static void
+dump_stats(int sig)
+{
+	(void)sig;
+	fprintf(stderr, "accepted %llu, failure-injected %llu\n",
+		(unsigned long long)total_accepted,
+		(unsigned long long)total_failed);
+}
+
+static void
+udp_echo(int port)
 {
-	int family = AF_INET6;
-	int port = 30080;
-	int listenfd, connfd;
-	pid_t childpid;
-	socklen_t clilen;
 	struct sockaddr_in cliaddr, servaddr;
 	struct sockaddr_in6 cliaddr6, servaddr6;
-	char opt;
-	int sock_type = SOCK_STREAM;
-	int n;
+	socklen_t clilen;
 	char buf[128];
+	int fd;
+	int n;
+
+	fd = socket(family, SOCK_DGRAM, 0);
+
+	if (family == AF_INET) {
+		bzero(&servaddr, sizeof(servaddr));
+		servaddr.sin_family = AF_INET;
+		servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		servaddr.sin_port = htons(port);
+
+		bind(fd, (struct sockaddr *)&servaddr, sizeof(servaddr));
+	}
+	else {
+		bzero(&servaddr6, sizeof(servaddr6));
+		servaddr6.sin6_family = AF_INET6;
+		servaddr6.sin6_addr = in6addr_any;
+		servaddr6.sin6_port = htons(port);
+
+		bind(fd, (struct sockaddr *)&servaddr6, sizeof(servaddr6));
+	}
+
+	for (;;) {
+		if (family == AF_INET) {
+			clilen = sizeof (cliaddr);
+			n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr, &clilen);
+			sendto(fd, buf, n, 0, (struct sockaddr *)&cliaddr, clilen);
+		}
+		else {
+			clilen = sizeof (cliaddr6);
+			n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr6, &clilen);
+			sendto(fd, buf, n, 0, (struct sockaddr *)&cliaddr6, clilen);
+		}
+		if (!silent)
+			printf("Received %d bytes\n", n);
+	}
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		" -4              use IPv4 (default IPv6)\n"
+		" -6              use IPv6\n"
+		" -p port         first port (default 30080)\n"
+		" -n count        number of backends on consecutive ports (default 1)\n"
+		" -l min[-max]    response latency in ms, uniform over range (default 1000)\n"
+		" -H              send a minimal HTTP 200 response\n"
+		" -b bytes        response body length, filled with 'x' (default 0)\n"
+		" -B string       response body string\n"
+		" -f percent      close this percentage of connections unanswered\n"
+		" -R              use RST rather than FIN for injected failures\n"
+		" -F up,down      flap schedule in seconds, phase-shifted per backend\n"
+		" -s              silent - don't report connections\n"
+		" -u              UDP echo server on one port (legacy mode)\n"
+		"SIGUSR1 dumps accept/failure counters to stderr.\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event evs[256];
 	struct sigaction sa;
-	bool silent = false;
+	struct conn *c, *c_scan;
+	struct backend *be;
+	int64_t now, next;
+	int timeout;
+	int opt;
+	int nev;
+	int i;
+	char *p;
+	char drain[512];
+	ssize_t n;
+	bool udp_mode = false;
 
-	while ((opt = getopt(argc, argv, "46p:su")) != -1) {
+	while ((opt = getopt(argc, argv, "46p:n:l:Hb:B:f:RF:su")) != -1) {
 		switch (opt) {
 		case '4':
 			family = AF_INET;
@@ -34,83 +360,148 @@ int main(int argc, char **argv)
 			family = AF_INET6;
 			break;
 		case 'p':
-			port = atoi(optarg);
+			base_port = atoi(optarg);
+			break;
+		case 'n':
+			num_backends = atoi(optarg);
+			break;
+		case 'l':
+			lat_min_ms = atoi(optarg);
+			p = strchr(optarg, '-');
+			lat_max_ms = p ? atoi(p + 1) : lat_min_ms;
+			if (lat_max_ms < lat_min_ms)
+				usage(argv[0]);
+			break;
+		case 'H':
+			http_mode = true;
+			break;
+		case 'b':
+			body_len = atoi(optarg);
+			break;
+		case 'B':
+			body_str = optarg;
+			body_len = strlen(optarg);
+			break;
+		case 'f':
+			fail_rate = atoi(optarg);
+			break;
+		case 'R':
+			fail_rst = true;
+			break;
+		case 'F':
+			flap_up_s = atoi(optarg);
+			p = strchr(optarg, ',');
+			if (!p || flap_up_s <= 0 || atoi(p + 1) <= 0)
+				usage(argv[0]);
+			flap_down_s = atoi(p + 1);
 			break;
 		case 's':
 			silent = true;
 			break;
 		case 'u':
-			sock_type = SOCK_DGRAM;
+			udp_mode = true;
 			break;
 		default: /* '?' */
-			fprintf(stderr, "Usage: %s [-p port] [-4] [-6] [-s] [-u]\n", argv[0]);
-			exit(EXIT_FAILURE);
+			usage(argv[0]);
 		}
 	}
 
-	listenfd = socket(family, sock_type, 0);
+	if (udp_mode)
+		udp_echo(base_port);
 
-	if (family == AF_INET) {
-		bzero(&servaddr, sizeof(servaddr));
-		servaddr.sin_family = AF_INET;
-		servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-		servaddr.sin_port = htons(port);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+	sa.sa_handler = dump_stats;
+	sigaction(SIGUSR1, &sa, NULL);
 
-		bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr));
+	srand(getpid() ^ time(NULL));
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
 	}
-	else {
-		bzero(&servaddr6, sizeof(servaddr6));
-		servaddr6.sin6_family = AF_INET6;
-		servaddr6.sin6_addr = in6addr_any;
-		servaddr6.sin6_port = htons(port);
 
-		bind(listenfd, (struct sockaddr *)&servaddr6, sizeof(servaddr6));
+	conns.next = conns.prev = &conns;
+
+	backends = calloc(num_backends, sizeof(*backends));
+	now = now_ms();
+	for (i = 0; i < num_backends; i++) {
+		be = &backends[i];
+		be->type = EV_LISTEN;
+		be->idx = i;
+		be->port = base_port + i;
+		be->lfd = open_listener(be->port);
+		if (be->lfd < 0)
+			exit(EXIT_FAILURE);
+
+		evs[0].events = EPOLLIN;
+		evs[0].data.ptr = be;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, be->lfd, &evs[0]);
+
+		/* Phase-shift the flap schedule so the backends don't all
+		 * transition at once */
+		if (flap_up_s)
+			be->next_flap = now + (int64_t)(flap_up_s + flap_down_s) * 1000
+					      * i / num_backends + (int64_t)flap_up_s * 1000;
 	}
 
-	memset(&sa, 0, sizeof(sa));
-	sa.sa_handler = SIG_DFL;
-	sa.sa_flags = SA_NOCLDWAIT;
-	sigaction(SIGCHLD, &sa, NULL);
+	if (!silent)
+		printf("%d backend(s) on ports %d-%d\n",
+		       num_backends, base_port, base_port + num_backends - 1);
 
-	if (sock_type == SOCK_STREAM) {
-		listen(listenfd, 4);
+	for (;;) {
+		now = now_ms();
 
-		for (;;) {
-			if (family == AF_INET) {
-				clilen = sizeof (cliaddr);
-				connfd = accept(listenfd, (struct sockaddr *)&cliaddr, &clilen);
-			}
-			else {
-				clilen = sizeof (cliaddr6);
-				connfd = accept(listenfd, (struct sockaddr *)&cliaddr6, &clilen);
-			}
+		/* Respond to connections whose latency has elapsed */
+		for (c = conns.prev; c != &conns; c = c_scan) {
+			c_scan = c->prev;
+			if (c->deadline <= now)
+				conn_respond(c);
+		}
 
-			if (!silent)
-				printf("Received connection\n");
-			if ((childpid = fork()) == 0) {
-				close(listenfd);
-				sleep (1);
-				exit(0);
-			}
+		/* Run the flap schedules */
+		next = INT64_MAX;
+		for (i = 0; i < num_backends; i++) {
+			be = &backends[i];
+			if (!be->next_flap)
+				continue;
+			if (be->next_flap <= now)
+				backend_flap(be, now);
+			if (be->next_flap < next)
+				next = be->next_flap;
+		}
+
+		for (c = conns.prev; c != &conns; c = c->prev)
+			if (c->deadline < next)
+				next = c->deadline;
 
-			close(connfd);
+		timeout = next == INT64_MAX ? -1 :
+			  next <= now ? 0 : (int)(next - now);
+
+		nev = epoll_wait(epfd, evs, sizeof(evs) / sizeof(evs[0]), timeout);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
 		}
-	}
-	else
-	{
-		for (;;) {
-			clilen = sizeof(cliaddr);
-			if (family == AF_INET) {
-				clilen = sizeof (cliaddr);
-				n = recvfrom(listenfd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr, &clilen);
-				sendto(listenfd, buf, n, 0, (struct sockaddr *)&cliaddr, clilen);
-			}
-			else {
-				clilen = sizeof (cliaddr6);
-				sendto(listenfd, buf, n, 0, (struct sockaddr *)&cliaddr6, clilen);
+
+		for (i = 0; i < nev; i++) {
+			if (*(int *)evs[i].data.ptr == EV_LISTEN) {
+				backend_accept(evs[i].data.ptr);
+				continue;
 			}
-			if (!silent)
-				printf("Received %d bytes\n", n);
+
+			/* Checkers don't usually send anything on a plain
+			 * TCP_CHECK; drain whatever arrives and treat
+			 * hangup as the peer losing interest */
+			c = evs[i].data.ptr;
+			n = recv(c->fd, drain, sizeof(drain), 0);
+			if ((n <= 0 && !(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) ||
+			    (evs[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+				conn_close(c);
 		}
 	}
 }